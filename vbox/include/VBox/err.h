@@ -576,6 +576,11 @@
 #define VERR_PGM_PHYS_NULL_PAGE_PARAM           (-1681)
 /** PCI passthru is not supported by this build. */
 #define VERR_PGM_PCI_PASSTHRU_MISCONFIG         (-1682)
+/** The saved state defers RAM pages to a post-copy source, but none has been
+ * registered. */
+#define VERR_PGM_POST_COPY_NOT_REGISTERED       (-1683)
+/** A post-copy page could not be fetched from the source. */
+#define VERR_PGM_POST_COPY_PAGE_UNAVAILABLE     (-1684)
 /** @} */
 
 
@@ -927,6 +932,8 @@
 #define VERR_TM_TSC_ALREADY_PAUSED          (-2210)
 /** Invalid value for cVirtualTicking.  */
 #define VERR_TM_VIRTUAL_TICKING_IPE         (-2211)
+/** The active timer heap of the queue is full, the timer was not armed. */
+#define VERR_TM_TIMER_HEAP_FULL             (-2212)
 /** @} */
 
 
@@ -135,8 +135,12 @@ typedef struct INTNETBUF
     STAMCOUNTER     cStatLost;
     /** Number of bad frames (both rings). */
     STAMCOUNTER     cStatBadFrames;
-    /** Reserved for future use. */
-    STAMCOUNTER     aStatReserved[2];
+    /** Number of unicast frames sent by this interface which were switched
+     * using the MAC address hash. */
+    STAMCOUNTER     cStatSwitchHashed;
+    /** Number of unicast frames sent by this interface which were switched by
+     * scanning the whole MAC address table. */
+    STAMCOUNTER     cStatSwitchScanned;
     /** Reserved for future send profiling. */
     STAMPROFILE     StatSend1;
     /** Reserved for future send profiling. */
@@ -557,6 +557,22 @@ typedef struct VBOXHDDBACKEND
     DECLR3CALLBACKMEMBER(int, pfnRepair, (const char *pszFilename, PVDINTERFACE pVDIfsDisk,
                                           PVDINTERFACE pVDIfsImage, uint32_t fFlags));
 
+    /**
+     * Returns whether the range starting at the given offset is allocated in
+     * this image without reading any data. Used to skip unallocated ranges when
+     * merging images. Optional, may be NULL.
+     *
+     * @returns VBox status code.
+     * @returns VERR_VD_BLOCK_FREE if the range is not allocated in this image.
+     * @param   pBackendData    Opaque state data for this image.
+     * @param   uOffset         Offset of the range, multiple of 512.
+     * @param   cbRange         Maximum size of the range.
+     * @param   pcbSame         Where to store the size of the range starting at
+     *                          uOffset which has the same allocation state.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnQueryAllocation, (void *pBackendData, uint64_t uOffset,
+                                                   uint64_t cbRange, uint64_t *pcbSame));
+
 } VBOXHDDBACKEND;
 
 /** Pointer to VD backend. */
@@ -471,6 +471,16 @@ VBOXDDU_DECL(int) VDInit(void);
  */
 VBOXDDU_DECL(int) VDShutdown(void);
 
+/**
+ * Sets the memory budget shared by the metadata table caches (L2 tables,
+ * grain tables) of all open images in the process. The least recently used
+ * tables of any image are evicted when the budget is exhausted.
+ *
+ * @returns VBox status code.
+ * @param   cbBudget        The new budget in bytes.
+ */
+VBOXDDU_DECL(int) VDSetMetaCacheBudget(uint64_t cbBudget);
+
 /**
  * Lists all HDD backends and their capabilities in a caller-provided buffer.
  *
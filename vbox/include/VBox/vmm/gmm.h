@@ -703,6 +703,38 @@ typedef GMMUNREGISTERSHAREDMODULEREQ *PGMMUNREGISTERSHAREDMODULEREQ;
 
 GMMR0DECL(int) GMMR0UnregisterSharedModuleReq(PVM pVM, VMCPUID idCpu, PGMMUNREGISTERSHAREDMODULEREQ pReq);
 
+GMMR0DECL(int) GMMR0DedupCheckPage(PGVM pGVM, PGMMSHAREDPAGEDESC pPageDesc);
+
+/**
+ * Request buffer for GMMR0DedupScanReq / VMMR0_DO_GMM_DEDUP_SCAN.
+ * @see GMMR0DedupScanReq.
+ */
+typedef struct GMMDEDUPSCANREQ
+{
+    /** The header. */
+    SUPVMMR0REQHDR              Hdr;
+    /** Where to resume scanning (in/out). Reset to 0 when the end of the
+     * guest RAM is reached. */
+    RTGCPHYS                    GCPhysNext;
+    /** The max number of guest pages to look at (in). */
+    uint32_t                    cMaxPages;
+    /** The number of pages that was hashed (out). */
+    uint32_t                    cScanned;
+    /** The number of private pages turned into shared ones (out). */
+    uint32_t                    cShared;
+    /** The number of pages replaced by an identical shared page and
+     * freed (out). */
+    uint32_t                    cMerged;
+    /** Set if the scan wrapped around to the start of the guest RAM (out). */
+    bool                        fWrapped;
+    /** Explicit alignment padding. */
+    bool                        afPadding[7];
+} GMMDEDUPSCANREQ;
+/** Pointer to a GMMR0DedupScanReq / VMMR0_DO_GMM_DEDUP_SCAN request buffer. */
+typedef GMMDEDUPSCANREQ *PGMMDEDUPSCANREQ;
+
+GMMR0DECL(int) GMMR0DedupScanReq(PVM pVM, VMCPUID idCpu, PGMMDEDUPSCANREQ pReq);
+
 #if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
 /**
  * Request buffer for GMMR0FindDuplicatePageReq / VMMR0_DO_GMM_FIND_DUPLICATE_PAGE.
@@ -793,6 +825,7 @@ GMMR3DECL(int)  GMMR3RegisterSharedModule(PVM pVM, PGMMREGISTERSHAREDMODULEREQ p
 GMMR3DECL(int)  GMMR3UnregisterSharedModule(PVM pVM, PGMMUNREGISTERSHAREDMODULEREQ pReq);
 GMMR3DECL(int)  GMMR3CheckSharedModules(PVM pVM);
 GMMR3DECL(int)  GMMR3ResetSharedModules(PVM pVM);
+GMMR3DECL(int)  GMMR3DedupScan(PVM pVM, PGMMDEDUPSCANREQ pReq);
 
 # if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
 GMMR3DECL(bool) GMMR3IsDuplicatePage(PVM pVM, uint32_t idPage);
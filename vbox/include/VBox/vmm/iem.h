@@ -51,6 +51,11 @@ VMM_INT_DECL(VBOXSTRICTRC)  IEMInjectTrap(PVMCPU pVCpu, uint8_t u8TrapNo, TRPMEV
 VMM_INT_DECL(int)           IEMBreakpointSet(PVM pVM, RTGCPTR GCPtrBp);
 VMM_INT_DECL(int)           IEMBreakpointClear(PVM pVM, RTGCPTR GCPtrBp);
 
+VMM_INT_DECL(void)          IEMTlbInvalidateAll(PVMCPU pVCpu, bool fGlobal);
+VMM_INT_DECL(void)          IEMTlbInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtr);
+VMM_INT_DECL(void)          IEMTlbInvalidateAllPhysicalAllCpus(PVM pVM);
+VMM_INT_DECL(void)          IEMTlbInvalidatePhysRangeAllCpus(PVM pVM, RTGCPHYS GCPhysFirst, RTGCPHYS GCPhysLast);
+
 /** @name Given Instruction Interpreters
  * @{ */
 
@@ -72,6 +77,7 @@ VMM_INT_DECL(void)   IEMNotifyIOPortWriteString(PVM pVM, RTIOPORT Port, RTGCPTR
  */
 VMMR3DECL(int)      IEMR3Init(PVM pVM);
 VMMR3DECL(int)      IEMR3Term(PVM pVM);
+VMMR3DECL(void)     IEMR3Reset(PVM pVM);
 VMMR3DECL(void)     IEMR3Relocate(PVM pVM);
 /** @} */
 
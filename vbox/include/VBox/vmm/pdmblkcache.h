@@ -387,6 +387,18 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
  */
 VMMR3DECL(void) PDMR3BlkCacheIoXferComplete(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEIOXFER hIoXfer, int rcIoXfer);
 
+/**
+ * Sets the size of the medium behind the block cache.
+ *
+ * The cache doesn't read ahead until the size is known and never reads
+ * beyond it.
+ *
+ * @returns nothing.
+ * @param   pBlkCache       The cache instance.
+ * @param   cbMedium        The size of the medium in bytes.
+ */
+VMMR3DECL(void) PDMR3BlkCacheSetMediumSize(PPDMBLKCACHE pBlkCache, uint64_t cbMedium);
+
 /**
  * Suspends the block cache. The cache waits until all I/O transfers completed
  * and stops to enqueue new requests after the call returned but will not accept
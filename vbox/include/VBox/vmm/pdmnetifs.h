@@ -287,6 +287,32 @@ typedef struct PDMINETWORKUP
      */
     DECLR3CALLBACKMEMBER(int, pfnSendBuf,(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread));
 
+    /**
+     * Send a batch of frames to the network.
+     *
+     * This allows the driver to commit all the frames and kick the transport
+     * once instead of once per frame.  Optional, NULL if not implemented.  Use
+     * PDMNetSendBufs, which falls back on PDMINETWORKUP::pfnSendBuf.
+     *
+     * @retval  VINF_SUCCESS on success.
+     * @retval  VERR_NET_DOWN if the NIC is not connected to a network.
+     * @retval  VERR_NET_NO_BUFFER_SPACE if we're out of resources.
+     *
+     * @param   pInterface      Pointer to the interface structure containing the
+     *                          called function pointer.
+     * @param   papSgBufs       The buffers containing the frames to send, in the
+     *                          order they were allocated.  The buffer ownership
+     *                          shall be 1.  All the buffers will always be
+     *                          consumed, regardless of the status code.
+     * @param   cSgBufs         The number of buffers in the array.
+     * @param   fOnWorkerThread Set if we're being called on a work thread.  Clear
+     *                          if an EMT.
+     *
+     * @thread  Any, but normally EMT or the XMIT thread.
+     */
+    DECLR3CALLBACKMEMBER(int, pfnSendBufs,(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs,
+                                           bool fOnWorkerThread));
+
     /**
      * Ends a transmit session.
      *
@@ -361,10 +387,41 @@ typedef struct PDMINETWORKUPRC
 } PDMINETWORKUPRC;
 
 /** PDMINETWORKUP interface ID. */
-#define PDMINETWORKUP_IID                       "67e7e7a8-2594-4649-a1e3-7cee680c6083"
+#define PDMINETWORKUP_IID                       "5d2b3c8e-6e0a-4f3b-9f4e-2c1d7a8b9e06"
 /** PDMINETWORKUP interface method names. */
 #define PDMINETWORKUP_SYM_LIST                  "BeginXmit;AllocBuf;FreeBuf;SendBuf;EndXmit;SetPromiscuousMode"
 
+/** The max number of buffers a device should pass to
+ * PDMINETWORKUP::pfnSendBufs in one go. */
+#define PDMINETWORKUP_MAX_SEND_BUFS             64
+
+#ifdef IN_RING3
+/**
+ * Sends a batch of frames thru PDMINETWORKUP::pfnSendBufs, or frame by frame
+ * using PDMINETWORKUP::pfnSendBuf if the driver doesn't implement it.
+ *
+ * @returns See PDMINETWORKUP::pfnSendBufs.  The first failure is returned.
+ * @param   pIfUp           The network up interface.
+ * @param   papSgBufs       The buffers to send, in allocation order.
+ * @param   cSgBufs         The number of buffers.
+ * @param   fOnWorkerThread Set if we're being called on a work thread.
+ */
+DECLINLINE(int) PDMNetSendBufs(PPDMINETWORKUP pIfUp, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs, bool fOnWorkerThread)
+{
+    if (pIfUp->pfnSendBufs)
+        return pIfUp->pfnSendBufs(pIfUp, papSgBufs, cSgBufs, fOnWorkerThread);
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t i = 0; i < cSgBufs; i++)
+    {
+        int rc2 = pIfUp->pfnSendBuf(pIfUp, papSgBufs[i], fOnWorkerThread);
+        if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+            rc = rc2;
+    }
+    return rc;
+}
+#endif /* IN_RING3 */
+
 
 /** Pointer to a network config port interface */
 typedef struct PDMINETWORKCONFIG *PPDMINETWORKCONFIG;
@@ -58,6 +58,18 @@ typedef struct PDMNSFILTER
     bool                                afPadding[HC_ARCH_BITS == 32 ? 3 : 7];
     /** The driver this filter is aggregated into (ring-3). */
     R3PTRTYPE(PPDMINETWORKDOWN)         pIDrvNetR3;
+    /** The share of the group bandwidth this filter gets relative to the other
+     * filters in the group when they compete for it.  0 is treated as 1. */
+    uint32_t                            uWeight;
+    /** Number of bytes the filter asked for when it was last choked. */
+    volatile uint32_t                   cbWanted;
+    /** When the filter got choked (RTTimeSystemNanoTS). */
+    volatile uint64_t                   tsChoked;
+    /** Wake-up credit in bytes, accumulated while choked (ring-3, owned by the
+     * shaper). */
+    uint32_t                            cbCredit;
+    /** Aligment padding. */
+    uint32_t                            u32Padding;
 } PDMNSFILTER;
 
 /** Pointer to a PDM filter handle. */
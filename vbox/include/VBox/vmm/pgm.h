@@ -235,6 +235,25 @@ typedef DECLCALLBACK(int) FNPGMENUMDIRTYFTPAGES(PVM pVM, RTGCPHYS GCPhys, uint8_
 /** Pointer to PGMR3PhysEnumDirtyFTPages callback. */
 typedef FNPGMENUMDIRTYFTPAGES *PFNPGMENUMDIRTYFTPAGES;
 
+/**
+ * Post-copy page fetch callback (target side).
+ *
+ * This is called by the thread which needs a RAM page whose content is still
+ * on the post-copy source.  The caller owns the PGM lock and keeps calling
+ * until the page has been supplied by PGMR3PostCopyTrgSupplyPage.  The first
+ * call for a page should send the request, subsequent calls may pump the
+ * transport if no other thread is reading from it.
+ *
+ * @returns VBox status code, failure aborts the fetch.
+ * @param   pUVM            The user mode VM handle.
+ * @param   GCPhys          The guest physical address of the page.
+ * @param   fFirst          Set on the first call for this page.
+ * @param   pvUser          User argument.
+ */
+typedef DECLCALLBACK(int) FNPGMR3POSTCOPYFETCH(PUVM pUVM, RTGCPHYS GCPhys, bool fFirst, void *pvUser);
+/** Pointer to a post-copy page fetch callback. */
+typedef FNPGMR3POSTCOPYFETCH *PFNPGMR3POSTCOPYFETCH;
+
 /**
  * Paging mode.
  */
@@ -430,6 +449,7 @@ VMMR0_INT_DECL(int) PGMR0PhysFlushHandyPages(PVM pVM, PVMCPU pVCpu);
 VMMR0_INT_DECL(int) PGMR0PhysAllocateLargeHandyPage(PVM pVM, PVMCPU pVCpu);
 VMMR0_INT_DECL(int) PGMR0PhysSetupIommu(PVM pVM);
 VMMR0DECL(int)      PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHAREDMODULE pModule, PCRTGCPTR64 paRegionsGCPtrs);
+VMMR0DECL(int)      PGMR0SharedPageScan(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMDEDUPSCANREQ pReq);
 VMMR0DECL(int)      PGMR0Trap0eHandlerNestedPaging(PVM pVM, PVMCPU pVCpu, PGMMODE enmShwPagingMode, RTGCUINT uErr, PCPUMCTXCORE pRegFrame, RTGCPHYS pvFault);
 VMMR0DECL(VBOXSTRICTRC) PGMR0Trap0eHandlerNPMisconfig(PVM pVM, PVMCPU pVCpu, PGMMODE enmShwPagingMode, PCPUMCTXCORE pRegFrame, RTGCPHYS GCPhysFault, uint32_t uErr);
 # ifdef VBOX_WITH_2X_4GB_ADDR_SPACE
@@ -579,6 +599,18 @@ VMMR3DECL(int)     PGMR3SharedModuleCheckAll(PVM pVM);
 VMMR3DECL(int)     PGMR3SharedModuleGetPageState(PVM pVM, RTGCPTR GCPtrPage, bool *pfShared, uint64_t *pfPageFlags);
 /** @} */
 
+/** @name Post-copy teleportation
+ * @{ */
+VMMR3DECL(int)      PGMR3PostCopySrcEnable(PUVM pUVM, bool fEnable);
+VMMR3DECL(int)      PGMR3PostCopySrcGetPage(PUVM pUVM, RTGCPHYS GCPhys, void *pvPage);
+VMMR3DECL(int)      PGMR3PostCopySrcNextPage(PUVM pUVM, PRTGCPHYS pGCPhys);
+VMMR3DECL(void)     PGMR3PostCopySrcDone(PUVM pUVM);
+VMMR3DECL(int)      PGMR3PostCopyTrgRegister(PUVM pUVM, PFNPGMR3POSTCOPYFETCH pfnFetch, void *pvUser);
+VMMR3DECL(int)      PGMR3PostCopyTrgSupplyPage(PUVM pUVM, RTGCPHYS GCPhys, const void *pvPage);
+VMMR3DECL(int)      PGMR3PostCopyTrgComplete(PUVM pUVM);
+VMMR3DECL(void)     PGMR3PostCopyTrgAbort(PUVM pUVM, int rc);
+/** @} */
+
 /** @} */
 #endif /* IN_RING3 */
 
@@ -268,6 +268,9 @@ VMMR3DECL(int)          TMR3TimerLoad(PTMTIMERR3 pTimer, PSSMHANDLE pSSM);
 VMMR3DECL(int)          TMR3TimerSetCritSect(PTMTIMERR3 pTimer, PPDMCRITSECT pCritSect);
 VMMR3DECL(void)         TMR3TimerQueuesDo(PVM pVM);
 VMMR3_INT_DECL(void)    TMR3VirtualSyncFF(PVM pVM, PVMCPU pVCpu);
+VMMR3_INT_DECL(uint64_t) TMR3TimerPollGIPAllClocks(PVM pVM, PVMCPU pVCpu, uint64_t *pu64Delta);
+VMMR3_INT_DECL(void)    TMR3HaltTicklessEnter(PVM pVM);
+VMMR3_INT_DECL(void)    TMR3HaltTicklessLeave(PVM pVM);
 VMMR3_INT_DECL(PRTTIMESPEC) TMR3UtcNow(PVM pVM, PRTTIMESPEC pTime);
 /** @} */
 #endif /* IN_RING3 */
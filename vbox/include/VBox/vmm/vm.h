@@ -166,7 +166,7 @@ typedef struct VMCPU
 #ifdef ___IEMInternal_h
         struct IEMCPU       s;
 #endif
-        uint8_t             padding[3072];      /* multiple of 64 */
+        uint8_t             padding[7168];      /* multiple of 64 */
     } iem;
 
     /** TRPM part. */
@@ -60,13 +60,6 @@
  * that requires it is Mac OS X (see @bugref{4657}).
  */
 #define E1K_LSC_ON_SLU
-/** @def E1K_ITR_ENABLED
- * E1K_ITR_ENABLED reduces the number of interrupts generated by E1000 if a
- * guest driver requested it by writing non-zero value to the Interrupt
- * Throttling Register (see section 13.4.18 in "8254x Family of Gigabit
- * Ethernet Controllers Software Developer’s Manual").
- */
-//#define E1K_ITR_ENABLED
 /** @def E1K_TX_DELAY
  * E1K_TX_DELAY aims to improve guest-host transfer rate for TCP streams by
  * preventing packets to be sent immediately. It allows to send several
@@ -74,22 +67,6 @@
  * effectively disables R0 TX path, forcing sending in R3.
  */
 //#define E1K_TX_DELAY 150
-/** @def E1K_USE_TX_TIMERS
- * E1K_USE_TX_TIMERS aims to reduce the number of generated TX interrupts if a
- * guest driver set the delays via the Transmit Interrupt Delay Value (TIDV)
- * register. Enabling it showed no positive effects on existing guests so it
- * stays disabled. See sections 3.2.7.1 and 3.4.3.1 in "8254x Family of Gigabit
- * Ethernet Controllers Software Developer’s Manual" for more detailed
- * explanation.
- */
-//#define E1K_USE_TX_TIMERS
-/** @def E1K_NO_TAD
- * E1K_NO_TAD disables one of two timers enabled by E1K_USE_TX_TIMERS, the
- * Transmit Absolute Delay time. This timer sets the maximum time interval
- * during which TX interrupts can be postponed (delayed). It has no effect
- * if E1K_USE_TX_TIMERS is not defined.
- */
-//#define E1K_NO_TAD
 /** @def E1K_REL_DEBUG
  * E1K_REL_DEBUG enables debug logging of l1, l2, l3 in release build.
  */
@@ -143,6 +120,21 @@
 # define E1K_RXD_CACHE_SIZE 16u
 #endif /* E1K_WITH_RXD_CACHE */
 
+/** @name Adaptive interrupt throttling classes.
+ * Used instead of the Interrupt Throttling Register when the guest leaves it
+ * at zero, see e1kAdaptItr().
+ * @{ */
+/** Latency sensitive traffic, no throttling. */
+#define E1K_ITR_CLASS_LOWEST_LATENCY    0
+/** Mixed traffic, at most 20000 interrupts per second. */
+#define E1K_ITR_CLASS_LOW_LATENCY       1
+/** Bulk traffic, at most 4000 interrupts per second. */
+#define E1K_ITR_CLASS_BULK              2
+/** @} */
+
+/** The minimum interval between interrupts (ns), indexed by throttling class. */
+static const uint32_t g_acNsE1kItrClassInterval[] = { 0, 50000, 250000 };
+
 
 /* Little helpers ************************************************************/
 #undef htons
@@ -1073,6 +1065,11 @@ struct E1kState_st
     PCIDEVICE   pciDevice;
     /** EMT: Last time the interrupt was acknowledged.  */
     uint64_t    u64AckedAt;
+    /** All: Last time the interrupt was raised (TMCLOCK_VIRTUAL), used for
+     *  throttling. */
+    uint64_t    u64RaisedAt;
+    /** All: Start of the current interrupt rate statistics window. */
+    uint64_t    u64IntRateStart;
     /** All: Used for eliminating spurious interrupts. */
     bool        fIntRaised;
     /** EMT: false if the cable is disconnected by the GUI. */
@@ -1083,10 +1080,34 @@ struct E1kState_st
     bool        fRCEnabled;
     /** EMT: Compute Ethernet CRC for RX packets. */
     bool        fEthernetCRC;
-
-    bool        Alignment2[3];
+    /** EMT: Honour the Interrupt Throttling Register (ITR). */
+    bool        fItrEnabled;
+    /** EMT: Throttle RX interrupts as well. */
+    bool        fItrRxEnabled;
+    /** EMT: Throttle adaptively when the guest leaves ITR at zero. */
+    bool        fItrAdaptive;
+    /** EMT: Emulate the transmit interrupt delay timers (TIDV, TADV). */
+    bool        fTidEnabled;
+    /** EMT: Emulate the receive interrupt delay timers (RDTR, RADV). */
+    bool        fRidEnabled;
+    /** All: The current adaptive throttling class (E1K_ITR_CLASS_XXX). */
+    uint8_t     uItrClass;
+
+    bool        Alignment2[1];
     /** Link up delay (in milliseconds). */
     uint32_t    cMsLinkUpDelay;
+    /** TX/RX: Bytes moved since the last interrupt. */
+    uint32_t volatile cbSinceInt;
+    /** TX/RX: Frames moved since the last interrupt. */
+    uint32_t volatile cPktsSinceInt;
+    /** All: Interrupts raised in the current rate statistics window. */
+    uint32_t    cIntsInWindow;
+    /** All: Frames moved in the current rate statistics window. */
+    uint32_t    cPktsInWindow;
+    /** Interrupts per second, as of the last complete window. */
+    uint32_t    uStatIntsPerSec;
+    /** Frames per interrupt, as of the last complete window. */
+    uint32_t    uStatPktsPerInt;
 
     /** All: Device register storage. */
     uint32_t    auRegs[E1K_NUM_OF_32BIT_REGS];
@@ -1190,6 +1211,7 @@ struct E1kState_st
 
     STAMCOUNTER                         StatReceiveBytes;
     STAMCOUNTER                         StatTransmitBytes;
+    STAMCOUNTER                         StatIntsThrottled;
 #if defined(VBOX_WITH_STATISTICS)
     STAMPROFILEADV                      StatMMIOReadRZ;
     STAMPROFILEADV                      StatMMIOReadR3;
@@ -1622,6 +1644,15 @@ static void e1kHardReset(PE1KSTATE pThis)
     if (pThis->pDrvR3)
         pThis->pDrvR3->pfnSetPromiscuousMode(pThis->pDrvR3, false);
 
+    /* Reset interrupt moderation state */
+    pThis->uItrClass       = E1K_ITR_CLASS_LOWEST_LATENCY;
+    pThis->u64RaisedAt     = 0;
+    pThis->u64IntRateStart = TMTimerGet(pThis->CTX_SUFF(pIntTimer));
+    ASMAtomicWriteU32(&pThis->cbSinceInt, 0);
+    ASMAtomicWriteU32(&pThis->cPktsSinceInt, 0);
+    pThis->cIntsInWindow   = 0;
+    pThis->cPktsInWindow   = 0;
+
 #ifdef E1K_WITH_TXD_CACHE
     int rc = e1kCsTxEnter(pThis, VERR_SEM_BUSY);
     if (RT_LIKELY(rc == VINF_SUCCESS))
@@ -1834,9 +1865,120 @@ static void e1kPrintTDesc(PE1KSTATE pThis, E1KTXDESC* pDesc, const char* cszDir,
     }
 }
 
+/**
+ * Accounts a frame moved by the device, for interrupt throttling and the
+ * interrupt statistics.
+ *
+ * @param   pThis       The device state structure.
+ * @param   cb          The size of the frame.
+ */
+DECLINLINE(void) e1kItrAccountFrame(PE1KSTATE pThis, uint32_t cb)
+{
+    ASMAtomicAddU32(&pThis->cbSinceInt, cb);
+    ASMAtomicIncU32(&pThis->cPktsSinceInt);
+}
+
+/**
+ * Picks the adaptive throttling class for the traffic seen since the last
+ * interrupt, the same way the Intel drivers pick their ITR values.
+ *
+ * @param   pThis       The device state structure.
+ * @param   cb          Number of bytes moved since the last interrupt.
+ * @param   cPkts       Number of frames moved since the last interrupt.
+ */
+static void e1kAdaptItr(PE1KSTATE pThis, uint32_t cb, uint32_t cPkts)
+{
+    if (!cPkts)
+        return;
+
+    uint8_t uClass = pThis->uItrClass;
+    switch (uClass)
+    {
+        case E1K_ITR_CLASS_LOWEST_LATENCY:
+            if (cb / cPkts > 8000)
+                uClass = E1K_ITR_CLASS_BULK;
+            else if (cPkts < 5 && cb > 512)
+                uClass = E1K_ITR_CLASS_LOW_LATENCY;
+            break;
+
+        case E1K_ITR_CLASS_LOW_LATENCY:
+            if (cb > 10000)
+            {
+                if (cb / cPkts > 1200 || cPkts < 10)
+                    uClass = E1K_ITR_CLASS_BULK;
+                else if (cPkts > 35)
+                    uClass = E1K_ITR_CLASS_LOWEST_LATENCY;
+            }
+            else if (cb / cPkts > 2000)
+                uClass = E1K_ITR_CLASS_BULK;
+            else if (cPkts <= 2 && cb < 512)
+                uClass = E1K_ITR_CLASS_LOWEST_LATENCY;
+            break;
+
+        default:
+            if (cb > 25000)
+            {
+                if (cPkts > 35)
+                    uClass = E1K_ITR_CLASS_LOW_LATENCY;
+            }
+            else if (cb < 6000)
+                uClass = E1K_ITR_CLASS_LOW_LATENCY;
+            break;
+    }
+    if (uClass != pThis->uItrClass)
+        E1kLog2(("%s e1kAdaptItr: class %u -> %u (cb=%u cPkts=%u)\n", pThis->szPrf, pThis->uItrClass, uClass, cb, cPkts));
+    pThis->uItrClass = uClass;
+}
+
+/**
+ * Gets the minimum interval between two interrupts.
+ *
+ * @returns The interval in nanoseconds, 0 if not throttling.
+ * @param   pThis       The device state structure.
+ */
+DECLINLINE(uint32_t) e1kGetItrInterval(PE1KSTATE pThis)
+{
+    if (!pThis->fItrEnabled)
+        return 0;
+    /* interrupts/sec = 1 / (256 * 10E-9 * ITR) */
+    if (ITR)
+        return ITR * 256;
+    if (pThis->fItrAdaptive)
+        return g_acNsE1kItrClassInterval[pThis->uItrClass];
+    return 0;
+}
+
+/**
+ * Updates the interrupt rate statistics when an interrupt is raised.
+ *
+ * @param   pThis       The device state structure.
+ * @param   u64Now      The current time (TMCLOCK_VIRTUAL).
+ * @param   cPkts       Number of frames moved since the last interrupt.
+ */
+DECLINLINE(void) e1kUpdateIntRateStats(PE1KSTATE pThis, uint64_t u64Now, uint32_t cPkts)
+{
+    pThis->cIntsInWindow++;
+    pThis->cPktsInWindow += cPkts;
+
+    PTMTIMER pTimer = pThis->CTX_SUFF(pIntTimer);
+    uint64_t cNsWindow = TMTimerToNano(pTimer, u64Now - pThis->u64IntRateStart);
+    if (cNsWindow >= RT_NS_1SEC)
+    {
+        pThis->uStatIntsPerSec = (uint32_t)((uint64_t)pThis->cIntsInWindow * RT_NS_1SEC / cNsWindow);
+        pThis->uStatPktsPerInt = pThis->cPktsInWindow / pThis->cIntsInWindow;
+        pThis->cIntsInWindow   = 0;
+        pThis->cPktsInWindow   = 0;
+        pThis->u64IntRateStart = u64Now;
+    }
+}
+
 /**
  * Raise interrupt if not masked.
  *
+ * Honours the Interrupt Throttling Register (or the adaptive policy): if the
+ * previous interrupt was raised too recently, the late interrupt timer is
+ * armed to deliver it once the interval has passed.
+ *
  * @param   pThis       The device state structure.
  */
 static int e1kRaiseInterrupt(PE1KSTATE pThis, int rcBusy, uint32_t u32IntCause = 0)
@@ -1876,28 +2018,37 @@ static int e1kRaiseInterrupt(PE1KSTATE pThis, int rcBusy, uint32_t u32IntCause =
         }
         else
         {
-#ifdef E1K_ITR_ENABLED
-            uint64_t tstamp = TMTimerGet(pThis->CTX_SUFF(pIntTimer));
-            /* interrupts/sec = 1 / (256 * 10E-9 * ITR) */
-            E1kLog2(("%s e1kRaiseInterrupt: tstamp - pThis->u64AckedAt = %d, ITR * 256 = %d\n",
-                        pThis->szPrf, (uint32_t)(tstamp - pThis->u64AckedAt), ITR * 256));
-            //if (!!ITR && pThis->fIntMaskUsed && tstamp - pThis->u64AckedAt < ITR * 256)
-            if (!!ITR && tstamp - pThis->u64AckedAt < ITR * 256 && !(ICR & ICR_RXT0))
+            PTMTIMER       pIntTimer  = pThis->CTX_SUFF(pIntTimer);
+            uint64_t const u64Now     = TMTimerGet(pIntTimer);
+            uint32_t const cNsMinIntv = e1kGetItrInterval(pThis);
+            uint64_t const cTicksIntv = cNsMinIntv ? TMTimerFromNano(pIntTimer, cNsMinIntv) : 0;
+            if (   cTicksIntv
+                && u64Now - pThis->u64RaisedAt < cTicksIntv
+                && (pThis->fItrRxEnabled || !(ICR & ICR_RXT0)))
             {
                 E1K_INC_ISTAT_CNT(pThis->uStatIntEarly);
+                STAM_REL_COUNTER_INC(&pThis->StatIntsThrottled);
                 E1kLog2(("%s e1kRaiseInterrupt: Too early to raise again: %d ns < %d ns.\n",
-                        pThis->szPrf, (uint32_t)(tstamp - pThis->u64AckedAt), ITR * 256));
+                        pThis->szPrf, (uint32_t)TMTimerToNano(pIntTimer, u64Now - pThis->u64RaisedAt), cNsMinIntv));
+                /* Deliver it when the interval is over. */
+                if (!TMTimerIsActive(pIntTimer))
+                    TMTimerSet(pIntTimer, pThis->u64RaisedAt + cTicksIntv);
             }
             else
-#endif
             {
 
                 /* Since we are delivering the interrupt now
                  * there is no need to do it later -- stop the timer.
                  */
-                TMTimerStop(pThis->CTX_SUFF(pIntTimer));
+                TMTimerStop(pIntTimer);
                 E1K_INC_ISTAT_CNT(pThis->uStatInt);
                 STAM_COUNTER_INC(&pThis->StatIntsRaised);
+                pThis->u64RaisedAt = u64Now;
+                uint32_t const cb    = ASMAtomicXchgU32(&pThis->cbSinceInt, 0);
+                uint32_t const cPkts = ASMAtomicXchgU32(&pThis->cPktsSinceInt, 0);
+                if (pThis->fItrAdaptive)
+                    e1kAdaptItr(pThis, cb, cPkts);
+                e1kUpdateIntRateStats(pThis, u64Now, cPkts);
                 /* Got at least one unmasked interrupt cause */
                 pThis->fIntRaised = true;
                 /* Raise(1) INTA(0) */
@@ -2162,8 +2313,7 @@ static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc,
     if (pDesc->status.fEOP)
     {
         /* Complete packet has been stored -- it is time to let the guest know. */
-#ifdef E1K_USE_RX_TIMERS
-        if (RDTR)
+        if (pThis->fRidEnabled && RDTR)
         {
             /* Arm the timer to fire in RDTR usec (discard .024) */
             e1kArmTimer(pThis, pThis->CTX_SUFF(pRIDTimer), RDTR);
@@ -2173,13 +2323,10 @@ static DECLCALLBACK(void) e1kStoreRxFragment(PE1KSTATE pThis, E1KRXDESC *pDesc,
         }
         else
         {
-#endif
             /* 0 delay means immediate interrupt */
             E1K_INC_ISTAT_CNT(pThis->uStatIntRx);
             e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
-#ifdef E1K_USE_RX_TIMERS
         }
-#endif
     }
     STAM_PROFILE_ADV_STOP(&pThis->StatReceiveStore, a);
 }
@@ -2339,6 +2486,7 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     /* Update octet receive counter */
     E1K_ADD_CNT64(GORCL, GORCH, cb);
     STAM_REL_COUNTER_ADD(&pThis->StatReceiveBytes, cb);
+    e1kItrAccountFrame(pThis, (uint32_t)cb);
     if (cb == 64)
         E1K_INC_CNT32(PRC64);
     else if (cb < 128)
@@ -2446,8 +2594,7 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     e1kCsRxLeave(pThis);
 #ifdef E1K_WITH_RXD_CACHE
     /* Complete packet has been stored -- it is time to let the guest know. */
-# ifdef E1K_USE_RX_TIMERS
-    if (RDTR)
+    if (pThis->fRidEnabled && RDTR)
     {
         /* Arm the timer to fire in RDTR usec (discard .024) */
         e1kArmTimer(pThis, pThis->CTX_SUFF(pRIDTimer), RDTR);
@@ -2457,13 +2604,10 @@ static int e1kHandleRxPacket(PE1KSTATE pThis, const void *pvBuf, size_t cb, E1KR
     }
     else
     {
-# endif /* E1K_USE_RX_TIMERS */
         /* 0 delay means immediate interrupt */
         E1K_INC_ISTAT_CNT(pThis->uStatIntRx);
         e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
-# ifdef E1K_USE_RX_TIMERS
     }
-# endif /* E1K_USE_RX_TIMERS */
 #endif /* E1K_WITH_RXD_CACHE */
 
     return VINF_SUCCESS;
@@ -3064,10 +3208,11 @@ static int e1kRegWriteRDTR(PE1KSTATE pThis, uint32_t offset, uint32_t index, uin
     if (value & RDTR_FPD)
     {
         /* Flush requested, cancel both timers and raise interrupt */
-#ifdef E1K_USE_RX_TIMERS
-        e1kCancelTimer(pThis, pThis->CTX_SUFF(pRIDTimer));
-        e1kCancelTimer(pThis, pThis->CTX_SUFF(pRADTimer));
-#endif
+        if (pThis->fRidEnabled)
+        {
+            e1kCancelTimer(pThis, pThis->CTX_SUFF(pRIDTimer));
+            e1kCancelTimer(pThis, pThis->CTX_SUFF(pRADTimer));
+        }
         E1K_INC_ISTAT_CNT(pThis->uStatIntRDTR);
         return e1kRaiseInterrupt(pThis, VINF_IOM_R3_MMIO_WRITE, ICR_RXT0);
     }
@@ -3114,8 +3259,6 @@ static DECLCALLBACK(void) e1kTxDelayTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, v
 }
 #endif /* E1K_TX_DELAY */
 
-#ifdef E1K_USE_TX_TIMERS
-
 /**
  * Transmit Interrupt Delay Timer handler.
  *
@@ -3132,10 +3275,8 @@ static DECLCALLBACK(void) e1kTxIntDelayTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer
 
     E1K_INC_ISTAT_CNT(pThis->uStatTID);
     /* Cancel absolute delay timer as we have already got attention */
-#ifndef E1K_NO_TAD
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pTADTimer));
-#endif /* E1K_NO_TAD */
-    e1kRaiseInterrupt(pThis, ICR_TXDW);
+    e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_TXDW);
 }
 
 /**
@@ -3155,12 +3296,9 @@ static DECLCALLBACK(void) e1kTxAbsDelayTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer
     E1K_INC_ISTAT_CNT(pThis->uStatTAD);
     /* Cancel interrupt delay timer as we have already got attention */
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pTIDTimer));
-    e1kRaiseInterrupt(pThis, ICR_TXDW);
+    e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_TXDW);
 }
 
-#endif /* E1K_USE_TX_TIMERS */
-#ifdef E1K_USE_RX_TIMERS
-
 /**
  * Receive Interrupt Delay Timer handler.
  *
@@ -3178,7 +3316,7 @@ static DECLCALLBACK(void) e1kRxIntDelayTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer
     E1K_INC_ISTAT_CNT(pThis->uStatRID);
     /* Cancel absolute delay timer as we have already got attention */
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pRADTimer));
-    e1kRaiseInterrupt(pThis, ICR_RXT0);
+    e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
 }
 
 /**
@@ -3198,11 +3336,9 @@ static DECLCALLBACK(void) e1kRxAbsDelayTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer
     E1K_INC_ISTAT_CNT(pThis->uStatRAD);
     /* Cancel interrupt delay timer as we have already got attention */
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pRIDTimer));
-    e1kRaiseInterrupt(pThis, ICR_RXT0);
+    e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_RXT0);
 }
 
-#endif /* E1K_USE_RX_TIMERS */
-
 /**
  * Late Interrupt Timer handler.
  *
@@ -3759,6 +3895,7 @@ static void e1kTransmitFrame(PE1KSTATE pThis, bool fOnWorkerThread)
     E1K_ADD_CNT64(GOTCL, GOTCH, cbFrame);
     if (pThis->CTX_SUFF(pDrv))
         STAM_REL_COUNTER_ADD(&pThis->StatTransmitBytes, cbFrame);
+    e1kItrAccountFrame(pThis, (uint32_t)cbFrame);
     if (cbFrame == 64)
         E1K_INC_CNT32(PTC64);
     else if (cbFrame < 128)
@@ -4311,8 +4448,7 @@ static void e1kDescReport(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr)
         e1kWriteBackDesc(pThis, pDesc, addr);
         if (pDesc->legacy.cmd.fEOP)
         {
-#ifdef E1K_USE_TX_TIMERS
-            if (pDesc->legacy.cmd.fIDE)
+            if (pThis->fTidEnabled && pDesc->legacy.cmd.fIDE)
             {
                 E1K_INC_ISTAT_CNT(pThis->uStatTxIDE);
                 //if (pThis->fIntRaised)
@@ -4323,28 +4459,24 @@ static void e1kDescReport(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr)
                 //else {
                 /* Arm the timer to fire in TIVD usec (discard .024) */
                 e1kArmTimer(pThis, pThis->CTX_SUFF(pTIDTimer), TIDV);
-# ifndef E1K_NO_TAD
                 /* If absolute timer delay is enabled and the timer is not running yet, arm it. */
                 E1kLog2(("%s Checking if TAD timer is running\n",
                          pThis->szPrf));
                 if (TADV != 0 && !TMTimerIsActive(pThis->CTX_SUFF(pTADTimer)))
                     e1kArmTimer(pThis, pThis->CTX_SUFF(pTADTimer), TADV);
-# endif /* E1K_NO_TAD */
             }
             else
             {
-                E1kLog2(("%s No IDE set, cancel TAD timer and raise interrupt\n",
-                        pThis->szPrf));
-# ifndef E1K_NO_TAD
-                /* Cancel both timers if armed and fire immediately. */
-                e1kCancelTimer(pThis, pThis->CTX_SUFF(pTADTimer));
-# endif /* E1K_NO_TAD */
-#endif /* E1K_USE_TX_TIMERS */
+                if (pThis->fTidEnabled)
+                {
+                    E1kLog2(("%s No IDE set, cancel TAD timer and raise interrupt\n",
+                            pThis->szPrf));
+                    /* Cancel both timers if armed and fire immediately. */
+                    e1kCancelTimer(pThis, pThis->CTX_SUFF(pTADTimer));
+                }
                 E1K_INC_ISTAT_CNT(pThis->uStatIntTx);
                 e1kRaiseInterrupt(pThis, VERR_SEM_BUSY, ICR_TXDW);
-#ifdef E1K_USE_TX_TIMERS
             }
-#endif /* E1K_USE_TX_TIMERS */
         }
     }
     else
@@ -4376,9 +4508,8 @@ static int e1kXmitDesc(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr, bool fO
 
     e1kPrintTDesc(pThis, pDesc, "vvv");
 
-#ifdef E1K_USE_TX_TIMERS
-    e1kCancelTimer(pThis, pThis->CTX_SUFF(pTIDTimer));
-#endif /* E1K_USE_TX_TIMERS */
+    if (pThis->fTidEnabled)
+        e1kCancelTimer(pThis, pThis->CTX_SUFF(pTIDTimer));
 
     switch (e1kGetDescType(pDesc))
     {
@@ -4637,9 +4768,8 @@ static int e1kXmitDesc(PE1KSTATE pThis, E1KTXDESC* pDesc, RTGCPHYS addr,
 
     e1kPrintTDesc(pThis, pDesc, "vvv");
 
-#ifdef E1K_USE_TX_TIMERS
-    e1kCancelTimer(pThis, pThis->CTX_SUFF(pTIDTimer));
-#endif /* E1K_USE_TX_TIMERS */
+    if (pThis->fTidEnabled)
+        e1kCancelTimer(pThis, pThis->CTX_SUFF(pTIDTimer));
 
     switch (e1kGetDescType(pDesc))
     {
@@ -6484,16 +6614,10 @@ static DECLCALLBACK(int) e1kSavePrep(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
 #ifdef E1K_TX_DELAY
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pTXDTimer));
 #endif /* E1K_TX_DELAY */
-#ifdef E1K_USE_TX_TIMERS
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pTIDTimer));
-#ifndef E1K_NO_TAD
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pTADTimer));
-#endif /* E1K_NO_TAD */
-#endif /* E1K_USE_TX_TIMERS */
-#ifdef E1K_USE_RX_TIMERS
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pRIDTimer));
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pRADTimer));
-#endif /* E1K_USE_RX_TIMERS */
     e1kCancelTimer(pThis, pThis->CTX_SUFF(pIntTimer));
     /* 3) Did I forget anything? */
     E1kLog(("%s Locked\n", pThis->szPrf));
@@ -7187,16 +7311,10 @@ static DECLCALLBACK(void) e1kR3Relocate(PPDMDEVINS pDevIns, RTGCINTPTR offDelta)
     pThis->pDevInsRC     = PDMDEVINS_2_RCPTR(pDevIns);
     pThis->pTxQueueRC    = PDMQueueRCPtr(pThis->pTxQueueR3);
     pThis->pCanRxQueueRC = PDMQueueRCPtr(pThis->pCanRxQueueR3);
-#ifdef E1K_USE_RX_TIMERS
     pThis->pRIDTimerRC   = TMTimerRCPtr(pThis->pRIDTimerR3);
     pThis->pRADTimerRC   = TMTimerRCPtr(pThis->pRADTimerR3);
-#endif /* E1K_USE_RX_TIMERS */
-#ifdef E1K_USE_TX_TIMERS
     pThis->pTIDTimerRC   = TMTimerRCPtr(pThis->pTIDTimerR3);
-# ifndef E1K_NO_TAD
     pThis->pTADTimerRC   = TMTimerRCPtr(pThis->pTADTimerR3);
-# endif /* E1K_NO_TAD */
-#endif /* E1K_USE_TX_TIMERS */
 #ifdef E1K_TX_DELAY
     pThis->pTXDTimerRC   = TMTimerRCPtr(pThis->pTXDTimerR3);
 #endif /* E1K_TX_DELAY */
@@ -7370,7 +7488,9 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
      */
     if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "AdapterType\0"
                                     "LineSpeed\0" "GCEnabled\0" "R0Enabled\0"
-                                    "EthernetCRC\0" "GSOEnabled\0" "LinkUpDelay\0"))
+                                    "EthernetCRC\0" "GSOEnabled\0" "LinkUpDelay\0"
+                                    "ItrEnabled\0" "ItrRxEnabled\0" "ItrAdaptive\0"
+                                    "TidEnabled\0" "RidEnabled\0"))
         return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
                                 N_("Invalid configuration for E1000 device"));
 
@@ -7425,6 +7545,39 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     else if (pThis->cMsLinkUpDelay == 0)
         LogRel(("%s WARNING! Link up delay is disabled!\n", pThis->szPrf));
 
+    rc = CFGMR3QueryBoolDef(pCfg, "ItrEnabled", &pThis->fItrEnabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'ItrEnabled'"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "ItrRxEnabled", &pThis->fItrRxEnabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'ItrRxEnabled'"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "ItrAdaptive", &pThis->fItrAdaptive, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'ItrAdaptive'"));
+
+    /* Transmit delay timers did not show any benefit with common guests, off by default. */
+    rc = CFGMR3QueryBoolDef(pCfg, "TidEnabled", &pThis->fTidEnabled, false);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'TidEnabled'"));
+
+    rc = CFGMR3QueryBoolDef(pCfg, "RidEnabled", &pThis->fRidEnabled, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'RidEnabled'"));
+
+    LogRel(("%s ITR=%s (RX %s, %s) TID=%s RID=%s\n", pThis->szPrf,
+            pThis->fItrEnabled ? "enabled" : "disabled",
+            pThis->fItrRxEnabled ? "on" : "off",
+            pThis->fItrAdaptive ? "adaptive" : "fixed",
+            pThis->fTidEnabled ? "enabled" : "disabled",
+            pThis->fRidEnabled ? "enabled" : "disabled"));
+
     E1kLog(("%s Chip=%s LinkUpDelay=%ums EthernetCRC=%s GSO=%s\n", pThis->szPrf,
             g_Chips[pThis->eChip].pcszName, pThis->cMsLinkUpDelay,
             pThis->fEthernetCRC ? "on" : "off",
@@ -7516,7 +7669,6 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     TMR3TimerSetCritSect(pThis->pTXDTimerR3, &pThis->csTx);
 #endif /* E1K_TX_DELAY */
 
-#ifdef E1K_USE_TX_TIMERS
     /* Create Transmit Interrupt Delay Timer */
     rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, e1kTxIntDelayTimer, pThis,
                                 TMTIMER_FLAGS_NO_CRIT_SECT,
@@ -7526,7 +7678,6 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     pThis->pTIDTimerR0 = TMTimerR0Ptr(pThis->pTIDTimerR3);
     pThis->pTIDTimerRC = TMTimerRCPtr(pThis->pTIDTimerR3);
 
-# ifndef E1K_NO_TAD
     /* Create Transmit Absolute Delay Timer */
     rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, e1kTxAbsDelayTimer, pThis,
                                 TMTIMER_FLAGS_NO_CRIT_SECT,
@@ -7535,10 +7686,7 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
         return rc;
     pThis->pTADTimerR0 = TMTimerR0Ptr(pThis->pTADTimerR3);
     pThis->pTADTimerRC = TMTimerRCPtr(pThis->pTADTimerR3);
-# endif /* E1K_NO_TAD */
-#endif /* E1K_USE_TX_TIMERS */
 
-#ifdef E1K_USE_RX_TIMERS
     /* Create Receive Interrupt Delay Timer */
     rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, e1kRxIntDelayTimer, pThis,
                                 TMTIMER_FLAGS_NO_CRIT_SECT,
@@ -7556,7 +7704,6 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
         return rc;
     pThis->pRADTimerR0 = TMTimerR0Ptr(pThis->pRADTimerR3);
     pThis->pRADTimerRC = TMTimerRCPtr(pThis->pRADTimerR3);
-#endif /* E1K_USE_RX_TIMERS */
 
     /* Create Late Interrupt Timer */
     rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, e1kLateIntTimer, pThis,
@@ -7648,6 +7795,9 @@ static DECLCALLBACK(int) e1kR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGM
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitR3,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling transmits in R3",          "/Devices/E1k%d/Transmit/TotalR3", iInstance);
 #endif /* VBOX_WITH_STATISTICS */
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitBytes,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data transmitted",         "/Devices/E1k%d/TransmitBytes", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatIntsThrottled,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of interrupts deferred by throttling", "/Devices/E1k%d/Interrupts/Throttled", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->uStatIntsPerSec,        STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_HZ,             "Interrupts raised per second",       "/Devices/E1k%d/Interrupts/PerSecond", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->uStatPktsPerInt,        STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Frames moved per interrupt",         "/Devices/E1k%d/Interrupts/FramesPerInt", iInstance);
 #if defined(VBOX_WITH_STATISTICS)
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitSendRZ,     STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling send transmit in RZ",      "/Devices/E1k%d/Transmit/SendRZ", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitSendR3,     STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling send transmit in R3",      "/Devices/E1k%d/Transmit/SendR3", iInstance);
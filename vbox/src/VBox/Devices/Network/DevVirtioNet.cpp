@@ -31,6 +31,7 @@
 #include <iprt/semaphore.h>
 #ifdef IN_RING3
 # include <iprt/mem.h>
+# include <iprt/string.h>
 # include <iprt/uuid.h>
 #endif /* IN_RING3 */
 #include "VBoxDD.h"
@@ -65,10 +66,23 @@
 #endif /* VBOX_DEVICE_STRUCT_TESTCASE */
 
 
-#define VNET_TX_DELAY           150   /**< 150 microseconds */
+/** @name Saved state versions.
+ * The common virtio versions up to VIRTIO_SAVEDSTATE_VERSION apply, the
+ * ones above are specific to virtio-net.
+ * @{ */
+/** Saved states without the number of active queue pairs. */
+#define VNET_SAVEDSTATE_VERSION_PRE_MQ  3
+#define VNET_SAVEDSTATE_VERSION         4
+/** @} */
+AssertCompile(VNET_SAVEDSTATE_VERSION_PRE_MQ == VIRTIO_SAVEDSTATE_VERSION);
+
 #define VNET_MAX_FRAME_SIZE     65536  ///< @todo Is it the right limit?
 #define VNET_MAC_FILTER_LEN     32
+#define VNET_INT_DELAY_MAX_DEFAULT 100 /**< Default upper bound of the interrupt delay, microseconds. */
+#define VNET_INT_DELAY_MAX_LIMIT   10000
 #define VNET_MAX_VID            (1 << 12)
+#define VNET_MAX_QUEUE_PAIRS    8      /**< Upper limit of the QueuePairs configuration value. */
+#define VNET_TX_RETRY_MS        1      /**< How long a TX thread waits before retrying a busy driver. */
 
 /** @name Virtio net features
  * @{  */
@@ -89,6 +103,7 @@
 #define VNET_F_CTRL_VQ    0x00020000  /**< Control channel available */
 #define VNET_F_CTRL_RX    0x00040000  /**< Control channel RX mode support */
 #define VNET_F_CTRL_VLAN  0x00080000  /**< Control channel VLAN filtering */
+#define VNET_F_MQ         0x00400000  /**< Device supports multiqueue with automatic receive steering */
 /** @} */
 
 #define VNET_S_LINK_UP    1
@@ -105,8 +120,41 @@ struct __attribute__ ((__packed__)) VNetPCIConfig /** @todo r=bird: Use #pragma
 {
     RTMAC    mac;
     uint16_t uStatus;
+    uint16_t uMaxVirtqueuePairs;
 };
 AssertCompileMemberOffset(struct VNetPCIConfig, uStatus, 6);
+AssertCompileMemberOffset(struct VNetPCIConfig, uMaxVirtqueuePairs, 8);
+
+/**
+ * A receive/transmit queue pair.
+ *
+ * Each pair has its own transmit thread so that guests spreading their
+ * traffic over several queues get it processed in parallel.
+ */
+typedef struct VNETQUEUEPAIR
+{
+    /** The receive queue. */
+    R3PTRTYPE(PVQUEUE)      pRxQueue;
+    /** The transmit queue. */
+    R3PTRTYPE(PVQUEUE)      pTxQueue;
+    /** The thread draining pTxQueue. */
+    R3PTRTYPE(PPDMTHREAD)   pTxThread;
+    /** The event the transmit thread waits on. */
+    RTSEMEVENT              hTxEvent;
+    /** Set when hTxEvent has been signalled and the thread has not yet woken up. */
+    bool volatile           fTxKicked;
+    /** Set while the transmit thread finds the driver busy and has to retry. */
+    bool volatile           fTxDeferred;
+    bool                    afAlignment[6];
+    /** Number of times the transmit thread was woken up. */
+    STAMCOUNTER             StatTxWakeups;
+    /** Number of packets received via this pair. */
+    STAMCOUNTER             StatReceivePackets;
+    /** Number of packets sent via this pair. */
+    STAMCOUNTER             StatTransmitPackets;
+} VNETQUEUEPAIR;
+/** Pointer to a queue pair. */
+typedef VNETQUEUEPAIR *PVNETQUEUEPAIR;
 
 /**
  * Device state structure. Holds the current state of device.
@@ -137,28 +185,6 @@ typedef struct VNetState_st
     /**< Link Up(/Restore) Timer. */
     PTMTIMERR3              pLinkUpTimer;
 
-#ifdef VNET_TX_DELAY
-    /**< Transmit Delay Timer - R3. */
-    PTMTIMERR3              pTxTimerR3;
-    /**< Transmit Delay Timer - R0. */
-    PTMTIMERR0              pTxTimerR0;
-    /**< Transmit Delay Timer - GC. */
-    PTMTIMERRC              pTxTimerRC;
-
-# if HC_ARCH_BITS == 64
-    uint32_t                padding2;
-# endif
-
-    uint32_t                u32i;
-    uint32_t                u32AvgDiff;
-    uint32_t                u32MinDiff;
-    uint32_t                u32MaxDiff;
-    uint64_t                u64NanoTS;
-#endif /* VNET_TX_DELAY */
-
-    /** Indicates transmission in progress -- only one thread is allowed. */
-    uint32_t                uIsTransmitting;
-
     /** PCI config area holding MAC address as well as TBD. */
     struct VNetPCIConfig    config;
     /** MAC address obtained from the configuration. */
@@ -187,9 +213,11 @@ typedef struct VNetState_st
     /** Bit array of VLAN filter, one bit per VLAN ID. */
     uint8_t                 aVlanFilter[VNET_MAX_VID / sizeof(uint8_t)];
 
-    R3PTRTYPE(PVQUEUE)      pRxQueue;
-    R3PTRTYPE(PVQUEUE)      pTxQueue;
-    R3PTRTYPE(PVQUEUE)      pCtlQueue;
+    /** Number of queue pairs offered to the guest (QueuePairs). */
+    uint32_t                cMaxQueuePairs;
+    /** Number of queue pairs the guest currently uses, 1 unless it negotiated
+     * VNET_F_MQ and said otherwise. */
+    uint32_t volatile       cActiveQueuePairs;
     /* Receive-blocking-related fields ***************************************/
 
     /** EMT: Gets signalled when more RX descriptors become available. */
@@ -200,6 +228,7 @@ typedef struct VNetState_st
     STAMCOUNTER             StatReceiveBytes;
     STAMCOUNTER             StatTransmitBytes;
     STAMCOUNTER             StatReceiveGSO;
+    STAMCOUNTER             StatReceivePackets;
     STAMCOUNTER             StatTransmitPackets;
     STAMCOUNTER             StatTransmitGSO;
     STAMCOUNTER             StatTransmitCSum;
@@ -212,6 +241,9 @@ typedef struct VNetState_st
     STAMCOUNTER             StatRxOverflowWakeup;
 #endif /* VBOX_WITH_STATISTICS */
     /** @}  */
+
+    /** The queue pairs, only the first cMaxQueuePairs are used. (R3 only) */
+    VNETQUEUEPAIR           aQueuePairs[VNET_MAX_QUEUE_PAIRS];
 } VNETSTATE;
 /** Pointer to a virtual I/O network device state. */
 typedef VNETSTATE *PVNETSTATE;
@@ -265,6 +297,9 @@ typedef uint8_t VNETCTLACK;
 #define VNET_CTRL_CMD_VLAN_ADD         0
 #define VNET_CTRL_CMD_VLAN_DEL         1
 
+#define VNET_CTRL_CLS_MQ               4
+#define VNET_CTRL_CMD_MQ_VQ_PAIRS_SET  0
+
 
 struct VNetCtlHdr
 {
@@ -281,6 +316,19 @@ DECLINLINE(bool) vnetMergeableRxBuffers(PVNETSTATE pThis)
     return !!(pThis->VPCI.uGuestFeatures & VNET_F_MRG_RXBUF);
 }
 
+/**
+ * Returns the index of the control queue.
+ *
+ * Without VNET_F_MQ the guest only knows about the first pair and expects the
+ * control queue right after it, otherwise it comes after all the pairs.
+ */
+DECLINLINE(uint32_t) vnetCtlQueueIndex(PVNETSTATE pThis)
+{
+    if (pThis->VPCI.uGuestFeatures & VNET_F_MQ)
+        return pThis->cMaxQueuePairs * 2;
+    return 2;
+}
+
 DECLINLINE(int) vnetCsEnter(PVNETSTATE pThis, int rcBusy)
 {
     return vpciCsEnter(&pThis->VPCI, rcBusy);
@@ -354,7 +402,8 @@ DECLINLINE(void) vnetPrintFeatures(PVNETSTATE pThis, uint32_t fFeatures, const c
         { VNET_F_STATUS,     "virtio_net_config.status available" },
         { VNET_F_CTRL_VQ,    "control channel available" },
         { VNET_F_CTRL_RX,    "control channel RX mode support" },
-        { VNET_F_CTRL_VLAN,  "control channel VLAN filtering" }
+        { VNET_F_CTRL_VLAN,  "control channel VLAN filtering" },
+        { VNET_F_MQ,         "multiple queue pairs" }
     };
 
     Log3(("%s %s:\n", INSTANCE(pThis), pcszText));
@@ -375,12 +424,16 @@ static DECLCALLBACK(uint32_t) vnetIoCb_GetHostFeatures(void *pvState)
      * - RX mode setting
      * - MAC filter table
      * - VLAN filter
+     * - Multiple queue pairs, if configured
      */
-    return VNET_F_MAC
+    PVNETSTATE pThis = (PVNETSTATE)pvState;
+    return (pThis->cMaxQueuePairs > 1 ? VNET_F_MQ : 0)
+        | VNET_F_MAC
         | VNET_F_STATUS
         | VNET_F_CTRL_VQ
         | VNET_F_CTRL_RX
         | VNET_F_CTRL_VLAN
+        | VPCI_F_RING_EVENT_IDX
 #ifdef VNET_WITH_GSO
         | VNET_F_CSUM
         | VNET_F_HOST_TSO4
@@ -471,7 +524,7 @@ static DECLCALLBACK(int) vnetIoCb_Reset(void *pvState)
     pThis->nMacFilterEntries = 0;
     memset(pThis->aMacFilter,  0, VNET_MAC_FILTER_LEN * sizeof(RTMAC));
     memset(pThis->aVlanFilter, 0, sizeof(pThis->aVlanFilter));
-    pThis->uIsTransmitting   = 0;
+    pThis->cActiveQueuePairs = 1;
 #ifndef IN_RING3
     return VINF_IOM_R3_IOPORT_WRITE;
 #else
@@ -585,9 +638,11 @@ PDMBOTHCBDECL(int) vnetIOPortOut(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT port
  * Check if the device can receive data now.
  * This must be called before the pfnRecieve() method is called.
  *
+ * The device can receive if any of the active receive queues has buffers,
+ * frames steered to an empty queue are diverted to another one.
+ *
  * @remarks As a side effect this function enables queue notification
- *          if it cannot receive because the queue is empty.
- *          It disables notification if it can receive.
+ *          on the queues that are empty and disables it on the others.
  *
  * @returns VERR_NET_NO_BUFFER_SPACE if it cannot.
  * @param   pInterface      Pointer to the interface structure containing the called function pointer.
@@ -599,19 +654,23 @@ static int vnetCanReceive(PVNETSTATE pThis)
     AssertRCReturn(rc, rc);
 
     LogFlow(("%s vnetCanReceive\n", INSTANCE(pThis)));
-    if (!(pThis->VPCI.uStatus & VPCI_STATUS_DRV_OK))
-        rc = VERR_NET_NO_BUFFER_SPACE;
-    else if (!vqueueIsReady(&pThis->VPCI, pThis->pRxQueue))
-        rc = VERR_NET_NO_BUFFER_SPACE;
-    else if (vqueueIsEmpty(&pThis->VPCI, pThis->pRxQueue))
-    {
-        vringSetNotification(&pThis->VPCI, &pThis->pRxQueue->VRing, true);
-        rc = VERR_NET_NO_BUFFER_SPACE;
-    }
-    else
+    rc = VERR_NET_NO_BUFFER_SPACE;
+    if (pThis->VPCI.uStatus & VPCI_STATUS_DRV_OK)
     {
-        vringSetNotification(&pThis->VPCI, &pThis->pRxQueue->VRing, false);
-        rc = VINF_SUCCESS;
+        uint32_t cPairs = ASMAtomicReadU32(&pThis->cActiveQueuePairs);
+        for (uint32_t i = 0; i < cPairs; i++)
+        {
+            PVQUEUE pRxQueue = pThis->aQueuePairs[i].pRxQueue;
+            if (!vqueueIsReady(&pThis->VPCI, pRxQueue))
+                continue;
+            if (vqueueIsEmpty(&pThis->VPCI, pRxQueue))
+                vqueueSetNotification(&pThis->VPCI, pRxQueue, true);
+            else
+            {
+                vqueueSetNotification(&pThis->VPCI, pRxQueue, false);
+                rc = VINF_SUCCESS;
+            }
+        }
     }
 
     LogFlow(("%s vnetCanReceive -> %Rrc\n", INSTANCE(pThis), rc));
@@ -740,6 +799,102 @@ static bool vnetAddressFilter(PVNETSTATE pThis, const void *pvBuf, size_t cb)
     return false;
 }
 
+/**
+ * Mixes a 32-bit word into a flow hash.
+ */
+DECLINLINE(uint32_t) vnetFlowHashMix(uint32_t uHash, uint32_t u32)
+{
+    uHash ^= u32;
+    uHash *= UINT32_C(0x9e3779b1);
+    return uHash ^ (uHash >> 15);
+}
+
+/**
+ * Calculates the flow hash used for steering a received frame.
+ *
+ * The addresses and, for TCP and UDP, the ports are combined so that both
+ * directions of a connection yield the same value and thus land on the same
+ * queue pair.  Anything that isn't IP hashes to zero.
+ *
+ * @returns The hash value.
+ * @param   pbFrame         The ethernet frame.
+ * @param   cbFrame         The size of the frame.
+ */
+static uint32_t vnetFlowHash(const uint8_t *pbFrame, size_t cbFrame)
+{
+    size_t offL3 = sizeof(RTNETETHERHDR);
+    if (cbFrame < offL3)
+        return 0;
+    uint16_t uEtherType = RT_BE2H_U16(((PCRTNETETHERHDR)pbFrame)->EtherType);
+    if (uEtherType == RTNET_ETHERTYPE_VLAN && cbFrame >= offL3 + 4)
+    {
+        uEtherType = RT_BE2H_U16(*(uint16_t const *)&pbFrame[offL3 + 2]);
+        offL3 += 4;
+    }
+
+    uint32_t uHash = 0;
+    uint8_t  bProto;
+    size_t   offL4;
+    if (uEtherType == RTNET_ETHERTYPE_IPV4 && cbFrame >= offL3 + RTNETIPV4_MIN_LEN)
+    {
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&pbFrame[offL3];
+        uHash = vnetFlowHashMix(uHash, pIpHdr->ip_src.u ^ pIpHdr->ip_dst.u);
+        /* Only the first fragment carries the ports, keep the fragments together. */
+        if (pIpHdr->ip_off & RT_H2BE_U16(RTNETIPV4_FLAGS_MF | UINT16_C(0x1fff)))
+            return uHash;
+        bProto = pIpHdr->ip_p;
+        offL4  = offL3 + pIpHdr->ip_hl * 4;
+    }
+    else if (uEtherType == RTNET_ETHERTYPE_IPV6 && cbFrame >= offL3 + sizeof(RTNETIPV6))
+    {
+        PCRTNETIPV6 pIpHdr = (PCRTNETIPV6)&pbFrame[offL3];
+        for (unsigned i = 0; i < RT_ELEMENTS(pIpHdr->ip6_src.au32); i++)
+            uHash = vnetFlowHashMix(uHash, pIpHdr->ip6_src.au32[i] ^ pIpHdr->ip6_dst.au32[i]);
+        bProto = pIpHdr->ip6_nxt;
+        offL4  = offL3 + sizeof(RTNETIPV6);
+    }
+    else
+        return 0;
+
+    if (   (bProto == RTNETIPV4_PROT_TCP || bProto == RTNETIPV4_PROT_UDP)
+        && cbFrame >= offL4 + 4)
+    {
+        uint16_t const *pu16Ports = (uint16_t const *)&pbFrame[offL4];
+        uHash = vnetFlowHashMix(uHash, (uint32_t)(pu16Ports[0] ^ pu16Ports[1]) | ((uint32_t)bProto << 16));
+    }
+    return uHash;
+}
+
+/**
+ * Picks the receive queue for a frame.
+ *
+ * The frame goes to the queue pair its flow hash selects, unless that queue
+ * has run dry in which case the next active one with buffers takes it.
+ *
+ * @returns The receive queue, NULL if none has buffers.
+ * @param   pThis           The device state structure.
+ * @param   pvBuf           The ethernet frame.
+ * @param   cb              The size of the frame.
+ * @param   ppPair          Where to return the queue pair.
+ * @thread  RX
+ */
+static PVQUEUE vnetSelectRxQueue(PVNETSTATE pThis, const void *pvBuf, size_t cb, PVNETQUEUEPAIR *ppPair)
+{
+    uint32_t cPairs = ASMAtomicReadU32(&pThis->cActiveQueuePairs);
+    uint32_t iPair  = cPairs > 1 ? vnetFlowHash((const uint8_t *)pvBuf, cb) % cPairs : 0;
+    for (uint32_t i = 0; i < cPairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[(iPair + i) % cPairs];
+        if (   vqueueIsReady(&pThis->VPCI, pPair->pRxQueue)
+            && !vqueueIsEmpty(&pThis->VPCI, pPair->pRxQueue))
+        {
+            *ppPair = pPair;
+            return pPair->pRxQueue;
+        }
+    }
+    return NULL;
+}
+
 /**
  * Pad and store received packet.
  *
@@ -750,10 +905,12 @@ static bool vnetAddressFilter(PVNETSTATE pThis, const void *pvBuf, size_t cb)
  * @param   pThis          The device state structure.
  * @param   pvBuf           The available data.
  * @param   cb              Number of bytes available in the buffer.
+ * @param   pGso            The GSO context of the packet, NULL if none.
+ * @param   pRxQueue        The receive queue to store the packet in.
  * @thread  RX
  */
 static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
-                              PCPDMNETWORKGSO pGso)
+                              PCPDMNETWORKGSO pGso, PVQUEUE pRxQueue)
 {
     VNETHDRMRX   Hdr;
     unsigned    uHdrLen;
@@ -807,7 +964,7 @@ static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
         VQUEUEELEM elem;
         unsigned int nSeg = 0, uElemSize = 0, cbReserved = 0;
 
-        if (!vqueueGet(&pThis->VPCI, pThis->pRxQueue, &elem))
+        if (!vqueueGet(&pThis->VPCI, pRxQueue, &elem))
         {
             /*
              * @todo: It is possible to run out of RX buffers if only a few
@@ -851,7 +1008,7 @@ static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
             uElemSize += uSize;
         }
         STAM_PROFILE_START(&pThis->StatReceiveStore, a);
-        vqueuePut(&pThis->VPCI, pThis->pRxQueue, &elem, uElemSize, cbReserved);
+        vqueuePut(&pThis->VPCI, pRxQueue, &elem, uElemSize, cbReserved);
         STAM_PROFILE_STOP(&pThis->StatReceiveStore, a);
         if (!vnetMergeableRxBuffers(pThis))
             break;
@@ -869,7 +1026,7 @@ static int vnetHandleRxPacket(PVNETSTATE pThis, const void *pvBuf, size_t cb,
             return rc;
         }
     }
-    vqueueSync(&pThis->VPCI, pThis->pRxQueue);
+    vqueueSync(&pThis->VPCI, pRxQueue);
     if (uOffset < cb)
     {
         Log(("%s vnetHandleRxPacket: Packet did not fit into RX queue (packet size=%u)!\n",
@@ -937,8 +1094,17 @@ static DECLCALLBACK(int) vnetNetworkDown_ReceiveGso(PPDMINETWORKDOWN pInterface,
         rc = vnetCsRxEnter(pThis, VERR_SEM_BUSY);
         if (RT_SUCCESS(rc))
         {
-            rc = vnetHandleRxPacket(pThis, pvBuf, cb, pGso);
-            STAM_REL_COUNTER_ADD(&pThis->StatReceiveBytes, cb);
+            PVNETQUEUEPAIR pPair;
+            PVQUEUE pRxQueue = vnetSelectRxQueue(pThis, pvBuf, cb, &pPair);
+            if (pRxQueue)
+            {
+                rc = vnetHandleRxPacket(pThis, pvBuf, cb, pGso, pRxQueue);
+                STAM_REL_COUNTER_ADD(&pThis->StatReceiveBytes, cb);
+                STAM_REL_COUNTER_INC(&pThis->StatReceivePackets);
+                STAM_REL_COUNTER_INC(&pPair->StatReceivePackets);
+            }
+            else
+                rc = VERR_NET_NO_BUFFER_SPACE;
             vnetCsRxLeave(pThis);
         }
     }
@@ -1093,33 +1259,75 @@ DECLINLINE(void) vnetCompleteChecksum(uint8_t *pBuf, unsigned cbSize, uint16_t u
     *(uint16_t*)(pBuf + uStart + uOffset) = vnetCSum16(pBuf + uStart, cbSize - uStart);
 }
 
-static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fOnWorkerThread)
+/**
+ * Wakes up the transmit thread of a queue pair.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pPair       The queue pair.
+ */
+static void vnetTxKick(PVNETSTATE pThis, PVNETQUEUEPAIR pPair)
 {
-    /*
-     * Only one thread is allowed to transmit at a time, others should skip
-     * transmission as the packets will be picked up by the transmitting
-     * thread.
-     */
-    if (!ASMAtomicCmpXchgU32(&pThis->uIsTransmitting, 1, 0))
-        return;
+    if (   pPair->hTxEvent != NIL_RTSEMEVENT
+        && !ASMAtomicXchgBool(&pPair->fTxKicked, true))
+    {
+        int rc = RTSemEventSignal(pPair->hTxEvent);
+        AssertRC(rc);
+    }
+}
+
+/**
+ * Kicks the transmit threads that found the driver busy.
+ *
+ * @param   pThis       The device state structure.
+ * @thread  TX
+ */
+static void vnetTxKickDeferred(PVNETSTATE pThis)
+{
+    for (uint32_t i = 0; i < pThis->cMaxQueuePairs; i++)
+        if (ASMAtomicReadBool(&pThis->aQueuePairs[i].fTxDeferred))
+            vnetTxKick(pThis, &pThis->aQueuePairs[i]);
+}
+
+/**
+ * Transmits the packets pending in the transmit queue of a queue pair.
+ *
+ * Only the transmit thread of the pair calls this, so there is a single
+ * consumer per queue and no need for serializing here.
+ *
+ * @returns VINF_SUCCESS if the queue was drained.
+ * @retval  VERR_TRY_AGAIN if another queue pair owns the driver, the owner
+ *          kicks us when it is done.
+ * @retval  VERR_NET_NO_BUFFER_SPACE if the driver ran out of buffers, it calls
+ *          pfnXmitPending when it has some again.
+ * @retval  VERR_INVALID_STATE if the guest driver is not ready.
+ * @retval  VERR_INVALID_PARAMETER if the queue holds a malformed descriptor
+ *          chain.
+ * @param   pThis       The device state structure.
+ * @param   pPair       The queue pair.
+ * @thread  TX
+ */
+static int vnetTransmitPendingPackets(PVNETSTATE pThis, PVNETQUEUEPAIR pPair)
+{
+    PVQUEUE pQueue = pPair->pTxQueue;
 
     if ((pThis->VPCI.uStatus & VPCI_STATUS_DRV_OK) == 0)
     {
         Log(("%s Ignoring transmit requests from non-existent driver (status=0x%x).\n",
              INSTANCE(pThis), pThis->VPCI.uStatus));
-        return;
+        return VERR_INVALID_STATE;
     }
 
     PPDMINETWORKUP pDrv = pThis->pDrv;
     if (pDrv)
     {
-        int rc = pDrv->pfnBeginXmit(pDrv, fOnWorkerThread);
+        /* Flag ourselves before trying so that the current owner is sure to
+           see it when it calls vnetTxKickDeferred. */
+        ASMAtomicWriteBool(&pPair->fTxDeferred, true);
+        int rc = pDrv->pfnBeginXmit(pDrv, true /*fOnWorkerThread*/);
         Assert(rc == VINF_SUCCESS || rc == VERR_TRY_AGAIN);
         if (rc == VERR_TRY_AGAIN)
-        {
-            ASMAtomicWriteU32(&pThis->uIsTransmitting, 0);
-            return;
-        }
+            return rc;
+        ASMAtomicWriteBool(&pPair->fTxDeferred, false);
     }
 
     unsigned int uHdrLen;
@@ -1128,11 +1336,17 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
     else
         uHdrLen = sizeof(VNETHDR);
 
-    Log3(("%s vnetTransmitPendingPackets: About to transmit %d pending packets\n", INSTANCE(pThis),
-          vringReadAvailIndex(&pThis->VPCI, &pThis->pTxQueue->VRing) - pThis->pTxQueue->uNextAvailIndex));
+    Log3(("%s vnetTransmitPendingPackets: About to transmit %d pending packets on %s\n", INSTANCE(pThis),
+          vringReadAvailIndex(&pThis->VPCI, &pQueue->VRing) - pQueue->uNextAvailIndex, pQueue->pcszName));
 
     vpciSetWriteLed(&pThis->VPCI, true);
 
+    /* The used ring is published to the guest once for the whole batch. */
+    bool fUsed = false;
+    /* The frames are handed to the driver in batches too. */
+    PPDMSCATTERGATHER apSgBufs[PDMINETWORKUP_MAX_SEND_BUFS];
+    uint32_t          cSgBufs = 0;
+    int               rcRet   = VINF_SUCCESS;
     VQUEUEELEM elem;
     /*
      * Do not remove descriptors from available ring yet, try to allocate the
@@ -1145,6 +1359,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
         {
             Log(("%s vnetQueueTransmit: The first segment is not the header! (%u < 2 || %u != %u).\n",
                  INSTANCE(pThis), elem.nOut, elem.aSegsOut[0].cb, uHdrLen));
+            rcRet = VERR_INVALID_PARAMETER;
             break; /* For now we simply ignore the header, but it must be there anyway! */
         }
         else
@@ -1164,6 +1379,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
                                   &Hdr, sizeof(Hdr));
 
                 STAM_REL_COUNTER_INC(&pThis->StatTransmitPackets);
+                STAM_REL_COUNTER_INC(&pPair->StatTransmitPackets);
 
                 STAM_PROFILE_START(&pThis->StatTransmitSend, a);
 
@@ -1171,6 +1387,13 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
                 /** @todo Optimize away the extra copying! (lazy bird) */
                 PPDMSCATTERGATHER pSgBuf;
                 int rc = pThis->pDrv->pfnAllocBuf(pThis->pDrv, uSize, pGso, &pSgBuf);
+                if (RT_FAILURE(rc) && cSgBufs)
+                {
+                    /* The pending frames may be holding the buffer space, flush them and retry. */
+                    PDMNetSendBufs(pThis->pDrv, apSgBufs, cSgBufs, false);
+                    cSgBufs = 0;
+                    rc = pThis->pDrv->pfnAllocBuf(pThis->pDrv, uSize, pGso, &pSgBuf);
+                }
                 if (RT_SUCCESS(rc))
                 {
                     Assert(pSgBuf->cSegs == 1);
@@ -1229,7 +1452,12 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
                                              Hdr.u16CSumStart, Hdr.u16CSumOffset);
                     }
 
-                    rc = pThis->pDrv->pfnSendBuf(pThis->pDrv, pSgBuf, false);
+                    apSgBufs[cSgBufs++] = pSgBuf;
+                    if (cSgBufs == RT_ELEMENTS(apSgBufs))
+                    {
+                        PDMNetSendBufs(pThis->pDrv, apSgBufs, cSgBufs, false);
+                        cSgBufs = 0;
+                    }
                 }
                 else
                 {
@@ -1237,6 +1465,7 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
                     STAM_PROFILE_STOP(&pThis->StatTransmitSend, a);
                     STAM_PROFILE_ADV_STOP(&pThis->StatTransmit, a);
                     /* Stop trying to fetch TX descriptors until we get more bandwidth. */
+                    rcRet = VERR_NET_NO_BUFFER_SPACE;
                     break;
                 }
 
@@ -1247,97 +1476,107 @@ static void vnetTransmitPendingPackets(PVNETSTATE pThis, PVQUEUE pQueue, bool fO
         /* Remove this descriptor chain from the available ring */
         vqueueSkip(&pThis->VPCI, pQueue);
         vqueuePut(&pThis->VPCI, pQueue, &elem, sizeof(VNETHDR) + uOffset);
-        vqueueSync(&pThis->VPCI, pQueue);
+        fUsed = true;
         STAM_PROFILE_ADV_STOP(&pThis->StatTransmit, a);
     }
+    if (cSgBufs)
+        PDMNetSendBufs(pDrv, apSgBufs, cSgBufs, false);
+    if (fUsed)
+        vqueueSync(&pThis->VPCI, pQueue);
     vpciSetWriteLed(&pThis->VPCI, false);
 
     if (pDrv)
+    {
         pDrv->pfnEndXmit(pDrv);
-    ASMAtomicWriteU32(&pThis->uIsTransmitting, 0);
+        vnetTxKickDeferred(pThis);
+    }
+    return rcRet;
 }
 
 /**
- * @interface_method_impl{PDMINETWORKDOWN,pfnXmitPending}
+ * Processes the transmit queue of a pair until the guest stops adding to it.
+ *
+ * Notifications are suppressed while the queue is being drained and turned
+ * back on once it is empty.  The queue is checked again afterwards as the
+ * guest may have added something just before noticing the change.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pPair       The queue pair.
+ * @thread  TX
  */
-static DECLCALLBACK(void) vnetNetworkDown_XmitPending(PPDMINETWORKDOWN pInterface)
+static void vnetTxProcess(PVNETSTATE pThis, PVNETQUEUEPAIR pPair)
 {
-    PVNETSTATE pThis = RT_FROM_MEMBER(pInterface, VNETSTATE, INetworkDown);
-    vnetTransmitPendingPackets(pThis, pThis->pTxQueue, false /*fOnWorkerThread*/);
+    PVQUEUE pQueue = pPair->pTxQueue;
+    while (vqueueIsReady(&pThis->VPCI, pQueue))
+    {
+        vqueueSetNotification(&pThis->VPCI, pQueue, false);
+        int rc = vnetTransmitPendingPackets(pThis, pPair);
+        if (rc == VERR_TRY_AGAIN)
+            break; /* Notifications stay off, we'll be back shortly. */
+        vqueueSetNotification(&pThis->VPCI, pQueue, true);
+        if (   rc != VINF_SUCCESS
+            || vqueueIsEmpty(&pThis->VPCI, pQueue))
+            break;
+    }
 }
 
-#ifdef VNET_TX_DELAY
-
-static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
+/**
+ * @callback_method_impl{FNPDMTHREADDEV, The transmit thread of a queue pair.}
+ */
+static DECLCALLBACK(int) vnetTxThread(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
 {
-    PVNETSTATE pThis = (PVNETSTATE)pvState;
+    PVNETSTATE     pThis = PDMINS_2_DATA(pDevIns, PVNETSTATE);
+    PVNETQUEUEPAIR pPair = (PVNETQUEUEPAIR)pThread->pvUser;
 
-    if (TMTimerIsActive(pThis->CTX_SUFF(pTxTimer)))
-    {
-        int rc = TMTimerStop(pThis->CTX_SUFF(pTxTimer));
-        Log3(("%s vnetQueueTransmit: Got kicked with notification disabled, "
-              "re-enable notification and flush TX queue\n", INSTANCE(pThis)));
-        vnetTransmitPendingPackets(pThis, pQueue, false /*fOnWorkerThread*/);
-        if (RT_FAILURE(vnetCsEnter(pThis, VERR_SEM_BUSY)))
-            LogRel(("vnetQueueTransmit: Failed to enter critical section!/n"));
-        else
-        {
-            vringSetNotification(&pThis->VPCI, &pThis->pTxQueue->VRing, true);
-            vnetCsLeave(pThis);
-        }
-    }
-    else
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
     {
-        if (RT_FAILURE(vnetCsEnter(pThis, VERR_SEM_BUSY)))
-            LogRel(("vnetQueueTransmit: Failed to enter critical section!/n"));
-        else
+        RTMSINTERVAL cMillies = ASMAtomicReadBool(&pPair->fTxDeferred) ? VNET_TX_RETRY_MS : RT_INDEFINITE_WAIT;
+        int rc = RTSemEventWait(pPair->hTxEvent, cMillies);
+        if (RT_FAILURE(rc) && rc != VERR_TIMEOUT && rc != VERR_INTERRUPTED)
         {
-            vringSetNotification(&pThis->VPCI, &pThis->pTxQueue->VRing, false);
-            TMTimerSetMicro(pThis->CTX_SUFF(pTxTimer), VNET_TX_DELAY);
-            pThis->u64NanoTS = RTTimeNanoTS();
-            vnetCsLeave(pThis);
+            AssertLogRelMsgFailed(("%s vnetTxThread: RTSemEventWait -> %Rrc\n", INSTANCE(pThis), rc));
+            return rc;
         }
+        ASMAtomicWriteBool(&pPair->fTxKicked, false);
+        if (RT_UNLIKELY(pThread->enmState != PDMTHREADSTATE_RUNNING))
+            break;
+
+        STAM_REL_COUNTER_INC(&pPair->StatTxWakeups);
+        vnetTxProcess(pThis, pPair);
     }
+    return VINF_SUCCESS;
 }
 
 /**
- * @callback_method_impl{FNTMTIMERDEV, Transmit Delay Timer handler.}
+ * @callback_method_impl{FNPDMTHREADWAKEUPDEV}
  */
-static DECLCALLBACK(void) vnetTxTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, void *pvUser)
+static DECLCALLBACK(int) vnetTxThreadWakeUp(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
 {
-    PVNETSTATE pThis = (PVNETSTATE)pvUser;
-
-    uint32_t u32MicroDiff = (uint32_t)((RTTimeNanoTS() - pThis->u64NanoTS)/1000);
-    if (u32MicroDiff < pThis->u32MinDiff)
-        pThis->u32MinDiff = u32MicroDiff;
-    if (u32MicroDiff > pThis->u32MaxDiff)
-        pThis->u32MaxDiff = u32MicroDiff;
-    pThis->u32AvgDiff = (pThis->u32AvgDiff * pThis->u32i + u32MicroDiff) / (pThis->u32i + 1);
-    pThis->u32i++;
-    Log3(("vnetTxTimer: Expired, diff %9d usec, avg %9d usec, min %9d usec, max %9d usec\n",
-            u32MicroDiff, pThis->u32AvgDiff, pThis->u32MinDiff, pThis->u32MaxDiff));
-
-//    Log3(("%s vnetTxTimer: Expired\n", INSTANCE(pThis)));
-    vnetTransmitPendingPackets(pThis, pThis->pTxQueue, false /*fOnWorkerThread*/);
-    if (RT_FAILURE(vnetCsEnter(pThis, VERR_SEM_BUSY)))
-    {
-        LogRel(("vnetTxTimer: Failed to enter critical section!/n"));
-        return;
-    }
-    vringSetNotification(&pThis->VPCI, &pThis->pTxQueue->VRing, true);
-    vnetCsLeave(pThis);
+    PVNETQUEUEPAIR pPair = (PVNETQUEUEPAIR)pThread->pvUser;
+    return RTSemEventSignal(pPair->hTxEvent);
 }
 
-#else /* !VNET_TX_DELAY */
-
-static DECLCALLBACK(void) vnetQueueTransmit(void *pvState, PVQUEUE pQueue)
+/**
+ * @interface_method_impl{PDMINETWORKDOWN,pfnXmitPending}
+ */
+static DECLCALLBACK(void) vnetNetworkDown_XmitPending(PPDMINETWORKDOWN pInterface)
 {
-    PVNETSTATE pThis = (PVNETSTATE)pvState;
-
-    vnetTransmitPendingPackets(pThis, pQueue, false /*fOnWorkerThread*/);
+    PVNETSTATE pThis = RT_FROM_MEMBER(pInterface, VNETSTATE, INetworkDown);
+    for (uint32_t i = 0; i < pThis->cMaxQueuePairs; i++)
+        vnetTxKick(pThis, &pThis->aQueuePairs[i]);
 }
 
-#endif /* !VNET_TX_DELAY */
+/**
+ * The guest added to a transmit queue, wake up the transmit thread.
+ */
+static void vnetQueueTransmit(PVNETSTATE pThis, PVNETQUEUEPAIR pPair)
+{
+    Log3(("%s vnetQueueTransmit: Kicking the transmit thread of %s\n", INSTANCE(pThis), pPair->pTxQueue->pcszName));
+    vnetTxKick(pThis, pPair);
+}
 
 static uint8_t vnetControlRx(PVNETSTATE pThis, PVNETCTLHDR pCtlHdr, PVQUEUEELEM pElem)
 {
@@ -1492,11 +1731,44 @@ static uint8_t vnetControlVlan(PVNETSTATE pThis, PVNETCTLHDR pCtlHdr, PVQUEUEELE
     return u8Ack;
 }
 
+static uint8_t vnetControlMq(PVNETSTATE pThis, PVNETCTLHDR pCtlHdr, PVQUEUEELEM pElem)
+{
+    uint16_t cPairs;
+
+    if (pElem->nOut != 2 || pElem->aSegsOut[1].cb != sizeof(cPairs))
+    {
+        Log(("%s vnetControlMq: Segment layout is wrong "
+             "(u8Command=%u nOut=%u cb=%u)\n", INSTANCE(pThis),
+             pCtlHdr->u8Command, pElem->nOut, pElem->aSegsOut[1].cb));
+        return VNET_ERROR;
+    }
+    if (pCtlHdr->u8Command != VNET_CTRL_CMD_MQ_VQ_PAIRS_SET)
+        return VNET_ERROR;
+
+    PDMDevHlpPhysRead(pThis->VPCI.CTX_SUFF(pDevIns),
+                      pElem->aSegsOut[1].addr,
+                      &cPairs, sizeof(cPairs));
+
+    if (   !(pThis->VPCI.uGuestFeatures & VNET_F_MQ)
+        || cPairs < 1
+        || cPairs > pThis->cMaxQueuePairs)
+    {
+        Log(("%s vnetControlMq: Number of queue pairs is out of range "
+             "(cPairs=%u max=%u)\n", INSTANCE(pThis), cPairs, pThis->cMaxQueuePairs));
+        return VNET_ERROR;
+    }
+
+    Log(("%s vnetControlMq: Using %u queue pairs\n", INSTANCE(pThis), cPairs));
+    ASMAtomicWriteU32(&pThis->cActiveQueuePairs, cPairs);
+    return VNET_OK;
+}
+
 
 static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
 {
     PVNETSTATE pThis = (PVNETSTATE)pvState;
     uint8_t u8Ack;
+    bool fUsed = false;
     VQUEUEELEM elem;
     while (vqueueGet(&pThis->VPCI, pQueue, &elem))
     {
@@ -1534,6 +1806,9 @@ static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
                 case VNET_CTRL_CLS_VLAN:
                     u8Ack = vnetControlVlan(pThis, &CtlHdr, &elem);
                     break;
+                case VNET_CTRL_CLS_MQ:
+                    u8Ack = vnetControlMq(pThis, &CtlHdr, &elem);
+                    break;
                 default:
                     u8Ack = VNET_ERROR;
             }
@@ -1544,8 +1819,29 @@ static DECLCALLBACK(void) vnetQueueControl(void *pvState, PVQUEUE pQueue)
                                   &u8Ack, sizeof(u8Ack));
         }
         vqueuePut(&pThis->VPCI, pQueue, &elem, sizeof(u8Ack));
-        vqueueSync(&pThis->VPCI, pQueue);
+        fUsed = true;
     }
+    if (fUsed)
+        vqueueSync(&pThis->VPCI, pQueue);
+}
+
+/**
+ * Queue notification callback shared by all queues.
+ *
+ * Which queue is which depends on whether the guest negotiated VNET_F_MQ,
+ * see vnetCtlQueueIndex, so the role is worked out on every kick.
+ */
+static DECLCALLBACK(void) vnetQueueNotify(void *pvState, PVQUEUE pQueue)
+{
+    PVNETSTATE pThis  = (PVNETSTATE)pvState;
+    uint32_t   iQueue = (uint32_t)(pQueue - &pThis->VPCI.Queues[0]);
+
+    if (iQueue == vnetCtlQueueIndex(pThis))
+        vnetQueueControl(pvState, pQueue);
+    else if (iQueue & 1)
+        vnetQueueTransmit(pThis, &pThis->aQueuePairs[iQueue / 2]);
+    else
+        vnetQueueReceive(pvState, pQueue);
 }
 
 
@@ -1616,6 +1912,8 @@ static DECLCALLBACK(int) vnetSaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
     AssertRCReturn(rc, rc);
     rc = SSMR3PutMem( pSSM, pThis->aVlanFilter, sizeof(pThis->aVlanFilter));
     AssertRCReturn(rc, rc);
+    rc = SSMR3PutU32( pSSM, pThis->cActiveQueuePairs);
+    AssertRCReturn(rc, rc);
     Log(("%s State has been saved\n", INSTANCE(pThis)));
     return VINF_SUCCESS;
 }
@@ -1677,8 +1975,14 @@ static DECLCALLBACK(int) vnetLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint3
         && (uPass == 0 || !PDMDevHlpVMTeleportedAndNotFullyResumedYet(pDevIns)))
         LogRel(("%s: The mac address differs: config=%RTmac saved=%RTmac\n", INSTANCE(pThis), &pThis->macConfigured, &macConfigured));
 
-    rc = vpciLoadExec(&pThis->VPCI, pSSM, uVersion, uPass, VNET_N_QUEUES);
+    rc = vpciLoadExec(&pThis->VPCI, pSSM, RT_MIN(uVersion, VIRTIO_SAVEDSTATE_VERSION), uPass, VNET_N_QUEUES);
     AssertRCReturn(rc, rc);
+    /* States saved with fewer queue pairs are fine, the rest simply stays unused. */
+    uint32_t const cQueues = pThis->cMaxQueuePairs * 2 + 1;
+    if (pThis->VPCI.nQueues > cQueues)
+        return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("The saved state has %u queues while the configuration allows for %u"),
+                                pThis->VPCI.nQueues, cQueues);
+    pThis->VPCI.nQueues = cQueues;
 
     if (uPass == SSM_PASS_FINAL)
     {
@@ -1717,6 +2021,17 @@ static DECLCALLBACK(int) vnetLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint3
             if (pThis->pDrv)
                 pThis->pDrv->pfnSetPromiscuousMode(pThis->pDrv, true);
         }
+
+        uint32_t cPairs = 1;
+        if (uVersion > VNET_SAVEDSTATE_VERSION_PRE_MQ)
+        {
+            rc = SSMR3GetU32(pSSM, &cPairs);
+            AssertRCReturn(rc, rc);
+            AssertLogRelMsgReturn(cPairs >= 1 && cPairs <= pThis->cMaxQueuePairs,
+                                  ("%s: %u queue pairs active\n", INSTANCE(pThis), cPairs),
+                                  VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+        }
+        pThis->cActiveQueuePairs = cPairs;
     }
 
     return rc;
@@ -1898,9 +2213,6 @@ static DECLCALLBACK(void) vnetRelocate(PPDMDEVINS pDevIns, RTGCINTPTR offDelta)
     PVNETSTATE pThis = PDMINS_2_DATA(pDevIns, PVNETSTATE);
     vpciRelocate(pDevIns, offDelta);
     pThis->pCanRxQueueRC = PDMQueueRCPtr(pThis->pCanRxQueueR3);
-#ifdef VNET_TX_DELAY
-    pThis->pTxTimerRC    = TMTimerRCPtr(pThis->pTxTimerR3);
-#endif /* VNET_TX_DELAY */
     // TBD
 }
 
@@ -1913,9 +2225,21 @@ static DECLCALLBACK(int) vnetDestruct(PPDMDEVINS pDevIns)
     PVNETSTATE pThis = PDMINS_2_DATA(pDevIns, PVNETSTATE);
     PDMDEV_CHECK_VERSIONS_RETURN_QUIET(pDevIns);
 
-    LogRel(("TxTimer stats (avg/min/max): %7d usec %7d usec %7d usec\n",
-            pThis->u32AvgDiff, pThis->u32MinDiff, pThis->u32MaxDiff));
     Log(("%s Destroying instance\n", INSTANCE(pThis)));
+    for (uint32_t i = 0; i < RT_ELEMENTS(pThis->aQueuePairs); i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+        if (pPair->pTxThread)
+        {
+            PDMR3ThreadDestroy(pPair->pTxThread, NULL);
+            pPair->pTxThread = NULL;
+        }
+        if (pPair->hTxEvent != NIL_RTSEMEVENT)
+        {
+            RTSemEventDestroy(pPair->hTxEvent);
+            pPair->hTxEvent = NIL_RTSEMEVENT;
+        }
+    }
     if (pThis->hEventMoreRxDescAvail != NIL_RTSEMEVENT)
     {
         RTSemEventSignal(pThis->hEventMoreRxDescAvail);
@@ -1941,6 +2265,34 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
 
     /* Initialize the instance data suffiencently for the destructor not to blow up. */
     pThis->hEventMoreRxDescAvail = NIL_RTSEMEVENT;
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aQueuePairs); i++)
+        pThis->aQueuePairs[i].hTxEvent = NIL_RTSEMEVENT;
+
+    /*
+     * Validate configuration.
+     */
+    if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "LineSpeed\0" "LinkUpDelay\0" "IntDelayMax\0"
+                                    "QueuePairs\0"))
+                    return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
+                                            N_("Invalid configuration for VirtioNet device"));
+
+    /** @cfgm{QueuePairs, uint32_t, 1}
+     * Number of receive/transmit queue pairs offered to the guest, each with its
+     * own transmit thread.  More than one makes the device offer VNET_F_MQ.
+     * Values above 1 are only accepted by builds with VBOX_WITH_VIRTIO_NET_MQ
+     * until the throughput scaling has been measured. */
+    rc = CFGMR3QueryU32Def(pCfg, "QueuePairs", &pThis->cMaxQueuePairs, 1);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'QueuePairs'"));
+    if (pThis->cMaxQueuePairs < 1 || pThis->cMaxQueuePairs > VNET_MAX_QUEUE_PAIRS)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: 'QueuePairs' must be between 1 and %u"), VNET_MAX_QUEUE_PAIRS);
+#ifndef VBOX_WITH_VIRTIO_NET_MQ
+    if (pThis->cMaxQueuePairs > 1)
+        return PDMDevHlpVMSetError(pDevIns, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                                   N_("Configuration error: 'QueuePairs' values above 1 are not supported by this build"));
+#endif
 
     /* Do our own locking. */
     rc = PDMDevHlpSetDeviceCritSect(pDevIns, PDMDevHlpCritSectGetNop(pDevIns));
@@ -1950,19 +2302,25 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     pThis->VPCI.IBase.pfnQueryInterface    = vnetQueryInterface;
     rc = vpciConstruct(pDevIns, &pThis->VPCI, iInstance,
                        VNET_NAME_FMT, VNET_PCI_SUBSYSTEM_ID,
-                       VNET_PCI_CLASS, VNET_N_QUEUES);
-    pThis->pRxQueue  = vpciAddQueue(&pThis->VPCI, 256, vnetQueueReceive,  "RX ");
-    pThis->pTxQueue  = vpciAddQueue(&pThis->VPCI, 256, vnetQueueTransmit, "TX ");
-    pThis->pCtlQueue = vpciAddQueue(&pThis->VPCI, 16,  vnetQueueControl,  "CTL");
-
-    Log(("%s Constructing new instance\n", INSTANCE(pThis)));
-
+                       VNET_PCI_CLASS, pThis->cMaxQueuePairs * 2 + 1);
     /*
-     * Validate configuration.
+     * The queues are laid out as RX0, TX0, RX1, TX1, ..., CTL.  A guest that
+     * does not negotiate VNET_F_MQ uses queue 2 as the control queue, see
+     * vnetCtlQueueIndex.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "MAC\0" "CableConnected\0" "LineSpeed\0" "LinkUpDelay\0"))
-                    return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
-                                            N_("Invalid configuration for VirtioNet device"));
+    static const char * const s_apszQueueNames[VNET_MAX_QUEUE_PAIRS][2] =
+    {
+        { "RX0", "TX0" }, { "RX1", "TX1" }, { "RX2", "TX2" }, { "RX3", "TX3" },
+        { "RX4", "TX4" }, { "RX5", "TX5" }, { "RX6", "TX6" }, { "RX7", "TX7" }
+    };
+    for (uint32_t i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        pThis->aQueuePairs[i].pRxQueue = vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, s_apszQueueNames[i][0]);
+        pThis->aQueuePairs[i].pTxQueue = vpciAddQueue(&pThis->VPCI, 256, vnetQueueNotify, s_apszQueueNames[i][1]);
+    }
+    vpciAddQueue(&pThis->VPCI, 16, vnetQueueNotify, "CTL");
+
+    Log(("%s Constructing new instance\n", INSTANCE(pThis)));
 
     /* Get config params */
     rc = CFGMR3QueryBytes(pCfg, "MAC", pThis->macConfigured.au8,
@@ -1987,12 +2345,27 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     Log(("%s Link up delay is set to %u seconds\n",
          INSTANCE(pThis), pThis->cMsLinkUpDelay / 1000));
 
+    /** @cfgm{IntDelayMax, uint32_t, 100}
+     * Upper bound of the adaptive queue interrupt delay in microseconds,
+     * 0 disables interrupt moderation. */
+    uint32_t cUsIntDelayMax;
+    rc = CFGMR3QueryU32Def(pCfg, "IntDelayMax", &cUsIntDelayMax, VNET_INT_DELAY_MAX_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'IntDelayMax'"));
+    if (cUsIntDelayMax > VNET_INT_DELAY_MAX_LIMIT)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: 'IntDelayMax' must not exceed %u"), VNET_INT_DELAY_MAX_LIMIT);
+    rc = vpciIntModerationInit(&pThis->VPCI, 0, cUsIntDelayMax);
+    AssertRCReturn(rc, rc);
+
 
     vnetPrintFeatures(pThis, vnetIoCb_GetHostFeatures(pThis), "Device supports the following features");
 
     /* Initialize PCI config space */
     memcpy(pThis->config.mac.au8, pThis->macConfigured.au8, sizeof(pThis->config.mac.au8));
     pThis->config.uStatus = 0;
+    pThis->config.uMaxVirtqueuePairs = (uint16_t)pThis->cMaxQueuePairs;
 
     /* Initialize state structure */
     pThis->u32PktNo     = 1;
@@ -2023,7 +2396,7 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
 
 
     /* Register save/restore state handlers. */
-    rc = PDMDevHlpSSMRegisterEx(pDevIns, VIRTIO_SAVEDSTATE_VERSION, sizeof(VNETSTATE), NULL,
+    rc = PDMDevHlpSSMRegisterEx(pDevIns, VNET_SAVEDSTATE_VERSION, sizeof(VNETSTATE), NULL,
                                 NULL,         vnetLiveExec, NULL,
                                 vnetSavePrep, vnetSaveExec, NULL,
                                 vnetLoadPrep, vnetLoadExec, vnetLoadDone);
@@ -2045,19 +2418,21 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     if (RT_FAILURE(rc))
         return rc;
 
-#ifdef VNET_TX_DELAY
-    /* Create Transmit Delay Timer */
-    rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, vnetTxTimer, pThis,
-                                TMTIMER_FLAGS_NO_CRIT_SECT,
-                                "VirtioNet TX Delay Timer", &pThis->pTxTimerR3);
-    if (RT_FAILURE(rc))
-        return rc;
-    pThis->pTxTimerR0 = TMTimerR0Ptr(pThis->pTxTimerR3);
-    pThis->pTxTimerRC = TMTimerRCPtr(pThis->pTxTimerR3);
-
-    pThis->u32i = pThis->u32AvgDiff = pThis->u32MaxDiff = 0;
-    pThis->u32MinDiff = ~0;
-#endif /* VNET_TX_DELAY */
+    /* Create the transmit threads, one per queue pair. */
+    for (uint32_t i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+        rc = RTSemEventCreate(&pPair->hTxEvent);
+        if (RT_FAILURE(rc))
+            return rc;
+        char szName[16];
+        RTStrPrintf(szName, sizeof(szName), "%sTx%u", INSTANCE(pThis), i);
+        rc = PDMDevHlpThreadCreate(pDevIns, &pPair->pTxThread, pPair, vnetTxThread, vnetTxThreadWakeUp,
+                                   0, RTTHREADTYPE_IO, szName);
+        if (RT_FAILURE(rc))
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("VirtioNet: Failed to create the transmit thread for queue pair %u"), i);
+    }
 
     rc = PDMDevHlpDriverAttach(pDevIns, 0, &pThis->VPCI.IBase, &pThis->pDrvBase, "Network Port");
     if (RT_SUCCESS(rc))
@@ -2090,9 +2465,17 @@ static DECLCALLBACK(int) vnetConstruct(PPDMDEVINS pDevIns, int iInstance, PCFGMN
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveBytes,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data received",            "/Devices/VNet%d/ReceiveBytes", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitBytes,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,          "Amount of data transmitted",         "/Devices/VNet%d/TransmitBytes", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveGSO,         STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of received GSO packets",     "/Devices/VNet%d/Packets/ReceiveGSO", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceivePackets,     STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of received packets",         "/Devices/VNet%d/Packets/Receive", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitPackets,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of sent packets",             "/Devices/VNet%d/Packets/Transmit", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitGSO,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of sent GSO packets",         "/Devices/VNet%d/Packets/Transmit-Gso", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatTransmitCSum,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,          "Number of completed TX checksums",   "/Devices/VNet%d/Packets/Transmit-Csum", iInstance);
+    for (uint32_t i = 0; i < pThis->cMaxQueuePairs; i++)
+    {
+        PVNETQUEUEPAIR pPair = &pThis->aQueuePairs[i];
+        PDMDevHlpSTAMRegisterF(pDevIns, &pPair->StatReceivePackets, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,      "Number of packets received on the pair", "/Devices/VNet%d/Pair%u/Receive", iInstance, i);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pPair->StatTransmitPackets, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,     "Number of packets sent on the pair",   "/Devices/VNet%d/Pair%u/Transmit", iInstance, i);
+        PDMDevHlpSTAMRegisterF(pDevIns, &pPair->StatTxWakeups,      STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES, "Number of transmit thread wakeups",    "/Devices/VNet%d/Pair%u/TxWakeups", iInstance, i);
+    }
 #if defined(VBOX_WITH_STATISTICS)
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceive,            STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive",                  "/Devices/VNet%d/Receive/Total", iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReceiveStore,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling receive storing",          "/Devices/VNet%d/Receive/Store", iInstance);
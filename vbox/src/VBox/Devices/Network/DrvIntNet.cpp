@@ -46,6 +46,7 @@
 #endif
 
 #include "VBoxDD.h"
+#include "NetRxCoalesce.h"
 
 
 /*******************************************************************************
@@ -167,6 +168,10 @@ typedef struct DRVINTNET
     STAMCOUNTER                     StatXmitWakeupR3;
     /** The times the xmit thread has been told to process the ring. */
     STAMCOUNTER                     StatXmitProcessRing;
+    /** Number of frame batches sent thru pfnSendBufs. */
+    STAMCOUNTER                     StatSendBatches;
+    /** Receive coalescing state, only used by the receive thread. */
+    NETRXCOALESCE                   RxCoalesce;
 #ifdef VBOX_WITH_STATISTICS
     /** Profiling packet transmit runs. */
     STAMPROFILE                     StatTransmit;
@@ -519,6 +524,47 @@ PDMBOTHCBDECL(int) drvIntNetUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGAT
 }
 
 
+#ifdef IN_RING3
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBufs}
+ */
+static DECLCALLBACK(int) drvIntNetUp_SendBufs(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs,
+                                              bool fOnWorkerThread)
+{
+    PDRVINTNET  pThis = RT_FROM_MEMBER(pInterface, DRVINTNET, INetworkUpR3);
+    STAM_PROFILE_START(&pThis->StatTransmit, a);
+    NOREF(fOnWorkerThread);
+    Assert(PDMCritSectIsOwner(&pThis->XmitLock));
+
+    /* Set an FTM checkpoint as this operation changes the state permanently. */
+    PDMDrvHlpFTSetCheckpoint(pThis->pDrvInsR3, FTMCHECKPOINTTYPE_NETWORK);
+
+    /*
+     * Commit all the frames (they must be committed in allocation order)
+     * and then push them thru the switch in one go.
+     */
+    for (uint32_t i = 0; i < cSgBufs; i++)
+    {
+        PPDMSCATTERGATHER pSgBuf = papSgBufs[i];
+        AssertPtr(pSgBuf);
+        Assert(pSgBuf->fFlags == (PDMSCATTERGATHER_FLAGS_MAGIC | PDMSCATTERGATHER_FLAGS_OWNER_1));
+        Assert(pSgBuf->cbUsed <= pSgBuf->cbAvailable);
+        if (pSgBuf->pvUser)
+            STAM_COUNTER_INC(&pThis->StatSentGso);
+
+        IntNetRingCommitFrameEx(&pThis->pBufR3->Send, (PINTNETHDR)pSgBuf->pvAllocator, pSgBuf->cbUsed);
+        RTMemCacheFree(pThis->hSgCache, pSgBuf);
+    }
+    STAM_COUNTER_INC(&pThis->StatSendBatches);
+
+    int rc = drvIntNetProcessXmit(pThis);
+    STAM_PROFILE_STOP(&pThis->StatTransmit, a);
+    return rc;
+}
+
+#endif /* IN_RING3 */
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
  */
@@ -665,6 +711,26 @@ static int drvR3IntNetRecvWaitForSpace(PDRVINTNET pThis)
 }
 
 
+/**
+ * @callback_method_impl{FNNETRXCOALESCEDELIVER}
+ */
+static DECLCALLBACK(int) drvR3IntNetRecvDeliver(void *pvUser, const void *pvFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    PDRVINTNET pThis = (PDRVINTNET)pvUser;
+    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, 0);
+    if (rc != VINF_SUCCESS)
+    {
+        rc = drvR3IntNetRecvWaitForSpace(pThis);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    if (!pGso)
+        return pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvFrame, cbFrame);
+    rc = pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pvFrame, cbFrame, pGso);
+    return RT_SUCCESS(rc) ? rc : VERR_NOT_SUPPORTED;
+}
+
+
 /**
  * Executes async I/O (RUNNING mode).
  *
@@ -696,6 +762,7 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
              */
             if (pThis->enmRecvState != RECVSTATE_RUNNING)
             {
+                NetRxCoalesceFlush(&pThis->RxCoalesce);
                 STAM_PROFILE_ADV_STOP(&pThis->StatReceive, a);
                 LogFlow(("drvR3IntNetRecvRun: returns VERR_STATE_CHANGED (state changed - #0)\n"));
                 return VERR_STATE_CHANGED;
@@ -708,9 +775,24 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
                 &&  !pThis->fLinkDown)
             {
                 /*
-                 * Check if there is room for the frame and pass it up.
+                 * Try merge TCP segments into a bigger GSO frame first, the
+                 * coalescer delivers whatever it held if this frame doesn't fit.
                  */
                 size_t cbFrame = pHdr->cbFrame;
+                if (u16Type == INTNETHDR_TYPE_FRAME)
+                {
+                    if (NetRxCoalesceAdd(&pThis->RxCoalesce, IntNetHdrGetFramePtr(pHdr, pBuf), cbFrame))
+                    {
+                        IntNetRingSkipFrame(pRingBuf);
+                        continue;
+                    }
+                }
+                else
+                    NetRxCoalesceFlush(&pThis->RxCoalesce);
+
+                /*
+                 * Check if there is room for the frame and pass it up.
+                 */
                 int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, 0);
                 if (rc == VINF_SUCCESS)
                 {
@@ -830,12 +912,20 @@ static int drvR3IntNetRecvRun(PDRVINTNET pThis)
                 /*
                  * Link down or unknown frame - skip to the next frame.
                  */
+                if (pThis->fLinkDown)
+                    NetRxCoalesceDiscard(&pThis->RxCoalesce);
                 AssertMsg(IntNetIsValidFrameType(pHdr->u16Type), ("Unknown frame type %RX16! offRead=%#x\n", pHdr->u16Type, pRingBuf->offReadX));
                 IntNetRingSkipFrame(pRingBuf);
                 STAM_REL_COUNTER_INC(&pBuf->cStatBadFrames);
             }
         } /* while more received data */
 
+        /* The ring is drained, don't sit on merged segments while waiting. */
+        if (!pThis->fLinkDown)
+            NetRxCoalesceFlush(&pThis->RxCoalesce);
+        else
+            NetRxCoalesceDiscard(&pThis->RxCoalesce);
+
         /*
          * Wait for data, checking the state before we block.
          */
@@ -1184,12 +1274,18 @@ static DECLCALLBACK(void) drvR3IntNetDestruct(PPDMDRVINS pDrvIns)
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatYieldsNok);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatLost);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatBadFrames);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatSwitchHashed);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatSwitchScanned);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend1);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend2);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv1);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv2);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceivedGso);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatSentGso);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatSendBatches);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->RxCoalesce.StatSegsMerged);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->RxCoalesce.StatGsoFrames);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->RxCoalesce.StatRefused);
 #ifdef VBOX_WITH_STATISTICS
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
@@ -1227,6 +1323,8 @@ static DECLCALLBACK(void) drvR3IntNetDestruct(PPDMDRVINS pDrvIns)
     RTMemCacheDestroy(pThis->hSgCache);
     pThis->hSgCache = NIL_RTMEMCACHE;
 
+    NetRxCoalesceTerm(&pThis->RxCoalesce);
+
     if (PDMCritSectIsInitialized(&pThis->XmitLock))
         PDMR3CritSectDelete(&pThis->XmitLock);
 }
@@ -1335,6 +1433,7 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     pThis->INetworkUpR3.pfnAllocBuf                 = drvIntNetUp_AllocBuf;
     pThis->INetworkUpR3.pfnFreeBuf                  = drvIntNetUp_FreeBuf;
     pThis->INetworkUpR3.pfnSendBuf                  = drvIntNetUp_SendBuf;
+    pThis->INetworkUpR3.pfnSendBufs                 = drvIntNetUp_SendBufs;
     pThis->INetworkUpR3.pfnEndXmit                  = drvIntNetUp_EndXmit;
     pThis->INetworkUpR3.pfnSetPromiscuousMode       = drvIntNetUp_SetPromiscuousMode;
     pThis->INetworkUpR3.pfnNotifyLinkChanged        = drvR3IntNetUp_NotifyLinkChanged;
@@ -1361,7 +1460,8 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
                                   "|TrunkPolicyWire"
                                   "|IsService"
                                   "|IgnoreConnectFailure"
-                                  "|Workaround1",
+                                  "|Workaround1"
+                                  "|RxCoalesce",
                                   "");
 
     /*
@@ -1652,6 +1752,21 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     if (fWorkaround1)
         OpenReq.fFlags |= INTNET_OPEN_FLAGS_WORKAROUND_1;
 
+    /** @cfgm{RxCoalesce, boolean, true}
+     * Merge received TCP segments into GSO frames when the device above can take
+     * them (large receive offload). */
+    bool fRxCoalesce;
+    rc = CFGMR3QueryBoolDef(pCfg, "RxCoalesce", &fRxCoalesce, true);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("Configuration error: Failed to get the \"RxCoalesce\" value"));
+    if (fRxCoalesce && pThis->pIAboveNet->pfnReceiveGso)
+    {
+        rc = NetRxCoalesceInit(&pThis->RxCoalesce, drvR3IntNetRecvDeliver, pThis);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     LogRel(("IntNet#%u: szNetwork={%s} enmTrunkType=%d szTrunk={%s} fFlags=%#x cbRecv=%u cbSend=%u fIgnoreConnectFailure=%RTbool\n",
             pDrvIns->iInstance, OpenReq.szNetwork, OpenReq.enmTrunkType, OpenReq.szTrunk, OpenReq.fFlags,
             OpenReq.cbRecv, OpenReq.cbSend, fIgnoreConnectFailure));
@@ -1753,11 +1868,17 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatReceivedGso,            "Packets/Received-Gso", "The GSO portion of the received packets.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatSentGso,                "Packets/Sent-Gso",     "The GSO portion of the sent packets.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatSentR0,                 "Packets/Sent-R0",      "The ring-0 portion of the sent packets.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->StatSendBatches,            "Packets/Sent-Batches", "Number of frame batches sent in one go.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->RxCoalesce.StatSegsMerged,  "Packets/Received-Coalesced", "Received segments merged into GSO frames.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->RxCoalesce.StatGsoFrames,   "Packets/Received-Lro", "GSO frames built from the received segments.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->RxCoalesce.StatRefused,     "Packets/Received-LroRefused", "Merged GSO frames the device refused.");
 
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatLost,          "Packets/Lost",         "Number of lost packets.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatYieldsNok,     "YieldOk",              "Number of times yielding helped fix an overflow.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatYieldsOk,      "YieldNok",             "Number of times yielding didn't help fix an overflow.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatBadFrames,     "BadFrames",            "Number of bad frames seed by the consumers.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatSwitchHashed,  "Switch/Hashed",        "Unicast frames switched by MAC address hash lookup.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatSwitchScanned, "Switch/Scanned",       "Unicast frames switched by scanning the MAC address table.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSend1,          "Send1",                "Profiling IntNetR0IfSend.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSend2,          "Send2",                "Profiling sending to the trunk.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatRecv1,          "Recv1",                "Reserved for future receive profiling.");
@@ -39,6 +39,7 @@
 #include <iprt/uuid.h>
 
 #include "VBoxDD.h"
+#include "NetRxCoalesce.h"
 
 #ifndef RT_OS_WINDOWS
 # include <unistd.h>
@@ -120,9 +121,51 @@ do                                                      \
         x.s_addr = def;                                 \
 } while (0)
 
+/** The maximum number of NAT engine shards per driver instance. */
+#define DRVNAT_MAX_SHARDS       8
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
+/**
+ * A NAT engine shard.
+ *
+ * Each shard runs its own slirp instance, i.e. its own socket set and mbuf
+ * zone, on a dedicated thread.  Shard 0 is the primary one and handles
+ * everything except the TCP and UDP flows which drvNATSelectShard() hashes
+ * onto the other shards.
+ */
+typedef struct DRVNATSHARD
+{
+    /** Pointer to the NAT instance owning this shard. */
+    struct DRVNAT          *pThis;
+    /** NAT state for this shard. */
+    PNATState               pNATState;
+    /** Polling thread. */
+    PPDMTHREAD              pSlirpThread;
+    /** Queue for NAT-thread-external events. */
+    RTREQQUEUE              hSlirpReqQueue;
+    /** The link state last passed to the slirp instance of this shard. */
+    PDMNETWORKLINKSTATE     enmLinkState;
+    /** The index of this shard. */
+    uint32_t                iShard;
+    /** The guest IP last announced to this shard (secondary shards only). */
+    uint32_t                GuestIP;
+    /** The guest MAC last announced to this shard (secondary shards only). */
+    RTMAC                   GuestMac;
+#ifndef RT_OS_WINDOWS
+    /** The write end of the control pipe. */
+    RTPIPE                  hPipeWrite;
+    /** The read end of the control pipe. */
+    RTPIPE                  hPipeRead;
+#else
+    /** for external notification */
+    HANDLE                  hWakeupEvent;
+#endif
+} DRVNATSHARD;
+/** Pointer to a NAT engine shard. */
+typedef DRVNATSHARD *PDRVNATSHARD;
+
 /**
  * NAT network transport driver instance data.
  *
@@ -142,33 +185,17 @@ typedef struct DRVNAT
     PPDMDRVINS              pDrvIns;
     /** Link state */
     PDMNETWORKLINKSTATE     enmLinkState;
-    /** NAT state for this instance. */
-    PNATState               pNATState;
     /** TFTP directory prefix. */
     char                   *pszTFTPPrefix;
     /** Boot file name to provide in the DHCP server response. */
     char                   *pszBootFile;
     /** tftp server name to provide in the DHCP server response. */
     char                   *pszNextServer;
-    /** Polling thread. */
-    PPDMTHREAD              pSlirpThread;
-    /** Queue for NAT-thread-external events. */
-    RTREQQUEUE              hSlirpReqQueue;
     /** The guest IP for port-forwarding. */
     uint32_t                GuestIP;
     /** Link state set when the VM is suspended. */
     PDMNETWORKLINKSTATE     enmLinkStateWant;
 
-#ifndef RT_OS_WINDOWS
-    /** The write end of the control pipe. */
-    RTPIPE                  hPipeWrite;
-    /** The read end of the control pipe. */
-    RTPIPE                  hPipeRead;
-#else
-    /** for external notification */
-    HANDLE                  hWakeupEvent;
-#endif
-
 #define DRV_PROFILE_COUNTER(name, dsc)     STAMPROFILE Stat ## name
 #define DRV_COUNTING_COUNTER(name, dsc)    STAMCOUNTER Stat ## name
 #include "counters.h"
@@ -191,9 +218,23 @@ typedef struct DRVNAT
     volatile uint32_t       cUrgPkts;
     /** Number of in-flight regular packets. */
     volatile uint32_t       cPkts;
+    /** Receive coalescing state, protected by DevAccessLock. */
+    NETRXCOALESCE           RxCoalesce;
 
     /** Transmit lock taken by BeginXmit and released by EndXmit. */
     RTCRITSECT              XmitLock;
+
+    /** The network address (host byte order). */
+    uint32_t                u32Network;
+    /** Number of NAT engine shards in use, 1 unless "Shards" is configured. */
+    uint32_t                cShards;
+    /** Guest TCP ports used by port-forwarding rules.  Frames from these ports
+     * must reach the primary shard, which owns the forwarded connections. */
+    uint32_t                bmTcpForwardedPorts[_64K / 32];
+    /** Guest UDP ports used by port-forwarding rules. */
+    uint32_t                bmUdpForwardedPorts[_64K / 32];
+    /** The NAT engine shards, cShards are used. */
+    DRVNATSHARD             aShards[DRVNAT_MAX_SHARDS];
 } DRVNAT;
 AssertCompileMemberAlignment(DRVNAT, StatNATRecvWakeups, 8);
 /** Pointer to the NAT driver instance data. */
@@ -203,7 +244,7 @@ typedef DRVNAT *PDRVNAT;
 /*******************************************************************************
 *   Internal Functions                                                         *
 *******************************************************************************/
-static void drvNATNotifyNATThread(PDRVNAT pThis, const char *pszWho);
+static void drvNATNotifyNATThread(PDRVNATSHARD pShard, const char *pszWho);
 
 
 static DECLCALLBACK(int) drvNATRecv(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
@@ -261,10 +302,30 @@ static DECLCALLBACK(int) drvNATUrgRecvWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
     return VINF_SUCCESS;
 }
 
-static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int cb, struct mbuf *m)
+/**
+ * @callback_method_impl{FNNETRXCOALESCEDELIVER}
+ */
+static DECLCALLBACK(int) drvNATRecvDeliver(void *pvUser, const void *pvFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    PDRVNAT pThis = (PDRVNAT)pvUser;
+    STAM_PROFILE_START(&pThis->StatNATRecvWait, b);
+    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+    STAM_PROFILE_STOP(&pThis->StatNATRecvWait, b);
+    if (RT_FAILURE(rc))
+        return rc;
+    if (!pGso)
+        return pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvFrame, cbFrame);
+    rc = pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pvFrame, cbFrame, pGso);
+    return RT_SUCCESS(rc) ? rc : VERR_NOT_SUPPORTED;
+}
+
+static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNATSHARD pShard, uint8_t *pu8Buf, int cb, struct mbuf *m)
 {
+    PDRVNAT pThis = pShard->pThis;
     int rc = RTCritSectEnter(&pThis->DevAccessLock);
     AssertRC(rc);
+    /* Urgent data must not overtake the segments held for merging. */
+    NetRxCoalesceFlush(&pThis->RxCoalesce);
     rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
     if (RT_SUCCESS(rc))
     {
@@ -280,17 +341,18 @@ static DECLCALLBACK(void) drvNATUrgRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, in
     rc = RTCritSectLeave(&pThis->DevAccessLock);
     AssertRC(rc);
 
-    slirp_ext_m_free(pThis->pNATState, m, pu8Buf);
+    slirp_ext_m_free(pShard->pNATState, m, pu8Buf);
     if (ASMAtomicDecU32(&pThis->cUrgPkts) == 0)
     {
         drvNATRecvWakeup(pThis->pDrvIns, pThis->pRecvThread);
-        drvNATNotifyNATThread(pThis, "drvNATUrgRecvWorker");
+        drvNATNotifyNATThread(pShard, "drvNATUrgRecvWorker");
     }
 }
 
 
-static DECLCALLBACK(void) drvNATRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int cb, struct mbuf *m)
+static DECLCALLBACK(void) drvNATRecvWorker(PDRVNATSHARD pShard, uint8_t *pu8Buf, int cb, struct mbuf *m)
 {
+    PDRVNAT pThis = pShard->pThis;
     int rc;
     STAM_PROFILE_START(&pThis->StatNATRecv, a);
 
@@ -307,29 +369,36 @@ static DECLCALLBACK(void) drvNATRecvWorker(PDRVNAT pThis, uint8_t *pu8Buf, int c
     rc = RTCritSectEnter(&pThis->DevAccessLock);
     AssertRC(rc);
 
-    STAM_PROFILE_START(&pThis->StatNATRecvWait, b);
-    rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
-    STAM_PROFILE_STOP(&pThis->StatNATRecvWait, b);
-
-    if (RT_SUCCESS(rc))
-    {
-        rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pu8Buf, cb);
-        AssertRC(rc);
-    }
-    else if (   rc != VERR_TIMEOUT
-             && rc != VERR_INTERRUPTED)
+    if (!NetRxCoalesceAdd(&pThis->RxCoalesce, pu8Buf, cb))
     {
-        AssertRC(rc);
+        STAM_PROFILE_START(&pThis->StatNATRecvWait, b);
+        rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+        STAM_PROFILE_STOP(&pThis->StatNATRecvWait, b);
+
+        if (RT_SUCCESS(rc))
+        {
+            rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pu8Buf, cb);
+            AssertRC(rc);
+        }
+        else if (   rc != VERR_TIMEOUT
+                 && rc != VERR_INTERRUPTED)
+        {
+            AssertRC(rc);
+        }
     }
 
+    /* Nothing else queued to merge with, deliver what's been held. */
+    if (ASMAtomicReadU32(&pThis->cPkts) == 1)
+        NetRxCoalesceFlush(&pThis->RxCoalesce);
+
     rc = RTCritSectLeave(&pThis->DevAccessLock);
     AssertRC(rc);
 
 done_unlocked:
-    slirp_ext_m_free(pThis->pNATState, m, pu8Buf);
+    slirp_ext_m_free(pShard->pNATState, m, pu8Buf);
     ASMAtomicDecU32(&pThis->cPkts);
 
-    drvNATNotifyNATThread(pThis, "drvNATRecvWorker");
+    drvNATNotifyNATThread(pShard, "drvNATRecvWorker");
 
     STAM_PROFILE_STOP(&pThis->StatNATRecv, a);
 }
@@ -337,6 +406,9 @@ done_unlocked:
 /**
  * Frees a S/G buffer allocated by drvNATNetworkUp_AllocBuf.
  *
+ * Only a single shard NAT puts normal frames into mbufs of the primary shard
+ * right away, otherwise the frames live on the heap like GSO ones.
+ *
  * @param   pThis               Pointer to the NAT instance.
  * @param   pSgBuf              The S/G buffer to free.
  */
@@ -347,10 +419,11 @@ static void drvNATFreeSgBuf(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
     if (pSgBuf->pvAllocator)
     {
         Assert(!pSgBuf->pvUser);
-        slirp_ext_m_free(pThis->pNATState, (struct mbuf *)pSgBuf->pvAllocator, NULL);
+        Assert(pThis->cShards == 1);
+        slirp_ext_m_free(pThis->aShards[0].pNATState, (struct mbuf *)pSgBuf->pvAllocator, NULL);
         pSgBuf->pvAllocator = NULL;
     }
-    else if (pSgBuf->pvUser)
+    else
     {
         RTMemFree(pSgBuf->aSegs[0].pvSeg);
         pSgBuf->aSegs[0].pvSeg = NULL;
@@ -361,25 +434,135 @@ static void drvNATFreeSgBuf(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
 }
 
 /**
- * Worker function for drvNATSend().
+ * Selects the shard which is to handle a frame sent by the guest.
  *
+ * TCP and UDP flows are distributed over the shards by hashing their 5-tuple.
+ * Everything needing the state only kept by the primary shard goes there:
+ * non-IPv4 frames (ARP), fragments, ICMP, traffic to the NAT's own DNS and
+ * TFTP addresses, broadcasts, DHCP, DNS, FTP (libalias) and any flow whose
+ * guest port is the target of a port-forwarding rule.
+ *
+ * @returns The shard.
  * @param   pThis               Pointer to the NAT instance.
+ * @param   pbFrame             The frame (at least the headers).
+ * @param   cbFrame             The size of the frame.
+ */
+static PDRVNATSHARD drvNATSelectShard(PDRVNAT pThis, uint8_t const *pbFrame, size_t cbFrame)
+{
+    if (pThis->cShards == 1)
+        return &pThis->aShards[0];
+
+    PCRTNETETHERHDR pEthHdr = (PCRTNETETHERHDR)pbFrame;
+    if (   cbFrame < sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + 4
+        || pEthHdr->EtherType != RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4))
+        return &pThis->aShards[0];
+
+    PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)(pEthHdr + 1);
+    size_t const cbIpHdr = pIpHdr->ip_hl * 4;
+    if (   pIpHdr->ip_v != 4
+        || cbIpHdr < RTNETIPV4_MIN_LEN
+        || cbFrame < sizeof(RTNETETHERHDR) + cbIpHdr + 4
+        || (RT_N2H_U16(pIpHdr->ip_off) & (RTNETIPV4_FLAGS_MF | UINT16_C(0x1fff)))
+        || (   pIpHdr->ip_p != RTNETIPV4_PROT_TCP
+            && pIpHdr->ip_p != RTNETIPV4_PROT_UDP))
+        return &pThis->aShards[0];
+
+    uint32_t const u32Dst = RT_N2H_U32(pIpHdr->ip_dst.u);
+    if (   u32Dst == (pThis->u32Network | CTL_DNS)
+        || u32Dst == (pThis->u32Network | CTL_TFTP)
+        || u32Dst == (pThis->u32Network | CTL_BROADCAST)
+        || u32Dst == UINT32_C(0xffffffff))
+        return &pThis->aShards[0];
+
+    /* TCP and UDP have the ports at the same place. */
+    uint16_t const *pu16Ports = (uint16_t const *)((uint8_t const *)pIpHdr + cbIpHdr);
+    uint16_t const uSrcPort = RT_N2H_U16(pu16Ports[0]);
+    uint16_t const uDstPort = RT_N2H_U16(pu16Ports[1]);
+    if (pIpHdr->ip_p == RTNETIPV4_PROT_TCP)
+    {
+        if (   uDstPort == 20 /* ftp-data */
+            || uDstPort == 21 /* ftp */
+            || ASMBitTest(&pThis->bmTcpForwardedPorts[0], uSrcPort))
+            return &pThis->aShards[0];
+    }
+    else if (   uDstPort == 53 /* domain */
+             || uDstPort == RTNETIPV4_PORT_BOOTPS
+             || uDstPort == RTNETIPV4_PORT_BOOTPC
+             || uDstPort == 69 /* tftp */
+             || ASMBitTest(&pThis->bmUdpForwardedPorts[0], uSrcPort))
+        return &pThis->aShards[0];
+
+    uint32_t uHash = pIpHdr->ip_src.u ^ pIpHdr->ip_dst.u ^ pIpHdr->ip_p;
+    uHash ^= ((uint32_t)uSrcPort << 16) | uDstPort;
+    uHash *= UINT32_C(0x9e3779b1);
+    return &pThis->aShards[(uHash >> 16) % pThis->cShards];
+}
+
+/**
+ * Makes sure a secondary shard knows the guest addresses a frame comes from.
+ *
+ * The primary shard learns them from ARP and DHCP, the secondary shards never
+ * see those, so they learn them from the IP frames dispatched to them.
+ *
+ * @param   pShard              The secondary shard.
+ * @param   pbFrame             The frame, drvNATSelectShard() made sure it is an
+ *                              IPv4 frame.
+ * @thread  NAT
+ */
+static void drvNATShardUpdateGuest(PDRVNATSHARD pShard, uint8_t const *pbFrame)
+{
+    PCRTNETETHERHDR pEthHdr = (PCRTNETETHERHDR)pbFrame;
+    PCRTNETIPV4     pIpHdr  = (PCRTNETIPV4)(pEthHdr + 1);
+    if (RT_UNLIKELY(   pShard->GuestIP != pIpHdr->ip_src.u
+                    || memcmp(&pShard->GuestMac, &pEthHdr->SrcMac, sizeof(RTMAC)) != 0))
+    {
+        pShard->GuestIP  = pIpHdr->ip_src.u;
+        pShard->GuestMac = pEthHdr->SrcMac;
+        slirp_set_ethaddr_and_activate_port_forwarding(pShard->pNATState, pShard->GuestMac.au8, pShard->GuestIP);
+    }
+}
+
+/**
+ * Worker function for drvNATSend().
+ *
+ * @param   pShard              The shard selected for the frame.
  * @param   pSgBuf              The scatter/gather buffer.
  * @thread  NAT
  */
-static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
+static void drvNATSendWorker(PDRVNATSHARD pShard, PPDMSCATTERGATHER pSgBuf)
 {
+    PDRVNAT pThis = pShard->pThis;
     Assert(pThis->enmLinkState == PDMNETWORKLINKSTATE_UP);
     if (pThis->enmLinkState == PDMNETWORKLINKSTATE_UP)
     {
+        if (pShard->iShard != 0)
+            drvNATShardUpdateGuest(pShard, (uint8_t const *)pSgBuf->aSegs[0].pvSeg);
+
         struct mbuf *m = (struct mbuf *)pSgBuf->pvAllocator;
         if (m)
         {
             /*
-             * A normal frame.
+             * A normal frame already in an mbuf of the (only) shard.
              */
+            Assert(pThis->cShards == 1);
             pSgBuf->pvAllocator = NULL;
-            slirp_input(pThis->pNATState, m, pSgBuf->cbUsed);
+            slirp_input(pShard->pNATState, m, pSgBuf->cbUsed);
+        }
+        else if (!pSgBuf->pvUser)
+        {
+            /*
+             * A normal frame on the heap, the shard wasn't known when it was
+             * allocated.  The mbuf comes from the zone of this shard so that it
+             * is only ever touched by this thread.
+             */
+            size_t cbSeg;
+            void  *pvSeg;
+            m = slirp_ext_m_get(pShard->pNATState, pSgBuf->cbUsed, &pvSeg, &cbSeg);
+            if (m)
+            {
+                memcpy(pvSeg, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+                slirp_input(pShard->pNATState, m, pSgBuf->cbUsed);
+            }
         }
         else
         {
@@ -397,7 +580,7 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
             {
                 size_t cbSeg;
                 void  *pvSeg;
-                m = slirp_ext_m_get(pThis->pNATState, pGso->cbHdrsTotal + pGso->cbMaxSeg, &pvSeg, &cbSeg);
+                m = slirp_ext_m_get(pShard->pNATState, pGso->cbHdrsTotal + pGso->cbMaxSeg, &pvSeg, &cbSeg);
                 if (!m)
                     break;
 
@@ -407,14 +590,14 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
                                                             iSeg, cSegs, (uint8_t *)pvSeg, &cbHdrs, &cbPayload);
                 memcpy((uint8_t *)pvSeg + cbHdrs, pbFrame + offPayload, cbPayload);
 
-                slirp_input(pThis->pNATState, m, cbPayload + cbHdrs);
+                slirp_input(pShard->pNATState, m, cbPayload + cbHdrs);
 #else
                 uint32_t cbSegFrame;
                 void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
                                                            iSeg, cSegs, &cbSegFrame);
                 memcpy((uint8_t *)pvSeg, pvSegFrame, cbSegFrame);
 
-                slirp_input(pThis->pNATState, m, cbSegFrame);
+                slirp_input(pShard->pNATState, m, cbSegFrame);
 #endif
             }
         }
@@ -424,6 +607,17 @@ static void drvNATSendWorker(PDRVNAT pThis, PPDMSCATTERGATHER pSgBuf)
     /** @todo Implement the VERR_TRY_AGAIN drvNATNetworkUp_AllocBuf semantics. */
 }
 
+/**
+ * Worker function for drvNATNetworkUp_SendBufs().
+ * @thread "NAT" thread of the shard.
+ */
+static void drvNATSendBatchWorker(PDRVNATSHARD pShard, PPDMSCATTERGATHER *papSgBufs, size_t cSgBufs)
+{
+    for (size_t i = 0; i < cSgBufs; i++)
+        drvNATSendWorker(pShard, papSgBufs[i]);
+    RTMemFree(papSgBufs);
+}
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
  */
@@ -451,22 +645,25 @@ static DECLCALLBACK(int) drvNATNetworkUp_AllocBuf(PPDMINETWORKUP pInterface, siz
     /*
      * Drop the incoming frame if the NAT thread isn't running.
      */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pThis->aShards[0].pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
     {
         Log(("drvNATNetowrkUp_AllocBuf: returns VERR_NET_NO_NETWORK\n"));
         return VERR_NET_NO_NETWORK;
     }
 
     /*
-     * Allocate a scatter/gather buffer and an mbuf.
+     * Allocate a scatter/gather buffer and an mbuf.  With several shards we
+     * don't know which one the frame goes to yet and their mbuf zones must
+     * only be used by their own threads, so the frame is put on the heap
+     * and copied into an mbuf of the right shard by drvNATSendWorker.
      */
     PPDMSCATTERGATHER pSgBuf = (PPDMSCATTERGATHER)RTMemAlloc(sizeof(*pSgBuf));
     if (!pSgBuf)
         return VERR_NO_MEMORY;
-    if (!pGso)
+    if (!pGso && pThis->cShards == 1)
     {
         pSgBuf->pvUser      = NULL;
-        pSgBuf->pvAllocator = slirp_ext_m_get(pThis->pNATState, cbMin,
+        pSgBuf->pvAllocator = slirp_ext_m_get(pThis->aShards[0].pNATState, cbMin,
                                               &pSgBuf->aSegs[0].pvSeg, &pSgBuf->aSegs[0].cbSeg);
         if (!pSgBuf->pvAllocator)
         {
@@ -476,11 +673,11 @@ static DECLCALLBACK(int) drvNATNetworkUp_AllocBuf(PPDMINETWORKUP pInterface, siz
     }
     else
     {
-        pSgBuf->pvUser      = RTMemDup(pGso, sizeof(*pGso));
+        pSgBuf->pvUser      = pGso ? RTMemDup(pGso, sizeof(*pGso)) : NULL;
         pSgBuf->pvAllocator = NULL;
         pSgBuf->aSegs[0].cbSeg = RT_ALIGN_Z(cbMin, 16);
         pSgBuf->aSegs[0].pvSeg = RTMemAlloc(pSgBuf->aSegs[0].cbSeg);
-        if (!pSgBuf->pvUser || !pSgBuf->aSegs[0].pvSeg)
+        if ((pGso && !pSgBuf->pvUser) || !pSgBuf->aSegs[0].pvSeg)
         {
             RTMemFree(pSgBuf->aSegs[0].pvSeg);
             RTMemFree(pSgBuf->pvUser);
@@ -525,19 +722,22 @@ static DECLCALLBACK(int) drvNATNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
     Assert(RTCritSectIsOwner(&pThis->XmitLock));
 
     int rc;
-    if (pThis->pSlirpThread->enmState == PDMTHREADSTATE_RUNNING)
+    PDRVNATSHARD pShard = drvNATSelectShard(pThis, (uint8_t const *)pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+    if (pShard->pSlirpThread->enmState == PDMTHREADSTATE_RUNNING)
     {
         /* Set an FTM checkpoint as this operation changes the state permanently. */
         PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
 
 
-        RTREQQUEUE hQueue = pThis->hSlirpReqQueue;
+        RTREQQUEUE hQueue = pShard->hSlirpReqQueue;
 
         rc = RTReqQueueCallEx(hQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                              (PFNRT)drvNATSendWorker, 2, pThis, pSgBuf);
+                              (PFNRT)drvNATSendWorker, 2, pShard, pSgBuf);
         if (RT_SUCCESS(rc))
         {
-            drvNATNotifyNATThread(pThis, "drvNATNetworkUp_SendBuf");
+            if (pShard->iShard != 0)
+                STAM_COUNTER_INC(&pThis->StatShardPktSent);
+            drvNATNotifyNATThread(pShard, "drvNATNetworkUp_SendBuf");
             return VINF_SUCCESS;
         }
 
@@ -549,6 +749,94 @@ static DECLCALLBACK(int) drvNATNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
     return rc;
 }
 
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBufs}
+ */
+static DECLCALLBACK(int) drvNATNetworkUp_SendBufs(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs,
+                                                  bool fOnWorkerThread)
+{
+    PDRVNAT pThis = RT_FROM_MEMBER(pInterface, DRVNAT, INetworkUp);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+
+    /*
+     * Sort the frames by shard, keeping their order within each shard.
+     */
+    PPDMSCATTERGATHER  *apaShardBufs[DRVNAT_MAX_SHARDS];
+    size_t              acShardBufs[DRVNAT_MAX_SHARDS];
+    RT_ZERO(apaShardBufs);
+    RT_ZERO(acShardBufs);
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t i = 0; i < cSgBufs; i++)
+    {
+        PPDMSCATTERGATHER pSgBuf = papSgBufs[i];
+        Assert((pSgBuf->fFlags & PDMSCATTERGATHER_FLAGS_OWNER_MASK) == PDMSCATTERGATHER_FLAGS_OWNER_1);
+
+        PDRVNATSHARD pShard = drvNATSelectShard(pThis, (uint8_t const *)pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+        if (pShard->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+        {
+            drvNATFreeSgBuf(pThis, pSgBuf);
+            if (RT_SUCCESS(rc))
+                rc = VERR_NET_DOWN;
+            continue;
+        }
+
+        unsigned const iShard = pShard->iShard;
+        if (!apaShardBufs[iShard])
+        {
+            apaShardBufs[iShard] = (PPDMSCATTERGATHER *)RTMemAlloc(sizeof(PPDMSCATTERGATHER) * cSgBufs);
+            if (!apaShardBufs[iShard])
+            {
+                drvNATFreeSgBuf(pThis, pSgBuf);
+                if (RT_SUCCESS(rc))
+                    rc = VERR_NET_NO_BUFFER_SPACE;
+                continue;
+            }
+        }
+        apaShardBufs[iShard][acShardBufs[iShard]++] = pSgBuf;
+    }
+
+    /*
+     * Hand each shard its frames with a single request and wakeup.
+     */
+    bool fCheckpoint = true;
+    for (unsigned iShard = 0; iShard < pThis->cShards; iShard++)
+    {
+        if (!acShardBufs[iShard])
+        {
+            RTMemFree(apaShardBufs[iShard]);
+            continue;
+        }
+
+        /* Set an FTM checkpoint as this operation changes the state permanently. */
+        if (fCheckpoint)
+        {
+            PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
+            fCheckpoint = false;
+        }
+
+        PDRVNATSHARD pShard = &pThis->aShards[iShard];
+        int rc2 = RTReqQueueCallEx(pShard->hSlirpReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
+                                   (PFNRT)drvNATSendBatchWorker, 3, pShard, apaShardBufs[iShard], acShardBufs[iShard]);
+        if (RT_SUCCESS(rc2))
+        {
+            if (iShard != 0)
+                STAM_COUNTER_ADD(&pThis->StatShardPktSent, acShardBufs[iShard]);
+            drvNATNotifyNATThread(pShard, "drvNATNetworkUp_SendBufs");
+        }
+        else
+        {
+            for (size_t i = 0; i < acShardBufs[iShard]; i++)
+                drvNATFreeSgBuf(pThis, apaShardBufs[iShard][i]);
+            RTMemFree(apaShardBufs[iShard]);
+            if (RT_SUCCESS(rc))
+                rc = VERR_NET_NO_BUFFER_SPACE;
+        }
+    }
+    STAM_COUNTER_INC(&pThis->StatSendBatches);
+    return rc;
+}
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
  */
@@ -561,16 +849,16 @@ static DECLCALLBACK(void) drvNATNetworkUp_EndXmit(PPDMINETWORKUP pInterface)
 /**
  * Get the NAT thread out of poll/WSAWaitForMultipleEvents
  */
-static void drvNATNotifyNATThread(PDRVNAT pThis, const char *pszWho)
+static void drvNATNotifyNATThread(PDRVNATSHARD pShard, const char *pszWho)
 {
     int rc;
 #ifndef RT_OS_WINDOWS
     /* kick poll() */
     size_t cbIgnored;
-    rc = RTPipeWrite(pThis->hPipeWrite, "", 1, &cbIgnored);
+    rc = RTPipeWrite(pShard->hPipeWrite, "", 1, &cbIgnored);
 #else
     /* kick WSAWaitForMultipleEvents */
-    rc = WSASetEvent(pThis->hWakeupEvent);
+    rc = WSASetEvent(pShard->hWakeupEvent);
 #endif
     AssertRC(rc);
 }
@@ -586,22 +874,32 @@ static DECLCALLBACK(void) drvNATNetworkUp_SetPromiscuousMode(PPDMINETWORKUP pInt
 
 /**
  * Worker function for drvNATNetworkUp_NotifyLinkChanged().
- * @thread "NAT" thread.
+ * @thread "NAT" thread of the shard.
  */
-static void drvNATNotifyLinkChangedWorker(PDRVNAT pThis, PDMNETWORKLINKSTATE enmLinkState)
+static void drvNATNotifyLinkChangedWorker(PDRVNATSHARD pShard, PDMNETWORKLINKSTATE enmLinkState)
 {
-    pThis->enmLinkState = pThis->enmLinkStateWant = enmLinkState;
+    PDRVNAT pThis = pShard->pThis;
+    pThis->enmLinkState = pThis->enmLinkStateWant = pShard->enmLinkState = enmLinkState;
     switch (enmLinkState)
     {
         case PDMNETWORKLINKSTATE_UP:
-            LogRel(("NAT: link up\n"));
-            slirp_link_up(pThis->pNATState);
+            if (pShard->iShard == 0)
+                LogRel(("NAT: link up\n"));
+            slirp_link_up(pShard->pNATState);
             break;
 
         case PDMNETWORKLINKSTATE_DOWN:
         case PDMNETWORKLINKSTATE_DOWN_RESUME:
-            LogRel(("NAT: link down\n"));
-            slirp_link_down(pThis->pNATState);
+            if (pShard->iShard == 0)
+            {
+                LogRel(("NAT: link down\n"));
+                /* Don't deliver segments held for merging once the link is back. */
+                int rc = RTCritSectEnter(&pThis->DevAccessLock);
+                AssertRC(rc);
+                NetRxCoalesceDiscard(&pThis->RxCoalesce);
+                RTCritSectLeave(&pThis->DevAccessLock);
+            }
+            slirp_link_down(pShard->pNATState);
             break;
 
         default:
@@ -624,24 +922,28 @@ static DECLCALLBACK(void) drvNATNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInte
 
     /* Don't queue new requests when the NAT thread is about to stop.
      * But the VM could also be paused. So memorize the desired state. */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pThis->aShards[0].pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
     {
         pThis->enmLinkStateWant = enmLinkState;
         return;
     }
 
-    PRTREQ pReq;
-    int rc = RTReqQueueCallEx(pThis->hSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
-                              (PFNRT)drvNATNotifyLinkChangedWorker, 2, pThis, enmLinkState);
-    if (RT_LIKELY(rc == VERR_TIMEOUT))
+    for (uint32_t iShard = 0; iShard < pThis->cShards; iShard++)
     {
-        drvNATNotifyNATThread(pThis, "drvNATNetworkUp_NotifyLinkChanged");
-        rc = RTReqWait(pReq, RT_INDEFINITE_WAIT);
-        AssertRC(rc);
+        PDRVNATSHARD pShard = &pThis->aShards[iShard];
+        PRTREQ pReq;
+        int rc = RTReqQueueCallEx(pShard->hSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
+                                  (PFNRT)drvNATNotifyLinkChangedWorker, 2, pShard, enmLinkState);
+        if (RT_LIKELY(rc == VERR_TIMEOUT))
+        {
+            drvNATNotifyNATThread(pShard, "drvNATNetworkUp_NotifyLinkChanged");
+            rc = RTReqWait(pReq, RT_INDEFINITE_WAIT);
+            AssertRC(rc);
+        }
+        else
+            AssertRC(rc);
+        RTReqRelease(pReq);
     }
-    else
-        AssertRC(rc);
-    RTReqRelease(pReq);
 }
 
 static void drvNATNotifyApplyPortForwardCommand(PDRVNAT pThis, bool fRemove,
@@ -664,9 +966,13 @@ static void drvNATNotifyApplyPortForwardCommand(PDRVNAT pThis, bool fRemove,
         guestIp.s_addr = pThis->GuestIP;
 
     if (fRemove)
-        slirp_remove_redirect(pThis->pNATState, fUdp, hostIp, u16HostPort, guestIp, u16GuestPort);
+        slirp_remove_redirect(pThis->aShards[0].pNATState, fUdp, hostIp, u16HostPort, guestIp, u16GuestPort);
     else
-        slirp_add_redirect(pThis->pNATState, fUdp, hostIp, u16HostPort, guestIp, u16GuestPort, Mac.au8);
+    {
+        /* The port stays marked after removing the rule, connections using it may still exist. */
+        ASMAtomicBitSet(fUdp ? &pThis->bmUdpForwardedPorts[0] : &pThis->bmTcpForwardedPorts[0], u16GuestPort);
+        slirp_add_redirect(pThis->aShards[0].pNATState, fUdp, hostIp, u16HostPort, guestIp, u16GuestPort, Mac.au8);
+    }
 }
 
 DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONFIG pInterface, bool fRemove,
@@ -678,12 +984,12 @@ DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONF
                  u16GuestPort));
     PDRVNAT pThis = RT_FROM_MEMBER(pInterface, DRVNAT, INetworkNATCfg);
     PRTREQ pReq;
-    int rc = RTReqQueueCallEx(pThis->hSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
+    int rc = RTReqQueueCallEx(pThis->aShards[0].hSlirpReqQueue, &pReq, 0 /*cMillies*/, RTREQFLAGS_VOID,
                               (PFNRT)drvNATNotifyApplyPortForwardCommand, 7, pThis, fRemove,
                               fUdp, pHostIp, u16HostPort, pGuestIp, u16GuestPort);
     if (RT_LIKELY(rc == VERR_TIMEOUT))
     {
-        drvNATNotifyNATThread(pThis, "drvNATNetworkNatConfig_RedirectRuleCommand");
+        drvNATNotifyNATThread(&pThis->aShards[0], "drvNATNetworkNatConfig_RedirectRuleCommand");
         rc = RTReqWait(pReq, RT_INDEFINITE_WAIT);
         AssertRC(rc);
     }
@@ -699,7 +1005,7 @@ DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONF
  * NAT thread handling the slirp stuff.
  *
  * The slirp implementation is single-threaded so we execute this enginre in a
- * dedicated thread. We take care that this thread does not become the
+ * dedicated thread, one per shard. We take care that this thread does not become the
  * bottleneck: If the guest wants to send, a request is enqueued into the
  * hSlirpReqQueue and handled asynchronously by this thread.  If this thread
  * wants to deliver packets to the guest, it enqueues a request into
@@ -707,22 +1013,23 @@ DECLCALLBACK(int) drvNATNetworkNatConfig_RedirectRuleCommand(PPDMINETWORKNATCONF
  */
 static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
 {
-    PDRVNAT pThis = PDMINS_2_DATA(pDrvIns, PDRVNAT);
+    PDRVNATSHARD pShard = (PDRVNATSHARD)pThread->pvUser;
+    PDRVNAT pThis = pShard->pThis;
     int     nFDs = -1;
 #ifdef RT_OS_WINDOWS
-    HANDLE  *phEvents = slirp_get_events(pThis->pNATState);
+    HANDLE  *phEvents = slirp_get_events(pShard->pNATState);
     unsigned int cBreak = 0;
 #else /* RT_OS_WINDOWS */
     unsigned int cPollNegRet = 0;
 #endif /* !RT_OS_WINDOWS */
 
-    LogFlow(("drvNATAsyncIoThread: pThis=%p\n", pThis));
+    LogFlow(("drvNATAsyncIoThread: pThis=%p iShard=%u\n", pThis, pShard->iShard));
 
     if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
         return VINF_SUCCESS;
 
-    if (pThis->enmLinkStateWant != pThis->enmLinkState)
-        drvNATNotifyLinkChangedWorker(pThis, pThis->enmLinkStateWant);
+    if (pThis->enmLinkStateWant != pShard->enmLinkState)
+        drvNATNotifyLinkChangedWorker(pShard, pThis->enmLinkStateWant);
 
     /*
      * Polling loop.
@@ -733,21 +1040,66 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
          * To prevent concurrent execution of sending/receiving threads
          */
 #ifndef RT_OS_WINDOWS
-        nFDs = slirp_get_nsock(pThis->pNATState);
+# ifdef VBOX_WITH_NAT_EPOLL
+        if (slirp_epoll_is_available(pShard->pNATState))
+        {
+            /*
+             * The sockets stay registered with the epoll descriptor, so we
+             * only have to wait for it and the management pipe.
+             */
+            struct pollfd aPolls[2];
+            int iEpollFd = slirp_epoll_fill(pShard->pNATState);
+
+            aPolls[0].fd = RTPipeToNative(pShard->hPipeRead);
+            aPolls[0].events = POLLRDNORM | POLLPRI | POLLRDBAND;
+            aPolls[0].revents = 0;
+            aPolls[1].fd = iEpollFd;
+            aPolls[1].events = POLLIN;
+            aPolls[1].revents = 0;
+
+            int cChangedFDs = poll(&aPolls[0], iEpollFd != -1 ? 2 : 1, slirp_get_timeout_ms(pShard->pNATState));
+            if (cChangedFDs < 0)
+            {
+                if (errno == EINTR)
+                    cChangedFDs = 0;
+                else if (cPollNegRet++ > 128)
+                {
+                    LogRel(("NAT:Poll returns (%s) suppressed %d\n", strerror(errno), cPollNegRet));
+                    cPollNegRet = 0;
+                }
+            }
+
+            if (cChangedFDs >= 0)
+            {
+                slirp_epoll_poll(pShard->pNATState);
+                if (aPolls[0].revents & (POLLRDNORM|POLLPRI|POLLRDBAND))
+                {
+                    /* drain the pipe, see below */
+                    char ch;
+                    size_t cbRead;
+                    RTPipeRead(pShard->hPipeRead, &ch, 1, &cbRead);
+                }
+            }
+            /* process _all_ outstanding requests but don't wait */
+            RTReqQueueProcess(pShard->hSlirpReqQueue, 0);
+            continue;
+        }
+# endif /* VBOX_WITH_NAT_EPOLL */
+        nFDs = slirp_get_nsock(pShard->pNATState);
         /* allocation for all sockets + Management pipe */
         struct pollfd *polls = (struct pollfd *)RTMemAlloc((1 + nFDs) * sizeof(struct pollfd) + sizeof(uint32_t));
         if (polls == NULL)
             return VERR_NO_MEMORY;
 
         /* don't pass the management pipe */
-        slirp_select_fill(pThis->pNATState, &nFDs, &polls[1]);
+        slirp_select_fill(pShard->pNATState, &nFDs, &polls[1]);
 
-        polls[0].fd = RTPipeToNative(pThis->hPipeRead);
+        polls[0].fd = RTPipeToNative(pShard->hPipeRead);
         /* POLLRDBAND usually doesn't used on Linux but seems used on Solaris */
         polls[0].events = POLLRDNORM | POLLPRI | POLLRDBAND;
         polls[0].revents = 0;
 
-        int cChangedFDs = poll(polls, nFDs + 1, slirp_get_timeout_ms(pThis->pNATState));
+        int cChangedFDs = poll(polls, nFDs + 1, slirp_get_timeout_ms(pShard->pNATState));
         if (cChangedFDs < 0)
         {
             if (errno == EINTR)
@@ -765,7 +1117,7 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
 
         if (cChangedFDs >= 0)
         {
-            slirp_select_poll(pThis->pNATState, &polls[1], nFDs);
+            slirp_select_poll(pShard->pNATState, &polls[1], nFDs);
             if (polls[0].revents & (POLLRDNORM|POLLPRI|POLLRDBAND))
             {
                 /* drain the pipe
@@ -782,18 +1134,18 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
                  * pipe.*/
                 char ch;
                 size_t cbRead;
-                RTPipeRead(pThis->hPipeRead, &ch, 1, &cbRead);
+                RTPipeRead(pShard->hPipeRead, &ch, 1, &cbRead);
             }
         }
         /* process _all_ outstanding requests but don't wait */
-        RTReqQueueProcess(pThis->hSlirpReqQueue, 0);
+        RTReqQueueProcess(pShard->hSlirpReqQueue, 0);
         RTMemFree(polls);
 
 #else /* RT_OS_WINDOWS */
         nFDs = -1;
-        slirp_select_fill(pThis->pNATState, &nFDs);
+        slirp_select_fill(pShard->pNATState, &nFDs);
         DWORD dwEvent = WSAWaitForMultipleEvents(nFDs, phEvents, FALSE,
-                                                 slirp_get_timeout_ms(pThis->pNATState),
+                                                 slirp_get_timeout_ms(pShard->pNATState),
                                                  FALSE);
         if (   (dwEvent < WSA_WAIT_EVENT_0 || dwEvent > WSA_WAIT_EVENT_0 + nFDs - 1)
             && dwEvent != WSA_WAIT_TIMEOUT)
@@ -806,14 +1158,14 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
         if (dwEvent == WSA_WAIT_TIMEOUT)
         {
             /* only check for slow/fast timers */
-            slirp_select_poll(pThis->pNATState, /* fTimeout=*/true, /*fIcmp=*/false);
+            slirp_select_poll(pShard->pNATState, /* fTimeout=*/true, /*fIcmp=*/false);
             continue;
         }
         /* poll the sockets in any case */
         Log2(("%s: poll\n", __FUNCTION__));
-        slirp_select_poll(pThis->pNATState, /* fTimeout=*/false, /* fIcmp=*/(dwEvent == WSA_WAIT_EVENT_0));
+        slirp_select_poll(pShard->pNATState, /* fTimeout=*/false, /* fIcmp=*/(dwEvent == WSA_WAIT_EVENT_0));
         /* process _all_ outstanding requests but don't wait */
-        RTReqQueueProcess(pThis->hSlirpReqQueue, 0);
+        RTReqQueueProcess(pShard->hSlirpReqQueue, 0);
 # ifdef VBOX_NAT_DELAY_HACK
         if (cBreak++ > 128)
         {
@@ -837,9 +1189,9 @@ static DECLCALLBACK(int) drvNATAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
  */
 static DECLCALLBACK(int) drvNATAsyncIoWakeup(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
 {
-    PDRVNAT pThis = PDMINS_2_DATA(pDrvIns, PDRVNAT);
+    PDRVNATSHARD pShard = (PDRVNATSHARD)pThread->pvUser;
 
-    drvNATNotifyNATThread(pThis, "drvNATAsyncIoWakeup");
+    drvNATNotifyNATThread(pShard, "drvNATAsyncIoWakeup");
     return VINF_SUCCESS;
 }
 
@@ -855,25 +1207,26 @@ int slirp_can_output(void *pvUser)
 
 void slirp_push_recv_thread(void *pvUser)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
+    PDRVNAT pThis = ((PDRVNATSHARD)pvUser)->pThis;
     Assert(pThis);
     drvNATUrgRecvWakeup(pThis->pDrvIns, pThis->pUrgRecvThread);
 }
 
 void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
-    Assert(pThis);
+    PDRVNATSHARD pShard = (PDRVNATSHARD)pvUser;
+    Assert(pShard);
+    PDRVNAT pThis = pShard->pThis;
 
     PRTREQ pReq = NULL;
 
     /* don't queue new requests when the NAT thread is about to stop */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pShard->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
         return;
 
     ASMAtomicIncU32(&pThis->cUrgPkts);
     int rc = RTReqQueueCallEx(pThis->hUrgRecvReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                              (PFNRT)drvNATUrgRecvWorker, 4, pThis, pu8Buf, cb, m);
+                              (PFNRT)drvNATUrgRecvWorker, 4, pShard, pu8Buf, cb, m);
     AssertRC(rc);
     drvNATUrgRecvWakeup(pThis->pDrvIns, pThis->pUrgRecvThread);
 }
@@ -883,7 +1236,7 @@ void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int c
  */
 void slirp_output_pending(void *pvUser)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
+    PDRVNAT pThis = ((PDRVNATSHARD)pvUser)->pThis;
     Assert(pThis);
     LogFlowFuncEnter();
     pThis->pIAboveNet->pfnXmitPending(pThis->pIAboveNet);
@@ -895,8 +1248,9 @@ void slirp_output_pending(void *pvUser)
  */
 void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
 {
-    PDRVNAT pThis = (PDRVNAT)pvUser;
-    Assert(pThis);
+    PDRVNATSHARD pShard = (PDRVNATSHARD)pvUser;
+    Assert(pShard);
+    PDRVNAT pThis = pShard->pThis;
 
     LogFlow(("slirp_output BEGIN %x %d\n", pu8Buf, cb));
     Log2(("slirp_output: pu8Buf=%p cb=%#x (pThis=%p)\n%.*Rhxd\n", pu8Buf, cb, pThis, cb, pu8Buf));
@@ -904,12 +1258,12 @@ void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
     PRTREQ pReq = NULL;
 
     /* don't queue new requests when the NAT thread is about to stop */
-    if (pThis->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
+    if (pShard->pSlirpThread->enmState != PDMTHREADSTATE_RUNNING)
         return;
 
     ASMAtomicIncU32(&pThis->cPkts);
     int rc = RTReqQueueCallEx(pThis->hRecvReqQueue, NULL /*ppReq*/, 0 /*cMillies*/, RTREQFLAGS_VOID | RTREQFLAGS_NO_WAIT,
-                              (PFNRT)drvNATRecvWorker, 4, pThis, pu8Buf, cb, m);
+                              (PFNRT)drvNATRecvWorker, 4, pShard, pu8Buf, cb, m);
     AssertRC(rc);
     drvNATRecvWakeup(pThis->pDrvIns, pThis->pRecvThread);
     STAM_COUNTER_INC(&pThis->StatQueuePktSent);
@@ -944,7 +1298,7 @@ static void drvNATSetMac(PDRVNAT pThis)
         RTMAC Mac;
         pThis->pIAboveConfig->pfnGetMac(pThis->pIAboveConfig, &Mac);
         /* Re-activate the port forwarding. If  */
-        slirp_set_ethaddr_and_activate_port_forwarding(pThis->pNATState, Mac.au8, pThis->GuestIP);
+        slirp_set_ethaddr_and_activate_port_forwarding(pThis->aShards[0].pNATState, Mac.au8, pThis->GuestIP);
     }
 }
 
@@ -978,7 +1332,12 @@ static DECLCALLBACK(void) drvNATPowerOn(PPDMDRVINS pDrvIns)
 static DECLCALLBACK(void) drvNATInfo(PPDMDRVINS pDrvIns, PCDBGFINFOHLP pHlp, const char *pszArgs)
 {
     PDRVNAT pThis = PDMINS_2_DATA(pDrvIns, PDRVNAT);
-    slirp_info(pThis->pNATState, pHlp, pszArgs);
+    for (uint32_t iShard = 0; iShard < pThis->cShards; iShard++)
+    {
+        if (pThis->cShards > 1)
+            pHlp->pfnPrintf(pHlp, "Shard #%u:\n", iShard);
+        slirp_info(pThis->aShards[iShard].pNATState, pHlp, pszArgs);
+    }
 }
 
 #ifdef VBOX_WITH_DNSMAPPING_IN_HOSTRESOLVER
@@ -1015,7 +1374,7 @@ static int drvNATConstructDNSMappings(unsigned iInstance, PDRVNAT pThis, PCFGMNO
             LogRel(("NAT: DNS mapping %s is ignored (address not pointed)\n", szHostNameOrPattern));
             continue;
         }
-        slirp_add_host_resolver_mapping(pThis->pNATState, fMatch ? NULL : szHostNameOrPattern, fMatch ? szHostNameOrPattern : NULL, HostIP.s_addr);
+        slirp_add_host_resolver_mapping(pThis->aShards[0].pNATState, fMatch ? NULL : szHostNameOrPattern, fMatch ? szHostNameOrPattern : NULL, HostIP.s_addr);
     }
     LogFlowFunc(("LEAVE: %Rrc\n", rc));
     return rc;
@@ -1100,7 +1459,8 @@ static int drvNATConstructRedir(unsigned iInstance, PDRVNAT pThis, PCFGMNODE pCf
          */
         struct in_addr BindIP;
         GETIP_DEF(rc, pThis, pNode, BindIP, INADDR_ANY);
-        if (slirp_add_redirect(pThis->pNATState, fUDP, BindIP, iHostPort, GuestIP, iGuestPort, Mac.au8) < 0)
+        ASMAtomicBitSet(fUDP ? &pThis->bmUdpForwardedPorts[0] : &pThis->bmTcpForwardedPorts[0], (uint16_t)iGuestPort);
+        if (slirp_add_redirect(pThis->aShards[0].pNATState, fUDP, BindIP, iHostPort, GuestIP, iGuestPort, Mac.au8) < 0)
             return PDMDrvHlpVMSetError(pThis->pDrvIns, VERR_NAT_REDIR_SETUP, RT_SRC_POS,
                                        N_("NAT#%d: configuration error: failed to set up "
                                        "redirection of %d to %d. Probably a conflict with "
@@ -1126,20 +1486,31 @@ static DECLCALLBACK(void) drvNATDestruct(PPDMDRVINS pDrvIns)
     LogFlow(("drvNATDestruct:\n"));
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
-    if (pThis->pNATState)
+    for (uint32_t iShard = 0; iShard < RT_ELEMENTS(pThis->aShards); iShard++)
     {
-        slirp_term(pThis->pNATState);
-        slirp_deregister_statistics(pThis->pNATState, pDrvIns);
+        PDRVNATSHARD pShard = &pThis->aShards[iShard];
+        if (pShard->pNATState)
+        {
+            slirp_term(pShard->pNATState);
+            /* Only the statistics of the primary shard are registered. */
+            if (iShard == 0)
+            {
+                slirp_deregister_statistics(pShard->pNATState, pDrvIns);
 #ifdef VBOX_WITH_STATISTICS
 # define DRV_PROFILE_COUNTER(name, dsc)     DEREGISTER_COUNTER(name, pThis)
 # define DRV_COUNTING_COUNTER(name, dsc)    DEREGISTER_COUNTER(name, pThis)
 # include "counters.h"
 #endif
-        pThis->pNATState = NULL;
-    }
+                PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->RxCoalesce.StatSegsMerged);
+                PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->RxCoalesce.StatGsoFrames);
+                PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->RxCoalesce.StatRefused);
+            }
+            pShard->pNATState = NULL;
+        }
 
-    RTReqQueueDestroy(pThis->hSlirpReqQueue);
-    pThis->hSlirpReqQueue = NIL_RTREQQUEUE;
+        RTReqQueueDestroy(pShard->hSlirpReqQueue);
+        pShard->hSlirpReqQueue = NIL_RTREQQUEUE;
+    }
 
     RTReqQueueDestroy(pThis->hUrgRecvReqQueue);
     pThis->hUrgRecvReqQueue = NIL_RTREQQUEUE;
@@ -1150,6 +1521,8 @@ static DECLCALLBACK(void) drvNATDestruct(PPDMDRVINS pDrvIns)
     RTSemEventDestroy(pThis->EventUrgRecv);
     pThis->EventUrgRecv = NIL_RTSEMEVENT;
 
+    NetRxCoalesceTerm(&pThis->RxCoalesce);
+
     if (RTCritSectIsInitialized(&pThis->DevAccessLock))
         RTCritSectDelete(&pThis->DevAccessLock);
 
@@ -1173,14 +1546,21 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
      * Init the static parts.
      */
     pThis->pDrvIns                      = pDrvIns;
-    pThis->pNATState                    = NULL;
     pThis->pszTFTPPrefix                = NULL;
     pThis->pszBootFile                  = NULL;
     pThis->pszNextServer                = NULL;
-    pThis->hSlirpReqQueue               = NIL_RTREQQUEUE;
     pThis->hUrgRecvReqQueue             = NIL_RTREQQUEUE;
     pThis->EventRecv                    = NIL_RTSEMEVENT;
     pThis->EventUrgRecv                 = NIL_RTSEMEVENT;
+    pThis->cShards                      = 1;
+    for (uint32_t iShard = 0; iShard < RT_ELEMENTS(pThis->aShards); iShard++)
+    {
+        pThis->aShards[iShard].pThis          = pThis;
+        pThis->aShards[iShard].iShard         = iShard;
+        pThis->aShards[iShard].pNATState      = NULL;
+        pThis->aShards[iShard].hSlirpReqQueue = NIL_RTREQQUEUE;
+        pThis->aShards[iShard].GuestIP        = INADDR_ANY;
+    }
 
     /* IBase */
     pDrvIns->IBase.pfnQueryInterface    = drvNATQueryInterface;
@@ -1190,6 +1570,7 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     pThis->INetworkUp.pfnAllocBuf           = drvNATNetworkUp_AllocBuf;
     pThis->INetworkUp.pfnFreeBuf            = drvNATNetworkUp_FreeBuf;
     pThis->INetworkUp.pfnSendBuf            = drvNATNetworkUp_SendBuf;
+    pThis->INetworkUp.pfnSendBufs           = drvNATNetworkUp_SendBufs;
     pThis->INetworkUp.pfnEndXmit            = drvNATNetworkUp_EndXmit;
     pThis->INetworkUp.pfnSetPromiscuousMode = drvNATNetworkUp_SetPromiscuousMode;
     pThis->INetworkUp.pfnNotifyLinkChanged  = drvNATNetworkUp_NotifyLinkChanged;
@@ -1207,6 +1588,8 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
                               "SockRcv\0SockSnd\0TcpRcv\0TcpSnd\0"
                               "ICMPCacheLimit\0"
                               "SoMaxConnection\0"
+                              "Shards\0"
+                              "RxCoalesce\0"
 #ifdef VBOX_WITH_DNSMAPPING_IN_HOSTRESOLVER
                               "HostResolverMappings\0"
 #endif
@@ -1243,6 +1626,17 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     i32AliasMode |= (i32MainAliasMode & 0x4 ? 0x4 : 0);
     int i32SoMaxConn = 10;
     GET_S32(rc, pThis, pCfg, "SoMaxConnection", i32SoMaxConn);
+
+    /** @cfgm{Shards, integer, 1}
+     * The number of NAT engine instances, each with its own thread, to spread
+     * the guest's TCP and UDP flows over.  DHCP, DNS, TFTP, ICMP and port
+     * forwarding are always handled by the first one. */
+    int32_t cShards = 1;
+    GET_S32(rc, pThis, pCfg, "Shards", cShards);
+    if (cShards < 1 || cShards > DRVNAT_MAX_SHARDS)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("NAT#%d: configuration error: \"Shards\" must be between 1 and %d"),
+                                   pDrvIns->iInstance, DRVNAT_MAX_SHARDS);
     /*
      * Query the network port interface.
      */
@@ -1257,6 +1651,18 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
                                 N_("Configuration error: the above device/driver didn't "
                                 "export the network config interface"));
 
+    /** @cfgm{RxCoalesce, boolean, true}
+     * Merge the TCP segments going to the guest into GSO frames when the device
+     * above can take them (large receive offload). */
+    bool fRxCoalesce = true;
+    GET_BOOL(rc, pThis, pCfg, "RxCoalesce", fRxCoalesce);
+    if (fRxCoalesce && pThis->pIAboveNet->pfnReceiveGso)
+    {
+        rc = NetRxCoalesceInit(&pThis->RxCoalesce, drvNATRecvDeliver, pThis);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     /* Generate a network address for this network card. */
     char szNetwork[32]; /* xxx.xxx.xxx.xxx/yy */
     GET_STRING(rc, pThis, pCfg, "Network", szNetwork[0], sizeof(szNetwork));
@@ -1273,43 +1679,64 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
                                    "network '%s' describes not a valid IPv4 network"),
                                    pDrvIns->iInstance, szNetwork);
 
+    pThis->u32Network = Network.u;
+
     /*
-     * Initialize slirp.
+     * Initialize slirp, one instance per shard.
      */
-    rc = slirp_init(&pThis->pNATState, RT_H2N_U32(Network.u), Netmask.u,
-                    fPassDomain, !!fUseHostResolver, i32AliasMode,
-                    iIcmpCacheLimit, pThis);
-    if (RT_SUCCESS(rc))
+    char *pszBindIP = NULL;
+    GET_STRING_ALLOC(rc, pThis, pCfg, "BindIP", pszBindIP);
+    for (uint32_t iShard = 0; iShard < (uint32_t)cShards; iShard++)
     {
-        slirp_set_dhcp_TFTP_prefix(pThis->pNATState, pThis->pszTFTPPrefix);
-        slirp_set_dhcp_TFTP_bootfile(pThis->pNATState, pThis->pszBootFile);
-        slirp_set_dhcp_next_server(pThis->pNATState, pThis->pszNextServer);
-        slirp_set_dhcp_dns_proxy(pThis->pNATState, !!fDNSProxy);
-        slirp_set_mtu(pThis->pNATState, MTU);
-        slirp_set_somaxconn(pThis->pNATState, i32SoMaxConn);
-        char *pszBindIP = NULL;
-        GET_STRING_ALLOC(rc, pThis, pCfg, "BindIP", pszBindIP);
-        rc = slirp_set_binding_address(pThis->pNATState, pszBindIP);
-        if (rc != 0 && pszBindIP && *pszBindIP)
+        PDRVNATSHARD pShard = &pThis->aShards[iShard];
+        rc = slirp_init(&pShard->pNATState, RT_H2N_U32(Network.u), Netmask.u,
+                        fPassDomain, !!fUseHostResolver, i32AliasMode,
+                        iIcmpCacheLimit, pShard);
+        if (RT_FAILURE(rc))
+            break;
+        pThis->cShards = iShard + 1;
+
+        slirp_set_dhcp_TFTP_prefix(pShard->pNATState, pThis->pszTFTPPrefix);
+        slirp_set_dhcp_TFTP_bootfile(pShard->pNATState, pThis->pszBootFile);
+        slirp_set_dhcp_next_server(pShard->pNATState, pThis->pszNextServer);
+        slirp_set_dhcp_dns_proxy(pShard->pNATState, !!fDNSProxy);
+        slirp_set_mtu(pShard->pNATState, MTU);
+        slirp_set_somaxconn(pShard->pNATState, i32SoMaxConn);
+        rc = slirp_set_binding_address(pShard->pNATState, pszBindIP);
+        if (rc != 0 && pszBindIP && *pszBindIP && iShard == 0)
             LogRel(("NAT: value of BindIP has been ignored\n"));
-
-        if(pszBindIP != NULL)
-            MMR3HeapFree(pszBindIP);
 #define SLIRP_SET_TUNING_VALUE(name, setter)                    \
             do                                                  \
             {                                                   \
                 int len = 0;                                    \
                 rc = CFGMR3QueryS32(pCfg, name, &len);    \
                 if (RT_SUCCESS(rc))                             \
-                    setter(pThis->pNATState, len);              \
+                    setter(pShard->pNATState, len);             \
             } while(0)
 
         SLIRP_SET_TUNING_VALUE("SockRcv", slirp_set_rcvbuf);
         SLIRP_SET_TUNING_VALUE("SockSnd", slirp_set_sndbuf);
         SLIRP_SET_TUNING_VALUE("TcpRcv", slirp_set_tcp_rcvspace);
         SLIRP_SET_TUNING_VALUE("TcpSnd", slirp_set_tcp_sndspace);
-
-        slirp_register_statistics(pThis->pNATState, pDrvIns);
+        rc = VINF_SUCCESS;
+    }
+    if(pszBindIP != NULL)
+        MMR3HeapFree(pszBindIP);
+    if (RT_SUCCESS(rc))
+    {
+        if (pThis->cShards > 1)
+            LogRel(("NAT: using %u shards\n", pThis->cShards));
+
+        slirp_register_statistics(pThis->aShards[0].pNATState, pDrvIns);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->RxCoalesce.StatSegsMerged, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                               STAMUNIT_COUNT, "Received segments merged into GSO frames.",
+                               "/Drivers/NAT%u/RxCoalesced", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->RxCoalesce.StatGsoFrames, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                               STAMUNIT_COUNT, "GSO frames built from the received segments.",
+                               "/Drivers/NAT%u/RxLro", pDrvIns->iInstance);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->RxCoalesce.StatRefused, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                               STAMUNIT_COUNT, "Merged GSO frames the device refused.",
+                               "/Drivers/NAT%u/RxLroRefused", pDrvIns->iInstance);
 #ifdef VBOX_WITH_STATISTICS
 # define DRV_PROFILE_COUNTER(name, dsc)     REGISTER_COUNTER(name, pThis, STAMTYPE_PROFILE, STAMUNIT_TICKS_PER_CALL, dsc)
 # define DRV_COUNTING_COUNTER(name, dsc)    REGISTER_COUNTER(name, pThis, STAMTYPE_COUNTER, STAMUNIT_COUNT,          dsc)
@@ -1335,9 +1762,6 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
             rc = PDMDrvHlpSSMRegisterLoadDone(pDrvIns, drvNATLoadDone);
             AssertLogRelRCReturn(rc, rc);
 
-            rc = RTReqQueueCreate(&pThis->hSlirpReqQueue);
-            AssertLogRelRCReturn(rc, rc);
-
             rc = RTReqQueueCreate(&pThis->hRecvReqQueue);
             AssertLogRelRCReturn(rc, rc);
 
@@ -1371,31 +1795,48 @@ static DECLCALLBACK(int) drvNATConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
             RTStrPrintf(szTmp, sizeof(szTmp), "nat%d", pDrvIns->iInstance);
             PDMDrvHlpDBGFInfoRegister(pDrvIns, szTmp, "NAT info.", drvNATInfo);
 
+            pThis->enmLinkState = pThis->enmLinkStateWant = PDMNETWORKLINKSTATE_UP;
+
+            for (uint32_t iShard = 0; iShard < pThis->cShards; iShard++)
+            {
+                PDRVNATSHARD pShard = &pThis->aShards[iShard];
+                pShard->enmLinkState = PDMNETWORKLINKSTATE_UP;
+
+                rc = RTReqQueueCreate(&pShard->hSlirpReqQueue);
+                AssertLogRelRCReturn(rc, rc);
+
 #ifndef RT_OS_WINDOWS
-            /*
-             * Create the control pipe.
-             */
-            rc = RTPipeCreate(&pThis->hPipeRead, &pThis->hPipeWrite, 0 /*fFlags*/);
-            AssertRCReturn(rc, rc);
+                /*
+                 * Create the control pipe.
+                 */
+                rc = RTPipeCreate(&pShard->hPipeRead, &pShard->hPipeWrite, 0 /*fFlags*/);
+                AssertRCReturn(rc, rc);
 #else
-            pThis->hWakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL); /* auto-reset event */
-            slirp_register_external_event(pThis->pNATState, pThis->hWakeupEvent,
-                                          VBOX_WAKEUP_EVENT_INDEX);
+                pShard->hWakeupEvent = CreateEvent(NULL, FALSE, FALSE, NULL); /* auto-reset event */
+                slirp_register_external_event(pShard->pNATState, pShard->hWakeupEvent,
+                                              VBOX_WAKEUP_EVENT_INDEX);
 #endif
 
-            rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pSlirpThread, pThis, drvNATAsyncIoThread,
-                                       drvNATAsyncIoWakeup, 128 * _1K, RTTHREADTYPE_IO, "NAT");
-            AssertRCReturn(rc, rc);
-
-            pThis->enmLinkState = pThis->enmLinkStateWant = PDMNETWORKLINKSTATE_UP;
+                char szName[16];
+                if (iShard == 0)
+                    RTStrCopy(szName, sizeof(szName), "NAT");
+                else
+                    RTStrPrintf(szName, sizeof(szName), "NAT%u", iShard);
+                rc = PDMDrvHlpThreadCreate(pDrvIns, &pShard->pSlirpThread, pShard, drvNATAsyncIoThread,
+                                           drvNATAsyncIoWakeup, 128 * _1K, RTTHREADTYPE_IO, szName);
+                AssertRCReturn(rc, rc);
+            }
 
             /* might return VINF_NAT_DNS */
             return rc;
         }
 
         /* failure path */
-        slirp_term(pThis->pNATState);
-        pThis->pNATState = NULL;
+        for (uint32_t iShard = 0; iShard < pThis->cShards; iShard++)
+        {
+            slirp_term(pThis->aShards[iShard].pNATState);
+            pThis->aShards[iShard].pNATState = NULL;
+        }
     }
     else
     {
@@ -194,6 +194,20 @@ PDMBOTHCBDECL(void) drvNetShaperUp_SetPromiscuousMode(PPDMINETWORKUP pInterface,
 
 
 #ifdef IN_RING3
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBufs}
+ */
+static DECLCALLBACK(int) drvR3NetShaperUp_SendBufs(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs,
+                                                   bool fOnWorkerThread)
+{
+    PDRVNETSHAPER pThis = RT_FROM_MEMBER(pInterface, DRVNETSHAPER, INetworkUpR3);
+    if (RT_UNLIKELY(!pThis->pIBelowNetR3))
+        return VERR_NET_DOWN;
+
+    return PDMNetSendBufs(pThis->pIBelowNetR3, papSgBufs, cSgBufs, fOnWorkerThread);
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnNotifyLinkChanged}
  */
@@ -423,6 +437,7 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
     pThis->INetworkUpR3.pfnAllocBuf                 = drvNetShaperUp_AllocBuf;
     pThis->INetworkUpR3.pfnFreeBuf                  = drvNetShaperUp_FreeBuf;
     pThis->INetworkUpR3.pfnSendBuf                  = drvNetShaperUp_SendBuf;
+    pThis->INetworkUpR3.pfnSendBufs                 = drvR3NetShaperUp_SendBufs;
     pThis->INetworkUpR3.pfnEndXmit                  = drvNetShaperUp_EndXmit;
     pThis->INetworkUpR3.pfnSetPromiscuousMode       = drvNetShaperUp_SetPromiscuousMode;
     pThis->INetworkUpR3.pfnNotifyLinkChanged        = drvR3NetShaperUp_NotifyLinkChanged;
@@ -450,7 +465,7 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "BwGroup\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "BwGroup\0Weight\0"))
         return VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES;
 
     /*
@@ -466,6 +481,15 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
     else
         rc = VINF_SUCCESS;
 
+    /*
+     * The weight decides our share of the group bandwidth when other filters
+     * in the group are throttled too.
+     */
+    rc = CFGMR3QueryU32Def(pCfg, "Weight", &pThis->Filter.uWeight, 1);
+    if (RT_FAILURE(rc) || pThis->Filter.uWeight == 0)
+        return PDMDRV_SET_ERROR(pDrvIns, RT_FAILURE(rc) ? rc : VERR_INVALID_PARAMETER,
+                                N_("DrvNetShaper: Configuration error: \"Weight\" must be a positive integer"));
+
     pThis->Filter.pIDrvNetR3 = &pThis->INetworkDown;
     rc = PDMDrvHlpNetShaperAttach(pDrvIns, pThis->pszBwGroup, &pThis->Filter);
     if (RT_FAILURE(rc))
@@ -485,6 +509,13 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
         return VERR_PDM_MISSING_INTERFACE_ABOVE;
     }
 
+    /*
+     * Only offer GSO frames to the drivers below if the device above takes
+     * them, the drivers check for the method when they are constructed.
+     */
+    if (!pThis->pIAboveNet->pfnReceiveGso)
+        pThis->INetworkDown.pfnReceiveGso = NULL;
+
     /*
      * Query the network config interface.
      */
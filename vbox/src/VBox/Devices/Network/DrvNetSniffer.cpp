@@ -22,12 +22,17 @@
 #define LOG_GROUP LOG_GROUP_DRV_NAT
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmnetifs.h>
+#include <VBox/vmm/pdmnetinline.h>
 
 #include <VBox/log.h>
+#include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/critsect.h>
 #include <iprt/file.h>
+#include <iprt/mem.h>
+#include <iprt/path.h>
 #include <iprt/process.h>
+#include <iprt/semaphore.h>
 #include <iprt/string.h>
 #include <iprt/time.h>
 #include <iprt/uuid.h>
@@ -37,9 +42,54 @@
 #include "VBoxDD.h"
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The alignment of capture ring entries. */
+#define DRVNETSNIFFER_ENTRY_ALIGN           32
+/** Capture ring entry state: a committed frame. */
+#define DRVNETSNIFFER_ENTRY_FRAME           UINT32_C(0x19610718)
+/** Capture ring entry state: padding up to the end of the ring. */
+#define DRVNETSNIFFER_ENTRY_PAD             UINT32_C(0x19660606)
+/** The default capture ring size. */
+#define DRVNETSNIFFER_DEF_RING_SIZE         (4 * _1M)
+/** How often the writer thread looks at the ring when nobody kicks it. */
+#define DRVNETSNIFFER_WRITER_INTERVAL_MS    20
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
+/**
+ * Capture ring entry header.
+ *
+ * The captured bytes follow the header directly.  The entry occupies
+ * RT_ALIGN_32(sizeof(DRVNETSNIFFERENTRY) + cbCaptured, DRVNETSNIFFER_ENTRY_ALIGN)
+ * bytes of the ring.
+ */
+typedef struct DRVNETSNIFFERENTRY
+{
+    /** The entry state, DRVNETSNIFFER_ENTRY_FRAME or DRVNETSNIFFER_ENTRY_PAD.
+     * Zero while the producer is still filling in the entry. */
+    uint32_t volatile       u32State;
+    /** The number of bytes following the header. */
+    uint32_t                cbCaptured;
+    /** The RTTimeNanoTS timestamp of the frame. */
+    uint64_t                u64NanoTS;
+    /** The original size of the frame. */
+    uint32_t                cbFrame;
+    /** PCAPNG_EPB_FLAGS_XXX. */
+    uint16_t                fFlags;
+    /** Whether Gso is valid and the whole GSO frame follows. */
+    bool                    fGso;
+    uint8_t                 bPadding;
+    /** The segmentation context if fGso is set. */
+    PDMNETWORKGSO           Gso;
+} DRVNETSNIFFERENTRY;
+AssertCompileSize(DRVNETSNIFFERENTRY, DRVNETSNIFFER_ENTRY_ALIGN);
+/** Pointer to a capture ring entry header. */
+typedef DRVNETSNIFFERENTRY *PDRVNETSNIFFERENTRY;
+
 /**
  * Block driver instance data.
  *
@@ -64,20 +114,353 @@ typedef struct DRVNETSNIFFER
     PPDMINETWORKUP          pIBelowNet;
     /** The filename. */
     char                    szFilename[RTPATH_MAX];
-    /** The filehandle. */
+    /** The filehandle, only accessed by the writer thread after construction. */
     RTFILE                  hFile;
-    /** The lock serializing the file access. */
-    RTCRITSECT              Lock;
-    /** The NanoTS delta we pass to the pcap writers. */
-    uint64_t                StartNanoTS;
+    /** The epoch timestamp (ns) corresponding to RTTimeNanoTS() == 0. */
+    uint64_t                u64EpochNanoTS;
     /** Pointer to the driver instance. */
     PPDMDRVINS              pDrvIns;
     /** For when we're the leaf driver. */
     RTCRITSECT              XmitLock;
 
+    /** @name Capture ring.
+     * A multiple producer, single consumer byte ring.  Producers on the send
+     * and receive paths reserve space by advancing offHead, copy the frame and
+     * then commit the entry by setting its state.  The writer thread consumes
+     * committed entries in order and advances offTail.  Both offsets are free
+     * running and masked with cbRing - 1.
+     * @{ */
+    /** The ring buffer. */
+    uint8_t                *pbRing;
+    /** The size of the ring, a power of two. */
+    uint32_t                cbRing;
+    /** The max number of bytes to capture per frame (or GSO segment). */
+    uint32_t                cbSnapLen;
+    /** The producer offset. */
+    uint32_t volatile       offHead;
+    /** The consumer offset. */
+    uint32_t volatile       offTail;
+    /** Set when a producer has kicked the writer thread. */
+    bool volatile           fWriterKicked;
+    /** Whether we've complained about a write failure. */
+    bool                    fWriteErrorLogged;
+    /** The event the writer thread waits on. */
+    RTSEMEVENT              hEvtWriter;
+    /** The writer thread. */
+    PPDMTHREAD              pWriterThread;
+    /** @} */
+
+    /** @name File rotation, writer thread only.
+     * @{ */
+    /** Rotate when the current file reaches this size, 0 if disabled. */
+    uint64_t                cbRotateSize;
+    /** Rotate when the current file spans this many nanoseconds, 0 if disabled. */
+    uint64_t                cNsRotateTime;
+    /** The number of bytes written to the current file. */
+    uint64_t                cbFile;
+    /** The epoch timestamp of the first frame in the current file. */
+    uint64_t                u64FileStartNs;
+    /** The value of cDropped when the current file was opened. */
+    uint64_t                cDroppedAtOpen;
+    /** The sequence number of the current file, 0 for szFilename itself. */
+    uint32_t                iFile;
+    /** @} */
+
+    /** Number of frames put into the capture ring. */
+    uint64_t volatile       cCaptured;
+    /** Number of frames dropped because the capture ring was full. */
+    uint64_t volatile       cDropped;
+    /** Number of bytes written to the capture files. */
+    uint64_t                cbWritten;
+
 } DRVNETSNIFFER, *PDRVNETSNIFFER;
 
 
+/**
+ * Puts a frame into the capture ring.
+ *
+ * Called concurrently by the send and receive paths, never blocks.  Frames
+ * that don't fit are counted and dropped.
+ *
+ * @param   pThis       The sniffer instance data.
+ * @param   paSegs      The segments making up the frame.
+ * @param   cSegs       The number of segments.
+ * @param   cbFrame     The size of the frame.
+ * @param   pGso        The segmentation context, NULL for ordinary frames.
+ * @param   fFlags      PCAPNG_EPB_FLAGS_XXX.
+ */
+static void drvNetSnifferCapture(PDRVNETSNIFFER pThis, PCPDMDATASEG paSegs, uint32_t cSegs, size_t cbFrame,
+                                 PCPDMNETWORKGSO pGso, uint16_t fFlags)
+{
+    /* GSO frames are carved by the writer and the segment checksums need the
+       entire payload, so only ordinary frames can be truncated up front. */
+    uint32_t const cbCopy  = pGso ? (uint32_t)cbFrame : (uint32_t)RT_MIN(cbFrame, pThis->cbSnapLen);
+    uint32_t const cbEntry = RT_ALIGN_32(sizeof(DRVNETSNIFFERENTRY) + cbCopy, DRVNETSNIFFER_ENTRY_ALIGN);
+    uint32_t const fMask   = pThis->cbRing - 1;
+
+    /*
+     * Reserve space, padding out the end of the ring if the entry doesn't fit
+     * in front of it.
+     */
+    uint32_t offHead, offTail, offEntry, cbPad;
+    for (;;)
+    {
+        offHead  = ASMAtomicReadU32(&pThis->offHead);
+        offTail  = ASMAtomicReadU32(&pThis->offTail);
+        offEntry = offHead & fMask;
+        cbPad    = offEntry + cbEntry > pThis->cbRing ? pThis->cbRing - offEntry : 0;
+        if (RT_UNLIKELY(offHead - offTail + cbPad + cbEntry > pThis->cbRing))
+        {
+            ASMAtomicIncU64(&pThis->cDropped);
+            return;
+        }
+        if (ASMAtomicCmpXchgU32(&pThis->offHead, offHead + cbPad + cbEntry, offHead))
+            break;
+    }
+
+    if (cbPad)
+    {
+        PDRVNETSNIFFERENTRY pPad = (PDRVNETSNIFFERENTRY)&pThis->pbRing[offEntry];
+        pPad->cbCaptured = cbPad - sizeof(DRVNETSNIFFERENTRY);
+        ASMAtomicWriteU32(&pPad->u32State, DRVNETSNIFFER_ENTRY_PAD);
+        offEntry = 0;
+    }
+
+    /*
+     * Fill in the entry and commit it.
+     */
+    PDRVNETSNIFFERENTRY pEntry = (PDRVNETSNIFFERENTRY)&pThis->pbRing[offEntry];
+    pEntry->cbCaptured = cbCopy;
+    pEntry->u64NanoTS  = RTTimeNanoTS();
+    pEntry->cbFrame    = (uint32_t)cbFrame;
+    pEntry->fFlags     = fFlags;
+    pEntry->fGso       = pGso != NULL;
+    if (pGso)
+        pEntry->Gso    = *pGso;
+
+    uint8_t *pbDst  = (uint8_t *)(pEntry + 1);
+    uint32_t cbLeft = cbCopy;
+    for (uint32_t iSeg = 0; iSeg < cSegs && cbLeft > 0; iSeg++)
+    {
+        uint32_t cbSeg = (uint32_t)RT_MIN(paSegs[iSeg].cbSeg, cbLeft);
+        memcpy(pbDst, paSegs[iSeg].pvSeg, cbSeg);
+        pbDst  += cbSeg;
+        cbLeft -= cbSeg;
+    }
+    if (cbLeft)
+    {
+        /* Short SG buffer, record what we've got. */
+        pEntry->cbFrame -= cbLeft;
+        pEntry->fGso     = false;
+    }
+
+    ASMAtomicWriteU32(&pEntry->u32State, DRVNETSNIFFER_ENTRY_FRAME);
+    ASMAtomicIncU64(&pThis->cCaptured);
+
+    /*
+     * Kick the writer if the ring is getting full, it'll come by on its own
+     * otherwise.
+     */
+    if (   offHead + cbPad + cbEntry - offTail > pThis->cbRing / 2
+        && !ASMAtomicXchgBool(&pThis->fWriterKicked, true))
+        RTSemEventSignal(pThis->hEvtWriter);
+}
+
+
+/**
+ * Puts the frame in a scatter/gather buffer into the capture ring.
+ *
+ * @param   pThis       The sniffer instance data.
+ * @param   pSgBuf      The frame.
+ */
+DECLINLINE(void) drvNetSnifferCaptureSg(PDRVNETSNIFFER pThis, PPDMSCATTERGATHER pSgBuf)
+{
+    PCPDMNETWORKGSO pGso = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+    if (   pGso
+        && !PDMNetGsoIsValid(pGso, sizeof(*pGso), pSgBuf->cbUsed))
+        pGso = NULL;
+    drvNetSnifferCapture(pThis, &pSgBuf->aSegs[0], pSgBuf->cSegs, pSgBuf->cbUsed, pGso, PCAPNG_EPB_FLAGS_OUTBOUND);
+}
+
+
+/**
+ * Opens a capture file and writes the pcapng headers.
+ *
+ * @returns IPRT status code.
+ * @param   pThis       The sniffer instance data.
+ * @param   pszFilename The file to create.
+ * @param   u64TimeNs   The epoch timestamp the file starts at.
+ */
+static int drvNetSnifferOpenFile(PDRVNETSNIFFER pThis, const char *pszFilename, uint64_t u64TimeNs)
+{
+    int rc = RTFileOpen(&pThis->hFile, pszFilename, RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+    if (RT_FAILURE(rc))
+    {
+        pThis->hFile = NIL_RTFILE;
+        return rc;
+    }
+
+    char szIfName[32];
+    RTStrPrintf(szIfName, sizeof(szIfName), "NetSniffer#%u", pThis->pDrvIns->iInstance);
+    pThis->cbFile         = 0;
+    pThis->u64FileStartNs = u64TimeNs;
+    pThis->cDroppedAtOpen = ASMAtomicReadU64(&pThis->cDropped);
+    rc = PcapNgFileHdr(pThis->hFile, pThis->cbSnapLen, szIfName, &pThis->cbFile);
+    pThis->cbWritten += pThis->cbFile;
+    return rc;
+}
+
+
+/**
+ * Finishes the current capture file with an interface statistics block and
+ * closes it.
+ *
+ * @param   pThis       The sniffer instance data.
+ * @param   u64TimeNs   The epoch timestamp for the statistics.
+ */
+static void drvNetSnifferCloseFile(PDRVNETSNIFFER pThis, uint64_t u64TimeNs)
+{
+    if (pThis->hFile == NIL_RTFILE)
+        return;
+    uint64_t const cbOld = pThis->cbFile;
+    PcapNgFileStats(pThis->hFile, u64TimeNs, ASMAtomicReadU64(&pThis->cDropped) - pThis->cDroppedAtOpen, &pThis->cbFile);
+    pThis->cbWritten += pThis->cbFile - cbOld;
+    RTFileClose(pThis->hFile);
+    pThis->hFile = NIL_RTFILE;
+}
+
+
+/**
+ * Closes the current capture file and continues in the next one.
+ *
+ * The files are named after the configured one with a sequence number
+ * inserted in front of the extension, i.e. VBox.pcap, VBox-00001.pcap,
+ * VBox-00002.pcap and so on.
+ *
+ * @param   pThis       The sniffer instance data.
+ * @param   u64TimeNs   The epoch timestamp of the frame triggering the rotation.
+ */
+static void drvNetSnifferRotate(PDRVNETSNIFFER pThis, uint64_t u64TimeNs)
+{
+    drvNetSnifferCloseFile(pThis, u64TimeNs);
+
+    pThis->iFile++;
+    char        szFilename[RTPATH_MAX];
+    const char *pszExt  = RTPathExt(pThis->szFilename);
+    size_t      cchBase = pszExt ? (size_t)(pszExt - pThis->szFilename) : strlen(pThis->szFilename);
+    RTStrPrintf(szFilename, sizeof(szFilename), "%.*s-%05u%s",
+                (int)cchBase, pThis->szFilename, pThis->iFile, pszExt ? pszExt : "");
+
+    int rc = drvNetSnifferOpenFile(pThis, szFilename, u64TimeNs);
+    if (RT_FAILURE(rc))
+        LogRel(("NetSniffer#%u: Failed to rotate to '%s': %Rrc, capture stopped\n",
+                pThis->pDrvIns->iInstance, szFilename, rc));
+    else
+        LogRel(("NetSniffer#%u: Capturing to '%s'\n", pThis->pDrvIns->iInstance, szFilename));
+}
+
+
+/**
+ * Writes a committed ring entry to the capture file, rotating the file first
+ * if it's due.
+ *
+ * @param   pThis       The sniffer instance data.
+ * @param   pEntry      The entry.
+ */
+static void drvNetSnifferWriteEntry(PDRVNETSNIFFER pThis, PDRVNETSNIFFERENTRY pEntry)
+{
+    uint64_t const u64TimeNs = pThis->u64EpochNanoTS + pEntry->u64NanoTS;
+    if (   pThis->hFile != NIL_RTFILE
+        && (   (pThis->cbRotateSize  && pThis->cbFile >= pThis->cbRotateSize)
+            || (pThis->cNsRotateTime && u64TimeNs - pThis->u64FileStartNs >= pThis->cNsRotateTime)))
+        drvNetSnifferRotate(pThis, u64TimeNs);
+    if (pThis->hFile == NIL_RTFILE)
+        return;
+
+    uint64_t const cbOld = pThis->cbFile;
+    int rc;
+    if (!pEntry->fGso)
+        rc = PcapNgFileFrame(pThis->hFile, u64TimeNs, pEntry + 1, pEntry->cbFrame, pEntry->cbCaptured,
+                             pEntry->fFlags, &pThis->cbFile);
+    else
+        rc = PcapNgFileGsoFrame(pThis->hFile, u64TimeNs, &pEntry->Gso, pEntry + 1, pEntry->cbFrame,
+                                pThis->cbSnapLen, pEntry->fFlags, &pThis->cbFile);
+    pThis->cbWritten += pThis->cbFile - cbOld;
+    if (RT_FAILURE(rc) && !pThis->fWriteErrorLogged)
+    {
+        LogRel(("NetSniffer#%u: Writing to the capture file failed: %Rrc\n", pThis->pDrvIns->iInstance, rc));
+        pThis->fWriteErrorLogged = true;
+    }
+}
+
+
+/**
+ * Writes out all committed entries in the capture ring.
+ *
+ * Stops at the first entry that is still being filled in.
+ *
+ * @param   pThis       The sniffer instance data.
+ * @thread  The writer thread, or the destructor once it's gone.
+ */
+static void drvNetSnifferDrain(PDRVNETSNIFFER pThis)
+{
+    uint32_t const fMask   = pThis->cbRing - 1;
+    uint32_t       offTail = pThis->offTail;
+    while (offTail != ASMAtomicReadU32(&pThis->offHead))
+    {
+        PDRVNETSNIFFERENTRY pEntry   = (PDRVNETSNIFFERENTRY)&pThis->pbRing[offTail & fMask];
+        uint32_t const      u32State = ASMAtomicReadU32(&pEntry->u32State);
+        if (u32State != DRVNETSNIFFER_ENTRY_FRAME && u32State != DRVNETSNIFFER_ENTRY_PAD)
+            break;
+
+        uint32_t const cbEntry = RT_ALIGN_32(sizeof(DRVNETSNIFFERENTRY) + pEntry->cbCaptured, DRVNETSNIFFER_ENTRY_ALIGN);
+        if (u32State == DRVNETSNIFFER_ENTRY_FRAME)
+            drvNetSnifferWriteEntry(pThis, pEntry);
+
+        /* Later entries may start anywhere within this one, so clear every
+           possible state word before handing the space back to the producers. */
+        for (uint32_t off = 0; off < cbEntry; off += DRVNETSNIFFER_ENTRY_ALIGN)
+            *(uint32_t *)((uint8_t *)pEntry + off) = 0;
+
+        offTail += cbEntry;
+        ASMAtomicWriteU32(&pThis->offTail, offTail);
+    }
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADDRV, Drains the capture ring into the file.}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        RTSemEventWait(pThis->hEvtWriter, DRVNETSNIFFER_WRITER_INTERVAL_MS);
+        ASMAtomicWriteBool(&pThis->fWriterKicked, false);
+        drvNetSnifferDrain(pThis);
+    }
+
+    /* Don't sit on captured frames while suspended. */
+    drvNetSnifferDrain(pThis);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDRV}
+ */
+static DECLCALLBACK(int) drvNetSnifferWriterWakeUp(PPDMDRVINS pDrvIns, PPDMTHREAD pThread)
+{
+    PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
+    NOREF(pThread);
+    return RTSemEventSignal(pThis->hEvtWriter);
+}
+
 
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
@@ -131,23 +514,30 @@ static DECLCALLBACK(int) drvNetSnifferUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
         return VERR_NET_DOWN;
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    if (!pSgBuf->pvUser)
-        PcapFileFrame(pThis->hFile, pThis->StartNanoTS,
-                      pSgBuf->aSegs[0].pvSeg,
-                      pSgBuf->cbUsed,
-                      RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    else
-        PcapFileGsoFrame(pThis->hFile, pThis->StartNanoTS, (PCPDMNETWORKGSO)pSgBuf->pvUser,
-                         pSgBuf->aSegs[0].pvSeg,
-                         pSgBuf->cbUsed,
-                         RT_MIN(pSgBuf->cbUsed, pSgBuf->aSegs[0].cbSeg));
-    RTCritSectLeave(&pThis->Lock);
+    drvNetSnifferCaptureSg(pThis, pSgBuf);
 
     return pThis->pIBelowNet->pfnSendBuf(pThis->pIBelowNet, pSgBuf, fOnWorkerThread);
 }
 
 
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBufs}
+ */
+static DECLCALLBACK(int) drvNetSnifferUp_SendBufs(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs,
+                                                  bool fOnWorkerThread)
+{
+    PDRVNETSNIFFER pThis = RT_FROM_MEMBER(pInterface, DRVNETSNIFFER, INetworkUp);
+    if (RT_UNLIKELY(!pThis->pIBelowNet))
+        return VERR_NET_DOWN;
+
+    /* output to sniffer */
+    for (uint32_t i = 0; i < cSgBufs; i++)
+        drvNetSnifferCaptureSg(pThis, papSgBufs[i]);
+
+    return PDMNetSendBufs(pThis->pIBelowNet, papSgBufs, cSgBufs, fOnWorkerThread);
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
  */
@@ -204,9 +594,10 @@ static DECLCALLBACK(int) drvNetSnifferDown_Receive(PPDMINETWORKDOWN pInterface,
     PDRVNETSNIFFER pThis = RT_FROM_MEMBER(pInterface, DRVNETSNIFFER, INetworkDown);
 
     /* output to sniffer */
-    RTCritSectEnter(&pThis->Lock);
-    PcapFileFrame(pThis->hFile, pThis->StartNanoTS, pvBuf, cb, cb);
-    RTCritSectLeave(&pThis->Lock);
+    PDMDATASEG Seg;
+    Seg.pvSeg = (void *)pvBuf;
+    Seg.cbSeg = cb;
+    drvNetSnifferCapture(pThis, &Seg, 1, cb, NULL, PCAPNG_EPB_FLAGS_INBOUND);
 
     /* pass up */
     int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvBuf, cb);
@@ -351,17 +742,33 @@ static DECLCALLBACK(void) drvNetSnifferDestruct(PPDMDRVINS pDrvIns)
     PDRVNETSNIFFER pThis = PDMINS_2_DATA(pDrvIns, PDRVNETSNIFFER);
     PDMDRV_CHECK_VERSIONS_RETURN_VOID(pDrvIns);
 
-    if (RTCritSectIsInitialized(&pThis->Lock))
-        RTCritSectDelete(&pThis->Lock);
+    /*
+     * Stop the writer, then flush what's left in the ring ourselves.
+     */
+    if (pThis->pWriterThread)
+    {
+        int rc = PDMR3ThreadDestroy(pThis->pWriterThread, NULL);
+        AssertRC(rc);
+        pThis->pWriterThread = NULL;
+    }
 
-    if (RTCritSectIsInitialized(&pThis->XmitLock))
-        RTCritSectDelete(&pThis->XmitLock);
+    if (pThis->pbRing)
+    {
+        drvNetSnifferDrain(pThis);
+        RTMemPageFree(pThis->pbRing, pThis->cbRing);
+        pThis->pbRing = NULL;
+    }
+
+    drvNetSnifferCloseFile(pThis, pThis->u64EpochNanoTS + RTTimeNanoTS());
 
-    if (pThis->hFile != NIL_RTFILE)
+    if (pThis->hEvtWriter != NIL_RTSEMEVENT)
     {
-        RTFileClose(pThis->hFile);
-        pThis->hFile = NIL_RTFILE;
+        RTSemEventDestroy(pThis->hEvtWriter);
+        pThis->hEvtWriter = NIL_RTSEMEVENT;
     }
+
+    if (RTCritSectIsInitialized(&pThis->XmitLock))
+        RTCritSectDelete(&pThis->XmitLock);
 }
 
 
@@ -380,8 +787,10 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
      */
     pThis->pDrvIns                                  = pDrvIns;
     pThis->hFile                                    = NIL_RTFILE;
-    /* The pcap file *must* start at time offset 0,0. */
-    pThis->StartNanoTS                              = RTTimeNanoTS() - RTTimeProgramNanoTS();
+    pThis->hEvtWriter                               = NIL_RTSEMEVENT;
+    /* pcapng wants absolute timestamps, the ring entries have RTTimeNanoTS ones. */
+    RTTIMESPEC Now;
+    pThis->u64EpochNanoTS                           = RTTimeSpecGetNano(RTTimeNow(&Now)) - RTTimeNanoTS();
     /* IBase */
     pDrvIns->IBase.pfnQueryInterface                = drvNetSnifferQueryInterface;
     /* INetworkUp */
@@ -389,6 +798,7 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     pThis->INetworkUp.pfnAllocBuf                   = drvNetSnifferUp_AllocBuf;
     pThis->INetworkUp.pfnFreeBuf                    = drvNetSnifferUp_FreeBuf;
     pThis->INetworkUp.pfnSendBuf                    = drvNetSnifferUp_SendBuf;
+    pThis->INetworkUp.pfnSendBufs                   = drvNetSnifferUp_SendBufs;
     pThis->INetworkUp.pfnEndXmit                    = drvNetSnifferUp_EndXmit;
     pThis->INetworkUp.pfnSetPromiscuousMode         = drvNetSnifferUp_SetPromiscuousMode;
     pThis->INetworkUp.pfnNotifyLinkChanged          = drvNetSnifferUp_NotifyLinkChanged;
@@ -404,15 +814,17 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     /*
      * Create the locks.
      */
-    int rc = RTCritSectInit(&pThis->Lock);
-    AssertRCReturn(rc, rc);
-    rc = RTCritSectInit(&pThis->XmitLock);
+    int rc = RTCritSectInit(&pThis->XmitLock);
     AssertRCReturn(rc, rc);
 
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "File\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "File\0"
+                                    "SnapLen\0"
+                                    "RingSize\0"
+                                    "RotateSize\0"
+                                    "RotateTime\0"))
         return VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES;
 
     if (CFGMR3GetFirstChild(pCfg))
@@ -436,6 +848,46 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
         return rc;
     }
 
+    /** @cfgm{SnapLen, uint32_t, 65535}
+     * The max number of bytes recorded per frame, or per segment for GSO
+     * frames. */
+    rc = CFGMR3QueryU32Def(pCfg, "SnapLen", &pThis->cbSnapLen, 65535);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"SnapLen\" value"));
+    if (pThis->cbSnapLen < 14)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"SnapLen\" must be at least 14 (%u)"), pThis->cbSnapLen);
+
+    /** @cfgm{RingSize, uint32_t, 4MB}
+     * The size of the capture ring the datapath copies frames into.  Frames are
+     * dropped when the writer thread falls this far behind.  Must be a power of
+     * two between 64KB and 1GB. */
+    rc = CFGMR3QueryU32Def(pCfg, "RingSize", &pThis->cbRing, DRVNETSNIFFER_DEF_RING_SIZE);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RingSize\" value"));
+    if (   !RT_IS_POWER_OF_TWO(pThis->cbRing)
+        || pThis->cbRing < _64K
+        || pThis->cbRing > _1G)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: \"RingSize\" must be a power of two between 64KB and 1GB (%#x)"),
+                                   pThis->cbRing);
+
+    /** @cfgm{RotateSize, uint64_t, 0}
+     * Continue in a new file once the current one has reached this many bytes,
+     * 0 to disable. */
+    rc = CFGMR3QueryU64Def(pCfg, "RotateSize", &pThis->cbRotateSize, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RotateSize\" value"));
+
+    /** @cfgm{RotateTime, uint32_t, 0}
+     * Continue in a new file once the current one spans this many seconds, 0 to
+     * disable. */
+    uint32_t cSecsRotate;
+    rc = CFGMR3QueryU32Def(pCfg, "RotateTime", &cSecsRotate, 0);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: Failed to get the \"RotateTime\" value"));
+    pThis->cNsRotateTime = cSecsRotate * UINT64_C(1000000000);
+
     /*
      * Query the network port interface.
      */
@@ -480,20 +932,36 @@ static DECLCALLBACK(int) drvNetSnifferConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pC
     }
 
     /*
-     * Open output file / pipe.
+     * Open output file / pipe and write the pcapng header.
      */
-    rc = RTFileOpen(&pThis->hFile, pThis->szFilename,
-                    RTFILE_O_WRITE | RTFILE_O_CREATE_REPLACE | RTFILE_O_DENY_WRITE);
+    rc = drvNetSnifferOpenFile(pThis, pThis->szFilename, pThis->u64EpochNanoTS + RTTimeNanoTS());
     if (RT_FAILURE(rc))
         return PDMDrvHlpVMSetError(pDrvIns, rc, RT_SRC_POS,
                                    N_("Netsniffer cannot open '%s' for writing. The directory must exist and it must be writable for the current user"), pThis->szFilename);
 
     /*
-     * Write pcap header.
-     * Some time has gone by since capturing pThis->StartNanoTS so get the
-     * current time again.
+     * Set up the capture ring and the writer thread draining it.
+     */
+    pThis->pbRing = (uint8_t *)RTMemPageAllocZ(pThis->cbRing);
+    if (!pThis->pbRing)
+        return VERR_NO_MEMORY;
+
+    rc = RTSemEventCreate(&pThis->hEvtWriter);
+    AssertRCReturn(rc, rc);
+
+    rc = PDMDrvHlpThreadCreate(pDrvIns, &pThis->pWriterThread, pThis, drvNetSnifferWriterThread,
+                               drvNetSnifferWriterWakeUp, 0, RTTHREADTYPE_IO, "NetSniffer");
+    AssertRCReturn(rc, rc);
+
+    /*
+     * Statistics.
      */
-    PcapFileHdr(pThis->hFile, RTTimeNanoTS());
+    PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->cCaptured, STAMTYPE_U64, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Number of frames put into the capture ring.", "/Drivers/NetSniffer%u/Captured", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, (void *)&pThis->cDropped, STAMTYPE_U64, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                           "Number of frames dropped because the capture ring was full.", "/Drivers/NetSniffer%u/Dropped", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->cbWritten, STAMTYPE_U64, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                           "Number of bytes written to the capture files.", "/Drivers/NetSniffer%u/Written", pDrvIns->iInstance);
 
     return VINF_SUCCESS;
 }
@@ -29,6 +29,7 @@
 #include <iprt/ctype.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/path.h>
 #include <iprt/pipe.h>
 #include <iprt/semaphore.h>
@@ -60,6 +61,11 @@
 #else
 # include <sys/fcntl.h>
 #endif
+#ifdef RT_OS_LINUX
+# include <sys/uio.h>
+# include <net/if.h>
+# include <linux/if_tun.h>
+#endif
 #include <errno.h>
 #include <unistd.h>
 
@@ -70,9 +76,55 @@
 #include "VBoxDD.h"
 
 
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+#ifdef RT_OS_LINUX
+/** @name Virtio-net header flags and GSO types (VIRTIO_NET_HDR_XXX).
+ * @{ */
+# define DRVTAP_VNETHDR_F_NEEDS_CSUM    1
+# define DRVTAP_VNETHDR_GSO_NONE        0
+# define DRVTAP_VNETHDR_GSO_TCPV4       1
+# define DRVTAP_VNETHDR_GSO_UDP         3
+# define DRVTAP_VNETHDR_GSO_TCPV6       4
+# define DRVTAP_VNETHDR_GSO_ECN         0x80
+/** @} */
+/** The largest frame we read from the device in vnet header mode (the host
+ * hands us frames of up to 64KB when GSO offloading is enabled). */
+# define DRVTAP_MAX_GSO_FRAME           (sizeof(RTNETETHERHDR) + 4 + 65535)
+#endif
+
+
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
 *******************************************************************************/
+#ifdef RT_OS_LINUX
+/**
+ * The header the Linux tap device puts in front of every frame when opened
+ * with IFF_VNET_HDR (struct virtio_net_hdr, host endian).
+ */
+typedef struct DRVTAPVNETHDR
+{
+    /** DRVTAP_VNETHDR_F_XXX. */
+    uint8_t                 fFlags;
+    /** DRVTAP_VNETHDR_GSO_XXX. */
+    uint8_t                 u8GsoType;
+    /** The size of the headers (a hint only). */
+    uint16_t                cbHdrs;
+    /** The maximum segment size. */
+    uint16_t                cbGsoSize;
+    /** Where to start checksumming from. */
+    uint16_t                offCsumStart;
+    /** Where to put the checksum, relative to offCsumStart. */
+    uint16_t                offCsum;
+} DRVTAPVNETHDR;
+AssertCompileSize(DRVTAPVNETHDR, 10);
+/** Pointer to a virtio-net header. */
+typedef DRVTAPVNETHDR *PDRVTAPVNETHDR;
+/** Pointer to a const virtio-net header. */
+typedef DRVTAPVNETHDR const *PCDRVTAPVNETHDR;
+#endif
+
 /**
  * TAP driver instance data.
  *
@@ -111,15 +163,30 @@ typedef struct DRVTAP
     /** Transmit lock used by drvTAPNetworkUp_BeginXmit. */
     RTCRITSECT              XmitLock;
 
+#ifdef RT_OS_LINUX
+    /** Set if the device was opened with IFF_VNET_HDR and each frame comes with
+     * a DRVTAPVNETHDR in front of it. */
+    bool                    fVNetHdr;
+    /** Set if GSO frames are passed to and taken from the host as they are
+     * instead of being segmented by us (TUNSETOFFLOAD). */
+    bool                    fGsoOffload;
+    /** The receive buffer used in vnet header mode, DRVTAP_MAX_GSO_FRAME bytes. */
+    uint8_t                *pbRecvBuf;
+#endif
+
 #ifdef VBOX_WITH_STATISTICS
     /** Number of sent packets. */
     STAMCOUNTER             StatPktSent;
     /** Number of sent bytes. */
     STAMCOUNTER             StatPktSentBytes;
+    /** Number of GSO frames handed to the host unsegmented. */
+    STAMCOUNTER             StatPktSentGso;
     /** Number of received packets. */
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of GSO frames received from the host. */
+    STAMCOUNTER             StatPktRecvGso;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -227,22 +294,64 @@ static DECLCALLBACK(int) drvTAPNetworkUp_FreeBuf(PPDMINETWORKUP pInterface, PPDM
 }
 
 
+#ifdef RT_OS_LINUX
 /**
- * @interface_method_impl{PDMINETWORKUP,pfnSendBuf}
+ * Writes a frame with a virtio-net header in front of it to the TAP device.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The TAP driver instance.
+ * @param   pHdr            The virtio-net header.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The size of the frame.
  */
-static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+static int drvTAPWriteVNet(PDRVTAP pThis, PCDRVTAPVNETHDR pHdr, const void *pvFrame, size_t cbFrame)
+{
+    struct iovec aIov[2];
+    aIov[0].iov_base = (void *)pHdr;
+    aIov[0].iov_len  = sizeof(*pHdr);
+    aIov[1].iov_base = (void *)pvFrame;
+    aIov[1].iov_len  = cbFrame;
+    if (writev(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov)) >= 0)
+        return VINF_SUCCESS;
+    return RTErrConvertFromErrno(errno);
+}
+
+
+/**
+ * Translates a GSO type into the virtio-net one.
+ *
+ * @returns DRVTAP_VNETHDR_GSO_XXX, DRVTAP_VNETHDR_GSO_NONE if the host can't
+ *          take the frame unsegmented.
+ * @param   pGso            The GSO context.
+ */
+static uint8_t drvTAPGsoToVNetType(PCPDMNETWORKGSO pGso)
+{
+    switch ((PDMNETWORKGSOTYPE)pGso->u8Type)
+    {
+        case PDMNETWORKGSOTYPE_IPV4_TCP:    return DRVTAP_VNETHDR_GSO_TCPV4;
+        case PDMNETWORKGSOTYPE_IPV6_TCP:    return DRVTAP_VNETHDR_GSO_TCPV6;
+        /* UFO is gone from recent kernels and the tunneled types have no
+           virtio-net equivalent. */
+        default:                            return DRVTAP_VNETHDR_GSO_NONE;
+    }
+}
+#endif /* RT_OS_LINUX */
+
+
+/**
+ * Writes a frame to the TAP device and frees the buffer.
+ *
+ * @returns VBox status code, see PDMINETWORKUP::pfnSendBuf.
+ * @param   pThis           The TAP driver instance.
+ * @param   pSgBuf          The buffer to send.  Consumed.
+ */
+static int drvTAPSendSgBuf(PDRVTAP pThis, PPDMSCATTERGATHER pSgBuf)
 {
-    PDRVTAP pThis = PDMINETWORKUP_2_DRVTAP(pInterface);
     STAM_COUNTER_INC(&pThis->StatPktSent);
     STAM_COUNTER_ADD(&pThis->StatPktSentBytes, pSgBuf->cbUsed);
-    STAM_PROFILE_START(&pThis->StatTransmit, a);
 
     AssertPtr(pSgBuf);
     Assert((pSgBuf->fFlags & PDMSCATTERGATHER_FLAGS_MAGIC_MASK) == PDMSCATTERGATHER_FLAGS_MAGIC);
-    Assert(RTCritSectIsOwner(&pThis->XmitLock));
-
-    /* Set an FTM checkpoint as this operation changes the state permanently. */
-    PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
 
     int rc;
     if (!pSgBuf->pvUser)
@@ -257,8 +366,40 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
               "%.*Rhxd\n",
               pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, pSgBuf->cbUsed, pSgBuf->aSegs[0].pvSeg));
 
-        rc = RTFileWrite(pThis->hFileDevice, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
+#ifdef RT_OS_LINUX
+        if (pThis->fVNetHdr)
+        {
+            DRVTAPVNETHDR Hdr;
+            RT_ZERO(Hdr);
+            rc = drvTAPWriteVNet(pThis, &Hdr, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
+        }
+        else
+#endif
+            rc = RTFileWrite(pThis->hFileDevice, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
+    }
+#ifdef RT_OS_LINUX
+    else if (   pThis->fGsoOffload
+             && drvTAPGsoToVNetType((PCPDMNETWORKGSO)pSgBuf->pvUser) != DRVTAP_VNETHDR_GSO_NONE)
+    {
+        /*
+         * Let the host kernel do the segmentation.  It wants the pseudo header
+         * checksum in the TCP header, like any other CHECKSUM_PARTIAL skb.
+         */
+        PCPDMNETWORKGSO pGso = (PCPDMNETWORKGSO)pSgBuf->pvUser;
+        DRVTAPVNETHDR   Hdr;
+        Hdr.fFlags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+        Hdr.u8GsoType    = drvTAPGsoToVNetType(pGso);
+        Hdr.cbHdrs       = pGso->cbHdrsTotal;
+        Hdr.cbGsoSize    = pGso->cbMaxSeg;
+        Hdr.offCsumStart = pGso->offHdr2;
+        Hdr.offCsum      = RT_OFFSETOF(RTNETTCP, th_sum);
+        PDMNetGsoPrepForDirectUse(pGso, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, PDMNETCSUMTYPE_PSEUDO);
+        Log2(("drvTAPSend: GSO %s cbUsed=%#x cbMaxSeg=%#x\n",
+              PDMNetGsoTypeName((PDMNETWORKGSOTYPE)pGso->u8Type), pSgBuf->cbUsed, pGso->cbMaxSeg));
+        STAM_COUNTER_INC(&pThis->StatPktSentGso);
+        rc = drvTAPWriteVNet(pThis, &Hdr, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed);
     }
+#endif
     else
     {
         uint8_t         abHdrScratch[256];
@@ -271,7 +412,16 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
             uint32_t cbSegFrame;
             void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
                                                        iSeg, cSegs, &cbSegFrame);
-            rc = RTFileWrite(pThis->hFileDevice, pvSegFrame, cbSegFrame, NULL);
+#ifdef RT_OS_LINUX
+            if (pThis->fVNetHdr)
+            {
+                DRVTAPVNETHDR Hdr;
+                RT_ZERO(Hdr);
+                rc = drvTAPWriteVNet(pThis, &Hdr, pvSegFrame, cbSegFrame);
+            }
+            else
+#endif
+                rc = RTFileWrite(pThis->hFileDevice, pvSegFrame, cbSegFrame, NULL);
             if (RT_FAILURE(rc))
                 break;
         }
@@ -280,7 +430,6 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
     pSgBuf->fFlags = 0;
     RTMemFree(pSgBuf);
 
-    STAM_PROFILE_STOP(&pThis->StatTransmit, a);
     AssertRC(rc);
     if (RT_FAILURE(rc))
         rc = rc == VERR_NO_MEMORY ? VERR_NET_NO_BUFFER_SPACE : VERR_NET_DOWN;
@@ -288,6 +437,52 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
 }
 
 
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBuf}
+ */
+static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER pSgBuf, bool fOnWorkerThread)
+{
+    PDRVTAP pThis = PDMINETWORKUP_2_DRVTAP(pInterface);
+    STAM_PROFILE_START(&pThis->StatTransmit, a);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+
+    /* Set an FTM checkpoint as this operation changes the state permanently. */
+    PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
+
+    int rc = drvTAPSendSgBuf(pThis, pSgBuf);
+    STAM_PROFILE_STOP(&pThis->StatTransmit, a);
+    return rc;
+}
+
+
+/**
+ * @interface_method_impl{PDMINETWORKUP,pfnSendBufs}
+ *
+ * The TAP device takes one frame per write, so this only saves the per frame
+ * checkpointing and profiling.
+ */
+static DECLCALLBACK(int) drvTAPNetworkUp_SendBufs(PPDMINETWORKUP pInterface, PPDMSCATTERGATHER *papSgBufs, uint32_t cSgBufs,
+                                                  bool fOnWorkerThread)
+{
+    PDRVTAP pThis = PDMINETWORKUP_2_DRVTAP(pInterface);
+    STAM_PROFILE_START(&pThis->StatTransmit, a);
+    Assert(RTCritSectIsOwner(&pThis->XmitLock));
+
+    /* Set an FTM checkpoint as this operation changes the state permanently. */
+    PDMDrvHlpFTSetCheckpoint(pThis->pDrvIns, FTMCHECKPOINTTYPE_NETWORK);
+
+    int rc = VINF_SUCCESS;
+    for (uint32_t i = 0; i < cSgBufs; i++)
+    {
+        int rc2 = drvTAPSendSgBuf(pThis, papSgBufs[i]);
+        if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+            rc = rc2;
+    }
+    STAM_PROFILE_STOP(&pThis->StatTransmit, a);
+    return rc;
+}
+
+
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnEndXmit}
  */
@@ -322,6 +517,139 @@ static DECLCALLBACK(void) drvTAPNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInte
 }
 
 
+#ifdef RT_OS_LINUX
+/**
+ * Reads a frame and its virtio-net header from the TAP device into the
+ * receive buffer.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The TAP driver instance.
+ * @param   pHdr            Where to return the virtio-net header.
+ * @param   pcbFrame        Where to return the size of the frame.
+ */
+static int drvTAPReadVNet(PDRVTAP pThis, PDRVTAPVNETHDR pHdr, size_t *pcbFrame)
+{
+    struct iovec aIov[2];
+    aIov[0].iov_base = pHdr;
+    aIov[0].iov_len  = sizeof(*pHdr);
+    aIov[1].iov_base = pThis->pbRecvBuf;
+    aIov[1].iov_len  = DRVTAP_MAX_GSO_FRAME;
+    ssize_t cbRead = readv(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov));
+    if (cbRead < 0)
+        return RTErrConvertFromErrno(errno);
+    if ((size_t)cbRead < sizeof(*pHdr) + sizeof(RTNETETHERHDR))
+        return VERR_NET_MSG_SIZE;
+    *pcbFrame = (size_t)cbRead - sizeof(*pHdr);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Creates the GSO context for a frame the host handed us unsegmented.
+ *
+ * @returns true if @a pGso is valid, false if the frame can't be handled.
+ * @param   pHdr            The virtio-net header of the frame.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   pGso            Where to return the GSO context.
+ */
+static bool drvTAPVNetHdrToGso(PCDRVTAPVNETHDR pHdr, uint8_t const *pbFrame, size_t cbFrame, PPDMNETWORKGSO pGso)
+{
+    switch (pHdr->u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN)
+    {
+        case DRVTAP_VNETHDR_GSO_TCPV4:  pGso->u8Type = PDMNETWORKGSOTYPE_IPV4_TCP; break;
+        case DRVTAP_VNETHDR_GSO_TCPV6:  pGso->u8Type = PDMNETWORKGSOTYPE_IPV6_TCP; break;
+        default:                        return false;
+    }
+
+    /* The header length in the virtio-net header is only a hint (Linux puts
+       the size of the linear skb part there), so work it out ourselves. */
+    uint32_t const offTcp = pHdr->offCsumStart;
+    if (   !(pHdr->fFlags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+        || offTcp + RTNETTCP_MIN_LEN > cbFrame)
+        return false;
+    uint32_t const cbHdrs = offTcp + ((PCRTNETTCP)&pbFrame[offTcp])->th_off * 4;
+    if (cbHdrs > UINT8_MAX)
+        return false;
+
+    PCRTNETETHERHDR pEthHdr = (PCRTNETETHERHDR)pbFrame;
+    pGso->offHdr1     = pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_VLAN)
+                      ? sizeof(RTNETETHERHDR) + sizeof(uint32_t) : sizeof(RTNETETHERHDR);
+    pGso->offHdr2     = (uint8_t)offTcp;
+    pGso->cbHdrsTotal = (uint8_t)cbHdrs;
+    pGso->cbHdrsSeg   = (uint8_t)cbHdrs;
+    pGso->cbMaxSeg    = pHdr->cbGsoSize;
+    pGso->u8Unused    = 0;
+    return PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame);
+}
+
+
+/**
+ * Completes the checksum of a frame the host left for us to checksum.
+ *
+ * The checksum field holds the pseudo header checksum, so summing up
+ * everything from the start offset gives the final value.
+ *
+ * @param   pHdr            The virtio-net header of the frame.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ */
+static void drvTAPVNetCompleteCsum(PCDRVTAPVNETHDR pHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+    uint32_t const offStart = pHdr->offCsumStart;
+    if ((size_t)offStart + pHdr->offCsum + sizeof(uint16_t) > cbFrame)
+        return;
+    bool     fOdd   = false;
+    uint32_t u32Sum = RTNetIPv4AddDataChecksum(&pbFrame[offStart], cbFrame - offStart, 0, &fOdd);
+    uint16_t u16Sum = RTNetIPv4FinalizeChecksum(u32Sum);
+    memcpy(&pbFrame[offStart + pHdr->offCsum], &u16Sum, sizeof(u16Sum));
+}
+
+
+/**
+ * Passes a GSO frame from the host up, segmenting it if the device above
+ * can't take it as it is.
+ *
+ * The caller has already waited for receive space for the first frame.
+ *
+ * @returns VBox status code.
+ * @param   pThis           The TAP driver instance.
+ * @param   pbFrame         The frame.  Trashed when segmenting.
+ * @param   cbFrame         The size of the frame.
+ * @param   pGso            The GSO context.
+ */
+static int drvTAPRecvGso(PDRVTAP pThis, uint8_t *pbFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    if (pThis->pIAboveNet->pfnReceiveGso)
+    {
+        int rc = pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pbFrame, cbFrame, pGso);
+        if (rc != VERR_NOT_SUPPORTED)
+            return rc;
+    }
+
+    uint8_t        abHdrScratch[256];
+    uint32_t const cSegs = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        if (iSeg > 0)
+        {
+            /* Woken up by a VM state transition: drop the rest, as the caller
+               does with whole frames. */
+            int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+            if (RT_FAILURE(rc))
+                return VINF_SUCCESS;
+        }
+        uint32_t cbSegFrame;
+        void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+        int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvSegFrame, cbSegFrame);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VINF_SUCCESS;
+}
+#endif /* RT_OS_LINUX */
+
+
 /**
  * Asynchronous I/O thread for handling receive.
  *
@@ -371,7 +699,34 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
              * Read the frame.
              */
             char achBuf[16384];
+            char *pbBuf = achBuf;
             size_t cbRead = 0;
+#ifdef RT_OS_LINUX
+            DRVTAPVNETHDR VNetHdr;
+            PDMNETWORKGSO Gso;
+            bool fGso = false;
+            if (pThis->fVNetHdr)
+            {
+                pbBuf = (char *)pThis->pbRecvBuf;
+                rc = drvTAPReadVNet(pThis, &VNetHdr, &cbRead);
+                if (RT_SUCCESS(rc))
+                {
+                    if (VNetHdr.u8GsoType != DRVTAP_VNETHDR_GSO_NONE)
+                    {
+                        fGso = drvTAPVNetHdrToGso(&VNetHdr, pThis->pbRecvBuf, cbRead, &Gso);
+                        if (!fGso)
+                        {
+                            LogRel(("TAP#%d: Dropping GSO frame of type %#x which we cannot handle\n",
+                                    pDrvIns->iInstance, VNetHdr.u8GsoType));
+                            continue;
+                        }
+                    }
+                    else if (VNetHdr.fFlags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+                        drvTAPVNetCompleteCsum(&VNetHdr, pThis->pbRecvBuf, cbRead);
+                }
+            }
+            else
+#endif
             /** @note At least on Linux we will never receive more than one network packet
              *        after poll() returned successfully. I don't know why but a second
              *        RTFileRead() operation will return with VERR_TRY_AGAIN in any case. */
@@ -411,10 +766,18 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
                          cbRead, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
                 pThis->u64LastReceiveTS = u64Now;
 #endif
-                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, achBuf));
+                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, pbBuf));
                 STAM_COUNTER_INC(&pThis->StatPktRecv);
                 STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbRead);
-                rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, achBuf, cbRead);
+#ifdef RT_OS_LINUX
+                if (fGso)
+                {
+                    STAM_COUNTER_INC(&pThis->StatPktRecvGso);
+                    rc1 = drvTAPRecvGso(pThis, (uint8_t *)pbBuf, cbRead, &Gso);
+                }
+                else
+#endif
+                    rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pbBuf, cbRead);
                 AssertRC(rc1);
             }
             else
@@ -824,14 +1187,21 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     if (RTCritSectIsInitialized(&pThis->XmitLock))
         RTCritSectDelete(&pThis->XmitLock);
 
+#ifdef RT_OS_LINUX
+    RTMemFree(pThis->pbRecvBuf);
+    pThis->pbRecvBuf = NULL;
+#endif
+
 #ifdef VBOX_WITH_STATISTICS
     /*
      * Deregister statistics.
      */
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSent);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentGso);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGso);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
 #endif /* VBOX_WITH_STATISTICS */
@@ -862,6 +1232,11 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
 #endif
     pThis->pszSetupApplication          = NULL;
     pThis->pszTerminateApplication      = NULL;
+#ifdef RT_OS_LINUX
+    pThis->fVNetHdr                     = false;
+    pThis->fGsoOffload                  = false;
+    pThis->pbRecvBuf                    = NULL;
+#endif
 
     /* IBase */
     pDrvIns->IBase.pfnQueryInterface    = drvTAPQueryInterface;
@@ -870,6 +1245,7 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     pThis->INetworkUp.pfnAllocBuf               = drvTAPNetworkUp_AllocBuf;
     pThis->INetworkUp.pfnFreeBuf                = drvTAPNetworkUp_FreeBuf;
     pThis->INetworkUp.pfnSendBuf                = drvTAPNetworkUp_SendBuf;
+    pThis->INetworkUp.pfnSendBufs               = drvTAPNetworkUp_SendBufs;
     pThis->INetworkUp.pfnEndXmit                = drvTAPNetworkUp_EndXmit;
     pThis->INetworkUp.pfnSetPromiscuousMode     = drvTAPNetworkUp_SetPromiscuousMode;
     pThis->INetworkUp.pfnNotifyLinkChanged      = drvTAPNetworkUp_NotifyLinkChanged;
@@ -880,8 +1256,10 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
      */
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSent,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of sent packets.",          "/Drivers/TAP%d/Packets/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/TAP%d/Bytes/Sent", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentGso,    STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,        "Number of GSO frames sent unsegmented.", "/Drivers/TAP%d/Packets/SentGso", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/TAP%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/TAP%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGso,    STAMTYPE_COUNTER, STAMVISIBILITY_USED,   STAMUNIT_OCCURENCES,        "Number of GSO frames received.",   "/Drivers/TAP%d/Packets/ReceivedGso", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/TAP%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/TAP%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -889,7 +1267,7 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "Device\0InitProg\0TermProg\0FileHandle\0TAPSetupApplication\0TAPTerminateApplication\0MAC"))
+    if (!CFGMR3AreValuesValid(pCfg, "Device\0InitProg\0TermProg\0FileHandle\0TAPSetupApplication\0TAPTerminateApplication\0MAC\0Offload\0"))
         return PDMDRV_SET_ERROR(pDrvIns, VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES, "");
 
     /*
@@ -984,6 +1362,45 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     Log(("drvTAPContruct: %d (from fd)\n", pThis->hFileDevice));
     rc = VINF_SUCCESS;
 
+#ifdef RT_OS_LINUX
+    /*
+     * If the device was opened with IFF_VNET_HDR every frame comes with a
+     * virtio-net header, which we use to exchange GSO frames with the host
+     * kernel unless told not to.
+     */
+    bool fOffload;
+    rc = CFGMR3QueryBoolDef(pCfg, "Offload", &fOffload, true);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Configuration error: failed to query \"Offload\""));
+
+    struct ifreq IfReq;
+    RT_ZERO(IfReq);
+    if (   ioctl(RTFileToNative(pThis->hFileDevice), TUNGETIFF, &IfReq) == 0
+        && (IfReq.ifr_flags & IFF_VNET_HDR))
+    {
+        int cbVNetHdr = sizeof(DRVTAPVNETHDR);
+        if (ioctl(RTFileToNative(pThis->hFileDevice), TUNSETVNETHDRSZ, &cbVNetHdr) == -1)
+            return PDMDrvHlpVMSetError(pDrvIns, VERR_HOSTIF_IOCTL, RT_SRC_POS,
+                                       N_("Failed to set the virtio-net header size of the TAP device. errno=%d"), errno);
+        pThis->pbRecvBuf = (uint8_t *)RTMemAlloc(DRVTAP_MAX_GSO_FRAME);
+        if (!pThis->pbRecvBuf)
+            return VERR_NO_MEMORY;
+        pThis->fVNetHdr = true;
+
+        if (fOffload)
+        {
+            unsigned fOffloads = TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6;
+            if (ioctl(RTFileToNative(pThis->hFileDevice), TUNSETOFFLOAD, fOffloads) == 0)
+                pThis->fGsoOffload = true;
+            else
+                LogRel(("TAP#%d: TUNSETOFFLOAD failed, errno=%d. Segmenting GSO frames ourselves.\n",
+                        pDrvIns->iInstance, errno));
+        }
+        LogRel(("TAP#%d: Using virtio-net headers, GSO offload %s\n",
+                pDrvIns->iInstance, pThis->fGsoOffload ? "enabled" : "disabled"));
+    }
+#endif
+
     /*
      * Create the control pipe.
      */
@@ -0,0 +1,411 @@
+/* $Id$ */
+/** @file
+ * Receive side TCP segment coalescing (LRO) for the network drivers.
+ *
+ * Merges consecutive in-order TCP segments of one connection into a single
+ * GSO frame which devices implementing PDMINETWORKDOWN::pfnReceiveGso can
+ * hand to the guest in one go (virtio-net with TSO negotiated by the guest).
+ * The segments are checksummed here before being merged, so the guest may
+ * treat the result as verified.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_DRV
+#include "NetRxCoalesce.h"
+
+#include <VBox/log.h>
+#include <VBox/vmm/pdmnetinline.h>
+#include <iprt/assert.h>
+#include <iprt/err.h>
+#include <iprt/mem.h>
+#include <iprt/net.h>
+#include <iprt/string.h>
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A parsed TCP segment which is a candidate for merging.
+ */
+typedef struct NETRXSEG
+{
+    /** PDMNETWORKGSOTYPE_IPV4_TCP or PDMNETWORKGSOTYPE_IPV6_TCP. */
+    uint8_t         u8Type;
+    /** Offset of the TCP header. */
+    uint8_t         offTcpHdr;
+    /** The size of all the headers, including TCP options. */
+    uint8_t         cbHdrs;
+    /** The TCP flags. */
+    uint8_t         fFlags;
+    /** The size of the TCP payload. */
+    uint32_t        cbPayload;
+    /** The sequence number (host endian). */
+    uint32_t        uSeq;
+} NETRXSEG;
+/** Pointer to a parsed segment. */
+typedef NETRXSEG *PNETRXSEG;
+/** Pointer to a const parsed segment. */
+typedef NETRXSEG const *PCNETRXSEG;
+
+
+/**
+ * Checks if a frame is a TCP segment we can merge and parses it.
+ *
+ * Only plain data segments (ACK, optionally PSH) without IPv4 options or IPv6
+ * extension headers qualify, and only if their checksums are correct.
+ *
+ * @returns true if it's a candidate, false if it must be passed on as is.
+ * @param   pbFrame     The frame.
+ * @param   cbFrame     The size of the frame.
+ * @param   pSeg        Where to return the segment info.
+ */
+static bool netRxCoalesceParse(const uint8_t *pbFrame, size_t cbFrame, PNETRXSEG pSeg)
+{
+    if (cbFrame < sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + RTNETTCP_MIN_LEN)
+        return false;
+
+    PCRTNETETHERHDR pEthHdr  = (PCRTNETETHERHDR)pbFrame;
+    uint32_t const  offIpHdr = sizeof(RTNETETHERHDR);
+    uint32_t        cbIpHdr;
+    uint32_t        cbIpPkt;
+    if (pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4))
+    {
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&pbFrame[offIpHdr];
+        if (   pIpHdr->ip_v  != 4
+            || pIpHdr->ip_hl != RTNETIPV4_MIN_LEN / 4
+            || pIpHdr->ip_p  != RTNETIPV4_PROT_TCP
+            || (pIpHdr->ip_off & ~RT_H2N_U16_C(RTNETIPV4_FLAGS_DF)))
+            return false;
+        pSeg->u8Type = PDMNETWORKGSOTYPE_IPV4_TCP;
+        cbIpHdr      = RTNETIPV4_MIN_LEN;
+        cbIpPkt      = RT_N2H_U16(pIpHdr->ip_len);
+    }
+    else if (pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_IPV6))
+    {
+        if (cbFrame < sizeof(RTNETETHERHDR) + RTNETIPV6_MIN_LEN + RTNETTCP_MIN_LEN)
+            return false;
+        PCRTNETIPV6 pIp6Hdr = (PCRTNETIPV6)&pbFrame[offIpHdr];
+        if (   (pIp6Hdr->ip6_vfc & RT_H2N_U32_C(0xf0000000)) != RT_H2N_U32_C(0x60000000)
+            || pIp6Hdr->ip6_nxt != RTNETIPV4_PROT_TCP)
+            return false;
+        pSeg->u8Type = PDMNETWORKGSOTYPE_IPV6_TCP;
+        cbIpHdr      = RTNETIPV6_MIN_LEN;
+        cbIpPkt      = RTNETIPV6_MIN_LEN + RT_N2H_U16(pIp6Hdr->ip6_plen);
+    }
+    else
+        return false;
+
+    /* The frame may be padded, but it must not be truncated. */
+    if (   cbIpPkt > cbFrame - offIpHdr
+        || cbIpPkt < cbIpHdr + RTNETTCP_MIN_LEN)
+        return false;
+
+    pSeg->offTcpHdr = (uint8_t)(offIpHdr + cbIpHdr);
+    PCRTNETTCP pTcpHdr = (PCRTNETTCP)&pbFrame[pSeg->offTcpHdr];
+    uint32_t const cbTcpHdr = pTcpHdr->th_off * 4;
+    pSeg->fFlags = pTcpHdr->th_flags;
+    if (   cbTcpHdr < RTNETTCP_MIN_LEN
+        || cbIpPkt <= cbIpHdr + cbTcpHdr
+        || (pSeg->fFlags & ~RTNETTCP_F_PSH) != RTNETTCP_F_ACK)
+        return false;
+    pSeg->cbHdrs    = (uint8_t)(pSeg->offTcpHdr + cbTcpHdr);
+    pSeg->cbPayload = offIpHdr + cbIpPkt - pSeg->cbHdrs;
+    pSeg->uSeq      = RT_N2H_U32(pTcpHdr->th_seq);
+
+    /* Verify the checksums last, it's the expensive bit. */
+    if (pSeg->u8Type == PDMNETWORKGSOTYPE_IPV4_TCP)
+    {
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&pbFrame[offIpHdr];
+        return RTNetIPv4IsHdrValid(pIpHdr, cbIpHdr, cbIpPkt, true /*fChecksum*/)
+            && RTNetIPv4IsTCPValid(pIpHdr, pTcpHdr, cbTcpHdr, NULL, cbIpPkt - cbIpHdr, true /*fChecksum*/);
+    }
+    PCRTNETIPV6 pIp6Hdr = (PCRTNETIPV6)&pbFrame[offIpHdr];
+    return RTNetTCPChecksum(RTNetIPv6PseudoChecksum(pIp6Hdr), pTcpHdr,
+                            &pbFrame[pSeg->cbHdrs], pSeg->cbPayload) == pTcpHdr->th_sum;
+}
+
+
+/**
+ * Checks if a segment continues the flow being held.
+ *
+ * @returns true if it can be appended.
+ * @param   pThis       The coalescing state.
+ * @param   pbFrame     The frame of the segment.
+ * @param   pSeg        The parsed segment.
+ */
+static bool netRxCoalesceIsNextSeg(PNETRXCOALESCE pThis, const uint8_t *pbFrame, PCNETRXSEG pSeg)
+{
+    if (   pSeg->u8Type    != pThis->Gso.u8Type
+        || pSeg->cbHdrs    != pThis->Gso.cbHdrsTotal
+        || pSeg->uSeq      != pThis->uNextSeq
+        || pSeg->cbPayload >  pThis->Gso.cbMaxSeg
+        || pThis->cbHeld + pSeg->cbPayload > NETRXCOALESCE_MAX_FRAME)
+        return false;
+
+    const uint8_t *pbHeld = pThis->pbBuf;
+    if (memcmp(pbFrame, pbHeld, sizeof(RTNETETHERHDR)))
+        return false;
+
+    if (pSeg->u8Type == PDMNETWORKGSOTYPE_IPV4_TCP)
+    {
+        PCRTNETIPV4 pIpHdr     = (PCRTNETIPV4)&pbFrame[sizeof(RTNETETHERHDR)];
+        PCRTNETIPV4 pHeldIpHdr = (PCRTNETIPV4)&pbHeld[sizeof(RTNETETHERHDR)];
+        if (   pIpHdr->ip_tos   != pHeldIpHdr->ip_tos
+            || pIpHdr->ip_off   != pHeldIpHdr->ip_off
+            || pIpHdr->ip_ttl   != pHeldIpHdr->ip_ttl
+            || pIpHdr->ip_src.u != pHeldIpHdr->ip_src.u
+            || pIpHdr->ip_dst.u != pHeldIpHdr->ip_dst.u)
+            return false;
+    }
+    else
+    {
+        PCRTNETIPV6 pIp6Hdr     = (PCRTNETIPV6)&pbFrame[sizeof(RTNETETHERHDR)];
+        PCRTNETIPV6 pHeldIp6Hdr = (PCRTNETIPV6)&pbHeld[sizeof(RTNETETHERHDR)];
+        if (   pIp6Hdr->ip6_vfc  != pHeldIp6Hdr->ip6_vfc
+            || pIp6Hdr->ip6_hlim != pHeldIp6Hdr->ip6_hlim
+            || memcmp(&pIp6Hdr->ip6_src, &pHeldIp6Hdr->ip6_src, 2 * sizeof(RTNETADDRIPV6)))
+            return false;
+    }
+
+    PCRTNETTCP pTcpHdr     = (PCRTNETTCP)&pbFrame[pSeg->offTcpHdr];
+    PCRTNETTCP pHeldTcpHdr = (PCRTNETTCP)&pbHeld[pSeg->offTcpHdr];
+    return pTcpHdr->th_sport == pHeldTcpHdr->th_sport
+        && pTcpHdr->th_dport == pHeldTcpHdr->th_dport
+        && pTcpHdr->th_ack   == pHeldTcpHdr->th_ack
+        && pTcpHdr->th_win   == pHeldTcpHdr->th_win
+        && pTcpHdr->th_urp   == pHeldTcpHdr->th_urp
+        && (pTcpHdr->th_flags & ~RTNETTCP_F_PSH) == (pHeldTcpHdr->th_flags & ~RTNETTCP_F_PSH)
+        /* The options (timestamps mostly) must be identical. */
+        && !memcmp(pTcpHdr + 1, pHeldTcpHdr + 1, pSeg->cbHdrs - pSeg->offTcpHdr - RTNETTCP_MIN_LEN);
+}
+
+
+/**
+ * Updates the headers of the held frame to describe the whole aggregate.
+ *
+ * The TCP checksum is set to the pseudo header sum as the devices signal a
+ * partial checksum to the guest along with the GSO frame.
+ *
+ * @param   pThis       The coalescing state.
+ * @param   cbFrame     The size of the aggregate frame.
+ */
+static void netRxCoalesceFinalizeHdrs(PNETRXCOALESCE pThis, uint32_t cbFrame)
+{
+    uint8_t * const pbFrame = pThis->pbBuf;
+    uint32_t        u32Sum;
+    if (pThis->Gso.u8Type == PDMNETWORKGSOTYPE_IPV4_TCP)
+    {
+        PRTNETIPV4 pIpHdr = (PRTNETIPV4)&pbFrame[pThis->Gso.offHdr1];
+        pIpHdr->ip_len    = RT_H2N_U16((uint16_t)(cbFrame - pThis->Gso.offHdr1));
+        pIpHdr->ip_sum    = RTNetIPv4HdrChecksum(pIpHdr);
+        u32Sum = RTNetIPv4PseudoChecksum(pIpHdr);
+    }
+    else
+    {
+        PRTNETIPV6 pIp6Hdr = (PRTNETIPV6)&pbFrame[pThis->Gso.offHdr1];
+        pIp6Hdr->ip6_plen  = RT_H2N_U16((uint16_t)(cbFrame - pThis->Gso.offHdr2));
+        u32Sum = RTNetIPv6PseudoChecksumEx(pIp6Hdr, RTNETIPV4_PROT_TCP, (uint16_t)(cbFrame - pThis->Gso.offHdr2));
+    }
+    PRTNETTCP pTcpHdr = (PRTNETTCP)&pbFrame[pThis->Gso.offHdr2];
+    pTcpHdr->th_sum   = ~RTNetIPv4FinalizeChecksum(u32Sum);
+}
+
+
+/**
+ * Initializes receive coalescing.
+ *
+ * If this isn't called the coalescer stays disabled and passes everything
+ * thru, so the owner may skip it when the device above cannot take GSO
+ * frames.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The coalescing state (zeroed).
+ * @param   pfnDeliver  The callback delivering frames to the device above.
+ * @param   pvUser      The user argument for @a pfnDeliver.
+ */
+int NetRxCoalesceInit(PNETRXCOALESCE pThis, PFNNETRXCOALESCEDELIVER pfnDeliver, void *pvUser)
+{
+    AssertPtrReturn(pfnDeliver, VERR_INVALID_POINTER);
+
+    pThis->pbBuf = (uint8_t *)RTMemAlloc(NETRXCOALESCE_MAX_FRAME);
+    if (!pThis->pbBuf)
+        return VERR_NO_MEMORY;
+    pThis->pfnDeliver = pfnDeliver;
+    pThis->pvUser     = pvUser;
+    pThis->cbHeld     = 0;
+    pThis->cSegs      = 0;
+    pThis->uNextSeq   = 0;
+    pThis->cBackoff   = 0;
+    RT_ZERO(pThis->Gso);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Frees the resources of the coalescer, discarding anything held.
+ *
+ * @param   pThis       The coalescing state.
+ */
+void NetRxCoalesceTerm(PNETRXCOALESCE pThis)
+{
+    RTMemFree(pThis->pbBuf);
+    pThis->pbBuf  = NULL;
+    pThis->cbHeld = 0;
+    pThis->cSegs  = 0;
+}
+
+
+/**
+ * Offers a received frame to the coalescer.
+ *
+ * When the frame cannot be merged, whatever is held is flushed first, so the
+ * caller can simply deliver the frame itself afterwards without reordering
+ * anything.
+ *
+ * @returns true if the frame was taken (copied), false if the caller must
+ *          deliver it.
+ * @param   pThis       The coalescing state.
+ * @param   pvFrame     The frame.
+ * @param   cbFrame     The size of the frame.
+ */
+bool NetRxCoalesceAdd(PNETRXCOALESCE pThis, const void *pvFrame, size_t cbFrame)
+{
+    if (!pThis->pbBuf)
+        return false;
+    if (pThis->cBackoff)
+    {
+        /* The device refused GSO frames recently; nothing is held here. */
+        pThis->cBackoff--;
+        return false;
+    }
+
+    const uint8_t *pbFrame = (const uint8_t *)pvFrame;
+    NETRXSEG       Seg;
+    if (!netRxCoalesceParse(pbFrame, cbFrame, &Seg))
+    {
+        NetRxCoalesceFlush(pThis);
+        return false;
+    }
+
+    if (pThis->cSegs)
+    {
+        if (netRxCoalesceIsNextSeg(pThis, pbFrame, &Seg))
+        {
+            memcpy(&pThis->pbBuf[pThis->cbHeld], &pbFrame[Seg.cbHdrs], Seg.cbPayload);
+            pThis->cbHeld  += Seg.cbPayload;
+            pThis->cSegs++;
+            pThis->uNextSeq = Seg.uSeq + Seg.cbPayload;
+
+            /* A push, a short segment or a full buffer ends the aggregate. */
+            if (Seg.fFlags & RTNETTCP_F_PSH)
+                ((PRTNETTCP)&pThis->pbBuf[Seg.offTcpHdr])->th_flags |= RTNETTCP_F_PSH;
+            else if (   Seg.cbPayload == pThis->Gso.cbMaxSeg
+                     && pThis->cbHeld + pThis->Gso.cbMaxSeg <= NETRXCOALESCE_MAX_FRAME)
+                return true;
+            NetRxCoalesceFlush(pThis);
+            return true;
+        }
+        NetRxCoalesceFlush(pThis);
+    }
+
+    /* A pushed segment has nothing to wait for. */
+    if (   (Seg.fFlags & RTNETTCP_F_PSH)
+        || Seg.cbHdrs + 2 * Seg.cbPayload > NETRXCOALESCE_MAX_FRAME)
+        return false;
+
+    memcpy(pThis->pbBuf, pbFrame, Seg.cbHdrs + Seg.cbPayload);
+    pThis->cbHeld          = Seg.cbHdrs + Seg.cbPayload;
+    pThis->cSegs           = 1;
+    pThis->uNextSeq        = Seg.uSeq + Seg.cbPayload;
+    pThis->Gso.u8Type      = Seg.u8Type;
+    pThis->Gso.cbHdrsTotal = Seg.cbHdrs;
+    pThis->Gso.cbHdrsSeg   = Seg.cbHdrs;
+    pThis->Gso.cbMaxSeg    = (uint16_t)Seg.cbPayload;
+    pThis->Gso.offHdr1     = sizeof(RTNETETHERHDR);
+    pThis->Gso.offHdr2     = Seg.offTcpHdr;
+    pThis->Gso.u8Unused    = 0;
+    return true;
+}
+
+
+/**
+ * Delivers whatever the coalescer is holding.
+ *
+ * A single segment is delivered as it was received.  Should the device refuse
+ * a GSO frame, it is segmented again and the coalescer passes frames thru for
+ * a while (NETRXCOALESCE_BACKOFF) before trying again, as the guest may not
+ * have negotiated the offload.
+ *
+ * @returns VBox status code of the (last) delivery.
+ * @param   pThis       The coalescing state.
+ */
+int NetRxCoalesceFlush(PNETRXCOALESCE pThis)
+{
+    uint32_t const cSegs = pThis->cSegs;
+    if (!cSegs)
+        return VINF_SUCCESS;
+    uint32_t const cbFrame = pThis->cbHeld;
+    pThis->cSegs  = 0;
+    pThis->cbHeld = 0;
+
+    if (cSegs == 1)
+        return pThis->pfnDeliver(pThis->pvUser, pThis->pbBuf, cbFrame, NULL);
+
+    netRxCoalesceFinalizeHdrs(pThis, cbFrame);
+    Assert(PDMNetGsoIsValid(&pThis->Gso, sizeof(pThis->Gso), cbFrame));
+
+    int rc = pThis->pfnDeliver(pThis->pvUser, pThis->pbBuf, cbFrame, &pThis->Gso);
+    if (rc != VERR_NOT_SUPPORTED)
+    {
+        if (RT_SUCCESS(rc))
+        {
+            STAM_REL_COUNTER_INC(&pThis->StatGsoFrames);
+            STAM_REL_COUNTER_ADD(&pThis->StatSegsMerged, cSegs);
+        }
+        return rc;
+    }
+
+    Log(("NetRxCoalesceFlush: GSO frame refused, segmenting %u segments\n", cSegs));
+    STAM_REL_COUNTER_INC(&pThis->StatRefused);
+    pThis->cBackoff = NETRXCOALESCE_BACKOFF;
+
+    uint8_t        abHdrScratch[256];
+    uint32_t const cSegsOut = PDMNetGsoCalcSegmentCount(&pThis->Gso, cbFrame);
+    for (uint32_t iSeg = 0; iSeg < cSegsOut; iSeg++)
+    {
+        uint32_t cbSegFrame;
+        void    *pvSegFrame = PDMNetGsoCarveSegmentQD(&pThis->Gso, pThis->pbBuf, cbFrame, abHdrScratch,
+                                                      iSeg, cSegsOut, &cbSegFrame);
+        rc = pThis->pfnDeliver(pThis->pvUser, pvSegFrame, cbSegFrame, NULL);
+        if (RT_FAILURE(rc))
+            break; /* we drop the rest. */
+    }
+    return rc;
+}
+
+
+/**
+ * Drops whatever the coalescer is holding, e.g. when the link goes down.
+ *
+ * @param   pThis       The coalescing state.
+ */
+void NetRxCoalesceDiscard(PNETRXCOALESCE pThis)
+{
+    pThis->cSegs  = 0;
+    pThis->cbHeld = 0;
+}
@@ -0,0 +1,94 @@
+/* $Id$ */
+/** @file
+ * Receive side TCP segment coalescing (LRO) for the network drivers.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___VBox_NetRxCoalesce_h
+#define ___VBox_NetRxCoalesce_h
+
+#include <VBox/types.h>
+#include <VBox/vmm/stam.h>
+
+RT_C_DECLS_BEGIN
+
+/** The largest frame the coalescer builds (ethernet header + max IP packet). */
+#define NETRXCOALESCE_MAX_FRAME     (14 + 65535)
+/** Number of frames to pass thru untouched after the device refused a GSO
+ * frame before trying again. */
+#define NETRXCOALESCE_BACKOFF       1024
+
+/**
+ * Delivers a frame to the device above.
+ *
+ * The callee waits for receive buffer space as needed.
+ *
+ * @returns VBox status code.  VERR_NOT_SUPPORTED for a GSO frame makes the
+ *          coalescer segment it and redeliver the segments one by one, other
+ *          failures drop the frame.
+ * @param   pvUser          The user argument given to NetRxCoalesceInit.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   pGso            The segmentation context, NULL for ordinary frames.
+ */
+typedef DECLCALLBACK(int) FNNETRXCOALESCEDELIVER(void *pvUser, const void *pvFrame, size_t cbFrame, PCPDMNETWORKGSO pGso);
+/** Pointer to a FNNETRXCOALESCEDELIVER. */
+typedef FNNETRXCOALESCEDELIVER *PFNNETRXCOALESCEDELIVER;
+
+/**
+ * Receive coalescing state.
+ *
+ * Holds at most one flow: consecutive in-order TCP segments of the same
+ * connection are merged until something else comes along, the sender pushes,
+ * or the owner flushes because its receive queue has drained.  The owner
+ * serializes all calls.
+ */
+typedef struct NETRXCOALESCE
+{
+    /** The delivery callback. */
+    R3PTRTYPE(PFNNETRXCOALESCEDELIVER)  pfnDeliver;
+    /** The user argument for pfnDeliver. */
+    RTR3PTR                             pvUser;
+    /** The aggregation buffer, NETRXCOALESCE_MAX_FRAME bytes.  NULL if disabled. */
+    R3PTRTYPE(uint8_t *)                pbBuf;
+    /** The number of bytes held in pbBuf. */
+    uint32_t                            cbHeld;
+    /** The number of segments held in pbBuf, 0 if nothing is pending. */
+    uint32_t                            cSegs;
+    /** The sequence number the next segment must have. */
+    uint32_t                            uNextSeq;
+    /** Frames left to pass thru before retrying after a refusal. */
+    uint32_t                            cBackoff;
+    /** The segmentation context of the held frame. */
+    PDMNETWORKGSO                       Gso;
+    /** Number of segments merged into GSO frames. */
+    STAMCOUNTER                         StatSegsMerged;
+    /** Number of GSO frames delivered. */
+    STAMCOUNTER                         StatGsoFrames;
+    /** Number of GSO frames the device refused and which had to be segmented
+     * again. */
+    STAMCOUNTER                         StatRefused;
+} NETRXCOALESCE;
+/** Pointer to the receive coalescing state. */
+typedef NETRXCOALESCE *PNETRXCOALESCE;
+
+int  NetRxCoalesceInit(PNETRXCOALESCE pThis, PFNNETRXCOALESCEDELIVER pfnDeliver, void *pvUser);
+void NetRxCoalesceTerm(PNETRXCOALESCE pThis);
+bool NetRxCoalesceAdd(PNETRXCOALESCE pThis, const void *pvFrame, size_t cbFrame);
+int  NetRxCoalesceFlush(PNETRXCOALESCE pThis);
+void NetRxCoalesceDiscard(PNETRXCOALESCE pThis);
+
+RT_C_DECLS_END
+
+#endif
@@ -1,6 +1,6 @@
 /* $Id: Pcap.cpp 38549 2011-08-26 13:26:07Z vboxsync $ */
 /** @file
- * Helpers for writing libpcap files.
+ * Helpers for writing libpcap and pcapng files.
  */
 
 /*
@@ -20,7 +20,9 @@
 *******************************************************************************/
 #include "Pcap.h"
 
+#include <iprt/assert.h>
 #include <iprt/file.h>
+#include <iprt/string.h>
 #include <iprt/stream.h>
 #include <iprt/time.h>
 #include <iprt/err.h>
@@ -60,6 +62,72 @@ struct pcaprec_hdr_init
     struct pcap_hdr     pcap;
 };
 
+/* pcapng block types. */
+#define PCAPNG_BT_SHB               UINT32_C(0x0a0d0d0a)
+#define PCAPNG_BT_IDB               UINT32_C(0x00000001)
+#define PCAPNG_BT_ISB               UINT32_C(0x00000005)
+#define PCAPNG_BT_EPB               UINT32_C(0x00000006)
+/* pcapng byte order magic. */
+#define PCAPNG_BYTE_ORDER_MAGIC     UINT32_C(0x1a2b3c4d)
+/* pcapng option codes. */
+#define PCAPNG_OPT_ENDOFOPT         0
+#define PCAPNG_OPT_IF_NAME          2
+#define PCAPNG_OPT_IF_TSRESOL       9
+#define PCAPNG_OPT_EPB_FLAGS        2
+#define PCAPNG_OPT_ISB_IFDROP       5
+/* pcapng link type for ethernet. */
+#define PCAPNG_LINKTYPE_ETHERNET    1
+
+/* pcapng section header block (minus the trailing length). */
+struct pcapng_shb
+{
+    uint32_t    block_type;     /* PCAPNG_BT_SHB */
+    uint32_t    block_total_length;
+    uint32_t    byte_order_magic; /* PCAPNG_BYTE_ORDER_MAGIC */
+    uint16_t    major_version;  /* = 1 */
+    uint16_t    minor_version;  /* = 0 */
+    int64_t     section_length; /* = -1, not specified */
+};
+
+/* pcapng interface description block (minus options and trailing length). */
+struct pcapng_idb
+{
+    uint32_t    block_type;     /* PCAPNG_BT_IDB */
+    uint32_t    block_total_length;
+    uint16_t    linktype;       /* PCAPNG_LINKTYPE_ETHERNET */
+    uint16_t    reserved;
+    uint32_t    snaplen;
+};
+
+/* pcapng enhanced packet block (minus data, options and trailing length). */
+struct pcapng_epb
+{
+    uint32_t    block_type;     /* PCAPNG_BT_EPB */
+    uint32_t    block_total_length;
+    uint32_t    interface_id;   /* = 0 */
+    uint32_t    ts_high;        /* timestamp in if_tsresol units, high part */
+    uint32_t    ts_low;         /* timestamp in if_tsresol units, low part */
+    uint32_t    cap_len;        /* number of octets of packet saved in file */
+    uint32_t    orig_len;       /* actual length of packet */
+};
+
+/* pcapng interface statistics block (minus options and trailing length). */
+struct pcapng_isb
+{
+    uint32_t    block_type;     /* PCAPNG_BT_ISB */
+    uint32_t    block_total_length;
+    uint32_t    interface_id;   /* = 0 */
+    uint32_t    ts_high;
+    uint32_t    ts_low;
+};
+
+/* pcapng option header. */
+struct pcapng_opt
+{
+    uint16_t    code;
+    uint16_t    length;         /* excluding padding */
+};
+
 
 /*******************************************************************************
 *   Global Variables                                                           *
@@ -254,3 +322,227 @@ int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
     return VINF_SUCCESS;
 }
 
+
+/**
+ * Internal helper for appending a pcapng option to a block being assembled.
+ *
+ * @returns Pointer to the byte following the padded option.
+ * @param   pb              Where to put the option.
+ * @param   uCode           The option code.
+ * @param   pvValue         The option value.
+ * @param   cbValue         The size of the value.
+ */
+static uint8_t *pcapNgPutOption(uint8_t *pb, uint16_t uCode, const void *pvValue, uint16_t cbValue)
+{
+    struct pcapng_opt Opt;
+    Opt.code   = uCode;
+    Opt.length = cbValue;
+    memcpy(pb, &Opt, sizeof(Opt));
+    pb += sizeof(Opt);
+    if (cbValue)
+    {
+        memcpy(pb, pvValue, cbValue);
+        memset(pb + cbValue, 0, RT_ALIGN_32(cbValue, 4) - cbValue);
+        pb += RT_ALIGN_32(cbValue, 4);
+    }
+    return pb;
+}
+
+
+/**
+ * Writes the pcapng section header and the interface description blocks.
+ *
+ * Timestamps are written with nanosecond resolution (if_tsresol=9), so the
+ * u64TimeNs arguments of the other PcapNg writers are nanoseconds since
+ * 1970-01-01 00:00 UTC.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   cbSnapLen       The max number of bytes included for each frame.
+ * @param   pszIfName       The interface name to record, optional.
+ * @param   pcbWritten      Where to add the number of bytes written, optional.
+ */
+int PcapNgFileHdr(RTFILE File, uint32_t cbSnapLen, const char *pszIfName, uint64_t *pcbWritten)
+{
+    uint8_t     abBuf[sizeof(struct pcapng_shb) + 4 + sizeof(struct pcapng_idb) + 4 + 128 + 8 + 4 + 4];
+    uint8_t    *pb = abBuf;
+
+    struct pcapng_shb Shb;
+    Shb.block_type          = PCAPNG_BT_SHB;
+    Shb.block_total_length  = sizeof(Shb) + 4;
+    Shb.byte_order_magic    = PCAPNG_BYTE_ORDER_MAGIC;
+    Shb.major_version       = 1;
+    Shb.minor_version       = 0;
+    Shb.section_length      = -1;
+    memcpy(pb, &Shb, sizeof(Shb));
+    pb += sizeof(Shb);
+    memcpy(pb, &Shb.block_total_length, 4);
+    pb += 4;
+
+    uint8_t * const pbIdb = pb;
+    struct pcapng_idb Idb;
+    Idb.block_type          = PCAPNG_BT_IDB;
+    Idb.block_total_length  = 0;
+    Idb.linktype            = PCAPNG_LINKTYPE_ETHERNET;
+    Idb.reserved            = 0;
+    Idb.snaplen             = cbSnapLen;
+    pb += sizeof(Idb);
+    if (pszIfName && *pszIfName)
+        pb = pcapNgPutOption(pb, PCAPNG_OPT_IF_NAME, pszIfName, (uint16_t)RTStrNLen(pszIfName, 128));
+    uint8_t const bTsResol = 9;
+    pb = pcapNgPutOption(pb, PCAPNG_OPT_IF_TSRESOL, &bTsResol, sizeof(bTsResol));
+    pb = pcapNgPutOption(pb, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    Idb.block_total_length  = (uint32_t)(pb - pbIdb) + 4;
+    memcpy(pbIdb, &Idb, sizeof(Idb));
+    memcpy(pb, &Idb.block_total_length, 4);
+    pb += 4;
+    Assert((size_t)(pb - abBuf) <= sizeof(abBuf));
+
+    int rc = RTFileWrite(File, abBuf, pb - abBuf, NULL);
+    if (RT_SUCCESS(rc) && pcbWritten)
+        *pcbWritten += pb - abBuf;
+    return rc;
+}
+
+
+/**
+ * Internal helper that writes an enhanced packet block.
+ *
+ * The captured data is given in two parts so the GSO writer can pass the
+ * carved headers and the segment payload without copying them together.
+ */
+static int pcapNgWriteEpb(RTFILE File, uint64_t u64TimeNs, const void *pvPart1, uint32_t cbPart1,
+                          const void *pvPart2, uint32_t cbPart2, size_t cbOrig, uint32_t fFlags, uint64_t *pcbWritten)
+{
+    uint32_t const cbCaptured = cbPart1 + cbPart2;
+
+    struct pcapng_epb Epb;
+    Epb.block_type          = PCAPNG_BT_EPB;
+    Epb.block_total_length  = sizeof(Epb) + RT_ALIGN_32(cbCaptured, 4) + 8 + 4 + 4;
+    Epb.interface_id        = 0;
+    Epb.ts_high             = (uint32_t)(u64TimeNs >> 32);
+    Epb.ts_low              = (uint32_t)u64TimeNs;
+    Epb.cap_len             = cbCaptured;
+    Epb.orig_len            = (uint32_t)cbOrig;
+
+    /* The padding, the options and the trailing length. */
+    uint8_t     abTail[3 + 8 + 4 + 4];
+    uint8_t    *pb = abTail;
+    memset(pb, 0, RT_ALIGN_32(cbCaptured, 4) - cbCaptured);
+    pb += RT_ALIGN_32(cbCaptured, 4) - cbCaptured;
+    if (fFlags)
+        pb = pcapNgPutOption(pb, PCAPNG_OPT_EPB_FLAGS, &fFlags, sizeof(fFlags));
+    else
+        Epb.block_total_length -= 8;
+    pb = pcapNgPutOption(pb, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    memcpy(pb, &Epb.block_total_length, 4);
+    pb += 4;
+
+    int rc = RTFileWrite(File, &Epb, sizeof(Epb), NULL);
+    if (RT_SUCCESS(rc) && cbPart1)
+        rc = RTFileWrite(File, pvPart1, cbPart1, NULL);
+    if (RT_SUCCESS(rc) && cbPart2)
+        rc = RTFileWrite(File, pvPart2, cbPart2, NULL);
+    if (RT_SUCCESS(rc))
+        rc = RTFileWrite(File, abTail, pb - abTail, NULL);
+    if (RT_SUCCESS(rc) && pcbWritten)
+        *pcbWritten += Epb.block_total_length;
+    return rc;
+}
+
+
+/**
+ * Writes a frame to a pcapng file.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   u64TimeNs       The frame timestamp, nanoseconds since the epoch.
+ * @param   pvFrame         The start of the frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   cbMax           The max number of bytes to include in the file.
+ * @param   fFlags          PCAPNG_EPB_FLAGS_XXX, 0 if unknown.
+ * @param   pcbWritten      Where to add the number of bytes written, optional.
+ */
+int PcapNgFileFrame(RTFILE File, uint64_t u64TimeNs, const void *pvFrame, size_t cbFrame, size_t cbMax,
+                    uint32_t fFlags, uint64_t *pcbWritten)
+{
+    return pcapNgWriteEpb(File, u64TimeNs, pvFrame, (uint32_t)RT_MIN(cbFrame, cbMax), NULL, 0, cbFrame, fFlags, pcbWritten);
+}
+
+
+/**
+ * Writes a GSO frame to a pcapng file, one block per segment.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   u64TimeNs       The frame timestamp, nanoseconds since the epoch.
+ * @param   pGso            Pointer to the GSO context.
+ * @param   pvFrame         The start of the GSO frame.
+ * @param   cbFrame         The size of the GSO frame.
+ * @param   cbSegMax        The max number of bytes to include in the file for
+ *                          each segment.
+ * @param   fFlags          PCAPNG_EPB_FLAGS_XXX, 0 if unknown.
+ * @param   pcbWritten      Where to add the number of bytes written, optional.
+ */
+int PcapNgFileGsoFrame(RTFILE File, uint64_t u64TimeNs, PCPDMNETWORKGSO pGso, const void *pvFrame, size_t cbFrame,
+                       size_t cbSegMax, uint32_t fFlags, uint64_t *pcbWritten)
+{
+    uint8_t const  *pbFrame = (uint8_t const *)pvFrame;
+    uint8_t         abHdrs[256];
+    uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, cbFrame);
+    for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+    {
+        uint32_t cbSegPayload, cbHdrs;
+        uint32_t offSegPayload = PDMNetGsoCarveSegment(pGso, pbFrame, cbFrame, iSeg, cSegs, abHdrs, &cbHdrs, &cbSegPayload);
+
+        uint32_t const cbIncl = (uint32_t)RT_MIN(cbHdrs + cbSegPayload, cbSegMax);
+        uint32_t const cbInclHdrs = RT_MIN(cbIncl, cbHdrs);
+        int rc = pcapNgWriteEpb(File, u64TimeNs, abHdrs, cbInclHdrs, pbFrame + offSegPayload, cbIncl - cbInclHdrs,
+                                cbHdrs + cbSegPayload, fFlags, pcbWritten);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Writes an interface statistics block to a pcapng file.
+ *
+ * @returns IPRT status code, @see RTFileWrite.
+ *
+ * @param   File            The file handle.
+ * @param   u64TimeNs       The timestamp, nanoseconds since the epoch.
+ * @param   cDropped        The number of frames the capture dropped since the
+ *                          section header was written.
+ * @param   pcbWritten      Where to add the number of bytes written, optional.
+ */
+int PcapNgFileStats(RTFILE File, uint64_t u64TimeNs, uint64_t cDropped, uint64_t *pcbWritten)
+{
+    uint8_t     abBuf[sizeof(struct pcapng_isb) + 4 + 8 + 4 + 4];
+    uint8_t    *pb = abBuf;
+
+    struct pcapng_isb Isb;
+    Isb.block_type          = PCAPNG_BT_ISB;
+    Isb.block_total_length  = sizeof(abBuf);
+    Isb.interface_id        = 0;
+    Isb.ts_high             = (uint32_t)(u64TimeNs >> 32);
+    Isb.ts_low              = (uint32_t)u64TimeNs;
+    memcpy(pb, &Isb, sizeof(Isb));
+    pb += sizeof(Isb);
+    pb = pcapNgPutOption(pb, PCAPNG_OPT_ISB_IFDROP, &cDropped, sizeof(cDropped));
+    pb = pcapNgPutOption(pb, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+    memcpy(pb, &Isb.block_total_length, 4);
+    pb += 4;
+    Assert((size_t)(pb - abBuf) == sizeof(abBuf));
+
+    int rc = RTFileWrite(File, abBuf, sizeof(abBuf), NULL);
+    if (RT_SUCCESS(rc) && pcbWritten)
+        *pcbWritten += sizeof(abBuf);
+    return rc;
+}
+
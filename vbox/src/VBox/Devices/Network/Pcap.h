@@ -1,6 +1,6 @@
 /* $Id: Pcap.h 44528 2013-02-04 14:27:54Z vboxsync $ */
 /** @file
- * Helpers for writing libpcap files.
+ * Helpers for writing libpcap and pcapng files.
  */
 
 /*
@@ -23,6 +23,14 @@
 
 RT_C_DECLS_BEGIN
 
+/** @name pcapng enhanced packet block flags (epb_flags).
+ * @{ */
+/** The frame was received by the guest. */
+#define PCAPNG_EPB_FLAGS_INBOUND    UINT32_C(0x00000001)
+/** The frame was sent by the guest. */
+#define PCAPNG_EPB_FLAGS_OUTBOUND   UINT32_C(0x00000002)
+/** @} */
+
 int PcapStreamHdr(PRTSTREAM pStream, uint64_t StartNanoTS);
 int PcapStreamFrame(PRTSTREAM pStream, uint64_t StartNanoTS, const void *pvFrame, size_t cbFrame, size_t cbMax);
 int PcapStreamGsoFrame(PRTSTREAM pStream, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
@@ -33,6 +41,13 @@ int PcapFileFrame(RTFILE File, uint64_t StartNanoTS, const void *pvFrame, size_t
 int PcapFileGsoFrame(RTFILE File, uint64_t StartNanoTS, PCPDMNETWORKGSO pGso,
                      const void *pvFrame, size_t cbFrame, size_t cbSegMax);
 
+int PcapNgFileHdr(RTFILE File, uint32_t cbSnapLen, const char *pszIfName, uint64_t *pcbWritten);
+int PcapNgFileFrame(RTFILE File, uint64_t u64TimeNs, const void *pvFrame, size_t cbFrame, size_t cbMax,
+                    uint32_t fFlags, uint64_t *pcbWritten);
+int PcapNgFileGsoFrame(RTFILE File, uint64_t u64TimeNs, PCPDMNETWORKGSO pGso, const void *pvFrame, size_t cbFrame,
+                       size_t cbSegMax, uint32_t fFlags, uint64_t *pcbWritten);
+int PcapNgFileStats(RTFILE File, uint64_t u64TimeNs, uint64_t cDropped, uint64_t *pcbWritten);
+
 RT_C_DECLS_END
 
 #endif
@@ -57,6 +57,12 @@
 # define INTNET_GROW_DSTTAB_SIZE    1
 #endif
 
+/** The minimum number of MAC address hash slots per MAC table entry.
+ * This keeps the load factor at or below 1/2. */
+#define INTNET_MAC_HASH_SLOTS_PER_IF 2
+/** The number of network layer address hash slots per MAC table entry. */
+#define INTNET_L3_HASH_SLOTS_PER_IF  8
+
 /** The wakeup bit in the INTNETIF::cBusy and INTNETRUNKIF::cBusy counters. */
 #define INTNET_BUSY_WAKEUP_MASK     RT_BIT_32(30)
 
@@ -86,6 +92,19 @@ typedef struct INTNETMACTABENTRY
 /** Pointer to a MAC address lookup table entry. */
 typedef INTNETMACTABENTRY *PINTNETMACTABENTRY;
 
+/**
+ * Network layer address hash table slot.
+ */
+typedef struct INTNETL3HASHSLOT
+{
+    /** The interface having the address in its cache, NULL if free. */
+    struct INTNETIF        *pIf;
+    /** The hash of the address and address type. */
+    uint32_t                uHash;
+} INTNETL3HASHSLOT;
+/** Pointer to a network layer address hash table slot. */
+typedef INTNETL3HASHSLOT *PINTNETL3HASHSLOT;
+
 /**
  * MAC address lookup table.
  *
@@ -127,6 +146,35 @@ typedef struct INTNETMACTAB
 
     /** Pointer to the trunk interface. */
     struct INTNETTRUNKIF   *pTrunk;
+
+    /** MAC address hash for unicast switching, open addressing with linear
+     * probing.  Each slot holds a paEntries index plus one, zero if free.
+     * Entries with a dummy MAC address are not hashed but counted in
+     * cDummyMacEntries.
+     *
+     * @remarks The hashes are rebuilt and read while owning
+     *          INTNETNETWORK::hAddrSpinlock, like the rest of the table.
+     *          Lock-free readers would need an RCU style grace period before
+     *          interfaces removed from the table could be destroyed, since
+     *          the busy references are picked up under the spinlock. */
+    uint16_t               *pau16MacHash;
+    /** The number of slots in pau16MacHash (power of two). */
+    uint32_t                cMacHashSlots;
+    /** The number of entries with a dummy MAC address. */
+    uint32_t                cDummyMacEntries;
+    /** Hash of the addresses in the interface address caches, used for level-3
+     * switching.  Open addressing with linear probing. */
+    PINTNETL3HASHSLOT       paL3Hash;
+    /** The number of slots in paL3Hash (power of two). */
+    uint32_t                cL3HashSlots;
+    /** Set when pau16MacHash must be rebuilt before use, i.e. when entries have
+     * been added, removed or had their MAC address changed. */
+    bool                    fMacHashDirty;
+    /** Set when paL3Hash must be rebuilt before use. */
+    bool                    fL3HashDirty;
+    /** Set if paL3Hash couldn't hold all the cached addresses the last time it
+     * was rebuilt.  Level-3 switching falls back on scanning then. */
+    bool                    fL3HashOverflowed;
 } INTNETMACTAB;
 /** Pointer to a MAC address .  */
 typedef INTNETMACTAB *PINTNETMACTAB;
@@ -1105,6 +1153,8 @@ static void intnetR0IfAddrCacheDeleteIt(PINTNETIF pIf, PINTNETADDRCACHE pCache,
         memmove(pCache->pbEntries +      iEntry  * pCache->cbEntry,
                 pCache->pbEntries + (iEntry + 1) * pCache->cbEntry,
                 (pCache->cEntries - iEntry)      * pCache->cbEntry);
+    if (pIf->pNetwork)
+        pIf->pNetwork->MacTab.fL3HashDirty = true;
 }
 
 
@@ -1282,6 +1332,7 @@ static void intnetR0IfAddrCacheAddIt(PINTNETIF pIf, PINTNETADDRCACHE pCache, PCR
 #endif
     pCache->cEntries++;
     Assert(pCache->cEntries <= pCache->cEntriesAlloc);
+    pNetwork->MacTab.fL3HashDirty = true;
 
     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
 }
@@ -1438,6 +1489,219 @@ DECL_FORCE_INLINE(bool) intnetR0AreMacAddrsEqual(PCRTMAC pDstAddr1, PCRTMAC pDst
 }
 
 
+/**
+ * Calculates the number of slots for a switching hash table.
+ *
+ * @returns Power of two slot count.
+ * @param   cEntriesAllocated   The number of MAC table entries allocated.
+ * @param   cSlotsPerIf         The minimum number of slots per entry.
+ */
+static uint32_t intnetR0HashCalcSlots(uint32_t cEntriesAllocated, uint32_t cSlotsPerIf)
+{
+    uint32_t cSlots = 16;
+    while (cSlots < cEntriesAllocated * cSlotsPerIf)
+        cSlots <<= 1;
+    return cSlots;
+}
+
+
+/**
+ * Hashes a MAC address.
+ *
+ * @returns Hash value, use the low bits.
+ * @param   pMacAddr            The MAC address.
+ */
+DECL_FORCE_INLINE(uint32_t) intnetR0MacAddrHash(PCRTMAC pMacAddr)
+{
+    /* The first three bytes are the OUI and thus rather uniform. */
+    uint32_t uHash = RT_MAKE_U32(pMacAddr->au16[2], pMacAddr->au16[1]) ^ pMacAddr->au16[0];
+    uHash *= UINT32_C(0x9e3779b1);
+    return uHash ^ (uHash >> 16);
+}
+
+
+/**
+ * Hashes a network layer address.
+ *
+ * @returns Hash value, use the low bits.
+ * @param   enmType             The address type.
+ * @param   pAddr               The address.
+ * @param   cbAddr              The address size.
+ */
+DECL_FORCE_INLINE(uint32_t) intnetR0AddrHash(INTNETADDRTYPE enmType, PCRTNETADDRU pAddr, uint8_t const cbAddr)
+{
+    uint32_t uHash;
+    switch (cbAddr)
+    {
+        case 4:
+            uHash = pAddr->au32[0];
+            break;
+        case 16:
+            uHash = pAddr->au32[0] ^ pAddr->au32[1] ^ pAddr->au32[2] ^ pAddr->au32[3];
+            break;
+        default:
+            uHash = 0;
+            for (uint8_t off = 0; off < cbAddr; off++)
+                uHash = (uHash << 5) ^ (uHash >> 27) ^ pAddr->au8[off];
+            break;
+    }
+    uHash = (uHash ^ (uint32_t)enmType) * UINT32_C(0x9e3779b1);
+    return uHash ^ (uHash >> 16);
+}
+
+
+/**
+ * Rebuilds the MAC address hash of the switching table.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pTab                The MAC table.
+ */
+static void intnetR0MacTabRebuildMacHash(PINTNETMACTAB pTab)
+{
+    uint32_t const fMask = pTab->cMacHashSlots - 1;
+    Assert(pTab->cEntries * 2 <= pTab->cMacHashSlots);
+    RT_BZERO(pTab->pau16MacHash, pTab->cMacHashSlots * sizeof(pTab->pau16MacHash[0]));
+    pTab->cDummyMacEntries = 0;
+
+    for (uint32_t iEntry = 0; iEntry < pTab->cEntries; iEntry++)
+    {
+        PCRTMAC pMacAddr = &pTab->paEntries[iEntry].MacAddr;
+        if (intnetR0IsMacAddrDummy(pMacAddr))
+            pTab->cDummyMacEntries++;
+        else
+        {
+            uint32_t iSlot = intnetR0MacAddrHash(pMacAddr) & fMask;
+            while (pTab->pau16MacHash[iSlot])
+                iSlot = (iSlot + 1) & fMask;
+            pTab->pau16MacHash[iSlot] = (uint16_t)(iEntry + 1);
+        }
+    }
+    pTab->fMacHashDirty = false;
+}
+
+
+/**
+ * Checks whether unicast frames can be switched using the MAC address hash.
+ *
+ * This is the case when no interface is promiscuous and all interface MAC
+ * addresses are known, as the other interfaces would otherwise have to see the
+ * frame as well.  The caller must own the network spinlock.
+ *
+ * @returns true if the hash can be used, false if the table must be scanned.
+ * @param   pTab                The MAC table.
+ */
+DECLINLINE(bool) intnetR0MacTabCanUseMacHash(PINTNETMACTAB pTab)
+{
+    if (RT_UNLIKELY(pTab->fMacHashDirty))
+        intnetR0MacTabRebuildMacHash(pTab);
+    return pTab->cPromiscuousEntries == 0
+        && pTab->cDummyMacEntries    == 0;
+}
+
+
+/**
+ * Checks if an active interface has the given MAC address using the hash.
+ *
+ * The caller must own the network spinlock and have checked
+ * intnetR0MacTabCanUseMacHash.
+ *
+ * @returns true if found, false if not.
+ * @param   pTab                The MAC table.
+ * @param   pMacAddr            The MAC address.
+ */
+static bool intnetR0MacTabHashHasActive(PINTNETMACTAB pTab, PCRTMAC pMacAddr)
+{
+    uint32_t const fMask = pTab->cMacHashSlots - 1;
+    uint32_t       iSlot = intnetR0MacAddrHash(pMacAddr) & fMask;
+    uint16_t       iEntryPlusOne;
+    while ((iEntryPlusOne = pTab->pau16MacHash[iSlot]) != 0)
+    {
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[iEntryPlusOne - 1];
+        if (   pEntry->fActive
+            && intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pMacAddr))
+            return true;
+        iSlot = (iSlot + 1) & fMask;
+    }
+    return false;
+}
+
+
+/**
+ * Rebuilds the network layer address hash of the switching table.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @param   pTab                The MAC table.
+ */
+static void intnetR0MacTabRebuildL3Hash(PINTNETMACTAB pTab)
+{
+    uint32_t const fMask     = pTab->cL3HashSlots - 1;
+    uint32_t       cLeft     = pTab->cL3HashSlots / 2;
+    RT_BZERO(pTab->paL3Hash, pTab->cL3HashSlots * sizeof(pTab->paL3Hash[0]));
+    pTab->fL3HashOverflowed = false;
+
+    for (uint32_t iEntry = 0; iEntry < pTab->cEntries && !pTab->fL3HashOverflowed; iEntry++)
+    {
+        PINTNETIF pIf = pTab->paEntries[iEntry].pIf;
+        for (int enmType = kIntNetAddrType_IPv4; enmType < kIntNetAddrType_End; enmType++)
+        {
+            PCINTNETADDRCACHE pCache = &pIf->aAddrCache[enmType];
+            for (uint8_t iAddr = 0; iAddr < pCache->cEntries; iAddr++)
+            {
+                if (!cLeft--)
+                {
+                    pTab->fL3HashOverflowed = true;
+                    break;
+                }
+                uint32_t const uHash = intnetR0AddrHash((INTNETADDRTYPE)enmType,
+                                                        (PCRTNETADDRU)(pCache->pbEntries + iAddr * pCache->cbEntry),
+                                                        pCache->cbAddress);
+                uint32_t iSlot = uHash & fMask;
+                while (pTab->paL3Hash[iSlot].pIf)
+                    iSlot = (iSlot + 1) & fMask;
+                pTab->paL3Hash[iSlot].pIf   = pIf;
+                pTab->paL3Hash[iSlot].uHash = uHash;
+            }
+        }
+    }
+    pTab->fL3HashDirty = false;
+}
+
+
+/**
+ * Checks whether level-3 switching can be done using the address hash.
+ *
+ * The caller must own the network spinlock.
+ *
+ * @returns true if the hash can be used, false if the table must be scanned.
+ * @param   pTab                The MAC table.
+ */
+DECLINLINE(bool) intnetR0MacTabCanUseL3Hash(PINTNETMACTAB pTab)
+{
+    if (RT_UNLIKELY(pTab->fL3HashDirty))
+        intnetR0MacTabRebuildL3Hash(pTab);
+    return pTab->cPromiscuousEntries == 0
+        && !pTab->fL3HashOverflowed;
+}
+
+
+/**
+ * Frees the switching hash tables.
+ *
+ * @param   pTab                The MAC table.
+ */
+static void intnetR0MacTabFreeHashes(PINTNETMACTAB pTab)
+{
+    RTMemFree(pTab->pau16MacHash);
+    pTab->pau16MacHash  = NULL;
+    pTab->cMacHashSlots = 0;
+    RTMemFree(pTab->paL3Hash);
+    pTab->paL3Hash      = NULL;
+    pTab->cL3HashSlots  = 0;
+}
+
+
 /**
  * Switch a unicast frame based on the network layer address (OSI level 3) and
  * return a destination table.
@@ -1470,24 +1734,59 @@ static INTNETSWDECISION intnetR0NetworkSwitchLevel3(PINTNETNETWORK pNetwork, PCR
 
     /* Find exactly matching or promiscuous interfaces. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
+    uint32_t iIfMac;
+    if (intnetR0MacTabCanUseL3Hash(pTab))
     {
-        if (pTab->paEntries[iIfMac].fActive)
+        /* No promiscuous interfaces, only those having the address cached. */
+        uint32_t const uHash = intnetR0AddrHash(enmL3AddrType, pL3Addr, cbL3Addr);
+        uint32_t const fMask = pTab->cL3HashSlots - 1;
+        for (uint32_t iSlot = uHash & fMask; pTab->paL3Hash[iSlot].pIf; iSlot = (iSlot + 1) & fMask)
         {
-            PINTNETIF pIf    = pTab->paEntries[iIfMac].pIf;         AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
-            bool      fExact = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmL3AddrType], pL3Addr, cbL3Addr) >= 0;
-            if (fExact || pTab->paEntries[iIfMac].fPromiscuousSeeTrunk)
+            PINTNETIF pIf = pTab->paL3Hash[iSlot].pIf;              AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+            if (   pTab->paL3Hash[iSlot].uHash == uHash
+                && pIf->fActive
+                && intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmL3AddrType], pL3Addr, cbL3Addr) >= 0)
             {
-                cExactHits += fExact;
+                /* The same interface may be hit twice on a full hash collision. */
+                uint32_t iIfDst = pDstTab->cIfs;
+                while (iIfDst-- > 0)
+                    if (pDstTab->aIfs[iIfDst].pIf == pIf)
+                        break;
+                if (iIfDst == UINT32_MAX)
+                {
+                    cExactHits++;
 
-                uint32_t iIfDst = pDstTab->cIfs++;
-                pDstTab->aIfs[iIfDst].pIf            = pIf;
-                pDstTab->aIfs[iIfDst].fReplaceDstMac = fExact;
-                intnetR0BusyIncIf(pIf);
+                    iIfDst = pDstTab->cIfs++;
+                    pDstTab->aIfs[iIfDst].pIf            = pIf;
+                    pDstTab->aIfs[iIfDst].fReplaceDstMac = true;
+                    intnetR0BusyIncIf(pIf);
 
-                if (fExact)
                     pDstMacAddr = &pIf->MacAddr; /* Avoids duplicates being sent to the host. */
+                }
+            }
+        }
+    }
+    else
+    {
+        iIfMac = pTab->cEntries;
+        while (iIfMac-- > 0)
+        {
+            if (pTab->paEntries[iIfMac].fActive)
+            {
+                PINTNETIF pIf    = pTab->paEntries[iIfMac].pIf;     AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                bool      fExact = intnetR0IfAddrCacheLookup(&pIf->aAddrCache[enmL3AddrType], pL3Addr, cbL3Addr) >= 0;
+                if (fExact || pTab->paEntries[iIfMac].fPromiscuousSeeTrunk)
+                {
+                    cExactHits += fExact;
+
+                    uint32_t iIfDst = pDstTab->cIfs++;
+                    pDstTab->aIfs[iIfDst].pIf            = pIf;
+                    pDstTab->aIfs[iIfDst].fReplaceDstMac = fExact;
+                    intnetR0BusyIncIf(pIf);
+
+                    if (fExact)
+                        pDstMacAddr = &pIf->MacAddr; /* Avoids duplicates being sent to the host. */
+                }
             }
         }
     }
@@ -1570,6 +1869,19 @@ static INTNETSWDECISION intnetR0NetworkPreSwitchUnicast(PINTNETNETWORK pNetwork,
     PINTNETMACTAB       pTab            = &pNetwork->MacTab;
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
+    if (intnetR0MacTabCanUseMacHash(pTab))
+    {
+        /* No promiscuous interfaces or unknown addresses, so only exact
+           matches matter.  (Paranoia: Source match means broadcast.) */
+        if (   (!pSrcAddr || !intnetR0MacTabHashHasActive(pTab, pSrcAddr))
+            && intnetR0MacTabHashHasActive(pTab, pDstAddr))
+            enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
+                          ? INTNETSWDECISION_BROADCAST
+                          : INTNETSWDECISION_INTNET;
+        RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
+        return enmSwDecision;
+    }
+
     /* Iterate the internal network interfaces and look for matching source and
        destination addresses. */
     uint32_t iIfMac = pTab->cEntries;
@@ -1636,21 +1948,22 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
 
     /* Find exactly matching or promiscuous interfaces. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
-    {
-        if (pTab->paEntries[iIfMac].fActive)
+    uint32_t iIfMac;
+    if (intnetR0MacTabCanUseMacHash(pTab))
+    {
+        /* No promiscuous interfaces or unknown addresses, so exact matches only. */
+        uint32_t const fMask = pTab->cMacHashSlots - 1;
+        uint32_t       iSlot = intnetR0MacAddrHash(pDstAddr) & fMask;
+        uint16_t       iEntryPlusOne;
+        while ((iEntryPlusOne = pTab->pau16MacHash[iSlot]) != 0)
         {
-            bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
-            if (   fExact
-                || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
-                || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                    || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
-               )
+            PINTNETMACTABENTRY pEntry = &pTab->paEntries[iEntryPlusOne - 1];
+            if (   pEntry->fActive
+                && intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pDstAddr))
             {
-                cExactHits += fExact;
+                cExactHits++;
 
-                PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                PINTNETIF pIf = pEntry->pIf;                        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
                 if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
                 {
                     uint32_t iIfDst = pDstTab->cIfs++;
@@ -1659,7 +1972,40 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
                     intnetR0BusyIncIf(pIf);
                 }
             }
+            iSlot = (iSlot + 1) & fMask;
         }
+        if (pIfSender)
+            STAM_REL_COUNTER_INC(&pIfSender->pIntBuf->cStatSwitchHashed);
+    }
+    else
+    {
+        iIfMac = pTab->cEntries;
+        while (iIfMac-- > 0)
+        {
+            if (pTab->paEntries[iIfMac].fActive)
+            {
+                bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
+                if (   fExact
+                    || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
+                    || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
+                        || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
+                   )
+                {
+                    cExactHits += fExact;
+
+                    PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;    AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                    if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
+                    {
+                        uint32_t iIfDst = pDstTab->cIfs++;
+                        pDstTab->aIfs[iIfDst].pIf            = pIf;
+                        pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                        intnetR0BusyIncIf(pIf);
+                    }
+                }
+            }
+        }
+        if (pIfSender)
+            STAM_REL_COUNTER_INC(&pIfSender->pIntBuf->cStatSwitchScanned);
     }
 
     /* Network only promicuous mode ifs should see related trunk traffic. */
@@ -1990,7 +2336,11 @@ static int intnetR0NetworkEnsureTabSpace(PINTNETNETWORK pNetwork)
             if (RT_SUCCESS(rc))
             {
                 PINTNETMACTABENTRY paNew = (PINTNETMACTABENTRY)RTMemAlloc(sizeof(INTNETMACTABENTRY) * cAllocated);
-                if (paNew)
+                uint32_t const     cMacHashSlots = intnetR0HashCalcSlots(cAllocated, INTNET_MAC_HASH_SLOTS_PER_IF);
+                uint16_t          *pau16MacHash  = (uint16_t *)RTMemAllocZ(sizeof(uint16_t) * cMacHashSlots);
+                uint32_t const     cL3HashSlots  = intnetR0HashCalcSlots(cAllocated, INTNET_L3_HASH_SLOTS_PER_IF);
+                PINTNETL3HASHSLOT  paL3Hash      = (PINTNETL3HASHSLOT)RTMemAllocZ(sizeof(INTNETL3HASHSLOT) * cL3HashSlots);
+                if (paNew && pau16MacHash && paL3Hash)
                 {
                     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
@@ -2007,12 +2357,28 @@ static int intnetR0NetworkEnsureTabSpace(PINTNETNETWORK pNetwork)
                     pTab->paEntries         = paNew;
                     pTab->cEntriesAllocated = cAllocated;
 
+                    uint16_t         *pau16OldMacHash = pTab->pau16MacHash;
+                    PINTNETL3HASHSLOT paOldL3Hash     = pTab->paL3Hash;
+                    pTab->pau16MacHash      = pau16MacHash;
+                    pTab->cMacHashSlots     = cMacHashSlots;
+                    pTab->paL3Hash          = paL3Hash;
+                    pTab->cL3HashSlots      = cL3HashSlots;
+                    pTab->fMacHashDirty     = true;
+                    pTab->fL3HashDirty      = true;
+
                     RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
 
                     RTMemFree(paOld);
+                    RTMemFree(pau16OldMacHash);
+                    RTMemFree(paOldL3Hash);
                 }
                 else
+                {
+                    RTMemFree(paNew);
+                    RTMemFree(pau16MacHash);
+                    RTMemFree(paL3Hash);
                     rc = VERR_NO_MEMORY;
+                }
             }
         }
         else
@@ -3640,7 +4006,10 @@ static INTNETSWDECISION intnetR0NetworkSend(PINTNETNETWORK pNetwork, PINTNETIF p
 
         PINTNETMACTABENTRY pIfEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIfSender);
         if (pIfEntry)
+        {
             pIfEntry->MacAddr = EthHdr.SrcMac;
+            pNetwork->MacTab.fMacHashDirty = true;
+        }
         pIfSender->MacAddr    = EthHdr.SrcMac;
 
         RTSpinlockReleaseNoInts(pNetwork->hAddrSpinlock);
@@ -4090,6 +4459,7 @@ INTNETR0DECL(int) IntNetR0IfSetMacAddress(INTNETIFHANDLE hIf, PSUPDRVSESSION pSe
             if (RT_LIKELY(pEntry))
                 pEntry->MacAddr = *pMac;
             pIf->MacAddr        = *pMac;
+            pNetwork->MacTab.fMacHashDirty = true;
             pIf->fMacSet        = true;
 
             /* Grab a busy reference to the trunk so we release the lock before notifying it. */
@@ -4582,6 +4952,8 @@ static DECLCALLBACK(void) intnetR0IfDestruct(void *pvObj, void *pvUser1, void *p
                             &pNetwork->MacTab.paEntries[iIf + 1],
                             (pNetwork->MacTab.cEntries - iIf - 1) * sizeof(pNetwork->MacTab.paEntries[0]));
                 pNetwork->MacTab.cEntries--;
+                pNetwork->MacTab.fMacHashDirty = true;
+                pNetwork->MacTab.fL3HashDirty  = true;
                 break;
             }
 
@@ -4818,6 +5190,8 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
                     pNetwork->MacTab.paEntries[iIf].pIf                  = pIf;
 
                     pNetwork->MacTab.cEntries = iIf + 1;
+                    pNetwork->MacTab.fMacHashDirty = true;
+                    pNetwork->MacTab.fL3HashDirty  = true;
                     pIf->pNetwork = pNetwork;
 
                     /*
@@ -5490,6 +5864,8 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
         {
             pIf->pNetwork = NULL;
             pNetwork->MacTab.cEntries--;
+            pNetwork->MacTab.fMacHashDirty = true;
+            pNetwork->MacTab.fL3HashDirty  = true;
         }
     }
 
@@ -5532,6 +5908,7 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
     pNetwork->hAddrSpinlock = NIL_RTSPINLOCK;
     RTMemFree(pNetwork->MacTab.paEntries);
     pNetwork->MacTab.paEntries = NULL;
+    intnetR0MacTabFreeHashes(&pNetwork->MacTab);
     RTMemFree(pNetwork);
 
     /* Release the create/destroy sem. */
@@ -5875,6 +6252,10 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     //pNetwork->MacTab.cPromiscuousEntries  = 0;
     //pNetwork->MacTab.cPromiscuousNoTrunkEntries = 0;
     pNetwork->MacTab.paEntries              = NULL;
+    //pNetwork->MacTab.pau16MacHash         = NULL;
+    //pNetwork->MacTab.paL3Hash             = NULL;
+    pNetwork->MacTab.fMacHashDirty          = true;
+    pNetwork->MacTab.fL3HashDirty           = true;
     pNetwork->MacTab.fHostPromiscuousReal   = false;
     pNetwork->MacTab.fHostPromiscuousEff    = false;
     pNetwork->MacTab.fHostActive            = false;
@@ -5909,7 +6290,13 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     if (RT_SUCCESS(rc))
     {
         pNetwork->MacTab.paEntries = (PINTNETMACTABENTRY)RTMemAlloc(sizeof(INTNETMACTABENTRY) * pNetwork->MacTab.cEntriesAllocated);
-        if (!pNetwork->MacTab.paEntries)
+        pNetwork->MacTab.cMacHashSlots = intnetR0HashCalcSlots(pNetwork->MacTab.cEntriesAllocated, INTNET_MAC_HASH_SLOTS_PER_IF);
+        pNetwork->MacTab.pau16MacHash  = (uint16_t *)RTMemAllocZ(sizeof(uint16_t) * pNetwork->MacTab.cMacHashSlots);
+        pNetwork->MacTab.cL3HashSlots  = intnetR0HashCalcSlots(pNetwork->MacTab.cEntriesAllocated, INTNET_L3_HASH_SLOTS_PER_IF);
+        pNetwork->MacTab.paL3Hash      = (PINTNETL3HASHSLOT)RTMemAllocZ(sizeof(INTNETL3HASHSLOT) * pNetwork->MacTab.cL3HashSlots);
+        if (   !pNetwork->MacTab.paEntries
+            || !pNetwork->MacTab.pau16MacHash
+            || !pNetwork->MacTab.paL3Hash)
             rc = VERR_NO_MEMORY;
     }
     if (RT_SUCCESS(rc))
@@ -5959,6 +6346,7 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     pNetwork->hAddrSpinlock = NIL_RTSPINLOCK;
     RTMemFree(pNetwork->MacTab.paEntries);
     pNetwork->MacTab.paEntries = NULL;
+    intnetR0MacTabFreeHashes(&pNetwork->MacTab);
     RTMemFree(pNetwork);
 
     LogFlow(("intnetR0CreateNetwork: returns %Rrc\n", rc));
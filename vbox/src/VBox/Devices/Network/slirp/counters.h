@@ -70,6 +70,8 @@ COUNTING_COUNTER(TCP, "TCP sockets");
 COUNTING_COUNTER(TCPHot, "TCP sockets active");
 COUNTING_COUNTER(UDP, "UDP sockets");
 COUNTING_COUNTER(UDPHot, "UDP sockets active");
+COUNTING_COUNTER(EpollCtl, "epoll interest set updates");
+COUNTING_COUNTER(EpollReady, "Sockets reported ready by epoll");
 
 COUNTING_COUNTER(IORead_in_1, "SB IORead_in_1");
 COUNTING_COUNTER(IORead_in_1_bytes, "SB IORead_in_1_bytes");
@@ -119,6 +121,8 @@ DRV_PROFILE_COUNTER(NATRecvWait,"Time spent in NATRecv worker in waiting of free
 DRV_COUNTING_COUNTER(QueuePktSent, "counting packet sent via PDM Queue");
 DRV_COUNTING_COUNTER(QueuePktDropped, "counting packet drops by PDM Queue");
 DRV_COUNTING_COUNTER(ConsumerFalse, "counting consumer's reject number to process the queue's item");
+DRV_COUNTING_COUNTER(ShardPktSent, "counting frames handed to the secondary NAT shards");
+DRV_COUNTING_COUNTER(SendBatches, "counting frame batches sent thru pfnSendBufs");
 # endif
 #endif /*!COUNTERS_INIT*/
 
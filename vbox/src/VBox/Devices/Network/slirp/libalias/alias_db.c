@@ -837,6 +837,7 @@ GetSocket(struct libalias *la, u_short port_net, struct alias_link *pLnk, int li
         {
             so->so_type = IPPROTO_UDP;
             insque(la->pData, so, &la->udb);
+            SOCKET_EPOLL_TOUCH(la->pData, so);
         }
         else
         {
@@ -61,6 +61,11 @@ void slirp_select_poll(PNATState pData, int fTimeout, int fIcmp);
 void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls);
 void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs);
 #endif /* !RT_OS_WINDOWS */
+#ifdef VBOX_WITH_NAT_EPOLL
+bool slirp_epoll_is_available(PNATState pData);
+int slirp_epoll_fill(PNATState pData);
+void slirp_epoll_poll(PNATState pData);
+#endif
 
 void slirp_input(PNATState pData, struct mbuf *m, size_t cbBuf);
 void slirp_set_ethaddr_and_activate_port_forwarding(PNATState pData, const uint8_t *ethaddr, uint32_t GuestIP);
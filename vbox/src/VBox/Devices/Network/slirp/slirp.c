@@ -318,6 +318,12 @@ int slirp_init(PNATState *ppData, uint32_t u32NetAddr, uint32_t u32Netmask,
      */
     pData->soMaxConn = 10;
 
+#ifdef VBOX_WITH_NAT_EPOLL
+    pData->iEpollFd = -1;
+    LIST_INIT(&pData->EpollDirtyHead);
+    LIST_INIT(&pData->EpollReadyHead);
+#endif
+
 #ifdef RT_OS_WINDOWS
     {
         WSADATA Data;
@@ -394,6 +400,16 @@ int slirp_init(PNATState *ppData, uint32_t u32NetAddr, uint32_t u32Netmask,
 # ifdef RT_OS_DARWIN
     pData->pInSockAddrHomeAddress[0].sin_len = sizeof(struct sockaddr_in);
 # endif
+#endif
+#ifdef VBOX_WITH_NAT_EPOLL
+    /* Sockets created so far are on the dirty list already and get
+     * registered on the first slirp_epoll_fill(). The size is just a hint
+     * and ignored by recent kernels. */
+    pData->iEpollFd = epoll_create(64);
+    if (pData->iEpollFd != -1)
+        fcntl(pData->iEpollFd, F_SETFD, FD_CLOEXEC);
+    else
+        LogRel(("NAT: epoll_create failed (%s), falling back to poll()\n", strerror(errno)));
 #endif
     return VINF_SUCCESS;
 }
@@ -527,6 +543,13 @@ void slirp_term(PNATState pData)
     slirpTftpTerm(pData);
     bootp_dhcp_fini(pData);
     m_fini(pData);
+#ifdef VBOX_WITH_NAT_EPOLL
+    if (pData->iEpollFd != -1)
+    {
+        close(pData->iEpollFd);
+        pData->iEpollFd = -1;
+    }
+#endif
 #ifdef RT_OS_WINDOWS
     WSACleanup();
 #endif
@@ -576,6 +599,48 @@ static void updtime(PNATState pData)
 #endif
 }
 
+/**
+ * Checks whether *_slowtimo needs calling, i.e. if there are IP fragments
+ * in the fragment queue, or there are TCP connections active.
+ */
+static int slirpIsSlowTimerNeeded(PNATState pData)
+{
+    int i;
+    /* XXX:
+     * triggering of fragment expiration should be the same but use new macroses
+     */
+    if (tcb.so_next != &tcb)
+        return 1;
+    for (i = 0; i < IPREASS_NHASH; i++)
+    {
+        if (!TAILQ_EMPTY(&ipq[i]))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Runs the TCP fast and slow timers if they are due.
+ */
+static void slirpCheckTimers(PNATState pData)
+{
+    if (time_fasttimo && ((curtime - time_fasttimo) >= 2))
+    {
+        STAM_PROFILE_START(&pData->StatFastTimer, b);
+        tcp_fasttimo(pData);
+        time_fasttimo = 0;
+        STAM_PROFILE_STOP(&pData->StatFastTimer, b);
+    }
+    if (do_slowtimo && ((curtime - last_slowtimo) >= 499))
+    {
+        STAM_PROFILE_START(&pData->StatSlowTimer, c);
+        ip_slowtimo(pData);
+        tcp_slowtimo(pData);
+        last_slowtimo = curtime;
+        STAM_PROFILE_STOP(&pData->StatSlowTimer, c);
+    }
+}
+
 #ifdef RT_OS_WINDOWS
 void slirp_select_fill(PNATState pData, int *pnfds)
 #else /* RT_OS_WINDOWS */
@@ -590,7 +655,6 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
 #else
     int poll_index = 0;
 #endif
-    int i;
 
     STAM_PROFILE_START(&pData->StatFill, a);
 
@@ -603,25 +667,7 @@ void slirp_select_fill(PNATState pData, int *pnfds, struct pollfd *polls)
     if (!link_up)
         goto done;
 
-    /*
-     * *_slowtimo needs calling if there are IP fragments
-     * in the fragment queue, or there are TCP connections active
-     */
-    /* XXX:
-     * triggering of fragment expiration should be the same but use new macroses
-     */
-    do_slowtimo = (tcb.so_next != &tcb);
-    if (!do_slowtimo)
-    {
-        for (i = 0; i < IPREASS_NHASH; i++)
-        {
-            if (!TAILQ_EMPTY(&ipq[i]))
-            {
-                do_slowtimo = 1;
-                break;
-            }
-        }
-    }
+    do_slowtimo = slirpIsSlowTimerNeeded(pData);
     /* always add the ICMP socket */
 #ifndef RT_OS_WINDOWS
     pData->icmp_socket.so_poll_index = -1;
@@ -867,23 +913,7 @@ void slirp_select_poll(PNATState pData, struct pollfd *polls, int ndfs)
      * See if anything has timed out
      */
     if (link_up)
-    {
-        if (time_fasttimo && ((curtime - time_fasttimo) >= 2))
-        {
-            STAM_PROFILE_START(&pData->StatFastTimer, b);
-            tcp_fasttimo(pData);
-            time_fasttimo = 0;
-            STAM_PROFILE_STOP(&pData->StatFastTimer, b);
-        }
-        if (do_slowtimo && ((curtime - last_slowtimo) >= 499))
-        {
-            STAM_PROFILE_START(&pData->StatSlowTimer, c);
-            ip_slowtimo(pData);
-            tcp_slowtimo(pData);
-            last_slowtimo = curtime;
-            STAM_PROFILE_STOP(&pData->StatSlowTimer, c);
-        }
-    }
+        slirpCheckTimers(pData);
 #if defined(RT_OS_WINDOWS)
     if (fTimeout)
         return; /* only timer update */
@@ -1153,6 +1183,412 @@ done:
     STAM_PROFILE_STOP(&pData->StatPoll, a);
 }
 
+#ifdef VBOX_WITH_NAT_EPOLL
+/*
+ * The epoll backend keeps the interest sets of the sockets registered in the
+ * kernel across iterations of the I/O thread. Instead of walking all sockets,
+ * slirp_epoll_fill() only re-evaluates the sockets on the dirty list, which
+ * are the ones created, touched by the guest (tcp_input/udp_input) or processed
+ * in the last slirp_epoll_poll() (see SOCKET_EPOLL_TOUCH). The events a socket
+ * waits for are the same the poll() path engages in slirp_select_fill().
+ * slirp_epoll_poll() then only processes the sockets reported ready.
+ */
+
+/** Maximum number of events fetched with one epoll_wait() call. Level
+ * triggering reports the remaining ones on the next iteration. */
+# define NAT_EPOLL_EVENTS_MAX   128
+
+/**
+ * Checks whether the epoll backend can be used.
+ *
+ * @returns true if the caller should use slirp_epoll_fill()/slirp_epoll_poll(),
+ *          false if it has to fall back to the poll() interface.
+ * @param   pData       The NAT state.
+ */
+bool slirp_epoll_is_available(PNATState pData)
+{
+    return pData->iEpollFd != -1;
+}
+
+/**
+ * Returns the epoll events the socket should wait for. Mirrors the
+ * predicates used for engaging events in slirp_select_fill().
+ */
+static uint32_t slirpEpollQueryEvents(PNATState pData, struct socket *so)
+{
+    uint32_t fEvents = 0;
+
+    if (so->so_type == IPPROTO_TCP)
+    {
+        /*
+         * See if we need a tcp_fasttimo
+         */
+        if (    time_fasttimo == 0
+            && so->so_tcpcb != NULL
+            && so->so_tcpcb->t_flags & TF_DELACK)
+            time_fasttimo = curtime; /* Flag when we want a fasttimo */
+
+        if (so->so_state & SS_NOFDREF || so->s == -1)
+            return 0;
+        if (so->so_state & SS_FACCEPTCONN)
+            return EPOLLIN;
+        if (so->so_state & SS_ISFCONNECTING)
+            fEvents |= EPOLLOUT;
+        if (CONN_CANFSEND(so) && SBUF_LEN(&so->so_rcv))
+            fEvents |= EPOLLOUT;
+        if (   CONN_CANFRCV(so)
+            && (SBUF_LEN(&so->so_snd) < (SBUF_SIZE(&so->so_snd)/2)))
+            fEvents |= EPOLLIN | EPOLLPRI;
+    }
+    else if (so->so_type == IPPROTO_UDP)
+    {
+#ifdef VBOX_WITH_NAT_UDP_SOCKET_CLONE
+        if (so->so_cloneOf)
+            return 0;
+#endif
+        if (   so->s != -1
+            && (so->so_state & SS_ISFCONNECTED)
+            && so->so_queued <= 4)
+            fEvents |= EPOLLIN;
+    }
+    return fEvents;
+}
+
+/**
+ * Brings the registration of the socket in the epoll set up to date.
+ *
+ * @param   pData       The NAT state.
+ * @param   so          The socket.
+ * @param   fEvents     The events to wait for, 0 to unregister the socket.
+ */
+static void slirpEpollUpdate(PNATState pData, struct socket *so, uint32_t fEvents)
+{
+    struct epoll_event Event;
+    int rc;
+    /* Closing the descriptor drops the registration. */
+    bool fRegistered =    so->so_epoll_events != 0
+                       && so->s != -1
+                       && so->so_epoll_fd == so->s;
+
+    if (!fRegistered)
+        so->so_epoll_events = 0;
+    if (so->so_epoll_events == fEvents)
+        return;
+
+    STAM_COUNTER_INC(&pData->StatEpollCtl);
+    if (!fEvents)
+    {
+        /* Otherwise EPOLLHUP and EPOLLERR would still be reported. */
+        epoll_ctl(pData->iEpollFd, EPOLL_CTL_DEL, so->s, &Event);
+        so->so_epoll_events = 0;
+        return;
+    }
+
+    RT_ZERO(Event);
+    Event.events   = fEvents;
+    Event.data.ptr = so;
+    rc = epoll_ctl(pData->iEpollFd, fRegistered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, so->s, &Event);
+    /* The descriptor was closed and the number reused behind our back
+     * (EPOLL_CTL_MOD) or the socket wasn't unregistered before (ADD). */
+    if (rc < 0 && errno == ENOENT)
+        rc = epoll_ctl(pData->iEpollFd, EPOLL_CTL_ADD, so->s, &Event);
+    else if (rc < 0 && errno == EEXIST)
+        rc = epoll_ctl(pData->iEpollFd, EPOLL_CTL_MOD, so->s, &Event);
+    if (rc < 0)
+    {
+        Log2(("NAT: epoll_ctl for %R[natsock] failed (%s)\n", so, strerror(errno)));
+        so->so_epoll_events = 0;
+        return;
+    }
+    so->so_epoll_events = fEvents;
+    so->so_epoll_fd     = so->s;
+}
+
+/**
+ * Queues the socket for processing in slirp_epoll_poll().
+ */
+static void slirpEpollQueueReady(PNATState pData, struct socket *so, uint32_t fEvents)
+{
+    if (!so->fEpollReady)
+    {
+        so->fEpollReady = 1;
+        so->so_revents  = fEvents;
+        LIST_INSERT_HEAD(&pData->EpollReadyHead, so, so_epoll_ready);
+    }
+    else
+        so->so_revents |= fEvents;
+}
+
+/**
+ * Removes the socket from the epoll set and the lists, called by sofree().
+ */
+void slirpEpollRemoveSocket(PNATState pData, struct socket *so)
+{
+    if (   pData->iEpollFd != -1
+        && so->so_epoll_events
+        && so->s != -1
+        && so->so_epoll_fd == so->s)
+    {
+        /* Usually the descriptor was closed already and this fails. */
+        struct epoll_event Event;
+        epoll_ctl(pData->iEpollFd, EPOLL_CTL_DEL, so->s, &Event);
+    }
+    so->so_epoll_events = 0;
+    if (so->fEpollDirty)
+    {
+        LIST_REMOVE(so, so_epoll_dirty);
+        so->fEpollDirty = 0;
+    }
+    if (so->fEpollReady)
+    {
+        LIST_REMOVE(so, so_epoll_ready);
+        so->fEpollReady = 0;
+    }
+}
+
+/**
+ * Detaches expired UDP sockets, the counterpart of the expiration check in
+ * slirp_select_fill().
+ */
+static void slirpEpollExpireUdp(PNATState pData)
+{
+    struct socket *so, *so_next;
+
+    QSOCKET_FOREACH(so, so_next, udp)
+    /* { */
+        if (so->so_expire && so->so_expire <= curtime)
+        {
+            Log2(("NAT: %R[natsock] expired\n", so));
+            if (so->so_timeout != NULL)
+            {
+                so->so_timeout(pData, so, so->so_timeout_arg);
+                if (   so_next->so_prev != so /* so_timeout freed the socket */
+                    || so->so_timeout)  /* so_timeout just freed so_timeout */
+                  CONTINUE_NO_UNLOCK(udp);
+            }
+            UDP_DETACH(pData, so, so_next);
+            CONTINUE_NO_UNLOCK(udp);
+        }
+        LOOP_LABEL(udp, so, so_next);
+    }
+}
+
+/**
+ * Prepares waiting for socket events, the epoll counterpart of
+ * slirp_select_fill().
+ *
+ * @returns The epoll descriptor the caller should wait on for readability,
+ *          -1 if there is nothing to wait for (link down).
+ * @param   pData       The NAT state.
+ */
+int slirp_epoll_fill(PNATState pData)
+{
+    struct socket *so;
+
+    STAM_PROFILE_START(&pData->StatFill, a);
+
+    do_slowtimo = 0;
+    if (!link_up)
+    {
+        STAM_PROFILE_STOP(&pData->StatFill, a);
+        return -1;
+    }
+    do_slowtimo = slirpIsSlowTimerNeeded(pData);
+
+    /* always add the ICMP socket */
+    if (pData->icmp_socket.s != -1)
+        slirpEpollUpdate(pData, &pData->icmp_socket, EPOLLIN);
+
+    /* The expiration times are in the order of seconds, no need to check
+     * them on every iteration. */
+    if (curtime - pData->uEpollLastUdpExpire >= 500)
+    {
+        slirpEpollExpireUdp(pData);
+        pData->uEpollLastUdpExpire = curtime;
+    }
+
+    while (!LIST_EMPTY(&pData->EpollDirtyHead))
+    {
+        so = LIST_FIRST(&pData->EpollDirtyHead);
+        LIST_REMOVE(so, so_epoll_dirty);
+        so->fEpollDirty = 0;
+
+        slirpEpollUpdate(pData, so, slirpEpollQueryEvents(pData, so));
+
+        /* Sockets marked for termination are drained on every poll. */
+        if (   so->so_type == IPPROTO_TCP
+            && so->so_close == 1)
+            slirpEpollQueueReady(pData, so, 0);
+    }
+
+    STAM_PROFILE_STOP(&pData->StatFill, a);
+    return pData->iEpollFd;
+}
+
+/**
+ * Processes the events of a TCP socket, the epoll counterpart of the TCP
+ * loop in slirp_select_poll().
+ */
+static void slirpEpollProcessTcp(PNATState pData, struct socket *so)
+{
+    uint32_t fEvents = so->so_revents;
+    int ret;
+
+    Assert(!so->fUnderPolling);
+    so->fUnderPolling = 1;
+    if (slirpVerifyAndFreeSocket(pData, so))
+        return;
+    if (so->so_state & SS_NOFDREF || so->s == -1)
+        goto done;
+
+    Log2(("%R[natsock] events %#x\n", so, fEvents));
+
+    /*
+     * Check for URG data
+     * This will soread as well, so no need to
+     * test for readfds below if this succeeds
+     */
+    if (fEvents & EPOLLPRI)
+    {
+        sorecvoob(pData, so);
+        if (slirpVerifyAndFreeSocket(pData, so))
+            return;
+    }
+    /*
+     * Check sockets for reading
+     */
+    else if (fEvents & EPOLLIN)
+    {
+        /*
+         * Check for incoming connections
+         */
+        if (so->so_state & SS_FACCEPTCONN)
+        {
+            TCP_CONNECT(pData, so);
+            if (slirpVerifyAndFreeSocket(pData, so))
+                return;
+            if (!(fEvents & EPOLLHUP))
+                goto done;
+        }
+
+        ret = soread(pData, so);
+        if (slirpVerifyAndFreeSocket(pData, so))
+            return;
+        /* Output it if we read something */
+        if (RT_LIKELY(ret > 0))
+            TCP_OUTPUT(pData, sototcpcb(so));
+        if (slirpVerifyAndFreeSocket(pData, so))
+            return;
+    }
+
+    /*
+     * Check for POLLHUP, drain the socket and mark it for termination.
+     */
+    if (   (fEvents & EPOLLHUP)
+        || so->so_close == 1)
+    {
+        for (;;)
+        {
+            ret = soread(pData, so);
+            if (slirpVerifyAndFreeSocket(pData, so))
+                return;
+            if (ret <= 0)
+            {
+                Log2(("%R[natsock] errno %d (%s)\n", so, errno, strerror(errno)));
+                break;
+            }
+            TCP_OUTPUT(pData, sototcpcb(so));
+            if (slirpVerifyAndFreeSocket(pData, so))
+                return;
+        }
+        so->so_close = 1;
+        /* In the error case POLLERR comes along with POLLHUP, we can't send more. */
+        if (fEvents & EPOLLERR)
+            sofcantsendmore(so);
+        goto done;
+    }
+
+    /*
+     * Check sockets for writing
+     */
+    if (fEvents & EPOLLOUT)
+    {
+        slirpConnectOrWrite(pData, so, false);
+        if (slirpVerifyAndFreeSocket(pData, so))
+            return;
+    }
+
+done:
+    if (!slirpVerifyAndFreeSocket(pData, so))
+    {
+        so->fUnderPolling = 0;
+        /* Processing the socket likely changed the events it waits for. */
+        SOCKET_EPOLL_TOUCH(pData, so);
+    }
+}
+
+/**
+ * Processes the sockets reported ready, the epoll counterpart of
+ * slirp_select_poll().
+ *
+ * @param   pData       The NAT state.
+ */
+void slirp_epoll_poll(PNATState pData)
+{
+    struct epoll_event aEvents[NAT_EPOLL_EVENTS_MAX];
+    struct socket *so;
+    bool fIcmp = false;
+    int cEvents;
+    int i;
+
+    STAM_PROFILE_START(&pData->StatPoll, a);
+
+    /* Update time */
+    updtime(pData);
+
+    if (!link_up)
+        goto done;
+    slirpCheckTimers(pData);
+
+    /*
+     * Collect the ready sockets first, processing one socket might free
+     * another one (which removes it from the ready list).
+     */
+    cEvents = epoll_wait(pData->iEpollFd, &aEvents[0], RT_ELEMENTS(aEvents), 0);
+    for (i = 0; i < cEvents; i++)
+    {
+        so = (struct socket *)aEvents[i].data.ptr;
+        if (so == &pData->icmp_socket)
+            fIcmp = true;
+        else
+            slirpEpollQueueReady(pData, so, aEvents[i].events);
+    }
+    if (cEvents > 0)
+        STAM_COUNTER_ADD(&pData->StatEpollReady, cEvents);
+
+    if (fIcmp)
+        sorecvfrom(pData, &pData->icmp_socket);
+
+    while (!LIST_EMPTY(&pData->EpollReadyHead))
+    {
+        so = LIST_FIRST(&pData->EpollReadyHead);
+        LIST_REMOVE(so, so_epoll_ready);
+        so->fEpollReady = 0;
+
+        if (so->so_type == IPPROTO_TCP)
+            slirpEpollProcessTcp(pData, so);
+        /* Incoming UDP data isn't buffered, the interest set doesn't change. */
+        else if (   so->so_type == IPPROTO_UDP
+                 && so->s != -1
+                 && (so->so_revents & EPOLLIN))
+            SORECVFROM(pData, so);
+    }
+
+done:
+    STAM_PROFILE_STOP(&pData->StatPoll, a);
+}
+#endif /* VBOX_WITH_NAT_EPOLL */
+
 
 struct arphdr
 {
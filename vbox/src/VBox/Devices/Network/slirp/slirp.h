@@ -212,6 +212,9 @@ int inet_aton (const char *cp, struct in_addr *ia);
 #ifndef RT_OS_WINDOWS
 # include <sys/socket.h>
 #endif
+#ifdef VBOX_WITH_NAT_EPOLL
+# include <sys/epoll.h>
+#endif
 
 #if defined(HAVE_SYS_IOCTL_H)
 # include <sys/ioctl.h>
@@ -196,6 +196,17 @@ typedef struct NATState
 #  define NSOCK_DEC() do {} while (0)
 #  define NSOCK_INC_EX(ex) do {} while (0)
 #  define NSOCK_DEC_EX(ex) do {} while (0)
+# endif
+# ifdef VBOX_WITH_NAT_EPOLL
+    /** The epoll descriptor, -1 if epoll isn't available and the poll()
+     *  interface must be used. */
+    int iEpollFd;
+    /** Sockets which interest set needs to be re-evaluated. */
+    LIST_HEAD(RT_NOTHING, socket) EpollDirtyHead;
+    /** Sockets which need processing in slirp_epoll_poll(). */
+    LIST_HEAD(RT_NOTHING, socket) EpollReadyHead;
+    /** The time of the last UDP expiration scan. */
+    uint32_t uEpollLastUdpExpire;
 # endif
     int cIcmpCacheSize;
     int iIcmpCacheLimit;
@@ -218,6 +218,9 @@ sofree(PNATState pData, struct socket *so)
         remque(pData, so);  /* crashes if so is not in a queue */
         NSOCK_DEC();
     }
+#ifdef VBOX_WITH_NAT_EPOLL
+    slirpEpollRemoveSocket(pData, so);
+#endif
 
     RTMemFree(so);
     LogFlowFuncLeave();
@@ -1064,6 +1067,7 @@ sosendto(PNATState pData, struct socket *so, struct mbuf *m)
     if (so->so_expire)
         so->so_expire = curtime + SO_EXPIRE;
     so->so_state = SS_ISFCONNECTED; /* So that it gets select()ed */
+    SOCKET_EPOLL_TOUCH(pData, so);
     return 0;
 }
 
@@ -1099,6 +1103,7 @@ solisten(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_in
     QSOCKET_LOCK(tcb);
     insque(pData, so,&tcb);
     NSOCK_INC();
+    SOCKET_EPOLL_TOUCH(pData, so);
     QSOCKET_UNLOCK(tcb);
 
     /*
@@ -126,12 +126,51 @@ struct socket
      *  alter value ''fShouldBeRemoved'' to 1, else we do removal.
      */
     int fShouldBeRemoved;
+#ifdef VBOX_WITH_NAT_EPOLL
+    /** The events registered with the epoll set, 0 if not registered. */
+    uint32_t so_epoll_events;
+    /** The descriptor the events were registered for, the socket might
+     *  switch descriptors (see tcp_connect). */
+    int so_epoll_fd;
+    /** The events reported by the last epoll_wait(). */
+    uint32_t so_revents;
+    /** Set if the socket is on the dirty list. */
+    int fEpollDirty;
+    /** Set if the socket is on the ready list. */
+    int fEpollReady;
+    /** Entry in NATState::EpollDirtyHead, sockets which interest set needs
+     *  to be re-evaluated. */
+    LIST_ENTRY(socket) so_epoll_dirty;
+    /** Entry in NATState::EpollReadyHead. */
+    LIST_ENTRY(socket) so_epoll_ready;
+#endif
 };
 
 /* this function inform libalias about socket close */
 void slirpDeleteLinkSocket(void *pvLnk);
+#ifdef VBOX_WITH_NAT_EPOLL
+void slirpEpollRemoveSocket(PNATState pData, struct socket *so);
+#endif
 
 
+#ifdef VBOX_WITH_NAT_EPOLL
+/**
+ * Marks the socket for re-evaluation of its epoll interest set. Must be used
+ * whenever something happens that might change the events the socket is
+ * waiting for, e.g. data arrived from the guest.
+ */
+# define SOCKET_EPOLL_TOUCH(pData, so)                                  \
+    do {                                                                \
+        if (!(so)->fEpollDirty)                                         \
+        {                                                               \
+            (so)->fEpollDirty = 1;                                      \
+            LIST_INSERT_HEAD(&(pData)->EpollDirtyHead, (so), so_epoll_dirty); \
+        }                                                               \
+    } while (0)
+#else
+# define SOCKET_EPOLL_TOUCH(pData, so) do {} while (0)
+#endif
+
 # define SOCKET_LOCK(so) do {} while (0)
 # define SOCKET_UNLOCK(so) do {} while (0)
 # define SOCKET_LOCK_CREATE(so) do {} while (0)
@@ -530,6 +530,8 @@ findso:
         tp = sototcpcb(so);
         TCP_STATE_SWITCH_TO(tp, TCPS_LISTEN);
     }
+    /* The segment is likely to change what we wait for on the socket. */
+    SOCKET_EPOLL_TOUCH(pData, so);
 
     /*
      * If this is a still-connecting socket, this probably
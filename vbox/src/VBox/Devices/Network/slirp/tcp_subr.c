@@ -575,8 +575,12 @@ tcp_connect(PNATState pData, struct socket *inso)
         closesocket(so->s);        /* If we only accept once, close the accept() socket */
         so->so_state = SS_NOFDREF; /* Don't select it yet, even though we have an FD */
                                    /* if it's not FACCEPTONCE, it's already NOFDREF */
+#ifdef VBOX_WITH_NAT_EPOLL
+        so->so_epoll_events = 0;   /* closing the descriptor dropped the registration */
+#endif
     }
     so->s = s;
+    SOCKET_EPOLL_TOUCH(pData, so);
 
     tp = sototcpcb(so);
 
@@ -614,6 +618,7 @@ tcp_attach(PNATState pData, struct socket *so)
     QSOCKET_LOCK(tcb);
     insque(pData, so, &tcb);
     NSOCK_INC();
+    SOCKET_EPOLL_TOUCH(pData, so);
     QSOCKET_UNLOCK(tcb);
     return 0;
 }
@@ -272,6 +272,7 @@ udp_input(PNATState pData, register struct mbuf *m, int iphlen)
     so->so_faddr = ip->ip_dst;   /* XXX */
     so->so_fport = uh->uh_dport; /* XXX */
     Assert(so->so_type == IPPROTO_UDP);
+    SOCKET_EPOLL_TOUCH(pData, so);
 
     /*
      * DNS proxy
@@ -517,6 +518,7 @@ udp_attach(PNATState pData, struct socket *so)
     QSOCKET_LOCK(udb);
     insque(pData, so, &udb);
     NSOCK_INC();
+    SOCKET_EPOLL_TOUCH(pData, so);
     QSOCKET_UNLOCK(udb);
     so->so_type = IPPROTO_UDP;
     return so->s;
@@ -581,6 +583,7 @@ udp_listen(PNATState pData, u_int32_t bind_addr, u_int port, u_int32_t laddr, u_
     QSOCKET_LOCK(udb);
     insque(pData, so, &udb);
     NSOCK_INC();
+    SOCKET_EPOLL_TOUCH(pData, so);
     QSOCKET_UNLOCK(udb);
 
     memset(&addr, 0, sizeof(addr));
@@ -0,0 +1,627 @@
+/* $Id$ */
+/** @file
+ * NAT - Testcase and benchmark for the event loop of the NAT I/O thread,
+ *       slirp_select_fill()/slirp_select_poll() vs. slirp_epoll_fill()/
+ *       slirp_epoll_poll().
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/*
+ * The testcase links the slirp sources and plays both the guest and the NAT
+ * I/O thread. The "guest" opens a number of UDP flows to an echo server on
+ * the host loopback (10.0.2.2 from the guest's point of view), so slirp ends
+ * up with one host socket per flow. The active flows then do ping-pong round
+ * trips while the idle ones just sit there, which is what a NAT with lots of
+ * open but quiet connections looks like. The event loop is driven exactly
+ * like drvNATAsyncIoThread() does it, either through the poll() array
+ * rebuilt on every iteration or through the persistent epoll interest set.
+ *
+ * Afterwards the loop is run with all flows idle and the testcase checks that
+ * slirp doesn't ask for a timer tick and that no socket reports readiness,
+ * i.e. that an idle NAT doesn't wake up the I/O thread.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include "../slirp/libslirp.h"
+
+#include <iprt/test.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/err.h>
+#include <iprt/getopt.h>
+#include <iprt/mem.h>
+#include <iprt/net.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The NAT network, 10.0.2.0/24 (host byte order). */
+#define TST_NAT_NETWORK         UINT32_C(0x0a000200)
+/** The NAT netmask (host byte order). */
+#define TST_NAT_NETMASK         UINT32_C(0xffffff00)
+/** The guest address, 10.0.2.15 (host byte order). */
+#define TST_NAT_GUEST_IP        UINT32_C(0x0a00020f)
+/** The host loopback alias, 10.0.2.2 (host byte order). */
+#define TST_NAT_ALIAS_IP        UINT32_C(0x0a000202)
+/** The guest UDP port of the first flow. */
+#define TST_NAT_FIRST_PORT      20000
+/** The size of the Ethernet, IPv4 and UDP headers. */
+#define TST_NAT_HDRS_SIZE       (sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + sizeof(RTNETUDP))
+/** How long to run the idle part of the test, in milliseconds. */
+#define TST_NAT_IDLE_MS         1000
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * The state of one run, passed to slirp as the user argument.
+ */
+typedef struct TSTNATRUN
+{
+    /** The slirp instance. */
+    PNATState           pNATState;
+    /** The echo server port (host byte order). */
+    uint16_t            uEchoPort;
+    /** The datagram payload size. */
+    size_t              cbMsg;
+    /** The total number of flows, the active ones come first. */
+    uint32_t            cFlows;
+    /** The number of active flows. */
+    uint32_t            cActive;
+    /** Whether the active flows should do another round trip on a reply. */
+    bool                fPingPong;
+    /** Replies received per flow. */
+    uint32_t           *pacReplies;
+    /** Flows to send the next request on once slirp has returned. */
+    bool               *pafResend;
+    /** Total number of replies received. */
+    uint32_t            cReplies;
+    /** Number of frames slirp handed us which we didn't expect. */
+    uint32_t            cUnexpected;
+} TSTNATRUN;
+/** Pointer to the state of a run. */
+typedef TSTNATRUN *PTSTNATRUN;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The test handle. */
+static RTTEST           g_hTest;
+/** The socket of the echo server. */
+static int              g_iEchoFd = -1;
+/** Pipe to stop the echo server, the server waits on the read end. */
+static int              g_aiStopPipe[2] = { -1, -1 };
+/** The MAC address of the guest. */
+static const RTMAC      g_GuestMac = { { 0x08, 0x00, 0x27, 0x01, 0x02, 0x03 } };
+/** The MAC address slirp uses. */
+static const RTMAC      g_NatMac   = { { 0x52, 0x54, 0x00, 0x12, 0x35, 0x00 } };
+
+
+/*
+ * The slirp callbacks, DrvNAT.cpp provides these in the real thing.
+ */
+
+int slirp_can_output(void *pvUser)
+{
+    NOREF(pvUser);
+    return 1;
+}
+
+void slirp_push_recv_thread(void *pvUser)
+{
+    NOREF(pvUser);
+}
+
+void slirp_output_pending(void *pvUser)
+{
+    NOREF(pvUser);
+}
+
+void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
+{
+    PTSTNATRUN pRun = (PTSTNATRUN)pvUser;
+    NOREF(cb);
+    pRun->cUnexpected++;
+    slirp_ext_m_free(pRun->pNATState, m, (uint8_t *)pu8Buf);
+}
+
+/**
+ * Called by slirp for every frame going to the guest, picks up the echo
+ * replies.
+ */
+void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
+{
+    PTSTNATRUN pRun = (PTSTNATRUN)pvUser;
+
+    PCRTNETETHERHDR pEthHdr = (PCRTNETETHERHDR)pu8Buf;
+    PCRTNETIPV4     pIpHdr  = (PCRTNETIPV4)(pEthHdr + 1);
+    if (   (size_t)cb >= TST_NAT_HDRS_SIZE
+        && pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4)
+        && pIpHdr->ip_p == RTNETIPV4_PROT_UDP
+        && pIpHdr->ip_dst.u == RT_H2N_U32_C(TST_NAT_GUEST_IP)
+        && (size_t)cb >= sizeof(RTNETETHERHDR) + pIpHdr->ip_hl * 4 + sizeof(RTNETUDP))
+    {
+        PCRTNETUDP pUdpHdr = (PCRTNETUDP)((uint8_t const *)pIpHdr + pIpHdr->ip_hl * 4);
+        uint32_t   iFlow   = RT_N2H_U16(pUdpHdr->uh_dport) - TST_NAT_FIRST_PORT;
+        if (   iFlow < pRun->cFlows
+            && RT_N2H_U16(pUdpHdr->uh_sport) == pRun->uEchoPort)
+        {
+            pRun->pacReplies[iFlow]++;
+            pRun->cReplies++;
+            /* Don't re-enter slirp from its own callback. */
+            if (pRun->fPingPong && iFlow < pRun->cActive)
+                pRun->pafResend[iFlow] = true;
+        }
+        else
+            pRun->cUnexpected++;
+    }
+    else
+        pRun->cUnexpected++;
+
+    slirp_ext_m_free(pRun->pNATState, m, (uint8_t *)pu8Buf);
+}
+
+
+/**
+ * Returns the CPU time consumed by the calling thread in nanoseconds.
+ */
+static uint64_t tstThreadCpuNanoTS(void)
+{
+    struct timespec Ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Ts);
+    return (uint64_t)Ts.tv_sec * RT_NS_1SEC + Ts.tv_nsec;
+}
+
+
+/**
+ * The echo server thread, sends back every datagram it receives.
+ */
+static DECLCALLBACK(int) tstEchoServerThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    NOREF(hThreadSelf); NOREF(pvUser);
+
+    for (;;)
+    {
+        struct pollfd aPolls[2];
+        aPolls[0].fd      = g_iEchoFd;
+        aPolls[0].events  = POLLIN;
+        aPolls[0].revents = 0;
+        aPolls[1].fd      = g_aiStopPipe[0];
+        aPolls[1].events  = POLLIN;
+        aPolls[1].revents = 0;
+        int cChanged = poll(&aPolls[0], RT_ELEMENTS(aPolls), -1);
+        if (cChanged < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return VERR_GENERAL_FAILURE;
+        }
+        if (aPolls[1].revents)
+            return VINF_SUCCESS;
+
+        char               abBuf[_4K];
+        struct sockaddr_in From;
+        socklen_t          cbFrom;
+        ssize_t            cb;
+        while (   cbFrom = sizeof(From),
+                  (cb = recvfrom(g_iEchoFd, abBuf, sizeof(abBuf), MSG_DONTWAIT, (struct sockaddr *)&From, &cbFrom)) >= 0)
+            sendto(g_iEchoFd, abBuf, cb, 0, (struct sockaddr *)&From, cbFrom);
+    }
+}
+
+
+/**
+ * Sends a datagram from the guest side of a flow to the echo server.
+ *
+ * @param   pRun        The run state.
+ * @param   iFlow       The flow.
+ */
+static void tstSendRequest(PTSTNATRUN pRun, uint32_t iFlow)
+{
+    size_t const cbFrame = TST_NAT_HDRS_SIZE + pRun->cbMsg;
+    void        *pvFrame;
+    size_t       cbBuf;
+    struct mbuf *m = slirp_ext_m_get(pRun->pNATState, cbFrame, &pvFrame, &cbBuf);
+    if (!m)
+    {
+        RTTestFailed(g_hTest, "slirp_ext_m_get failed\n");
+        return;
+    }
+    RT_BZERO(pvFrame, cbFrame);
+
+    PRTNETETHERHDR pEthHdr = (PRTNETETHERHDR)pvFrame;
+    pEthHdr->DstMac    = g_NatMac;
+    pEthHdr->SrcMac    = g_GuestMac;
+    pEthHdr->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4);
+
+    PRTNETIPV4 pIpHdr = (PRTNETIPV4)(pEthHdr + 1);
+    pIpHdr->ip_v     = 4;
+    pIpHdr->ip_hl    = RTNETIPV4_MIN_LEN / 4;
+    pIpHdr->ip_len   = RT_H2N_U16((uint16_t)(cbFrame - sizeof(RTNETETHERHDR)));
+    pIpHdr->ip_id    = RT_H2N_U16((uint16_t)iFlow);
+    pIpHdr->ip_ttl   = 64;
+    pIpHdr->ip_p     = RTNETIPV4_PROT_UDP;
+    pIpHdr->ip_src.u = RT_H2N_U32_C(TST_NAT_GUEST_IP);
+    pIpHdr->ip_dst.u = RT_H2N_U32_C(TST_NAT_ALIAS_IP);
+    pIpHdr->ip_sum   = RTNetIPv4HdrChecksum(pIpHdr);
+
+    /* A zero UDP checksum means none. */
+    PRTNETUDP pUdpHdr = (PRTNETUDP)((uint8_t *)pIpHdr + RTNETIPV4_MIN_LEN);
+    pUdpHdr->uh_sport = RT_H2N_U16((uint16_t)(TST_NAT_FIRST_PORT + iFlow));
+    pUdpHdr->uh_dport = RT_H2N_U16(pRun->uEchoPort);
+    pUdpHdr->uh_ulen  = RT_H2N_U16((uint16_t)(sizeof(RTNETUDP) + pRun->cbMsg));
+
+    slirp_input(pRun->pNATState, m, cbFrame);
+}
+
+
+/**
+ * Does one iteration of the NAT I/O thread loop.
+ *
+ * @returns The poll() status, i.e. the number of ready descriptors.
+ * @param   pRun        The run state.
+ * @param   fEpoll      Whether to use the epoll or the poll() array flavor.
+ * @param   cMsMax      Upper limit for the poll timeout.
+ * @param   pcFDs       Where to return the number of descriptors polled.
+ */
+static int tstLoopOnce(PTSTNATRUN pRun, bool fEpoll, unsigned cMsMax, unsigned *pcFDs)
+{
+    PNATState pNATState = pRun->pNATState;
+    int       cChanged;
+
+#ifdef VBOX_WITH_NAT_EPOLL
+    if (fEpoll)
+    {
+        /* What drvNATAsyncIoThread() does with VBOX_WITH_NAT_EPOLL. */
+        struct pollfd EpollFd;
+        EpollFd.fd      = slirp_epoll_fill(pNATState);
+        EpollFd.events  = POLLIN;
+        EpollFd.revents = 0;
+        unsigned const cMs = RT_MIN(slirp_get_timeout_ms(pNATState), cMsMax);
+        cChanged = poll(&EpollFd, EpollFd.fd != -1 ? 1 : 0, cMs);
+        if (cChanged >= 0)
+            slirp_epoll_poll(pNATState);
+        *pcFDs = 1;
+    }
+    else
+#endif
+    {
+        NOREF(fEpoll);
+        int nFDs = slirp_get_nsock(pNATState);
+        struct pollfd *paPolls = (struct pollfd *)RTMemAlloc((1 + nFDs) * sizeof(struct pollfd) + sizeof(uint32_t));
+        if (!paPolls)
+        {
+            RTTestFailed(g_hTest, "Out of memory\n");
+            return -1;
+        }
+        slirp_select_fill(pNATState, &nFDs, &paPolls[0]);
+        unsigned const cMs = RT_MIN(slirp_get_timeout_ms(pNATState), cMsMax);
+        cChanged = poll(paPolls, nFDs, cMs);
+        if (cChanged >= 0)
+            slirp_select_poll(pNATState, &paPolls[0], nFDs);
+        RTMemFree(paPolls);
+        *pcFDs = nFDs;
+    }
+
+    if (cChanged < 0 && errno == EINTR)
+        cChanged = 0;
+    return cChanged;
+}
+
+
+/**
+ * Sends the requests the output callback asked for.
+ */
+static void tstSendPending(PTSTNATRUN pRun)
+{
+    for (uint32_t i = 0; i < pRun->cActive; i++)
+        if (pRun->pafResend[i])
+        {
+            pRun->pafResend[i] = false;
+            tstSendRequest(pRun, i);
+        }
+}
+
+
+/**
+ * Runs the loop until the given number of replies has been received.
+ *
+ * @returns true if all replies arrived, false on timeout.
+ * @param   pRun        The run state.
+ * @param   fEpoll      The event loop flavor.
+ * @param   cReplies    The total reply count to wait for.
+ * @param   pcWakeups   Where to count the loop iterations, optional.
+ */
+static bool tstLoopUntil(PTSTNATRUN pRun, bool fEpoll, uint32_t cReplies, uint64_t *pcWakeups)
+{
+    uint64_t const u64Start = RTTimeMilliTS();
+    while (pRun->cReplies < cReplies)
+    {
+        if (RTTimeMilliTS() - u64Start > 10000)
+            return false;
+
+        unsigned cFDs;
+        if (tstLoopOnce(pRun, fEpoll, 1000, &cFDs) < 0)
+            return false;
+        if (pcWakeups)
+            (*pcWakeups)++;
+        tstSendPending(pRun);
+    }
+    return true;
+}
+
+
+/**
+ * Runs the test for one event loop flavor on a fresh slirp instance.
+ *
+ * @returns VINF_SUCCESS, or VERR_NOT_AVAILABLE if slirp can't be set up in
+ *          this environment.
+ * @param   uEchoPort       The echo server port.
+ * @param   cFlows          The total number of flows.
+ * @param   cActive         The number of active flows.
+ * @param   cRoundTrips     The number of round trips to do.
+ * @param   cbMsg           The message size.
+ * @param   fEpoll          Whether to use epoll or poll.
+ */
+static int tstRun(uint16_t uEchoPort, uint32_t cFlows, uint32_t cActive, uint32_t cRoundTrips, size_t cbMsg, bool fEpoll)
+{
+    const char *pszName = fEpoll ? "epoll" : "poll";
+
+    TSTNATRUN Run;
+    RT_ZERO(Run);
+    Run.uEchoPort  = uEchoPort;
+    Run.cbMsg      = cbMsg;
+    Run.cFlows     = cFlows;
+    Run.cActive    = cActive;
+    Run.pacReplies = (uint32_t *)RTMemAllocZ(cFlows * sizeof(uint32_t));
+    Run.pafResend  = (bool *)RTMemAllocZ(cFlows * sizeof(bool));
+    RTTESTI_CHECK_RET(Run.pacReplies && Run.pafResend, VERR_NO_MEMORY);
+
+    int rc = slirp_init(&Run.pNATState, RT_H2N_U32_C(TST_NAT_NETWORK), TST_NAT_NETMASK,
+                        true /*fPassDomain*/, false /*fUseHostResolver*/, 0 /*i32AliasMode*/,
+                        100 /*iIcmpCacheLimit*/, &Run);
+    if (rc != VINF_SUCCESS)
+    {
+        /* VINF_NAT_DNS leaves slirp half initialized. */
+        RTTestPrintf(g_hTest, RTTESTLVL_ALWAYS, "slirp_init returned %Rrc\n", rc);
+        if (Run.pNATState && RT_SUCCESS(rc))
+            slirp_term(Run.pNATState);
+        RTMemFree(Run.pacReplies);
+        RTMemFree(Run.pafResend);
+        return VERR_NOT_AVAILABLE;
+    }
+
+    RTTestSub(g_hTest, pszName);
+#ifdef VBOX_WITH_NAT_EPOLL
+    if (fEpoll && !slirp_epoll_is_available(Run.pNATState))
+        RTTestFailed(g_hTest, "No epoll descriptor\n");
+    else
+#endif
+    {
+        slirp_set_ethaddr_and_activate_port_forwarding(Run.pNATState, g_GuestMac.au8, RT_H2N_U32_C(TST_NAT_GUEST_IP));
+
+        /*
+         * Open the flows, slirp creates a host socket for each of them.
+         */
+        for (uint32_t i = 0; i < cFlows; i++)
+            tstSendRequest(&Run, i);
+        if (!tstLoopUntil(&Run, fEpoll, cFlows, NULL))
+            RTTestFailed(g_hTest, "Only %u of %u flows got a reply\n", Run.cReplies, cFlows);
+
+        /*
+         * Ping-pong on the active flows.
+         */
+        uint64_t       cWakeups    = 0;
+        uint32_t const cBase       = Run.cReplies;
+        uint64_t const u64CpuStart = tstThreadCpuNanoTS();
+        uint64_t const u64Start    = RTTimeNanoTS();
+        if (!RTTestErrorCount(g_hTest))
+        {
+            Run.fPingPong = true;
+            for (uint32_t i = 0; i < cActive; i++)
+                tstSendRequest(&Run, i);
+            if (!tstLoopUntil(&Run, fEpoll, cBase + cRoundTrips, &cWakeups))
+                RTTestFailed(g_hTest, "Only %u of %u round trips completed\n", Run.cReplies - cBase, cRoundTrips);
+        }
+        uint64_t const cNsElapsed = RTTimeNanoTS() - u64Start;
+        uint64_t const cNsCpu     = tstThreadCpuNanoTS() - u64CpuStart;
+        uint32_t const cDone      = Run.cReplies - cBase;
+
+        /* Every active flow has one request in flight, collect the replies so
+           the idle part starts out idle. */
+        Run.fPingPong = false;
+        if (   !RTTestErrorCount(g_hTest)
+            && !tstLoopUntil(&Run, fEpoll, Run.cReplies + cActive, NULL))
+            RTTestFailed(g_hTest, "Lost replies after the round trips\n");
+
+        if (cDone)
+        {
+            RTTestValueF(g_hTest, cNsCpu / cDone, RTTESTUNIT_NS_PER_ROUND_TRIP, "%s CPU per round trip", pszName);
+            RTTestValueF(g_hTest, cNsElapsed / cDone, RTTESTUNIT_NS_PER_ROUND_TRIP, "%s elapsed per round trip", pszName);
+            RTTestValueF(g_hTest, cWakeups, RTTESTUNIT_OCCURRENCES, "%s busy wakeups", pszName);
+        }
+
+        /*
+         * Idle: nothing is in flight, only UDP sockets exist, so slirp should
+         * neither need a timer nor see a ready socket.
+         */
+        uint64_t       cIdleWakeups = 0;
+        uint64_t       cSpurious    = 0;
+        unsigned       cMinFDs      = UINT32_MAX;
+        uint64_t const u64IdleStart = RTTimeMilliTS();
+        uint64_t       cMsElapsed;
+        while (   !RTTestErrorCount(g_hTest)
+               && (cMsElapsed = RTTimeMilliTS() - u64IdleStart) < TST_NAT_IDLE_MS)
+        {
+            unsigned const cMsTimeout = slirp_get_timeout_ms(Run.pNATState);
+            if (cMsTimeout < TST_NAT_IDLE_MS)
+                RTTestFailed(g_hTest, "Idle slirp wants to be woken up after %u ms\n", cMsTimeout);
+
+            unsigned cFDs;
+            int cChanged = tstLoopOnce(&Run, fEpoll, TST_NAT_IDLE_MS - (unsigned)cMsElapsed, &cFDs);
+            cIdleWakeups++;
+            if (cChanged > 0)
+                cSpurious++;
+            cMinFDs = RT_MIN(cMinFDs, cFDs);
+        }
+        if (cSpurious)
+            RTTestFailed(g_hTest, "%RU64 of %RU64 idle wakeups found ready descriptors\n", cSpurious, cIdleWakeups);
+        if (!fEpoll && cMinFDs != UINT32_MAX && cMinFDs < cFlows)
+            RTTestFailed(g_hTest, "The poll array has %u entries for %u flows\n", cMinFDs, cFlows);
+        RTTestValueF(g_hTest, cIdleWakeups, RTTESTUNIT_OCCURRENCES, "%s idle wakeups", pszName);
+
+        for (uint32_t i = cActive; i < cFlows; i++)
+            if (Run.pacReplies[i] != 1)
+                RTTestFailed(g_hTest, "Idle flow #%u got %u replies\n", i, Run.pacReplies[i]);
+        if (Run.cUnexpected)
+            RTTestFailed(g_hTest, "%u unexpected frames from slirp\n", Run.cUnexpected);
+    }
+
+    slirp_term(Run.pNATState);
+    RTMemFree(Run.pacReplies);
+    RTMemFree(Run.pafResend);
+    RTTestSubDone(g_hTest);
+    return VINF_SUCCESS;
+}
+
+
+int main(int argc, char **argv)
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstNATEventLoop-1", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+
+    static RTGETOPTDEF const s_aOptions[] =
+    {
+        { "--idle",         'i', RTGETOPT_REQ_UINT32 },
+        { "--active",       'a', RTGETOPT_REQ_UINT32 },
+        { "--round-trips",  'n', RTGETOPT_REQ_UINT32 },
+        { "--size",         's', RTGETOPT_REQ_UINT32 },
+    };
+
+    uint32_t cIdle       = 256;
+    uint32_t cActive     = 8;
+    uint32_t cRoundTrips = 20000;
+    uint32_t cbMsg       = 64;
+
+    int ch;
+    RTGETOPTUNION Value;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /* fFlags */);
+    while ((ch = RTGetOpt(&GetState, &Value)))
+        switch (ch)
+        {
+            case 'i':
+                cIdle = Value.u32;
+                break;
+
+            case 'a':
+                cActive = Value.u32;
+                break;
+
+            case 'n':
+                cRoundTrips = Value.u32;
+                break;
+
+            case 's':
+                cbMsg = RT_MIN(RT_MAX(Value.u32, 1), 1024);
+                break;
+
+            case 'h':
+                RTPrintf("syntax: tstNATEventLoop-1 [--idle <N>] [--active <M>] [--round-trips <count>] [--size <bytes>]\n");
+                return RTEXITCODE_SUCCESS;
+
+            default:
+                return RTGetOptPrintError(ch, &Value);
+        }
+    if (!cActive)
+        return RTTestSkipAndDestroy(g_hTest, "No active flows");
+    if (cIdle + cActive > 40000)
+        return RTGetOptPrintError(VERR_OUT_OF_RANGE, &Value);
+
+    RTTestBanner(g_hTest);
+    RTTestPrintf(g_hTest, RTTESTLVL_ALWAYS, "%u idle + %u active flows, %u round trips of %u bytes\n",
+                 cIdle, cActive, cRoundTrips, cbMsg);
+
+    /* One slirp socket per flow plus the echo server and slirp's own. */
+    uint32_t const cFlows = cIdle + cActive;
+    struct rlimit Limit;
+    if (   !getrlimit(RLIMIT_NOFILE, &Limit)
+        && Limit.rlim_cur < cFlows + 64)
+    {
+        Limit.rlim_cur = RT_MIN(Limit.rlim_max, cFlows + 64);
+        setrlimit(RLIMIT_NOFILE, &Limit);
+    }
+
+    /*
+     * Start the echo server on the host loopback.
+     */
+    struct sockaddr_in Addr;
+    RT_ZERO(Addr);
+    Addr.sin_family      = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t cbAddr     = sizeof(Addr);
+    g_iEchoFd = socket(AF_INET, SOCK_DGRAM, 0);
+    RTTESTI_CHECK_RET(g_iEchoFd >= 0, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RET(bind(g_iEchoFd, (struct sockaddr *)&Addr, sizeof(Addr)) == 0, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RET(getsockname(g_iEchoFd, (struct sockaddr *)&Addr, &cbAddr) == 0, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RET(pipe(g_aiStopPipe) == 0, RTTestSummaryAndDestroy(g_hTest));
+
+    RTTHREAD hThread;
+    RTTESTI_CHECK_RC_RET(RTThreadCreate(&hThread, tstEchoServerThread, NULL, 0, RTTHREADTYPE_IO,
+                                        RTTHREADFLAGS_WAITABLE, "EchoSrv"),
+                         VINF_SUCCESS, RTTestSummaryAndDestroy(g_hTest));
+
+    /*
+     * The two event loop flavors, each on a fresh slirp instance.
+     */
+    uint16_t const uEchoPort = RT_N2H_U16(Addr.sin_port);
+    int rc = tstRun(uEchoPort, cFlows, cActive, cRoundTrips, cbMsg, false /*fEpoll*/);
+#ifdef VBOX_WITH_NAT_EPOLL
+    if (rc == VINF_SUCCESS)
+        rc = tstRun(uEchoPort, cFlows, cActive, cRoundTrips, cbMsg, true /*fEpoll*/);
+#endif
+
+    /*
+     * Cleanup.
+     */
+    write(g_aiStopPipe[1], "", 1);
+    RTThreadWait(hThread, RT_INDEFINITE_WAIT, NULL);
+    close(g_aiStopPipe[0]);
+    close(g_aiStopPipe[1]);
+    close(g_iEchoFd);
+
+    if (rc == VERR_NOT_AVAILABLE)
+        return RTTestSkipAndDestroy(g_hTest, "slirp could not be initialized");
+    return RTTestSummaryAndDestroy(g_hTest);
+}
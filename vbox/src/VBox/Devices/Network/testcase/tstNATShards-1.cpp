@@ -0,0 +1,696 @@
+/* $Id$ */
+/** @file
+ * NAT - Benchmark for the NAT engine shards, parallel flows spread over
+ *       several slirp instances each running on its own thread.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/*
+ * The benchmark links the slirp sources and does what DrvNAT.cpp does with
+ * the "Shards" setting: one slirp instance per shard, each driven by its own
+ * thread, with the guest's UDP flows distributed over them using the hash of
+ * drvNATSelectShard(). Every flow does ping-pong round trips with an echo
+ * server on the host loopback (10.0.2.2 from the guest's point of view) for a
+ * fixed time, and the aggregate round trip rate is reported for 1, 2, 4, ...
+ * shards up to the requested number.
+ *
+ * Unlike the driver, every shard thread plays the guest for its own flows, so
+ * this measures how the NAT engine itself scales and not the guest side
+ * transmit path, which is serialized by the device anyway.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include "../slirp/libslirp.h"
+
+#include <iprt/test.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/err.h>
+#include <iprt/getopt.h>
+#include <iprt/mem.h>
+#include <iprt/net.h>
+#include <iprt/semaphore.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The NAT network, 10.0.2.0/24 (host byte order). */
+#define TST_NAT_NETWORK         UINT32_C(0x0a000200)
+/** The NAT netmask (host byte order). */
+#define TST_NAT_NETMASK         UINT32_C(0xffffff00)
+/** The guest address, 10.0.2.15 (host byte order). */
+#define TST_NAT_GUEST_IP        UINT32_C(0x0a00020f)
+/** The host loopback alias, 10.0.2.2 (host byte order). */
+#define TST_NAT_ALIAS_IP        UINT32_C(0x0a000202)
+/** The guest UDP port of the first flow. */
+#define TST_NAT_FIRST_PORT      20000
+/** The size of the Ethernet, IPv4 and UDP headers. */
+#define TST_NAT_HDRS_SIZE       (sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + sizeof(RTNETUDP))
+/** The max number of shards, same as DRVNAT_MAX_SHARDS. */
+#define TST_NAT_MAX_SHARDS      8
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * One shard, passed to slirp as the user argument.
+ */
+typedef struct TSTNATSHARD
+{
+    /** The slirp instance. */
+    PNATState           pNATState;
+    /** The thread driving it. */
+    RTTHREAD            hThread;
+    /** The index of the shard. */
+    uint32_t            iShard;
+    /** The number of flows the shard handles. */
+    uint32_t            cFlows;
+    /** Whether the flows should do another round trip on a reply. */
+    bool                fPingPong;
+    /** Flows to send the next request on once slirp has returned, indexed by
+     * the global flow number. */
+    bool               *pafResend;
+    /** Total number of replies received. */
+    uint32_t            cReplies;
+    /** Number of replies received while measuring. */
+    uint32_t            cRoundTrips;
+    /** Number of frames slirp handed us which we didn't expect. */
+    uint32_t            cUnexpected;
+    /** The CPU time the thread spent measuring. */
+    uint64_t            cNsCpu;
+} TSTNATSHARD;
+/** Pointer to a shard. */
+typedef TSTNATSHARD *PTSTNATSHARD;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The test handle. */
+static RTTEST           g_hTest;
+/** The socket of the echo server. */
+static int              g_iEchoFd = -1;
+/** Pipe to stop the echo servers, they wait on the read end. */
+static int              g_aiStopPipe[2] = { -1, -1 };
+/** The echo server port (host byte order). */
+static uint16_t         g_uEchoPort;
+/** The datagram payload size. */
+static size_t           g_cbMsg = 64;
+/** The total number of flows. */
+static uint32_t         g_cFlows;
+/** The shard of each flow. */
+static uint8_t         *g_paiFlowShard;
+/** The number of shard threads done with their setup. */
+static uint32_t volatile g_cReady;
+/** Released when the measurement starts. */
+static RTSEMEVENTMULTI  g_hEvtStart = NIL_RTSEMEVENTMULTI;
+/** Set when the measurement is over. */
+static bool volatile    g_fStop;
+/** The MAC address of the guest. */
+static const RTMAC      g_GuestMac = { { 0x08, 0x00, 0x27, 0x01, 0x02, 0x03 } };
+/** The MAC address slirp uses. */
+static const RTMAC      g_NatMac   = { { 0x52, 0x54, 0x00, 0x12, 0x35, 0x00 } };
+
+
+/*
+ * The slirp callbacks, DrvNAT.cpp provides these in the real thing.
+ */
+
+int slirp_can_output(void *pvUser)
+{
+    NOREF(pvUser);
+    return 1;
+}
+
+void slirp_push_recv_thread(void *pvUser)
+{
+    NOREF(pvUser);
+}
+
+void slirp_output_pending(void *pvUser)
+{
+    NOREF(pvUser);
+}
+
+void slirp_urg_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
+{
+    PTSTNATSHARD pShard = (PTSTNATSHARD)pvUser;
+    NOREF(cb);
+    pShard->cUnexpected++;
+    slirp_ext_m_free(pShard->pNATState, m, (uint8_t *)pu8Buf);
+}
+
+/**
+ * Called by slirp for every frame going to the guest, picks up the echo
+ * replies.
+ */
+void slirp_output(void *pvUser, struct mbuf *m, const uint8_t *pu8Buf, int cb)
+{
+    PTSTNATSHARD pShard = (PTSTNATSHARD)pvUser;
+
+    PCRTNETETHERHDR pEthHdr = (PCRTNETETHERHDR)pu8Buf;
+    PCRTNETIPV4     pIpHdr  = (PCRTNETIPV4)(pEthHdr + 1);
+    if (   (size_t)cb >= TST_NAT_HDRS_SIZE
+        && pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4)
+        && pIpHdr->ip_p == RTNETIPV4_PROT_UDP
+        && pIpHdr->ip_dst.u == RT_H2N_U32_C(TST_NAT_GUEST_IP)
+        && (size_t)cb >= sizeof(RTNETETHERHDR) + pIpHdr->ip_hl * 4 + sizeof(RTNETUDP))
+    {
+        PCRTNETUDP pUdpHdr = (PCRTNETUDP)((uint8_t const *)pIpHdr + pIpHdr->ip_hl * 4);
+        uint32_t   iFlow   = RT_N2H_U16(pUdpHdr->uh_dport) - TST_NAT_FIRST_PORT;
+        if (   iFlow < g_cFlows
+            && g_paiFlowShard[iFlow] == pShard->iShard
+            && RT_N2H_U16(pUdpHdr->uh_sport) == g_uEchoPort)
+        {
+            pShard->cReplies++;
+            /* Don't re-enter slirp from its own callback. */
+            if (pShard->fPingPong)
+                pShard->pafResend[iFlow] = true;
+        }
+        else
+            pShard->cUnexpected++;
+    }
+    else
+        pShard->cUnexpected++;
+
+    slirp_ext_m_free(pShard->pNATState, m, (uint8_t *)pu8Buf);
+}
+
+
+/**
+ * Returns the CPU time consumed by the calling thread in nanoseconds.
+ */
+static uint64_t tstThreadCpuNanoTS(void)
+{
+    struct timespec Ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &Ts);
+    return (uint64_t)Ts.tv_sec * RT_NS_1SEC + Ts.tv_nsec;
+}
+
+
+/**
+ * An echo server thread, sends back every datagram it receives.  There is
+ * one per shard, all serving the same socket.
+ */
+static DECLCALLBACK(int) tstEchoServerThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    NOREF(hThreadSelf); NOREF(pvUser);
+
+    for (;;)
+    {
+        struct pollfd aPolls[2];
+        aPolls[0].fd      = g_iEchoFd;
+        aPolls[0].events  = POLLIN;
+        aPolls[0].revents = 0;
+        aPolls[1].fd      = g_aiStopPipe[0];
+        aPolls[1].events  = POLLIN;
+        aPolls[1].revents = 0;
+        int cChanged = poll(&aPolls[0], RT_ELEMENTS(aPolls), -1);
+        if (cChanged < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return VERR_GENERAL_FAILURE;
+        }
+        if (aPolls[1].revents)
+            return VINF_SUCCESS;
+
+        char               abBuf[_4K];
+        struct sockaddr_in From;
+        socklen_t          cbFrom;
+        ssize_t            cb;
+        while (   cbFrom = sizeof(From),
+                  (cb = recvfrom(g_iEchoFd, abBuf, sizeof(abBuf), MSG_DONTWAIT, (struct sockaddr *)&From, &cbFrom)) >= 0)
+            sendto(g_iEchoFd, abBuf, cb, 0, (struct sockaddr *)&From, cbFrom);
+    }
+}
+
+
+/**
+ * Picks the shard for a flow the way drvNATSelectShard() does it for UDP.
+ *
+ * @returns The shard index.
+ * @param   iFlow       The flow.
+ * @param   cShards     The number of shards.
+ */
+static uint32_t tstSelectShard(uint32_t iFlow, uint32_t cShards)
+{
+    uint16_t const uSrcPort = (uint16_t)(TST_NAT_FIRST_PORT + iFlow);
+    uint32_t uHash = RT_H2N_U32_C(TST_NAT_GUEST_IP) ^ RT_H2N_U32_C(TST_NAT_ALIAS_IP) ^ RTNETIPV4_PROT_UDP;
+    uHash ^= ((uint32_t)uSrcPort << 16) | g_uEchoPort;
+    uHash *= UINT32_C(0x9e3779b1);
+    return (uHash >> 16) % cShards;
+}
+
+
+/**
+ * Sends a datagram from the guest side of a flow to the echo server.
+ *
+ * @param   pShard      The shard handling the flow.
+ * @param   iFlow       The flow.
+ */
+static void tstSendRequest(PTSTNATSHARD pShard, uint32_t iFlow)
+{
+    size_t const cbFrame = TST_NAT_HDRS_SIZE + g_cbMsg;
+    void        *pvFrame;
+    size_t       cbBuf;
+    struct mbuf *m = slirp_ext_m_get(pShard->pNATState, cbFrame, &pvFrame, &cbBuf);
+    if (!m)
+    {
+        RTTestFailed(g_hTest, "slirp_ext_m_get failed\n");
+        return;
+    }
+    RT_BZERO(pvFrame, cbFrame);
+
+    PRTNETETHERHDR pEthHdr = (PRTNETETHERHDR)pvFrame;
+    pEthHdr->DstMac    = g_NatMac;
+    pEthHdr->SrcMac    = g_GuestMac;
+    pEthHdr->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4);
+
+    PRTNETIPV4 pIpHdr = (PRTNETIPV4)(pEthHdr + 1);
+    pIpHdr->ip_v     = 4;
+    pIpHdr->ip_hl    = RTNETIPV4_MIN_LEN / 4;
+    pIpHdr->ip_len   = RT_H2N_U16((uint16_t)(cbFrame - sizeof(RTNETETHERHDR)));
+    pIpHdr->ip_id    = RT_H2N_U16((uint16_t)iFlow);
+    pIpHdr->ip_ttl   = 64;
+    pIpHdr->ip_p     = RTNETIPV4_PROT_UDP;
+    pIpHdr->ip_src.u = RT_H2N_U32_C(TST_NAT_GUEST_IP);
+    pIpHdr->ip_dst.u = RT_H2N_U32_C(TST_NAT_ALIAS_IP);
+    pIpHdr->ip_sum   = RTNetIPv4HdrChecksum(pIpHdr);
+
+    /* A zero UDP checksum means none. */
+    PRTNETUDP pUdpHdr = (PRTNETUDP)((uint8_t *)pIpHdr + RTNETIPV4_MIN_LEN);
+    pUdpHdr->uh_sport = RT_H2N_U16((uint16_t)(TST_NAT_FIRST_PORT + iFlow));
+    pUdpHdr->uh_dport = RT_H2N_U16(g_uEchoPort);
+    pUdpHdr->uh_ulen  = RT_H2N_U16((uint16_t)(sizeof(RTNETUDP) + g_cbMsg));
+
+    slirp_input(pShard->pNATState, m, cbFrame);
+}
+
+
+/**
+ * Does one iteration of the NAT I/O thread loop, like drvNATAsyncIoThread().
+ *
+ * @returns The poll() status, i.e. the number of ready descriptors.
+ * @param   pShard      The shard.
+ * @param   cMsMax      Upper limit for the poll timeout.
+ */
+static int tstLoopOnce(PTSTNATSHARD pShard, unsigned cMsMax)
+{
+    PNATState pNATState = pShard->pNATState;
+    int       cChanged;
+
+#ifdef VBOX_WITH_NAT_EPOLL
+    if (slirp_epoll_is_available(pNATState))
+    {
+        struct pollfd EpollFd;
+        EpollFd.fd      = slirp_epoll_fill(pNATState);
+        EpollFd.events  = POLLIN;
+        EpollFd.revents = 0;
+        unsigned const cMs = RT_MIN(slirp_get_timeout_ms(pNATState), cMsMax);
+        cChanged = poll(&EpollFd, EpollFd.fd != -1 ? 1 : 0, cMs);
+        if (cChanged >= 0)
+            slirp_epoll_poll(pNATState);
+    }
+    else
+#endif
+    {
+        int nFDs = slirp_get_nsock(pNATState);
+        struct pollfd *paPolls = (struct pollfd *)RTMemAlloc((1 + nFDs) * sizeof(struct pollfd) + sizeof(uint32_t));
+        if (!paPolls)
+        {
+            RTTestFailed(g_hTest, "Out of memory\n");
+            return -1;
+        }
+        slirp_select_fill(pNATState, &nFDs, &paPolls[0]);
+        unsigned const cMs = RT_MIN(slirp_get_timeout_ms(pNATState), cMsMax);
+        cChanged = poll(paPolls, nFDs, cMs);
+        if (cChanged >= 0)
+            slirp_select_poll(pNATState, &paPolls[0], nFDs);
+        RTMemFree(paPolls);
+    }
+
+    if (cChanged < 0 && errno == EINTR)
+        cChanged = 0;
+    if (cChanged >= 0)
+    {
+        /* Send the requests the output callback asked for. */
+        for (uint32_t iFlow = 0; iFlow < g_cFlows; iFlow++)
+            if (pShard->pafResend[iFlow])
+            {
+                pShard->pafResend[iFlow] = false;
+                tstSendRequest(pShard, iFlow);
+            }
+    }
+    return cChanged;
+}
+
+
+/**
+ * Runs the loop until the given number of replies has been received.
+ *
+ * @returns true if all replies arrived, false on timeout.
+ * @param   pShard      The shard.
+ * @param   cReplies    The total reply count to wait for.
+ */
+static bool tstLoopUntil(PTSTNATSHARD pShard, uint32_t cReplies)
+{
+    uint64_t const u64Start = RTTimeMilliTS();
+    while (pShard->cReplies < cReplies)
+    {
+        if (RTTimeMilliTS() - u64Start > 10000)
+            return false;
+        if (tstLoopOnce(pShard, 100) < 0)
+            return false;
+    }
+    return true;
+}
+
+
+/**
+ * The shard thread, plays the guest for the flows of the shard and runs the
+ * NAT event loop.
+ */
+static DECLCALLBACK(int) tstShardThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PTSTNATSHARD pShard = (PTSTNATSHARD)pvUser;
+    NOREF(hThreadSelf);
+
+    /*
+     * Open the flows, slirp creates a host socket for each of them.
+     */
+    slirp_set_ethaddr_and_activate_port_forwarding(pShard->pNATState, g_GuestMac.au8, RT_H2N_U32_C(TST_NAT_GUEST_IP));
+    for (uint32_t iFlow = 0; iFlow < g_cFlows; iFlow++)
+        if (g_paiFlowShard[iFlow] == pShard->iShard)
+            tstSendRequest(pShard, iFlow);
+    bool fOk = tstLoopUntil(pShard, pShard->cFlows);
+    if (!fOk)
+        RTTestFailed(g_hTest, "Shard #%u: only %u of %u flows got a reply\n", pShard->iShard, pShard->cReplies, pShard->cFlows);
+    ASMAtomicIncU32(&g_cReady);
+
+    /*
+     * Ping-pong on all the flows until told to stop.
+     */
+    RTSemEventMultiWait(g_hEvtStart, RT_INDEFINITE_WAIT);
+    if (fOk)
+    {
+        uint32_t const cBase       = pShard->cReplies;
+        uint64_t const u64CpuStart = tstThreadCpuNanoTS();
+        pShard->fPingPong = true;
+        for (uint32_t iFlow = 0; iFlow < g_cFlows; iFlow++)
+            if (g_paiFlowShard[iFlow] == pShard->iShard)
+                tstSendRequest(pShard, iFlow);
+        while (!ASMAtomicReadBool(&g_fStop))
+            if (tstLoopOnce(pShard, 100) < 0)
+            {
+                RTTestFailed(g_hTest, "Shard #%u: poll failed, errno=%d\n", pShard->iShard, errno);
+                break;
+            }
+        pShard->cNsCpu      = tstThreadCpuNanoTS() - u64CpuStart;
+        pShard->cRoundTrips = pShard->cReplies - cBase;
+
+        /* Every flow has one request in flight, collect the replies. */
+        pShard->fPingPong = false;
+        for (uint32_t iFlow = 0; iFlow < g_cFlows; iFlow++)
+            pShard->pafResend[iFlow] = false;
+        if (!tstLoopUntil(pShard, cBase + pShard->cRoundTrips + pShard->cFlows))
+            RTTestFailed(g_hTest, "Shard #%u: lost replies\n", pShard->iShard);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Runs the benchmark with the given number of shards.
+ *
+ * @returns VINF_SUCCESS, or VERR_NOT_AVAILABLE if slirp can't be set up in
+ *          this environment.
+ * @param   cShards         The number of shards.
+ * @param   cMsDuration     How long to measure.
+ * @param   pcRoundTripsPerSec  Where to return the aggregate round trip rate.
+ */
+static int tstRun(uint32_t cShards, uint32_t cMsDuration, uint64_t *pcRoundTripsPerSec)
+{
+    RTTestSubF(g_hTest, "%u shard(s)", cShards);
+    *pcRoundTripsPerSec = 0;
+
+    TSTNATSHARD aShards[TST_NAT_MAX_SHARDS];
+    RT_ZERO(aShards);
+    g_cReady = 0;
+    g_fStop  = false;
+    RTSemEventMultiReset(g_hEvtStart);
+
+    for (uint32_t iFlow = 0; iFlow < g_cFlows; iFlow++)
+    {
+        g_paiFlowShard[iFlow] = (uint8_t)tstSelectShard(iFlow, cShards);
+        aShards[g_paiFlowShard[iFlow]].cFlows++;
+    }
+
+    /*
+     * Create the slirp instances.
+     */
+    int      rc = VINF_SUCCESS;
+    uint32_t iShard;
+    for (iShard = 0; iShard < cShards; iShard++)
+    {
+        PTSTNATSHARD pShard = &aShards[iShard];
+        pShard->iShard    = iShard;
+        pShard->pafResend = (bool *)RTMemAllocZ(g_cFlows * sizeof(bool));
+        RTTESTI_CHECK_BREAK(pShard->pafResend);
+        rc = slirp_init(&pShard->pNATState, RT_H2N_U32_C(TST_NAT_NETWORK), TST_NAT_NETMASK,
+                        true /*fPassDomain*/, false /*fUseHostResolver*/, 0 /*i32AliasMode*/,
+                        100 /*iIcmpCacheLimit*/, pShard);
+        if (rc != VINF_SUCCESS)
+        {
+            /* VINF_NAT_DNS leaves slirp half initialized. */
+            RTTestPrintf(g_hTest, RTTESTLVL_ALWAYS, "slirp_init returned %Rrc\n", rc);
+            if (pShard->pNATState && RT_SUCCESS(rc))
+                slirp_term(pShard->pNATState);
+            pShard->pNATState = NULL;
+            rc = VERR_NOT_AVAILABLE;
+            break;
+        }
+    }
+
+    /*
+     * Start the shard threads, wait for them to open their flows, then
+     * measure for the given time.
+     */
+    uint32_t cThreads = 0;
+    if (rc == VINF_SUCCESS && !RTTestErrorCount(g_hTest))
+    {
+        for (iShard = 0; iShard < cShards; iShard++, cThreads++)
+        {
+            rc = RTThreadCreateF(&aShards[iShard].hThread, tstShardThread, &aShards[iShard], 0, RTTHREADTYPE_IO,
+                                 RTTHREADFLAGS_WAITABLE, "NATShard%u", iShard);
+            if (RT_FAILURE(rc))
+            {
+                RTTestFailed(g_hTest, "RTThreadCreateF -> %Rrc\n", rc);
+                break;
+            }
+        }
+        while (ASMAtomicReadU32(&g_cReady) < cThreads)
+            RTThreadSleep(10);
+
+        uint64_t const u64Start = RTTimeNanoTS();
+        RTSemEventMultiSignal(g_hEvtStart);
+        RTThreadSleep(cMsDuration);
+        ASMAtomicWriteBool(&g_fStop, true);
+        uint64_t const cNsElapsed = RTTimeNanoTS() - u64Start;
+        for (iShard = 0; iShard < cThreads; iShard++)
+            RTThreadWait(aShards[iShard].hThread, RT_INDEFINITE_WAIT, NULL);
+
+        /*
+         * Report.
+         */
+        uint64_t cRoundTrips = 0;
+        uint64_t cNsCpu      = 0;
+        uint32_t cMinFlows   = UINT32_MAX;
+        uint32_t cMaxFlows   = 0;
+        for (iShard = 0; iShard < cShards; iShard++)
+        {
+            cRoundTrips += aShards[iShard].cRoundTrips;
+            cNsCpu      += aShards[iShard].cNsCpu;
+            cMinFlows    = RT_MIN(cMinFlows, aShards[iShard].cFlows);
+            cMaxFlows    = RT_MAX(cMaxFlows, aShards[iShard].cFlows);
+            if (aShards[iShard].cUnexpected)
+                RTTestFailed(g_hTest, "Shard #%u: %u unexpected frames from slirp\n", iShard, aShards[iShard].cUnexpected);
+        }
+        if (cRoundTrips && cNsElapsed)
+        {
+            *pcRoundTripsPerSec = cRoundTrips * RT_NS_1SEC / cNsElapsed;
+            RTTestValueF(g_hTest, *pcRoundTripsPerSec, RTTESTUNIT_CALLS_PER_SEC, "%u shard(s) round trips", cShards);
+            RTTestValueF(g_hTest, cNsCpu / cRoundTrips, RTTESTUNIT_NS_PER_ROUND_TRIP, "%u shard(s) NAT CPU per round trip", cShards);
+            RTTestValueF(g_hTest, cMinFlows, RTTESTUNIT_OCCURRENCES, "%u shard(s) min flows per shard", cShards);
+            RTTestValueF(g_hTest, cMaxFlows, RTTESTUNIT_OCCURRENCES, "%u shard(s) max flows per shard", cShards);
+        }
+        else if (!RTTestErrorCount(g_hTest))
+            RTTestFailed(g_hTest, "No round trips completed\n");
+    }
+
+    for (iShard = 0; iShard < cShards; iShard++)
+    {
+        if (aShards[iShard].pNATState)
+            slirp_term(aShards[iShard].pNATState);
+        RTMemFree(aShards[iShard].pafResend);
+    }
+    RTTestSubDone(g_hTest);
+    return rc == VERR_NOT_AVAILABLE ? rc : VINF_SUCCESS;
+}
+
+
+int main(int argc, char **argv)
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstNATShards-1", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+
+    static RTGETOPTDEF const s_aOptions[] =
+    {
+        { "--shards",       'S', RTGETOPT_REQ_UINT32 },
+        { "--flows",        'f', RTGETOPT_REQ_UINT32 },
+        { "--duration",     'd', RTGETOPT_REQ_UINT32 },
+        { "--size",         's', RTGETOPT_REQ_UINT32 },
+    };
+
+    uint32_t cMaxShards  = 4;
+    uint32_t cMsDuration = 2000;
+
+    g_cFlows = 64;
+
+    int ch;
+    RTGETOPTUNION Value;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0 /* fFlags */);
+    while ((ch = RTGetOpt(&GetState, &Value)))
+        switch (ch)
+        {
+            case 'S':
+                cMaxShards = RT_MIN(RT_MAX(Value.u32, 1), TST_NAT_MAX_SHARDS);
+                break;
+
+            case 'f':
+                g_cFlows = Value.u32;
+                break;
+
+            case 'd':
+                cMsDuration = RT_MAX(Value.u32, 100);
+                break;
+
+            case 's':
+                g_cbMsg = RT_MIN(RT_MAX(Value.u32, 1), 1024);
+                break;
+
+            case 'h':
+                RTPrintf("syntax: tstNATShards-1 [--shards <max>] [--flows <N>] [--duration <ms>] [--size <bytes>]\n");
+                return RTEXITCODE_SUCCESS;
+
+            default:
+                return RTGetOptPrintError(ch, &Value);
+        }
+    if (!g_cFlows)
+        return RTTestSkipAndDestroy(g_hTest, "No flows");
+    if (g_cFlows > 20000)
+        return RTGetOptPrintError(VERR_OUT_OF_RANGE, &Value);
+
+    RTTestBanner(g_hTest);
+    RTTestPrintf(g_hTest, RTTESTLVL_ALWAYS, "%u flows, up to %u shards, %u ms each, %u byte datagrams\n",
+                 g_cFlows, cMaxShards, cMsDuration, g_cbMsg);
+
+    /* One slirp socket per flow and shard plus the echo server and slirp's own. */
+    struct rlimit Limit;
+    if (   !getrlimit(RLIMIT_NOFILE, &Limit)
+        && Limit.rlim_cur < g_cFlows + 64 * TST_NAT_MAX_SHARDS)
+    {
+        Limit.rlim_cur = RT_MIN(Limit.rlim_max, g_cFlows + 64 * TST_NAT_MAX_SHARDS);
+        setrlimit(RLIMIT_NOFILE, &Limit);
+    }
+
+    g_paiFlowShard = (uint8_t *)RTMemAllocZ(g_cFlows);
+    RTTESTI_CHECK_RET(g_paiFlowShard, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RC_RET(RTSemEventMultiCreate(&g_hEvtStart), VINF_SUCCESS, RTTestSummaryAndDestroy(g_hTest));
+
+    /*
+     * Start the echo servers on the host loopback, one thread per shard so
+     * they don't end up being the bottleneck.
+     */
+    struct sockaddr_in Addr;
+    RT_ZERO(Addr);
+    Addr.sin_family      = AF_INET;
+    Addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t cbAddr     = sizeof(Addr);
+    g_iEchoFd = socket(AF_INET, SOCK_DGRAM, 0);
+    RTTESTI_CHECK_RET(g_iEchoFd >= 0, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RET(bind(g_iEchoFd, (struct sockaddr *)&Addr, sizeof(Addr)) == 0, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RET(getsockname(g_iEchoFd, (struct sockaddr *)&Addr, &cbAddr) == 0, RTTestSummaryAndDestroy(g_hTest));
+    RTTESTI_CHECK_RET(pipe(g_aiStopPipe) == 0, RTTestSummaryAndDestroy(g_hTest));
+    g_uEchoPort = RT_N2H_U16(Addr.sin_port);
+
+    RTTHREAD ahEchoThreads[TST_NAT_MAX_SHARDS];
+    uint32_t cEchoThreads;
+    for (cEchoThreads = 0; cEchoThreads < cMaxShards; cEchoThreads++)
+        RTTESTI_CHECK_RC_BREAK(RTThreadCreateF(&ahEchoThreads[cEchoThreads], tstEchoServerThread, NULL, 0, RTTHREADTYPE_IO,
+                                               RTTHREADFLAGS_WAITABLE, "EchoSrv%u", cEchoThreads),
+                               VINF_SUCCESS);
+
+    /*
+     * 1, 2, 4, ... shards.
+     */
+    uint64_t cRoundTripsPerSec1 = 0;
+    int      rc                 = VINF_SUCCESS;
+    for (uint32_t cShards = 1; cShards <= cMaxShards && rc == VINF_SUCCESS && !RTTestErrorCount(g_hTest); cShards *= 2)
+    {
+        uint64_t cRoundTripsPerSec;
+        rc = tstRun(cShards, cMsDuration, &cRoundTripsPerSec);
+        if (cShards == 1)
+            cRoundTripsPerSec1 = cRoundTripsPerSec;
+        else if (cRoundTripsPerSec1)
+            RTTestValueF(g_hTest, cRoundTripsPerSec * 100 / cRoundTripsPerSec1, RTTESTUNIT_PCT,
+                         "%u shard(s) vs. 1 shard", cShards);
+    }
+
+    /*
+     * Cleanup.
+     */
+    write(g_aiStopPipe[1], "", 1);
+    for (uint32_t i = 0; i < cEchoThreads; i++)
+        RTThreadWait(ahEchoThreads[i], RT_INDEFINITE_WAIT, NULL);
+    close(g_aiStopPipe[0]);
+    close(g_aiStopPipe[1]);
+    close(g_iEchoFd);
+    RTSemEventMultiDestroy(g_hEvtStart);
+    RTMemFree(g_paiFlowShard);
+
+    if (rc == VERR_NOT_AVAILABLE)
+        return RTTestSkipAndDestroy(g_hTest, "slirp could not be initialized");
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -0,0 +1,430 @@
+/* $Id$ */
+/** @file
+ * Receive side TCP segment coalescing testcase.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include "../NetRxCoalesce.h"
+
+#include <VBox/vmm/pdmnetinline.h>
+#include <iprt/test.h>
+#include <iprt/err.h>
+#include <iprt/net.h>
+#include <iprt/string.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The MSS used by the test flows. */
+#define TST_MSS             1460
+/** The size of the TCP options of the test flows (NOP, NOP, timestamp). */
+#define TST_TCP_OPT_SIZE    12
+/** The size of the headers of an IPv4 segment of the test flows. */
+#define TST_IPV4_HDRS_SIZE  (sizeof(RTNETETHERHDR) + RTNETIPV4_MIN_LEN + RTNETTCP_MIN_LEN + TST_TCP_OPT_SIZE)
+/** The initial sequence number of the test flows, wraps after a few segments. */
+#define TST_SEQ             UINT32_C(0xfffff000)
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * What the delivery callback saw.
+ */
+typedef struct TSTDELIVERY
+{
+    /** Whether to refuse GSO frames like a device without the offload. */
+    bool            fRefuseGso;
+    /** Number of ordinary frames delivered. */
+    uint32_t        cFrames;
+    /** Number of GSO frames delivered (including refused ones). */
+    uint32_t        cGsoFrames;
+    /** Sum of the sizes of all the frames delivered. */
+    size_t          cbTotal;
+    /** The size of the last frame. */
+    size_t          cbLast;
+    /** The segmentation context of the last GSO frame. */
+    PDMNETWORKGSO   GsoLast;
+    /** Copy of the last frame. */
+    uint8_t         abLast[NETRXCOALESCE_MAX_FRAME];
+} TSTDELIVERY;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The test handle. */
+static RTTEST           g_hTest;
+/** The delivery record. */
+static TSTDELIVERY      g_Delivery;
+/** The coalescer under test. */
+static NETRXCOALESCE    g_RxCoalesce;
+/** Frame scratch buffer. */
+static uint8_t          g_abFrame[2048];
+
+
+/**
+ * @callback_method_impl{FNNETRXCOALESCEDELIVER}
+ */
+static DECLCALLBACK(int) tstDeliver(void *pvUser, const void *pvFrame, size_t cbFrame, PCPDMNETWORKGSO pGso)
+{
+    TSTDELIVERY *pDelivery = (TSTDELIVERY *)pvUser;
+    RTTESTI_CHECK_RET(cbFrame <= sizeof(pDelivery->abLast), VERR_BUFFER_OVERFLOW);
+    if (pGso)
+    {
+        pDelivery->cGsoFrames++;
+        pDelivery->GsoLast = *pGso;
+        if (pDelivery->fRefuseGso)
+            return VERR_NOT_SUPPORTED;
+    }
+    else
+        pDelivery->cFrames++;
+    pDelivery->cbTotal += cbFrame;
+    pDelivery->cbLast   = cbFrame;
+    memcpy(pDelivery->abLast, pvFrame, cbFrame);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Builds a TCP segment of the test flow.
+ *
+ * The payload bytes are the low bytes of their sequence numbers, so merged
+ * payload can be verified without keeping the segments around.
+ *
+ * @returns The frame size.
+ * @param   pbFrame     Where to build the frame.
+ * @param   fIPv6       IPv6 instead of IPv4.
+ * @param   uSeq        The sequence number.
+ * @param   cbPayload   The payload size.
+ * @param   fFlags      The TCP flags.
+ * @param   uSrcPort    The source port.
+ */
+static size_t tstBuildSeg(uint8_t *pbFrame, bool fIPv6, uint32_t uSeq, uint32_t cbPayload, uint8_t fFlags, uint16_t uSrcPort)
+{
+    static const RTMAC s_DstMac = { { 0x08, 0x00, 0x27, 0x01, 0x02, 0x03 } };
+    static const RTMAC s_SrcMac = { { 0x52, 0x54, 0x00, 0x12, 0x35, 0x02 } };
+
+    PRTNETETHERHDR pEthHdr = (PRTNETETHERHDR)pbFrame;
+    pEthHdr->DstMac    = s_DstMac;
+    pEthHdr->SrcMac    = s_SrcMac;
+    pEthHdr->EtherType = fIPv6 ? RT_H2N_U16_C(RTNET_ETHERTYPE_IPV6) : RT_H2N_U16_C(RTNET_ETHERTYPE_IPV4);
+
+    uint32_t const offTcpHdr = sizeof(RTNETETHERHDR) + (fIPv6 ? RTNETIPV6_MIN_LEN : RTNETIPV4_MIN_LEN);
+    uint32_t const cbTcp     = RTNETTCP_MIN_LEN + TST_TCP_OPT_SIZE + cbPayload;
+    PRTNETTCP      pTcpHdr   = (PRTNETTCP)&pbFrame[offTcpHdr];
+    RT_BZERO(pTcpHdr, RTNETTCP_MIN_LEN);
+    pTcpHdr->th_sport = RT_H2N_U16(uSrcPort);
+    pTcpHdr->th_dport = RT_H2N_U16_C(80);
+    pTcpHdr->th_seq   = RT_H2N_U32(uSeq);
+    pTcpHdr->th_ack   = RT_H2N_U32_C(0x1000);
+    pTcpHdr->th_off   = (RTNETTCP_MIN_LEN + TST_TCP_OPT_SIZE) / 4;
+    pTcpHdr->th_flags = fFlags;
+    pTcpHdr->th_win   = RT_H2N_U16_C(0xffff);
+
+    uint8_t *pbOpt = (uint8_t *)(pTcpHdr + 1);
+    pbOpt[0] = 1;                       /* NOP */
+    pbOpt[1] = 1;                       /* NOP */
+    pbOpt[2] = 8;                       /* timestamp */
+    pbOpt[3] = 10;
+    *(uint32_t *)&pbOpt[4] = RT_H2N_U32_C(0x11223344);
+    *(uint32_t *)&pbOpt[8] = RT_H2N_U32_C(0x55667788);
+
+    uint8_t *pbPayload = pbOpt + TST_TCP_OPT_SIZE;
+    for (uint32_t off = 0; off < cbPayload; off++)
+        pbPayload[off] = (uint8_t)(uSeq + off);
+
+    if (!fIPv6)
+    {
+        PRTNETIPV4 pIpHdr = (PRTNETIPV4)(pEthHdr + 1);
+        RT_BZERO(pIpHdr, RTNETIPV4_MIN_LEN);
+        pIpHdr->ip_v     = 4;
+        pIpHdr->ip_hl    = RTNETIPV4_MIN_LEN / 4;
+        pIpHdr->ip_len   = RT_H2N_U16((uint16_t)(RTNETIPV4_MIN_LEN + cbTcp));
+        pIpHdr->ip_off   = RT_H2N_U16_C(RTNETIPV4_FLAGS_DF);
+        pIpHdr->ip_ttl   = 64;
+        pIpHdr->ip_p     = RTNETIPV4_PROT_TCP;
+        pIpHdr->ip_src.u = RT_H2N_U32_C(0x0a000001);
+        pIpHdr->ip_dst.u = RT_H2N_U32_C(0x0a000002);
+        pIpHdr->ip_sum   = RTNetIPv4HdrChecksum(pIpHdr);
+        pTcpHdr->th_sum  = RTNetIPv4TCPChecksum(pIpHdr, pTcpHdr, NULL);
+    }
+    else
+    {
+        PRTNETIPV6 pIp6Hdr = (PRTNETIPV6)(pEthHdr + 1);
+        RT_BZERO(pIp6Hdr, RTNETIPV6_MIN_LEN);
+        pIp6Hdr->ip6_vfc  = RT_H2N_U32_C(0x60000000);
+        pIp6Hdr->ip6_plen = RT_H2N_U16((uint16_t)cbTcp);
+        pIp6Hdr->ip6_nxt  = RTNETIPV4_PROT_TCP;
+        pIp6Hdr->ip6_hlim = 64;
+        pIp6Hdr->ip6_src.au8[0]  = 0xfe;
+        pIp6Hdr->ip6_src.au8[1]  = 0x80;
+        pIp6Hdr->ip6_src.au8[15] = 1;
+        pIp6Hdr->ip6_dst.au8[0]  = 0xfe;
+        pIp6Hdr->ip6_dst.au8[1]  = 0x80;
+        pIp6Hdr->ip6_dst.au8[15] = 2;
+        pTcpHdr->th_sum = RTNetTCPChecksum(RTNetIPv6PseudoChecksum(pIp6Hdr), pTcpHdr, pbPayload, cbPayload);
+    }
+
+    return offTcpHdr + cbTcp;
+}
+
+
+/**
+ * Offers a segment of the test flow to the coalescer.
+ *
+ * @returns What NetRxCoalesceAdd returned.
+ */
+static bool tstAddSeg(bool fIPv6, uint32_t uSeq, uint32_t cbPayload, uint8_t fFlags, uint16_t uSrcPort)
+{
+    size_t cbFrame = tstBuildSeg(g_abFrame, fIPv6, uSeq, cbPayload, fFlags, uSrcPort);
+    return NetRxCoalesceAdd(&g_RxCoalesce, g_abFrame, cbFrame);
+}
+
+
+/**
+ * Starts a subtest with a fresh coalescer and delivery record.
+ */
+static void tstReset(const char *pszSubTest)
+{
+    RTTestSub(g_hTest, pszSubTest);
+    NetRxCoalesceTerm(&g_RxCoalesce);
+    RT_ZERO(g_RxCoalesce);
+    RT_ZERO(g_Delivery);
+    RTTESTI_CHECK_RC(NetRxCoalesceInit(&g_RxCoalesce, tstDeliver, &g_Delivery), VINF_SUCCESS);
+}
+
+
+/**
+ * Checks the GSO frame delivered last.
+ *
+ * @param   fIPv6       Whether it should be IPv6.
+ * @param   cbPayload   The expected payload size.
+ */
+static void tstCheckGsoFrame(bool fIPv6, uint32_t cbPayload)
+{
+    uint32_t const offTcpHdr = sizeof(RTNETETHERHDR) + (fIPv6 ? RTNETIPV6_MIN_LEN : RTNETIPV4_MIN_LEN);
+    uint32_t const cbHdrs    = offTcpHdr + RTNETTCP_MIN_LEN + TST_TCP_OPT_SIZE;
+    PCPDMNETWORKGSO pGso     = &g_Delivery.GsoLast;
+
+    RTTESTI_CHECK(g_Delivery.cbLast == cbHdrs + cbPayload);
+    RTTESTI_CHECK(pGso->u8Type == (fIPv6 ? PDMNETWORKGSOTYPE_IPV6_TCP : PDMNETWORKGSOTYPE_IPV4_TCP));
+    RTTESTI_CHECK(pGso->cbMaxSeg == TST_MSS);
+    RTTESTI_CHECK(pGso->cbHdrsTotal == cbHdrs);
+    RTTESTI_CHECK(pGso->offHdr1 == sizeof(RTNETETHERHDR));
+    RTTESTI_CHECK(pGso->offHdr2 == offTcpHdr);
+    RTTESTI_CHECK(PDMNetGsoIsValid(pGso, sizeof(*pGso), g_Delivery.cbLast));
+
+    if (!fIPv6)
+    {
+        PCRTNETIPV4 pIpHdr = (PCRTNETIPV4)&g_Delivery.abLast[sizeof(RTNETETHERHDR)];
+        RTTESTI_CHECK(RT_N2H_U16(pIpHdr->ip_len) == g_Delivery.cbLast - sizeof(RTNETETHERHDR));
+        RTTESTI_CHECK(RTNetIPv4IsHdrValid(pIpHdr, RTNETIPV4_MIN_LEN, g_Delivery.cbLast - sizeof(RTNETETHERHDR),
+                                          true /*fChecksum*/));
+    }
+    else
+    {
+        PCRTNETIPV6 pIp6Hdr = (PCRTNETIPV6)&g_Delivery.abLast[sizeof(RTNETETHERHDR)];
+        RTTESTI_CHECK(RT_N2H_U16(pIp6Hdr->ip6_plen) == g_Delivery.cbLast - offTcpHdr);
+    }
+
+    PCRTNETTCP pTcpHdr = (PCRTNETTCP)&g_Delivery.abLast[offTcpHdr];
+    RTTESTI_CHECK(RT_N2H_U32(pTcpHdr->th_seq) == TST_SEQ);
+    for (uint32_t off = 0; off < cbPayload; off++)
+        if (g_Delivery.abLast[cbHdrs + off] != (uint8_t)(TST_SEQ + off))
+        {
+            RTTestFailed(g_hTest, "Payload mismatch at offset %#x\n", off);
+            break;
+        }
+}
+
+
+/**
+ * Full sized segments followed by a pushed short one become one GSO frame.
+ */
+static void tstMerge(bool fIPv6)
+{
+    tstReset(fIPv6 ? "Merge IPv6" : "Merge IPv4");
+
+    uint32_t uSeq = TST_SEQ;
+    for (unsigned i = 0; i < 10; i++, uSeq += TST_MSS)
+        RTTESTI_CHECK(tstAddSeg(fIPv6, uSeq, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(g_Delivery.cFrames == 0 && g_Delivery.cGsoFrames == 0);
+
+    /* The push ends the aggregate. */
+    RTTESTI_CHECK(tstAddSeg(fIPv6, uSeq, 100, RTNETTCP_F_ACK | RTNETTCP_F_PSH, 1234));
+    RTTESTI_CHECK(g_Delivery.cFrames == 0);
+    RTTESTI_CHECK(g_Delivery.cGsoFrames == 1);
+    tstCheckGsoFrame(fIPv6, 10 * TST_MSS + 100);
+
+    uint32_t const offTcpHdr = sizeof(RTNETETHERHDR) + (fIPv6 ? RTNETIPV6_MIN_LEN : RTNETIPV4_MIN_LEN);
+    RTTESTI_CHECK(((PCRTNETTCP)&g_Delivery.abLast[offTcpHdr])->th_flags & RTNETTCP_F_PSH);
+    RTTESTI_CHECK(g_RxCoalesce.StatGsoFrames.c == 1);
+    RTTESTI_CHECK(g_RxCoalesce.StatSegsMerged.c == 11);
+
+    /* Nothing left behind. */
+    RTTESTI_CHECK_RC(NetRxCoalesceFlush(&g_RxCoalesce), VINF_SUCCESS);
+    RTTESTI_CHECK(g_Delivery.cFrames == 0 && g_Delivery.cGsoFrames == 1);
+}
+
+
+/**
+ * Frames which don't continue the held flow flush it first.
+ */
+static void tstBreakFlow(void)
+{
+    tstReset("Flow breaks");
+
+    /* A single held segment is delivered the way it came in. */
+    RTTESTI_CHECK(tstAddSeg(false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK_RC(NetRxCoalesceFlush(&g_RxCoalesce), VINF_SUCCESS);
+    RTTESTI_CHECK(g_Delivery.cFrames == 1 && g_Delivery.cGsoFrames == 0);
+    size_t cbFrame = tstBuildSeg(g_abFrame, false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK, 1234);
+    RTTESTI_CHECK(g_Delivery.cbLast == cbFrame && !memcmp(g_Delivery.abLast, g_abFrame, cbFrame));
+
+    /* Out of order. */
+    RTTESTI_CHECK(tstAddSeg(false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(tstAddSeg(false, TST_SEQ + 2 * TST_MSS, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(g_Delivery.cFrames == 2);
+
+    /* Another connection. */
+    RTTESTI_CHECK(tstAddSeg(false, TST_SEQ + 3 * TST_MSS, TST_MSS, RTNETTCP_F_ACK, 4321));
+    RTTESTI_CHECK(g_Delivery.cFrames == 3);
+
+    /* Not TCP, the caller has to deliver it after the held segment. */
+    RT_BZERO(g_abFrame, 64);
+    ((PRTNETETHERHDR)g_abFrame)->EtherType = RT_H2N_U16_C(RTNET_ETHERTYPE_ARP);
+    RTTESTI_CHECK(!NetRxCoalesceAdd(&g_RxCoalesce, g_abFrame, 64));
+    RTTESTI_CHECK(g_Delivery.cFrames == 4);
+
+    /* SYN and FIN segments are never held. */
+    RTTESTI_CHECK(!tstAddSeg(false, TST_SEQ, 0, RTNETTCP_F_SYN, 1234));
+    RTTESTI_CHECK(!tstAddSeg(false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK | RTNETTCP_F_FIN, 1234));
+
+    /* Neither is a segment with a bad checksum. */
+    cbFrame = tstBuildSeg(g_abFrame, false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK, 1234);
+    g_abFrame[cbFrame - 1] ^= 0xff;
+    RTTESTI_CHECK(!NetRxCoalesceAdd(&g_RxCoalesce, g_abFrame, cbFrame));
+
+    RTTESTI_CHECK(g_Delivery.cFrames == 4 && g_Delivery.cGsoFrames == 0);
+    RTTESTI_CHECK(g_RxCoalesce.StatGsoFrames.c == 0);
+}
+
+
+/**
+ * The aggregate is delivered before it outgrows the largest GSO frame.
+ */
+static void tstFull(void)
+{
+    tstReset("Full");
+
+    unsigned const cSegsMax = (NETRXCOALESCE_MAX_FRAME - TST_IPV4_HDRS_SIZE) / TST_MSS;
+    uint32_t       uSeq     = TST_SEQ;
+    for (unsigned i = 0; i < cSegsMax; i++, uSeq += TST_MSS)
+        RTTESTI_CHECK(tstAddSeg(false, uSeq, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(g_Delivery.cGsoFrames == 1);
+    RTTESTI_CHECK(g_Delivery.cbLast <= NETRXCOALESCE_MAX_FRAME);
+    tstCheckGsoFrame(false, cSegsMax * TST_MSS);
+}
+
+
+/**
+ * A device refusing the GSO frame gets the original segments and a break.
+ */
+static void tstRefused(void)
+{
+    tstReset("Refused");
+    g_Delivery.fRefuseGso = true;
+
+    uint32_t uSeq = TST_SEQ;
+    for (unsigned i = 0; i < 4; i++, uSeq += TST_MSS)
+        RTTESTI_CHECK(tstAddSeg(false, uSeq, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK_RC(NetRxCoalesceFlush(&g_RxCoalesce), VINF_SUCCESS);
+    RTTESTI_CHECK(g_Delivery.cGsoFrames == 1);
+    RTTESTI_CHECK(g_Delivery.cFrames == 4);
+    size_t const cbSegFrame = tstBuildSeg(g_abFrame, false, uSeq - TST_MSS, TST_MSS, RTNETTCP_F_ACK, 1234);
+    RTTESTI_CHECK(g_Delivery.cbTotal == 4 * cbSegFrame);
+    RTTESTI_CHECK(g_Delivery.cbLast == cbSegFrame);
+    RTTESTI_CHECK(!memcmp(&g_Delivery.abLast[cbSegFrame - TST_MSS], &g_abFrame[cbSegFrame - TST_MSS], TST_MSS));
+    RTTESTI_CHECK(g_RxCoalesce.StatRefused.c == 1);
+    RTTESTI_CHECK(g_RxCoalesce.StatGsoFrames.c == 0);
+
+    /* Backing off. */
+    RTTESTI_CHECK(!tstAddSeg(false, uSeq, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(g_Delivery.cGsoFrames == 1);
+}
+
+
+/**
+ * Discarding drops what's held, e.g. on link down.
+ */
+static void tstDiscard(void)
+{
+    tstReset("Discard");
+
+    uint32_t uSeq = TST_SEQ;
+    for (unsigned i = 0; i < 3; i++, uSeq += TST_MSS)
+        RTTESTI_CHECK(tstAddSeg(false, uSeq, TST_MSS, RTNETTCP_F_ACK, 1234));
+    NetRxCoalesceDiscard(&g_RxCoalesce);
+    RTTESTI_CHECK_RC(NetRxCoalesceFlush(&g_RxCoalesce), VINF_SUCCESS);
+    RTTESTI_CHECK(g_Delivery.cFrames == 0 && g_Delivery.cGsoFrames == 0);
+
+    /* And it starts over cleanly. */
+    RTTESTI_CHECK(tstAddSeg(false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(tstAddSeg(false, TST_SEQ + TST_MSS, 10, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK(g_Delivery.cGsoFrames == 1);
+    tstCheckGsoFrame(false, TST_MSS + 10);
+}
+
+
+/**
+ * Without NetRxCoalesceInit everything passes thru.
+ */
+static void tstDisabled(void)
+{
+    RTTestSub(g_hTest, "Disabled");
+    NetRxCoalesceTerm(&g_RxCoalesce);
+    RT_ZERO(g_RxCoalesce);
+    RT_ZERO(g_Delivery);
+
+    RTTESTI_CHECK(!tstAddSeg(false, TST_SEQ, TST_MSS, RTNETTCP_F_ACK, 1234));
+    RTTESTI_CHECK_RC(NetRxCoalesceFlush(&g_RxCoalesce), VINF_SUCCESS);
+    NetRxCoalesceDiscard(&g_RxCoalesce);
+    RTTESTI_CHECK(g_Delivery.cFrames == 0 && g_Delivery.cGsoFrames == 0);
+}
+
+
+int main()
+{
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstNetRxCoalesce", &g_hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(g_hTest);
+
+    tstMerge(false /*fIPv6*/);
+    tstMerge(true /*fIPv6*/);
+    tstBreakFlow();
+    tstFull();
+    tstRefused();
+    tstDiscard();
+    tstDisabled();
+
+    NetRxCoalesceTerm(&g_RxCoalesce);
+    return RTTestSummaryAndDestroy(g_hTest);
+}
@@ -0,0 +1,1553 @@
+/* $Id$ */
+/** @file
+ * DevVirtioBlk - Virtio Block Device
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_DEV_VIRTIO
+
+#include <VBox/vmm/pdmdev.h>
+#include <VBox/sup.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/uuid.h>
+#include "VBoxDD.h"
+#include "../VirtIO/Virtio.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+#define INSTANCE(pThis) pThis->VPCI.szInstance
+
+#define VBLK_PCI_SUBSYSTEM_ID        1 + VIRTIO_BLK_ID
+#define VBLK_PCI_CLASS               0x0180
+#define VBLK_NAME_FMT                "VBlk%d"
+
+/** Maximum number of request queues. */
+#define VBLK_MAX_QUEUES              VIRTIO_MAX_NQUEUES
+/** Default number of descriptors per request queue. */
+#define VBLK_QUEUE_SIZE_DEFAULT      128
+/** Number of requests the I/O thread completes before publishing them to the guest. */
+#define VBLK_SYNC_BATCH_MAX          8
+/** Default upper bound of the interrupt delay, microseconds. */
+#define VBLK_INT_DELAY_MAX_DEFAULT   50
+/** Largest configurable interrupt delay, microseconds. */
+#define VBLK_INT_DELAY_MAX_LIMIT     10000
+/** The sector size the guest addresses the disk with. */
+#define VBLK_SECTOR_SHIFT            9
+/** Largest data transfer of a single request, bigger requests fail. */
+#define VBLK_MAX_TRANSFER            (32 * _1M)
+/** Maximum number of ranges in a discard request. */
+#define VBLK_MAX_DISCARD_SEGS        256
+/** Maximum number of sectors of a single discard range. */
+#define VBLK_MAX_DISCARD_SECTORS     UINT32_C(0x003fffff)
+/** Length of the device ID returned by VBLK_T_GET_ID. */
+#define VBLK_ID_BYTES                20
+/** Maximum number of I/O errors which are logged to the release log. */
+#define VBLK_MAX_LOG_REL_ERRORS      1024
+
+/** @name Virtio block features
+ * @{  */
+#define VBLK_F_SEG_MAX     0x00000004  /**< Maximum number of segments given in config. */
+#define VBLK_F_RO          0x00000020  /**< Disk is read-only. */
+#define VBLK_F_BLK_SIZE    0x00000040  /**< Block size of disk given in config. */
+#define VBLK_F_FLUSH       0x00000200  /**< Cache flush command support. */
+#define VBLK_F_MQ          0x00001000  /**< Multiple request queues. */
+#define VBLK_F_DISCARD     0x00002000  /**< Discard command support. */
+/** @} */
+
+/** @name Virtio block request types
+ * @{ */
+#define VBLK_T_IN          0
+#define VBLK_T_OUT         1
+#define VBLK_T_FLUSH       4
+#define VBLK_T_GET_ID      8
+#define VBLK_T_DISCARD     11
+/** @} */
+
+/** @name Virtio block request status
+ * @{ */
+#define VBLK_S_OK          0
+#define VBLK_S_IOERR       1
+#define VBLK_S_UNSUPP      2
+/** @} */
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+#pragma pack(1)
+/**
+ * The device specific configuration space.
+ */
+typedef struct VBlkPCIConfig
+{
+    uint64_t uCapacity;                 /**< Capacity in 512 byte sectors. */
+    uint32_t cbSizeMax;                 /**< Maximum segment size. */
+    uint32_t cSegMax;                   /**< Maximum number of segments per request. */
+    uint16_t cCylinders;                /**< Geometry: cylinders. */
+    uint8_t  cHeads;                    /**< Geometry: heads. */
+    uint8_t  cSectors;                  /**< Geometry: sectors. */
+    uint32_t cbBlock;                   /**< Logical block size. */
+    uint8_t  uPhysBlockExp;             /**< Topology: physical blocks per logical block (log2). */
+    uint8_t  uAlignmentOffset;          /**< Topology: offset of first aligned logical block. */
+    uint16_t cMinIoBlocks;              /**< Topology: minimum I/O size in blocks. */
+    uint32_t cOptIoBlocks;              /**< Topology: optimal I/O size in blocks. */
+    uint8_t  fWriteback;                /**< Cache mode. */
+    uint8_t  bUnused0;
+    uint16_t cQueues;                   /**< Number of request queues. */
+    uint32_t cMaxDiscardSectors;        /**< Maximum sectors of one discard range. */
+    uint32_t cMaxDiscardSegs;           /**< Maximum ranges of one discard request. */
+    uint32_t cDiscardSectorAlignment;   /**< Discard granularity in sectors. */
+    uint32_t cMaxWriteZeroesSectors;
+    uint32_t cMaxWriteZeroesSegs;
+    uint8_t  fWriteZeroesMayUnmap;
+    uint8_t  abUnused1[3];
+} VBLKPCICONFIG;
+
+/**
+ * The header leading every request.
+ */
+typedef struct VBlkReqHdr
+{
+    uint32_t uType;                     /**< Request type, VBLK_T_XXX. */
+    uint32_t uReserved;
+    uint64_t uSector;                   /**< Start sector of a read or write. */
+} VBLKREQHDR;
+
+/**
+ * A range in the payload of a discard request.
+ */
+typedef struct VBlkDiscardSeg
+{
+    uint64_t uSector;                   /**< Start sector. */
+    uint32_t cSectors;                  /**< Number of sectors. */
+    uint32_t fFlags;                    /**< Flags, must be 0 for discard. */
+} VBLKDISCARDSEG;
+#pragma pack()
+AssertCompileSize(VBLKPCICONFIG, 60);
+AssertCompileMemberOffset(VBLKPCICONFIG, cQueues, 34);
+AssertCompileSize(VBLKREQHDR, 16);
+AssertCompileSize(VBLKDISCARDSEG, 16);
+
+/** Pointer to the device state. */
+typedef struct VBlkState_st *PVBLKSTATE;
+
+/**
+ * A request queue and the I/O thread serving it.
+ */
+typedef struct VBLKQUEUE
+{
+    /** The device state. */
+    R3PTRTYPE(PVBLKSTATE)   pThis;
+    /** The virtio queue. */
+    R3PTRTYPE(PVQUEUE)      pQueue;
+    /** The I/O thread processing the queue. */
+    R3PTRTYPE(PPDMTHREAD)   pThread;
+    /** Scratch element the I/O thread fetches descriptor chains into. */
+    R3PTRTYPE(PVQUEUEELEM)  pElem;
+    /** Event semaphore the I/O thread waits on. */
+    SUPSEMEVENT             hEvtProcess;
+    /** Flag whether the I/O thread is waiting for work. */
+    bool volatile           fSleeping;
+    /** Flag whether the guest notified the queue since it was last processed. */
+    bool volatile           fNotified;
+    /** Number of chains the I/O thread returned without syncing the used ring,
+     * protected by the VPCI critical section. */
+    uint32_t                cSyncPending;
+    /** Name of the queue. */
+    char                    szName[8];
+    /** Number of requests submitted from this queue. */
+    STAMCOUNTER             StatReqs;
+} VBLKQUEUE;
+/** Pointer to a request queue. */
+typedef VBLKQUEUE *PVBLKQUEUE;
+
+/**
+ * Device state structure. Holds the current state of device.
+ *
+ * @extends     VPCISTATE
+ * @implements  PDMIBLOCKPORT
+ * @implements  PDMIBLOCKASYNCPORT
+ */
+typedef struct VBlkState_st
+{
+    /* VPCISTATE must be the first member! */
+    VPCISTATE               VPCI;
+
+    /** The block port interface. */
+    PDMIBLOCKPORT           IPort;
+    /** The asynchronous block port interface. */
+    PDMIBLOCKASYNCPORT      IPortAsync;
+    /** The attached block driver. */
+    R3PTRTYPE(PPDMIBASE)    pDrvBase;
+    /** The block interface of the attached driver. */
+    R3PTRTYPE(PPDMIBLOCK)   pDrvBlock;
+    /** The asynchronous block interface of the attached driver, NULL if not used. */
+    R3PTRTYPE(PPDMIBLOCKASYNC) pDrvBlockAsync;
+    /** The support driver session handle. */
+    R3PTRTYPE(PSUPDRVSESSION) pSupDrvSession;
+
+    /** PCI config area. */
+    VBLKPCICONFIG           config;
+    /** Number of request queues. */
+    uint32_t                cQueues;
+    /** Number of descriptors per request queue. */
+    uint32_t                cQueueSize;
+    /** The medium is read-only. */
+    bool                    fReadOnly;
+    /** The medium supports discarding ranges. */
+    bool                    fDiscard;
+    /** The I/O threads don't fetch new requests from the queues. */
+    bool volatile           fQuiescing;
+    /** Indicates that PDMDevHlpAsyncNotificationCompleted should be called when
+     * the last active request completes. */
+    bool volatile           fSignalIdle;
+    /** Number of active requests, including I/O threads fetching requests. */
+    uint32_t volatile       cReqsActive;
+    /** Incremented on every reset, requests of an older generation complete
+     * without touching guest memory. */
+    uint32_t volatile       uResetGen;
+    /** Number of I/O errors. */
+    uint32_t volatile       cErrors;
+    /** The device ID returned to the guest. */
+    char                    szSerialNumber[VBLK_ID_BYTES + 1];
+
+    /** The request queues. */
+    VBLKQUEUE               aQueues[VBLK_MAX_QUEUES];
+
+    /** @name Statistic
+     * @{ */
+    STAMCOUNTER             StatBytesRead;
+    STAMCOUNTER             StatBytesWritten;
+    STAMCOUNTER             StatReqsFlush;
+    STAMCOUNTER             StatReqsDiscard;
+    STAMCOUNTER             StatReqsAsync;
+    /** @}  */
+} VBLKSTATE;
+/** Pointer to a virtio block device state. */
+typedef VBLKSTATE *PVBLKSTATE;
+
+/**
+ * An active request.
+ */
+typedef struct VBLKREQ
+{
+    /** The queue the request was taken from. */
+    PVBLKQUEUE              pBlkQueue;
+    /** Index of the head descriptor. */
+    uint32_t                uIndex;
+    /** Reset generation the request was fetched in. */
+    uint32_t                uGen;
+    /** The request type. */
+    uint32_t                uType;
+    /** The status returned to the guest if the request succeeds. */
+    uint8_t                 bStatus;
+    /** Number of bytes written into the IN segments, excluding the status. */
+    uint32_t                cbIn;
+    /** Bounce buffer for the data. */
+    RTSGSEG                 DataSeg;
+    /** Ranges of a discard request. */
+    PRTRANGE                paRanges;
+    /** Number of ranges. */
+    unsigned                cRanges;
+    /** Guest address of the status byte. */
+    RTGCPHYS                GCPhysStatus;
+    /** Number of IN data segments. */
+    uint32_t                cSegsIn;
+    /** The IN data segments, without the status byte. */
+    VQUEUESEG               aSegsIn[1];
+} VBLKREQ;
+/** Pointer to an active request. */
+typedef VBLKREQ *PVBLKREQ;
+
+
+#ifndef VBOX_DEVICE_STRUCT_TESTCASE
+
+/**
+ * Copies guest memory described by a segment list into a buffer.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   paSegs      The segments.
+ * @param   cSegs       Number of segments.
+ * @param   offSkip     Number of bytes at the start of the segments to skip.
+ * @param   pvBuf       Where to store the data.
+ * @param   cbBuf       Number of bytes to copy.
+ */
+static void vblkCopyFromGuest(PPDMDEVINS pDevIns, const VQUEUESEG *paSegs, uint32_t cSegs, size_t offSkip,
+                              void *pvBuf, size_t cbBuf)
+{
+    uint8_t *pbBuf = (uint8_t *)pvBuf;
+
+    for (uint32_t i = 0; i < cSegs && cbBuf; i++)
+    {
+        if (offSkip >= paSegs[i].cb)
+        {
+            offSkip -= paSegs[i].cb;
+            continue;
+        }
+
+        size_t cbCopy = RT_MIN(paSegs[i].cb - offSkip, cbBuf);
+        PDMDevHlpPhysRead(pDevIns, paSegs[i].addr + offSkip, pbBuf, cbCopy);
+        pbBuf  += cbCopy;
+        cbBuf  -= cbCopy;
+        offSkip = 0;
+    }
+}
+
+/**
+ * Copies a buffer into guest memory described by a segment list.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   paSegs      The segments.
+ * @param   cSegs       Number of segments.
+ * @param   pvBuf       The data to copy.
+ * @param   cbBuf       Number of bytes to copy.
+ */
+static void vblkCopyToGuest(PPDMDEVINS pDevIns, const VQUEUESEG *paSegs, uint32_t cSegs,
+                            const void *pvBuf, size_t cbBuf)
+{
+    const uint8_t *pbBuf = (const uint8_t *)pvBuf;
+
+    for (uint32_t i = 0; i < cSegs && cbBuf; i++)
+    {
+        size_t cbCopy = RT_MIN(paSegs[i].cb, cbBuf);
+        PDMDevHlpPCIPhysWrite(pDevIns, paSegs[i].addr, pbBuf, cbCopy);
+        pbBuf += cbCopy;
+        cbBuf -= cbCopy;
+    }
+}
+
+/**
+ * Drops a reference to the active request count, signalling the completion
+ * of a pending suspend, power off or reset if it was the last one.
+ *
+ * @param   pThis       The device state structure.
+ */
+static void vblkReqsActiveRelease(PVBLKSTATE pThis)
+{
+    if (   !ASMAtomicDecU32(&pThis->cReqsActive)
+        && ASMAtomicReadBool(&pThis->fSignalIdle))
+        PDMDevHlpAsyncNotificationCompleted(pThis->VPCI.pDevInsR3);
+}
+
+/**
+ * Publishes the chains returned to the used ring of a queue to the guest.
+ * Must be called with the VPCI critical section held.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pBlkQueue   The queue.
+ * @param   fDeferSync  Whether the I/O thread of the queue is the caller and the
+ *                      sync may be postponed to the end of its batch.
+ */
+static void vblkQueueSync(PVBLKSTATE pThis, PVBLKQUEUE pBlkQueue, bool fDeferSync)
+{
+    if (   fDeferSync
+        && ++pBlkQueue->cSyncPending < VBLK_SYNC_BATCH_MAX)
+        return;
+
+    pBlkQueue->cSyncPending = 0;
+    vqueueSync(&pThis->VPCI, pBlkQueue->pQueue);
+}
+
+/**
+ * Completes a request, writing the data and the status into guest memory and
+ * returning the descriptor chain.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pReq        The request to complete.
+ * @param   rcReq       Status code of the request.
+ * @param   fDeferSync  Whether the caller is the I/O thread of the queue which
+ *                      syncs the used ring once it is done with the batch.
+ */
+static void vblkReqComplete(PVBLKSTATE pThis, PVBLKREQ pReq, int rcReq, bool fDeferSync)
+{
+    PPDMDEVINS pDevIns = pThis->VPCI.pDevInsR3;
+    uint8_t    bStatus = pReq->bStatus;
+    uint32_t   cbIn    = pReq->cbIn;
+
+    if (RT_FAILURE(rcReq))
+    {
+        bStatus = VBLK_S_IOERR;
+        cbIn    = 0;
+        if (ASMAtomicIncU32(&pThis->cErrors) < VBLK_MAX_LOG_REL_ERRORS)
+            LogRel(("%s: Request type %u failed with %Rrc\n", INSTANCE(pThis), pReq->uType, rcReq));
+    }
+
+    if (pReq->uType == VBLK_T_IN)
+        vpciSetReadLed(&pThis->VPCI, false);
+    else if (pReq->uType == VBLK_T_OUT)
+        vpciSetWriteLed(&pThis->VPCI, false);
+
+    int rc = vpciCsEnter(&pThis->VPCI, VERR_SEM_BUSY);
+    AssertRC(rc);
+    if (   pReq->uGen == ASMAtomicReadU32(&pThis->uResetGen)
+        && vqueueIsReady(&pThis->VPCI, pReq->pBlkQueue->pQueue))
+    {
+        if (cbIn && pReq->DataSeg.pvSeg)
+            vblkCopyToGuest(pDevIns, pReq->aSegsIn, pReq->cSegsIn, pReq->DataSeg.pvSeg, cbIn);
+        PDMDevHlpPCIPhysWrite(pDevIns, pReq->GCPhysStatus, &bStatus, sizeof(bStatus));
+
+        vqueuePutUsed(&pThis->VPCI, pReq->pBlkQueue->pQueue, pReq->uIndex, cbIn + sizeof(bStatus));
+        vblkQueueSync(pThis, pReq->pBlkQueue, fDeferSync);
+    }
+    else
+        Log(("%s vblkReqComplete: dropping request %u after reset\n", INSTANCE(pThis), pReq->uIndex));
+    vpciCsLeave(&pThis->VPCI);
+
+    if (pReq->DataSeg.pvSeg)
+        RTMemFree(pReq->DataSeg.pvSeg);
+    if (pReq->paRanges)
+        RTMemFree(pReq->paRanges);
+    RTMemFree(pReq);
+
+    vblkReqsActiveRelease(pThis);
+}
+
+/**
+ * Handles the status of a request submitted to the attached driver.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pReq        The request.
+ * @param   rc          Status code returned by the driver.
+ * @param   fAsync      Whether the request was submitted asynchronously.
+ */
+static void vblkReqSubmitted(PVBLKSTATE pThis, PVBLKREQ pReq, int rc, bool fAsync)
+{
+    if (fAsync)
+    {
+        STAM_COUNTER_INC(&pThis->StatReqsAsync);
+        if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            return;
+        if (rc == VINF_VD_ASYNC_IO_FINISHED)
+            rc = VINF_SUCCESS;
+    }
+    vblkReqComplete(pThis, pReq, rc, true /*fDeferSync*/);
+}
+
+/**
+ * Checks that a transfer lies within the medium.
+ *
+ * @returns true if the transfer is valid.
+ * @param   pThis       The device state structure.
+ * @param   uSector     The start sector.
+ * @param   cbData      Size of the transfer in bytes.
+ */
+DECLINLINE(bool) vblkIsTransferValid(PVBLKSTATE pThis, uint64_t uSector, size_t cbData)
+{
+    return    !(cbData & ((1 << VBLK_SECTOR_SHIFT) - 1))
+           && uSector <= pThis->config.uCapacity
+           && (cbData >> VBLK_SECTOR_SHIFT) <= pThis->config.uCapacity - uSector;
+}
+
+/**
+ * Hands a descriptor chain back to the guest without processing it, for
+ * chains which never made it into a request.
+ *
+ * The status byte is set to VBLK_S_IOERR if the chain has one.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pBlkQueue   The queue the chain was taken from.
+ * @param   pElem       The descriptor chain.
+ * @param   uGen        The reset generation the chain was fetched in.
+ */
+static void vblkElemFail(PVBLKSTATE pThis, PVBLKQUEUE pBlkQueue, PVQUEUEELEM pElem, uint32_t uGen)
+{
+    int rc = vpciCsEnter(&pThis->VPCI, VERR_SEM_BUSY);
+    AssertRC(rc);
+    if (   uGen == ASMAtomicReadU32(&pThis->uResetGen)
+        && vqueueIsReady(&pThis->VPCI, pBlkQueue->pQueue))
+    {
+        uint32_t cbLen = 0;
+        if (   pElem->nIn > 0
+            && pElem->aSegsIn[pElem->nIn - 1].cb > 0)
+        {
+            uint8_t bStatus = VBLK_S_IOERR;
+            PDMDevHlpPCIPhysWrite(pThis->VPCI.pDevInsR3,
+                                  pElem->aSegsIn[pElem->nIn - 1].addr + pElem->aSegsIn[pElem->nIn - 1].cb - 1,
+                                  &bStatus, sizeof(bStatus));
+            cbLen = sizeof(bStatus);
+        }
+        vqueuePutUsed(&pThis->VPCI, pBlkQueue->pQueue, pElem->uIndex, cbLen);
+        vblkQueueSync(pThis, pBlkQueue, true /*fDeferSync*/);
+    }
+    vpciCsLeave(&pThis->VPCI);
+    vblkReqsActiveRelease(pThis);
+}
+
+/**
+ * Parses a descriptor chain and submits the request to the attached driver.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pBlkQueue   The queue the chain was taken from.
+ * @param   pElem       The descriptor chain.
+ * @param   uGen        The reset generation the chain was fetched in.
+ */
+static void vblkReqSubmit(PVBLKSTATE pThis, PVBLKQUEUE pBlkQueue, PVQUEUEELEM pElem, uint32_t uGen)
+{
+    PPDMDEVINS pDevIns = pThis->VPCI.pDevInsR3;
+    VBLKREQHDR Hdr;
+
+    STAM_COUNTER_INC(&pBlkQueue->StatReqs);
+
+    /*
+     * The chain starts with the header and ends with the status byte,
+     * anything else can't be completed and is handed back right away.
+     */
+    if (RT_UNLIKELY(   pElem->nOut == 0
+                    || pElem->aSegsOut[0].cb < sizeof(Hdr)
+                    || pElem->nIn == 0
+                    || pElem->aSegsIn[pElem->nIn - 1].cb == 0))
+    {
+        Log(("%s vblkReqSubmit: Malformed request nOut=%u nIn=%u\n", INSTANCE(pThis), pElem->nOut, pElem->nIn));
+        vblkElemFail(pThis, pBlkQueue, pElem, uGen);
+        return;
+    }
+
+    PDMDevHlpPhysRead(pDevIns, pElem->aSegsOut[0].addr, &Hdr, sizeof(Hdr));
+
+    uint64_t cbOut = 0;
+    for (uint32_t i = 0; i < pElem->nOut; i++)
+        cbOut += pElem->aSegsOut[i].cb;
+    cbOut -= sizeof(Hdr);
+
+    PVBLKREQ pReq = (PVBLKREQ)RTMemAllocZ(RT_OFFSETOF(VBLKREQ, aSegsIn[pElem->nIn]));
+    if (RT_UNLIKELY(!pReq))
+    {
+        if (ASMAtomicIncU32(&pThis->cErrors) < VBLK_MAX_LOG_REL_ERRORS)
+            LogRel(("%s: Out of memory allocating a request\n", INSTANCE(pThis)));
+        vblkElemFail(pThis, pBlkQueue, pElem, uGen);
+        return;
+    }
+
+    pReq->pBlkQueue = pBlkQueue;
+    pReq->uIndex    = pElem->uIndex;
+    pReq->uGen      = uGen;
+    pReq->uType     = Hdr.uType;
+    pReq->bStatus   = VBLK_S_OK;
+    pReq->cSegsIn   = pElem->nIn;
+
+    uint64_t cbInData = 0;
+    for (uint32_t i = 0; i < pElem->nIn; i++)
+    {
+        pReq->aSegsIn[i] = pElem->aSegsIn[i];
+        cbInData += pElem->aSegsIn[i].cb;
+    }
+    /* The last byte is the status. */
+    pReq->aSegsIn[pElem->nIn - 1].cb--;
+    pReq->GCPhysStatus = pElem->aSegsIn[pElem->nIn - 1].addr + pElem->aSegsIn[pElem->nIn - 1].cb - 1;
+    cbInData--;
+
+    bool fAsync = pThis->pDrvBlockAsync != NULL;
+    int  rc     = VINF_SUCCESS;
+
+    if (RT_UNLIKELY(!pThis->pDrvBlock))
+    {
+        vblkReqComplete(pThis, pReq, VERR_PDM_MEDIA_NOT_MOUNTED, true /*fDeferSync*/);
+        return;
+    }
+
+    switch (Hdr.uType)
+    {
+        case VBLK_T_IN:
+        {
+            if (   cbInData > VBLK_MAX_TRANSFER
+                || !vblkIsTransferValid(pThis, Hdr.uSector, (size_t)cbInData))
+            {
+                vblkReqComplete(pThis, pReq, VERR_OUT_OF_RANGE, true /*fDeferSync*/);
+                return;
+            }
+
+            pReq->cbIn              = (uint32_t)cbInData;
+            pReq->DataSeg.cbSeg     = (size_t)cbInData;
+            pReq->DataSeg.pvSeg     = RTMemAlloc(RT_MAX(pReq->DataSeg.cbSeg, 1));
+            if (!pReq->DataSeg.pvSeg)
+            {
+                vblkReqComplete(pThis, pReq, VERR_NO_MEMORY, true /*fDeferSync*/);
+                return;
+            }
+
+            STAM_COUNTER_ADD(&pThis->StatBytesRead, cbInData);
+            vpciSetReadLed(&pThis->VPCI, true);
+            if (fAsync)
+                rc = pThis->pDrvBlockAsync->pfnStartRead(pThis->pDrvBlockAsync, Hdr.uSector << VBLK_SECTOR_SHIFT,
+                                                         &pReq->DataSeg, 1, pReq->DataSeg.cbSeg, pReq);
+            else
+                rc = pThis->pDrvBlock->pfnRead(pThis->pDrvBlock, Hdr.uSector << VBLK_SECTOR_SHIFT,
+                                               pReq->DataSeg.pvSeg, pReq->DataSeg.cbSeg);
+            break;
+        }
+
+        case VBLK_T_OUT:
+        {
+            if (pThis->fReadOnly)
+            {
+                vblkReqComplete(pThis, pReq, VERR_WRITE_PROTECT, true /*fDeferSync*/);
+                return;
+            }
+            if (   cbOut > VBLK_MAX_TRANSFER
+                || !vblkIsTransferValid(pThis, Hdr.uSector, (size_t)cbOut))
+            {
+                vblkReqComplete(pThis, pReq, VERR_OUT_OF_RANGE, true /*fDeferSync*/);
+                return;
+            }
+
+            pReq->DataSeg.cbSeg     = (size_t)cbOut;
+            pReq->DataSeg.pvSeg     = RTMemAlloc(RT_MAX(pReq->DataSeg.cbSeg, 1));
+            if (!pReq->DataSeg.pvSeg)
+            {
+                vblkReqComplete(pThis, pReq, VERR_NO_MEMORY, true /*fDeferSync*/);
+                return;
+            }
+            vblkCopyFromGuest(pDevIns, pElem->aSegsOut, pElem->nOut, sizeof(Hdr),
+                              pReq->DataSeg.pvSeg, pReq->DataSeg.cbSeg);
+
+            STAM_COUNTER_ADD(&pThis->StatBytesWritten, cbOut);
+            vpciSetWriteLed(&pThis->VPCI, true);
+            if (fAsync)
+                rc = pThis->pDrvBlockAsync->pfnStartWrite(pThis->pDrvBlockAsync, Hdr.uSector << VBLK_SECTOR_SHIFT,
+                                                          &pReq->DataSeg, 1, pReq->DataSeg.cbSeg, pReq);
+            else
+                rc = pThis->pDrvBlock->pfnWrite(pThis->pDrvBlock, Hdr.uSector << VBLK_SECTOR_SHIFT,
+                                                pReq->DataSeg.pvSeg, pReq->DataSeg.cbSeg);
+            break;
+        }
+
+        case VBLK_T_FLUSH:
+        {
+            STAM_COUNTER_INC(&pThis->StatReqsFlush);
+            if (fAsync)
+                rc = pThis->pDrvBlockAsync->pfnStartFlush(pThis->pDrvBlockAsync, pReq);
+            else
+                rc = pThis->pDrvBlock->pfnFlush(pThis->pDrvBlock);
+            break;
+        }
+
+        case VBLK_T_DISCARD:
+        {
+            if (!pThis->fDiscard)
+            {
+                pReq->bStatus = VBLK_S_UNSUPP;
+                vblkReqComplete(pThis, pReq, VINF_SUCCESS, true /*fDeferSync*/);
+                return;
+            }
+
+            unsigned cRanges = (unsigned)(cbOut / sizeof(VBLKDISCARDSEG));
+            if (   !cRanges
+                || cRanges > VBLK_MAX_DISCARD_SEGS
+                || cbOut % sizeof(VBLKDISCARDSEG))
+            {
+                vblkReqComplete(pThis, pReq, VERR_INVALID_PARAMETER, true /*fDeferSync*/);
+                return;
+            }
+
+            VBLKDISCARDSEG aSegs[VBLK_MAX_DISCARD_SEGS];
+            vblkCopyFromGuest(pDevIns, pElem->aSegsOut, pElem->nOut, sizeof(Hdr), &aSegs[0],
+                              cRanges * sizeof(VBLKDISCARDSEG));
+
+            pReq->paRanges = (PRTRANGE)RTMemAlloc(cRanges * sizeof(RTRANGE));
+            if (!pReq->paRanges)
+            {
+                vblkReqComplete(pThis, pReq, VERR_NO_MEMORY, true /*fDeferSync*/);
+                return;
+            }
+            pReq->cRanges = cRanges;
+
+            for (unsigned i = 0; i < cRanges; i++)
+            {
+                if (   aSegs[i].fFlags
+                    || aSegs[i].cSectors > VBLK_MAX_DISCARD_SECTORS
+                    || !vblkIsTransferValid(pThis, aSegs[i].uSector, (size_t)aSegs[i].cSectors << VBLK_SECTOR_SHIFT))
+                {
+                    vblkReqComplete(pThis, pReq, VERR_INVALID_PARAMETER, true /*fDeferSync*/);
+                    return;
+                }
+                pReq->paRanges[i].offStart = aSegs[i].uSector << VBLK_SECTOR_SHIFT;
+                pReq->paRanges[i].cbRange  = (size_t)aSegs[i].cSectors << VBLK_SECTOR_SHIFT;
+            }
+
+            STAM_COUNTER_INC(&pThis->StatReqsDiscard);
+            if (fAsync)
+                rc = pThis->pDrvBlockAsync->pfnStartDiscard(pThis->pDrvBlockAsync, pReq->paRanges, pReq->cRanges, pReq);
+            else
+                rc = pThis->pDrvBlock->pfnDiscard(pThis->pDrvBlock, pReq->paRanges, pReq->cRanges);
+            break;
+        }
+
+        case VBLK_T_GET_ID:
+        {
+            pReq->cbIn          = (uint32_t)RT_MIN(cbInData, VBLK_ID_BYTES);
+            pReq->DataSeg.cbSeg = VBLK_ID_BYTES;
+            pReq->DataSeg.pvSeg = RTMemAllocZ(VBLK_ID_BYTES);
+            if (!pReq->DataSeg.pvSeg)
+            {
+                vblkReqComplete(pThis, pReq, VERR_NO_MEMORY, true /*fDeferSync*/);
+                return;
+            }
+            memcpy(pReq->DataSeg.pvSeg, pThis->szSerialNumber, strlen(pThis->szSerialNumber));
+            vblkReqComplete(pThis, pReq, VINF_SUCCESS, true /*fDeferSync*/);
+            return;
+        }
+
+        default:
+            Log(("%s vblkReqSubmit: Unsupported request type %u\n", INSTANCE(pThis), Hdr.uType));
+            pReq->bStatus = VBLK_S_UNSUPP;
+            vblkReqComplete(pThis, pReq, VINF_SUCCESS, true /*fDeferSync*/);
+            return;
+    }
+
+    vblkReqSubmitted(pThis, pReq, rc, fAsync);
+}
+
+/**
+ * Fetches and submits all available requests of a queue.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pBlkQueue   The queue to process.
+ * @thread  The I/O thread of the queue.
+ */
+static void vblkQueueProcess(PVBLKSTATE pThis, PVBLKQUEUE pBlkQueue)
+{
+    PVQUEUE pQueue = pBlkQueue->pQueue;
+
+    /*
+     * Each request holds a reference from the moment it is fetched, the
+     * reference taken here covers the gap so a suspend either sees the
+     * fetch in progress or the fetch sees the suspend.
+     */
+    ASMAtomicIncU32(&pThis->cReqsActive);
+    for (;;)
+    {
+        bool fEmpty = true;
+
+        /* No need for notifications while we're draining the queue. */
+        int rc = vpciCsEnter(&pThis->VPCI, VERR_SEM_BUSY);
+        AssertRC(rc);
+        if (vqueueIsReady(&pThis->VPCI, pQueue))
+            vqueueSetNotification(&pThis->VPCI, pQueue, false);
+        vpciCsLeave(&pThis->VPCI);
+
+        while (!ASMAtomicReadBool(&pThis->fQuiescing))
+        {
+            rc = vpciCsEnter(&pThis->VPCI, VERR_SEM_BUSY);
+            AssertRC(rc);
+            bool     fGot = vqueueIsReady(&pThis->VPCI, pQueue)
+                         && vqueueGet(&pThis->VPCI, pQueue, pBlkQueue->pElem);
+            uint32_t uGen = ASMAtomicReadU32(&pThis->uResetGen);
+            vpciCsLeave(&pThis->VPCI);
+            if (!fGot)
+                break;
+
+            ASMAtomicIncU32(&pThis->cReqsActive);
+            vblkReqSubmit(pThis, pBlkQueue, pBlkQueue->pElem, uGen);
+        }
+
+        /* Publish the batch, re-enable notifications and check for requests which raced us. */
+        rc = vpciCsEnter(&pThis->VPCI, VERR_SEM_BUSY);
+        AssertRC(rc);
+        if (vqueueIsReady(&pThis->VPCI, pQueue))
+        {
+            if (pBlkQueue->cSyncPending)
+                vblkQueueSync(pThis, pBlkQueue, false /*fDeferSync*/);
+            vqueueSetNotification(&pThis->VPCI, pQueue, true);
+            fEmpty = vqueueIsEmpty(&pThis->VPCI, pQueue);
+        }
+        vpciCsLeave(&pThis->VPCI);
+
+        if (fEmpty || ASMAtomicReadBool(&pThis->fQuiescing))
+            break;
+    }
+    vblkReqsActiveRelease(pThis);
+}
+
+/**
+ * Wakes up the I/O thread of a queue.
+ *
+ * @param   pThis       The device state structure.
+ * @param   pBlkQueue   The queue.
+ */
+static void vblkQueueKick(PVBLKSTATE pThis, PVBLKQUEUE pBlkQueue)
+{
+    ASMAtomicWriteBool(&pBlkQueue->fNotified, true);
+    if (ASMAtomicReadBool(&pBlkQueue->fSleeping))
+    {
+        int rc = SUPSemEventSignal(pThis->pSupDrvSession, pBlkQueue->hEvtProcess);
+        AssertRC(rc);
+    }
+}
+
+/**
+ * The I/O thread of a request queue.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pThread     The thread.
+ */
+static DECLCALLBACK(int) vblkQueueWorker(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PVBLKSTATE pThis     = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+    PVBLKQUEUE pBlkQueue = (PVBLKQUEUE)pThread->pvUser;
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        ASMAtomicWriteBool(&pBlkQueue->fSleeping, true);
+        if (!ASMAtomicXchgBool(&pBlkQueue->fNotified, false))
+        {
+            int rc = SUPSemEventWaitNoResume(pThis->pSupDrvSession, pBlkQueue->hEvtProcess, RT_INDEFINITE_WAIT);
+            AssertLogRelMsgReturn(RT_SUCCESS(rc) || rc == VERR_INTERRUPTED, ("%Rrc\n", rc), rc);
+            if (RT_UNLIKELY(pThread->enmState != PDMTHREADSTATE_RUNNING))
+                break;
+            ASMAtomicWriteBool(&pBlkQueue->fNotified, false);
+        }
+        ASMAtomicWriteBool(&pBlkQueue->fSleeping, false);
+
+        vblkQueueProcess(pThis, pBlkQueue);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Unblocks the I/O thread of a queue so it can respond to a state change.
+ *
+ * @returns VBox status code.
+ * @param   pDevIns     The device instance.
+ * @param   pThread     The thread.
+ */
+static DECLCALLBACK(int) vblkQueueWorkerWakeUp(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PVBLKSTATE pThis     = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+    PVBLKQUEUE pBlkQueue = (PVBLKQUEUE)pThread->pvUser;
+    return SUPSemEventSignal(pThis->pSupDrvSession, pBlkQueue->hEvtProcess);
+}
+
+/**
+ * Queue notification callback, hands the queue over to its I/O thread.
+ *
+ * @param   pvState     The device state structure.
+ * @param   pQueue      The queue the guest notified.
+ * @thread  EMT
+ */
+static DECLCALLBACK(void) vblkQueueNotify(void *pvState, PVQUEUE pQueue)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    unsigned   iQueue = pQueue - &pThis->VPCI.Queues[0];
+
+    AssertReturnVoid(iQueue < pThis->cQueues);
+    vblkQueueKick(pThis, &pThis->aQueues[iQueue]);
+}
+
+
+/* -=-=-=-=- VirtIO PCI callbacks -=-=-=-=- */
+
+static DECLCALLBACK(uint32_t) vblkIoCb_GetHostFeatures(void *pvState)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    uint32_t fFeatures = VBLK_F_SEG_MAX
+                       | VBLK_F_BLK_SIZE
+                       | VBLK_F_FLUSH
+                       | VPCI_F_RING_INDIRECT_DESC
+                       | VPCI_F_RING_EVENT_IDX;
+
+    if (pThis->cQueues > 1)
+        fFeatures |= VBLK_F_MQ;
+    if (pThis->fReadOnly)
+        fFeatures |= VBLK_F_RO;
+    if (pThis->fDiscard)
+        fFeatures |= VBLK_F_DISCARD;
+    return fFeatures;
+}
+
+static DECLCALLBACK(uint32_t) vblkIoCb_GetHostMinimalFeatures(void *pvState)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    return pThis->fReadOnly ? VBLK_F_RO : 0;
+}
+
+static DECLCALLBACK(void) vblkIoCb_SetHostFeatures(void *pvState, uint32_t fFeatures)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    LogFlow(("%s vblkIoCb_SetHostFeatures: uFeatures=%x\n", INSTANCE(pThis), fFeatures));
+    NOREF(pThis); NOREF(fFeatures);
+}
+
+static DECLCALLBACK(int) vblkIoCb_GetConfig(void *pvState, uint32_t offCfg, uint32_t cb, void *data)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    if (offCfg + cb > sizeof(VBLKPCICONFIG))
+    {
+        Log(("%s vblkIoCb_GetConfig: Read beyond the config structure is attempted (offCfg=%#x cb=%x).\n", INSTANCE(pThis), offCfg, cb));
+        return VERR_IOM_IOPORT_UNUSED;
+    }
+    memcpy(data, (uint8_t *)&pThis->config + offCfg, cb);
+    return VINF_SUCCESS;
+}
+
+static DECLCALLBACK(int) vblkIoCb_SetConfig(void *pvState, uint32_t offCfg, uint32_t cb, void *data)
+{
+    /* The configuration is read-only for the guest. */
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    Log(("%s vblkIoCb_SetConfig: Ignoring write (offCfg=%#x cb=%x).\n", INSTANCE(pThis), offCfg, cb));
+    NOREF(pThis); NOREF(data);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Hardware reset. Revert all registers to initial values.
+ *
+ * Requests which are still active complete without touching guest memory.
+ *
+ * @param   pvState     The device state structure.
+ */
+static DECLCALLBACK(int) vblkIoCb_Reset(void *pvState)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    Log(("%s Reset triggered\n", INSTANCE(pThis)));
+
+    int rc = vpciCsEnter(&pThis->VPCI, VERR_SEM_BUSY);
+    if (RT_UNLIKELY(rc != VINF_SUCCESS))
+    {
+        LogRel(("vblkIoCb_Reset failed to enter critical section!\n"));
+        return rc;
+    }
+    ASMAtomicIncU32(&pThis->uResetGen);
+    vpciReset(&pThis->VPCI);
+    vpciCsLeave(&pThis->VPCI);
+    return VINF_SUCCESS;
+}
+
+/**
+ * This function is called when the driver becomes ready.
+ *
+ * @param   pvState     The device state structure.
+ */
+static DECLCALLBACK(void) vblkIoCb_Ready(void *pvState)
+{
+    PVBLKSTATE pThis = (PVBLKSTATE)pvState;
+    Log(("%s Driver became ready\n", INSTANCE(pThis)));
+    for (uint32_t i = 0; i < pThis->cQueues; i++)
+        vblkQueueKick(pThis, &pThis->aQueues[i]);
+}
+
+
+/**
+ * I/O port callbacks.
+ */
+static const VPCIIOCALLBACKS g_IOCallbacks =
+{
+     vblkIoCb_GetHostFeatures,
+     vblkIoCb_GetHostMinimalFeatures,
+     vblkIoCb_SetHostFeatures,
+     vblkIoCb_GetConfig,
+     vblkIoCb_SetConfig,
+     vblkIoCb_Reset,
+     vblkIoCb_Ready,
+};
+
+
+/**
+ * @callback_method_impl{FNIOMIOPORTIN}
+ */
+static DECLCALLBACK(int) vblkIOPortIn(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT port, uint32_t *pu32, unsigned cb)
+{
+    return vpciIOPortIn(pDevIns, pvUser, port, pu32, cb, &g_IOCallbacks);
+}
+
+
+/**
+ * @callback_method_impl{FNIOMIOPORTOUT}
+ */
+static DECLCALLBACK(int) vblkIOPortOut(PPDMDEVINS pDevIns, void *pvUser, RTIOPORT port, uint32_t u32, unsigned cb)
+{
+    return vpciIOPortOut(pDevIns, pvUser, port, u32, cb, &g_IOCallbacks);
+}
+
+
+/* -=-=-=-=- PDMIBASE, PDMIBLOCKPORT, PDMIBLOCKASYNCPORT -=-=-=-=- */
+
+/**
+ * @interface_method_impl{PDMIBASE,pfnQueryInterface}
+ */
+static DECLCALLBACK(void *) vblkQueryInterface(struct PDMIBASE *pInterface, const char *pszIID)
+{
+    PVBLKSTATE pThis = RT_FROM_MEMBER(pInterface, VBLKSTATE, VPCI.IBase);
+    Assert(&pThis->VPCI.IBase == pInterface);
+
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBLOCKPORT, &pThis->IPort);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBLOCKASYNCPORT, &pThis->IPortAsync);
+    return vpciQueryInterface(pInterface, pszIID);
+}
+
+/**
+ * @interface_method_impl{PDMIBLOCKPORT,pfnQueryDeviceLocation}
+ */
+static DECLCALLBACK(int) vblkQueryDeviceLocation(PPDMIBLOCKPORT pInterface, const char **ppcszController,
+                                                 uint32_t *piInstance, uint32_t *piLUN)
+{
+    PVBLKSTATE pThis   = RT_FROM_MEMBER(pInterface, VBLKSTATE, IPort);
+    PPDMDEVINS pDevIns = pThis->VPCI.pDevInsR3;
+
+    AssertPtrReturn(ppcszController, VERR_INVALID_POINTER);
+    AssertPtrReturn(piInstance, VERR_INVALID_POINTER);
+    AssertPtrReturn(piLUN, VERR_INVALID_POINTER);
+
+    *ppcszController = pDevIns->pReg->szName;
+    *piInstance = pDevIns->iInstance;
+    *piLUN = 0;
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIBLOCKASYNCPORT,pfnTransferCompleteNotify}
+ */
+static DECLCALLBACK(int) vblkTransferCompleteNotify(PPDMIBLOCKASYNCPORT pInterface, void *pvUser, int rcReq)
+{
+    PVBLKSTATE pThis = RT_FROM_MEMBER(pInterface, VBLKSTATE, IPortAsync);
+    vblkReqComplete(pThis, (PVBLKREQ)pvUser, rcReq, false /*fDeferSync*/);
+    return VINF_SUCCESS;
+}
+
+
+/* -=-=-=-=- Saved State -=-=-=-=- */
+
+static void vblkSaveConfig(PVBLKSTATE pThis, PSSMHANDLE pSSM)
+{
+    SSMR3PutU32(pSSM, pThis->cQueues);
+    SSMR3PutU32(pSSM, pThis->cQueueSize);
+}
+
+
+/**
+ * @callback_method_impl{FNSSMDEVLIVEEXEC}
+ */
+static DECLCALLBACK(int) vblkLiveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uPass)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+    vblkSaveConfig(pThis, pSSM);
+    return VINF_SSM_DONT_CALL_AGAIN;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMDEVSAVEEXEC}
+ */
+static DECLCALLBACK(int) vblkSaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+
+    /* The VM is suspended and all requests were completed at this point. */
+    Assert(!ASMAtomicReadU32(&pThis->cReqsActive));
+
+    vblkSaveConfig(pThis, pSSM);
+    return vpciSaveExec(&pThis->VPCI, pSSM);
+}
+
+
+/**
+ * @callback_method_impl{FNSSMDEVLOADEXEC}
+ */
+static DECLCALLBACK(int) vblkLoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+    uint32_t   cQueues;
+    uint32_t   cQueueSize;
+
+    /* config checks */
+    int rc = SSMR3GetU32(pSSM, &cQueues);
+    AssertRCReturn(rc, rc);
+    rc = SSMR3GetU32(pSSM, &cQueueSize);
+    AssertRCReturn(rc, rc);
+    if (cQueues != pThis->cQueues)
+        return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("Config mismatch - saved NumQueues=%u; configured NumQueues=%u"),
+                                cQueues, pThis->cQueues);
+    if (cQueueSize != pThis->cQueueSize)
+        return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("Config mismatch - saved QueueSize=%u; configured QueueSize=%u"),
+                                cQueueSize, pThis->cQueueSize);
+
+    rc = vpciLoadExec(&pThis->VPCI, pSSM, uVersion, uPass, pThis->cQueues);
+    AssertRCReturn(rc, rc);
+    if (pThis->VPCI.nQueues != pThis->cQueues)
+        return SSMR3SetCfgError(pSSM, RT_SRC_POS, N_("Config mismatch - saved %u queues; configured %u"),
+                                pThis->VPCI.nQueues, pThis->cQueues);
+    return rc;
+}
+
+
+/* -=-=-=-=- PCI Device -=-=-=-=- */
+
+/**
+ * @callback_method_impl{FNPCIIOREGIONMAP}
+ */
+static DECLCALLBACK(int) vblkMap(PPCIDEVICE pPciDev, int iRegion,
+                                 RTGCPHYS GCPhysAddress, uint32_t cb, PCIADDRESSSPACE enmType)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pPciDev->pDevIns, PVBLKSTATE);
+    int       rc;
+
+    if (enmType != PCI_ADDRESS_SPACE_IO)
+    {
+        /* We should never get here */
+        AssertMsgFailed(("Invalid PCI address space param in map callback"));
+        return VERR_INTERNAL_ERROR;
+    }
+
+    /* Queue notifications are handled in ring-3 anyway, so there are no R0/RC handlers. */
+    pThis->VPCI.IOPortBase = (RTIOPORT)GCPhysAddress;
+    rc = PDMDevHlpIOPortRegister(pPciDev->pDevIns, pThis->VPCI.IOPortBase,
+                                 cb, 0, vblkIOPortOut, vblkIOPortIn,
+                                 NULL, NULL, "VirtioBlk");
+    AssertRC(rc);
+    return rc;
+}
+
+
+/* -=-=-=-=- PDMDEVREG -=-=-=-=- */
+
+/**
+ * Checks whether all requests completed.
+ *
+ * @returns true if there are no active requests.
+ * @param   pThis       The device state structure.
+ */
+static bool vblkR3AllAsyncIOIsFinished(PVBLKSTATE pThis)
+{
+    return ASMAtomicReadU32(&pThis->cReqsActive) == 0;
+}
+
+/**
+ * Callback employed by vblkR3Suspend and vblkR3PowerOff.
+ *
+ * @returns true if we've quiesced, false if we're still working.
+ * @param   pDevIns     The device instance.
+ */
+static DECLCALLBACK(bool) vblkR3IsAsyncSuspendOrPowerOffDone(PPDMDEVINS pDevIns)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+
+    if (!vblkR3AllAsyncIOIsFinished(pThis))
+        return false;
+    ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+    return true;
+}
+
+/**
+ * Common worker for vblkR3Suspend and vblkR3PowerOff.
+ */
+static void vblkR3SuspendOrPowerOff(PPDMDEVINS pDevIns)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+
+    ASMAtomicWriteBool(&pThis->fQuiescing, true);
+    ASMAtomicWriteBool(&pThis->fSignalIdle, true);
+    if (!vblkR3AllAsyncIOIsFinished(pThis))
+        PDMDevHlpSetAsyncNotification(pDevIns, vblkR3IsAsyncSuspendOrPowerOffDone);
+    else
+        ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnSuspend}
+ */
+static DECLCALLBACK(void) vblkR3Suspend(PPDMDEVINS pDevIns)
+{
+    Log(("vblkR3Suspend\n"));
+    vblkR3SuspendOrPowerOff(pDevIns);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnResume}
+ */
+static DECLCALLBACK(void) vblkR3Resume(PPDMDEVINS pDevIns)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+
+    Log(("vblkR3Resume\n"));
+    ASMAtomicWriteBool(&pThis->fQuiescing, false);
+
+    /* Pick up the requests the guest queued while we were quiescing. */
+    for (uint32_t i = 0; i < pThis->cQueues; i++)
+        vblkQueueKick(pThis, &pThis->aQueues[i]);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnPowerOff}
+ */
+static DECLCALLBACK(void) vblkR3PowerOff(PPDMDEVINS pDevIns)
+{
+    Log(("vblkR3PowerOff\n"));
+    vblkR3SuspendOrPowerOff(pDevIns);
+}
+
+/**
+ * Callback employed by vblkR3Reset.
+ *
+ * @returns true if we've quiesced, false if we're still working.
+ * @param   pDevIns     The device instance.
+ */
+static DECLCALLBACK(bool) vblkR3IsAsyncResetDone(PPDMDEVINS pDevIns)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+
+    if (!vblkR3AllAsyncIOIsFinished(pThis))
+        return false;
+    ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+
+    vblkIoCb_Reset(pThis);
+    ASMAtomicWriteBool(&pThis->fQuiescing, false);
+    return true;
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnReset}
+ */
+static DECLCALLBACK(void) vblkR3Reset(PPDMDEVINS pDevIns)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+
+    ASMAtomicWriteBool(&pThis->fQuiescing, true);
+    ASMAtomicWriteBool(&pThis->fSignalIdle, true);
+    if (!vblkR3AllAsyncIOIsFinished(pThis))
+        PDMDevHlpSetAsyncNotification(pDevIns, vblkR3IsAsyncResetDone);
+    else
+    {
+        ASMAtomicWriteBool(&pThis->fSignalIdle, false);
+        vblkIoCb_Reset(pThis);
+        ASMAtomicWriteBool(&pThis->fQuiescing, false);
+    }
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnDestruct}
+ */
+static DECLCALLBACK(int) vblkR3Destruct(PPDMDEVINS pDevIns)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+    PDMDEV_CHECK_VERSIONS_RETURN_QUIET(pDevIns);
+
+    Log(("%s Destroying instance\n", INSTANCE(pThis)));
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aQueues); i++)
+    {
+        PVBLKQUEUE pBlkQueue = &pThis->aQueues[i];
+
+        if (pBlkQueue->pThread)
+        {
+            int rcThread;
+            int rc = PDMR3ThreadDestroy(pBlkQueue->pThread, &rcThread);
+            if (RT_FAILURE(rc) || RT_FAILURE(rcThread))
+                AssertMsgFailed(("%s Failed to destroy I/O thread rc=%Rrc rcThread=%Rrc\n",
+                                 INSTANCE(pThis), rc, rcThread));
+            pBlkQueue->pThread = NULL;
+        }
+        if (pBlkQueue->hEvtProcess != NIL_SUPSEMEVENT)
+        {
+            SUPSemEventClose(pThis->pSupDrvSession, pBlkQueue->hEvtProcess);
+            pBlkQueue->hEvtProcess = NIL_SUPSEMEVENT;
+        }
+        if (pBlkQueue->pElem)
+        {
+            RTMemFree(pBlkQueue->pElem);
+            pBlkQueue->pElem = NULL;
+        }
+    }
+
+    return vpciDestruct(&pThis->VPCI);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREG,pfnConstruct}
+ */
+static DECLCALLBACK(int) vblkR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGMNODE pCfg)
+{
+    PVBLKSTATE pThis = PDMINS_2_DATA(pDevIns, PVBLKSTATE);
+    int        rc;
+    PDMDEV_CHECK_VERSIONS_RETURN(pDevIns);
+
+    /* Initialize the instance data suffiencently for the destructor not to blow up. */
+    for (unsigned i = 0; i < RT_ELEMENTS(pThis->aQueues); i++)
+        pThis->aQueues[i].hEvtProcess = NIL_SUPSEMEVENT;
+    pThis->pSupDrvSession = PDMDevHlpGetSupDrvSession(pDevIns);
+
+    /*
+     * Validate configuration.
+     */
+    if (!CFGMR3AreValuesValid(pCfg, "NumQueues\0" "QueueSize\0" "UseAsyncInterfaceIfAvailable\0" "SerialNumber\0"
+                                    "IntDelayMax\0"))
+        return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_DEVINS_UNKNOWN_CFG_VALUES,
+                                N_("Invalid configuration for VirtioBlk device"));
+
+    /** @cfgm{NumQueues, uint32_t, 1}
+     * Number of request queues, each is served by its own I/O thread. */
+    rc = CFGMR3QueryU32Def(pCfg, "NumQueues", &pThis->cQueues, 1);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'NumQueues'"));
+    if (pThis->cQueues < 1 || pThis->cQueues > VBLK_MAX_QUEUES)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: 'NumQueues' must be between 1 and %u"), VBLK_MAX_QUEUES);
+
+    /** @cfgm{QueueSize, uint32_t, 128}
+     * Number of descriptors of each request queue, must be a power of two. */
+    rc = CFGMR3QueryU32Def(pCfg, "QueueSize", &pThis->cQueueSize, VBLK_QUEUE_SIZE_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'QueueSize'"));
+    if (   pThis->cQueueSize < 4
+        || pThis->cQueueSize > VRING_MAX_SIZE
+        || (pThis->cQueueSize & (pThis->cQueueSize - 1)))
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: 'QueueSize' must be a power of two between 4 and %u"),
+                                   VRING_MAX_SIZE);
+
+    /** @cfgm{UseAsyncInterfaceIfAvailable, bool, true}
+     * Whether to use the asynchronous interface of the attached driver. */
+    bool fUseAsyncInterfaceIfAvailable;
+    rc = CFGMR3QueryBoolDef(pCfg, "UseAsyncInterfaceIfAvailable", &fUseAsyncInterfaceIfAvailable, true);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'UseAsyncInterfaceIfAvailable'"));
+
+    /* Do our own locking. */
+    rc = PDMDevHlpSetDeviceCritSect(pDevIns, PDMDevHlpCritSectGetNop(pDevIns));
+    AssertRCReturn(rc, rc);
+
+    /* Initialize PCI part. */
+    pThis->VPCI.IBase.pfnQueryInterface    = vblkQueryInterface;
+    rc = vpciConstruct(pDevIns, &pThis->VPCI, iInstance,
+                       VBLK_NAME_FMT, VBLK_PCI_SUBSYSTEM_ID,
+                       VBLK_PCI_CLASS, pThis->cQueues);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    Log(("%s Constructing new instance\n", INSTANCE(pThis)));
+
+    /** @cfgm{IntDelayMax, uint32_t, 50}
+     * Upper bound of the adaptive queue interrupt delay in microseconds,
+     * 0 disables interrupt moderation. */
+    uint32_t cUsIntDelayMax;
+    rc = CFGMR3QueryU32Def(pCfg, "IntDelayMax", &cUsIntDelayMax, VBLK_INT_DELAY_MAX_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("Configuration error: Failed to get the value of 'IntDelayMax'"));
+    if (cUsIntDelayMax > VBLK_INT_DELAY_MAX_LIMIT)
+        return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                   N_("Configuration error: 'IntDelayMax' must not exceed %u"), VBLK_INT_DELAY_MAX_LIMIT);
+    rc = vpciIntModerationInit(&pThis->VPCI, 0, cUsIntDelayMax);
+    AssertRCReturn(rc, rc);
+
+    /* Interfaces */
+    pThis->IPort.pfnQueryDeviceLocation           = vblkQueryDeviceLocation;
+    pThis->IPortAsync.pfnTransferCompleteNotify   = vblkTransferCompleteNotify;
+
+    /* Map our ports to IO space. */
+    rc = PDMDevHlpPCIIORegionRegister(pDevIns, 0,
+                                      VPCI_CONFIG + sizeof(VBLKPCICONFIG),
+                                      PCI_ADDRESS_SPACE_IO, vblkMap);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /* Register save/restore state handlers. */
+    rc = PDMDevHlpSSMRegisterEx(pDevIns, VIRTIO_SAVEDSTATE_VERSION, sizeof(VBLKSTATE), NULL,
+                                NULL,         vblkLiveExec, NULL,
+                                NULL,         vblkSaveExec, NULL,
+                                NULL,         vblkLoadExec, NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    /*
+     * Attach the block driver.
+     */
+    rc = PDMDevHlpDriverAttach(pDevIns, 0, &pThis->VPCI.IBase, &pThis->pDrvBase, "Block Port");
+    if (RT_SUCCESS(rc))
+    {
+        pThis->pDrvBlock = PDMIBASE_QUERY_INTERFACE(pThis->pDrvBase, PDMIBLOCK);
+        AssertMsgReturn(pThis->pDrvBlock, ("Failed to obtain the PDMIBLOCK interface!\n"),
+                        VERR_PDM_MISSING_INTERFACE_BELOW);
+        if (pThis->pDrvBlock->pfnGetType(pThis->pDrvBlock) != PDMBLOCKTYPE_HARD_DISK)
+            return PDMDEV_SET_ERROR(pDevIns, VERR_PDM_UNSUPPORTED_BLOCK_TYPE,
+                                    N_("VirtioBlk: Only hard disks are supported"));
+
+        if (fUseAsyncInterfaceIfAvailable)
+            pThis->pDrvBlockAsync = PDMIBASE_QUERY_INTERFACE(pThis->pDrvBase, PDMIBLOCKASYNC);
+
+        pThis->fReadOnly = pThis->pDrvBlock->pfnIsReadOnly(pThis->pDrvBlock);
+        pThis->fDiscard  =    pThis->pDrvBlockAsync
+                           ? pThis->pDrvBlockAsync->pfnStartDiscard != NULL
+                           : pThis->pDrvBlock->pfnDiscard != NULL;
+        pThis->config.uCapacity = pThis->pDrvBlock->pfnGetSize(pThis->pDrvBlock) >> VBLK_SECTOR_SHIFT;
+
+        LogRel(("%s: using %s I/O, %u queue(s), %llu sectors%s%s\n", INSTANCE(pThis),
+                pThis->pDrvBlockAsync ? "async" : "normal", pThis->cQueues, pThis->config.uCapacity,
+                pThis->fReadOnly ? ", read-only" : "", pThis->fDiscard ? ", discard" : ""));
+    }
+    else if (rc == VERR_PDM_NO_ATTACHED_DRIVER)
+    {
+        pThis->pDrvBase = NULL;
+        LogRel(("%s: no driver attached\n", INSTANCE(pThis)));
+    }
+    else
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to attach the block LUN"));
+
+    /*
+     * Device ID, derived from the medium UUID like the other controllers do.
+     */
+    RTUUID Uuid;
+    if (pThis->pDrvBlock)
+        rc = pThis->pDrvBlock->pfnGetUuid(pThis->pDrvBlock, &Uuid);
+    else
+        RTUuidClear(&Uuid);
+
+    char szSerial[VBLK_ID_BYTES + 1];
+    if (RT_FAILURE(rc) || RTUuidIsNull(&Uuid))
+        RTStrPrintf(szSerial, sizeof(szSerial), "VB%x-1a2b3c4d", iInstance);
+    else
+        RTStrPrintf(szSerial, sizeof(szSerial), "VB%08x-%08x", Uuid.au32[0], Uuid.au32[3]);
+
+    /** @cfgm{SerialNumber, string, VBxxxxxxxx-xxxxxxxx}
+     * The device ID returned to the guest, at most 20 bytes. */
+    rc = CFGMR3QueryStringDef(pCfg, "SerialNumber", pThis->szSerialNumber, sizeof(pThis->szSerialNumber), szSerial);
+    if (RT_FAILURE(rc))
+    {
+        if (rc == VERR_CFGM_NOT_ENOUGH_SPACE)
+            return PDMDEV_SET_ERROR(pDevIns, VERR_INVALID_PARAMETER,
+                                    N_("VirtioBlk configuration error: \"SerialNumber\" is longer than 20 bytes"));
+        return PDMDEV_SET_ERROR(pDevIns, rc,
+                                N_("VirtioBlk configuration error: failed to read \"SerialNumber\" as string"));
+    }
+
+    /* Initialize PCI config space */
+    pThis->config.cSegMax                 = pThis->cQueueSize - 2;
+    pThis->config.cbBlock                 = 1 << VBLK_SECTOR_SHIFT;
+    pThis->config.cQueues                 = (uint16_t)pThis->cQueues;
+    pThis->config.cMaxDiscardSectors      = VBLK_MAX_DISCARD_SECTORS;
+    pThis->config.cMaxDiscardSegs         = VBLK_MAX_DISCARD_SEGS;
+    pThis->config.cDiscardSectorAlignment = 1;
+
+    /*
+     * Create the request queues and their I/O threads.
+     */
+    for (uint32_t i = 0; i < pThis->cQueues; i++)
+    {
+        PVBLKQUEUE pBlkQueue = &pThis->aQueues[i];
+        char       szName[24];
+
+        pBlkQueue->pThis = pThis;
+        RTStrPrintf(pBlkQueue->szName, sizeof(pBlkQueue->szName), "RQ%u", i);
+        pBlkQueue->pQueue = vpciAddQueue(&pThis->VPCI, pThis->cQueueSize, vblkQueueNotify, pBlkQueue->szName);
+        AssertReturn(pBlkQueue->pQueue, VERR_INTERNAL_ERROR_3);
+
+        pBlkQueue->pElem = (PVQUEUEELEM)RTMemAllocZ(sizeof(VQUEUEELEM));
+        if (!pBlkQueue->pElem)
+            return VERR_NO_MEMORY;
+
+        rc = SUPSemEventCreate(pThis->pSupDrvSession, &pBlkQueue->hEvtProcess);
+        if (RT_FAILURE(rc))
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("VirtioBlk: Failed to create SUP event semaphore"));
+
+        RTStrPrintf(szName, sizeof(szName), "VBLK%d-%u", iInstance, i);
+        rc = PDMDevHlpThreadCreate(pDevIns, &pBlkQueue->pThread, pBlkQueue, vblkQueueWorker,
+                                   vblkQueueWorkerWakeUp, 0, RTTHREADTYPE_IO, szName);
+        if (RT_FAILURE(rc))
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("VirtioBlk: Failed to create worker thread %s"), szName);
+
+        PDMDevHlpSTAMRegisterF(pDevIns, &pBlkQueue->StatReqs, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                               "Number of requests submitted from the queue", "/Devices/VBlk%d/Queue%u/Requests", iInstance, i);
+    }
+
+    rc = vblkIoCb_Reset(pThis);
+    AssertRC(rc);
+
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatBytesRead,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES, "Amount of data read",          "/Devices/VBlk%d/ReadBytes", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatBytesWritten, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES, "Amount of data written",       "/Devices/VBlk%d/WrittenBytes", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReqsFlush,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT, "Number of flush requests",     "/Devices/VBlk%d/Requests/Flush", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReqsDiscard,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT, "Number of discard requests",   "/Devices/VBlk%d/Requests/Discard", iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pThis->StatReqsAsync,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT, "Number of asynchronous requests", "/Devices/VBlk%d/Requests/Async", iInstance);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * The device registration structure.
+ */
+const PDMDEVREG g_DeviceVirtioBlk =
+{
+    /* Structure version. PDM_DEVREG_VERSION defines the current version. */
+    PDM_DEVREG_VERSION,
+    /* Device name. */
+    "virtio-blk",
+    /* Name of guest context module (no path).
+     * Only evalutated if PDM_DEVREG_FLAGS_RC is set. */
+    "",
+    /* Name of ring-0 module (no path).
+     * Only evalutated if PDM_DEVREG_FLAGS_RC is set. */
+    "",
+    /* The description of the device. The UTF-8 string pointed to shall, like this structure,
+     * remain unchanged from registration till VM destruction. */
+    "Virtio Block Device.\n",
+
+    /* Flags, combination of the PDM_DEVREG_FLAGS_* \#defines. */
+    PDM_DEVREG_FLAGS_DEFAULT_BITS,
+    /* Device class(es), combination of the PDM_DEVREG_CLASS_* \#defines. */
+    PDM_DEVREG_CLASS_STORAGE,
+    /* Maximum number of instances (per VM). */
+    ~0U,
+    /* Size of the instance data. */
+    sizeof(VBLKSTATE),
+
+    /* pfnConstruct */
+    vblkR3Construct,
+    /* pfnDestruct */
+    vblkR3Destruct,
+    /* pfnRelocate */
+    NULL,
+    /* pfnMemSetup. */
+    NULL,
+    /* pfnPowerOn */
+    NULL,
+    /* pfnReset */
+    vblkR3Reset,
+    /* pfnSuspend */
+    vblkR3Suspend,
+    /* pfnResume */
+    vblkR3Resume,
+    /* pfnAttach */
+    NULL,
+    /* pfnDetach */
+    NULL,
+    /* pfnQueryInterface */
+    NULL,
+    /* pfnInitComplete */
+    NULL,
+    /* pfnPowerOff */
+    vblkR3PowerOff,
+    /* pfnSoftReset */
+    NULL,
+
+    /* u32VersionEnd */
+    PDM_DEVREG_VERSION
+};
+
+#endif /* !VBOX_DEVICE_STRUCT_TESTCASE */
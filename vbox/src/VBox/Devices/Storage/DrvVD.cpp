@@ -2220,7 +2220,7 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           "HostIPStack\0UseNewIo\0BootAcceleration\0BootAccelerationBuffer\0"
                                           "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0"
                                           "CachePath\0CacheFormat\0Discard\0InformAboutZeroBlocks\0"
-                                          "SkipConsistencyChecks\0");
+                                          "SkipConsistencyChecks\0MetaCacheBudget\0");
         }
         else
         {
@@ -2333,6 +2333,25 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                       N_("DrvVD: Configuration error: Querying \"BlockCache\" as boolean failed"));
                 break;
             }
+            uint64_t cbMetaCacheBudget = 0;
+            rc = CFGMR3QueryU64Def(pCurNode, "MetaCacheBudget", &cbMetaCacheBudget, 0);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"MetaCacheBudget\" as integer failed"));
+                break;
+            }
+            if (cbMetaCacheBudget)
+            {
+                /* The budget is process wide, the last disk configuring it wins. */
+                rc = VDSetMetaCacheBudget(cbMetaCacheBudget);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Invalid \"MetaCacheBudget\""));
+                    break;
+                }
+            }
             rc = CFGMR3QueryStringAlloc(pCurNode, "BwGroup", &pThis->pszBwGroup);
             if (RT_FAILURE(rc) && rc != VERR_CFGM_VALUE_NOT_FOUND)
             {
@@ -2828,7 +2847,11 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                     rc = VINF_SUCCESS;
                 }
                 else
+                {
                     AssertRC(rc);
+                    if (RT_SUCCESS(rc))
+                        PDMR3BlkCacheSetMediumSize(pThis->pBlkCache, VDGetSize(pThis->pDisk, VD_LAST_IMAGE));
+                }
 
                 RTStrFree(pszId);
             }
@@ -21,6 +21,7 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_DEV_VIRTIO
 
+#include <iprt/asm.h>
 #include <iprt/param.h>
 #include <iprt/uuid.h>
 #include <VBox/vmm/pdmdev.h>
@@ -49,6 +50,8 @@ static void vqueueReset(PVQUEUE pQueue)
     pQueue->uNextAvailIndex       = 0;
     pQueue->uNextUsedIndex        = 0;
     pQueue->uPageNumber           = 0;
+    pQueue->uSignalledUsedIndex   = 0;
+    pQueue->fSignalledUsedValid   = false;
 }
 
 static void vqueueInit(PVQUEUE pQueue, uint32_t uPageNumber)
@@ -61,6 +64,8 @@ static void vqueueInit(PVQUEUE pQueue, uint32_t uPageNumber)
         PAGE_SIZE); /* The used ring must start from the next page. */
     pQueue->uNextAvailIndex       = 0;
     pQueue->uNextUsedIndex        = 0;
+    pQueue->uSignalledUsedIndex   = 0;
+    pQueue->fSignalledUsedValid   = false;
 }
 
 // void vqueueElemFree(PVQUEUEELEM pElem)
@@ -113,6 +118,63 @@ void vringSetNotification(PVPCISTATE pState, PVRING pVRing, bool fEnabled)
                           &tmp, sizeof(tmp));
 }
 
+/**
+ * Reads the used_event field the guest places behind the available ring
+ * (VPCI_F_RING_EVENT_IDX).
+ */
+static uint16_t vringReadUsedEvent(PVPCISTATE pState, PVRING pVRing)
+{
+    uint16_t tmp;
+
+    PDMDevHlpPhysRead(pState->CTX_SUFF(pDevIns),
+                      pVRing->addrAvail + RT_OFFSETOF(VRINGAVAIL, auRing[pVRing->uSize]),
+                      &tmp, sizeof(tmp));
+    return tmp;
+}
+
+/**
+ * Writes the avail_event field behind the used ring (VPCI_F_RING_EVENT_IDX).
+ */
+static void vringWriteAvailEvent(PVPCISTATE pState, PVRING pVRing, uint16_t u16Value)
+{
+    PDMDevHlpPCIPhysWrite(pState->CTX_SUFF(pDevIns),
+                          pVRing->addrUsed + RT_OFFSETOF(VRINGUSED, aRing[pVRing->uSize]),
+                          &u16Value, sizeof(u16Value));
+}
+
+/**
+ * Checks whether the other side wants an event when the index moves from
+ * uOld to uNew, that is whether uEvent lies in [uOld, uNew).
+ */
+DECLINLINE(bool) vringNeedEvent(uint16_t uEvent, uint16_t uNew, uint16_t uOld)
+{
+    return (uint16_t)(uNew - uEvent - 1) < (uint16_t)(uNew - uOld);
+}
+
+/**
+ * Enables or disables guest notifications (kicks) for a queue.
+ *
+ * With VPCI_F_RING_EVENT_IDX the guest is asked to kick us once it adds a
+ * buffer past the ones we have already seen, otherwise the NO_NOTIFY flag of
+ * the used ring is toggled. The guest may still kick us while notifications
+ * are disabled, so the caller has to recheck the queue after enabling them.
+ *
+ * @param   pState      The device state structure.
+ * @param   pQueue      The queue.
+ * @param   fEnabled    Whether to enable notifications.
+ */
+void vqueueSetNotification(PVPCISTATE pState, PVQUEUE pQueue, bool fEnabled)
+{
+    if (pState->uGuestFeatures & VPCI_F_RING_EVENT_IDX)
+    {
+        /* There is no flag to clear, the guest keeps kicking until the event index is passed. */
+        if (fEnabled)
+            vringWriteAvailEvent(pState, &pQueue->VRing, pQueue->uNextAvailIndex);
+    }
+    else
+        vringSetNotification(pState, &pQueue->VRing, fEnabled);
+}
+
 bool vqueueSkip(PVPCISTATE pState, PVQUEUE pQueue)
 {
     if (vqueueIsEmpty(pState, pQueue))
@@ -124,6 +186,101 @@ bool vqueueSkip(PVPCISTATE pState, PVQUEUE pQueue)
     return true;
 }
 
+/**
+ * Appends a descriptor to the IN or OUT segment list of a queue element.
+ *
+ * @returns false if the segment list is full, true otherwise.
+ * @param   pState      The device state structure.
+ * @param   pQueue      The queue the element was taken from.
+ * @param   pElem       The element to add the segment to.
+ * @param   pDesc       The descriptor.
+ * @param   idx         The index of the descriptor, for logging.
+ */
+static bool vqueueAddSeg(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, PVRINGDESC pDesc, uint32_t idx)
+{
+    VQUEUESEG *pSeg;
+
+    if (pDesc->u16Flags & VRINGDESC_F_WRITE)
+    {
+        if (RT_UNLIKELY(pElem->nIn >= RT_ELEMENTS(pElem->aSegsIn)))
+        {
+            Log(("%s vqueueGet: %s too many IN segments\n", INSTANCE(pState), QUEUENAME(pState, pQueue)));
+            return false;
+        }
+        Log2(("%s vqueueGet: %s IN  seg=%u desc_idx=%u addr=%p cb=%u\n", INSTANCE(pState),
+              QUEUENAME(pState, pQueue), pElem->nIn, idx, pDesc->u64Addr, pDesc->uLen));
+        pSeg = &pElem->aSegsIn[pElem->nIn++];
+    }
+    else
+    {
+        if (RT_UNLIKELY(pElem->nOut >= RT_ELEMENTS(pElem->aSegsOut)))
+        {
+            Log(("%s vqueueGet: %s too many OUT segments\n", INSTANCE(pState), QUEUENAME(pState, pQueue)));
+            return false;
+        }
+        Log2(("%s vqueueGet: %s OUT seg=%u desc_idx=%u addr=%p cb=%u\n", INSTANCE(pState),
+              QUEUENAME(pState, pQueue), pElem->nOut, idx, pDesc->u64Addr, pDesc->uLen));
+        pSeg = &pElem->aSegsOut[pElem->nOut++];
+    }
+
+    pSeg->addr = pDesc->u64Addr;
+    pSeg->cb   = pDesc->uLen;
+    pSeg->pv   = NULL;
+    return true;
+}
+
+/**
+ * Walks an indirect descriptor table and adds its descriptors to the element.
+ *
+ * Small tables are read with a single physical read, which is the common case
+ * for block requests.
+ *
+ * @param   pState      The device state structure.
+ * @param   pQueue      The queue the element was taken from.
+ * @param   pElem       The element to add the segments to.
+ * @param   pDesc       The descriptor referring to the table.
+ */
+static void vqueueGetIndirect(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, PVRINGDESC pDesc)
+{
+    VRINGDESC aDescs[64];
+    VRINGDESC desc;
+    uint32_t  cDescs = pDesc->uLen / sizeof(VRINGDESC);
+    uint32_t  idx    = 0;
+    uint32_t  cSeen  = 0;
+
+    if (RT_UNLIKELY(cDescs == 0 || cDescs > VRING_MAX_SIZE))
+    {
+        Log(("%s vqueueGet: %s invalid indirect table size %u\n", INSTANCE(pState),
+             QUEUENAME(pState, pQueue), pDesc->uLen));
+        return;
+    }
+
+    bool fCached = cDescs <= RT_ELEMENTS(aDescs);
+    if (fCached)
+        PDMDevHlpPhysRead(pState->CTX_SUFF(pDevIns), pDesc->u64Addr, aDescs, cDescs * sizeof(VRINGDESC));
+
+    do
+    {
+        if (RT_UNLIKELY(idx >= cDescs))
+        {
+            Log(("%s vqueueGet: %s indirect descriptor index %u out of range\n", INSTANCE(pState),
+                 QUEUENAME(pState, pQueue), idx));
+            break;
+        }
+
+        if (fCached)
+            desc = aDescs[idx];
+        else
+            PDMDevHlpPhysRead(pState->CTX_SUFF(pDevIns), pDesc->u64Addr + idx * sizeof(VRINGDESC),
+                              &desc, sizeof(desc));
+
+        if (!vqueueAddSeg(pState, pQueue, pElem, &desc, idx))
+            break;
+
+        idx = desc.u16Next;
+    } while ((desc.u16Flags & VRINGDESC_F_NEXT) && ++cSeen < cDescs);
+}
+
 bool vqueueGet(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, bool fRemove)
 {
     if (vqueueIsEmpty(pState, pQueue))
@@ -135,34 +292,21 @@ bool vqueueGet(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, bool fRemov
           QUEUENAME(pState, pQueue), pQueue->uNextAvailIndex));
 
     VRINGDESC desc;
+    uint32_t  cSeen = 0;
     uint16_t  idx = vringReadAvail(pState, &pQueue->VRing, pQueue->uNextAvailIndex);
     if (fRemove)
         pQueue->uNextAvailIndex++;
     pElem->uIndex = idx;
     do
     {
-        VQUEUESEG *pSeg;
-
         vringReadDesc(pState, &pQueue->VRing, idx, &desc);
-        if (desc.u16Flags & VRINGDESC_F_WRITE)
-        {
-            Log2(("%s vqueueGet: %s IN  seg=%u desc_idx=%u addr=%p cb=%u\n", INSTANCE(pState),
-                  QUEUENAME(pState, pQueue), pElem->nIn, idx, desc.u64Addr, desc.uLen));
-            pSeg = &pElem->aSegsIn[pElem->nIn++];
-        }
-        else
-        {
-            Log2(("%s vqueueGet: %s OUT seg=%u desc_idx=%u addr=%p cb=%u\n", INSTANCE(pState),
-                  QUEUENAME(pState, pQueue), pElem->nOut, idx, desc.u64Addr, desc.uLen));
-            pSeg = &pElem->aSegsOut[pElem->nOut++];
-        }
-
-        pSeg->addr = desc.u64Addr;
-        pSeg->cb   = desc.uLen;
-        pSeg->pv   = NULL;
+        if (desc.u16Flags & VRINGDESC_F_INDIRECT)
+            vqueueGetIndirect(pState, pQueue, pElem, &desc);
+        else if (!vqueueAddSeg(pState, pQueue, pElem, &desc, idx))
+            break;
 
         idx = desc.u16Next;
-    } while (desc.u16Flags & VRINGDESC_F_NEXT);
+    } while ((desc.u16Flags & VRINGDESC_F_NEXT) && ++cSeen < pQueue->VRing.uSize);
 
     Log2(("%s vqueueGet: %s head_desc_idx=%u nIn=%u nOut=%u\n", INSTANCE(pState),
           QUEUENAME(pState, pQueue), pElem->uIndex, pElem->nIn, pElem->nOut));
@@ -217,24 +361,113 @@ void vqueuePut(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, uint32_t uL
     }
 
     Assert((uReserved + uOffset) == uLen || pElem->nIn == 0);
+    vqueuePutUsed(pState, pQueue, pElem->uIndex, uLen);
+}
+
+/**
+ * Returns a descriptor chain to the guest without copying any data.
+ *
+ * For devices which write the data into guest memory themselves and only keep
+ * the index of the head descriptor around while a request is in flight.
+ *
+ * @param   pState      The device state structure.
+ * @param   pQueue      The queue the chain was taken from.
+ * @param   uIndex      The index of the head descriptor of the chain.
+ * @param   uLen        The number of bytes written into the chain.
+ */
+void vqueuePutUsed(PVPCISTATE pState, PVQUEUE pQueue, uint32_t uIndex, uint32_t uLen)
+{
     Log2(("%s vqueuePut: %s used_idx=%u guest_used_idx=%u id=%u len=%u\n", INSTANCE(pState),
-          QUEUENAME(pState, pQueue), pQueue->uNextUsedIndex, vringReadUsedIndex(pState, &pQueue->VRing), pElem->uIndex, uLen));
-    vringWriteUsedElem(pState, &pQueue->VRing, pQueue->uNextUsedIndex++, pElem->uIndex, uLen);
+          QUEUENAME(pState, pQueue), pQueue->uNextUsedIndex, vringReadUsedIndex(pState, &pQueue->VRing), uIndex, uLen));
+    vringWriteUsedElem(pState, &pQueue->VRing, pQueue->uNextUsedIndex++, uIndex, uLen);
+}
+
+/**
+ * Raises a queue interrupt, subject to interrupt moderation.
+ *
+ * The first interrupt after a quiet period is delivered right away. Further
+ * interrupts within the current delay are coalesced into one delivered by
+ * the moderation timer. The delay grows while interrupts keep coming in
+ * quickly or the timer collects many events per interrupt, and shrinks back
+ * when the load goes away.
+ *
+ * @param   pState      The device state structure.
+ */
+static void vpciRaiseQueueInterrupt(PVPCISTATE pState)
+{
+#ifdef IN_RING3
+    if (pState->cUsIntDelayMax)
+    {
+        if (ASMAtomicReadBool(&pState->fIntPending))
+        {
+            /* The timer raises the interrupt after it has cleared fIntPending, i.e. after we've updated the ring. */
+            ASMAtomicIncU32(&pState->cIntEvents);
+            STAM_REL_COUNTER_INC(&pState->StatIntsDeferred);
+            return;
+        }
+
+        uint64_t u64Now   = TMTimerGetNano(pState->pIntTimerR3);
+        uint64_t cNsDelay = (uint64_t)ASMAtomicReadU32(&pState->cUsIntDelay) * 1000;
+        uint64_t cNsSince = u64Now - ASMAtomicReadU64(&pState->u64LastIntNs);
+        if (cNsSince < cNsDelay)
+        {
+            if (!ASMAtomicCmpXchgBool(&pState->fIntPending, true, false))
+            {
+                /* Somebody else armed the timer meanwhile. */
+                ASMAtomicIncU32(&pState->cIntEvents);
+                STAM_REL_COUNTER_INC(&pState->StatIntsDeferred);
+                return;
+            }
+            ASMAtomicWriteU32(&pState->cIntEvents, 1);
+            STAM_REL_COUNTER_INC(&pState->StatIntsDeferred);
+            int rc = TMTimerSetNano(pState->pIntTimerR3, cNsDelay - cNsSince);
+            if (RT_SUCCESS(rc))
+                return;
+            ASMAtomicWriteBool(&pState->fIntPending, false);
+        }
+        else if (cNsSince < (uint64_t)pState->cUsIntDelayMax * 1000)
+        {
+            /* Busy, start coalescing. */
+            uint32_t cUs = ASMAtomicReadU32(&pState->cUsIntDelay);
+            ASMAtomicWriteU32(&pState->cUsIntDelay, RT_MIN(RT_MAX(cUs * 2, 8), pState->cUsIntDelayMax));
+        }
+        else if (cNsSince >= (uint64_t)pState->cUsIntDelayMax * 4000)
+            ASMAtomicWriteU32(&pState->cUsIntDelay, pState->cUsIntDelayMin); /* Idle, back to low latency. */
+        ASMAtomicWriteU64(&pState->u64LastIntNs, u64Now);
+    }
+#endif /* IN_RING3 */
+
+    STAM_REL_COUNTER_INC(&pState->StatIntsQueue);
+    int rc = vpciRaiseInterrupt(pState, VERR_INTERNAL_ERROR, VPCI_ISR_QUEUE);
+    if (RT_FAILURE(rc))
+        Log(("%s vqueueNotify: Failed to raise an interrupt (%Rrc).\n", INSTANCE(pState), rc));
 }
 
 void vqueueNotify(PVPCISTATE pState, PVQUEUE pQueue)
 {
-    LogFlow(("%s vqueueNotify: %s availFlags=%x guestFeatures=%x vqueue is %sempty\n",
-             INSTANCE(pState), QUEUENAME(pState, pQueue),
-             vringReadAvailFlags(pState, &pQueue->VRing),
-             pState->uGuestFeatures, vqueueIsEmpty(pState, pQueue)?"":"not "));
-    if (!(vringReadAvailFlags(pState, &pQueue->VRing) & VRINGAVAIL_F_NO_INTERRUPT)
-        || ((pState->uGuestFeatures & VPCI_F_NOTIFY_ON_EMPTY) && vqueueIsEmpty(pState, pQueue)))
+    bool fNotify;
+
+    if (pState->uGuestFeatures & VPCI_F_RING_EVENT_IDX)
     {
-        int rc = vpciRaiseInterrupt(pState, VERR_INTERNAL_ERROR, VPCI_ISR_QUEUE);
-        if (RT_FAILURE(rc))
-            Log(("%s vqueueNotify: Failed to raise an interrupt (%Rrc).\n", INSTANCE(pState), rc));
+        /* Interrupt only if the used index passed the event index since the last check. */
+        uint16_t uOld   = pQueue->uSignalledUsedIndex;
+        uint16_t uNew   = pQueue->uNextUsedIndex;
+        bool     fValid = pQueue->fSignalledUsedValid;
+
+        pQueue->uSignalledUsedIndex = uNew;
+        pQueue->fSignalledUsedValid = true;
+        fNotify = !fValid
+               || vringNeedEvent(vringReadUsedEvent(pState, &pQueue->VRing), uNew, uOld);
     }
+    else
+        fNotify = !(vringReadAvailFlags(pState, &pQueue->VRing) & VRINGAVAIL_F_NO_INTERRUPT);
+
+    LogFlow(("%s vqueueNotify: %s notify=%RTbool guestFeatures=%x vqueue is %sempty\n",
+             INSTANCE(pState), QUEUENAME(pState, pQueue), fNotify,
+             pState->uGuestFeatures, vqueueIsEmpty(pState, pQueue)?"":"not "));
+    if (   fNotify
+        || ((pState->uGuestFeatures & VPCI_F_NOTIFY_ON_EMPTY) && vqueueIsEmpty(pState, pQueue)))
+        vpciRaiseQueueInterrupt(pState);
     else
     {
         STAM_COUNTER_INC(&pState->StatIntsSkipped);
@@ -259,6 +492,13 @@ void vpciReset(PVPCISTATE pState)
 
     for (unsigned i = 0; i < pState->nQueues; i++)
         vqueueReset(&pState->Queues[i]);
+
+#ifdef IN_RING3
+    /* Drop a deferred interrupt, the rings it was meant for are gone. */
+    if (pState->pIntTimerR3 && ASMAtomicXchgBool(&pState->fIntPending, false))
+        TMTimerStop(pState->pIntTimerR3);
+    pState->cUsIntDelay = pState->cUsIntDelayMin;
+#endif
 }
 
 
@@ -479,6 +719,7 @@ int vpciIOPortOut(PPDMDEVINS                pDevIns,
 #ifdef IN_RING3
             Assert(cb == 2);
             u32 &= 0xFFFF;
+            STAM_REL_COUNTER_INC(&pState->StatQueueNotify);
             if (u32 < pState->nQueues)
                 if (pState->Queues[u32].VRing.addrDescriptors)
                 {
@@ -706,6 +947,12 @@ int vpciSaveExec(PVPCISTATE pState, PSSMHANDLE pSSM)
         AssertRCReturn(rc, rc);
     }
 
+    /* Deferred interrupt */
+    rc = SSMR3PutBool(pSSM, pState->fIntPending);
+    AssertRCReturn(rc, rc);
+    rc = TMR3TimerSave(pState->pIntTimerR3, pSSM);
+    AssertRCReturn(rc, rc);
+
     return VINF_SUCCESS;
 }
 
@@ -739,6 +986,9 @@ int vpciLoadExec(PVPCISTATE pState, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
         {
             rc = SSMR3GetU32(pSSM, &pState->nQueues);
             AssertRCReturn(rc, rc);
+            AssertLogRelMsgReturn(pState->nQueues <= VIRTIO_MAX_NQUEUES,
+                                  ("%s: %u queues saved\n", INSTANCE(pState), pState->nQueues),
+                                  VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
         }
         else
             pState->nQueues = nQueues;
@@ -757,6 +1007,18 @@ int vpciLoadExec(PVPCISTATE pState, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             rc = SSMR3GetU16(pSSM, &pState->Queues[i].uNextUsedIndex);
             AssertRCReturn(rc, rc);
         }
+
+        /* Restore a deferred interrupt, the timer delivers it after resuming. */
+        if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_INT_MODERATION)
+        {
+            bool fIntPending;
+            rc = SSMR3GetBool(pSSM, &fIntPending);
+            AssertRCReturn(rc, rc);
+            rc = TMR3TimerLoad(pState->pIntTimerR3, pSSM);
+            AssertRCReturn(rc, rc);
+            ASMAtomicWriteBool(&pState->fIntPending, fIntPending);
+            ASMAtomicWriteU32(&pState->cIntEvents, fIntPending ? 1 : 0);
+        }
     }
 
     vpciDumpState(pState, "vpciLoadExec");
@@ -796,6 +1058,56 @@ static DECLCALLBACK(void) vpciConfigure(PCIDEVICE& pci,
 #endif
 }
 
+/**
+ * Interrupt moderation timer callback, raises the deferred queue interrupt
+ * and adapts the delay to the number of events it has coalesced.
+ *
+ * @param   pDevIns     Pointer to device instance structure.
+ * @param   pTimer      Pointer to the timer.
+ * @param   pvUser      The device state structure.
+ * @thread  EMT, owns the device critical section.
+ */
+static DECLCALLBACK(void) vpciIntTimer(PPDMDEVINS pDevIns, PTMTIMER pTimer, void *pvUser)
+{
+    PVPCISTATE pState = (PVPCISTATE)pvUser;
+    NOREF(pDevIns);
+    Assert(PDMCritSectIsOwner(&pState->cs));
+
+    if (!ASMAtomicXchgBool(&pState->fIntPending, false))
+        return;
+    uint32_t cEvents = ASMAtomicXchgU32(&pState->cIntEvents, 0);
+    uint32_t cUs     = ASMAtomicReadU32(&pState->cUsIntDelay);
+
+    if (cEvents >= 8)
+        cUs = RT_MIN(RT_MAX(cUs * 2, 1), pState->cUsIntDelayMax);
+    else if (cEvents <= 1)
+        cUs = RT_MAX(cUs / 2, pState->cUsIntDelayMin);
+    ASMAtomicWriteU32(&pState->cUsIntDelay, cUs);
+    ASMAtomicWriteU64(&pState->u64LastIntNs, TMTimerGetNano(pTimer));
+
+    STAM_REL_COUNTER_INC(&pState->StatIntsQueue);
+    Log2(("%s vpciIntTimer: %u events, delay now %u us\n", INSTANCE(pState), cEvents, cUs));
+    vpciRaiseInterrupt(pState, VERR_INTERNAL_ERROR, VPCI_ISR_QUEUE);
+}
+
+/**
+ * Configures the queue interrupt moderation.
+ *
+ * @returns VBox status code.
+ * @param   pState      The device state structure.
+ * @param   cUsMin      The minimum delay between two queue interrupts (us).
+ * @param   cUsMax      The maximum delay between two queue interrupts (us),
+ *                      0 disables moderation.
+ */
+int vpciIntModerationInit(PVPCISTATE pState, uint32_t cUsMin, uint32_t cUsMax)
+{
+    AssertReturn(cUsMin <= cUsMax, VERR_INVALID_PARAMETER);
+    pState->cUsIntDelayMin = cUsMin;
+    pState->cUsIntDelayMax = cUsMax;
+    pState->cUsIntDelay    = cUsMin;
+    return VINF_SUCCESS;
+}
+
 /* WARNING! This function must never be used in multithreaded context! */
 static const char *vpciCounter(const char *pszDevFmt,
                                const char *pszCounter)
@@ -863,6 +1175,20 @@ DECLCALLBACK(int) vpciConstruct(PPDMDEVINS pDevIns, VPCISTATE *pState,
 
     pState->nQueues = nQueues;
 
+    /* Interrupt moderation timer, moderation stays off until the device enables it.
+       It runs under the device lock so the ISR update can't race the ISR read. */
+    rc = PDMDevHlpTMTimerCreate(pDevIns, TMCLOCK_VIRTUAL, vpciIntTimer, pState,
+                                TMTIMER_FLAGS_NO_CRIT_SECT, "VirtIO Interrupt Moderation Timer", &pState->pIntTimerR3);
+    if (RT_FAILURE(rc))
+        return rc;
+    rc = TMR3TimerSetCritSect(pState->pIntTimerR3, &pState->cs);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatQueueNotify,        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of queue notifications by the guest",  vpciCounter(pcszNameFmt, "Queues/Notify"), iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatIntsQueue,          STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of queue interrupts",                  vpciCounter(pcszNameFmt, "Interrupts/Queue"), iInstance);
+    PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatIntsDeferred,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of queue events coalesced by moderation", vpciCounter(pcszNameFmt, "Interrupts/Deferred"), iInstance);
+
 #if defined(VBOX_WITH_STATISTICS)
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatIOReadGC,           STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling IO reads in GC",      vpciCounter(pcszNameFmt, "IO/ReadGC"), iInstance);
     PDMDevHlpSTAMRegisterF(pDevIns, &pState->StatIOReadHC,           STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL, "Profiling IO reads in HC",      vpciCounter(pcszNameFmt, "IO/ReadHC"), iInstance);
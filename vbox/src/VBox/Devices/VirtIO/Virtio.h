@@ -25,17 +25,21 @@
  * The saved state version is changed if either common or any of specific
  * parts are changed. That is, it is perfectly possible that the version
  * of saved vnet state will increase as a result of change in vblk structure
- * for example.
+ * for example.  Devices may go beyond VIRTIO_SAVEDSTATE_VERSION with their
+ * own versions (see VNET_SAVEDSTATE_VERSION), the next common version must
+ * then skip past those.
  */
 #define VIRTIO_SAVEDSTATE_VERSION_3_1_BETA1 1
-#define VIRTIO_SAVEDSTATE_VERSION           2
+#define VIRTIO_SAVEDSTATE_VERSION_PRE_INT_MODERATION 2
+#define VIRTIO_SAVEDSTATE_VERSION           3
 /** @} */
 
 #define DEVICE_PCI_VENDOR_ID                0x1AF4
 #define DEVICE_PCI_DEVICE_ID                0x1000
 #define DEVICE_PCI_SUBSYSTEM_VENDOR_ID      0x1AF4
 
-#define VIRTIO_MAX_NQUEUES                  3
+/** Enough for eight virtio-net queue pairs plus the control queue. */
+#define VIRTIO_MAX_NQUEUES                  17
 
 #define VPCI_HOST_FEATURES                  0x0
 #define VPCI_GUEST_FEATURES                 0x4
@@ -56,11 +60,14 @@
 #define VPCI_STATUS_FAILED                  0x80
 
 #define VPCI_F_NOTIFY_ON_EMPTY              0x01000000
+#define VPCI_F_RING_INDIRECT_DESC           0x10000000
+#define VPCI_F_RING_EVENT_IDX               0x20000000
 #define VPCI_F_BAD_FEATURE                  0x40000000
 
 #define VRINGDESC_MAX_SIZE                  (2 * 1024 * 1024)
 #define VRINGDESC_F_NEXT                    0x01
 #define VRINGDESC_F_WRITE                   0x02
+#define VRINGDESC_F_INDIRECT                0x04
 
 typedef struct VRingDesc
 {
@@ -124,6 +131,12 @@ typedef struct VQueue
     uint16_t uNextAvailIndex;
     uint16_t uNextUsedIndex;
     uint32_t uPageNumber;
+    /** The used index the guest was last checked for an interrupt with
+     * (VPCI_F_RING_EVENT_IDX only). */
+    uint16_t uSignalledUsedIndex;
+    /** Whether uSignalledUsedIndex is valid, cleared when the ring is set up. */
+    bool     fSignalledUsedValid;
+    uint8_t  abPadding[5];
     R3PTRTYPE(PFNVPCIQUEUECALLBACK) pfnCallback;
     R3PTRTYPE(const char *)         pcszName;
 } VQUEUE;
@@ -206,6 +219,35 @@ typedef struct VPCIState_st
     uint32_t               nQueues;       /**< Actual number of queues used. */
     VQUEUE                 Queues[VIRTIO_MAX_NQUEUES];
 
+    /* Interrupt moderation, see vpciIntModerationInit(). */
+    /** Virtual time of the last queue interrupt (ns). */
+    uint64_t volatile      u64LastIntNs;
+    /** Timer delivering deferred queue interrupts - R3. */
+    PTMTIMERR3             pIntTimerR3;
+    /** Current interrupt delay (us), adapted to the load. */
+    uint32_t volatile      cUsIntDelay;
+    /** Lower bound of the interrupt delay (us). */
+    uint32_t               cUsIntDelayMin;
+    /** Upper bound of the interrupt delay (us), 0 if moderation is disabled. */
+    uint32_t               cUsIntDelayMax;
+    /** Number of queue events coalesced into the pending interrupt. */
+    uint32_t volatile      cIntEvents;
+    /** Whether a queue interrupt is pending on the timer. */
+    bool volatile          fIntPending;
+    bool                   afPadding4[3];
+#if HC_ARCH_BITS == 64
+    uint32_t               padding4;
+#else
+    uint32_t               padding4[2];
+#endif
+
+    /** Number of queue notifications (kicks) by the guest. */
+    STAMCOUNTER            StatQueueNotify;
+    /** Number of queue interrupts raised. */
+    STAMCOUNTER            StatIntsQueue;
+    /** Number of queue events coalesced into a deferred interrupt. */
+    STAMCOUNTER            StatIntsDeferred;
+
 #if defined(VBOX_WITH_STATISTICS)
     STAMPROFILEADV         StatIOReadGC;
     STAMPROFILEADV         StatIOReadHC;
@@ -264,6 +306,7 @@ int   vpciDestruct(VPCISTATE* pState);
 void  vpciRelocate(PPDMDEVINS pDevIns, RTGCINTPTR offDelta);
 void  vpciReset(PVPCISTATE pState);
 void *vpciQueryInterface(struct PDMIBASE *pInterface, const char *pszIID);
+int   vpciIntModerationInit(PVPCISTATE pState, uint32_t cUsMin, uint32_t cUsMax);
 PVQUEUE vpciAddQueue(VPCISTATE* pState, unsigned uSize, PFNVPCIQUEUECALLBACK pfnCallback, const char *pcszName);
 
 #define VPCI_CS
@@ -287,6 +330,7 @@ DECLINLINE(void) vpciCsLeave(VPCISTATE *pState)
 }
 
 void vringSetNotification(PVPCISTATE pState, PVRING pVRing, bool fEnabled);
+void vqueueSetNotification(PVPCISTATE pState, PVQUEUE pQueue, bool fEnabled);
 
 DECLINLINE(uint16_t) vringReadAvailIndex(PVPCISTATE pState, PVRING pVRing)
 {
@@ -301,6 +345,7 @@ DECLINLINE(uint16_t) vringReadAvailIndex(PVPCISTATE pState, PVRING pVRing)
 bool vqueueSkip(PVPCISTATE pState, PVQUEUE pQueue);
 bool vqueueGet(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, bool fRemove = true);
 void vqueuePut(PVPCISTATE pState, PVQUEUE pQueue, PVQUEUEELEM pElem, uint32_t uLen, uint32_t uReserved = 0);
+void vqueuePutUsed(PVPCISTATE pState, PVQUEUE pQueue, uint32_t uIndex, uint32_t uLen);
 void vqueueNotify(PVPCISTATE pState, PVQUEUE pQueue);
 void vqueueSync(PVPCISTATE pState, PVQUEUE pQueue);
 
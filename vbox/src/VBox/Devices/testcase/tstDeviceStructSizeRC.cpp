@@ -1304,10 +1304,26 @@ int main()
     GEN_CHECK_OFF(E1KSTATE, IOPortBase);
     GEN_CHECK_OFF(E1KSTATE, pciDevice);
     GEN_CHECK_OFF(E1KSTATE, u64AckedAt);
+    GEN_CHECK_OFF(E1KSTATE, u64RaisedAt);
+    GEN_CHECK_OFF(E1KSTATE, u64IntRateStart);
     GEN_CHECK_OFF(E1KSTATE, fIntRaised);
     GEN_CHECK_OFF(E1KSTATE, fCableConnected);
     GEN_CHECK_OFF(E1KSTATE, fR0Enabled);
     GEN_CHECK_OFF(E1KSTATE, fRCEnabled);
+    GEN_CHECK_OFF(E1KSTATE, fEthernetCRC);
+    GEN_CHECK_OFF(E1KSTATE, fItrEnabled);
+    GEN_CHECK_OFF(E1KSTATE, fItrRxEnabled);
+    GEN_CHECK_OFF(E1KSTATE, fItrAdaptive);
+    GEN_CHECK_OFF(E1KSTATE, fTidEnabled);
+    GEN_CHECK_OFF(E1KSTATE, fRidEnabled);
+    GEN_CHECK_OFF(E1KSTATE, uItrClass);
+    GEN_CHECK_OFF(E1KSTATE, cMsLinkUpDelay);
+    GEN_CHECK_OFF(E1KSTATE, cbSinceInt);
+    GEN_CHECK_OFF(E1KSTATE, cPktsSinceInt);
+    GEN_CHECK_OFF(E1KSTATE, cIntsInWindow);
+    GEN_CHECK_OFF(E1KSTATE, cPktsInWindow);
+    GEN_CHECK_OFF(E1KSTATE, uStatIntsPerSec);
+    GEN_CHECK_OFF(E1KSTATE, uStatPktsPerInt);
     GEN_CHECK_OFF(E1KSTATE, auRegs[E1K_NUM_OF_32BIT_REGS]);
     GEN_CHECK_OFF(E1KSTATE, led);
     GEN_CHECK_OFF(E1KSTATE, u32PktNo);
@@ -1365,6 +1381,14 @@ int main()
     GEN_CHECK_OFF(VPCISTATE, uISR);
     GEN_CHECK_OFF(VPCISTATE, Queues);
     GEN_CHECK_OFF(VPCISTATE, Queues[VIRTIO_MAX_NQUEUES]);
+    GEN_CHECK_OFF(VPCISTATE, u64LastIntNs);
+    GEN_CHECK_OFF(VPCISTATE, pIntTimerR3);
+    GEN_CHECK_OFF(VPCISTATE, cUsIntDelay);
+    GEN_CHECK_OFF(VPCISTATE, cUsIntDelayMin);
+    GEN_CHECK_OFF(VPCISTATE, cUsIntDelayMax);
+    GEN_CHECK_OFF(VPCISTATE, cIntEvents);
+    GEN_CHECK_OFF(VPCISTATE, fIntPending);
+    GEN_CHECK_OFF(VPCISTATE, StatQueueNotify);
     GEN_CHECK_OFF(VNETSTATE, VPCI);
     GEN_CHECK_OFF(VNETSTATE, INetworkDown);
     GEN_CHECK_OFF(VNETSTATE, INetworkConfig);
@@ -1373,20 +1397,14 @@ int main()
     GEN_CHECK_OFF(VNETSTATE, pCanRxQueueR0);
     GEN_CHECK_OFF(VNETSTATE, pCanRxQueueRC);
     GEN_CHECK_OFF(VNETSTATE, pLinkUpTimer);
-# ifdef VNET_TX_DELAY
-    GEN_CHECK_OFF(VNETSTATE, pTxTimerR3);
-    GEN_CHECK_OFF(VNETSTATE, pTxTimerR0);
-    GEN_CHECK_OFF(VNETSTATE, pTxTimerRC);
-# endif /* VNET_TX_DELAY */
     GEN_CHECK_OFF(VNETSTATE, config);
     GEN_CHECK_OFF(VNETSTATE, macConfigured);
     GEN_CHECK_OFF(VNETSTATE, fCableConnected);
     GEN_CHECK_OFF(VNETSTATE, u32PktNo);
     GEN_CHECK_OFF(VNETSTATE, fPromiscuous);
     GEN_CHECK_OFF(VNETSTATE, fAllMulti);
-    GEN_CHECK_OFF(VNETSTATE, pRxQueue);
-    GEN_CHECK_OFF(VNETSTATE, pTxQueue);
-    GEN_CHECK_OFF(VNETSTATE, pCtlQueue);
+    GEN_CHECK_OFF(VNETSTATE, cMaxQueuePairs);
+    GEN_CHECK_OFF(VNETSTATE, cActiveQueuePairs);
     GEN_CHECK_OFF(VNETSTATE, fMaybeOutOfSpace);
     GEN_CHECK_OFF(VNETSTATE, hEventMoreRxDescAvail);
 #endif /* VBOX_WITH_VIRTIO */
@@ -8165,6 +8165,13 @@ HRESULT Console::attachToTapInterface(INetworkAdapter *networkAdapter)
             else
                 memcpy(IfReq.ifr_name, str.c_str(), sizeof(IfReq.ifr_name) - 1); /** @todo bitch about names which are too long... */
             IfReq.ifr_flags = IFF_TAP | IFF_NO_PI;
+#  ifdef IFF_VNET_HDR
+            /* Let DrvTAP exchange GSO frames with the kernel if it can. */
+            unsigned int fTunFeatures = 0;
+            if (   ioctl(maTapFD[slot], TUNGETFEATURES, &fTunFeatures) == 0
+                && (fTunFeatures & IFF_VNET_HDR))
+                IfReq.ifr_flags |= IFF_VNET_HDR;
+#  endif
             rcVBox = ioctl(maTapFD[slot], TUNSETIFF, &IfReq);
             if (rcVBox != 0)
             {
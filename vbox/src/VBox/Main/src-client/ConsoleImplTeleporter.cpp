@@ -28,15 +28,19 @@
 #include "HashedPw.h"
 
 #include <iprt/asm.h>
+#include <iprt/critsect.h>
 #include <iprt/err.h>
+#include <iprt/mem.h>
 #include <iprt/rand.h>
 #include <iprt/socket.h>
 #include <iprt/tcp.h>
 #include <iprt/timer.h>
 
 #include <VBox/vmm/vmapi.h>
+#include <VBox/vmm/pgm.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/err.h>
+#include <VBox/param.h>
 #include <VBox/version.h>
 #include <VBox/com/string.h>
 #include "VBox/com/ErrorInfo.h"
@@ -69,6 +73,32 @@ public:
     bool volatile       mfIOError;
     /** @} */
 
+    /** @name post-copy stuff
+     * @{  */
+    /** Set when both sides agreed on leaving the dirty pages for after the
+     *  hand-over. */
+    bool                mfPostCopy;
+    /** Target: Set while threads waiting for a page may read the socket. */
+    bool volatile       mfPostCopyPump;
+    /** Target: Set when the end of the post-copy pages has been read. */
+    bool volatile       mfPostCopyEnd;
+    /** Source: Set when the end of the post-copy pages has been sent. */
+    bool                mfPostCopyEndSent;
+    /** Target: Serializes reading, page fetches only try to enter it. */
+    RTCRITSECT          mReadCritSect;
+    /** Target: Serializes writing, page requests come from any thread. */
+    RTCRITSECT          mWriteCritSect;
+    /** Target: SSM data read ahead by a page fetch, consumed first by
+     *  teleporterTcpOpRead. */
+    uint8_t            *mpbReadAhead;
+    size_t              mcbReadAhead;
+    size_t              moffReadAhead;
+    size_t              mcbReadAheadAlloc;
+    /** Source: A line other than a page request which came in while serving
+     *  requests, returned by the next teleporterTcpReadLine call. */
+    char                mszStashedLine[256];
+    /** @} */
+
     TeleporterState(Console *pConsole, PUVM pUVM, Progress *pProgress, bool fIsSource)
         : mptrConsole(pConsole)
         , mpUVM(pUVM)
@@ -80,7 +110,18 @@ public:
         , mfStopReading(false)
         , mfEndOfStream(false)
         , mfIOError(false)
+        , mfPostCopy(false)
+        , mfPostCopyPump(false)
+        , mfPostCopyEnd(false)
+        , mfPostCopyEndSent(false)
+        , mpbReadAhead(NULL)
+        , mcbReadAhead(0)
+        , moffReadAhead(0)
+        , mcbReadAheadAlloc(0)
     {
+        mszStashedLine[0] = '\0';
+        RTCritSectInit(&mReadCritSect);
+        RTCritSectInit(&mWriteCritSect);
         VMR3RetainUVM(mpUVM);
     }
 
@@ -88,6 +129,10 @@ public:
     {
         VMR3ReleaseUVM(mpUVM);
         mpUVM = NULL;
+        RTCritSectDelete(&mWriteCritSect);
+        RTCritSectDelete(&mReadCritSect);
+        RTMemFree(mpbReadAhead);
+        mpbReadAhead = NULL;
     }
 };
 
@@ -166,6 +211,12 @@ typedef struct TELEPORTERTCPHDR
 #define TELEPORTERTCPHDR_MAGIC       UINT32_C(0x19471205)
 /** The max block size. */
 #define TELEPORTERTCPHDR_MAX_SIZE    UINT32_C(0x00fffff8)
+/** Magic value for TELEPORTERTCPHDR::u32Magic of post-copy page blocks.
+ * The data is the guest physical address (uint64_t) followed by the page,
+ * a zero size marks the end of the pages. (Keith Jarrett) */
+#define TELEPORTERTCPHDR_PAGE_MAGIC  UINT32_C(0x19450508)
+/** The size of a post-copy page block. */
+#define TELEPORTERTCPHDR_PAGE_SIZE   (sizeof(uint64_t) + PAGE_SIZE)
 
 
 /*******************************************************************************
@@ -174,6 +225,79 @@ typedef struct TELEPORTERTCPHDR
 static const char g_szWelcome[] = "VirtualBox-Teleporter-1.0\n";
 
 
+/**
+ * Processes a block header read by the target.
+ *
+ * Post-copy pages are read and handed to PGM right away.
+ *
+ * @returns VBox status code.
+ * @retval  VINF_SUCCESS if SSM data follows, mcbReadBlock is set.
+ * @retval  VINF_TRY_AGAIN if a post-copy block was consumed.
+ * @retval  VERR_EOF or VERR_SSM_CANCELLED at the end of the SSM stream.
+ *
+ * @param   pState      The teleporter state structure.
+ * @param   pHdr        The header.
+ */
+static int teleporterTcpProcessHdr(TeleporterState *pState, TELEPORTERTCPHDR const *pHdr)
+{
+    if (   pHdr->u32Magic == TELEPORTERTCPHDR_PAGE_MAGIC
+        && pState->mfPostCopy)
+    {
+        if (pHdr->cb == 0)
+        {
+            ASMAtomicWriteBool(&pState->mfPostCopyEnd, true);
+            return VINF_TRY_AGAIN;
+        }
+        if (pHdr->cb != TELEPORTERTCPHDR_PAGE_SIZE)
+        {
+            pState->mfIOError = true;
+            LogRel(("Teleporter/TCP: Invalid page block: cb=%#x\n", pHdr->cb));
+            return VERR_IO_GEN_FAILURE;
+        }
+
+        uint64_t    GCPhys;
+        uint8_t     abPage[PAGE_SIZE];
+        int rc = RTTcpRead(pState->mhSocket, &GCPhys, sizeof(GCPhys), NULL);
+        if (RT_SUCCESS(rc))
+            rc = RTTcpRead(pState->mhSocket, abPage, sizeof(abPage), NULL);
+        if (RT_FAILURE(rc))
+        {
+            pState->mfIOError = true;
+            LogRel(("Teleporter/TCP: Page read error: %Rrc\n", rc));
+            return rc;
+        }
+        rc = PGMR3PostCopyTrgSupplyPage(pState->mpUVM, GCPhys, abPage);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("Teleporter: PGMR3PostCopyTrgSupplyPage(,%RX64,) -> %Rrc\n", GCPhys, rc));
+            return rc;
+        }
+        return VINF_TRY_AGAIN;
+    }
+
+    if (RT_UNLIKELY(   pHdr->u32Magic != TELEPORTERTCPHDR_MAGIC
+                    || pHdr->cb > TELEPORTERTCPHDR_MAX_SIZE
+                    || pHdr->cb == 0))
+    {
+        if (    pHdr->u32Magic == TELEPORTERTCPHDR_MAGIC
+            &&  (   pHdr->cb == 0
+                 || pHdr->cb == UINT32_MAX)
+           )
+        {
+            pState->mfEndOfStream = true;
+            pState->mcbReadBlock  = 0;
+            return pHdr->cb ? VERR_SSM_CANCELLED : VERR_EOF;
+        }
+        pState->mfIOError = true;
+        LogRel(("Teleporter/TCP: Invalid block: u32Magic=%#x cb=%#x\n", pHdr->u32Magic, pHdr->cb));
+        return VERR_IO_GEN_FAILURE;
+    }
+
+    pState->mcbReadBlock = pHdr->cb;
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Reads a string from the socket.
  *
@@ -192,6 +316,14 @@ static int teleporterTcpReadLine(TeleporterState *pState, char *pszBuf, size_t c
     AssertReturn(cchBuf > 1, VERR_INTERNAL_ERROR);
     *pszBuf = '\0';
 
+    /* A line which came in while serving post-copy page requests. */
+    if (pState->mszStashedLine[0])
+    {
+        int rc = RTStrCopy(pszBuf, cchBuf, pState->mszStashedLine);
+        pState->mszStashedLine[0] = '\0';
+        return rc;
+    }
+
     /* dead simple approach. */
     for (;;)
     {
@@ -202,6 +334,28 @@ static int teleporterTcpReadLine(TeleporterState *pState, char *pszBuf, size_t c
             LogRel(("Teleporter: RTTcpRead -> %Rrc while reading string ('%s')\n", rc, pszStart));
             return rc;
         }
+        if (   pszBuf == pszStart
+            && ch == (char)RT_BYTE1(TELEPORTERTCPHDR_PAGE_MAGIC)
+            && pState->mfPostCopy
+            && !pState->mfIsSource)
+        {
+            /* A post-copy page answering a request made while waiting for a command. */
+            uint8_t abHdr[sizeof(TELEPORTERTCPHDR)];
+            abHdr[0] = (uint8_t)ch;
+            rc = RTTcpRead(Sock, &abHdr[1], sizeof(abHdr) - 1, NULL);
+            if (RT_SUCCESS(rc))
+            {
+                TELEPORTERTCPHDR Hdr;
+                memcpy(&Hdr, abHdr, sizeof(Hdr));
+                rc = teleporterTcpProcessHdr(pState, &Hdr);
+                if (rc == VINF_TRY_AGAIN)
+                    continue;
+                if (RT_SUCCESS(rc))
+                    rc = VERR_IO_GEN_FAILURE;
+            }
+            LogRel(("Teleporter: %Rrc while reading a page block instead of a string\n", rc));
+            return rc;
+        }
         if (    ch == '\n'
             ||  ch == '\0')
             return VINF_SUCCESS;
@@ -217,6 +371,95 @@ static int teleporterTcpReadLine(TeleporterState *pState, char *pszBuf, size_t c
 }
 
 
+/**
+ * Sends a post-copy page to the target.
+ *
+ * @returns VBox status code.
+ * @param   pState      The teleporter state structure.
+ * @param   GCPhys      The guest physical address of the page.
+ */
+static int teleporterSrcSendPage(TeleporterState *pState, RTGCPHYS GCPhys)
+{
+    uint8_t abPage[PAGE_SIZE];
+    int rc = PGMR3PostCopySrcGetPage(pState->mpUVM, GCPhys, abPage);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("Teleporter: PGMR3PostCopySrcGetPage(,%RGp,) -> %Rrc\n", GCPhys, rc));
+        return rc;
+    }
+
+    TELEPORTERTCPHDR Hdr;
+    Hdr.u32Magic = TELEPORTERTCPHDR_PAGE_MAGIC;
+    Hdr.cb       = TELEPORTERTCPHDR_PAGE_SIZE;
+    uint64_t u64GCPhys = GCPhys;
+    rc = RTTcpSgWriteL(pState->mhSocket, 3, &Hdr, sizeof(Hdr), &u64GCPhys, sizeof(u64GCPhys), abPage, sizeof(abPage));
+    if (RT_FAILURE(rc))
+        LogRel(("Teleporter/TCP: Page write error: %Rrc\n", rc));
+    return rc;
+}
+
+
+/**
+ * Serves a post-copy page request.
+ *
+ * @returns VBox status code.
+ * @param   pState      The teleporter state structure.
+ * @param   pszLine     The request line ("page=<hex address>").
+ */
+static int teleporterSrcServeRequest(TeleporterState *pState, const char *pszLine)
+{
+    uint64_t u64GCPhys;
+    int rc = RTStrToUInt64Full(&pszLine[sizeof("page=") - 1], 16, &u64GCPhys);
+    if (rc != VINF_SUCCESS)
+    {
+        LogRel(("Teleporter: Malformed page request '%s'\n", pszLine));
+        return VERR_INVALID_PARAMETER;
+    }
+    return teleporterSrcSendPage(pState, u64GCPhys);
+}
+
+
+/**
+ * Serves the post-copy page requests the target has sent so far.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_SSM_CANCELLED if something else came in, it is stashed for
+ *          the next teleporterTcpReadLine call.
+ *
+ * @param   pState      The teleporter state structure.
+ */
+static int teleporterSrcServeRequests(TeleporterState *pState)
+{
+    while (!pState->mszStashedLine[0])
+    {
+        int rc = RTTcpSelectOne(pState->mhSocket, 0);
+        if (rc == VERR_TIMEOUT)
+            return VINF_SUCCESS;
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("Teleporter/TCP: RTTcpSelectOne -> %Rrc (post-copy).\n", rc));
+            return rc;
+        }
+
+        char szLine[sizeof(pState->mszStashedLine)];
+        rc = teleporterTcpReadLine(pState, szLine, sizeof(szLine));
+        if (RT_FAILURE(rc))
+            return rc;
+        if (strncmp(szLine, RT_STR_TUPLE("page=")))
+        {
+            LogRel(("Teleporter/TCP: Incoming '%s' while serving page requests, assuming it is a cancellation NACK.\n", szLine));
+            RTStrCopy(pState->mszStashedLine, sizeof(pState->mszStashedLine), szLine);
+            break;
+        }
+
+        rc = teleporterSrcServeRequest(pState, szLine);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VERR_SSM_CANCELLED;
+}
+
+
 /**
  * Reads an ACK or NACK.
  *
@@ -233,6 +476,17 @@ Console::teleporterSrcReadACK(TeleporterStateSrc *pState, const char *pszWhich,
 {
     char szMsg[256];
     int vrc = teleporterTcpReadLine(pState, szMsg, sizeof(szMsg));
+    while (   RT_SUCCESS(vrc)
+           && pState->mfPostCopy
+           && !strncmp(szMsg, RT_STR_TUPLE("page=")))
+    {
+        /* The target is waiting for a page, serve it unless they've all been
+           pushed already. */
+        if (!pState->mfPostCopyEndSent)
+            vrc = teleporterSrcServeRequest(pState, szMsg);
+        if (RT_SUCCESS(vrc))
+            vrc = teleporterTcpReadLine(pState, szMsg, sizeof(szMsg));
+    }
     if (RT_FAILURE(vrc))
         return setError(E_FAIL, tr("Failed reading ACK(%s): %Rrc"), pszWhich, vrc);
 
@@ -315,6 +569,14 @@ static DECLCALLBACK(int) teleporterTcpOpWrite(void *pvUser, uint64_t offStream,
     AssertReturn(cbToWrite < UINT32_MAX, VERR_OUT_OF_RANGE);
     AssertReturn(pState->mfIsSource, VERR_INVALID_HANDLE);
 
+    /* Pages the target needs to finish loading come first. */
+    if (pState->mfPostCopy)
+    {
+        int rc = teleporterSrcServeRequests(pState);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     for (;;)
     {
         TELEPORTERTCPHDR Hdr;
@@ -371,17 +633,39 @@ static int teleporterTcpReadSelect(TeleporterState *pState)
 
 
 /**
+ * Reads from the socket, target side, caller owns mReadCritSect.
+ *
  * @copydoc SSMSTRMOPS::pfnRead
  */
-static DECLCALLBACK(int) teleporterTcpOpRead(void *pvUser, uint64_t offStream, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+static int teleporterTcpOpReadLocked(TeleporterState *pState, void *pvBuf, size_t cbToRead, size_t *pcbRead)
 {
-    TeleporterState *pState = (TeleporterState *)pvUser;
-    AssertReturn(!pState->mfIsSource, VERR_INVALID_HANDLE);
-
     for (;;)
     {
         int rc;
 
+        /*
+         * Data read ahead by a post-copy page fetch goes first.
+         */
+        if (pState->moffReadAhead < pState->mcbReadAhead)
+        {
+            size_t cb = RT_MIN(pState->mcbReadAhead - pState->moffReadAhead, cbToRead);
+            memcpy(pvBuf, &pState->mpbReadAhead[pState->moffReadAhead], cb);
+            pState->moffReadAhead += cb;
+            if (pState->moffReadAhead == pState->mcbReadAhead)
+                pState->moffReadAhead = pState->mcbReadAhead = 0;
+            pState->moffStream += cb;
+            if (pcbRead)
+            {
+                *pcbRead = cb;
+                return VINF_SUCCESS;
+            }
+            if (cbToRead == cb)
+                return VINF_SUCCESS;
+            cbToRead -= cb;
+            pvBuf = (uint8_t *)pvBuf + cb;
+            continue;
+        }
+
         /*
          * Check for various conditions and may have been signalled.
          */
@@ -410,25 +694,11 @@ static DECLCALLBACK(int) teleporterTcpOpRead(void *pvUser, uint64_t offStream, v
                 return rc;
             }
 
-            if (RT_UNLIKELY(   Hdr.u32Magic != TELEPORTERTCPHDR_MAGIC
-                            || Hdr.cb > TELEPORTERTCPHDR_MAX_SIZE
-                            || Hdr.cb == 0))
-            {
-                if (    Hdr.u32Magic == TELEPORTERTCPHDR_MAGIC
-                    &&  (   Hdr.cb == 0
-                         || Hdr.cb == UINT32_MAX)
-                   )
-                {
-                    pState->mfEndOfStream = true;
-                    pState->mcbReadBlock  = 0;
-                    return Hdr.cb ? VERR_SSM_CANCELLED : VERR_EOF;
-                }
-                pState->mfIOError = true;
-                LogRel(("Teleporter/TCP: Invalid block: u32Magic=%#x cb=%#x\n", Hdr.u32Magic, Hdr.cb));
-                return VERR_IO_GEN_FAILURE;
-            }
-
-            pState->mcbReadBlock = Hdr.cb;
+            rc = teleporterTcpProcessHdr(pState, &Hdr);
+            if (rc == VINF_TRY_AGAIN)
+                continue;
+            if (rc != VINF_SUCCESS)
+                return rc;
             if (pState->mfStopReading)
                 return VERR_EOF;
         }
@@ -466,6 +736,165 @@ static DECLCALLBACK(int) teleporterTcpOpRead(void *pvUser, uint64_t offStream, v
 }
 
 
+/**
+ * @copydoc SSMSTRMOPS::pfnRead
+ */
+static DECLCALLBACK(int) teleporterTcpOpRead(void *pvUser, uint64_t offStream, void *pvBuf, size_t cbToRead, size_t *pcbRead)
+{
+    TeleporterState *pState = (TeleporterState *)pvUser;
+    AssertReturn(!pState->mfIsSource, VERR_INVALID_HANDLE);
+
+    RTCritSectEnter(&pState->mReadCritSect);
+    int rc = teleporterTcpOpReadLocked(pState, pvBuf, cbToRead, pcbRead);
+    RTCritSectLeave(&pState->mReadCritSect);
+    return rc;
+}
+
+
+/**
+ * Reads the next block on behalf of a thread waiting for a post-copy page,
+ * target side, caller owns mReadCritSect.
+ *
+ * SSM data is put aside for teleporterTcpOpRead.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_TIMEOUT if nothing came in within @a cMsTimeout.
+ *
+ * @param   pState      The teleporter state structure.
+ * @param   cMsTimeout  How long to wait for the next block header.
+ */
+static int teleporterTrgPumpBlock(TeleporterState *pState, RTMSINTERVAL cMsTimeout)
+{
+    if (pState->mfIOError)
+        return VERR_IO_GEN_FAILURE;
+
+    if (!pState->mcbReadBlock)
+    {
+        int rc = RTTcpSelectOne(pState->mhSocket, cMsTimeout);
+        if (RT_FAILURE(rc))
+        {
+            if (rc != VERR_TIMEOUT)
+            {
+                pState->mfIOError = true;
+                LogRel(("Teleporter/TCP: Header select error: %Rrc (post-copy)\n", rc));
+            }
+            return rc;
+        }
+        TELEPORTERTCPHDR Hdr;
+        rc = RTTcpRead(pState->mhSocket, &Hdr, sizeof(Hdr), NULL);
+        if (RT_FAILURE(rc))
+        {
+            pState->mfIOError = true;
+            LogRel(("Teleporter/TCP: Header read error: %Rrc (post-copy)\n", rc));
+            return rc;
+        }
+        rc = teleporterTcpProcessHdr(pState, &Hdr);
+        if (rc != VINF_SUCCESS)
+            return rc == VERR_EOF || rc == VERR_SSM_CANCELLED ? VINF_SUCCESS : rc; /* OpRead picks up mfEndOfStream. */
+    }
+
+    /*
+     * Put the rest of the SSM block aside.
+     */
+    size_t const cbNeeded = pState->mcbReadAhead + pState->mcbReadBlock;
+    if (cbNeeded > pState->mcbReadAheadAlloc)
+    {
+        void *pvNew = RTMemRealloc(pState->mpbReadAhead, RT_ALIGN_Z(cbNeeded, _64K));
+        if (!pvNew)
+            return VERR_NO_MEMORY;
+        pState->mpbReadAhead      = (uint8_t *)pvNew;
+        pState->mcbReadAheadAlloc = RT_ALIGN_Z(cbNeeded, _64K);
+    }
+    int rc = RTTcpRead(pState->mhSocket, &pState->mpbReadAhead[pState->mcbReadAhead], pState->mcbReadBlock, NULL);
+    if (RT_FAILURE(rc))
+    {
+        pState->mfIOError = true;
+        LogRel(("Teleporter/TCP: Data read error: %Rrc (post-copy, cb=%#x)\n", rc, pState->mcbReadBlock));
+        return rc;
+    }
+    pState->mcbReadAhead = cbNeeded;
+    pState->mcbReadBlock = 0;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @copydoc FNPGMR3POSTCOPYFETCH
+ */
+static DECLCALLBACK(int) teleporterTrgPostCopyFetch(PUVM pUVM, RTGCPHYS GCPhys, bool fFirst, void *pvUser)
+{
+    TeleporterState *pState = (TeleporterState *)pvUser;
+    int rc;
+    NOREF(pUVM);
+
+    if (fFirst)
+    {
+        char    szLine[64];
+        size_t  cch = RTStrPrintf(szLine, sizeof(szLine), "page=%RX64\n", (uint64_t)GCPhys);
+        RTCritSectEnter(&pState->mWriteCritSect);
+        rc = RTTcpWrite(pState->mhSocket, szLine, cch);
+        RTCritSectLeave(&pState->mWriteCritSect);
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("Teleporter: RTTcpWrite(,%RGp,) -> %Rrc (post-copy)\n", GCPhys, rc));
+            return rc;
+        }
+    }
+
+    /* Read the page ourselves if nobody else is reading. */
+    rc = VINF_SUCCESS;
+    if (   ASMAtomicReadBool(&pState->mfPostCopyPump)
+        && RT_SUCCESS(RTCritSectTryEnter(&pState->mReadCritSect)))
+    {
+        rc = teleporterTrgPumpBlock(pState, 10);
+        RTCritSectLeave(&pState->mReadCritSect);
+        if (rc == VERR_TIMEOUT)
+            rc = VINF_SUCCESS;
+    }
+    return rc;
+}
+
+
+/**
+ * Receives the post-copy pages the source sends after the hand-over.
+ *
+ * @returns VBox status code.
+ * @param   pState      The teleporter state structure.
+ */
+static int teleporterTrgPostCopyReceive(TeleporterState *pState)
+{
+    int rc = VINF_SUCCESS;
+    RTCritSectEnter(&pState->mReadCritSect);
+    while (!ASMAtomicReadBool(&pState->mfPostCopyEnd))
+    {
+        rc = teleporterTcpReadSelect(pState);
+        if (RT_FAILURE(rc))
+            break;
+        TELEPORTERTCPHDR Hdr;
+        rc = RTTcpRead(pState->mhSocket, &Hdr, sizeof(Hdr), NULL);
+        if (RT_FAILURE(rc))
+        {
+            pState->mfIOError = true;
+            LogRel(("Teleporter/TCP: Header read error: %Rrc (post-copy)\n", rc));
+            break;
+        }
+        rc = teleporterTcpProcessHdr(pState, &Hdr);
+        if (rc != VINF_TRY_AGAIN)
+        {
+            if (RT_SUCCESS(rc))
+            {
+                LogRel(("Teleporter/TCP: Unexpected block after the hand-over: u32Magic=%#x cb=%#x\n", Hdr.u32Magic, Hdr.cb));
+                rc = VERR_IO_GEN_FAILURE;
+            }
+            break;
+        }
+        rc = VINF_SUCCESS;
+    }
+    RTCritSectLeave(&pState->mReadCritSect);
+    return rc;
+}
+
+
 /**
  * @copydoc SSMSTRMOPS::pfnSeek
  */
@@ -501,7 +930,13 @@ static DECLCALLBACK(int) teleporterTcpOpIsOk(void *pvUser)
 {
     TeleporterState *pState = (TeleporterState *)pvUser;
 
-    if (pState->mfIsSource)
+    if (pState->mfIsSource && pState->mfPostCopy)
+    {
+        /* Page requests come in, so only teleporterTcpOpWrite reads the socket. */
+        if (pState->mszStashedLine[0])
+            return VERR_SSM_CANCELLED;
+    }
+    else if (pState->mfIsSource)
     {
         /* Poll for incoming NACKs and errors from the other side */
         int rc = RTTcpSelectOne(pState->mhSocket, 0);
@@ -618,6 +1053,54 @@ static DECLCALLBACK(void) teleporterDstTimeout(RTTIMERLR hTimerLR, void *pvUser,
 }
 
 
+/**
+ * Sends the pages left for after the hand-over, serving the requests for
+ * pages the target is waiting for first.
+ *
+ * @returns S_OK once the target has got them all, E_FAIL+setError() on
+ *          failure.
+ * @param   pState              The teleporter source state.
+ */
+HRESULT
+Console::teleporterSrcPostCopy(TeleporterStateSrc *pState)
+{
+    int vrc;
+    for (;;)
+    {
+        vrc = teleporterSrcServeRequests(pState);
+        if (RT_FAILURE(vrc))
+            break;
+        RTGCPHYS GCPhys;
+        vrc = PGMR3PostCopySrcNextPage(pState->mpUVM, &GCPhys);
+        if (RT_FAILURE(vrc))
+            break;
+        vrc = teleporterSrcSendPage(pState, GCPhys);
+        if (RT_FAILURE(vrc))
+            break;
+    }
+    if (vrc != VERR_NOT_FOUND)
+    {
+        if (pState->mszStashedLine[0])
+        {
+            HRESULT hrc = teleporterSrcReadACK(pState, "post-copy");
+            if (FAILED(hrc))
+                return hrc;
+        }
+        return setError(E_FAIL, tr("Failed sending the remaining guest memory: %Rrc"), vrc);
+    }
+
+    TELEPORTERTCPHDR EndHdr;
+    EndHdr.u32Magic = TELEPORTERTCPHDR_PAGE_MAGIC;
+    EndHdr.cb       = 0;
+    vrc = RTTcpWrite(pState->mhSocket, &EndHdr, sizeof(EndHdr));
+    if (RT_FAILURE(vrc))
+        return setError(E_FAIL, tr("Failed writing the end of the guest memory: %Rrc"), vrc);
+    pState->mfPostCopyEndSent = true;
+
+    return teleporterSrcReadACK(pState, "post-copy");
+}
+
+
 /**
  * Do the teleporter.
  *
@@ -680,6 +1163,36 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
      *       verified against the VM config on the other end.  This is all done
      *       in the first pass, so we should fail pretty promptly on misconfig.
      */
+    /*
+     * Leave the pages still dirty at the end for after the hand-over if the
+     * target can do that.  This must be agreed on before loading starts.
+     */
+    Bstr bstrPostCopy;
+    hrc = mMachine->GetExtraData(Bstr("VBoxInternal2/TeleporterPostCopy").raw(), bstrPostCopy.asOutParam());
+    if (   hrc          == S_OK
+        && bstrPostCopy == "1")
+    {
+        vrc = PGMR3PostCopySrcEnable(pState->mpUVM, true /*fEnable*/);
+        if (RT_SUCCESS(vrc))
+        {
+            hrc = teleporterSrcSubmitCommand(pState, "postcopy", false /*fWaitForAck*/);
+            if (FAILED(hrc))
+                return hrc;
+            vrc = teleporterTcpReadLine(pState, szLine, sizeof(szLine));
+            if (RT_FAILURE(vrc))
+                return setError(E_FAIL, tr("Failed reading ACK(postcopy): %Rrc"), vrc);
+            if (!strcmp(szLine, "ACK"))
+                pState->mfPostCopy = true;
+            else
+            {
+                LogRel(("Teleporter: The target declined post-copy ('%s')\n", szLine));
+                PGMR3PostCopySrcEnable(pState->mpUVM, false /*fEnable*/);
+            }
+        }
+        else
+            LogRel(("Teleporter: PGMR3PostCopySrcEnable -> %Rrc\n", vrc));
+    }
+
     hrc = teleporterSrcSubmitCommand(pState, "load");
     if (FAILED(hrc))
         return hrc;
@@ -695,7 +1208,8 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
     if (RT_FAILURE(vrc))
     {
         if (   vrc == VERR_SSM_CANCELLED
-            && RT_SUCCESS(RTTcpSelectOne(pState->mhSocket, 1)))
+            && (   pState->mszStashedLine[0]
+                || RT_SUCCESS(RTTcpSelectOne(pState->mhSocket, 1))))
         {
             hrc = teleporterSrcReadACK(pState, "load-complete");
             if (FAILED(hrc))
@@ -743,6 +1257,16 @@ Console::teleporterSrc(TeleporterStateSrc *pState)
     if (FAILED(hrc))
         return hrc;
 
+    /*
+     * The target runs the VM now, send it the rest of the memory.
+     */
+    if (pState->mfPostCopy)
+    {
+        hrc = teleporterSrcPostCopy(pState);
+        if (FAILED(hrc))
+            return hrc;
+    }
+
     /*
      * teleporterSrcThreadWrapper will do the automatic power off because it
      * has to release the AutoVMCaller.
@@ -772,6 +1296,8 @@ Console::teleporterSrcThreadWrapper(RTTHREAD hThread, void *pvUser)
 
     if (SUCCEEDED(hrc))
         hrc = pState->mptrConsole->teleporterSrc(pState);
+    if (pState->mfPostCopy)
+        PGMR3PostCopySrcDone(pState->mpUVM);
 
     /* Close the connection ASAP on so that the other side can complete. */
     if (pState->mhSocket != NIL_RTSOCKET)
@@ -1208,7 +1734,9 @@ static void teleporterTrgUnlockMedia(TeleporterStateTrg *pState)
 
 static int teleporterTcpWriteACK(TeleporterStateTrg *pState, bool fAutomaticUnlock = true)
 {
+    RTCritSectEnter(&pState->mWriteCritSect);
     int rc = RTTcpWrite(pState->mhSocket, "ACK\n", sizeof("ACK\n") - 1);
+    RTCritSectLeave(&pState->mWriteCritSect);
     if (RT_FAILURE(rc))
     {
         LogRel(("Teleporter: RTTcpWrite(,ACK,) -> %Rrc\n", rc));
@@ -1238,7 +1766,9 @@ static int teleporterTcpWriteNACK(TeleporterStateTrg *pState, int32_t rc2, const
     }
     else
         cch = RTStrPrintf(szMsg, sizeof(szMsg), "NACK=%d\n", rc2);
+    RTCritSectEnter(&pState->mWriteCritSect);
     int rc = RTTcpWrite(pState->mhSocket, szMsg, cch);
+    RTCritSectLeave(&pState->mWriteCritSect);
     if (RT_FAILURE(rc))
         LogRel(("Teleporter: RTTcpWrite(,%s,%zu) -> %Rrc\n", szMsg, cch, rc));
     return rc;
@@ -1344,9 +1874,11 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
             pState->moffStream = 0;
 
             void *pvUser2 = static_cast<void *>(static_cast<TeleporterState *>(pState));
+            ASMAtomicWriteBool(&pState->mfPostCopyPump, pState->mfPostCopy);
             vrc = VMR3LoadFromStream(pState->mpUVM,
                                      &g_teleporterTcpOps, pvUser2,
                                      teleporterProgressCallback, pvUser2);
+            ASMAtomicWriteBool(&pState->mfPostCopyPump, false);
 
             RTSocketRelease(pState->mhSocket);
             vrc2 = VMR3AtErrorDeregister(pState->mpUVM, Console::genericVMSetErrorCallback, &pState->mErrorText); AssertRC(vrc2);
@@ -1371,6 +1903,22 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
 
             vrc = teleporterTcpWriteACK(pState);
         }
+        else if (!strcmp(szCmd, "postcopy"))
+        {
+            /* A NACK makes the source fall back on pre-copy only. */
+            vrc = PGMR3PostCopyTrgRegister(pState->mpUVM, teleporterTrgPostCopyFetch,
+                                           static_cast<TeleporterState *>(pState));
+            if (RT_SUCCESS(vrc))
+            {
+                pState->mfPostCopy = true;
+                vrc = teleporterTcpWriteACK(pState);
+            }
+            else
+            {
+                LogRel(("Teleporter: PGMR3PostCopyTrgRegister -> %Rrc\n", vrc));
+                vrc = teleporterTcpWriteNACK(pState, vrc);
+            }
+        }
         else if (!strcmp(szCmd, "cancel"))
         {
             /* Don't ACK this. */
@@ -1408,6 +1956,9 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
             if (   pState->mptrProgress->notifyPointOfNoReturn()
                 && pState->mfLockedMedia)
             {
+                /* Threads needing a page the source hasn't sent yet must be
+                   able to read it while we're resuming. */
+                ASMAtomicWriteBool(&pState->mfPostCopyPump, pState->mfPostCopy);
                 vrc = teleporterTcpWriteACK(pState);
                 if (RT_SUCCESS(vrc))
                 {
@@ -1415,9 +1966,25 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
                         vrc = VMR3Resume(pState->mpUVM);
                     else
                         pState->mptrConsole->setMachineState(MachineState_Paused);
+                    if (pState->mfPostCopy)
+                    {
+                        if (RT_SUCCESS(vrc))
+                            vrc = teleporterTrgPostCopyReceive(pState);
+                        ASMAtomicWriteBool(&pState->mfPostCopyPump, false);
+                        if (RT_SUCCESS(vrc))
+                            vrc = PGMR3PostCopyTrgComplete(pState->mpUVM);
+                        if (RT_SUCCESS(vrc))
+                            vrc = teleporterTcpWriteACK(pState);
+                        else
+                        {
+                            LogRel(("Teleporter: Post-copy failed: %Rrc\n", vrc));
+                            teleporterTcpWriteNACK(pState, vrc);
+                        }
+                    }
                     fDone = true;
                     break;
                 }
+                ASMAtomicWriteBool(&pState->mfPostCopyPump, false);
             }
             else
             {
@@ -1440,6 +2007,8 @@ Console::teleporterTrgServeConnection(RTSOCKET Sock, void *pvUser)
         vrc = VERR_WRONG_ORDER;
     if (RT_FAILURE(vrc))
         teleporterTrgUnlockMedia(pState);
+    if (RT_FAILURE(vrc) && pState->mfPostCopy)
+        PGMR3PostCopyTrgAbort(pState->mpUVM, vrc);
 
     pState->mRc = vrc;
     pState->mhSocket = NIL_RTSOCKET;
@@ -1800,6 +1800,32 @@ RTDECL(int) RTZipBlockCompress(RTZIPTYPE enmType, RTZIPLEVEL enmLevel, uint32_t
         }
 
         case RTZIPTYPE_ZLIB:
+        {
+#ifdef RTZIP_USE_ZLIB
+            int iLevel = Z_DEFAULT_COMPRESSION;
+            switch (enmLevel)
+            {
+                case RTZIPLEVEL_STORE:      iLevel = 0; break;
+                case RTZIPLEVEL_FAST:       iLevel = 1; break;
+                case RTZIPLEVEL_DEFAULT:    iLevel = Z_DEFAULT_COMPRESSION; break;
+                case RTZIPLEVEL_MAX:        iLevel = 9; break;
+            }
+
+            uLongf cbDstActual = (uLongf)cbDst;                 Assert(cbDstActual == cbDst);
+            int rc = compress2((Bytef *)pvDst, &cbDstActual, (const Bytef *)pvSrc, (uLong)cbSrc, iLevel);
+            if (RT_UNLIKELY(rc != Z_OK))
+            {
+                if (rc == Z_BUF_ERROR)
+                    return VERR_BUFFER_OVERFLOW;
+                return zipErrConvertFromZlib(rc, true /*fCompressing*/);
+            }
+            *pcbDstActual = cbDstActual;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
 
@@ -1915,6 +1941,26 @@ RTDECL(int) RTZipBlockDecompress(RTZIPTYPE enmType, uint32_t fFlags,
         }
 
         case RTZIPTYPE_ZLIB:
+        {
+#ifdef RTZIP_USE_ZLIB
+            uLongf cbDstActual = (uLongf)cbDst;                 Assert(cbDstActual == cbDst);
+            int rc = uncompress((Bytef *)pvDst, &cbDstActual, (const Bytef *)pvSrc, (uLong)cbSrc);
+            if (RT_UNLIKELY(rc != Z_OK))
+            {
+                if (rc == Z_BUF_ERROR)
+                    return VERR_BUFFER_OVERFLOW;
+                return zipErrConvertFromZlib(rc, false /*fCompressing*/);
+            }
+            if (pcbSrcActual)
+                *pcbSrcActual = cbSrc;
+            if (pcbDstActual)
+                *pcbDstActual = cbDstActual;
+            break;
+#else
+            return VERR_NOT_SUPPORTED;
+#endif
+        }
+
         case RTZIPTYPE_BZLIB:
             return VERR_NOT_SUPPORTED;
 
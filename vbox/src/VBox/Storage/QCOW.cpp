@@ -27,9 +27,12 @@
 #include <iprt/assert.h>
 #include <iprt/string.h>
 #include <iprt/alloc.h>
+#include <iprt/avl.h>
 #include <iprt/path.h>
 #include <iprt/list.h>
 
+#include "VDMetaCache.h"
+
 /**
  * The QCOW backend implements support for the qemu copy on write format (short QCOW)
  * There is no official specification available but the format is described
@@ -137,10 +140,10 @@ typedef QCowHeader *PQCowHeader;
  */
 typedef struct QCOWL2CACHEENTRY
 {
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
-    /** List node for the LRU list. */
-    RTLISTNODE              NodeLru;
+    /** AVL tree node, the offset of the L2 table is the key. */
+    AVLRU64NODECORE         Core;
+    /** Metadata cache entry, links the entry into the shared LRU list. */
+    VDMETACACHEENTRY        MetaEntry;
     /** Reference counter. */
     uint32_t                cRefs;
     /** The offset of the L2 table, used as search key. */
@@ -149,7 +152,8 @@ typedef struct QCOWL2CACHEENTRY
     uint64_t               *paL2Tbl;
 } QCOWL2CACHEENTRY, *PQCOWL2CACHEENTRY;
 
-/** Maximum amount of memory the cache is allowed to use. */
+/** Default amount of memory the cache is allowed to use,
+ * can be changed with the L2CacheSize config key. */
 #define QCOW_L2_CACHE_MEMORY_MAX (2*_1M)
 
 /** QCOW default cluster size for image version 2. */
@@ -218,12 +222,10 @@ typedef struct QCOWIMAGE
     uint32_t            cbL2Table;
     /** Number of entries in the L2 table. */
     uint32_t            cL2TableEntries;
-    /** Memory occupied by the L2 table cache. */
-    size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
-    /** The LRU L2 entry list used for eviction. */
-    RTLISTNODE          ListLru;
+    /** The L2 table cache accounting against the shared budget. */
+    VDMETACACHE         L2Cache;
+    /** The cached L2 tables used for searching. */
+    AVLRU64TREE         TreeL2Tbls;
 
     /** Offset of the refcount table. */
     uint64_t            offRefcountTable;
@@ -480,6 +482,32 @@ static void qcowRefcountTableConvertFromHostEndianess(uint16_t *paTblImg, uint16
     }
 }
 
+/**
+ * Evicts an unused L2 table from the cache, called by the shared metadata cache
+ * with the lock held.
+ *
+ * @returns true if the entry was evicted, false if it is in use.
+ * @param   pvUser    The image instance data.
+ * @param   pEntry    The metadata cache entry to evict.
+ */
+static DECLCALLBACK(bool) qcowL2TblCacheEntryEvict(void *pvUser, PVDMETACACHEENTRY pEntry)
+{
+    PQCOWIMAGE pImage = (PQCOWIMAGE)pvUser;
+    PQCOWL2CACHEENTRY pL2Entry = RT_FROM_MEMBER(pEntry, QCOWL2CACHEENTRY, MetaEntry);
+
+    if (pL2Entry->cRefs)
+        return false;
+
+    PAVLRU64NODECORE pRemoved = RTAvlrU64Remove(&pImage->TreeL2Tbls, pL2Entry->Core.Key);
+    Assert(pRemoved == &pL2Entry->Core); NOREF(pRemoved);
+    vdMetaCacheEntryRemove(&pL2Entry->MetaEntry);
+    vdMetaCacheRelease(&pImage->L2Cache, pImage->cbL2Table);
+
+    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
+    RTMemFree(pL2Entry);
+    return true;
+}
+
 /**
  * Creates the L2 table cache.
  *
@@ -488,10 +516,31 @@ static void qcowRefcountTableConvertFromHostEndianess(uint16_t *paTblImg, uint16
  */
 static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    size_t cbMax = vdMetaCacheQueryMax(pImage->pVDIfsImage, "L2CacheSize",
+                                       QCOW_L2_CACHE_MEMORY_MAX);
 
+    pImage->TreeL2Tbls = NULL;
+    return vdMetaCacheCreate(&pImage->L2Cache, cbMax, qcowL2TblCacheEntryEvict, pImage);
+}
+
+/**
+ * Frees a L2 table cache entry when destroying the cache.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   pNode     The AVL node of the entry.
+ * @param   pvUser    The image instance data.
+ */
+static DECLCALLBACK(int) qcowL2TblCacheDestroyEntry(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    PQCOWIMAGE pImage = (PQCOWIMAGE)pvUser;
+    PQCOWL2CACHEENTRY pL2Entry = (PQCOWL2CACHEENTRY)pNode;
+
+    Assert(!pL2Entry->cRefs);
+
+    vdMetaCacheEntryRemove(&pL2Entry->MetaEntry);
+    vdMetaCacheRelease(&pImage->L2Cache, pImage->cbL2Table);
+    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
+    RTMemFree(pL2Entry);
     return VINF_SUCCESS;
 }
 
@@ -503,21 +552,16 @@ static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
  */
 static void qcowL2TblCacheDestroy(PQCOWIMAGE pImage)
 {
-    PQCOWL2CACHEENTRY pL2Entry = NULL;
-    PQCOWL2CACHEENTRY pL2Next  = NULL;
-
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QCOWL2CACHEENTRY, NodeSearch)
-    {
-        Assert(!pL2Entry->cRefs);
+    /* The open might have failed before the cache was created. */
+    if (!pImage->L2Cache.pfnEvict)
+        return;
 
-        RTListNodeRemove(&pL2Entry->NodeSearch);
-        RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
-        RTMemFree(pL2Entry);
-    }
+    vdMetaCacheLock();
+    RTAvlrU64Destroy(&pImage->TreeL2Tbls, qcowL2TblCacheDestroyEntry, pImage);
+    vdMetaCacheUnlock();
 
-    pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    vdMetaCacheDestroy(&pImage->L2Cache);
+    pImage->TreeL2Tbls = NULL;
 }
 
 /**
@@ -531,22 +575,19 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2T
 {
     PQCOWL2CACHEENTRY pL2Entry = NULL;
 
-    RTListForEach(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
+    vdMetaCacheLock();
+    pL2Entry = (PQCOWL2CACHEENTRY)RTAvlrU64Get(&pImage->TreeL2Tbls, offL2Tbl);
+    if (pL2Entry)
     {
         /* Update LRU list. */
-        RTListNodeRemove(&pL2Entry->NodeLru);
-        RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
+        vdMetaCacheEntryHit(&pL2Entry->MetaEntry);
         pL2Entry->cRefs++;
-        return pL2Entry;
     }
     else
-        return NULL;
+        vdMetaCacheMiss(&pImage->L2Cache);
+    vdMetaCacheUnlock();
+
+    return pL2Entry;
 }
 
 /**
@@ -557,8 +598,10 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2T
  */
 static void qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
 {
+    vdMetaCacheLock();
     Assert(pL2Entry->cRefs > 0);
     pL2Entry->cRefs--;
+    vdMetaCacheUnlock();
 }
 
 /**
@@ -570,54 +613,37 @@ static void qcowL2TblCacheEntryRelease(PQCOWL2CACHEENTRY pL2Entry)
 static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
 {
     PQCOWL2CACHEENTRY pL2Entry = NULL;
-    int rc = VINF_SUCCESS;
 
-    if (pImage->cbL2Cache + pImage->cbL2Table <= QCOW_L2_CACHE_MEMORY_MAX)
+    /* Make room in the shared budget first. */
+    vdMetaCacheLock();
+    vdMetaCacheReserve(&pImage->L2Cache, pImage->cbL2Table);
+    vdMetaCacheUnlock();
+
+    pL2Entry = (PQCOWL2CACHEENTRY)RTMemAllocZ(sizeof(QCOWL2CACHEENTRY));
+    if (pL2Entry)
     {
-        /* Add a new entry. */
-        pL2Entry = (PQCOWL2CACHEENTRY)RTMemAllocZ(sizeof(QCOWL2CACHEENTRY));
-        if (pL2Entry)
+        pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbL2Table);
+        if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
         {
-            pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbL2Table);
-            if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
-            {
-                RTMemFree(pL2Entry);
-                pL2Entry = NULL;
-            }
-            else
-            {
-                pL2Entry->cRefs    = 1;
-                pImage->cbL2Cache += pImage->cbL2Table;
-            }
+            RTMemFree(pL2Entry);
+            pL2Entry = NULL;
         }
+        else
+            pL2Entry->cRefs = 1;
     }
-    else
-    {
-        /* Evict the last not in use entry and use it */
-        Assert(!RTListIsEmpty(&pImage->ListLru));
-
-        RTListForEachReverse(&pImage->ListLru, pL2Entry, QCOWL2CACHEENTRY, NodeLru)
-        {
-            if (!pL2Entry->cRefs)
-                break;
-        }
 
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
-        {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
-            RTListNodeRemove(&pL2Entry->NodeLru);
-            pL2Entry->offL2Tbl = 0;
-            pL2Entry->cRefs    = 1;
-        }
-        else
-            pL2Entry = NULL;
+    if (!pL2Entry)
+    {
+        vdMetaCacheLock();
+        vdMetaCacheRelease(&pImage->L2Cache, pImage->cbL2Table);
+        vdMetaCacheUnlock();
     }
 
     return pL2Entry;
 }
 
 /**
- * Frees a L2 table cache entry.
+ * Frees a L2 table cache entry which is not in the cache.
  *
  * @returns nothing.
  * @param   pImage    The image instance data.
@@ -629,7 +655,9 @@ static void qcowL2TblCacheEntryFree(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entr
     RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
     RTMemFree(pL2Entry);
 
-    pImage->cbL2Cache -= pImage->cbL2Table;
+    vdMetaCacheLock();
+    vdMetaCacheRelease(&pImage->L2Cache, pImage->cbL2Table);
+    vdMetaCacheUnlock();
 }
 
 /**
@@ -641,40 +669,17 @@ static void qcowL2TblCacheEntryFree(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entr
  */
 static void qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2Entry)
 {
-    PQCOWL2CACHEENTRY pIt = NULL;
-
     Assert(pL2Entry->offL2Tbl > 0);
 
-    /* Insert at the top of the LRU list. */
-    RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-
-    if (RTListIsEmpty(&pImage->ListSearch))
-    {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-    }
-    else
-    {
-        /* Insert into search list. */
-        pIt = RTListGetFirst(&pImage->ListSearch, QCOWL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
+    pL2Entry->Core.Key     = pL2Entry->offL2Tbl;
+    pL2Entry->Core.KeyLast = pL2Entry->offL2Tbl;
 
-            RTListForEach(&pImage->ListSearch, pIt, QCOWL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-             Assert(fInserted);
-        }
-    }
+    vdMetaCacheLock();
+    /* Insert at the top of the LRU list. */
+    vdMetaCacheEntryInsert(&pImage->L2Cache, &pL2Entry->MetaEntry);
+    bool fInserted = RTAvlrU64Insert(&pImage->TreeL2Tbls, &pL2Entry->Core);
+    Assert(fInserted); NOREF(fInserted);
+    vdMetaCacheUnlock();
 }
 
 /**
@@ -2369,6 +2374,9 @@ static void qcowDump(void *pBackendData)
                          pImage->PCHSGeometry.cCylinders, pImage->PCHSGeometry.cHeads, pImage->PCHSGeometry.cSectors,
                          pImage->LCHSGeometry.cCylinders, pImage->LCHSGeometry.cHeads, pImage->LCHSGeometry.cSectors,
                          pImage->cbSize / 512);
+        vdIfErrorMessage(pImage->pIfError, "L2 cache: Used=%zu Max=%zu Tables=%u Hits=%llu Misses=%llu Evictions=%llu\n",
+                         pImage->L2Cache.cbUsed, pImage->L2Cache.cbMax, pImage->L2Cache.cEntries,
+                         pImage->L2Cache.cHits, pImage->L2Cache.cMisses, pImage->L2Cache.cEvictions);
     }
 }
 
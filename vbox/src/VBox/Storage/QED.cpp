@@ -27,9 +27,12 @@
 #include <iprt/assert.h>
 #include <iprt/string.h>
 #include <iprt/alloc.h>
+#include <iprt/avl.h>
 #include <iprt/path.h>
 #include <iprt/list.h>
 
+#include "VDMetaCache.h"
+
 /**
  * The QED backend implements support for the qemu enhanced disk format (short QED)
  * The specification for the format is available under http://wiki.qemu.org/Features/QED/Specification
@@ -125,10 +128,10 @@ typedef QedHeader *PQedHeader;
  */
 typedef struct QEDL2CACHEENTRY
 {
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
-    /** List node for the LRU list. */
-    RTLISTNODE              NodeLru;
+    /** AVL tree node, the offset of the L2 table is the key. */
+    AVLRU64NODECORE         Core;
+    /** Metadata cache entry, links the entry into the shared LRU list. */
+    VDMETACACHEENTRY        MetaEntry;
     /** Reference counter. */
     uint32_t                cRefs;
     /** The offset of the L2 table, used as search key. */
@@ -137,7 +140,8 @@ typedef struct QEDL2CACHEENTRY
     uint64_t               *paL2Tbl;
 } QEDL2CACHEENTRY, *PQEDL2CACHEENTRY;
 
-/** Maximum amount of memory the cache is allowed to use. */
+/** Default amount of memory the cache is allowed to use,
+ * can be changed with the L2CacheSize config key. */
 #define QED_L2_CACHE_MEMORY_MAX (2*_1M)
 
 /**
@@ -201,12 +205,10 @@ typedef struct QEDIMAGE
     /** Number of bits to shift to get the L2 index. */
     uint32_t            cL2Shift;
 
-    /** Memory occupied by the L2 table cache. */
-    size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
-    /** The LRU L2 entry list used for eviction. */
-    RTLISTNODE          ListLru;
+    /** The L2 table cache accounting against the shared budget. */
+    VDMETACACHE         L2Cache;
+    /** The cached L2 tables used for searching. */
+    AVLRU64TREE         TreeL2Tbls;
 
 } QEDIMAGE, *PQEDIMAGE;
 
@@ -356,6 +358,32 @@ static void qedTableConvertFromHostEndianess(uint64_t *paTblImg, uint64_t *paTbl
     }
 }
 
+/**
+ * Evicts an unused L2 table from the cache, called by the shared metadata cache
+ * with the lock held.
+ *
+ * @returns true if the entry was evicted, false if it is in use.
+ * @param   pvUser    The image instance data.
+ * @param   pEntry    The metadata cache entry to evict.
+ */
+static DECLCALLBACK(bool) qedL2TblCacheEntryEvict(void *pvUser, PVDMETACACHEENTRY pEntry)
+{
+    PQEDIMAGE pImage = (PQEDIMAGE)pvUser;
+    PQEDL2CACHEENTRY pL2Entry = RT_FROM_MEMBER(pEntry, QEDL2CACHEENTRY, MetaEntry);
+
+    if (pL2Entry->cRefs)
+        return false;
+
+    PAVLRU64NODECORE pRemoved = RTAvlrU64Remove(&pImage->TreeL2Tbls, pL2Entry->Core.Key);
+    Assert(pRemoved == &pL2Entry->Core); NOREF(pRemoved);
+    vdMetaCacheEntryRemove(&pL2Entry->MetaEntry);
+    vdMetaCacheRelease(&pImage->L2Cache, pImage->cbTable);
+
+    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
+    RTMemFree(pL2Entry);
+    return true;
+}
+
 /**
  * Creates the L2 table cache.
  *
@@ -364,10 +392,31 @@ static void qedTableConvertFromHostEndianess(uint64_t *paTblImg, uint64_t *paTbl
  */
 static int qedL2TblCacheCreate(PQEDIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    size_t cbMax = vdMetaCacheQueryMax(pImage->pVDIfsImage, "L2CacheSize",
+                                       QED_L2_CACHE_MEMORY_MAX);
 
+    pImage->TreeL2Tbls = NULL;
+    return vdMetaCacheCreate(&pImage->L2Cache, cbMax, qedL2TblCacheEntryEvict, pImage);
+}
+
+/**
+ * Frees a L2 table cache entry when destroying the cache.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   pNode     The AVL node of the entry.
+ * @param   pvUser    The image instance data.
+ */
+static DECLCALLBACK(int) qedL2TblCacheDestroyEntry(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    PQEDIMAGE pImage = (PQEDIMAGE)pvUser;
+    PQEDL2CACHEENTRY pL2Entry = (PQEDL2CACHEENTRY)pNode;
+
+    Assert(!pL2Entry->cRefs);
+
+    vdMetaCacheEntryRemove(&pL2Entry->MetaEntry);
+    vdMetaCacheRelease(&pImage->L2Cache, pImage->cbTable);
+    RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
+    RTMemFree(pL2Entry);
     return VINF_SUCCESS;
 }
 
@@ -379,21 +428,16 @@ static int qedL2TblCacheCreate(PQEDIMAGE pImage)
  */
 static void qedL2TblCacheDestroy(PQEDIMAGE pImage)
 {
-    PQEDL2CACHEENTRY pL2Entry = NULL;
-    PQEDL2CACHEENTRY pL2Next  = NULL;
-
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QEDL2CACHEENTRY, NodeSearch)
-    {
-        Assert(!pL2Entry->cRefs);
+    /* The open might have failed before the cache was created. */
+    if (!pImage->L2Cache.pfnEvict)
+        return;
 
-        RTListNodeRemove(&pL2Entry->NodeSearch);
-        RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
-        RTMemFree(pL2Entry);
-    }
+    vdMetaCacheLock();
+    RTAvlrU64Destroy(&pImage->TreeL2Tbls, qedL2TblCacheDestroyEntry, pImage);
+    vdMetaCacheUnlock();
 
-    pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
-    RTListInit(&pImage->ListLru);
+    vdMetaCacheDestroy(&pImage->L2Cache);
+    pImage->TreeL2Tbls = NULL;
 }
 
 /**
@@ -407,22 +451,19 @@ static PQEDL2CACHEENTRY qedL2TblCacheRetain(PQEDIMAGE pImage, uint64_t offL2Tbl)
 {
     PQEDL2CACHEENTRY pL2Entry = NULL;
 
-    RTListForEach(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch))
+    vdMetaCacheLock();
+    pL2Entry = (PQEDL2CACHEENTRY)RTAvlrU64Get(&pImage->TreeL2Tbls, offL2Tbl);
+    if (pL2Entry)
     {
         /* Update LRU list. */
-        RTListNodeRemove(&pL2Entry->NodeLru);
-        RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
+        vdMetaCacheEntryHit(&pL2Entry->MetaEntry);
         pL2Entry->cRefs++;
-        return pL2Entry;
     }
     else
-        return NULL;
+        vdMetaCacheMiss(&pImage->L2Cache);
+    vdMetaCacheUnlock();
+
+    return pL2Entry;
 }
 
 /**
@@ -433,8 +474,10 @@ static PQEDL2CACHEENTRY qedL2TblCacheRetain(PQEDIMAGE pImage, uint64_t offL2Tbl)
  */
 static void qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
 {
+    vdMetaCacheLock();
     Assert(pL2Entry->cRefs > 0);
     pL2Entry->cRefs--;
+    vdMetaCacheUnlock();
 }
 
 /**
@@ -446,54 +489,37 @@ static void qedL2TblCacheEntryRelease(PQEDL2CACHEENTRY pL2Entry)
 static PQEDL2CACHEENTRY qedL2TblCacheEntryAlloc(PQEDIMAGE pImage)
 {
     PQEDL2CACHEENTRY pL2Entry = NULL;
-    int rc = VINF_SUCCESS;
 
-    if (pImage->cbL2Cache + pImage->cbTable <= QED_L2_CACHE_MEMORY_MAX)
+    /* Make room in the shared budget first. */
+    vdMetaCacheLock();
+    vdMetaCacheReserve(&pImage->L2Cache, pImage->cbTable);
+    vdMetaCacheUnlock();
+
+    pL2Entry = (PQEDL2CACHEENTRY)RTMemAllocZ(sizeof(QEDL2CACHEENTRY));
+    if (pL2Entry)
     {
-        /* Add a new entry. */
-        pL2Entry = (PQEDL2CACHEENTRY)RTMemAllocZ(sizeof(QEDL2CACHEENTRY));
-        if (pL2Entry)
+        pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbTable);
+        if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
         {
-            pL2Entry->paL2Tbl = (uint64_t *)RTMemPageAllocZ(pImage->cbTable);
-            if (RT_UNLIKELY(!pL2Entry->paL2Tbl))
-            {
-                RTMemFree(pL2Entry);
-                pL2Entry = NULL;
-            }
-            else
-            {
-                pL2Entry->cRefs    = 1;
-                pImage->cbL2Cache += pImage->cbTable;
-            }
+            RTMemFree(pL2Entry);
+            pL2Entry = NULL;
         }
+        else
+            pL2Entry->cRefs = 1;
     }
-    else
-    {
-        /* Evict the last not in use entry and use it */
-        Assert(!RTListIsEmpty(&pImage->ListLru));
 
-        RTListForEachReverse(&pImage->ListLru, pL2Entry, QEDL2CACHEENTRY, NodeLru)
-        {
-            if (!pL2Entry->cRefs)
-                break;
-        }
-
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QEDL2CACHEENTRY, NodeSearch))
-        {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
-            RTListNodeRemove(&pL2Entry->NodeLru);
-            pL2Entry->offL2Tbl = 0;
-            pL2Entry->cRefs    = 1;
-        }
-        else
-            pL2Entry = NULL;
+    if (!pL2Entry)
+    {
+        vdMetaCacheLock();
+        vdMetaCacheRelease(&pImage->L2Cache, pImage->cbTable);
+        vdMetaCacheUnlock();
     }
 
     return pL2Entry;
 }
 
 /**
- * Frees a L2 table cache entry.
+ * Frees a L2 table cache entry which is not in the cache.
  *
  * @returns nothing.
  * @param   pImage    The image instance data.
@@ -505,7 +531,9 @@ static void qedL2TblCacheEntryFree(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
     RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbTable);
     RTMemFree(pL2Entry);
 
-    pImage->cbL2Cache -= pImage->cbTable;
+    vdMetaCacheLock();
+    vdMetaCacheRelease(&pImage->L2Cache, pImage->cbTable);
+    vdMetaCacheUnlock();
 }
 
 /**
@@ -517,40 +545,17 @@ static void qedL2TblCacheEntryFree(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
  */
 static void qedL2TblCacheEntryInsert(PQEDIMAGE pImage, PQEDL2CACHEENTRY pL2Entry)
 {
-    PQEDL2CACHEENTRY pIt = NULL;
-
     Assert(pL2Entry->offL2Tbl > 0);
 
-    /* Insert at the top of the LRU list. */
-    RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
-
-    if (RTListIsEmpty(&pImage->ListSearch))
-    {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-    }
-    else
-    {
-        /* Insert into search list. */
-        pIt = RTListGetFirst(&pImage->ListSearch, QEDL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
+    pL2Entry->Core.Key     = pL2Entry->offL2Tbl;
+    pL2Entry->Core.KeyLast = pL2Entry->offL2Tbl;
 
-            RTListForEach(&pImage->ListSearch, pIt, QEDL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-             Assert(fInserted);
-        }
-    }
+    vdMetaCacheLock();
+    /* Insert at the top of the LRU list. */
+    vdMetaCacheEntryInsert(&pImage->L2Cache, &pL2Entry->MetaEntry);
+    bool fInserted = RTAvlrU64Insert(&pImage->TreeL2Tbls, &pL2Entry->Core);
+    Assert(fInserted); NOREF(fInserted);
+    vdMetaCacheUnlock();
 }
 
 /**
@@ -2457,6 +2462,9 @@ static void qedDump(void *pBackendData)
                          pImage->PCHSGeometry.cCylinders, pImage->PCHSGeometry.cHeads, pImage->PCHSGeometry.cSectors,
                          pImage->LCHSGeometry.cCylinders, pImage->LCHSGeometry.cHeads, pImage->LCHSGeometry.cSectors,
                          pImage->cbSize / 512);
+        vdIfErrorMessage(pImage->pIfError, "L2 cache: Used=%zu Max=%zu Tables=%u Hits=%llu Misses=%llu Evictions=%llu\n",
+                         pImage->L2Cache.cbUsed, pImage->L2Cache.cbMax, pImage->L2Cache.cEntries,
+                         pImage->L2Cache.cHits, pImage->L2Cache.cMisses, pImage->L2Cache.cEvictions);
     }
 }
 
@@ -39,10 +39,13 @@
 #include <iprt/list.h>
 #include <iprt/avl.h>
 #include <iprt/semaphore.h>
+#include <iprt/thread.h>
 
 #include <VBox/vd-plugin.h>
 #include <VBox/vd-cache-plugin.h>
 
+#include "VDMetaCache.h"
+
 /** Disable dynamic backends on non x86 architectures. This feature
  * requires the SUPR3 library which is not available there.
  */
@@ -55,6 +58,15 @@
 /** Buffer size used for merging images. */
 #define VD_MERGE_BUFFER_SIZE    (16 * _1M)
 
+/** Granularity of the allocation bitmap used for merging images. */
+#define VD_MERGE_ALLOC_GRANULARITY _1M
+
+/** Default number of buffers the copy reads ahead, can be changed with the
+ * CopyBuffers key of the operation config interface. */
+#define VD_COPY_BUFFERS_DEFAULT 4
+/** Maximum number of buffers the copy reads ahead. */
+#define VD_COPY_BUFFERS_MAX     64
+
 /** Maximum number of segments in one I/O task. */
 #define VD_IO_TASK_SEGMENTS_MAX 64
 
@@ -285,6 +297,56 @@ typedef struct VDPARENTSTATEDESC
     PVDIMAGE pImage;
 } VDPARENTSTATEDESC, *PVDPARENTSTATEDESC;
 
+/**
+ * Buffer of the pipelined copy.
+ */
+typedef struct VDCOPYBUF
+{
+    /** The buffer, VD_MERGE_BUFFER_SIZE bytes. */
+    void                *pvBuf;
+    /** Offset of the data in the disk. */
+    uint64_t             uOffset;
+    /** Amount of data in the buffer. */
+    size_t               cbData;
+    /** Status code of the read. */
+    int                  rc;
+    /** Whether the data needs to be written to the destination. */
+    bool                 fWrite;
+} VDCOPYBUF, *PVDCOPYBUF;
+
+/**
+ * State of the pipelined copy, shared by the reader thread and the writer.
+ */
+typedef struct VDCOPYPIPE
+{
+    /** The source disk. */
+    PVBOXHDD             pDiskFrom;
+    /** The source image. */
+    PVDIMAGE             pImageFrom;
+    /** Number of bytes to copy. */
+    uint64_t             cbSize;
+    /** Number of images to read in the source chain. */
+    unsigned             cImagesFromRead;
+    /** Whether to copy blockwise. */
+    bool                 fBlockwiseCopy;
+    /** Whether chunks containing only zeroes are not written. */
+    bool                 fSkipZeroes;
+    /** Set by the writer to stop the reader. */
+    volatile bool        fCancel;
+    /** Number of buffers. */
+    unsigned             cBufs;
+    /** Number of buffers filled by the reader and not yet written. */
+    volatile uint32_t    cBufsFilled;
+    /** The buffers, used as a ring. */
+    PVDCOPYBUF           paBufs;
+    /** Signalled by the reader when a buffer was filled. */
+    RTSEMEVENT           hEvtBufFilled;
+    /** Signalled by the writer when a buffer was freed. */
+    RTSEMEVENT           hEvtBufFree;
+    /** The reader thread. */
+    RTTHREAD             hThreadRead;
+} VDCOPYPIPE, *PVDCOPYPIPE;
+
 /**
  * Transfer direction.
  */
@@ -2058,27 +2120,335 @@ static int vdWriteHelper(PVBOXHDD pDisk, PVDIMAGE pImage, uint64_t uOffset,
                            fUpdateCache, 0);
 }
 
+/**
+ * Internal: Reads one chunk of the source for vdCopyHelper(), taking the read
+ * lock of the source disk.
+ *
+ * @returns VBox status code, VERR_VD_BLOCK_FREE if no image has data for the
+ *          chunk in blockwise mode.
+ * @param   pDiskFrom           The source disk.
+ * @param   pImageFrom          The source image.
+ * @param   uOffset             Where to start reading.
+ * @param   pvBuf               Where to store the data, VD_MERGE_BUFFER_SIZE bytes.
+ * @param   pcbThisRead         On input the amount to read, on output the amount
+ *                              read in blockwise mode.
+ * @param   cImagesFromRead     Number of images to read in the source chain.
+ * @param   fBlockwiseCopy      Whether to copy blockwise.
+ */
+static int vdCopyHelperRead(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, uint64_t uOffset,
+                            void *pvBuf, size_t *pcbThisRead, unsigned cImagesFromRead,
+                            bool fBlockwiseCopy)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    size_t cbThisRead = *pcbThisRead;
+
+    /* Note that we don't attempt to synchronize cross-disk accesses.
+     * It wouldn't be very difficult to do, just the lock order would
+     * need to be defined somehow to prevent deadlocks. Postpone such
+     * magic as there is no use case for this. */
+
+    rc2 = vdThreadStartRead(pDiskFrom);
+    AssertRC(rc2);
+
+    if (fBlockwiseCopy)
+    {
+        RTSGSEG SegmentBuf;
+        RTSGBUF SgBuf;
+        VDIOCTX IoCtx;
+
+        SegmentBuf.pvSeg = pvBuf;
+        SegmentBuf.cbSeg = VD_MERGE_BUFFER_SIZE;
+        RTSgBufInit(&SgBuf, &SegmentBuf, 1);
+        vdIoCtxInit(&IoCtx, pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
+                    &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
+
+        /* Read the source data. */
+        rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
+                                               uOffset, cbThisRead, &IoCtx,
+                                               &cbThisRead);
+
+        if (   rc == VERR_VD_BLOCK_FREE
+            && cImagesFromRead != 1)
+        {
+            unsigned cImagesToProcess = cImagesFromRead;
+
+            for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
+                 pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
+                 pCurrImage = pCurrImage->pPrev)
+            {
+                rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
+                                                       uOffset, cbThisRead,
+                                                       &IoCtx, &cbThisRead);
+                if (cImagesToProcess == 1)
+                    break;
+                else if (cImagesToProcess > 0)
+                    cImagesToProcess--;
+            }
+        }
+    }
+    else
+        rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
+                          false /* fUpdateCache */);
+
+    rc2 = vdThreadFinishRead(pDiskFrom);
+    AssertRC(rc2);
+
+    *pcbThisRead = cbThisRead;
+    return rc;
+}
+
+/**
+ * Internal: Writes one chunk to the destination for vdCopyHelper(), taking the
+ * write lock of the destination disk.
+ *
+ * @returns VBox status code.
+ * @param   pDiskTo             The destination disk.
+ * @param   uOffset             Where to start writing.
+ * @param   pvBuf               The data to write.
+ * @param   cbThisWrite         How much to write.
+ * @param   cImagesToRead       Number of images to read in the destination chain
+ *                              when collapsing I/O.
+ */
+static int vdCopyHelperWrite(PVBOXHDD pDiskTo, uint64_t uOffset, const void *pvBuf,
+                             size_t cbThisWrite, unsigned cImagesToRead)
+{
+    int rc2 = vdThreadStartWrite(pDiskTo);
+    AssertRC(rc2);
+
+    int rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
+                             cbThisWrite, false /* fUpdateCache */, cImagesToRead);
+
+    rc2 = vdThreadFinishWrite(pDiskTo);
+    AssertRC(rc2);
+    return rc;
+}
+
+/**
+ * Internal: Reports the copy progress to both progress interfaces if it changed.
+ *
+ * @returns VBox status code, failure if the operation was cancelled.
+ * @param   uOffset             Number of bytes processed so far.
+ * @param   cbSize              Total number of bytes to process.
+ * @param   puProgressOld       The last reported progress, updated.
+ * @param   pIfProgress         The source progress interface, optional.
+ * @param   pDstIfProgress      The destination progress interface, optional.
+ */
+static int vdCopyHelperProgress(uint64_t uOffset, uint64_t cbSize, unsigned *puProgressOld,
+                                PVDINTERFACEPROGRESS pIfProgress,
+                                PVDINTERFACEPROGRESS pDstIfProgress)
+{
+    int rc = VINF_SUCCESS;
+    unsigned uProgressNew = uOffset * 99 / cbSize;
+
+    if (uProgressNew != *puProgressOld)
+    {
+        *puProgressOld = uProgressNew;
+
+        if (pIfProgress && pIfProgress->pfnProgress)
+        {
+            rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
+                                          uProgressNew);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+        if (pDstIfProgress && pDstIfProgress->pfnProgress)
+            rc = pDstIfProgress->pfnProgress(pDstIfProgress->Core.pvUser,
+                                             uProgressNew);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Reader thread of the pipelined copy. Fills the buffers in order
+ * and hands them over to the writer.
+ */
+static DECLCALLBACK(int) vdCopyPipeReadThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVDCOPYPIPE pPipe = (PVDCOPYPIPE)pvUser;
+    uint64_t uOffset = 0;
+    unsigned idxBuf = 0;
+
+    NOREF(hThreadSelf);
+
+    while (   uOffset < pPipe->cbSize
+           && !ASMAtomicReadBool(&pPipe->fCancel))
+    {
+        /* Wait for the writer to free a buffer. */
+        while (   ASMAtomicReadU32(&pPipe->cBufsFilled) == pPipe->cBufs
+               && !ASMAtomicReadBool(&pPipe->fCancel))
+            RTSemEventWait(pPipe->hEvtBufFree, RT_INDEFINITE_WAIT);
+        if (ASMAtomicReadBool(&pPipe->fCancel))
+            break;
+
+        PVDCOPYBUF pBuf = &pPipe->paBufs[idxBuf];
+        size_t cbThisRead = (size_t)RT_MIN(VD_MERGE_BUFFER_SIZE, pPipe->cbSize - uOffset);
+
+        pBuf->uOffset = uOffset;
+        pBuf->rc = vdCopyHelperRead(pPipe->pDiskFrom, pPipe->pImageFrom, uOffset,
+                                    pBuf->pvBuf, &cbThisRead, pPipe->cImagesFromRead,
+                                    pPipe->fBlockwiseCopy);
+        pBuf->cbData = cbThisRead;
+        pBuf->fWrite = pBuf->rc != VERR_VD_BLOCK_FREE;
+
+        /* All zero chunks don't need to be written to a fresh image. */
+        if (   RT_SUCCESS(pBuf->rc)
+            && pPipe->fSkipZeroes
+            && !ASMMemIsAll8(pBuf->pvBuf, cbThisRead, 0))
+            pBuf->fWrite = false;
+
+        uOffset += cbThisRead;
+        idxBuf = (idxBuf + 1) % pPipe->cBufs;
+
+        ASMAtomicIncU32(&pPipe->cBufsFilled);
+        RTSemEventSignal(pPipe->hEvtBufFilled);
+
+        if (RT_FAILURE(pBuf->rc) && pBuf->rc != VERR_VD_BLOCK_FREE)
+            break;
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Pipelined variant of vdCopyHelper(). A reader thread reads ahead
+ * into several buffers while the calling thread writes the chunks to the
+ * destination in order.
+ */
+static int vdCopyHelperPipelined(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskTo,
+                                 uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
+                                 bool fBlockwiseCopy, bool fSkipZeroes, unsigned cBufs,
+                                 PVDINTERFACEPROGRESS pIfProgress,
+                                 PVDINTERFACEPROGRESS pDstIfProgress)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    unsigned uProgressOld = 0;
+    VDCOPYPIPE Pipe;
+
+    RT_ZERO(Pipe);
+    Pipe.pDiskFrom       = pDiskFrom;
+    Pipe.pImageFrom      = pImageFrom;
+    Pipe.cbSize          = cbSize;
+    Pipe.cImagesFromRead = cImagesFromRead;
+    Pipe.fBlockwiseCopy  = fBlockwiseCopy;
+    Pipe.fSkipZeroes     = fSkipZeroes;
+    Pipe.hEvtBufFilled   = NIL_RTSEMEVENT;
+    Pipe.hEvtBufFree     = NIL_RTSEMEVENT;
+    Pipe.hThreadRead     = NIL_RTTHREAD;
+
+    Pipe.paBufs = (PVDCOPYBUF)RTMemAllocZ(cBufs * sizeof(VDCOPYBUF));
+    if (!Pipe.paBufs)
+        return VERR_NO_MEMORY;
+
+    for (Pipe.cBufs = 0; Pipe.cBufs < cBufs; Pipe.cBufs++)
+    {
+        Pipe.paBufs[Pipe.cBufs].pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
+        if (!Pipe.paBufs[Pipe.cBufs].pvBuf)
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+    }
+
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&Pipe.hEvtBufFilled);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&Pipe.hEvtBufFree);
+    if (RT_SUCCESS(rc))
+        rc = RTThreadCreate(&Pipe.hThreadRead, vdCopyPipeReadThread, &Pipe, 0,
+                            RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "VDCopyRd");
+
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t uOffset = 0;
+        unsigned idxBuf = 0;
+
+        while (uOffset < cbSize)
+        {
+            while (!ASMAtomicReadU32(&Pipe.cBufsFilled))
+                RTSemEventWait(Pipe.hEvtBufFilled, RT_INDEFINITE_WAIT);
+
+            PVDCOPYBUF pBuf = &Pipe.paBufs[idxBuf];
+            Assert(pBuf->uOffset == uOffset);
+
+            rc = pBuf->rc;
+            if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
+                break;
+
+            /* Only do collapsed I/O if we are copying the data blockwise. */
+            if (pBuf->fWrite)
+                rc = vdCopyHelperWrite(pDiskTo, uOffset, pBuf->pvBuf, pBuf->cbData,
+                                       fBlockwiseCopy ? cImagesToRead : 0);
+            else /* Don't propagate the error to the outside */
+                rc = VINF_SUCCESS;
+            if (RT_FAILURE(rc))
+                break;
+
+            uOffset += pBuf->cbData;
+            idxBuf = (idxBuf + 1) % Pipe.cBufs;
+
+            ASMAtomicDecU32(&Pipe.cBufsFilled);
+            RTSemEventSignal(Pipe.hEvtBufFree);
+
+            rc = vdCopyHelperProgress(uOffset, cbSize, &uProgressOld,
+                                      pIfProgress, pDstIfProgress);
+            if (RT_FAILURE(rc))
+                break;
+        }
+
+        ASMAtomicWriteBool(&Pipe.fCancel, true);
+        RTSemEventSignal(Pipe.hEvtBufFree);
+        rc2 = RTThreadWait(Pipe.hThreadRead, RT_INDEFINITE_WAIT, NULL);
+        AssertRC(rc2);
+    }
+
+    if (Pipe.hEvtBufFree != NIL_RTSEMEVENT)
+        RTSemEventDestroy(Pipe.hEvtBufFree);
+    if (Pipe.hEvtBufFilled != NIL_RTSEMEVENT)
+        RTSemEventDestroy(Pipe.hEvtBufFilled);
+    for (unsigned i = 0; i < Pipe.cBufs; i++)
+        RTMemTmpFree(Pipe.paBufs[i].pvBuf);
+    RTMemFree(Pipe.paBufs);
+
+    return rc;
+}
+
 /**
  * Internal: Copies the content of one disk to another one applying optimizations
  * to speed up the copy process if possible.
+ *
+ * With more than one buffer the source is read ahead by a separate thread
+ * (see vdCopyHelperPipelined()). A single buffer selects the strictly
+ * sequential read-then-write copy.
  */
 static int vdCopyHelper(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskTo,
                         uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
-                        bool fSuppressRedundantIo, PVDINTERFACEPROGRESS pIfProgress,
+                        bool fSuppressRedundantIo, bool fSkipZeroes, unsigned cBufs,
+                        PVDINTERFACEPROGRESS pIfProgress,
                         PVDINTERFACEPROGRESS pDstIfProgress)
 {
     int rc = VINF_SUCCESS;
-    int rc2;
     uint64_t uOffset = 0;
     uint64_t cbRemaining = cbSize;
     void *pvBuf = NULL;
-    bool fLockReadFrom = false;
-    bool fLockWriteTo = false;
     bool fBlockwiseCopy = fSuppressRedundantIo || (cImagesFromRead > 0);
     unsigned uProgressOld = 0;
 
-    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool pIfProgress=%#p pDstIfProgress=%#p\n",
-                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, pDstIfProgress, pDstIfProgress));
+    LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool fSkipZeroes=%RTbool cBufs=%u pIfProgress=%#p pDstIfProgress=%#p\n",
+                 pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, fSkipZeroes, cBufs, pDstIfProgress, pDstIfProgress));
+
+    /* Synchronous I/O is serialized per disk, reading ahead needs two disks. */
+    if (   cBufs > 1
+        && pDiskFrom != pDiskTo)
+    {
+        rc = vdCopyHelperPipelined(pDiskFrom, pImageFrom, pDiskTo, cbSize,
+                                   cImagesFromRead, cImagesToRead, fBlockwiseCopy,
+                                   fSkipZeroes, cBufs, pIfProgress, pDstIfProgress);
+        LogFlowFunc(("returns rc=%Rrc\n", rc));
+        return rc;
+    }
 
     /* Allocate tmp buffer. */
     pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
@@ -2089,78 +2459,20 @@ static int vdCopyHelper(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskT
     {
         size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
 
-        /* Note that we don't attempt to synchronize cross-disk accesses.
-         * It wouldn't be very difficult to do, just the lock order would
-         * need to be defined somehow to prevent deadlocks. Postpone such
-         * magic as there is no use case for this. */
-
-        rc2 = vdThreadStartRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = true;
-
-        if (fBlockwiseCopy)
-        {
-            RTSGSEG SegmentBuf;
-            RTSGBUF SgBuf;
-            VDIOCTX IoCtx;
-
-            SegmentBuf.pvSeg = pvBuf;
-            SegmentBuf.cbSeg = VD_MERGE_BUFFER_SIZE;
-            RTSgBufInit(&SgBuf, &SegmentBuf, 1);
-            vdIoCtxInit(&IoCtx, pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
-                        &SgBuf, NULL, NULL, VDIOCTX_FLAGS_SYNC);
-
-            /* Read the source data. */
-            rc = pImageFrom->Backend->pfnRead(pImageFrom->pBackendData,
-                                                   uOffset, cbThisRead, &IoCtx,
-                                                   &cbThisRead);
-
-            if (   rc == VERR_VD_BLOCK_FREE
-                && cImagesFromRead != 1)
-            {
-                unsigned cImagesToProcess = cImagesFromRead;
-
-                for (PVDIMAGE pCurrImage = pImageFrom->pPrev;
-                     pCurrImage != NULL && rc == VERR_VD_BLOCK_FREE;
-                     pCurrImage = pCurrImage->pPrev)
-                {
-                    rc = pCurrImage->Backend->pfnRead(pCurrImage->pBackendData,
-                                                           uOffset, cbThisRead,
-                                                           &IoCtx, &cbThisRead);
-                    if (cImagesToProcess == 1)
-                        break;
-                    else if (cImagesToProcess > 0)
-                        cImagesToProcess--;
-                }
-            }
-        }
-        else
-            rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
-                              false /* fUpdateCache */);
-
+        rc = vdCopyHelperRead(pDiskFrom, pImageFrom, uOffset, pvBuf, &cbThisRead,
+                              cImagesFromRead, fBlockwiseCopy);
         if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
             break;
 
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
-        fLockReadFrom = false;
-
-        if (rc != VERR_VD_BLOCK_FREE)
+        if (   rc != VERR_VD_BLOCK_FREE
+            && (   !fSkipZeroes
+                || ASMMemIsAll8(pvBuf, cbThisRead, 0)))
         {
-            rc2 = vdThreadStartWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = true;
-
             /* Only do collapsed I/O if we are copying the data blockwise. */
-            rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
-                                 cbThisRead, false /* fUpdateCache */,
-                                 fBlockwiseCopy ? cImagesToRead : 0);
+            rc = vdCopyHelperWrite(pDiskTo, uOffset, pvBuf, cbThisRead,
+                                   fBlockwiseCopy ? cImagesToRead : 0);
             if (RT_FAILURE(rc))
                 break;
-
-            rc2 = vdThreadFinishWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = false;
         }
         else /* Don't propagate the error to the outside */
             rc = VINF_SUCCESS;
@@ -2168,46 +2480,128 @@ static int vdCopyHelper(PVBOXHDD pDiskFrom, PVDIMAGE pImageFrom, PVBOXHDD pDiskT
         uOffset += cbThisRead;
         cbRemaining -= cbThisRead;
 
-        unsigned uProgressNew = uOffset * 99 / cbSize;
-        if (uProgressNew != uProgressOld)
-        {
-            uProgressOld = uProgressNew;
-
-            if (pIfProgress && pIfProgress->pfnProgress)
-            {
-                rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
-                                              uProgressOld);
-                if (RT_FAILURE(rc))
-                    break;
-            }
-            if (pDstIfProgress && pDstIfProgress->pfnProgress)
-            {
-                rc = pDstIfProgress->pfnProgress(pDstIfProgress->Core.pvUser,
-                                                 uProgressOld);
-                if (RT_FAILURE(rc))
-                    break;
-            }
-        }
+        rc = vdCopyHelperProgress(uOffset, cbSize, &uProgressOld,
+                                  pIfProgress, pDstIfProgress);
+        if (RT_FAILURE(rc))
+            break;
     } while (uOffset < cbSize);
 
     RTMemFree(pvBuf);
 
-    if (fLockReadFrom)
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Internal: Creates the bitmap of the ranges which are allocated in at least
+ * one of the given images, used to skip unallocated ranges when merging.
+ *
+ * @returns VBox status code.
+ * @returns VERR_NOT_SUPPORTED if one of the backends can't report the
+ *          allocation state. The merge has to scan the whole disk then.
+ * @param   pImageFirst     The first (oldest) image to check.
+ * @param   pImageLast      The last image to check, inclusive.
+ * @param   cbSize          Size of the merged range.
+ * @param   ppbmAlloc       Where to store the bitmap, one bit per
+ *                          VD_MERGE_ALLOC_GRANULARITY bytes.
+ * @param   pcBits          Where to store the number of bits in the bitmap,
+ *                          a multiple of 32.
+ */
+static int vdMergeAllocBitmapCreate(PVDIMAGE pImageFirst, PVDIMAGE pImageLast, uint64_t cbSize,
+                                    void **ppbmAlloc, uint32_t *pcBits)
+{
+    int rc = VINF_SUCCESS;
+    uint64_t cGranules = (cbSize + VD_MERGE_ALLOC_GRANULARITY - 1) / VD_MERGE_ALLOC_GRANULARITY;
+
+    if (cGranules > INT32_MAX - 32)
+        return VERR_NOT_SUPPORTED;
+
+    for (PVDIMAGE pImage = pImageFirst; pImage != pImageLast->pNext; pImage = pImage->pNext)
+        if (!pImage->Backend->pfnQueryAllocation)
+            return VERR_NOT_SUPPORTED;
+
+    uint32_t cBits = RT_ALIGN_32((uint32_t)cGranules, 32);
+    void *pbmAlloc = RTMemAllocZ(cBits / 8);
+    if (!pbmAlloc)
+        return VERR_NO_MEMORY;
+
+    for (PVDIMAGE pImage = pImageFirst;
+         pImage != pImageLast->pNext && RT_SUCCESS(rc);
+         pImage = pImage->pNext)
     {
-        rc2 = vdThreadFinishRead(pDiskFrom);
-        AssertRC(rc2);
+        uint64_t cbImage = RT_MIN(cbSize, pImage->Backend->pfnGetSize(pImage->pBackendData));
+        uint64_t uOffset = 0;
+
+        while (uOffset < cbImage)
+        {
+            uint64_t cbSame = 0;
+
+            rc = pImage->Backend->pfnQueryAllocation(pImage->pBackendData, uOffset,
+                                                     cbImage - uOffset, &cbSame);
+            if (RT_SUCCESS(rc))
+                ASMBitSetRange(pbmAlloc, (int32_t)(uOffset / VD_MERGE_ALLOC_GRANULARITY),
+                               (int32_t)((uOffset + cbSame - 1) / VD_MERGE_ALLOC_GRANULARITY + 1));
+            else if (rc != VERR_VD_BLOCK_FREE)
+                break;
+
+            rc = VINF_SUCCESS;
+            AssertBreakStmt(cbSame, rc = VERR_INTERNAL_ERROR);
+            uOffset += cbSame;
+        }
     }
 
-    if (fLockWriteTo)
+    if (RT_SUCCESS(rc))
     {
-        rc2 = vdThreadFinishWrite(pDiskTo);
-        AssertRC(rc2);
+        *ppbmAlloc = pbmAlloc;
+        *pcBits    = cBits;
     }
+    else
+        RTMemFree(pbmAlloc);
 
-    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
+/**
+ * Internal: Returns the next chunk to merge, skipping the unallocated ranges.
+ *
+ * @returns Size of the chunk, 0 if there is nothing left to merge.
+ * @param   pbmAlloc        The allocation bitmap, NULL if everything has to be
+ *                          merged.
+ * @param   cBits           Number of bits in the bitmap.
+ * @param   cbSize          Size of the merged range.
+ * @param   puOffset        The offset of the chunk, advanced to the start of
+ *                          the next allocated range.
+ */
+static size_t vdMergeChunkNext(void *pbmAlloc, uint32_t cBits, uint64_t cbSize,
+                               uint64_t *puOffset)
+{
+    uint64_t uEnd = cbSize;
+
+    if (*puOffset >= cbSize)
+        return 0;
+
+    if (pbmAlloc)
+    {
+        int32_t iBit = (int32_t)(*puOffset / VD_MERGE_ALLOC_GRANULARITY);
+        if (!ASMBitTest(pbmAlloc, iBit))
+        {
+            iBit = ASMBitNextSet(pbmAlloc, cBits, iBit);
+            if (iBit == -1)
+            {
+                *puOffset = cbSize;
+                return 0;
+            }
+            *puOffset = RT_MIN((uint64_t)iBit * VD_MERGE_ALLOC_GRANULARITY, cbSize);
+        }
+
+        int32_t iBitEnd = ASMBitNextClear(pbmAlloc, cBits, iBit);
+        if (iBitEnd != -1)
+            uEnd = RT_MIN((uint64_t)iBitEnd * VD_MERGE_ALLOC_GRANULARITY, cbSize);
+    }
+
+    return (size_t)RT_MIN(VD_MERGE_BUFFER_SIZE, uEnd - *puOffset);
+}
+
 /**
  * Flush helper async version.
  */
@@ -5013,6 +5407,21 @@ VBOXDDU_DECL(int) VDShutdown(void)
     return VINF_SUCCESS;
 }
 
+/**
+ * Sets the memory budget of the shared metadata table cache.
+ */
+VBOXDDU_DECL(int) VDSetMetaCacheBudget(uint64_t cbBudget)
+{
+    LogFlowFunc(("cbBudget=%llu\n", cbBudget));
+
+    AssertMsgReturn(cbBudget <= (uint64_t)~(size_t)0,
+                    ("cbBudget=%llu\n", cbBudget),
+                    VERR_INVALID_PARAMETER);
+
+    vdMetaCacheSetBudget((size_t)cbBudget);
+    return VINF_SUCCESS;
+}
+
 
 /**
  * Lists all HDD backends and their capabilities in a caller-provided buffer.
@@ -6670,6 +7079,8 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
     int rc2;
     bool fLockWrite = false, fLockRead = false;
     void *pvBuf = NULL;
+    void *pbmAlloc = NULL;
+    uint32_t cBitsAlloc = 0;
 
     LogFlowFunc(("pDisk=%#p nImageFrom=%u nImageTo=%u pVDIfsOperation=%#p\n",
                  pDisk, nImageFrom, nImageTo, pVDIfsOperation));
@@ -6713,6 +7124,19 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
 
         /* Get size of destination image. */
         uint64_t cbSize = pImageTo->Backend->pfnGetSize(pImageTo->pBackendData);
+
+        /* The parent images are not written while merging them into the child,
+         * collect the ranges they have allocated now. */
+        if (nImageFrom < nImageTo)
+        {
+            rc = vdMergeAllocBitmapCreate(pImageFrom, pImageTo->pPrev, cbSize,
+                                          &pbmAlloc, &cBitsAlloc);
+            if (rc == VERR_NOT_SUPPORTED)
+                rc = VINF_SUCCESS;
+            else if (RT_FAILURE(rc))
+                break;
+        }
+
         rc2 = vdThreadFinishWrite(pDisk);
         AssertRC(rc2);
         fLockWrite = false;
@@ -6733,10 +7157,9 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
              * allocated blocks in the destination image which are allocated in
              * the images to be merged. */
             uint64_t uOffset = 0;
-            uint64_t cbRemaining = cbSize;
-            do
+            size_t cbThisRead;
+            while ((cbThisRead = vdMergeChunkNext(pbmAlloc, cBitsAlloc, cbSize, &uOffset)) != 0)
             {
-                size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
                 RTSGSEG SegmentBuf;
                 RTSGBUF SgBuf;
                 VDIOCTX IoCtx;
@@ -6792,7 +7215,6 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
                 fLockWrite = false;
 
                 uOffset += cbThisRead;
-                cbRemaining -= cbThisRead;
 
                 if (pIfProgress && pIfProgress->pfnProgress)
                 {
@@ -6804,7 +7226,7 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
                     if (RT_FAILURE(rc))
                         break;
                 }
-            } while (uOffset < cbSize);
+            }
         }
         else
         {
@@ -6858,14 +7280,30 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
                 fLockWrite = false;
             }
 
+            /* Collect the ranges allocated in the images to merge. This has to
+             * happen after the relay is set up, later writes to the last image
+             * reach the destination through the relay. */
+            rc2 = vdThreadStartRead(pDisk);
+            AssertRC(rc2);
+            fLockRead = true;
+
+            rc = vdMergeAllocBitmapCreate(pImageTo->pNext, pImageFrom, cbSize,
+                                          &pbmAlloc, &cBitsAlloc);
+            if (rc == VERR_NOT_SUPPORTED)
+                rc = VINF_SUCCESS;
+
+            rc2 = vdThreadFinishRead(pDisk);
+            AssertRC(rc2);
+            fLockRead = false;
+
             /* Merge child state into parent. This means writing all blocks
              * which are allocated in the image up to the source image to the
              * destination image. */
             uint64_t uOffset = 0;
-            uint64_t cbRemaining = cbSize;
-            do
+            size_t cbThisRead;
+            while (   RT_SUCCESS(rc)
+                   && (cbThisRead = vdMergeChunkNext(pbmAlloc, cBitsAlloc, cbSize, &uOffset)) != 0)
             {
-                size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
                 RTSGSEG SegmentBuf;
                 RTSGBUF SgBuf;
                 VDIOCTX IoCtx;
@@ -6913,7 +7351,6 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
                 fLockWrite = false;
 
                 uOffset += cbThisRead;
-                cbRemaining -= cbThisRead;
 
                 if (pIfProgress && pIfProgress->pfnProgress)
                 {
@@ -6925,7 +7362,7 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
                     if (RT_FAILURE(rc))
                         break;
                 }
-            } while (uOffset < cbSize);
+            }
 
             /* In case we set up a "write proxy" image above we must clear
              * this again now to prevent stray writes. Failure or not. */
@@ -7066,6 +7503,8 @@ VBOXDDU_DECL(int) VDMerge(PVBOXHDD pDisk, unsigned nImageFrom,
 
     if (pvBuf)
         RTMemTmpFree(pvBuf);
+    if (pbmAlloc)
+        RTMemFree(pbmAlloc);
 
     if (RT_SUCCESS(rc) && pIfProgress && pIfProgress->pfnProgress)
         pIfProgress->pfnProgress(pIfProgress->Core.pvUser, 100);
@@ -7335,10 +7774,29 @@ VBOXDDU_DECL(int) VDCopyEx(PVBOXHDD pDiskFrom, unsigned nImage, PVBOXHDD pDiskTo
         else
             cImagesToReadBack = pDiskTo->cImages - nImageToSame - 1;
 
+        /* Chunks containing only zeroes need not be written to a newly
+         * created base image, it reads as zeroes anyway. */
+        bool fSkipZeroes =    pszFilename
+                           && cImagesTo == 0
+                           && !(uOpenFlags & VD_OPEN_FLAGS_HONOR_ZEROES);
+
+        /* Number of buffers to read ahead, 1 selects the strictly
+         * sequential copy. */
+        uint32_t cCopyBufs = VD_COPY_BUFFERS_DEFAULT;
+        PVDINTERFACECONFIG pIfCfg = VDIfConfigGet(pVDIfsOperation);
+        if (pIfCfg)
+        {
+            rc = VDCFGQueryU32Def(pIfCfg, "CopyBuffers", &cCopyBufs, VD_COPY_BUFFERS_DEFAULT);
+            if (RT_FAILURE(rc))
+                break;
+        }
+        cCopyBufs = RT_MIN(RT_MAX(cCopyBufs, 1), VD_COPY_BUFFERS_MAX);
+
         /* Copy the data. */
         rc = vdCopyHelper(pDiskFrom, pImageFrom, pDiskTo, cbSize,
                           cImagesFromReadBack, cImagesToReadBack,
-                          fSuppressRedundantIo, pIfProgress, pDstIfProgress);
+                          fSuppressRedundantIo, fSkipZeroes, cCopyBufs,
+                          pIfProgress, pDstIfProgress);
 
         if (RT_SUCCESS(rc))
         {
@@ -9371,6 +9829,12 @@ VBOXDDU_DECL(void) VDDumpImages(PVBOXHDD pDisk)
                              pImage->pszFilename, pImage->Backend->pszBackendName);
             pImage->Backend->pfnDump(pImage->pBackendData);
         }
+
+        VDMETACACHESTATS MetaStats;
+        vdMetaCacheQueryStats(&MetaStats);
+        vdMessageWrapper(pDisk, "Metadata cache: Used=%zu Budget=%zu Caches=%u Hits=%llu Misses=%llu Evictions=%llu\n",
+                         MetaStats.cbUsed, MetaStats.cbBudget, MetaStats.cCaches,
+                         MetaStats.cHits, MetaStats.cMisses, MetaStats.cEvictions);
     } while (0);
 
     if (RT_UNLIKELY(fLockRead))
@@ -3167,6 +3167,43 @@ static DECLCALLBACK(int) vdiRepair(const char *pszFilename, PVDINTERFACE pVDIfsD
     return rc;
 }
 
+/** @copydoc VBOXHDDBACKEND::pfnQueryAllocation */
+static DECLCALLBACK(int) vdiQueryAllocation(void *pBackendData, uint64_t uOffset,
+                                            uint64_t cbRange, uint64_t *pcbSame)
+{
+    LogFlowFunc(("pBackendData=%#p uOffset=%llu cbRange=%llu pcbSame=%#p\n",
+                 pBackendData, uOffset, cbRange, pcbSame));
+    PVDIIMAGEDESC pImage = (PVDIIMAGEDESC)pBackendData;
+
+    AssertPtrReturn(pImage, VERR_INVALID_POINTER);
+    AssertReturn(!(uOffset % 512), VERR_INVALID_PARAMETER);
+
+    uint64_t cbDisk = getImageDiskSize(&pImage->Header);
+    if (uOffset >= cbDisk || !cbRange)
+        return VERR_INVALID_PARAMETER;
+    cbRange = RT_MIN(cbRange, cbDisk - uOffset);
+
+    /* Zero blocks hide the parent data as well and count as allocated. */
+    unsigned uBlock     = (unsigned)(uOffset >> pImage->uShiftOffset2Index);
+    unsigned cBlocks    = getImageBlocks(&pImage->Header);
+    bool     fAllocated = pImage->paBlocks[uBlock] != VDI_IMAGE_BLOCK_FREE;
+    uint64_t cbSame     = getImageBlockSize(&pImage->Header) - (uOffset & pImage->uBlockMask);
+
+    for (uBlock++; uBlock < cBlocks && cbSame < cbRange; uBlock++)
+    {
+        if ((pImage->paBlocks[uBlock] != VDI_IMAGE_BLOCK_FREE) != fAllocated)
+            break;
+        cbSame += getImageBlockSize(&pImage->Header);
+    }
+
+    *pcbSame = RT_MIN(cbSame, cbRange);
+
+    int rc = fAllocated ? VINF_SUCCESS : VERR_VD_BLOCK_FREE;
+    LogFlowFunc(("returns %Rrc (cbSame=%llu)\n", rc, *pcbSame));
+    return rc;
+}
+
+
 VBOXHDDBACKEND g_VDIBackend =
 {
     /* pszBackendName */
@@ -3261,5 +3298,7 @@ VBOXHDDBACKEND g_VDIBackend =
     /* pfnResize */
     vdiResize,
     /* pfnRepair */
-    vdiRepair
+    vdiRepair,
+    /* pfnQueryAllocation */
+    vdiQueryAllocation
 };
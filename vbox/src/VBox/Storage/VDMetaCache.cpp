@@ -0,0 +1,372 @@
+/* $Id$ */
+/** @file
+ * VD - Shared metadata table cache budget.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_VD
+#include <VBox/err.h>
+
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/once.h>
+#include <iprt/semaphore.h>
+
+#include "VDMetaCache.h"
+
+/**
+ * The table caches of the image backends (QCOW and QED L2 tables, VMDK grain
+ * tables) account their memory here. Every image has a limit configured through
+ * the VD config interface and all images share one process wide budget.
+ *
+ * All cached tables which are not pinned by the backend are kept in a single
+ * LRU list. If an image exceeds its own limit the least recently used entry of
+ * this image is evicted. If the budget is exhausted the least recently used
+ * entry of any image is evicted. The backends do all cache list operations
+ * with the lock held, so it is safe to evict the entry of another image from
+ * here. Entries which are in use are skipped. If nothing can be evicted the
+ * reservation succeeds anyway and the budget is exceeded until entries are
+ * released again.
+ */
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+
+/**
+ * Process wide metadata cache state.
+ */
+typedef struct VDMETACACHEGLOBAL
+{
+    /** Lock protecting the lists and counters below and all
+     * cache lists of the backends. */
+    RTSEMFASTMUTEX      hMtx;
+    /** The LRU list of all cache entries. */
+    RTLISTANCHOR        ListLru;
+    /** List of all registered caches. */
+    RTLISTANCHOR        ListCaches;
+    /** Memory budget for all caches. */
+    size_t              cbBudget;
+    /** Memory used by all caches. */
+    size_t              cbUsed;
+    /** Hits of caches which were already destroyed. */
+    uint64_t            cHitsRetired;
+    /** Misses of caches which were already destroyed. */
+    uint64_t            cMissesRetired;
+    /** Evictions of caches which were already destroyed. */
+    uint64_t            cEvictionsRetired;
+} VDMETACACHEGLOBAL;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** Initialize the global state only once. */
+static RTONCE            g_MetaCacheOnce = RTONCE_INITIALIZER;
+/** The global state. */
+static VDMETACACHEGLOBAL g_MetaCache;
+
+
+/**
+ * Initializes the global state, called once.
+ *
+ * @returns VBox status code.
+ * @param   pvUser    Unused.
+ */
+static DECLCALLBACK(int32_t) vdMetaCacheInitOnce(void *pvUser)
+{
+    NOREF(pvUser);
+
+    RTListInit(&g_MetaCache.ListLru);
+    RTListInit(&g_MetaCache.ListCaches);
+    g_MetaCache.cbBudget = VD_META_CACHE_BUDGET_DEFAULT;
+    g_MetaCache.cbUsed   = 0;
+    return RTSemFastMutexCreate(&g_MetaCache.hMtx);
+}
+
+/**
+ * Evicts the least recently used entry which is not in use.
+ *
+ * @returns true if an entry was evicted, false otherwise.
+ * @param   pOwner    Evict only entries of this cache, NULL to evict
+ *                    from any cache.
+ */
+static bool vdMetaCacheEvictLru(PVDMETACACHE pOwner)
+{
+    PVDMETACACHEENTRY pEntry = NULL;
+    PVDMETACACHEENTRY pPrev  = NULL;
+
+    RTListForEachReverseSafe(&g_MetaCache.ListLru, pEntry, pPrev, VDMETACACHEENTRY, NodeLru)
+    {
+        PVDMETACACHE pCache = pEntry->pOwner;
+
+        if (   (!pOwner || pCache == pOwner)
+            && pCache->pfnEvict(pCache->pvUser, pEntry))
+        {
+            pCache->cEvictions++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Creates a new metadata cache for an image and registers it.
+ *
+ * @returns VBox status code.
+ * @param   pCache    The cache to initialize.
+ * @param   cbMax     Maximum amount of memory the cache may use.
+ * @param   pfnEvict  Callback to evict an entry.
+ * @param   pvUser    Opaque user data for the callback.
+ */
+int vdMetaCacheCreate(PVDMETACACHE pCache, size_t cbMax, PFNVDMETACACHEEVICT pfnEvict, void *pvUser)
+{
+    int rc = RTOnce(&g_MetaCacheOnce, vdMetaCacheInitOnce, NULL);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pCache->cbMax      = cbMax;
+    pCache->cbUsed     = 0;
+    pCache->cEntries   = 0;
+    pCache->pfnEvict   = pfnEvict;
+    pCache->pvUser     = pvUser;
+    pCache->cHits      = 0;
+    pCache->cMisses    = 0;
+    pCache->cEvictions = 0;
+
+    vdMetaCacheLock();
+    RTListAppend(&g_MetaCache.ListCaches, &pCache->NodeCaches);
+    vdMetaCacheUnlock();
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Unregisters a metadata cache. All entries must be freed already.
+ * Does nothing if the cache was never created.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache to destroy.
+ */
+void vdMetaCacheDestroy(PVDMETACACHE pCache)
+{
+    if (!pCache->pfnEvict)
+        return;
+
+    vdMetaCacheLock();
+    Assert(!pCache->cEntries);
+    Assert(!pCache->cbUsed);
+    RTListNodeRemove(&pCache->NodeCaches);
+    g_MetaCache.cHitsRetired      += pCache->cHits;
+    g_MetaCache.cMissesRetired    += pCache->cMisses;
+    g_MetaCache.cEvictionsRetired += pCache->cEvictions;
+    vdMetaCacheUnlock();
+
+    pCache->pfnEvict = NULL;
+}
+
+/**
+ * Queries the cache limit of an image from the VD config interface.
+ *
+ * @returns The configured limit in bytes or the default if the key is not
+ *          present or there is no config interface.
+ * @param   pVDIfsImage    The per image interface list.
+ * @param   pszKey         The name of the config key.
+ * @param   cbDefault      The default limit.
+ */
+size_t vdMetaCacheQueryMax(PVDINTERFACE pVDIfsImage, const char *pszKey, size_t cbDefault)
+{
+    PVDINTERFACECONFIG pIfCfg = VDIfConfigGet(pVDIfsImage);
+    uint64_t cbMax = cbDefault;
+
+    if (pIfCfg)
+    {
+        int rc = VDCFGQueryU64Def(pIfCfg, pszKey, &cbMax, cbDefault);
+        if (RT_FAILURE(rc))
+            cbMax = cbDefault;
+    }
+
+    return (size_t)RT_MIN(cbMax, (uint64_t)~(size_t)0);
+}
+
+/**
+ * Acquires the metadata cache lock.
+ *
+ * @returns nothing.
+ */
+void vdMetaCacheLock(void)
+{
+    int rc = RTSemFastMutexRequest(g_MetaCache.hMtx);
+    AssertRC(rc);
+}
+
+/**
+ * Releases the metadata cache lock.
+ *
+ * @returns nothing.
+ */
+void vdMetaCacheUnlock(void)
+{
+    int rc = RTSemFastMutexRelease(g_MetaCache.hMtx);
+    AssertRC(rc);
+}
+
+/**
+ * Reserves memory for a new entry evicting old entries if required.
+ * Must be called with the lock held.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache to reserve memory for.
+ * @param   cb        Amount of memory to reserve.
+ */
+void vdMetaCacheReserve(PVDMETACACHE pCache, size_t cb)
+{
+    while (   pCache->cbUsed + cb > pCache->cbMax
+           && vdMetaCacheEvictLru(pCache))
+        ;
+
+    while (   g_MetaCache.cbUsed + cb > g_MetaCache.cbBudget
+           && vdMetaCacheEvictLru(NULL))
+        ;
+
+    pCache->cbUsed      += cb;
+    g_MetaCache.cbUsed  += cb;
+}
+
+/**
+ * Gives back memory reserved with vdMetaCacheReserve().
+ * Must be called with the lock held.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache to release memory from.
+ * @param   cb        Amount of memory to release.
+ */
+void vdMetaCacheRelease(PVDMETACACHE pCache, size_t cb)
+{
+    Assert(pCache->cbUsed >= cb);
+    Assert(g_MetaCache.cbUsed >= cb);
+
+    pCache->cbUsed     -= cb;
+    g_MetaCache.cbUsed -= cb;
+}
+
+/**
+ * Inserts an entry at the top of the LRU list, making it eligible for eviction.
+ * Must be called with the lock held.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache owning the entry.
+ * @param   pEntry    The entry to insert.
+ */
+void vdMetaCacheEntryInsert(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry)
+{
+    pEntry->pOwner = pCache;
+    pCache->cEntries++;
+    RTListPrepend(&g_MetaCache.ListLru, &pEntry->NodeLru);
+}
+
+/**
+ * Removes an entry from the LRU list.
+ * Must be called with the lock held.
+ *
+ * @returns nothing.
+ * @param   pEntry    The entry to remove.
+ */
+void vdMetaCacheEntryRemove(PVDMETACACHEENTRY pEntry)
+{
+    Assert(pEntry->pOwner->cEntries > 0);
+
+    pEntry->pOwner->cEntries--;
+    RTListNodeRemove(&pEntry->NodeLru);
+    pEntry->pOwner = NULL;
+}
+
+/**
+ * Records a cache hit and moves the entry to the top of the LRU list.
+ * Must be called with the lock held.
+ *
+ * @returns nothing.
+ * @param   pEntry    The entry which was hit.
+ */
+void vdMetaCacheEntryHit(PVDMETACACHEENTRY pEntry)
+{
+    pEntry->pOwner->cHits++;
+    RTListNodeRemove(&pEntry->NodeLru);
+    RTListPrepend(&g_MetaCache.ListLru, &pEntry->NodeLru);
+}
+
+/**
+ * Records a cache miss.
+ * Must be called with the lock held.
+ *
+ * @returns nothing.
+ * @param   pCache    The cache which was missed.
+ */
+void vdMetaCacheMiss(PVDMETACACHE pCache)
+{
+    pCache->cMisses++;
+}
+
+/**
+ * Changes the process wide memory budget. Caches above the new budget
+ * shrink on their next allocation.
+ *
+ * @returns nothing.
+ * @param   cbBudget    The new budget in bytes.
+ */
+void vdMetaCacheSetBudget(size_t cbBudget)
+{
+    int rc = RTOnce(&g_MetaCacheOnce, vdMetaCacheInitOnce, NULL);
+    AssertRCReturnVoid(rc);
+
+    vdMetaCacheLock();
+    g_MetaCache.cbBudget = cbBudget;
+    vdMetaCacheUnlock();
+}
+
+/**
+ * Returns the process wide cache statistics.
+ *
+ * @returns nothing.
+ * @param   pStats    Where to store the statistics.
+ */
+void vdMetaCacheQueryStats(PVDMETACACHESTATS pStats)
+{
+    int rc = RTOnce(&g_MetaCacheOnce, vdMetaCacheInitOnce, NULL);
+    AssertRCReturnVoid(rc);
+
+    vdMetaCacheLock();
+    pStats->cbBudget   = g_MetaCache.cbBudget;
+    pStats->cbUsed     = g_MetaCache.cbUsed;
+    pStats->cCaches    = 0;
+    pStats->cHits      = g_MetaCache.cHitsRetired;
+    pStats->cMisses    = g_MetaCache.cMissesRetired;
+    pStats->cEvictions = g_MetaCache.cEvictionsRetired;
+
+    PVDMETACACHE pCache = NULL;
+    RTListForEach(&g_MetaCache.ListCaches, pCache, VDMETACACHE, NodeCaches)
+    {
+        pStats->cCaches++;
+        pStats->cHits      += pCache->cHits;
+        pStats->cMisses    += pCache->cMisses;
+        pStats->cEvictions += pCache->cEvictions;
+    }
+    vdMetaCacheUnlock();
+}
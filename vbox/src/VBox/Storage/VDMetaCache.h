@@ -0,0 +1,131 @@
+/* $Id$ */
+/** @file
+ * VD - Shared metadata table cache budget (internal).
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+#ifndef ___VDMetaCache_h___
+#define ___VDMetaCache_h___
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vd-ifs.h>
+#include <iprt/list.h>
+
+
+/*******************************************************************************
+*   Constants And Macros, Structures and Typedefs                              *
+*******************************************************************************/
+
+/** Default process wide memory budget for all metadata table caches. */
+#define VD_META_CACHE_BUDGET_DEFAULT    (256*_1M)
+
+/** Pointer to a per image metadata cache. */
+typedef struct VDMETACACHE *PVDMETACACHE;
+
+/**
+ * Metadata cache entry. Embedded into the backend specific table cache entry.
+ */
+typedef struct VDMETACACHEENTRY
+{
+    /** List node for the process wide LRU list. */
+    RTLISTNODE          NodeLru;
+    /** The cache owning this entry. */
+    PVDMETACACHE        pOwner;
+} VDMETACACHEENTRY, *PVDMETACACHEENTRY;
+
+/**
+ * Evicts an unused cache entry.
+ *
+ * Called with the metadata cache lock held. If the entry is not referenced the
+ * callback must remove it with vdMetaCacheEntryRemove(), give back its memory
+ * with vdMetaCacheRelease() and free it.
+ *
+ * @returns true if the entry was evicted, false if it is still in use.
+ * @param   pvUser    Opaque user data passed in vdMetaCacheCreate().
+ * @param   pEntry    The entry to evict.
+ */
+typedef DECLCALLBACK(bool) FNVDMETACACHEEVICT(void *pvUser, PVDMETACACHEENTRY pEntry);
+/** Pointer to a FNVDMETACACHEEVICT(). */
+typedef FNVDMETACACHEEVICT *PFNVDMETACACHEEVICT;
+
+/**
+ * Per image metadata cache, accounts the memory of one image against
+ * the process wide budget.
+ */
+typedef struct VDMETACACHE
+{
+    /** List node for the list of all caches. */
+    RTLISTNODE          NodeCaches;
+    /** Maximum amount of memory this cache may use. */
+    size_t              cbMax;
+    /** Memory currently used by this cache. */
+    size_t              cbUsed;
+    /** Number of entries of this cache in the LRU list. */
+    uint32_t            cEntries;
+    /** Eviction callback. */
+    PFNVDMETACACHEEVICT pfnEvict;
+    /** Opaque user data for the eviction callback. */
+    void               *pvUser;
+    /** Number of lookups which hit the cache. */
+    uint64_t            cHits;
+    /** Number of lookups which missed the cache. */
+    uint64_t            cMisses;
+    /** Number of entries evicted from this cache. */
+    uint64_t            cEvictions;
+} VDMETACACHE;
+
+/**
+ * Process wide metadata cache statistics.
+ */
+typedef struct VDMETACACHESTATS
+{
+    /** The memory budget. */
+    size_t              cbBudget;
+    /** Memory used by all caches. */
+    size_t              cbUsed;
+    /** Number of registered caches. */
+    uint32_t            cCaches;
+    /** Number of cache hits of all caches. */
+    uint64_t            cHits;
+    /** Number of cache misses of all caches. */
+    uint64_t            cMisses;
+    /** Number of evictions of all caches. */
+    uint64_t            cEvictions;
+} VDMETACACHESTATS, *PVDMETACACHESTATS;
+
+
+/*******************************************************************************
+*   Internal Functions                                                         *
+*******************************************************************************/
+RT_C_DECLS_BEGIN
+
+int    vdMetaCacheCreate(PVDMETACACHE pCache, size_t cbMax, PFNVDMETACACHEEVICT pfnEvict, void *pvUser);
+void   vdMetaCacheDestroy(PVDMETACACHE pCache);
+size_t vdMetaCacheQueryMax(PVDINTERFACE pVDIfsImage, const char *pszKey, size_t cbDefault);
+void   vdMetaCacheLock(void);
+void   vdMetaCacheUnlock(void);
+void   vdMetaCacheReserve(PVDMETACACHE pCache, size_t cb);
+void   vdMetaCacheRelease(PVDMETACACHE pCache, size_t cb);
+void   vdMetaCacheEntryInsert(PVDMETACACHE pCache, PVDMETACACHEENTRY pEntry);
+void   vdMetaCacheEntryRemove(PVDMETACACHEENTRY pEntry);
+void   vdMetaCacheEntryHit(PVDMETACACHEENTRY pEntry);
+void   vdMetaCacheMiss(PVDMETACACHE pCache);
+void   vdMetaCacheSetBudget(size_t cbBudget);
+void   vdMetaCacheQueryStats(PVDMETACACHESTATS pStats);
+
+RT_C_DECLS_END
+
+#endif
@@ -32,6 +32,8 @@
 #include <iprt/zip.h>
 #include <iprt/asm.h>
 
+#include "VDMetaCache.h"
+
 /*******************************************************************************
 *   Constants And Macros, Structures and Typedefs                              *
 *******************************************************************************/
@@ -328,7 +330,8 @@ typedef struct VMDKEXTENT
 } VMDKEXTENT, *PVMDKEXTENT;
 
 /**
- * Grain table cache size. Allocated per image.
+ * Default and minimum grain table cache size in cache lines. Allocated per
+ * image, can be increased with the GTCacheSize config key (in bytes).
  */
 #define VMDK_GT_CACHE_SIZE 256
 
@@ -388,17 +391,21 @@ typedef struct VMDKGTCACHEENTRY
 } VMDKGTCACHEENTRY, *PVMDKGTCACHEENTRY;
 
 /**
- * Cache data structure for blocks of grain table entries. For now this is a
- * fixed size direct mapping cache, but this should be adapted to the size of
- * the sparse image and maybe converted to a set-associative cache. The
- * implementation below implements a write-through cache with write allocate.
+ * Cache data structure for blocks of grain table entries. This is a direct
+ * mapping cache with a configurable number of lines, but it should maybe be
+ * converted to a set-associative cache. The implementation below implements
+ * a write-through cache with write allocate. The whole cache is accounted
+ * against the shared metadata cache budget and is never evicted, as the
+ * streamOptimized code uses it as the grain table buffer.
  */
 typedef struct VMDKGTCACHE
 {
-    /** Cache entries. */
-    VMDKGTCACHEENTRY    aGTCache[VMDK_GT_CACHE_SIZE];
-    /** Number of cache entries (currently unused). */
+    /** Accounting against the shared metadata cache budget. */
+    VDMETACACHE         Budget;
+    /** Number of cache entries. */
     unsigned            cEntries;
+    /** Cache entries, variable size. */
+    VMDKGTCACHEENTRY    aGTCache[1];
 } VMDKGTCACHE, *PVMDKGTCACHE;
 
 /**
@@ -2892,6 +2899,32 @@ static void vmdkFreeExtentData(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     vmdkFreeStreamBuffers(pExtent);
 }
 
+/**
+ * Internal: grain table cache eviction callback. The grain table cache is
+ * accounted as a whole and can't be evicted.
+ */
+static DECLCALLBACK(bool) vmdkGTCacheEvict(void *pvUser, PVDMETACACHEENTRY pEntry)
+{
+    NOREF(pvUser); NOREF(pEntry);
+    AssertFailed();
+    return false;
+}
+
+/**
+ * Internal: determine the size of the grain table cache structure from the
+ * configuration, never smaller than the default size.
+ */
+static size_t vmdkGTCacheQuerySize(PVMDKIMAGE pImage)
+{
+    size_t cbDefault = RT_OFFSETOF(VMDKGTCACHE, aGTCache[VMDK_GT_CACHE_SIZE]);
+    size_t cbGTCache = vdMetaCacheQueryMax(pImage->pVDIfsImage, "GTCacheSize", cbDefault);
+    size_t cEntries  = RT_MAX(cbGTCache / sizeof(VMDKGTCACHEENTRY), VMDK_GT_CACHE_SIZE);
+
+    /* Avoid overflowing the hash with absurd values. */
+    cEntries = RT_MIN(cEntries, 16 * _1M);
+    return RT_OFFSETOF(VMDKGTCACHE, aGTCache) + cEntries * sizeof(VMDKGTCACHEENTRY);
+}
+
 /**
  * Internal: allocate grain table cache if necessary for this image.
  */
@@ -2910,15 +2943,28 @@ static int vmdkAllocateGrainTableCache(PVMDKIMAGE pImage)
            )
         {
             /* Allocate grain table cache. */
-            pImage->pGTCache = (PVMDKGTCACHE)RTMemAllocZ(sizeof(VMDKGTCACHE));
-            if (!pImage->pGTCache)
+            size_t cbGTCache = vmdkGTCacheQuerySize(pImage);
+            PVMDKGTCACHE pCache = (PVMDKGTCACHE)RTMemAllocZ(cbGTCache);
+            if (!pCache)
                 return VERR_NO_MEMORY;
-            for (unsigned j = 0; j < VMDK_GT_CACHE_SIZE; j++)
+            int rc = vdMetaCacheCreate(&pCache->Budget, cbGTCache, vmdkGTCacheEvict, pImage);
+            if (RT_FAILURE(rc))
             {
-                PVMDKGTCACHEENTRY pGCE = &pImage->pGTCache->aGTCache[j];
+                RTMemFree(pCache);
+                return rc;
+            }
+            vdMetaCacheLock();
+            vdMetaCacheReserve(&pCache->Budget, cbGTCache);
+            vdMetaCacheUnlock();
+
+            pCache->cEntries = (unsigned)(  (cbGTCache - RT_OFFSETOF(VMDKGTCACHE, aGTCache))
+                                          / sizeof(VMDKGTCACHEENTRY));
+            for (unsigned j = 0; j < pCache->cEntries; j++)
+            {
+                PVMDKGTCACHEENTRY pGCE = &pCache->aGTCache[j];
                 pGCE->uExtent = UINT32_MAX;
             }
-            pImage->pGTCache->cEntries = VMDK_GT_CACHE_SIZE;
+            pImage->pGTCache = pCache;
             break;
         }
     }
@@ -4331,6 +4377,10 @@ static int vmdkFreeImage(PVMDKIMAGE pImage, bool fDelete)
 
         if (pImage->pGTCache)
         {
+            vdMetaCacheLock();
+            vdMetaCacheRelease(&pImage->pGTCache->Budget, pImage->pGTCache->Budget.cbMax);
+            vdMetaCacheUnlock();
+            vdMetaCacheDestroy(&pImage->pGTCache->Budget);
             RTMemFree(pImage->pGTCache);
             pImage->pGTCache = NULL;
         }
@@ -4519,6 +4569,8 @@ static int vmdkGetSector(PVMDKIMAGE pImage, PVDIOCTX pIoCtx,
     {
         /* Cache miss, fetch data from disk. */
         PVDMETAXFER pMetaXfer;
+        /* I/O on an image is serialized, the statistics need no locking. */
+        pCache->Budget.cMisses++;
         rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pExtent->pFile->pStorage,
                                    VMDK_SECTOR2BYTE(uGTSector) + (uGTBlock % (pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE)) * sizeof(aGTDataTmp),
                                    aGTDataTmp, sizeof(aGTDataTmp), pIoCtx, &pMetaXfer, NULL, NULL);
@@ -4531,6 +4583,8 @@ static int vmdkGetSector(PVMDKIMAGE pImage, PVDIOCTX pIoCtx,
         for (unsigned i = 0; i < VMDK_GT_CACHELINE_SIZE; i++)
             pGTCacheEntry->aGTData[i] = RT_LE2H_U32(aGTDataTmp[i]);
     }
+    else
+        pCache->Budget.cHits++;
     uGTBlockIndex = (uSector / pExtent->cSectorsPerGrain) % VMDK_GT_CACHELINE_SIZE;
     uint32_t uGrainSector = pGTCacheEntry->aGTData[uGTBlockIndex];
     if (uGrainSector)
@@ -4611,7 +4665,7 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
      * grain table buffer space. Also grain table entry must be clear. */
     if (   pExtent->enmType != VMDKETYPE_HOSTED_SPARSE
         || !pImage->pGTCache
-        || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE
+        || pExtent->cGTEntries > pImage->pGTCache->cEntries * VMDK_GT_CACHELINE_SIZE
         || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
         return VERR_INTERNAL_ERROR;
 
@@ -6506,6 +6560,10 @@ static void vmdkDump(void *pBackendData)
         vdIfErrorMessage(pImage->pIfError, "Header: uuidModification={%RTuuid}\n", &pImage->ModificationUuid);
         vdIfErrorMessage(pImage->pIfError, "Header: uuidParent={%RTuuid}\n", &pImage->ParentUuid);
         vdIfErrorMessage(pImage->pIfError, "Header: uuidParentModification={%RTuuid}\n", &pImage->ParentModificationUuid);
+        if (pImage->pGTCache)
+            vdIfErrorMessage(pImage->pIfError, "GT cache: Lines=%u Size=%zu Hits=%llu Misses=%llu\n",
+                             pImage->pGTCache->cEntries, pImage->pGTCache->Budget.cbMax,
+                             pImage->pGTCache->Budget.cHits, pImage->pGTCache->Budget.cMisses);
     }
 }
 
@@ -660,6 +660,11 @@ static VBOXSTRICTRC     iemRaiseSelectorBoundsBySelector(PIEMCPU pIemCpu, RTSEL
 static VBOXSTRICTRC     iemRaiseSelectorInvalidAccess(PIEMCPU pIemCpu, uint32_t iSegReg, uint32_t fAccess);
 static VBOXSTRICTRC     iemRaisePageFault(PIEMCPU pIemCpu, RTGCPTR GCPtrWhere, uint32_t fAccess, int rc);
 static VBOXSTRICTRC     iemRaiseAlignmentCheckException(PIEMCPU pIemCpu);
+static VBOXSTRICTRC     iemMemPageTranslateAndCheckAccessEx(PIEMCPU pIemCpu, RTGCPTR GCPtrMem, uint32_t fAccess,
+                                                            PRTGCPHYS pGCPhysMem, PIEMTLBENTRY *ppTlbe);
+#ifdef IN_RING3
+static uint8_t         *iemTlbGetMappingR3(PIEMCPU pIemCpu, PIEMTLBENTRY pTlbe, uint32_t fAccess);
+#endif
 static VBOXSTRICTRC     iemMemMap(PIEMCPU pIemCpu, void **ppvMem, size_t cbMem, uint8_t iSegReg, RTGCPTR GCPtrMem, uint32_t fAccess);
 static VBOXSTRICTRC     iemMemCommitAndUnmap(PIEMCPU pIemCpu, void *pvMem, uint32_t fAccess);
 static VBOXSTRICTRC     iemMemFetchDataU32(PIEMCPU pIemCpu, uint32_t *pu32Dst, uint8_t iSegReg, RTGCPTR GCPtrMem);
@@ -831,28 +836,16 @@ static VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PIEMCPU pIemCpu, bool fBypa
     }
 #endif
 
-    RTGCPHYS    GCPhys;
-    uint64_t    fFlags;
-    int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtrPC, &fFlags, &GCPhys);
-    if (RT_FAILURE(rc))
-    {
-        Log(("iemInitDecoderAndPrefetchOpcodes: %RGv - rc=%Rrc\n", GCPtrPC, rc));
-        return iemRaisePageFault(pIemCpu, GCPtrPC, IEM_ACCESS_INSTRUCTION, rc);
-    }
-    if (!(fFlags & X86_PTE_US) && pIemCpu->uCpl == 3)
-    {
-        Log(("iemInitDecoderAndPrefetchOpcodes: %RGv - supervisor page\n", GCPtrPC));
-        return iemRaisePageFault(pIemCpu, GCPtrPC, IEM_ACCESS_INSTRUCTION, VERR_ACCESS_DENIED);
-    }
-    if ((fFlags & X86_PTE_PAE_NX) && (pCtx->msrEFER & MSR_K6_EFER_NXE))
+    RTGCPHYS        GCPhys;
+    PIEMTLBENTRY    pTlbe;
+    VBOXSTRICTRC rcStrict = iemMemPageTranslateAndCheckAccessEx(pIemCpu, GCPtrPC, IEM_ACCESS_INSTRUCTION, &GCPhys, &pTlbe);
+    if (rcStrict != VINF_SUCCESS)
     {
-        Log(("iemInitDecoderAndPrefetchOpcodes: %RGv - NX\n", GCPtrPC));
-        return iemRaisePageFault(pIemCpu, GCPtrPC, IEM_ACCESS_INSTRUCTION, VERR_ACCESS_DENIED);
+        Log(("iemInitDecoderAndPrefetchOpcodes: %RGv - rcStrict=%Rrc\n", GCPtrPC, VBOXSTRICTRC_VAL(rcStrict)));
+        return rcStrict;
     }
-    GCPhys |= GCPtrPC & PAGE_OFFSET_MASK;
     /** @todo Check reserved bits and such stuff. PGM is better at doing
-     *        that, so do it when implementing the guest virtual address
-     *        TLB... */
+     *        that. */
 
 #ifdef IEM_VERIFICATION_MODE_FULL
     /*
@@ -870,6 +863,8 @@ static VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PIEMCPU pIemCpu, bool fBypa
         pIemCpu->cbOpcode = cbNew;
         return VINF_SUCCESS;
     }
+#else
+    pIemCpu->GCPhysOpcodes = GCPhys;
 #endif
 
     /*
@@ -882,6 +877,16 @@ static VBOXSTRICTRC iemInitDecoderAndPrefetchOpcodes(PIEMCPU pIemCpu, bool fBypa
         cbToTryRead = sizeof(pIemCpu->abOpcode);
     /** @todo PATM: Read original, unpatched bytes? EMAll.cpp doesn't seem to be
      *        doing that. */
+    int rc;
+#ifdef IN_RING3
+    uint8_t const *pbPage = iemTlbGetMappingR3(pIemCpu, pTlbe, IEM_ACCESS_INSTRUCTION);
+    if (pbPage)
+    {
+        memcpy(pIemCpu->abOpcode, pbPage + (GCPhys & PAGE_OFFSET_MASK), cbToTryRead);
+        rc = VINF_SUCCESS;
+    }
+    else
+#endif
     if (!pIemCpu->fBypassHandlers)
         rc = PGMPhysRead(IEMCPU_TO_VM(pIemCpu), GCPhys, pIemCpu->abOpcode, cbToTryRead);
     else
@@ -940,29 +945,17 @@ static VBOXSTRICTRC iemOpcodeFetchMoreBytes(PIEMCPU pIemCpu, size_t cbMin)
         GCPtrNext = pCtx->cs.u64Base + GCPtrNext32;
     }
 
-    RTGCPHYS    GCPhys;
-    uint64_t    fFlags;
-    int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtrNext, &fFlags, &GCPhys);
-    if (RT_FAILURE(rc))
-    {
-        Log(("iemOpcodeFetchMoreBytes: %RGv - rc=%Rrc\n", GCPtrNext, rc));
-        return iemRaisePageFault(pIemCpu, GCPtrNext, IEM_ACCESS_INSTRUCTION, rc);
-    }
-    if (!(fFlags & X86_PTE_US) && pIemCpu->uCpl == 3)
-    {
-        Log(("iemOpcodeFetchMoreBytes: %RGv - supervisor page\n", GCPtrNext));
-        return iemRaisePageFault(pIemCpu, GCPtrNext, IEM_ACCESS_INSTRUCTION, VERR_ACCESS_DENIED);
-    }
-    if ((fFlags & X86_PTE_PAE_NX) && (pCtx->msrEFER & MSR_K6_EFER_NXE))
+    RTGCPHYS        GCPhys;
+    PIEMTLBENTRY    pTlbe;
+    VBOXSTRICTRC rcStrict = iemMemPageTranslateAndCheckAccessEx(pIemCpu, GCPtrNext, IEM_ACCESS_INSTRUCTION, &GCPhys, &pTlbe);
+    if (rcStrict != VINF_SUCCESS)
     {
-        Log(("iemOpcodeFetchMoreBytes: %RGv - NX\n", GCPtrNext));
-        return iemRaisePageFault(pIemCpu, GCPtrNext, IEM_ACCESS_INSTRUCTION, VERR_ACCESS_DENIED);
+        Log(("iemOpcodeFetchMoreBytes: %RGv - rcStrict=%Rrc\n", GCPtrNext, VBOXSTRICTRC_VAL(rcStrict)));
+        return rcStrict;
     }
-    GCPhys |= GCPtrNext & PAGE_OFFSET_MASK;
     Log5(("GCPtrNext=%RGv GCPhys=%RGp cbOpcodes=%#x\n",  GCPtrNext,  GCPhys,  pIemCpu->cbOpcode));
     /** @todo Check reserved bits and such stuff. PGM is better at doing
-     *        that, so do it when implementing the guest virtual address
-     *        TLB... */
+     *        that. */
 
     /*
      * Read the bytes at this address.
@@ -973,6 +966,16 @@ static VBOXSTRICTRC iemOpcodeFetchMoreBytes(PIEMCPU pIemCpu, size_t cbMin)
     if (cbToTryRead > sizeof(pIemCpu->abOpcode) - pIemCpu->cbOpcode)
         cbToTryRead = sizeof(pIemCpu->abOpcode) - pIemCpu->cbOpcode;
     Assert(cbToTryRead >= cbMin - cbLeft);
+    int rc;
+#ifdef IN_RING3
+    uint8_t const *pbPage = iemTlbGetMappingR3(pIemCpu, pTlbe, IEM_ACCESS_INSTRUCTION);
+    if (pbPage)
+    {
+        memcpy(&pIemCpu->abOpcode[pIemCpu->cbOpcode], pbPage + (GCPhys & PAGE_OFFSET_MASK), cbToTryRead);
+        rc = VINF_SUCCESS;
+    }
+    else
+#endif
     if (!pIemCpu->fBypassHandlers)
         rc = PGMPhysRead(IEMCPU_TO_VM(pIemCpu), GCPhys, &pIemCpu->abOpcode[pIemCpu->cbOpcode], cbToTryRead);
     else
@@ -4484,6 +4487,311 @@ static uint16_t iemFpuCompressFtw(uint16_t u16FullFtw)
 /** @}  */
 
 
+/** @name   Guest virtual address TLBs.
+ *
+ * Each EMT has a direct mapped code and data TLB caching the result of guest
+ * page table walks.  Whole TLB flushes are done by bumping the revision in the
+ * tags, so CR3 loads and mode changes cost next to nothing.  In ring-3 the
+ * entries also cache the host mapping of the page; these are tagged by the
+ * physical revision (IEMCPU::uTlbPhysRev) which PGM bumps whenever a page
+ * mapping or page state changes.  Access handler changes only drop the
+ * mappings of the pages concerned (IEMTlbInvalidatePhysRangeAllCpus).
+ *
+ * @{
+ */
+
+
+/**
+ * Looks up a guest virtual address in a TLB.
+ *
+ * @returns Pointer to the TLB entry on hit, NULL on miss.
+ * @param   pTlb                The TLB to search.
+ * @param   GCPtr               The guest virtual address.
+ */
+DECLINLINE(PIEMTLBENTRY) iemTlbLookup(PIEMTLB pTlb, RTGCPTR GCPtr)
+{
+#ifndef IEM_VERIFICATION_MODE_FULL
+    uint64_t const     uTagNoRev = IEMTLB_CALC_TAG_NO_REV(GCPtr);
+    PIEMTLBENTRY const pTlbe     = &pTlb->aEntries[IEMTLB_TAG_TO_INDEX(uTagNoRev)];
+    if (   pTlbe->uTag == (uTagNoRev | pTlb->uTlbRevision)
+        || (   pTlbe->uTag == (uTagNoRev | pTlb->uTlbRevisionGlobal)
+            && (pTlbe->fFlagsAndPhysRev & IEMTLBE_F_PT_GLOBAL)) )
+    {
+        pTlb->cTlbHits++;
+        return pTlbe;
+    }
+#else
+    /* The verifier needs to see the page table walks. */
+    NOREF(GCPtr);
+#endif
+    pTlb->cTlbMisses++;
+    return NULL;
+}
+
+
+/**
+ * Walks the guest page tables and loads the result into a TLB entry.
+ *
+ * @returns VBox status code from PGMGstGetPage.  Nothing is cached on failure.
+ * @param   pIemCpu             The IEM per CPU data.
+ * @param   pTlb                The TLB to load the entry into.
+ * @param   GCPtr               The guest virtual address.
+ * @param   ppTlbe              Where to return the loaded entry.
+ */
+static int iemTlbLoadEntry(PIEMCPU pIemCpu, PIEMTLB pTlb, RTGCPTR GCPtr, PIEMTLBENTRY *ppTlbe)
+{
+    /** @todo Need a different PGM interface here.  We're currently using
+     *        generic / REM interfaces. this won't cut it for R0 & RC. */
+    RTGCPHYS    GCPhys;
+    uint64_t    fFlags;
+    int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtr, &fFlags, &GCPhys);
+    if (RT_FAILURE(rc))
+    {
+        /** @todo Check unassigned memory in unpaged mode. */
+        /** @todo Reserved bits in page tables. Requires new PGM interface. */
+        *ppTlbe = NULL;
+        return rc;
+    }
+
+    uint64_t const  uTagNoRev = IEMTLB_CALC_TAG_NO_REV(GCPtr);
+    PIEMTLBENTRY    pTlbe     = &pTlb->aEntries[IEMTLB_TAG_TO_INDEX(uTagNoRev)];
+    uint64_t        fTlbe     = 0;
+    if (!(fFlags & X86_PTE_RW))
+        fTlbe |= IEMTLBE_F_PT_NO_WRITE;
+    if (!(fFlags & X86_PTE_US))
+        fTlbe |= IEMTLBE_F_PT_NO_USER;
+    if (fFlags & X86_PTE_PAE_NX)
+        fTlbe |= IEMTLBE_F_PT_NO_EXEC;
+    if (   (fFlags & X86_PTE_G)
+        && (pIemCpu->CTX_SUFF(pCtx)->cr4 & X86_CR4_PGE))
+    {
+        fTlbe |= IEMTLBE_F_PT_GLOBAL;
+        pTlbe->uTag = uTagNoRev | pTlb->uTlbRevisionGlobal;
+    }
+    else
+        pTlbe->uTag = uTagNoRev | pTlb->uTlbRevision;
+    pTlbe->fFlagsAndPhysRev = fTlbe; /* Physical revision zero never matches, the mapping is set up on demand. */
+    pTlbe->GCPhys           = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    pTlbe->pbMappingR3      = NIL_RTR3PTR;
+
+    *ppTlbe = pTlbe;
+    return VINF_SUCCESS;
+}
+
+
+#ifdef IN_RING3
+/**
+ * Gets the ring-3 mapping of the page a TLB entry translates to, setting it up
+ * if necessary.
+ *
+ * Since the mapping is only revalidated via IEMCPU::uTlbPhysRev, no PGM page
+ * mapping lock is held on the page.
+ *
+ * @returns Pointer to the start of the page, NULL if the access must go thru
+ *          the regular PGM interfaces.
+ * @param   pIemCpu             The IEM per CPU data.
+ * @param   pTlbe               The TLB entry.
+ * @param   fAccess             The intended access (IEM_ACCESS_TYPE_XXX).
+ */
+static uint8_t *iemTlbGetMappingR3(PIEMCPU pIemCpu, PIEMTLBENTRY pTlbe, uint32_t fAccess)
+{
+# if defined(IEM_VERIFICATION_MODE_FULL) || defined(IEM_VERIFICATION_MODE_MINIMAL)
+    /* Same as iemMemPageMap, force the alternative path. */
+    NOREF(pIemCpu); NOREF(pTlbe); NOREF(fAccess);
+    return NULL;
+# else
+    bool const fWrite = RT_BOOL(fAccess & IEM_ACCESS_TYPE_WRITE);
+#  ifdef IEM_LOG_MEMORY_WRITES
+    if (fWrite)
+        return NULL;
+#  endif
+
+    /*
+     * Must read the revision before talking to PGM, a concurrent bump then
+     * makes us redo the mapping next time around.
+     */
+    uint64_t const uTlbPhysRev = ASMAtomicUoReadU64(&pIemCpu->uTlbPhysRev);
+    uint64_t const fPhysBits   = pTlbe->fFlagsAndPhysRev & (IEMTLBE_F_PHYS_REV | IEMTLBE_F_NO_MAPPINGR3);
+    if (fPhysBits == uTlbPhysRev)
+    {
+        if (!fWrite || !(pTlbe->fFlagsAndPhysRev & IEMTLBE_F_PG_NO_WRITE))
+            return pTlbe->pbMappingR3;
+    }
+    else if (fPhysBits == (uTlbPhysRev | IEMTLBE_F_NO_MAPPINGR3))
+        return NULL; /* PGM already said no for this revision. */
+
+    /*
+     * (Re-)establish the mapping.  Reads only ask for a readable mapping so
+     * we don't unshare or allocate pages for nothing.
+     */
+    uint64_t const  cTlbPhysRangeInvls = ASMAtomicUoReadU64(&pIemCpu->cTlbPhysRangeInvls);
+    void           *pv;
+    PGMPAGEMAPLOCK  Lock;
+    int rc = PGMPhysIemGCPhys2Ptr(IEMCPU_TO_VM(pIemCpu), pTlbe->GCPhys, fWrite, false /*fByPassHandlers*/, &pv, &Lock);
+    pTlbe->fFlagsAndPhysRev &= ~(IEMTLBE_F_PHYS_REV | IEMTLBE_F_NO_MAPPINGR3 | IEMTLBE_F_PG_NO_WRITE);
+    if (rc == VINF_SUCCESS)
+    {
+        PGMPhysReleasePageMappingLock(IEMCPU_TO_VM(pIemCpu), &Lock);
+        pTlbe->fFlagsAndPhysRev |= uTlbPhysRev | (fWrite ? 0 : IEMTLBE_F_PG_NO_WRITE);
+        pTlbe->pbMappingR3       = (uint8_t *)pv;
+    }
+    else
+    {
+        /* Handlers, MMIO or unassigned memory. */
+        pTlbe->fFlagsAndPhysRev |= uTlbPhysRev | IEMTLBE_F_NO_MAPPINGR3;
+        pTlbe->pbMappingR3       = NULL;
+        pv = NULL;
+    }
+
+    /* If a handler range was invalidated while we were at it, the scan may
+       have missed the entry.  Don't keep it then.  (ASMAtomicReadU64 fences.) */
+    if (RT_UNLIKELY(ASMAtomicReadU64(&pIemCpu->cTlbPhysRangeInvls) != cTlbPhysRangeInvls))
+        pTlbe->fFlagsAndPhysRev &= ~(IEMTLBE_F_PHYS_REV | IEMTLBE_F_NO_MAPPINGR3);
+    return (uint8_t *)pv;
+# endif
+}
+#endif /* IN_RING3 */
+
+
+/**
+ * Flushes one TLB.
+ *
+ * @param   pTlb                The TLB.
+ * @param   fGlobal             Whether to flush global pages as well.
+ */
+static void iemTlbFlush(PIEMTLB pTlb, bool fGlobal)
+{
+    pTlb->uTlbRevision += IEMTLB_REVISION_INCR;
+    if (RT_LIKELY(pTlb->uTlbRevision != 0))
+    {
+        if (fGlobal)
+            pTlb->uTlbRevisionGlobal = pTlb->uTlbRevision;
+    }
+    else
+    {
+        /* Wrapped around, start over with clean tags. */
+        pTlb->uTlbRevision       = IEMTLB_REVISION_INCR;
+        pTlb->uTlbRevisionGlobal = IEMTLB_REVISION_INCR;
+        for (unsigned i = 0; i < RT_ELEMENTS(pTlb->aEntries); i++)
+            pTlb->aEntries[i].uTag = 0;
+    }
+}
+
+
+/**
+ * Invalidates all entries in a TLB within the 4MB region containing the given
+ * revision-less tag.
+ *
+ * PGMGstGetPage doesn't tell us whether the translation came from a large page,
+ * so INVLPG has to assume the worst.  This covers both 2MB and 4MB pages.
+ *
+ * @param   pTlb                The TLB.
+ * @param   uTagNoRev           The revision-less tag of the address.
+ */
+static void iemTlbInvalidateLargePageRegion(PIEMTLB pTlb, uint64_t uTagNoRev)
+{
+    uint64_t const uRegion = uTagNoRev >> (X86_PD_SHIFT - X86_PAGE_4K_SHIFT);
+    for (unsigned i = 0; i < RT_ELEMENTS(pTlb->aEntries); i++)
+        if (((pTlb->aEntries[i].uTag & (IEMTLB_REVISION_INCR - 1)) >> (X86_PD_SHIFT - X86_PAGE_4K_SHIFT)) == uRegion)
+            pTlb->aEntries[i].uTag = 0;
+}
+
+
+/**
+ * Invalidates all the guest virtual address translations of this VCPU.
+ *
+ * This is called by PGM when CR3 is loaded, when the paging mode changes and
+ * similar, and by EM after having executed guest code natively.
+ *
+ * @param   pVCpu               The virtual CPU.
+ * @param   fGlobal             Whether to flush global pages as well.
+ * @thread  EMT(pVCpu)
+ */
+VMM_INT_DECL(void) IEMTlbInvalidateAll(PVMCPU pVCpu, bool fGlobal)
+{
+    PIEMCPU pIemCpu = &pVCpu->iem.s;
+    iemTlbFlush(&pIemCpu->CodeTlb, fGlobal);
+    iemTlbFlush(&pIemCpu->DataTlb, fGlobal);
+}
+
+
+/**
+ * Invalidates the guest virtual address translations of a page (INVLPG).
+ *
+ * @param   pVCpu               The virtual CPU.
+ * @param   GCPtr               The address of the page.
+ * @thread  EMT(pVCpu)
+ */
+VMM_INT_DECL(void) IEMTlbInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtr)
+{
+    PIEMCPU        pIemCpu   = &pVCpu->iem.s;
+    uint64_t const uTagNoRev = IEMTLB_CALC_TAG_NO_REV(GCPtr);
+    iemTlbInvalidateLargePageRegion(&pIemCpu->CodeTlb, uTagNoRev);
+    iemTlbInvalidateLargePageRegion(&pIemCpu->DataTlb, uTagNoRev);
+}
+
+
+/**
+ * Invalidates the ring-3 host mappings cached by the TLBs of all VCPUs.
+ *
+ * PGM calls this whenever a guest physical page changes backing, state or
+ * access handlers.  The translations themselves are left alone.
+ *
+ * @param   pVM                 Pointer to the VM.
+ * @thread  Any.
+ */
+VMM_INT_DECL(void) IEMTlbInvalidateAllPhysicalAllCpus(PVM pVM)
+{
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+        ASMAtomicAddU64(&pVM->aCpus[idCpu].iem.s.uTlbPhysRev, IEMTLB_PHYS_REV_INCR);
+}
+
+
+/**
+ * Drops the ring-3 host mappings of a guest physical range from one TLB.
+ *
+ * @param   pTlb                The TLB.
+ * @param   GCPhysFirst         The first page of the range.
+ * @param   GCPhysLast          The last byte of the range.
+ */
+static void iemTlbInvalidatePhysRange(PIEMTLB pTlb, RTGCPHYS GCPhysFirst, RTGCPHYS GCPhysLast)
+{
+    for (unsigned i = 0; i < RT_ELEMENTS(pTlb->aEntries); i++)
+        if (pTlb->aEntries[i].GCPhys - GCPhysFirst <= GCPhysLast - GCPhysFirst)
+            ASMAtomicAndU64(&pTlb->aEntries[i].fFlagsAndPhysRev, ~(IEMTLBE_F_PHYS_REV | IEMTLBE_F_NO_MAPPINGR3));
+}
+
+
+/**
+ * Invalidates the ring-3 host mappings of a guest physical range cached by the
+ * TLBs of all VCPUs.
+ *
+ * Used by PGM when access handlers are registered or deregistered.  Unlike
+ * IEMTlbInvalidateAllPhysicalAllCpus this leaves the mappings of all the other
+ * pages alone.  Walking the TLBs of the other VCPUs is fine as the caller owns
+ * the PGM lock, so their mapping setup (PGMPhysIemGCPhys2Ptr) is serialized
+ * with us and detected via IEMCPU::cTlbPhysRangeInvls.
+ *
+ * @param   pVM                 Pointer to the VM.
+ * @param   GCPhysFirst         The first byte of the range.
+ * @param   GCPhysLast          The last byte of the range (inclusive).
+ * @thread  Any, owning the PGM lock.
+ */
+VMM_INT_DECL(void) IEMTlbInvalidatePhysRangeAllCpus(PVM pVM, RTGCPHYS GCPhysFirst, RTGCPHYS GCPhysLast)
+{
+    GCPhysFirst &= ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        PIEMCPU pIemCpu = &pVM->aCpus[idCpu].iem.s;
+        ASMAtomicIncU64(&pIemCpu->cTlbPhysRangeInvls);
+        iemTlbInvalidatePhysRange(&pIemCpu->CodeTlb, GCPhysFirst, GCPhysLast);
+        iemTlbInvalidatePhysRange(&pIemCpu->DataTlb, GCPhysFirst, GCPhysLast);
+    }
+}
+
+/** @} */
+
+
 /** @name   Memory access.
  *
  * @{
@@ -4656,72 +4964,100 @@ static VBOXSTRICTRC iemMemApplySegment(PIEMCPU pIemCpu, uint32_t fAccess, uint8_
 
 /**
  * Translates a virtual address to a physical physical address and checks if we
- * can access the page as specified.
+ * can access the page as specified, returning the TLB entry used.
  *
  * @param   pIemCpu             The IEM per CPU data.
  * @param   GCPtrMem            The virtual address.
  * @param   fAccess             The intended access.
  * @param   pGCPhysMem          Where to return the physical address.
+ * @param   ppTlbe              Where to return the TLB entry holding the
+ *                              translation.  NULL on failure.
  */
-static VBOXSTRICTRC iemMemPageTranslateAndCheckAccess(PIEMCPU pIemCpu, RTGCPTR GCPtrMem, uint32_t fAccess,
-                                                      PRTGCPHYS pGCPhysMem)
+static VBOXSTRICTRC iemMemPageTranslateAndCheckAccessEx(PIEMCPU pIemCpu, RTGCPTR GCPtrMem, uint32_t fAccess,
+                                                        PRTGCPHYS pGCPhysMem, PIEMTLBENTRY *ppTlbe)
 {
-    /** @todo Need a different PGM interface here.  We're currently using
-     *        generic / REM interfaces. this won't cut it for R0 & RC. */
-    RTGCPHYS    GCPhys;
-    uint64_t    fFlags;
-    int rc = PGMGstGetPage(IEMCPU_TO_VMCPU(pIemCpu), GCPtrMem, &fFlags, &GCPhys);
-    if (RT_FAILURE(rc))
+    PIEMTLB      pTlb  = fAccess & IEM_ACCESS_TYPE_EXEC ? &pIemCpu->CodeTlb : &pIemCpu->DataTlb;
+    PIEMTLBENTRY pTlbe = iemTlbLookup(pTlb, GCPtrMem);
+    if (!pTlbe)
     {
-        /** @todo Check unassigned memory in unpaged mode. */
-        /** @todo Reserved bits in page tables. Requires new PGM interface. */
-        *pGCPhysMem = NIL_RTGCPHYS;
-        return iemRaisePageFault(pIemCpu, GCPtrMem, fAccess, rc);
+        int rc = iemTlbLoadEntry(pIemCpu, pTlb, GCPtrMem, &pTlbe);
+        if (RT_FAILURE(rc))
+        {
+            *pGCPhysMem = NIL_RTGCPHYS;
+            *ppTlbe     = NULL;
+            return iemRaisePageFault(pIemCpu, GCPtrMem, fAccess, rc);
+        }
     }
 
     /* If the page is writable and does not have the no-exec bit set, all
-       access is allowed.  Otherwise we'll have to check more carefully... */
-    if ((fFlags & (X86_PTE_RW | X86_PTE_US | X86_PTE_PAE_NX)) != (X86_PTE_RW | X86_PTE_US))
+       access is allowed.  Otherwise we'll have to check more carefully...
+       Note! Real CPUs don't keep translations that caused a #PF, and guests
+             commonly fix up the PTE in the handler and retry without an
+             INVLPG.  So, drop the entry whenever we raise one here. */
+    if (pTlbe->fFlagsAndPhysRev & (IEMTLBE_F_PT_NO_WRITE | IEMTLBE_F_PT_NO_USER | IEMTLBE_F_PT_NO_EXEC))
     {
         /* Write to read only memory? */
         if (   (fAccess & IEM_ACCESS_TYPE_WRITE)
-            && !(fFlags & X86_PTE_RW)
+            && (pTlbe->fFlagsAndPhysRev & IEMTLBE_F_PT_NO_WRITE)
             && (   pIemCpu->uCpl != 0
                 || (pIemCpu->CTX_SUFF(pCtx)->cr0 & X86_CR0_WP)))
         {
             Log(("iemMemPageTranslateAndCheckAccess: GCPtrMem=%RGv - read-only page -> #PF\n", GCPtrMem));
             *pGCPhysMem = NIL_RTGCPHYS;
+            *ppTlbe     = NULL;
+            pTlbe->uTag = 0;
             return iemRaisePageFault(pIemCpu, GCPtrMem, fAccess & ~IEM_ACCESS_TYPE_READ, VERR_ACCESS_DENIED);
         }
 
         /* Kernel memory accessed by userland? */
-        if (   !(fFlags & X86_PTE_US)
+        if (   (pTlbe->fFlagsAndPhysRev & IEMTLBE_F_PT_NO_USER)
             && pIemCpu->uCpl == 3
             && !(fAccess & IEM_ACCESS_WHAT_SYS))
         {
             Log(("iemMemPageTranslateAndCheckAccess: GCPtrMem=%RGv - user access to kernel page -> #PF\n", GCPtrMem));
             *pGCPhysMem = NIL_RTGCPHYS;
+            *ppTlbe     = NULL;
+            pTlbe->uTag = 0;
             return iemRaisePageFault(pIemCpu, GCPtrMem, fAccess, VERR_ACCESS_DENIED);
         }
 
         /* Executing non-executable memory? */
         if (   (fAccess & IEM_ACCESS_TYPE_EXEC)
-            && (fFlags & X86_PTE_PAE_NX)
+            && (pTlbe->fFlagsAndPhysRev & IEMTLBE_F_PT_NO_EXEC)
             && (pIemCpu->CTX_SUFF(pCtx)->msrEFER & MSR_K6_EFER_NXE) )
         {
             Log(("iemMemPageTranslateAndCheckAccess: GCPtrMem=%RGv - NX -> #PF\n", GCPtrMem));
             *pGCPhysMem = NIL_RTGCPHYS;
+            *ppTlbe     = NULL;
+            pTlbe->uTag = 0;
             return iemRaisePageFault(pIemCpu, GCPtrMem, fAccess & ~(IEM_ACCESS_TYPE_READ | IEM_ACCESS_TYPE_WRITE),
                                      VERR_ACCESS_DENIED);
         }
     }
 
-    GCPhys |= GCPtrMem & PAGE_OFFSET_MASK;
-    *pGCPhysMem = GCPhys;
+    *pGCPhysMem = pTlbe->GCPhys | (GCPtrMem & PAGE_OFFSET_MASK);
+    *ppTlbe     = pTlbe;
     return VINF_SUCCESS;
 }
 
 
+/**
+ * Translates a virtual address to a physical physical address and checks if we
+ * can access the page as specified.
+ *
+ * @param   pIemCpu             The IEM per CPU data.
+ * @param   GCPtrMem            The virtual address.
+ * @param   fAccess             The intended access.
+ * @param   pGCPhysMem          Where to return the physical address.
+ */
+static VBOXSTRICTRC iemMemPageTranslateAndCheckAccess(PIEMCPU pIemCpu, RTGCPTR GCPtrMem, uint32_t fAccess,
+                                                      PRTGCPHYS pGCPhysMem)
+{
+    PIEMTLBENTRY pTlbeIgn;
+    return iemMemPageTranslateAndCheckAccessEx(pIemCpu, GCPtrMem, fAccess, pGCPhysMem, &pTlbeIgn);
+}
+
+
 
 /**
  * Maps a physical page.
@@ -5223,21 +5559,34 @@ static VBOXSTRICTRC iemMemMap(PIEMCPU pIemCpu, void **ppvMem, size_t cbMem, uint
     if ((GCPtrMem & PAGE_OFFSET_MASK) + cbMem > PAGE_SIZE) /* Crossing a page boundary? */
         return iemMemBounceBufferMapCrossPage(pIemCpu, iMemMap, ppvMem, cbMem, GCPtrMem, fAccess);
 
-    RTGCPHYS GCPhysFirst;
-    rcStrict = iemMemPageTranslateAndCheckAccess(pIemCpu, GCPtrMem, fAccess, &GCPhysFirst);
+    RTGCPHYS     GCPhysFirst;
+    PIEMTLBENTRY pTlbe;
+    rcStrict = iemMemPageTranslateAndCheckAccessEx(pIemCpu, GCPtrMem, fAccess, &GCPhysFirst, &pTlbe);
     if (rcStrict != VINF_SUCCESS)
         return rcStrict;
 
-    void *pvMem;
-    rcStrict = iemMemPageMap(pIemCpu, GCPhysFirst, fAccess, &pvMem, &pIemCpu->aMemMappingLocks[iMemMap].Lock);
-    if (rcStrict != VINF_SUCCESS)
-        return iemMemBounceBufferMapPhys(pIemCpu, iMemMap, ppvMem, cbMem, GCPhysFirst, fAccess, rcStrict);
+    void    *pvMem;
+    uint32_t fMapping = fAccess;
+#ifdef IN_RING3
+    uint8_t *pbPage = iemTlbGetMappingR3(pIemCpu, pTlbe, fAccess);
+    if (pbPage)
+    {
+        pvMem     = pbPage + (GCPhysFirst & PAGE_OFFSET_MASK);
+        fMapping |= IEM_ACCESS_NOT_LOCKED;
+    }
+    else
+#endif
+    {
+        rcStrict = iemMemPageMap(pIemCpu, GCPhysFirst, fAccess, &pvMem, &pIemCpu->aMemMappingLocks[iMemMap].Lock);
+        if (rcStrict != VINF_SUCCESS)
+            return iemMemBounceBufferMapPhys(pIemCpu, iMemMap, ppvMem, cbMem, GCPhysFirst, fAccess, rcStrict);
+    }
 
     /*
      * Fill in the mapping table entry.
      */
     pIemCpu->aMemMappings[iMemMap].pv      = pvMem;
-    pIemCpu->aMemMappings[iMemMap].fAccess = fAccess;
+    pIemCpu->aMemMappings[iMemMap].fAccess = fMapping;
     pIemCpu->iNextMapping = iMemMap + 1;
     pIemCpu->cActiveMappings++;
 
@@ -5266,8 +5615,8 @@ static VBOXSTRICTRC iemMemCommitAndUnmap(PIEMCPU pIemCpu, void *pvMem, uint32_t
         if (pIemCpu->aMemMappings[iMemMap].fAccess & IEM_ACCESS_TYPE_WRITE)
             return iemMemBounceBufferCommitAndUnmap(pIemCpu, iMemMap);
     }
-    /* Otherwise unlock it. */
-    else
+    /* Otherwise unlock it, unless it's a TLB mapping which isn't locked. */
+    else if (!(pIemCpu->aMemMappings[iMemMap].fAccess & IEM_ACCESS_NOT_LOCKED))
         PGMPhysReleasePageMappingLock(IEMCPU_TO_VM(pIemCpu), &pIemCpu->aMemMappingLocks[iMemMap].Lock);
 
     /* Free the entry. */
@@ -8443,6 +8792,10 @@ VMMDECL(VBOXSTRICTRC)       IEMExecOneEx(PVMCPU pVCpu, PCPUMCTXCORE pCtxCore, ui
     PIEMCPU  pIemCpu = &pVCpu->iem.s;
     PCPUMCTX pCtx    = pVCpu->iem.s.CTX_SUFF(pCtx);
     AssertReturn(CPUMCTX2CORE(pCtx) == pCtxCore, VERR_IEM_IPE_3);
+#ifdef IN_RING0
+    /* The guest has been running with nested paging since we last looked. */
+    IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
+#endif
 
     iemInitDecoder(pIemCpu, false);
     uint32_t const cbOldWritten = pIemCpu->cbWritten;
@@ -8464,6 +8817,10 @@ VMMDECL(VBOXSTRICTRC)       IEMExecOneWithPrefetchedByPC(PVMCPU pVCpu, PCPUMCTXC
     PIEMCPU  pIemCpu = &pVCpu->iem.s;
     PCPUMCTX pCtx    = pVCpu->iem.s.CTX_SUFF(pCtx);
     AssertReturn(CPUMCTX2CORE(pCtx) == pCtxCore, VERR_IEM_IPE_3);
+#ifdef IN_RING0
+    /* The guest has been running with nested paging since we last looked. */
+    IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
+#endif
 
     VBOXSTRICTRC rcStrict;
     if (   cbOpcodeBytes
@@ -8489,6 +8846,10 @@ VMMDECL(VBOXSTRICTRC)       IEMExecOneBypassEx(PVMCPU pVCpu, PCPUMCTXCORE pCtxCo
     PIEMCPU  pIemCpu = &pVCpu->iem.s;
     PCPUMCTX pCtx    = pVCpu->iem.s.CTX_SUFF(pCtx);
     AssertReturn(CPUMCTX2CORE(pCtx) == pCtxCore, VERR_IEM_IPE_3);
+#ifdef IN_RING0
+    /* The guest has been running with nested paging since we last looked. */
+    IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
+#endif
 
     iemInitDecoder(pIemCpu, true);
     uint32_t const cbOldWritten = pIemCpu->cbWritten;
@@ -8510,6 +8871,10 @@ VMMDECL(VBOXSTRICTRC)       IEMExecOneBypassWithPrefetchedByPC(PVMCPU pVCpu, PCP
     PIEMCPU  pIemCpu = &pVCpu->iem.s;
     PCPUMCTX pCtx    = pVCpu->iem.s.CTX_SUFF(pCtx);
     AssertReturn(CPUMCTX2CORE(pCtx) == pCtxCore, VERR_IEM_IPE_3);
+#ifdef IN_RING0
+    /* The guest has been running with nested paging since we last looked. */
+    IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
+#endif
 
     VBOXSTRICTRC rcStrict;
     if (   cbOpcodeBytes
@@ -8528,8 +8893,240 @@ VMMDECL(VBOXSTRICTRC)       IEMExecOneBypassWithPrefetchedByPC(PVMCPU pVCpu, PCP
 }
 
 
+#if defined(IN_RING3) && !defined(IEM_VERIFICATION_MODE)
+/** @name   Decoded block cache.
+ *
+ * IEMExecLots keeps a per-VCPU cache of the instruction boundaries and opcode
+ * bytes of the blocks it executes, keyed by the guest physical address of the
+ * first instruction.  When replaying a block, only the first instruction is
+ * fetched the normal way, the rest are fed to the decoder from the cache as
+ * long as execution proceeds straight thru the block.
+ *
+ * The code pages are write monitored thru PGM (see iemR3CodePageMonitor), a
+ * write bumps the page generation and thereby invalidates every block
+ * recorded from it.
+ *
+ * @{
+ */
+
+/** The max number of instructions IEMExecLots executes before returning to
+ * EM so it can poll the timers. */
+# define IEM_EXEC_LOTS_MAX_INSTRS       4096
+
+
+/**
+ * Checks whether a cached block was recorded from the current content of its
+ * code page.
+ *
+ * @returns true if current, false if stale.
+ * @param   pIemCpu             The IEM per CPU data.
+ * @param   pBlock              The block.
+ */
+DECLINLINE(bool) iemBlockIsCurrent(PIEMCPU pIemCpu, PIEMBLOCK pBlock)
+{
+    PIEMCODEPAGE pCodePage = &pIemCpu->pCodePagesR3->aPages[IEMCODEPAGE_IDX(pBlock->GCPhys)];
+    return pCodePage->GCPhys      == (pBlock->GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK)
+        && pCodePage->uGeneration == pBlock->uCodePageGen;
+}
+
+
+/**
+ * Executes a block of instructions, either replaying or recording it.
+ *
+ * The first instruction must already have been fetched by
+ * iemInitDecoderAndPrefetchOpcodes.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVCpu               The current virtual CPU.
+ * @param   pIemCpu             The IEM per CPU data.
+ * @param   pBlock              The block to replay, or the cache entry to
+ *                              record into.
+ * @param   fRecord             Whether to record the block.
+ * @param   pcInstrBudget       The instruction budget, decremented by the
+ *                              number of instructions executed.
+ */
+static VBOXSTRICTRC iemExecBlock(PVMCPU pVCpu, PIEMCPU pIemCpu, PIEMBLOCK pBlock, bool fRecord, uint32_t *pcInstrBudget)
+{
+    PVM             pVM         = IEMCPU_TO_VM(pIemCpu);
+    PCPUMCTX        pCtx        = pIemCpu->CTX_SUFF(pCtx);
+    RTGCPHYS const  GCPhysBlock = pIemCpu->GCPhysOpcodes;
+
+    /*
+     * Take note of what the fetching of the first instruction established.
+     * As long as this holds, the opcode bytes of the following instructions
+     * come from the same physical page and the access checks still apply.
+     */
+    IEMMODE const       enmCpuMode    = pIemCpu->enmCpuMode;
+    uint8_t const       uCpl          = pIemCpu->uCpl;
+    RTGCPTR const       GCPtrBlock    = enmCpuMode == IEMMODE_64BIT ? pCtx->rip : pCtx->cs.u64Base + pCtx->eip;
+    PIEMTLBENTRY const  pTlbe         = &pIemCpu->CodeTlb.aEntries[IEMTLB_TAG_TO_INDEX(IEMTLB_CALC_TAG_NO_REV(GCPtrBlock))];
+    uint64_t const      uTlbeTag      = pTlbe->uTag;
+    uint64_t const      uTlbRev       = pIemCpu->CodeTlb.uTlbRevision;
+    uint64_t const      uTlbRevGlobal = pIemCpu->CodeTlb.uTlbRevisionGlobal;
+    uint32_t const      cbPageLeft    = PAGE_SIZE - (uint32_t)(GCPhysBlock & PAGE_OFFSET_MASK);
+
+    if (fRecord)
+    {
+        pBlock->GCPhys = NIL_RTGCPHYS;
+        int rc = iemR3CodePageMonitor(pVM, pIemCpu->pCodePagesR3, GCPhysBlock & ~(RTGCPHYS)PAGE_OFFSET_MASK,
+                                      &pBlock->uCodePageGen);
+        if (RT_SUCCESS(rc))
+        {
+            pBlock->enmCpuMode = (uint8_t)enmCpuMode;
+            pBlock->cInstrs    = 0;
+            pBlock->cbOpcodes  = 0;
+        }
+        else
+        {
+            /* Someone else is monitoring the page, it isn't RAM, or it is
+               written to too often to be worth it. */
+            if (rc == VERR_TRY_AGAIN)
+                pIemCpu->cBlockUncacheable++;
+            fRecord = false;
+        }
+    }
+
+    VBOXSTRICTRC    rcStrict;
+    uint32_t        offInstr = 0;
+    unsigned        iInstr   = 0;
+    for (;;)
+    {
+        /*
+         * Execute the instruction.
+         */
+        uint32_t const cInstrsBefore = pIemCpu->cInstructions;
+        uint64_t const uRipBefore    = pCtx->rip;
+        rcStrict = iemExecOneInner(pVCpu, pIemCpu, true);
+        *pcInstrBudget -= RT_MIN(*pcInstrBudget, pIemCpu->cInstructions - cInstrsBefore);
+        if (rcStrict != VINF_SUCCESS)
+            break;
+
+        /* Note! Interrupt inhibiting may have made iemExecOneInner do two
+                 instructions, that's not something we want in a block. */
+        uint8_t const   cbInstr     = fRecord ? pIemCpu->offOpcode : pBlock->acbInstrs[iInstr];
+        bool const      fStraight   = pIemCpu->cInstructions == cInstrsBefore + 1
+                                   && pCtx->rip == uRipBefore + cbInstr;
+        if (fRecord)
+        {
+            if (   pIemCpu->cInstructions != cInstrsBefore + 1
+                || offInstr + cbInstr > cbPageLeft
+                || offInstr + cbInstr > sizeof(pBlock->abOpcodes))
+                break;
+            memcpy(&pBlock->abOpcodes[offInstr], pIemCpu->abOpcode, cbInstr);
+            pBlock->acbInstrs[iInstr] = cbInstr;
+            pBlock->cInstrs           = (uint8_t)(iInstr + 1);
+            pBlock->cbOpcodes         = (uint8_t)(offInstr + cbInstr);
+            pBlock->GCPhys            = GCPhysBlock;
+        }
+        offInstr += cbInstr;
+        iInstr++;
+
+        /*
+         * Should we continue with the next instruction in the block?
+         */
+        if (   !fStraight
+            || iInstr >= (fRecord ? (unsigned)RT_ELEMENTS(pBlock->acbInstrs) : (unsigned)pBlock->cInstrs)
+            || !*pcInstrBudget
+            || pCtx->eflags.Bits.u1TF
+            || pIemCpu->CodeTlb.uTlbRevision       != uTlbRev
+            || pIemCpu->CodeTlb.uTlbRevisionGlobal != uTlbRevGlobal
+            || pTlbe->uTag                         != uTlbeTag
+            || VM_FF_ISPENDING(pVM, VM_FF_ALL_REM_MASK)
+            || VMCPU_FF_ISPENDING(pVCpu, VMCPU_FF_ALL_REM_MASK & VM_WHEN_RAW_MODE(~(VMCPU_FF_CSAM_PENDING_ACTION | VMCPU_FF_CSAM_SCAN_PAGE), UINT32_MAX)) )
+            break;
+
+        if (fRecord)
+        {
+            if (offInstr >= cbPageLeft)
+                break;
+            rcStrict = iemInitDecoderAndPrefetchOpcodes(pIemCpu, false);
+            if (rcStrict != VINF_SUCCESS)
+                break;
+            Assert(pIemCpu->GCPhysOpcodes == GCPhysBlock + offInstr);
+        }
+        else
+        {
+            if (!iemBlockIsCurrent(pIemCpu, pBlock))
+                break;
+            iemInitDecoder(pIemCpu, false);
+            uint8_t const cbNext = pBlock->acbInstrs[iInstr];
+            if (   pIemCpu->enmCpuMode != enmCpuMode
+                || pIemCpu->uCpl       != uCpl)
+                break;
+            if (enmCpuMode == IEMMODE_64BIT)
+            {
+                if (pCtx->rip != GCPtrBlock + offInstr)
+                    break;
+            }
+            else if (   pCtx->cs.u64Base + pCtx->eip != GCPtrBlock + offInstr
+                     || pCtx->eip + cbNext - 1       >  pCtx->cs.u32Limit)
+                break;
+            memcpy(pIemCpu->abOpcode, &pBlock->abOpcodes[offInstr], cbNext);
+            pIemCpu->cbOpcode = cbNext;
+            pIemCpu->cBlockInstrsReplayed++;
+        }
+    }
+
+    return rcStrict;
+}
+
+/** @} */
+#endif /* IN_RING3 && !IEM_VERIFICATION_MODE */
+
+
+/**
+ * Execute lots of instructions.
+ *
+ * In ring-3 this goes thru the decoded block cache (if enabled) and keeps
+ * going until a forced action is pending, a status code needs attention or
+ * the instruction budget is exhausted.  Elsewhere it's just IEMExecOne.
+ *
+ * @return  Strict VBox status code.
+ * @param   pVCpu       The current virtual CPU.
+ */
 VMMDECL(VBOXSTRICTRC) IEMExecLots(PVMCPU pVCpu)
 {
+#if defined(IN_RING3) && !defined(IEM_VERIFICATION_MODE)
+    PIEMCPU pIemCpu = &pVCpu->iem.s;
+    if (pIemCpu->paBlocksR3)
+    {
+        PVM          pVM          = IEMCPU_TO_VM(pIemCpu);
+        uint32_t     cInstrBudget = IEM_EXEC_LOTS_MAX_INSTRS;
+        VBOXSTRICTRC rcStrict;
+        do
+        {
+            rcStrict = iemInitDecoderAndPrefetchOpcodes(pIemCpu, false);
+            if (rcStrict != VINF_SUCCESS)
+                break;
+
+            PIEMBLOCK pBlock = &pIemCpu->paBlocksR3[IEMBLOCK_CACHE_IDX(pIemCpu->GCPhysOpcodes)];
+            bool      fRecord;
+            if (   pBlock->GCPhys     != pIemCpu->GCPhysOpcodes
+                || pBlock->enmCpuMode != pIemCpu->enmCpuMode)
+            {
+                pIemCpu->cBlockMisses++;
+                fRecord = true;
+            }
+            else if (!iemBlockIsCurrent(pIemCpu, pBlock))
+            {
+                pIemCpu->cBlockStale++;
+                pIemCpu->cBlockMisses++;
+                fRecord = true;
+            }
+            else
+            {
+                pIemCpu->cBlockHits++;
+                fRecord = false;
+            }
+            rcStrict = iemExecBlock(pVCpu, pIemCpu, pBlock, fRecord, &cInstrBudget);
+        } while (   rcStrict == VINF_SUCCESS
+                 && cInstrBudget
+                 && !VM_FF_ISPENDING(pVM, VM_FF_ALL_REM_MASK)
+                 && !VMCPU_FF_ISPENDING(pVCpu, VMCPU_FF_ALL_REM_MASK & VM_WHEN_RAW_MODE(~(VMCPU_FF_CSAM_PENDING_ACTION | VMCPU_FF_CSAM_SCAN_PAGE), UINT32_MAX))
+                 && !pIemCpu->CTX_SUFF(pCtx)->eflags.Bits.u1TF);
+        return rcStrict;
+    }
+#endif
     return IEMExecOne(pVCpu);
 }
 
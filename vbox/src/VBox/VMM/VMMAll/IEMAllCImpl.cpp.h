@@ -3692,7 +3692,7 @@ IEM_CIMPL_DEF_2(iemCImpl_mov_Dd_Rd, uint8_t, iDrReg, uint8_t, iGReg)
  * @param   GCPtrPage       The effective address of the page to invalidate.
  * @remarks Updates the RIP.
  */
-IEM_CIMPL_DEF_1(iemCImpl_invlpg, uint8_t, GCPtrPage)
+IEM_CIMPL_DEF_1(iemCImpl_invlpg, RTGCPTR, GCPtrPage)
 {
     /* ring-0 only. */
     if (pIemCpu->uCpl != 0)
@@ -3708,7 +3708,7 @@ IEM_CIMPL_DEF_1(iemCImpl_invlpg, uint8_t, GCPtrPage)
         return iemSetPassUpStatus(pIemCpu, rc);
 
     AssertMsg(rc == VINF_EM_RAW_EMULATE_INSTR || RT_FAILURE_NP(rc), ("%Rrc\n", rc));
-    Log(("PGMInvalidatePage(%RGv) -> %Rrc\n", rc));
+    Log(("PGMInvalidatePage(%RGv) -> %Rrc\n", GCPtrPage, rc));
     return rc;
 }
 
@@ -31,6 +31,10 @@
 /**
  * Obtain bandwidth in a bandwidth group.
  *
+ * The bytes are taken from the group the filter is attached to and from all
+ * its parents, so the request is only granted if every group on the way up to
+ * the top has enough tokens.
+ *
  * @returns True if bandwidth was allocated, false if not.
  * @param   pFilter         Pointer to the filter that allocates bandwidth.
  * @param   cbTransfer      Number of bytes to allocate.
@@ -41,37 +45,68 @@ VMMDECL(bool) PDMNsAllocateBandwidth(PPDMNSFILTER pFilter, size_t cbTransfer)
     if (!VALID_PTR(pFilter->CTX_SUFF(pBwGroup)))
         return true;
 
-    PPDMNSBWGROUP pBwGroup = ASMAtomicReadPtrT(&pFilter->CTX_SUFF(pBwGroup), PPDMNSBWGROUP);
-    int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
-    if (RT_UNLIKELY(rc == VERR_SEM_BUSY))
-        return true;
+    /*
+     * Lock the group and its parents, child before parent.  All paths take
+     * the locks in this order, so there is no deadlock potential.
+     */
+    PPDMNSBWGROUP apBwGroups[PDM_NETSHAPER_MAX_DEPTH];
+    unsigned      cBwGroups = 0;
+    PPDMNSBWGROUP pBwGroup  = ASMAtomicReadPtrT(&pFilter->CTX_SUFF(pBwGroup), PPDMNSBWGROUP);
+    while (   VALID_PTR(pBwGroup)
+           && cBwGroups < RT_ELEMENTS(apBwGroups))
+    {
+        int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
+        if (RT_UNLIKELY(rc == VERR_SEM_BUSY))
+        {
+            while (cBwGroups-- > 0)
+                PDMCritSectLeave(&apBwGroups[cBwGroups]->Lock);
+            return true;
+        }
+        apBwGroups[cBwGroups++] = pBwGroup;
+        pBwGroup = pBwGroup->CTX_SUFF(pParent);
+    }
 
-    bool fAllowed = true;
-    if (pBwGroup->cbPerSecMax)
+    /* Re-fill the buckets and check that every level can take the transfer. */
+    uint64_t tsNow = RTTimeSystemNanoTS();
+    uint32_t auTokens[PDM_NETSHAPER_MAX_DEPTH];
+    bool     fAllowed = true;
+    for (unsigned i = 0; i < cBwGroups; i++)
     {
-        /* Re-fill the bucket first */
-        uint64_t tsNow        = RTTimeSystemNanoTS();
-        uint32_t uTokensAdded = (tsNow - pBwGroup->tsUpdatedLast) * pBwGroup->cbPerSecMax / (1000 * 1000 * 1000);
-        uint32_t uTokens      = RT_MIN(pBwGroup->cbBucket, uTokensAdded + pBwGroup->cbTokensLast);
+        auTokens[i] = pdmNsBwGroupGetTokens(apBwGroups[i], tsNow);
+        if (cbTransfer > auTokens[i])
+            fAllowed = false;
+        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} cbTransfer=%u uTokens=%u\n",
+              apBwGroups[i], R3STRING(apBwGroups[i]->pszNameR3), cbTransfer, auTokens[i]));
+    }
 
-        if (cbTransfer > uTokens)
+    if (fAllowed)
+    {
+        for (unsigned i = 0; i < cBwGroups; i++)
+            if (apBwGroups[i]->cbPerSecMax)
+            {
+                apBwGroups[i]->tsUpdatedLast = tsNow;
+                apBwGroups[i]->cbTokensLast  = auTokens[i] - (uint32_t)cbTransfer;
+            }
+    }
+    else
+    {
+        /* Tell the TX thread how much we need so it only wakes us up once
+           we can actually transmit. */
+        ASMAtomicWriteU32(&pFilter->cbWanted, (uint32_t)cbTransfer);
+        if (!ASMAtomicReadBool(&pFilter->fChoked))
         {
-            fAllowed = false;
+            ASMAtomicWriteU64(&pFilter->tsChoked, tsNow);
             ASMAtomicWriteBool(&pFilter->fChoked, true);
         }
-        else
-        {
-            pBwGroup->tsUpdatedLast = tsNow;
-            pBwGroup->cbTokensLast = uTokens - (uint32_t)cbTransfer;
-        }
-        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} cbTransfer=%u uTokens=%u uTokensAdded=%u fAllowed=%RTbool\n",
-              pBwGroup, R3STRING(pBwGroup->pszNameR3), cbTransfer, uTokens, uTokensAdded, fAllowed));
+        STAM_REL_COUNTER_INC(&apBwGroups[0]->StatDenied);
     }
-    else
-        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} disabled fAllowed=%RTbool\n",
-              pBwGroup, R3STRING(pBwGroup->pszNameR3), fAllowed));
+    Log2(("pdmNsAllocateBandwidth: pFilter=%#p cbTransfer=%u cBwGroups=%u fAllowed=%RTbool\n",
+          pFilter, cbTransfer, cBwGroups, fAllowed));
 
-    rc = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc);
+    while (cBwGroups-- > 0)
+    {
+        int rc = PDMCritSectLeave(&apBwGroups[cBwGroups]->Lock); AssertRC(rc);
+    }
     return fAllowed;
 }
 
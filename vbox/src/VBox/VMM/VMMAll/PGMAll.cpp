@@ -33,6 +33,7 @@
 # include <VBox/vmm/rem.h>
 #endif
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/hm.h>
 #include <VBox/vmm/hm_vmx.h>
 #include "PGMInternal.h"
@@ -723,6 +724,11 @@ VMMDECL(int) PGMInvalidatePage(PVMCPU pVCpu, RTGCPTR GCPtrPage)
     int rc;
     Log3(("PGMInvalidatePage: GCPtrPage=%RGv\n", GCPtrPage));
 
+    /*
+     * Drop IEM's cached translations.
+     */
+    IEMTlbInvalidatePage(pVCpu, GCPtrPage);
+
 #if !defined(IN_RING3) && defined(VBOX_WITH_REM)
     /*
      * Notify the recompiler so it can record this instruction.
@@ -1891,6 +1897,7 @@ VMMDECL(int) PGMFlushTLB(PVMCPU pVCpu, uint64_t cr3, bool fGlobal)
     if (fGlobal)
         VMCPU_FF_SET(pVCpu, VMCPU_FF_PGM_SYNC_CR3);
     LogFlow(("PGMFlushTLB: cr3=%RX64 OldCr3=%RX64 fGlobal=%d\n", cr3, pVCpu->pgm.s.GCPhysCR3, fGlobal));
+    IEMTlbInvalidateAll(pVCpu, fGlobal);
 
     /*
      * Remap the CR3 content and adjust the monitoring if CR3 was actually changed.
@@ -2201,7 +2208,10 @@ VMMDECL(int) PGMChangeMode(PVMCPU pVCpu, uint64_t cr0, uint64_t cr4, uint64_t ef
     {
         bool const fPse = !!(cr4 & X86_CR4_PSE);
         if (pVCpu->pgm.s.fGst32BitPageSizeExtension != fPse)
+        {
             Log(("PGMChangeMode: CR4.PSE %d -> %d\n", pVCpu->pgm.s.fGst32BitPageSizeExtension, fPse));
+            IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
+        }
         pVCpu->pgm.s.fGst32BitPageSizeExtension = fPse;
         enmGuestMode = PGMMODE_32_BIT;
     }
@@ -2228,6 +2238,7 @@ VMMDECL(int) PGMChangeMode(PVMCPU pVCpu, uint64_t cr0, uint64_t cr4, uint64_t ef
 
     /* Flush the TLB */
     PGM_INVL_VCPU_TLBS(pVCpu);
+    IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
 
 #ifdef IN_RING3
     return PGMR3ChangeMode(pVCpu->CTX_SUFF(pVM), pVCpu, enmGuestMode);
@@ -25,6 +25,7 @@
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/stam.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
@@ -236,6 +237,7 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVM pVM, PPGMPHYSHANDL
         i++;
     }
 
+    IEMTlbInvalidatePhysRangeAllCpus(pVM, pCur->Core.Key, pCur->Core.KeyLast);
     if (fFlushTLBs)
     {
         PGM_INVL_ALL_VCPU_TLBS(pVM);
@@ -398,6 +400,7 @@ DECLINLINE(void) pgmHandlerPhysicalRecalcPageState(PVM pVM, RTGCPHYS GCPhys, boo
         {
             /* This should normally not be necessary. */
             PGM_PAGE_SET_HNDL_PHYS_STATE(pPage, uState);
+            IEMTlbInvalidateAllPhysicalAllCpus(pVM);
             bool fFlushTLBs ;
             rc = pgmPoolTrackUpdateGCPhys(pVM, GCPhys, pPage, false /*fFlushPTEs*/, &fFlushTLBs);
             if (RT_SUCCESS(rc) && fFlushTLBs)
@@ -524,6 +527,9 @@ static void pgmHandlerPhysicalResetRamFlags(PVM pVM, PPGMPHYSHANDLER pCur)
         pgmHandlerPhysicalRecalcPageState(pVM, pCur->Core.Key - 1, false /* fAbove */, &pRamHint);
     if ((pCur->Core.KeyLast & PAGE_OFFSET_MASK) != PAGE_OFFSET_MASK)
         pgmHandlerPhysicalRecalcPageState(pVM, pCur->Core.KeyLast + 1, true /* fAbove */, &pRamHint);
+
+    /* Let IEM map the pages directly again. */
+    IEMTlbInvalidatePhysRangeAllCpus(pVM, pCur->Core.Key, pCur->Core.KeyLast);
 }
 
 
@@ -1426,10 +1432,11 @@ DECLCALLBACK(int) pgmHandlerVirtualResetOne(PAVLROGCPTRNODECORE pNode, void *pvU
     /*
      * Iterate the pages and apply the new state.
      */
-    unsigned        uState   = pgmHandlerVirtualCalcState(pCur);
-    PPGMRAMRANGE    pRamHint = NULL;
-    RTGCUINTPTR     offPage  = ((RTGCUINTPTR)pCur->Core.Key & PAGE_OFFSET_MASK);
-    RTGCUINTPTR     cbLeft   = pCur->cb;
+    unsigned        uState    = pgmHandlerVirtualCalcState(pCur);
+    PPGMRAMRANGE    pRamHint  = NULL;
+    RTGCUINTPTR     offPage   = ((RTGCUINTPTR)pCur->Core.Key & PAGE_OFFSET_MASK);
+    RTGCUINTPTR     cbLeft    = pCur->cb;
+    bool            fUpgraded = false;
     for (unsigned iPage = 0; iPage < pCur->cPages; iPage++)
     {
         PPGMPHYS2VIRTHANDLER pPhys2Virt = &pCur->aPhysToVirt[iPage];
@@ -1442,7 +1449,10 @@ DECLCALLBACK(int) pgmHandlerVirtualResetOne(PAVLROGCPTRNODECORE pNode, void *pvU
             int rc = pgmPhysGetPageWithHintEx(pVM, pPhys2Virt->Core.Key, &pPage, &pRamHint);
             if (    RT_SUCCESS(rc)
                 &&  PGM_PAGE_GET_HNDL_VIRT_STATE(pPage) < uState)
+            {
                 PGM_PAGE_SET_HNDL_VIRT_STATE(pPage, uState);
+                fUpgraded = true;
+            }
             else
                 AssertRC(rc);
 
@@ -1477,6 +1487,10 @@ DECLCALLBACK(int) pgmHandlerVirtualResetOne(PAVLROGCPTRNODECORE pNode, void *pvU
         offPage = 0;
     }
 
+    /* IEM may have cached mappings of the pages we just started catching. */
+    if (fUpgraded)
+        IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+
     return 0;
 }
 
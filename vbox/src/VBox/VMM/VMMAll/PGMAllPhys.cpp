@@ -24,6 +24,7 @@
 #include <VBox/vmm/vmm.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
 #endif
@@ -416,6 +417,7 @@ void pgmPhysInvalidatePageMapTLB(PVM pVM)
 
     /** @todo clear the RC TLB whenever we add it. */
 
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
     pgmUnlock(pVM);
 }
 
@@ -448,6 +450,8 @@ void pgmPhysInvalidatePageMapTLBEntry(PVM pVM, RTGCPHYS GCPhys)
 #endif
 
     /** @todo clear the RC TLB whenever we add it. */
+
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
 }
 
 /**
@@ -885,6 +889,21 @@ void pgmPhysPageMakeWriteMonitoredWritable(PVM pVM, PPGMPAGE pPage)
 int pgmPhysPageMakeWritable(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
 {
     PGM_LOCK_ASSERT_OWNER(pVM);
+#ifdef IN_RING3
+    /*
+     * Fetch the content first if it's still on the post-copy source.
+     */
+    if (RT_UNLIKELY(PGM_PAGE_IS_NOT_PRESENT(pPage)))
+    {
+        int rc2 = pgmR3PostCopyFetchPage(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc2))
+            return rc2;
+    }
+#else
+    if (RT_UNLIKELY(PGM_PAGE_IS_NOT_PRESENT(pPage)))
+        return VERR_PGM_PHYS_PAGE_RESERVED; /* Only ring-3 can fetch it. */
+#endif
+
     switch (PGM_PAGE_GET_STATE(pPage))
     {
         case PGM_PAGE_STATE_WRITE_MONITORED:
@@ -1011,6 +1030,20 @@ int pgmPhysPageMapByPageID(PVM pVM, uint32_t idPage, RTHCPHYS HCPhys, void **ppv
 static int pgmPhysPageMapCommon(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, PPPGMPAGEMAP ppMap, void **ppv)
 {
     PGM_LOCK_ASSERT_OWNER(pVM);
+#ifdef IN_RING3
+    /*
+     * Fetch the content first if it's still on the post-copy source.
+     */
+    if (RT_UNLIKELY(PGM_PAGE_IS_NOT_PRESENT(pPage)))
+    {
+        int rc2 = pgmR3PostCopyFetchPage(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc2))
+            return rc2;
+    }
+#else
+    if (RT_UNLIKELY(PGM_PAGE_IS_NOT_PRESENT(pPage)))
+        return VERR_PGM_PHYS_PAGE_RESERVED; /* Only ring-3 can fetch it. */
+#endif
 
 #if defined(IN_RC) || defined(VBOX_WITH_2X_4GB_ADDR_SPACE_IN_R0)
     /*
@@ -1251,6 +1284,21 @@ int pgmPhysPageLoadIntoTlbWithPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
     PGM_LOCK_ASSERT_OWNER(pVM);
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PageMapTlbMisses));
 
+#ifdef IN_RING3
+    /*
+     * Fetch the content first if it's still on the post-copy source.
+     */
+    if (RT_UNLIKELY(PGM_PAGE_IS_NOT_PRESENT(pPage)))
+    {
+        int rc2 = pgmR3PostCopyFetchPage(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc2))
+            return rc2;
+    }
+#else
+    if (RT_UNLIKELY(PGM_PAGE_IS_NOT_PRESENT(pPage)))
+        return VERR_PGM_PHYS_PAGE_RESERVED; /* Only ring-3 can fetch it. */
+#endif
+
     /*
      * Map the page.
      * Make a special case for the zero page as it is kind of special.
@@ -2077,6 +2125,13 @@ static int pgmPhysReadHandler(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, void *pv
      * The current code ASSUMES all these access handlers covers full pages!
      */
 
+#ifndef IN_RING3
+    /* Pages still on the post-copy source are covered by an all-access
+       handler which only ring-3 can service. */
+    if (PGM_PAGE_IS_NOT_PRESENT(pPage))
+        return VERR_PGM_PHYS_WR_HIT_HANDLER;
+#endif
+
     /*
      * Whatever we do we need the source page, map it first.
      */
@@ -328,54 +328,38 @@ DECLINLINE(bool) tmTimerTryWithLink(PTMTIMER pTimer, TMTIMERSTATE enmStateNew, T
 /**
  * Links a timer into the active list of a timer queue.
  *
+ * @returns VBox status code.
+ * @retval  VERR_TM_TIMER_HEAP_FULL if there is no room left in the heap.  The
+ *          timer isn't linked and the caller must put it back in a stable
+ *          state.  (Shouldn't happen as tmR3TimerQueueGrowHeap sizes the heap
+ *          for all the timers created on the clock.)
+ *
  * @param   pQueue          The queue.
  * @param   pTimer          The timer.
  * @param   u64Expire       The timer expiration time.
  *
  * @remarks Called while owning the relevant queue lock.
  */
-DECL_FORCE_INLINE(void) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
+DECL_FORCE_INLINE(int) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
 {
-    Assert(!pTimer->offNext);
-    Assert(!pTimer->offPrev);
+    Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
     Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE || pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC); /* (active is not a stable state) */
+    AssertMsgReturn(pQueue->cActive < pQueue->cHeapEntries,
+                    ("%u >= %u %s\n", pQueue->cActive, pQueue->cHeapEntries, R3STRING(pTimer->pszDesc)),
+                    VERR_TM_TIMER_HEAP_FULL);
 
-    PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue);
-    if (pCur)
-    {
-        for (;; pCur = TMTIMER_GET_NEXT(pCur))
-        {
-            if (pCur->u64Expire > u64Expire)
-            {
-                const PTMTIMER pPrev = TMTIMER_GET_PREV(pCur);
-                TMTIMER_SET_NEXT(pTimer, pCur);
-                TMTIMER_SET_PREV(pTimer, pPrev);
-                if (pPrev)
-                    TMTIMER_SET_NEXT(pPrev, pTimer);
-                else
-                {
-                    TMTIMER_SET_HEAD(pQueue, pTimer);
-                    ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
-                    DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive head", R3STRING(pTimer->pszDesc));
-                }
-                TMTIMER_SET_PREV(pCur, pTimer);
-                return;
-            }
-            if (!pCur->offNext)
-            {
-                TMTIMER_SET_NEXT(pCur, pTimer);
-                TMTIMER_SET_PREV(pTimer, pCur);
-                DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive tail", R3STRING(pTimer->pszDesc));
-                return;
-            }
-        }
-    }
-    else
+    TMTIMERHEAPENTRY Entry;
+    Entry.u64Expire  = u64Expire;
+    Entry.offTimer   = (int32_t)((intptr_t)pTimer - (intptr_t)pQueue);
+    Entry.u32Padding = 0;
+    tmTimerQueueHeapSiftUp(pQueue, TMTIMER_GET_HEAP(pQueue), pQueue->cActive++, Entry);
+
+    if (pTimer->idxHeap == 0)
     {
-        TMTIMER_SET_HEAD(pQueue, pTimer);
         ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
-        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive empty", R3STRING(pTimer->pszDesc));
+        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive head", R3STRING(pTimer->pszDesc));
     }
+    return VINF_SUCCESS;
 }
 
 
@@ -414,10 +398,18 @@ DECLINLINE(void) tmTimerQueueScheduleOne(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
              * Schedule timer (insert into the active list).
              */
             case TMTIMERSTATE_PENDING_SCHEDULE:
-                Assert(!pTimer->offNext); Assert(!pTimer->offPrev);
+                Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
+                if (RT_UNLIKELY(pQueue->cActive >= pQueue->cHeapEntries))
+                {
+                    /* No room in the heap, keep it pending until a slot is freed
+                       up rather than dropping an armed timer. */
+                    AssertMsgFailed(("%u >= %u %s\n", pQueue->cActive, pQueue->cHeapEntries, R3STRING(pTimer->pszDesc)));
+                    tmTimerLinkSchedule(pQueue, pTimer);
+                    return;
+                }
                 if (RT_UNLIKELY(!tmTimerTry(pTimer, TMTIMERSTATE_ACTIVE, TMTIMERSTATE_PENDING_SCHEDULE)))
                     break; /* retry */
-                tmTimerQueueLinkActive(pQueue, pTimer, pTimer->u64Expire);
+                tmTimerQueueLinkActive(pQueue, pTimer, pTimer->u64Expire); /* can't fail, checked above */
                 return;
 
             /*
@@ -433,7 +425,7 @@ DECLINLINE(void) tmTimerQueueScheduleOne(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
              * Stop the timer (not on the active list).
              */
             case TMTIMERSTATE_PENDING_STOP_SCHEDULE:
-                Assert(!pTimer->offNext); Assert(!pTimer->offPrev);
+                Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
                 if (RT_UNLIKELY(!tmTimerTry(pTimer, TMTIMERSTATE_STOPPED, TMTIMERSTATE_PENDING_STOP_SCHEDULE)))
                     break;
                 return;
@@ -525,7 +517,7 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
     TM_ASSERT_TIMER_LOCK_OWNERSHIP(pVM);
 
     /*
-     * Check the linking of the active lists.
+     * Check the heap order and the back links of the active timer heaps.
      */
     bool fHaveVirtualSyncLock = false;
     for (int i = 0; i < TMCLOCK_MAX; i++)
@@ -538,11 +530,18 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
                 continue;
             fHaveVirtualSyncLock = true;
         }
-        PTMTIMER pPrev = NULL;
-        for (PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue); pCur; pPrev = pCur, pCur = TMTIMER_GET_NEXT(pCur))
+        AssertMsg(pQueue->cActive <= pQueue->cHeapEntries, ("%s: %u > %u\n", pszWhere, pQueue->cActive, pQueue->cHeapEntries));
+        AssertMsg(pQueue->cHeapEntries >= pQueue->cTimers, ("%s: %u < %u\n", pszWhere, pQueue->cHeapEntries, pQueue->cTimers));
+        PTMTIMERHEAPENTRY const paHeap = TMTIMER_GET_HEAP(pQueue);
+        AssertMsg(pQueue->u64Expire == (pQueue->cActive ? paHeap[0].u64Expire : (uint64_t)INT64_MAX),
+                  ("%s: %'RU64\n", pszWhere, pQueue->u64Expire));
+        for (uint32_t idx = 0; idx < pQueue->cActive; idx++)
         {
+            PTMTIMER pCur = TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx]);
             AssertMsg((int)pCur->enmClock == i, ("%s: %d != %d\n", pszWhere, pCur->enmClock, i));
-            AssertMsg(TMTIMER_GET_PREV(pCur) == pPrev, ("%s: %p != %p\n", pszWhere, TMTIMER_GET_PREV(pCur), pPrev));
+            AssertMsg(pCur->idxHeap == idx, ("%s: %#x != %#x\n", pszWhere, pCur->idxHeap, idx));
+            AssertMsg(idx == 0 || paHeap[(idx - 1) / 2].u64Expire <= paHeap[idx].u64Expire,
+                      ("%s: %'RU64 > %'RU64\n", pszWhere, paHeap[(idx - 1) / 2].u64Expire, paHeap[idx].u64Expire));
             TMTIMERSTATE enmState = pCur->enmState;
             switch (enmState)
             {
@@ -550,6 +549,9 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
                     AssertMsg(  !pCur->offScheduleNext
                               || pCur->enmState != TMTIMERSTATE_ACTIVE,
                               ("%s: %RI32\n", pszWhere, pCur->offScheduleNext));
+                    AssertMsg(  pCur->u64Expire == paHeap[idx].u64Expire
+                              || pCur->enmState != TMTIMERSTATE_ACTIVE,
+                              ("%s: %'RU64 != %'RU64\n", pszWhere, pCur->u64Expire, paHeap[idx].u64Expire));
                     break;
                 case TMTIMERSTATE_PENDING_STOP:
                 case TMTIMERSTATE_PENDING_RESCHEDULE:
@@ -565,7 +567,7 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
 
 # ifdef IN_RING3
     /*
-     * Do the big list and check that active timers all are in the active lists.
+     * Do the big list and check that active timers all are in the active heaps.
      */
     PTMTIMERR3 pPrev = NULL;
     for (PTMTIMERR3 pCur = pVM->tm.s.pCreated; pCur; pPrev = pCur, pCur = pCur->pBigNext)
@@ -582,11 +584,10 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
             case TMTIMERSTATE_PENDING_RESCHEDULE_SET_EXPIRE:
                 if (fHaveVirtualSyncLock || pCur->enmClock != TMCLOCK_VIRTUAL_SYNC)
                 {
-                    PTMTIMERR3 pCurAct = TMTIMER_GET_HEAD(&pVM->tm.s.CTX_SUFF(paTimerQueues)[pCur->enmClock]);
-                    Assert(pCur->offPrev || pCur == pCurAct);
-                    while (pCurAct && pCurAct != pCur)
-                        pCurAct = TMTIMER_GET_NEXT(pCurAct);
-                    Assert(pCurAct == pCur);
+                    PTMTIMERQUEUE pQueue = &pVM->tm.s.CTX_SUFF(paTimerQueues)[pCur->enmClock];
+                    AssertMsg(pCur->idxHeap < pQueue->cActive, ("%#x\n", pCur->idxHeap));
+                    if (pCur->idxHeap < pQueue->cActive)
+                        Assert(TMTIMER_HEAP_GET_TIMER(pQueue, &TMTIMER_GET_HEAP(pQueue)[pCur->idxHeap]) == pCur);
                 }
                 break;
 
@@ -595,18 +596,7 @@ void tmTimerQueuesSanityChecks(PVM pVM, const char *pszWhere)
             case TMTIMERSTATE_STOPPED:
             case TMTIMERSTATE_EXPIRED_DELIVER:
                 if (fHaveVirtualSyncLock || pCur->enmClock != TMCLOCK_VIRTUAL_SYNC)
-                {
-                    Assert(!pCur->offNext);
-                    Assert(!pCur->offPrev);
-                    for (PTMTIMERR3 pCurAct = TMTIMER_GET_HEAD(&pVM->tm.s.CTX_SUFF(paTimerQueues)[pCur->enmClock]);
-                          pCurAct;
-                          pCurAct = TMTIMER_GET_NEXT(pCurAct))
-                    {
-                        Assert(pCurAct != pCur);
-                        Assert(TMTIMER_GET_NEXT(pCurAct) != pCur);
-                        Assert(TMTIMER_GET_PREV(pCurAct) != pCur);
-                    }
-                }
+                    AssertMsg(pCur->idxHeap == TMTIMER_HEAP_IDX_NIL, ("%#x\n", pCur->idxHeap));
                 break;
 
             /* ignore */
@@ -1083,8 +1073,7 @@ VMMDECL(bool) TMTimerIsLockOwner(PTMTIMER pTimer)
  */
 static int tmTimerSetOptimizedStart(PVM pVM, PTMTIMER pTimer, uint64_t u64Expire)
 {
-    Assert(!pTimer->offPrev);
-    Assert(!pTimer->offNext);
+    Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
     Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE);
 
     TMCLOCK const enmClock = pTimer->enmClock;
@@ -1105,11 +1094,13 @@ static int tmTimerSetOptimizedStart(PVM pVM, PTMTIMER pTimer, uint64_t u64Expire
     /*
      * Link the timer into the active list.
      */
-    tmTimerQueueLinkActive(&pVM->tm.s.CTX_SUFF(paTimerQueues)[enmClock], pTimer, u64Expire);
+    int rc = tmTimerQueueLinkActive(&pVM->tm.s.CTX_SUFF(paTimerQueues)[enmClock], pTimer, u64Expire);
+    if (RT_FAILURE(rc))
+        TM_SET_STATE(pTimer, TMTIMERSTATE_STOPPED);
 
     STAM_COUNTER_INC(&pVM->tm.s.StatTimerSetOpt);
     TM_UNLOCK_TIMERS(pVM);
-    return VINF_SUCCESS;
+    return rc;
 }
 
 
@@ -1147,16 +1138,18 @@ static int tmTimerVirtualSyncSet(PVM pVM, PTMTIMER pTimer, uint64_t u64Expire)
                       ("%'RU64 < %'RU64 %s\n", u64Expire, pVM->tm.s.u64VirtualSync, R3STRING(pTimer->pszDesc)));
             pTimer->u64Expire = u64Expire;
             TM_SET_STATE(pTimer, TMTIMERSTATE_ACTIVE);
-            tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
-            rc = VINF_SUCCESS;
+            rc = tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
+            if (RT_FAILURE(rc))
+                TM_SET_STATE(pTimer, TMTIMERSTATE_STOPPED);
             break;
 
         case TMTIMERSTATE_ACTIVE:
             STAM_COUNTER_INC(&pVM->tm.s.StatTimerSetVsStActive);
             tmTimerQueueUnlinkActive(pQueue, pTimer);
             pTimer->u64Expire = u64Expire;
-            tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
-            rc = VINF_SUCCESS;
+            rc = tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
+            if (RT_FAILURE(rc))
+                TM_SET_STATE(pTimer, TMTIMERSTATE_STOPPED);
             break;
 
         case TMTIMERSTATE_PENDING_RESCHEDULE:
@@ -1238,9 +1231,9 @@ VMMDECL(int) TMTimerSet(PTMTIMER pTimer, uint64_t u64Expire)
         {
             if (RT_LIKELY(tmTimerTry(pTimer, TMTIMERSTATE_ACTIVE, enmState1)))
             {
-                tmTimerSetOptimizedStart(pVM, pTimer, u64Expire);
+                int rc = tmTimerSetOptimizedStart(pVM, pTimer, u64Expire);
                 STAM_PROFILE_STOP(&pVM->tm.s.CTX_SUFF_Z(StatTimerSet), a);
-                return VINF_SUCCESS;
+                return rc;
             }
             TM_UNLOCK_TIMERS(pVM);
         }
@@ -1265,8 +1258,7 @@ VMMDECL(int) TMTimerSet(PTMTIMER pTimer, uint64_t u64Expire)
             case TMTIMERSTATE_STOPPED:
                 if (tmTimerTryWithLink(pTimer, TMTIMERSTATE_PENDING_SCHEDULE_SET_EXPIRE, enmState))
                 {
-                    Assert(!pTimer->offPrev);
-                    Assert(!pTimer->offNext);
+                    Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
                     pTimer->u64Expire = u64Expire;
                     TM_SET_STATE(pTimer, TMTIMERSTATE_PENDING_SCHEDULE);
                     tmSchedule(pTimer);
@@ -1387,8 +1379,7 @@ DECL_FORCE_INLINE(uint64_t) tmTimerSetRelativeNowWorker(PVM pVM, TMCLOCK enmCloc
  */
 static int tmTimerSetRelativeOptimizedStart(PVM pVM, PTMTIMER pTimer, uint64_t cTicksToNext, uint64_t *pu64Now)
 {
-    Assert(!pTimer->offPrev);
-    Assert(!pTimer->offNext);
+    Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
     Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE);
 
     /*
@@ -1403,11 +1394,13 @@ static int tmTimerSetRelativeOptimizedStart(PVM pVM, PTMTIMER pTimer, uint64_t c
      * Link the timer into the active list.
      */
     DBGFTRACE_U64_TAG2(pVM, u64Expire, "tmTimerSetRelativeOptimizedStart", R3STRING(pTimer->pszDesc));
-    tmTimerQueueLinkActive(&pVM->tm.s.CTX_SUFF(paTimerQueues)[enmClock], pTimer, u64Expire);
+    int rc = tmTimerQueueLinkActive(&pVM->tm.s.CTX_SUFF(paTimerQueues)[enmClock], pTimer, u64Expire);
+    if (RT_FAILURE(rc))
+        TM_SET_STATE(pTimer, TMTIMERSTATE_STOPPED);
 
     STAM_COUNTER_INC(&pVM->tm.s.StatTimerSetRelativeOpt);
     TM_UNLOCK_TIMERS(pVM);
-    return VINF_SUCCESS;
+    return rc;
 }
 
 
@@ -1450,16 +1443,18 @@ static int tmTimerVirtualSyncSetRelative(PVM pVM, PTMTIMER pTimer, uint64_t cTic
                 STAM_COUNTER_INC(&pVM->tm.s.StatTimerSetRelativeVsStStopped);
             pTimer->u64Expire = u64Expire;
             TM_SET_STATE(pTimer, TMTIMERSTATE_ACTIVE);
-            tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
-            rc = VINF_SUCCESS;
+            rc = tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
+            if (RT_FAILURE(rc))
+                TM_SET_STATE(pTimer, TMTIMERSTATE_STOPPED);
             break;
 
         case TMTIMERSTATE_ACTIVE:
             STAM_COUNTER_INC(&pVM->tm.s.StatTimerSetRelativeVsStActive);
             tmTimerQueueUnlinkActive(pQueue, pTimer);
             pTimer->u64Expire = u64Expire;
-            tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
-            rc = VINF_SUCCESS;
+            rc = tmTimerQueueLinkActive(pQueue, pTimer, u64Expire);
+            if (RT_FAILURE(rc))
+                TM_SET_STATE(pTimer, TMTIMERSTATE_STOPPED);
             break;
 
         case TMTIMERSTATE_PENDING_RESCHEDULE:
@@ -1551,9 +1546,9 @@ VMMDECL(int) TMTimerSetRelative(PTMTIMER pTimer, uint64_t cTicksToNext, uint64_t
                          || enmState == TMTIMERSTATE_STOPPED)
                       && tmTimerTry(pTimer, TMTIMERSTATE_ACTIVE, enmState)))
         {
-            tmTimerSetRelativeOptimizedStart(pVM, pTimer, cTicksToNext, pu64Now);
+            int rc = tmTimerSetRelativeOptimizedStart(pVM, pTimer, cTicksToNext, pu64Now);
             STAM_PROFILE_STOP(&pTimer->CTX_SUFF(pVM)->tm.s.CTX_SUFF_Z(StatTimerSetRelative), a);
-            return VINF_SUCCESS;
+            return rc;
         }
 
         /* Optimize other states when it becomes necessary. */
@@ -1586,8 +1581,7 @@ VMMDECL(int) TMTimerSetRelative(PTMTIMER pTimer, uint64_t cTicksToNext, uint64_t
             case TMTIMERSTATE_EXPIRED_DELIVER:
                 if (tmTimerTryWithLink(pTimer, TMTIMERSTATE_PENDING_SCHEDULE_SET_EXPIRE, enmState))
                 {
-                    Assert(!pTimer->offPrev);
-                    Assert(!pTimer->offNext);
+                    Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL);
                     pTimer->u64Expire = cTicksToNext + tmTimerSetRelativeNowWorker(pVM, enmClock, pu64Now);
                     Log2(("TMTimerSetRelative: %p:{.enmState=%s, .pszDesc='%s', .u64Expire=%'RU64} cRetries=%d [EXP/STOP]\n",
                           pTimer, tmTimerState(enmState), R3STRING(pTimer->pszDesc), pTimer->u64Expire, cRetries));
@@ -2443,9 +2437,11 @@ static uint32_t tmGetFrequencyHint(PVM pVM)
             uMaxHzHint = 0;
             for (int i = 0; i < TMCLOCK_MAX; i++)
             {
-                PTMTIMERQUEUE pQueue = &pVM->tm.s.CTX_SUFF(paTimerQueues)[i];
-                for (PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue); pCur; pCur = TMTIMER_GET_NEXT(pCur))
+                PTMTIMERQUEUE           pQueue = &pVM->tm.s.CTX_SUFF(paTimerQueues)[i];
+                PTMTIMERHEAPENTRY const paHeap = TMTIMER_GET_HEAP(pQueue);
+                for (uint32_t idx = 0; idx < pQueue->cActive; idx++)
                 {
+                    PTMTIMER pCur = TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx]);
                     uint32_t uHzHint = ASMAtomicUoReadU32(&pCur->uHzHint);
                     if (uHzHint > uMaxHzHint)
                     {
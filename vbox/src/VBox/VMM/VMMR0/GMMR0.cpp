@@ -466,6 +466,33 @@ typedef struct GMMCHUNKTLB
 typedef GMMCHUNKTLB *PGMMCHUNKTLB;
 
 
+/**
+ * An entry in the content index of the page dedup scanner.
+ *
+ * The index is a set associative table keyed by a hash of the page content,
+ * the lower bits selecting the bucket and the upper 32 bits being kept in the
+ * entry.  It is lossy by design; identical content is always confirmed with
+ * memcmp before anything is freed.
+ */
+typedef struct GMMDEDUPENTRY
+{
+    /** The upper 32 bits of the content hash. */
+    uint32_t        uHashHi;
+    /** The page ID, NIL_GMM_PAGEID if the entry is unused.
+     * This is either a private page which content was seen once (a candidate)
+     * or a shared page other pages can be merged into.  Entries aren't
+     * updated when pages are freed, so always check the page state. */
+    uint32_t        idPage;
+} GMMDEDUPENTRY;
+/** Pointer to a dedup index entry. */
+typedef GMMDEDUPENTRY *PGMMDEDUPENTRY;
+
+/** The number of entries per dedup index bucket. */
+#define GMM_DEDUP_WAYS              4
+/** The number of dedup index buckets (power of two). */
+#define GMM_DEDUP_BUCKETS           _256K
+
+
 /**
  * The GMM instance data.
  */
@@ -496,6 +523,9 @@ typedef struct GMM
     PAVLLU32NODECORE    pGlobalSharedModuleTree;
     /** Sharable modules (count of nodes in pGlobalSharedModuleTree). */
     uint32_t            cShareableModules;
+    /** The content index used by the page dedup scanner
+     * (GMM_DEDUP_BUCKETS * GMM_DEDUP_WAYS entries).  Allocated on first use. */
+    PGMMDEDUPENTRY      paDedupEntries;
 
     /** The chunk list.  For simplifying the cleanup process. */
     RTLISTANCHOR        ChunkList;
@@ -856,6 +886,10 @@ GMMR0DECL(void) GMMR0Term(void)
     /* Free any chunks still hanging around. */
     RTAvlU32Destroy(&pGMM->pChunks, gmmR0TermDestroyChunk, pGMM);
 
+    /* The dedup index. */
+    RTMemFree(pGMM->paDedupEntries);
+    pGMM->paDedupEntries = NULL;
+
     /* Destroy the chunk locks. */
     for (unsigned iMtx = 0; iMtx < RT_ELEMENTS(pGMM->aChunkMtx); iMtx++)
     {
@@ -5168,6 +5202,241 @@ GMMR0DECL(int) GMMR0CheckSharedModules(PVM pVM, PVMCPU pVCpu)
 #endif
 }
 
+#ifdef VBOX_WITH_PAGE_SHARING
+
+/**
+ * Calculates the content hash used by the page dedup scanner.
+ *
+ * This only has to be good enough for finding candidates, identical content
+ * is confirmed by memcmp before anything is merged.
+ *
+ * @returns 64-bit hash value.
+ * @param   pbPage      The page.
+ */
+static uint64_t gmmR0DedupHashPage(uint8_t const *pbPage)
+{
+    uint64_t const *pu64  = (uint64_t const *)pbPage;
+    uint64_t        uHash = UINT64_C(0xcbf29ce484222325);
+    for (unsigned i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+    {
+        uHash ^= pu64[i];
+        uHash *= UINT64_C(0x9e3779b97f4a7c15);
+        uHash ^= uHash >> 32;
+    }
+    return uHash;
+}
+
+
+/**
+ * Checks a private page against the content index of the dedup scanner.
+ *
+ * Performs the following tasks:
+ *  - If an identical shared page exists, the VM page is freed and the shared
+ *    page is returned in the pPageDesc descriptor.
+ *  - If another private page with the same content hash has been seen, the
+ *    VM page is changed into a shared page (so that the other page and any
+ *    later copies can be merged into it) and returned unchanged in pPageDesc.
+ *  - Otherwise the page is recorded as a candidate and pPageDesc->idPage is
+ *    set to NIL_GMM_PAGEID to indicate that nothing changed.
+ *
+ * @remarks ASSUMES the caller has acquired the GMM semaphore and that the
+ *          page cannot be modified by the guest while we're working on it!!
+ *
+ * @returns VBox status code.
+ * @param   pGVM                Pointer to the GVM instance data.
+ * @param   pPageDesc           Page descriptor (in/out).
+ */
+GMMR0DECL(int) GMMR0DedupCheckPage(PGVM pGVM, PGMMSHAREDPAGEDESC pPageDesc)
+{
+    PGMM pGMM;
+    GMM_GET_VALID_INSTANCE(pGMM, VERR_GMM_INSTANCE);
+    AssertReturn(pGMM->paDedupEntries, VERR_WRONG_ORDER);
+    pPageDesc->u32StrictChecksum = 0;
+
+    uint32_t const idPage = pPageDesc->idPage;
+    PGMMPAGE       pPage  = gmmR0GetPage(pGMM, idPage);
+    AssertMsgReturn(pPage && GMM_PAGE_IS_PRIVATE(pPage) && pPage->Private.hGVM == pGVM->hSelf,
+                    ("idPage=%#x (GCPhys=%RGp HCPhys=%RHp)\n", idPage, pPageDesc->GCPhys, pPageDesc->HCPhys),
+                    VERR_PGM_PHYS_INVALID_PAGE_ID);
+
+    /*
+     * Hash the local page. Skip it if its chunk isn't mapped into this
+     * process, PGM will have it mapped again before long if the page is in use.
+     */
+    PGMMCHUNK pChunk = gmmR0GetChunk(pGMM, idPage >> GMM_CHUNKID_SHIFT);
+    uint8_t  *pbChunk;
+    if (!pChunk || !gmmR0IsChunkMapped(pGMM, pGVM, pChunk, (PRTR3PTR)&pbChunk))
+    {
+        pPageDesc->idPage = NIL_GMM_PAGEID;
+        return VINF_SUCCESS;
+    }
+    uint8_t const *pbLocalPage = pbChunk + ((idPage & GMM_PAGEID_IDX_MASK) << PAGE_SHIFT);
+    uint64_t const uHash       = gmmR0DedupHashPage(pbLocalPage);
+    uint32_t const uHashHi     = (uint32_t)(uHash >> 32);
+    PGMMDEDUPENTRY paBucket    = &pGMM->paDedupEntries[(uHash & (GMM_DEDUP_BUCKETS - 1)) * GMM_DEDUP_WAYS];
+
+    /*
+     * Look for matching entries, noting down a slot for recording
+     * this page in case nothing matches.  Unused and stale entries are
+     * preferred over candidates; shared pages are never evicted.
+     */
+    PGMMDEDUPENTRY pVictim = NULL;
+    for (unsigned iWay = 0; iWay < GMM_DEDUP_WAYS; iWay++)
+    {
+        PGMMDEDUPENTRY pEntry  = &paBucket[iWay];
+        PGMMPAGE       pOther  = pEntry->idPage != NIL_GMM_PAGEID ? gmmR0GetPage(pGMM, pEntry->idPage) : NULL;
+        if (!pOther || GMM_PAGE_IS_FREE(pOther))
+        {
+            if (!pVictim || pVictim->idPage != NIL_GMM_PAGEID)
+                pVictim = pEntry;
+            continue;
+        }
+        if (pEntry->idPage == idPage)
+        {
+            /* Seen this page before; it's the same or it would've ended up in another bucket. */
+            pVictim = pEntry;
+            break;
+        }
+        if (pEntry->uHashHi != uHashHi)
+        {
+            if (!pVictim && GMM_PAGE_IS_PRIVATE(pOther))
+                pVictim = pEntry;
+            continue;
+        }
+
+        /* In bound memory mode pages must not be shared with other VMs. */
+        PGMMCHUNK pOtherChunk = gmmR0GetChunk(pGMM, pEntry->idPage >> GMM_CHUNKID_SHIFT);
+        Assert(pOtherChunk); /* can't fail as gmmR0GetPage succeeded. */
+        if (   pGMM->fBoundMemoryMode
+            && pOtherChunk->hGVM != pGVM->hSelf)
+            continue;
+
+        if (GMM_PAGE_IS_SHARED(pOther))
+        {
+            /*
+             * Compare it with the shared page, mapping the chunk into the
+             * VM process if necessary as we'll be using it from now on.
+             */
+            if (!gmmR0IsChunkMapped(pGMM, pGVM, pOtherChunk, (PRTR3PTR)&pbChunk))
+            {
+                int rc = gmmR0MapChunk(pGMM, pGVM, pOtherChunk, false /*fRelaxedSem*/, (PRTR3PTR)&pbChunk);
+                if (RT_FAILURE(rc))
+                {
+                    Log(("GMMR0DedupCheckPage: failed to map chunk %#x: %Rrc\n", pOtherChunk->Core.Key, rc));
+                    continue;
+                }
+            }
+            uint8_t const *pbSharedPage = pbChunk + ((pEntry->idPage & GMM_PAGEID_IDX_MASK) << PAGE_SHIFT);
+            if (memcmp(pbSharedPage, pbLocalPage, PAGE_SIZE))
+                continue;
+#ifdef VBOX_STRICT
+            pPageDesc->u32StrictChecksum = RTCrc32(pbSharedPage, PAGE_SIZE);
+#endif
+
+            /*
+             * Free the local page and hand back the shared one.
+             */
+            Log(("GMMR0DedupCheckPage: merging %RGp %#x into shared page %#x\n", pPageDesc->GCPhys, idPage, pEntry->idPage));
+            GMMFREEPAGEDESC PageDesc;
+            PageDesc.idPage = idPage;
+            int rc = gmmR0FreePages(pGMM, pGVM, 1, &PageDesc, GMMACCOUNT_BASE);
+            AssertRCReturn(rc, rc);
+
+            gmmR0UseSharedPage(pGMM, pGVM, pOther);
+
+            pPageDesc->HCPhys = ((uint64_t)pOther->Shared.pfn) << PAGE_SHIFT;
+            pPageDesc->idPage = pEntry->idPage;
+            return VINF_SUCCESS;
+        }
+
+        /*
+         * Another private page with the same content hash (we don't bother
+         * mapping it).  Make the local page the shared copy that it and any
+         * further duplicates can be merged into.
+         */
+        Assert(GMM_PAGE_IS_PRIVATE(pOther));
+        Log(("GMMR0DedupCheckPage: %RGp %#x matches %#x, converting to shared\n", pPageDesc->GCPhys, idPage, pEntry->idPage));
+        gmmR0ConvertToSharedPage(pGMM, pGVM, pPageDesc->HCPhys, idPage, pPage, pPageDesc);
+        pEntry->idPage = idPage;
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * No luck, record the page as a candidate.
+     */
+    if (pVictim)
+    {
+        pVictim->uHashHi = uHashHi;
+        pVictim->idPage  = idPage;
+    }
+    pPageDesc->idPage = NIL_GMM_PAGEID;
+    return VINF_SUCCESS;
+}
+
+#endif /* VBOX_WITH_PAGE_SHARING */
+
+/**
+ * Scans a range of the guest RAM of the calling VM for pages that can be
+ * shared with identical pages of this or other VMs.
+ *
+ * This is the content based counterpart to GMMR0CheckSharedModules that
+ * doesn't depend on the guest telling us about anything.  The caller is
+ * expected to have all the other EMTs of the VM stalled and own the PGM lock.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 Pointer to the VM.
+ * @param   idCpu               The VCPU id.
+ * @param   pReq                Pointer to the request packet.
+ */
+GMMR0DECL(int) GMMR0DedupScanReq(PVM pVM, VMCPUID idCpu, PGMMDEDUPSCANREQ pReq)
+{
+#ifdef VBOX_WITH_PAGE_SHARING
+    /*
+     * Validate input and get the basics.
+     */
+    AssertPtrReturn(pVM, VERR_INVALID_POINTER);
+    AssertPtrReturn(pReq, VERR_INVALID_POINTER);
+    AssertMsgReturn(pReq->Hdr.cbReq == sizeof(*pReq), ("%#x != %#x\n", pReq->Hdr.cbReq, sizeof(*pReq)), VERR_INVALID_PARAMETER);
+    AssertMsgReturn(!(pReq->GCPhysNext & PAGE_OFFSET_MASK), ("%RGp\n", pReq->GCPhysNext), VERR_INVALID_PARAMETER);
+    AssertMsgReturn(pReq->cMaxPages > 0 && pReq->cMaxPages <= _1M, ("%#x\n", pReq->cMaxPages), VERR_OUT_OF_RANGE);
+
+    PGMM pGMM;
+    GMM_GET_VALID_INSTANCE(pGMM, VERR_GMM_INSTANCE);
+    PGVM pGVM;
+    int rc = GVMMR0ByVMAndEMT(pVM, idCpu, &pGVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pReq->cScanned = 0;
+    pReq->cShared  = 0;
+    pReq->cMerged  = 0;
+    pReq->fWrapped = false;
+
+    /*
+     * Take the semaphore and do some more validations.
+     */
+    gmmR0MutexAcquire(pGMM);
+    if (GMM_CHECK_SANITY_UPON_ENTERING(pGMM))
+    {
+        if (!pGMM->paDedupEntries)
+            pGMM->paDedupEntries = (PGMMDEDUPENTRY)RTMemAllocZ(sizeof(GMMDEDUPENTRY) * GMM_DEDUP_BUCKETS * GMM_DEDUP_WAYS);
+        if (pGMM->paDedupEntries)
+            rc = PGMR0SharedPageScan(pVM, pGVM, idCpu, pReq);
+        else
+            rc = VERR_NO_MEMORY;
+        GMM_CHECK_SANITY_UPON_LEAVING(pGMM);
+    }
+    else
+        rc = VERR_GMM_IS_NOT_SANE;
+
+    gmmR0MutexRelease(pGMM);
+    return rc;
+#else
+    NOREF(pVM); NOREF(idCpu); NOREF(pReq);
+    return VERR_NOT_IMPLEMENTED;
+#endif
+}
+
 #if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
 
 /**
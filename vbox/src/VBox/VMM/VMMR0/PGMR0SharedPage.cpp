@@ -21,6 +21,7 @@
 #define LOG_GROUP LOG_GROUP_PGM_SHARED
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/gmm.h>
+#include <VBox/vmm/iem.h>
 #include "PGMInternal.h"
 #include <VBox/vmm/vm.h>
 #include "PGMInline.h"
@@ -31,6 +32,57 @@
 
 
 #ifdef VBOX_WITH_PAGE_SHARING
+/**
+ * Applies a page change made by GMM to the PGM page.
+ *
+ * The page was either replaced by an existing shared version of it or
+ * converted into a read-only shared page, so all references to it are
+ * cleared and the page made shared.
+ *
+ * @param   pVM                 Pointer to the VM.
+ * @param   pVCpu               Pointer to the VMCPU of the calling EMT.
+ * @param   pPage               The PGM page.
+ * @param   pPageDesc           The page descriptor returned by GMM.
+ * @param   pfFlushTLBs         Where to indicate that the shadow TLBs needs
+ *                              flushing. Only set, never cleared.
+ */
+static void pgmR0SharedPageUpdate(PVM pVM, PVMCPU pVCpu, PPGMPAGE pPage, PGMMSHAREDPAGEDESC pPageDesc, bool *pfFlushTLBs)
+{
+    Assert(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED);
+
+    bool fFlush = false;
+    int rc = pgmPoolTrackUpdateGCPhys(pVM, pPageDesc->GCPhys, pPage, true /* clear the entries */, &fFlush);
+    Assert(   rc == VINF_SUCCESS
+           || (   VMCPU_FF_ISSET(pVCpu, VMCPU_FF_PGM_SYNC_CR3)
+               && (pVCpu->pgm.s.fSyncFlags & PGM_SYNC_CLEAR_PGM_POOL)));
+    if (rc == VINF_SUCCESS)
+        *pfFlushTLBs |= fFlush;
+    NOREF(pVCpu);
+
+    if (pPageDesc->HCPhys != PGM_PAGE_GET_HCPHYS(pPage))
+    {
+        /* Update the physical address and page id now. */
+        PGM_PAGE_SET_HCPHYS(pVM, pPage, pPageDesc->HCPhys);
+        PGM_PAGE_SET_PAGEID(pVM, pPage, pPageDesc->idPage);
+
+        /* Invalidate page map TLB entry for this page too. */
+        pgmPhysInvalidatePageMapTLBEntry(pVM, pPageDesc->GCPhys);
+        pVM->pgm.s.cReusedSharedPages++;
+    }
+    /* else: nothing changed (== this page is now a shared
+       page), so no need to flush anything. */
+
+    pVM->pgm.s.cSharedPages++;
+    pVM->pgm.s.cPrivatePages--;
+    PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_SHARED);
+
+# ifdef VBOX_STRICT /* check sum hack */
+    pPage->s.u1Unused0 = (pPageDesc->u32StrictChecksum >> 1) & 1;
+    pPage->s.u2Unused1 = (pPageDesc->u32StrictChecksum >> 8) & 3;
+# endif
+}
+
+
 /**
  * Check a registered module for shared page changes.
  *
@@ -80,6 +132,7 @@ VMMR0DECL(int) PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHA
                 Assert(!pPage || !PGM_PAGE_IS_BALLOONED(pPage));
                 if (    pPage
                     &&  PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED
+                    &&  !PGM_PAGE_IS_NOT_PRESENT(pPage)
                     &&  PGM_PAGE_GET_READ_LOCKS(pPage) == 0
                     &&  PGM_PAGE_GET_WRITE_LOCKS(pPage) == 0 )
                 {
@@ -96,44 +149,10 @@ VMMR0DECL(int) PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHA
                      */
                     if (PageDesc.idPage != NIL_GMM_PAGEID)
                     {
-                        Assert(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED);
-
                         Log(("PGMR0SharedModuleCheck: shared page gst virt=%RGv phys=%RGp host %RHp->%RHp\n",
                              GCPtrPage, PageDesc.GCPhys, PGM_PAGE_GET_HCPHYS(pPage), PageDesc.HCPhys));
-
-                        /* Page was either replaced by an existing shared
-                           version of it or converted into a read-only shared
-                           page, so, clear all references. */
-                        bool fFlush = false;
-                        rc = pgmPoolTrackUpdateGCPhys(pVM, PageDesc.GCPhys, pPage, true /* clear the entries */, &fFlush);
-                        Assert(   rc == VINF_SUCCESS
-                               || (   VMCPU_FF_ISSET(pVCpu, VMCPU_FF_PGM_SYNC_CR3)
-                                   && (pVCpu->pgm.s.fSyncFlags & PGM_SYNC_CLEAR_PGM_POOL)));
-                        if (rc == VINF_SUCCESS)
-                            fFlushTLBs |= fFlush;
                         fFlushRemTLBs = true;
-
-                        if (PageDesc.HCPhys != PGM_PAGE_GET_HCPHYS(pPage))
-                        {
-                            /* Update the physical address and page id now. */
-                            PGM_PAGE_SET_HCPHYS(pVM, pPage, PageDesc.HCPhys);
-                            PGM_PAGE_SET_PAGEID(pVM, pPage, PageDesc.idPage);
-
-                            /* Invalidate page map TLB entry for this page too. */
-                            pgmPhysInvalidatePageMapTLBEntry(pVM, PageDesc.GCPhys);
-                            pVM->pgm.s.cReusedSharedPages++;
-                        }
-                        /* else: nothing changed (== this page is now a shared
-                           page), so no need to flush anything. */
-
-                        pVM->pgm.s.cSharedPages++;
-                        pVM->pgm.s.cPrivatePages--;
-                        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_SHARED);
-
-# ifdef VBOX_STRICT /* check sum hack */
-                        pPage->s.u2Unused0 = PageDesc.u32StrictChecksum        & 3;
-                        pPage->s.u2Unused1 = (PageDesc.u32StrictChecksum >> 8) & 3;
-# endif
+                        pgmR0SharedPageUpdate(pVM, pVCpu, pPage, &PageDesc, &fFlushTLBs);
                     }
                 }
             }
@@ -160,8 +179,150 @@ VMMR0DECL(int) PGMR0SharedModuleCheck(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMSHA
         PGM_INVL_ALL_VCPU_TLBS(pVM);
 
     if (fFlushRemTLBs)
+    {
         for (VMCPUID idCurCpu = 0; idCurCpu < pVM->cCpus; idCurCpu++)
             CPUMSetChangedFlags(&pVM->aCpus[idCurCpu], CPUM_CHANGED_GLOBAL_TLB_FLUSH);
+        IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+    }
+
+    return rc;
+}
+
+
+/**
+ * Checks whether the given guest physical page is in use as a guest paging
+ * structure by any of the VCPUs.
+ *
+ * Such pages are written by the guest (accessed/dirty bits) very soon after
+ * they would be made read-only, so there is no point in sharing them.
+ *
+ * @returns true if it's a paging structure, false if not.
+ * @param   pVM                 Pointer to the VM.
+ * @param   GCPhys              The guest physical address of the page.
+ */
+static bool pgmR0SharedPageIsGstPagingRoot(PVM pVM, RTGCPHYS GCPhys)
+{
+    for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+    {
+        PVMCPU pVCpu = &pVM->aCpus[idCpu];
+        if ((pVCpu->pgm.s.GCPhysCR3 & ~(RTGCPHYS)PAGE_OFFSET_MASK) == GCPhys)
+            return true;
+        for (unsigned i = 0; i < RT_ELEMENTS(pVCpu->pgm.s.aGCPhysGstPaePDs); i++)
+            if ((pVCpu->pgm.s.aGCPhysGstPaePDs[i] & ~(RTGCPHYS)PAGE_OFFSET_MASK) == GCPhys)
+                return true;
+    }
+    return false;
+}
+
+
+/**
+ * Scans a range of guest RAM for pages that can be shared based on their
+ * content, see GMMR0DedupCheckPage.
+ *
+ * The PGM lock shall be taken prior to calling this method.
+ *
+ * @returns VBox status code.
+ *
+ * @param   pVM                 Pointer to the VM.
+ * @param   pGVM                Pointer to the GVM instance data.
+ * @param   idCpu               The ID of the calling virtual CPU.
+ * @param   pReq                The scan request. GCPhysNext and cMaxPages
+ *                              are input, the rest is output.  GCPhysNext
+ *                              is updated to where the next scan should
+ *                              continue.
+ */
+VMMR0DECL(int) PGMR0SharedPageScan(PVM pVM, PGVM pGVM, VMCPUID idCpu, PGMMDEDUPSCANREQ pReq)
+{
+    PVMCPU              pVCpu         = &pVM->aCpus[idCpu];
+    int                 rc            = VINF_SUCCESS;
+    bool                fFlushTLBs    = false;
+    bool                fFlushRemTLBs = false;
+    uint32_t            cPagesLeft    = pReq->cMaxPages;
+    RTGCPHYS            GCPhysNext    = pReq->GCPhysNext;
+    GMMSHAREDPAGEDESC   PageDesc;
+
+    PGM_LOCK_ASSERT_OWNER(pVM);     /* This cannot fail as we grab the lock in pgmR3DedupScanRendezvous before calling into ring-0. */
+
+    /*
+     * Walk the RAM ranges starting where the previous scan stopped.
+     */
+    PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR0;
+    while (pRam && pRam->GCPhysLast < GCPhysNext)
+        pRam = pRam->pNextR0;
+    for (; pRam && cPagesLeft > 0; pRam = pRam->pNextR0)
+    {
+        if (PGM_RAM_RANGE_IS_AD_HOC(pRam))
+            continue;
+
+        uint32_t const cPages = (uint32_t)(pRam->cb >> PAGE_SHIFT);
+        uint32_t       iPage  = GCPhysNext > pRam->GCPhys ? (uint32_t)((GCPhysNext - pRam->GCPhys) >> PAGE_SHIFT) : 0;
+        for (; iPage < cPages && cPagesLeft > 0; iPage++, cPagesLeft--)
+        {
+            PPGMPAGE pPage  = &pRam->aPages[iPage];
+            RTGCPHYS GCPhys = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+            if (    PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM
+                ||  PGM_PAGE_GET_STATE(pPage) != PGM_PAGE_STATE_ALLOCATED
+                ||  PGM_PAGE_IS_NOT_PRESENT(pPage)
+                ||  PGM_PAGE_GET_READ_LOCKS(pPage) != 0
+                ||  PGM_PAGE_GET_WRITE_LOCKS(pPage) != 0
+                ||  PGM_PAGE_HAS_ANY_HANDLERS(pPage)
+                ||  PGM_PAGE_GET_PDE_TYPE(pPage) == PGM_PAGE_PDE_TYPE_PDE
+                ||  pgmR0SharedPageIsGstPagingRoot(pVM, GCPhys))
+                continue;
+
+            PageDesc.idPage = PGM_PAGE_GET_PAGEID(pPage);
+            PageDesc.HCPhys = PGM_PAGE_GET_HCPHYS(pPage);
+            PageDesc.GCPhys = GCPhys;
+
+            rc = GMMR0DedupCheckPage(pGVM, &PageDesc);
+            if (RT_FAILURE(rc))
+                break;
+            pReq->cScanned++;
+
+            /*
+             * Any change for this page?
+             */
+            if (PageDesc.idPage != NIL_GMM_PAGEID)
+            {
+                Log(("PGMR0SharedPageScan: shared page phys=%RGp host %RHp->%RHp\n",
+                     PageDesc.GCPhys, PGM_PAGE_GET_HCPHYS(pPage), PageDesc.HCPhys));
+                if (PageDesc.HCPhys != PGM_PAGE_GET_HCPHYS(pPage))
+                    pReq->cMerged++;
+                else
+                    pReq->cShared++;
+                pgmR0SharedPageUpdate(pVM, pVCpu, pPage, &PageDesc, &fFlushTLBs);
+                fFlushRemTLBs = true;
+            }
+        }
+
+        /* Where to continue next time (retry the page on failure).  Don't
+           advance pRam unless we're done with this range, running out of
+           ranges is what tells us that we've wrapped around. */
+        GCPhysNext = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+        if (RT_FAILURE(rc) || iPage < cPages)
+            break;
+    }
+
+    if (!pRam)
+    {
+        pReq->fWrapped   = true;
+        pReq->GCPhysNext = 0;
+    }
+    else
+        pReq->GCPhysNext = GCPhysNext;
+
+    /*
+     * Do TLB flushing if necessary.
+     */
+    if (fFlushTLBs)
+        PGM_INVL_ALL_VCPU_TLBS(pVM);
+
+    if (fFlushRemTLBs)
+    {
+        for (VMCPUID idCurCpu = 0; idCurCpu < pVM->cCpus; idCurCpu++)
+            CPUMSetChangedFlags(&pVM->aCpus[idCurCpu], CPUM_CHANGED_GLOBAL_TLB_FLUSH);
+        IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+    }
 
     return rc;
 }
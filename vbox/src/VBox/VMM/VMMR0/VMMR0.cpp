@@ -1137,6 +1137,15 @@ static int vmmR0EntryExWorker(PVM pVM, VMCPUID idCpu, VMMR0OPERATION enmOperatio
         }
 #endif
 
+#ifdef VBOX_WITH_PAGE_SHARING
+        case VMMR0_DO_GMM_DEDUP_SCAN:
+            if (idCpu == NIL_VMCPUID)
+                return VERR_INVALID_CPU_ID;
+            if (u64Arg)
+                return VERR_INVALID_PARAMETER;
+            return GMMR0DedupScanReq(pVM, idCpu, (PGMMDEDUPSCANREQ)pReqHdr);
+#endif
+
 #if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
         case VMMR0_DO_GMM_FIND_DUPLICATE_PAGE:
             if (u64Arg)
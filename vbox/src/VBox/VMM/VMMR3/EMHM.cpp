@@ -109,6 +109,7 @@ static int emR3HmStep(PVM pVM, PVMCPU pVCpu)
     do
     {
         rc = VMMR3HmRunGC(pVM, pVCpu);
+        IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
     } while (   rc == VINF_SUCCESS
              || rc == VINF_EM_RAW_INTERRUPT);
     VMCPU_FF_CLEAR(pVCpu, VMCPU_FF_RESUME_GUEST_MASK);
@@ -549,6 +550,8 @@ int emR3HmExecute(PVM pVM, PVMCPU pVCpu, bool *pfFFDone)
             STAM_PROFILE_START(&pVCpu->em.s.StatHmExec, x);
             rc = VMMR3HmRunGC(pVM, pVCpu);
             STAM_PROFILE_STOP(&pVCpu->em.s.StatHmExec, x);
+            /* CR3 loads and INVLPG need not exit, so IEM can't trust its TLBs. */
+            IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
         }
         else
         {
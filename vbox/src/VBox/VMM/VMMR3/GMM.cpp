@@ -428,6 +428,17 @@ GMMR3DECL(int)  GMMR3CheckSharedModules(PVM pVM)
 }
 
 
+/**
+ * @see GMMR0DedupScanReq
+ */
+GMMR3DECL(int)  GMMR3DedupScan(PVM pVM, PGMMDEDUPSCANREQ pReq)
+{
+    pReq->Hdr.u32Magic = SUPVMMR0REQHDR_MAGIC;
+    pReq->Hdr.cbReq    = sizeof(*pReq);
+    return VMMR3CallR0(pVM, VMMR0_DO_GMM_DEDUP_SCAN, 0, &pReq->Hdr);
+}
+
+
 #if defined(VBOX_STRICT) && HC_ARCH_BITS == 64
 /**
  * @see GMMR0FindDuplicatePage
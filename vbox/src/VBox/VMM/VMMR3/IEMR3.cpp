@@ -20,15 +20,78 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_EM
 #include <VBox/vmm/iem.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/vmm/hm.h>
+#include <VBox/vmm/mm.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/ssm.h>
 #include "IEMInternal.h"
 #include <VBox/vmm/vm.h>
 #include <VBox/err.h>
+#include <VBox/log.h>
 
+#include <iprt/asm.h>
 #include <iprt/assert.h>
+#include <iprt/critsect.h>
+
+
+/*******************************************************************************
+*   Internal Functions                                                         *
+*******************************************************************************/
+static DECLCALLBACK(int) iemR3CodePageWriteHandler(PVM pVM, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                                                   PGMACCESSTYPE enmAccessType, void *pvUser);
+static DECLCALLBACK(int) iemR3LoadPrep(PVM pVM, PSSMHANDLE pSSM);
+static void              iemR3CodePagesFlush(PVM pVM, PIEMCODEPAGES pCodePages);
 
 
 VMMR3DECL(int)      IEMR3Init(PVM pVM)
 {
+    /*
+     * Read the configuration.
+     */
+    PCFGMNODE pCfgIem = CFGMR3GetChild(CFGMR3GetRoot(pVM), "IEM");
+
+    /** @cfgm{/IEM/BlockCache, bool, false}
+     * Whether IEMExecLots should cache the instruction boundaries and opcode
+     * bytes of the blocks it executes and replay them.  Nothing is pre-decoded,
+     * the instructions are still decoded each time they execute.  The code pages
+     * are write monitored using ring-3 only physical access handlers, so this is
+     * ignored when HM is enabled as every write to a monitored page would exit
+     * to ring-3 there. */
+    bool fBlockCache;
+    int rc = CFGMR3QueryBoolDef(pCfgIem, "BlockCache", &fBlockCache, false);
+    AssertLogRelRCReturn(rc, rc);
+    if (fBlockCache && HMIsEnabled(pVM))
+    {
+        LogRel(("IEM: BlockCache is not supported with HM, ignored.\n"));
+        fBlockCache = false;
+    }
+
+    /*
+     * Set up the code page monitor shared by the block caches.
+     */
+    PIEMCODEPAGES pCodePages = NULL;
+    if (fBlockCache)
+    {
+        pCodePages = (PIEMCODEPAGES)MMR3HeapAllocZ(pVM, MM_TAG_IEM, sizeof(*pCodePages));
+        if (!pCodePages)
+            return VERR_NO_MEMORY;
+        rc = RTCritSectInit(&pCodePages->CritSect);
+        AssertRCReturn(rc, rc);
+        for (unsigned i = 0; i < RT_ELEMENTS(pCodePages->aPages); i++)
+        {
+            pCodePages->aPages[i].GCPhys       = NIL_RTGCPHYS;
+            pCodePages->aPages[i].GCPhysWrites = NIL_RTGCPHYS;
+        }
+
+        /* Nothing to save, but the memory is about to be replaced when loading. */
+        rc = SSMR3RegisterInternal(pVM, "iem", 0 /*uInstance*/, 1 /*uVersion*/, 0 /*cbGuess*/,
+                                   NULL /*pfnLivePrep*/, NULL /*pfnLiveExec*/, NULL /*pfnLiveVote*/,
+                                   NULL /*pfnSavePrep*/, NULL /*pfnSaveExec*/, NULL /*pfnSaveDone*/,
+                                   iemR3LoadPrep,        NULL /*pfnLoadExec*/, NULL /*pfnLoadDone*/);
+        AssertRCReturn(rc, rc);
+    }
+
     for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
     {
         PVMCPU pVCpu = &pVM->aCpus[idCpu];
@@ -38,6 +101,24 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
         pVCpu->iem.s.pCtxR0   = VM_R0_ADDR(pVM, pVCpu->iem.s.pCtxR3);
         pVCpu->iem.s.pCtxRC   = VM_RC_ADDR(pVM, pVCpu->iem.s.pCtxR3);
 
+        /* Zero is never a valid revision, so the zeroed TLB entries won't hit. */
+        pVCpu->iem.s.CodeTlb.uTlbRevision       = IEMTLB_REVISION_INCR;
+        pVCpu->iem.s.CodeTlb.uTlbRevisionGlobal = IEMTLB_REVISION_INCR;
+        pVCpu->iem.s.DataTlb.uTlbRevision       = IEMTLB_REVISION_INCR;
+        pVCpu->iem.s.DataTlb.uTlbRevisionGlobal = IEMTLB_REVISION_INCR;
+        pVCpu->iem.s.uTlbPhysRev                = IEMTLB_PHYS_REV_INCR;
+
+        if (pCodePages)
+        {
+            PIEMBLOCK paBlocks = (PIEMBLOCK)MMR3HeapAllocZ(pVM, MM_TAG_IEM, sizeof(IEMBLOCK) * IEMBLOCK_CACHE_SIZE);
+            if (!paBlocks)
+                return VERR_NO_MEMORY;
+            for (unsigned i = 0; i < IEMBLOCK_CACHE_SIZE; i++)
+                paBlocks[i].GCPhys = NIL_RTGCPHYS;
+            pVCpu->iem.s.paBlocksR3   = paBlocks;
+            pVCpu->iem.s.pCodePagesR3 = pCodePages;
+        }
+
         STAMR3RegisterF(pVM, &pVCpu->iem.s.cInstructions,               STAMTYPE_U32,       STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
                         "Instructions interpreted",          "/IEM/CPU%u/cInstructions", idCpu);
         STAMR3RegisterF(pVM, &pVCpu->iem.s.cPotentialExits,             STAMTYPE_U32,       STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
@@ -52,6 +133,27 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
                         "Error statuses returned",           "/IEM/CPU%u/cRetErrStatuses", idCpu);
         STAMR3RegisterF(pVM, &pVCpu->iem.s.cbWritten,                   STAMTYPE_U32,       STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
                         "Approx bytes written",              "/IEM/CPU%u/cbWritten", idCpu);
+        STAMR3RegisterF(pVM, &pVCpu->iem.s.CodeTlb.cTlbHits,            STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                        "Code TLB hits",                     "/IEM/CPU%u/CodeTlb/cHits", idCpu);
+        STAMR3RegisterF(pVM, &pVCpu->iem.s.CodeTlb.cTlbMisses,          STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                        "Code TLB misses",                   "/IEM/CPU%u/CodeTlb/cMisses", idCpu);
+        STAMR3RegisterF(pVM, &pVCpu->iem.s.DataTlb.cTlbHits,            STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                        "Data TLB hits",                     "/IEM/CPU%u/DataTlb/cHits", idCpu);
+        STAMR3RegisterF(pVM, &pVCpu->iem.s.DataTlb.cTlbMisses,          STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                        "Data TLB misses",                   "/IEM/CPU%u/DataTlb/cMisses", idCpu);
+        if (pCodePages)
+        {
+            STAMR3RegisterF(pVM, &pVCpu->iem.s.cBlockHits,              STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Blocks replayed from the cache",    "/IEM/CPU%u/Blocks/cHits", idCpu);
+            STAMR3RegisterF(pVM, &pVCpu->iem.s.cBlockMisses,            STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Blocks recorded",                   "/IEM/CPU%u/Blocks/cMisses", idCpu);
+            STAMR3RegisterF(pVM, &pVCpu->iem.s.cBlockStale,             STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Cached blocks invalidated by writes", "/IEM/CPU%u/Blocks/cStale", idCpu);
+            STAMR3RegisterF(pVM, &pVCpu->iem.s.cBlockUncacheable,       STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Blocks not recorded because their page is written too often", "/IEM/CPU%u/Blocks/cUncacheable", idCpu);
+            STAMR3RegisterF(pVM, &pVCpu->iem.s.cBlockInstrsReplayed,    STAMTYPE_U32_RESET, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                            "Instructions fed from cached opcode bytes", "/IEM/CPU%u/Blocks/cInstrsReplayed", idCpu);
+        }
     }
     return VINF_SUCCESS;
 }
@@ -59,14 +161,178 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
 
 VMMR3DECL(int)      IEMR3Term(PVM pVM)
 {
-    NOREF(pVM);
+    PIEMCODEPAGES pCodePages = pVM->aCpus[0].iem.s.pCodePagesR3;
+    if (pCodePages)
+    {
+        iemR3CodePagesFlush(pVM, pCodePages);
+        RTCritSectDelete(&pCodePages->CritSect);
+        for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
+            pVM->aCpus[idCpu].iem.s.pCodePagesR3 = NULL;
+    }
     return VINF_SUCCESS;
 }
 
 
+/**
+ * Reset notification.
+ *
+ * Stops the code page write monitoring since the memory content is about to
+ * be reset without anyone writing to it.
+ *
+ * @param   pVM         Pointer to the VM.
+ */
+VMMR3DECL(void)     IEMR3Reset(PVM pVM)
+{
+    PIEMCODEPAGES pCodePages = pVM->aCpus[0].iem.s.pCodePagesR3;
+    if (pCodePages)
+        iemR3CodePagesFlush(pVM, pCodePages);
+}
+
+
 VMMR3DECL(void)     IEMR3Relocate(PVM pVM)
 {
     for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
         pVM->aCpus[idCpu].iem.s.pCtxRC = VM_RC_ADDR(pVM, pVM->aCpus[idCpu].iem.s.pCtxR3);
 }
 
+
+
+/**
+ * @callback_method_impl{FNSSMINTLOADPREP,
+ *      Stops the code page write monitoring since the memory content is about to
+ *      be replaced.}
+ */
+static DECLCALLBACK(int) iemR3LoadPrep(PVM pVM, PSSMHANDLE pSSM)
+{
+    NOREF(pSSM);
+    iemR3CodePagesFlush(pVM, pVM->aCpus[0].iem.s.pCodePagesR3);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Stops monitoring a code page, invalidating all the blocks recorded from it.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   pCodePage   The code page.  Caller owns the critical section.
+ */
+static void iemR3CodePageUnmonitor(PVM pVM, PIEMCODEPAGE pCodePage)
+{
+    int rc = PGMHandlerPhysicalDeregister(pVM, pCodePage->GCPhys);
+    AssertRC(rc);
+    ASMAtomicIncU32(&pCodePage->uGeneration);
+    pCodePage->GCPhys = NIL_RTGCPHYS;
+}
+
+
+/**
+ * Stops monitoring all code pages, invalidating all cached blocks.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   pCodePages  The code pages.
+ */
+static void iemR3CodePagesFlush(PVM pVM, PIEMCODEPAGES pCodePages)
+{
+    RTCritSectEnter(&pCodePages->CritSect);
+    for (unsigned i = 0; i < RT_ELEMENTS(pCodePages->aPages); i++)
+        if (pCodePages->aPages[i].GCPhys != NIL_RTGCPHYS)
+            iemR3CodePageUnmonitor(pVM, &pCodePages->aPages[i]);
+    RTCritSectLeave(&pCodePages->CritSect);
+}
+
+
+/**
+ * Makes sure a code page is write monitored before recording a block from it.
+ *
+ * Pages that keep getting written to (code and data sharing a page, JITs)
+ * are refused for a while once IEMCODEPAGE_MAX_WRITES writes have invalidated
+ * them, every refusal counts towards IEMCODEPAGE_UNCACHEABLE_PERIOD.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_PGM_HANDLER_PHYSICAL_CONFLICT if somebody else has a handler
+ *          covering the page (ROM, MMIO, the page pool, devices).  The block
+ *          must not be cached then.
+ * @retval  VERR_TRY_AGAIN if the page is currently considered uncacheable.
+ *          The block must not be cached then either.
+ * @param   pVM             Pointer to the VM.
+ * @param   pCodePages      The code pages.
+ * @param   GCPhysPage      The guest physical address of the page.
+ * @param   puGeneration    Where to return the current write generation of
+ *                          the page.  Blocks recorded under it are valid for as
+ *                          long as it doesn't change.
+ * @thread  EMT
+ */
+int iemR3CodePageMonitor(PVM pVM, PIEMCODEPAGES pCodePages, RTGCPHYS GCPhysPage, uint32_t *puGeneration)
+{
+    PIEMCODEPAGE pCodePage = &pCodePages->aPages[IEMCODEPAGE_IDX(GCPhysPage)];
+    int          rc        = VINF_SUCCESS;
+    RTCritSectEnter(&pCodePages->CritSect);
+    if (pCodePage->GCPhys != GCPhysPage)
+    {
+        if (pCodePage->GCPhysWrites != GCPhysPage)
+        {
+            /* Another page took the slot, start counting afresh. */
+            pCodePage->GCPhysWrites = GCPhysPage;
+            pCodePage->cWrites      = 0;
+            pCodePage->cUncacheable = 0;
+        }
+        else if (pCodePage->cUncacheable)
+        {
+            pCodePage->cUncacheable--;
+            *puGeneration = pCodePage->uGeneration;
+            RTCritSectLeave(&pCodePages->CritSect);
+            return VERR_TRY_AGAIN;
+        }
+
+        if (pCodePage->GCPhys != NIL_RTGCPHYS)
+            iemR3CodePageUnmonitor(pVM, pCodePage);
+        rc = PGMR3HandlerPhysicalRegister(pVM, PGMPHYSHANDLERTYPE_PHYSICAL_WRITE, GCPhysPage, GCPhysPage + PAGE_OFFSET_MASK,
+                                          iemR3CodePageWriteHandler, pCodePages,
+                                          NULL /*pszModR0*/, NULL /*pszHandlerR0*/, NIL_RTR0PTR,
+                                          NULL /*pszModRC*/, NULL /*pszHandlerRC*/, NIL_RTRCPTR,
+                                          "IEM code page");
+        if (RT_SUCCESS(rc))
+            pCodePage->GCPhys = GCPhysPage;
+        else
+            Log(("iemR3CodePageMonitor: %RGp -> %Rrc\n", GCPhysPage, rc));
+    }
+    *puGeneration = pCodePage->uGeneration;
+    RTCritSectLeave(&pCodePages->CritSect);
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNPGMR3PHYSHANDLER,
+ *      Write to a code page, invalidates the blocks recorded from it.}
+ */
+static DECLCALLBACK(int) iemR3CodePageWriteHandler(PVM pVM, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                                                   PGMACCESSTYPE enmAccessType, void *pvUser)
+{
+    PIEMCODEPAGES  pCodePages = (PIEMCODEPAGES)pvUser;
+    RTGCPHYS const GCPhysPage = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    Assert(enmAccessType == PGMACCESSTYPE_WRITE); NOREF(enmAccessType);
+    NOREF(pvPhys); NOREF(pvBuf); NOREF(cbBuf);
+    Log2(("iemR3CodePageWriteHandler: %RGp LB %#zx\n", GCPhys, cbBuf));
+
+    /* Stop monitoring; whoever records a block from the page next time
+       around will start it again. */
+    RTCritSectEnter(&pCodePages->CritSect);
+    PIEMCODEPAGE pCodePage = &pCodePages->aPages[IEMCODEPAGE_IDX(GCPhysPage)];
+    if (pCodePage->GCPhys == GCPhysPage)
+    {
+        iemR3CodePageUnmonitor(pVM, pCodePage);
+
+        /* Give up on pages that are written to all the time for a while. */
+        Assert(pCodePage->GCPhysWrites == GCPhysPage);
+        if (++pCodePage->cWrites >= IEMCODEPAGE_MAX_WRITES)
+        {
+            Log(("iemR3CodePageWriteHandler: %RGp is uncacheable for now\n", GCPhysPage));
+            pCodePage->cWrites      = 0;
+            pCodePage->cUncacheable = IEMCODEPAGE_UNCACHEABLE_PERIOD;
+        }
+    }
+    RTCritSectLeave(&pCodePages->CritSect);
+
+    return VINF_PGM_HANDLER_DO_DEFAULT;
+}
@@ -17,6 +17,17 @@
 
 /** @page pg_pdm_block_cache     PDM Block Cache - The I/O cache
  * This component implements an I/O cache based on the 2Q cache algorithm.
+ *
+ * Sequential and strided read streams are detected per endpoint and the data
+ * following the stream is read into the cache asynchronously. Adjacent dirty
+ * entries are written to the medium with a single transfer when committing.
+ *
+ * The LRU lists are split into a configurable number of shards, each with
+ * its own lock. An entry is assigned to a shard by hashing the endpoint and
+ * the offset of the entry so that concurrent accesses to different disks or
+ * different regions of the same disk don't contend on a single lock.
+ * Instead of 2Q the shards can use the ARC replacement policy which adapts
+ * the split between the recently and frequently used lists to the workload.
  */
 
 /*******************************************************************************
@@ -27,8 +38,10 @@
 #include <iprt/asm.h>
 #include <iprt/mem.h>
 #include <iprt/path.h>
+#include <iprt/sort.h>
 #include <iprt/string.h>
 #include <VBox/log.h>
+#include <VBox/vmm/mm.h>
 #include <VBox/vmm/stam.h>
 #include <VBox/vmm/uvm.h>
 #include <VBox/vmm/vm.h>
@@ -97,47 +110,122 @@ DECLINLINE(void) pdmBlkCacheEntryRef(PPDMBLKCACHEENTRY pEntry)
 }
 
 #ifdef VBOX_STRICT
-static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
+static void pdmBlkCacheValidate(PPDMBLKCACHESHARD pShard)
 {
     /* Amount of cached data should never exceed the maximum amount. */
-    AssertMsg(pCache->cbCached <= pCache->cbMax,
+    AssertMsg(pShard->cbCached <= pShard->cbMax,
               ("Current amount of cached data exceeds maximum\n"));
 
     /* The amount of cached data in the LRU and FRU list should match cbCached */
-    AssertMsg(pCache->LruRecentlyUsedIn.cbCached + pCache->LruFrequentlyUsed.cbCached == pCache->cbCached,
+    AssertMsg(pShard->LruRecentlyUsedIn.cbCached + pShard->LruFrequentlyUsed.cbCached == pShard->cbCached,
               ("Amount of cached data doesn't match\n"));
 
-    AssertMsg(pCache->LruRecentlyUsedOut.cbCached <= pCache->cbRecentlyUsedOutMax,
+    AssertMsg(pShard->LruRecentlyUsedOut.cbCached <= pShard->cbRecentlyUsedOutMax,
               ("Paged out list exceeds maximum\n"));
+    AssertMsg(pShard->LruFrequentlyUsedOut.cbCached <= pShard->cbFrequentlyUsedOutMax,
+              ("Frequently used paged out list exceeds maximum\n"));
 }
 #endif
 
 DECLINLINE(void) pdmBlkCacheLockEnter(PPDMBLKCACHEGLOBAL pCache)
 {
     RTCritSectEnter(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+{
+    RTCritSectLeave(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheShardLockEnter(PPDMBLKCACHESHARD pShard)
+{
+    RTCritSectEnter(&pShard->CritSect);
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheValidate(pShard);
 #endif
 }
 
-DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+DECLINLINE(void) pdmBlkCacheShardLockLeave(PPDMBLKCACHESHARD pShard)
 {
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheValidate(pShard);
 #endif
-    RTCritSectLeave(&pCache->CritSect);
+    RTCritSectLeave(&pShard->CritSect);
+}
+
+/**
+ * Enters the global lock and the locks of all shards.
+ *
+ * @returns nothing.
+ * @param   pCache    The global cache instance.
+ *
+ * @note Needed when entries of an endpoint are removed while the R/W semaphore
+ *       of the endpoint is held. The shard locks must be taken before the
+ *       R/W semaphore to avoid lock order inversions with the eviction path.
+ */
+static void pdmBlkCacheLockEnterAll(PPDMBLKCACHEGLOBAL pCache)
+{
+    pdmBlkCacheLockEnter(pCache);
+    for (uint32_t i = 0; i < pCache->cShards; i++)
+        pdmBlkCacheShardLockEnter(&pCache->paShards[i]);
+}
+
+/**
+ * Leaves the locks taken by pdmBlkCacheLockEnterAll().
+ *
+ * @returns nothing.
+ * @param   pCache    The global cache instance.
+ */
+static void pdmBlkCacheLockLeaveAll(PPDMBLKCACHEGLOBAL pCache)
+{
+    for (uint32_t i = pCache->cShards; i > 0; i--)
+        pdmBlkCacheShardLockLeave(&pCache->paShards[i - 1]);
+    pdmBlkCacheLockLeave(pCache);
+}
+
+/**
+ * Returns the shard which manages the entry for the given offset.
+ *
+ * @returns Pointer to the shard.
+ * @param   pCache       The global cache instance.
+ * @param   pBlkCache    The endpoint cache.
+ * @param   off          Start offset of the entry.
+ */
+DECLINLINE(PPDMBLKCACHESHARD) pdmBlkCacheShardGet(PPDMBLKCACHEGLOBAL pCache, PPDMBLKCACHE pBlkCache, uint64_t off)
+{
+    if (pCache->cShards == 1)
+        return &pCache->paShards[0];
+
+    uint64_t uHash = ((uintptr_t)pBlkCache >> 4) ^ (off >> PDMBLKCACHE_SHARD_GRANULE_SHIFT);
+    uHash *= UINT64_C(0x9e3779b97f4a7c15); /* Fibonacci hashing, spreads neighbouring granules. */
+    return &pCache->paShards[(uint32_t)(uHash >> 32) & (pCache->cShards - 1)];
+}
+
+/**
+ * Checks whether the given entry holds data, i.e. is not on a ghost list.
+ *
+ * @returns true if the entry is on one of the lists containing data.
+ * @param   pEntry    The entry to check.
+ */
+DECLINLINE(bool) pdmBlkCacheEntryIsCached(PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKLRULIST pList = pEntry->pList;
+    return    pList == &pEntry->pShard->LruRecentlyUsedIn
+           || pList == &pEntry->pShard->LruFrequentlyUsed;
 }
 
-DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached -= cbAmount;
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached -= cbAmount;
+    ASMAtomicSubU32(&pShard->pCache->cbCached, cbAmount);
 }
 
-DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached += cbAmount;
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached += cbAmount;
+    ASMAtomicAddU32(&pShard->pCache->cbCached, cbAmount);
 }
 
 DECLINLINE(void) pdmBlkCacheListAdd(PPDMBLKLRULIST pList, uint32_t cbAmount)
@@ -305,10 +393,10 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  * moving the entries to one of the given ghosts lists
  *
  * @returns Amount of data which could be freed.
- * @param    pCache           Pointer to the global cache data.
+ * @param    pShard           Pointer to the cache shard.
  * @param    cbData           The amount of the data to free.
  * @param    pListSrc         The source list to evict data from.
- * @param    pGhostListSrc    The ghost list removed entries should be moved to
+ * @param    pGhostListDst    The ghost list removed entries should be moved to
  *                            NULL if the entry should be freed.
  * @param    fReuseBuffer     Flag whether a buffer should be reused if it has the same size
  * @param    ppbBuf           Where to store the address of the buffer if an entry with the
@@ -318,18 +406,23 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  *          may be marked as non evictable if they are used for I/O at the
  *          moment.
  */
-static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData,
+static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHESHARD pShard, size_t cbData,
                                         PPDMBLKLRULIST pListSrc, PPDMBLKLRULIST pGhostListDst,
                                         bool fReuseBuffer, uint8_t **ppbBuffer)
 {
+    PPDMBLKCACHEGLOBAL pCache = pShard->pCache;
     size_t cbEvicted = 0;
 
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
 
     AssertMsg(cbData > 0, ("Evicting 0 bytes not possible\n"));
     AssertMsg(   !pGhostListDst
-              || (pGhostListDst == &pCache->LruRecentlyUsedOut),
-              ("Destination list must be NULL or the recently used but paged out list\n"));
+              || (pGhostListDst == &pShard->LruRecentlyUsedOut)
+              || (pGhostListDst == &pShard->LruFrequentlyUsedOut),
+              ("Destination list must be NULL or one of the paged out lists\n"));
+    uint32_t cbGhostMax = pGhostListDst == &pShard->LruFrequentlyUsedOut
+                        ? pShard->cbFrequentlyUsedOutMax
+                        : pShard->cbRecentlyUsedOutMax;
 
     if (fReuseBuffer)
     {
@@ -372,16 +465,19 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                 cbEvicted += pCurr->cbData;
 
                 pdmBlkCacheEntryRemoveFromList(pCurr);
-                pdmBlkCacheSub(pCache, pCurr->cbData);
+                pdmBlkCacheSub(pShard, pCurr->cbData);
+                STAM_COUNTER_INC(&pShard->StatEvicted);
 
-                if (pGhostListDst)
+                /* Entries with invalid data are not worth remembering. */
+                if (   pGhostListDst
+                    && !(pCurr->fFlags & PDMBLKCACHE_ENTRY_INVALID))
                 {
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
                     PPDMBLKCACHEENTRY pGhostEntFree = pGhostListDst->pTail;
 
                     /* We have to remove the last entries from the paged out list. */
-                    while (   pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax
+                    while (   pGhostListDst->cbCached + pCurr->cbData > cbGhostMax
                            && pGhostEntFree)
                     {
                         PPDMBLKCACHEENTRY pFree = pGhostEntFree;
@@ -405,7 +501,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                         RTSemRWReleaseWrite(pBlkCacheFree->SemRWEntries);
                     }
 
-                    if (pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax)
+                    if (pGhostListDst->cbCached + pCurr->cbData > cbGhostMax)
                     {
                         /* Couldn't remove enough entries. Delete */
                         STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
@@ -437,17 +533,63 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
     return cbEvicted;
 }
 
-static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
+/**
+ * Adapts the target size of the recently used list after a hit in one of the
+ * ghost lists when the ARC policy is used.
+ *
+ * @returns nothing.
+ * @param   pShard       The cache shard.
+ * @param   pGhostList   The ghost list the entry was found in.
+ * @param   cbEntry      Size of the entry.
+ *
+ * @note The caller must own the shard lock.
+ */
+static void pdmBlkCacheArcAdapt(PPDMBLKCACHESHARD pShard, PPDMBLKLRULIST pGhostList, uint32_t cbEntry)
+{
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    STAM_COUNTER_INC(&pShard->StatGhostHits);
+
+    if (pShard->pCache->enmPolicy != PDMBLKCACHEPOLICY_ARC)
+        return;
+
+    uint32_t cbRecentOut   = RT_MAX(pShard->LruRecentlyUsedOut.cbCached, 1);
+    uint32_t cbFrequentOut = RT_MAX(pShard->LruFrequentlyUsedOut.cbCached, 1);
+
+    if (pGhostList == &pShard->LruRecentlyUsedOut)
+    {
+        /* The recently used list was too small, grow its target. */
+        uint64_t cbDelta = (uint64_t)cbEntry * RT_MAX(cbFrequentOut / cbRecentOut, 1);
+        pShard->cbRecentlyUsedInMax = (uint32_t)RT_MIN(pShard->cbRecentlyUsedInMax + cbDelta, pShard->cbMax);
+    }
+    else
+    {
+        Assert(pGhostList == &pShard->LruFrequentlyUsedOut);
+
+        /* The frequently used list was too small, shrink the recently used target. */
+        uint64_t cbDelta = (uint64_t)cbEntry * RT_MAX(cbRecentOut / cbFrequentOut, 1);
+        pShard->cbRecentlyUsedInMax = cbDelta >= pShard->cbRecentlyUsedInMax
+                                    ? 0
+                                    : pShard->cbRecentlyUsedInMax - (uint32_t)cbDelta;
+    }
+
+    LogFlowFunc(("Shard %u: new recently used target %u bytes\n", pShard->idxShard, pShard->cbRecentlyUsedInMax));
+}
+
+static bool pdmBlkCacheReclaim(PPDMBLKCACHESHARD pShard, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
 {
     size_t cbRemoved = 0;
+    /* ARC keeps entries evicted from the frequently used list on a ghost list as well. */
+    PPDMBLKLRULIST pGhostListFrequent =   pShard->pCache->enmPolicy == PDMBLKCACHEPOLICY_ARC
+                                        ? &pShard->LruFrequentlyUsedOut
+                                        : NULL;
 
-    if ((pCache->cbCached + cbData) < pCache->cbMax)
+    if ((pShard->cbCached + cbData) < pShard->cbMax)
         return true;
-    else if ((pCache->LruRecentlyUsedIn.cbCached + cbData) > pCache->cbRecentlyUsedInMax)
+    else if ((pShard->LruRecentlyUsedIn.cbCached + cbData) > pShard->cbRecentlyUsedInMax)
     {
         /* Try to evict as many bytes as possible from A1in */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruRecentlyUsedIn,
-                                                 &pCache->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
+        cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruRecentlyUsedIn,
+                                                 &pShard->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
 
         /*
          * If it was not possible to remove enough entries
@@ -462,24 +604,60 @@ static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fR
              * we don't need to evict that much data
              */
             if (!cbRemoved)
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
-                                                          NULL, fReuseBuffer, ppbBuffer);
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruFrequentlyUsed,
+                                                          pGhostListFrequent, fReuseBuffer, ppbBuffer);
             else
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData - cbRemoved, &pCache->LruFrequentlyUsed,
-                                                          NULL, false, NULL);
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData - cbRemoved, &pShard->LruFrequentlyUsed,
+                                                          pGhostListFrequent, false, NULL);
         }
     }
     else
     {
         /* We have to remove entries from frequently access list. */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
-                                                 NULL, fReuseBuffer, ppbBuffer);
+        cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruFrequentlyUsed,
+                                                 pGhostListFrequent, fReuseBuffer, ppbBuffer);
+
+        /* ARC may have shrunk the recently used target below its current size, fall back to it. */
+        if (   cbRemoved < cbData
+            && pGhostListFrequent)
+        {
+            if (!cbRemoved)
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruRecentlyUsedIn,
+                                                       &pShard->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
+            else
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData - cbRemoved, &pShard->LruRecentlyUsedIn,
+                                                       &pShard->LruRecentlyUsedOut, false, NULL);
+        }
     }
 
     LogFlowFunc((": removed %u bytes, requested %u\n", cbRemoved, cbData));
     return (cbRemoved >= cbData);
 }
 
+/**
+ * Updates the LRU position of an entry holding data after it was accessed.
+ *
+ * @returns nothing.
+ * @param   pShard    The shard the entry belongs to.
+ * @param   pEntry    The entry which was hit.
+ *
+ * @note 2Q only moves entries which are already on the frequently used list
+ *       while ARC promotes entries from the recently used list on the second hit.
+ */
+static void pdmBlkCacheEntryHit(PPDMBLKCACHESHARD pShard, PPDMBLKCACHEENTRY pEntry)
+{
+    if (   pEntry->pList == &pShard->LruFrequentlyUsed
+        || (   pShard->pCache->enmPolicy == PDMBLKCACHEPOLICY_ARC
+            && pEntry->pList == &pShard->LruRecentlyUsedIn))
+    {
+        pdmBlkCacheShardLockEnter(pShard);
+        /* Recheck, the entry might have been evicted in the meantime. */
+        if (pdmBlkCacheEntryIsCached(pEntry))
+            pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+        pdmBlkCacheShardLockLeave(pShard);
+    }
+}
+
 DECLINLINE(int) pdmBlkCacheEnqueue(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbXfer, PPDMBLKCACHEIOXFER pIoXfer)
 {
     int rc = VINF_SUCCESS;
@@ -589,6 +767,65 @@ static int pdmBlkCacheEntryWriteToMedium(PPDMBLKCACHEENTRY pEntry)
     return pdmBlkCacheEnqueue(pBlkCache, pEntry->Core.Key, pEntry->cbData, pIoXfer);
 }
 
+/**
+ * Initiates a single write I/O task for several adjacent entries.
+ *
+ * @returns true if the transfer was started, false if there is not enough memory
+ *          to set it up (the entries are not touched in that case).
+ * @param   pBlkCache     The endpoint cache the entries belong to.
+ * @param   papEntries    Array of entries sorted by offset without holes in between.
+ * @param   cEntries      Number of entries in the array.
+ */
+static bool pdmBlkCacheEntriesWriteToMedium(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY *papEntries, uint32_t cEntries)
+{
+    LogFlowFunc((": Writing data from %u cache entries starting at %#p\n", cEntries, papEntries[0]));
+
+    Assert(cEntries > 1);
+
+    PPDMBLKCACHEIOXFER pIoXfer = (PPDMBLKCACHEIOXFER)RTMemAllocZ(sizeof(PDMBLKCACHEIOXFER));
+    if (RT_UNLIKELY(!pIoXfer))
+        return false;
+
+    /* The segment array is placed right after the entry array. */
+    pIoXfer->papEntries = (PPDMBLKCACHEENTRY *)RTMemAllocZ(cEntries * (sizeof(PPDMBLKCACHEENTRY) + sizeof(RTSGSEG)));
+    if (RT_UNLIKELY(!pIoXfer->papEntries))
+    {
+        RTMemFree(pIoXfer);
+        return false;
+    }
+    pIoXfer->paSegs = (PRTSGSEG)&pIoXfer->papEntries[cEntries];
+
+    size_t cbXfer = 0;
+    for (uint32_t i = 0; i < cEntries; i++)
+    {
+        PPDMBLKCACHEENTRY pEntry = papEntries[i];
+
+        AssertMsg(pEntry->pbData, ("Entry is in ghost state\n"));
+        AssertMsg(!i || papEntries[i - 1]->Core.KeyLast + 1 == pEntry->Core.Key,
+                  ("Entries are not adjacent\n"));
+
+        /* Make sure no one evicts the entry while it is accessed. */
+        pEntry->fFlags |= PDMBLKCACHE_ENTRY_IO_IN_PROGRESS;
+
+        pIoXfer->papEntries[i]   = pEntry;
+        pIoXfer->paSegs[i].pvSeg = pEntry->pbData;
+        pIoXfer->paSegs[i].cbSeg = pEntry->cbData;
+        cbXfer += pEntry->cbData;
+    }
+
+    pIoXfer->fIoCache   = true;
+    pIoXfer->pEntry     = papEntries[0];
+    pIoXfer->cEntries   = cEntries;
+    pIoXfer->enmXferDir = PDMBLKCACHEXFERDIR_WRITE;
+    RTSgBufInit(&pIoXfer->SgBuf, pIoXfer->paSegs, cEntries);
+
+    STAM_COUNTER_INC(&pBlkCache->pCache->StatCommitCoalesced);
+    STAM_COUNTER_ADD(&pBlkCache->pCache->StatCommitCoalescedEntries, cEntries);
+
+    pdmBlkCacheEnqueue(pBlkCache, papEntries[0]->Core.Key, cbXfer, pIoXfer);
+    return true;
+}
+
 /**
  * Passthrough a part of a request directly to the I/O manager
  * handling the endpoint.
@@ -638,6 +875,67 @@ static void pdmBlkCacheEntryCommit(PPDMBLKCACHEENTRY pEntry)
     pdmBlkCacheEntryWriteToMedium(pEntry);
 }
 
+/**
+ * Compares the offsets of two cache entries, used for sorting.
+ */
+static DECLCALLBACK(int) pdmBlkCacheEntryCmpOffset(void const *pvElement1, void const *pvElement2, void *pvUser)
+{
+    PPDMBLKCACHEENTRY pEntry1 = (PPDMBLKCACHEENTRY)pvElement1;
+    PPDMBLKCACHEENTRY pEntry2 = (PPDMBLKCACHEENTRY)pvElement2;
+    NOREF(pvUser);
+
+    if (pEntry1->Core.Key < pEntry2->Core.Key)
+        return -1;
+    if (pEntry1->Core.Key > pEntry2->Core.Key)
+        return 1;
+    return 0;
+}
+
+/**
+ * Commits the given dirty entries sorted by offset, writing adjacent entries
+ * with a single transfer.
+ *
+ * @returns Number of bytes committed.
+ * @param   pBlkCache     The endpoint cache.
+ * @param   papEntries    The dirty entries, removed from the not committed list already.
+ * @param   cEntries      Number of entries.
+ */
+static uint32_t pdmBlkCacheCommitCoalesced(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY *papEntries, uint32_t cEntries)
+{
+    uint32_t cbCommitMax = pBlkCache->pCache->cbCommitCoalesceMax;
+    uint32_t cbCommitted = 0;
+    uint32_t i = 0;
+
+    RTSortApvShell((void **)papEntries, cEntries, pdmBlkCacheEntryCmpOffset, NULL);
+
+    while (i < cEntries)
+    {
+        /* Find the run of adjacent entries starting at the current one. */
+        uint32_t cRun    = 1;
+        uint32_t cbRun   = papEntries[i]->cbData;
+        while (   i + cRun < cEntries
+               && papEntries[i + cRun - 1]->Core.KeyLast + 1 == papEntries[i + cRun]->Core.Key
+               && cbRun + papEntries[i + cRun]->cbData <= cbCommitMax)
+        {
+            cbRun += papEntries[i + cRun]->cbData;
+            cRun++;
+        }
+
+        if (   cRun == 1
+            || !pdmBlkCacheEntriesWriteToMedium(pBlkCache, &papEntries[i], cRun))
+        {
+            /* Single entry or out of memory, commit every entry on its own. */
+            for (uint32_t j = i; j < i + cRun; j++)
+                pdmBlkCacheEntryCommit(papEntries[j]);
+        }
+
+        cbCommitted += cbRun;
+        i           += cRun;
+    }
+
+    return cbCommitted;
+}
+
 /**
  * Commit all dirty entries for a single endpoint.
  *
@@ -664,23 +962,60 @@ static void pdmBlkCacheCommit(PPDMBLKCACHE pBlkCache)
 
     if (!RTListIsEmpty(&ListDirtyNotCommitted))
     {
-        PPDMBLKCACHEENTRY pEntry = RTListGetFirst(&ListDirtyNotCommitted, PDMBLKCACHEENTRY, NodeNotCommitted);
+        PPDMBLKCACHEENTRY *papEntries = NULL;
+        uint32_t           cEntries   = 0;
+        PPDMBLKCACHEENTRY  pEntry;
 
-        while (!RTListNodeIsLast(&ListDirtyNotCommitted, &pEntry->NodeNotCommitted))
+        /* Try to coalesce adjacent entries if enabled, this requires sorting them by offset. */
+        if (pBlkCache->pCache->cbCommitCoalesceMax > 0)
         {
-            PPDMBLKCACHEENTRY pNext = RTListNodeGetNext(&pEntry->NodeNotCommitted, PDMBLKCACHEENTRY,
-                                                        NodeNotCommitted);
+            RTListForEach(&ListDirtyNotCommitted, pEntry, PDMBLKCACHEENTRY, NodeNotCommitted)
+            {
+                cEntries++;
+            }
+
+            if (cEntries > 1)
+                papEntries = (PPDMBLKCACHEENTRY *)RTMemAlloc(cEntries * sizeof(PPDMBLKCACHEENTRY));
+        }
+
+        if (papEntries)
+        {
+            uint32_t i = 0;
+            PPDMBLKCACHEENTRY pEntryNext;
+
+            RTListForEachSafe(&ListDirtyNotCommitted, pEntry, pEntryNext, PDMBLKCACHEENTRY, NodeNotCommitted)
+            {
+                AssertMsg(   (pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY)
+                          && !(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS),
+                          ("Invalid flags set for entry %#p\n", pEntry));
+                RTListNodeRemove(&pEntry->NodeNotCommitted);
+                papEntries[i++] = pEntry;
+            }
+
+            cbCommitted = pdmBlkCacheCommitCoalesced(pBlkCache, papEntries, cEntries);
+            RTMemFree(papEntries);
+        }
+        else
+        {
+            pEntry = RTListGetFirst(&ListDirtyNotCommitted, PDMBLKCACHEENTRY, NodeNotCommitted);
+
+            while (!RTListNodeIsLast(&ListDirtyNotCommitted, &pEntry->NodeNotCommitted))
+            {
+                PPDMBLKCACHEENTRY pNext = RTListNodeGetNext(&pEntry->NodeNotCommitted, PDMBLKCACHEENTRY,
+                                                            NodeNotCommitted);
+                pdmBlkCacheEntryCommit(pEntry);
+                cbCommitted += pEntry->cbData;
+                RTListNodeRemove(&pEntry->NodeNotCommitted);
+                pEntry = pNext;
+            }
+
+            /* Commit the last endpoint */
+            Assert(RTListNodeIsLast(&ListDirtyNotCommitted, &pEntry->NodeNotCommitted));
             pdmBlkCacheEntryCommit(pEntry);
             cbCommitted += pEntry->cbData;
             RTListNodeRemove(&pEntry->NodeNotCommitted);
-            pEntry = pNext;
         }
 
-        /* Commit the last endpoint */
-        Assert(RTListNodeIsLast(&ListDirtyNotCommitted, &pEntry->NodeNotCommitted));
-        pdmBlkCacheEntryCommit(pEntry);
-        cbCommitted += pEntry->cbData;
-        RTListNodeRemove(&pEntry->NodeNotCommitted);
         AssertMsg(RTListIsEmpty(&ListDirtyNotCommitted),
                   ("Committed all entries but list is not empty\n"));
     }
@@ -841,11 +1176,9 @@ static DECLCALLBACK(int) pdmR3BlkCacheSaveExec(PVM pVM, PSSMHANDLE pSSM)
             /* A few sanity checks. */
             AssertMsg(!pEntry->cRefs, ("The entry is still referenced\n"));
             AssertMsg(pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY, ("Entry is not dirty\n"));
-            AssertMsg(!(pEntry->fFlags & ~PDMBLKCACHE_ENTRY_IS_DIRTY), ("Invalid flags set\n"));
+            AssertMsg(!(pEntry->fFlags & ~(PDMBLKCACHE_ENTRY_IS_DIRTY | PDMBLKCACHE_ENTRY_READ_AHEAD)), ("Invalid flags set\n"));
             AssertMsg(!pEntry->pWaitingHead && !pEntry->pWaitingTail, ("There are waiting requests\n"));
-            AssertMsg(   pEntry->pList == &pBlkCacheGlobal->LruRecentlyUsedIn
-                      || pEntry->pList == &pBlkCacheGlobal->LruFrequentlyUsed,
-                      ("Invalid list\n"));
+            AssertMsg(pdmBlkCacheEntryIsCached(pEntry), ("Invalid list\n"));
             AssertMsg(pEntry->cbData == pEntry->Core.KeyLast - pEntry->Core.Key + 1,
                       ("Size and range do not match\n"));
 
@@ -955,9 +1288,12 @@ static DECLCALLBACK(int) pdmR3BlkCacheLoadExec(PVM pVM, PSSMHANDLE pSSM, uint32_
             Assert(fInserted); NOREF(fInserted);
 
             /* Add to the dirty list. */
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
             pdmBlkCacheAddDirtyEntry(pBlkCache, pEntry);
-            pdmBlkCacheEntryAddToList(&pBlkCacheGlobal->LruRecentlyUsedIn, pEntry);
-            pdmBlkCacheAdd(pBlkCacheGlobal, cbEntry);
+            pdmBlkCacheShardLockEnter(pShard);
+            pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntry);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
             pdmBlkCacheEntryRelease(pEntry);
             cEntries--;
         }
@@ -1007,19 +1343,7 @@ int pdmR3BlkCacheInit(PVM pVM)
     pBlkCacheGlobal->cRefs = 0;
     pBlkCacheGlobal->cbCached  = 0;
     pBlkCacheGlobal->fCommitInProgress = false;
-
-    /* Initialize members */
-    pBlkCacheGlobal->LruRecentlyUsedIn.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.cbCached = 0;
-
-    pBlkCacheGlobal->LruRecentlyUsedOut.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.cbCached = 0;
-
-    pBlkCacheGlobal->LruFrequentlyUsed.pHead    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.pTail    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.cbCached = 0;
+    pBlkCacheGlobal->enmPolicy = PDMBLKCACHEPOLICY_2Q;
 
     do
     {
@@ -1027,18 +1351,124 @@ int pdmR3BlkCacheInit(PVM pVM)
         AssertLogRelRCBreak(rc);
         LogFlowFunc(("Maximum number of bytes cached %u\n", pBlkCacheGlobal->cbMax));
 
-        pBlkCacheGlobal->cbRecentlyUsedInMax  = (pBlkCacheGlobal->cbMax / 100) * 25; /* 25% of the buffer size */
-        pBlkCacheGlobal->cbRecentlyUsedOutMax = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
-        LogFlowFunc(("cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
-                     pBlkCacheGlobal->cbRecentlyUsedInMax, pBlkCacheGlobal->cbRecentlyUsedOutMax));
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheShards", &pBlkCacheGlobal->cShards, 1);
+        AssertLogRelRCBreak(rc);
+        if (   !pBlkCacheGlobal->cShards
+            || pBlkCacheGlobal->cShards > PDMBLKCACHE_SHARDS_MAX
+            || !RT_IS_POWER_OF_TWO(pBlkCacheGlobal->cShards))
+        {
+            rc = VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                            N_("Configuration error: \"CacheShards\" must be a power of two between 1 and %u, got %u"),
+                            PDMBLKCACHE_SHARDS_MAX, pBlkCacheGlobal->cShards);
+            break;
+        }
+
+        char *pszPolicy = NULL;
+        rc = CFGMR3QueryStringAllocDef(pCfgBlkCache, "CachePolicy", &pszPolicy, "2Q");
+        AssertLogRelRCBreak(rc);
+        if (!RTStrICmp(pszPolicy, "2Q"))
+            pBlkCacheGlobal->enmPolicy = PDMBLKCACHEPOLICY_2Q;
+        else if (!RTStrICmp(pszPolicy, "ARC"))
+            pBlkCacheGlobal->enmPolicy = PDMBLKCACHEPOLICY_ARC;
+        else
+            rc = VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                            N_("Configuration error: \"CachePolicy\" must be either \"2Q\" or \"ARC\", got \"%s\""),
+                            pszPolicy);
+        MMR3HeapFree(pszPolicy);
+        if (RT_FAILURE(rc))
+            break;
 
         /** @todo r=aeichner: Experiment to find optimal default values */
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitIntervalMs", &pBlkCacheGlobal->u32CommitTimeoutMs, 10000 /* 10sec */);
         AssertLogRelRCBreak(rc);
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitThreshold", &pBlkCacheGlobal->cbCommitDirtyThreshold, pBlkCacheGlobal->cbMax / 2);
         AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitCoalesceMax", &pBlkCacheGlobal->cbCommitCoalesceMax, _1M);
+        AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheReadAheadDepth", &pBlkCacheGlobal->cbReadAheadDepth, _256K);
+        AssertLogRelRCBreak(rc);
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheReadAheadTrigger", &pBlkCacheGlobal->cReadAheadTrigger, 2);
+        AssertLogRelRCBreak(rc);
     } while (0);
 
+    if (RT_SUCCESS(rc))
+    {
+        pBlkCacheGlobal->paShards = (PPDMBLKCACHESHARD)RTMemAllocZ(pBlkCacheGlobal->cShards * sizeof(PDMBLKCACHESHARD));
+        if (!pBlkCacheGlobal->paShards)
+            rc = VERR_NO_MEMORY;
+    }
+
+    uint32_t cShardsInitialized = 0;
+    while (   RT_SUCCESS(rc)
+           && cShardsInitialized < pBlkCacheGlobal->cShards)
+    {
+        PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->paShards[cShardsInitialized];
+
+        pShard->pCache                 = pBlkCacheGlobal;
+        pShard->idxShard               = cShardsInitialized;
+        pShard->cbMax                  = pBlkCacheGlobal->cbMax / pBlkCacheGlobal->cShards;
+        pShard->cbRecentlyUsedOutMax   = (pShard->cbMax / 100) * 50; /* 50% of the buffer size */
+        if (pBlkCacheGlobal->enmPolicy == PDMBLKCACHEPOLICY_ARC)
+        {
+            /* The target is adapted on ghost hits, start with an even split. */
+            pShard->cbRecentlyUsedInMax    = pShard->cbMax / 2;
+            pShard->cbRecentlyUsedOutMax   = pShard->cbMax;
+            pShard->cbFrequentlyUsedOutMax = pShard->cbMax;
+        }
+        else
+            pShard->cbRecentlyUsedInMax    = (pShard->cbMax / 100) * 25; /* 25% of the buffer size */
+        LogFlowFunc(("Shard %u: cbMax=%u cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
+                     cShardsInitialized, pShard->cbMax, pShard->cbRecentlyUsedInMax, pShard->cbRecentlyUsedOutMax));
+
+        rc = RTCritSectInit(&pShard->CritSect);
+        if (RT_FAILURE(rc))
+            break;
+
+        STAMR3RegisterF(pVM, &pShard->cbCached,
+                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_BYTES, "Currently used cache",
+                        "/PDM/BlkCache/Shard%u/cbCached", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->cbRecentlyUsedInMax,
+                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_BYTES, "Target size of the MRU list",
+                        "/PDM/BlkCache/Shard%u/cbMruInTarget", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedIn.cbCached,
+                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_BYTES, "Number of bytes cached in MRU list",
+                        "/PDM/BlkCache/Shard%u/cbCachedMruIn", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedOut.cbCached,
+                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_BYTES, "Number of bytes cached in MRU ghost list",
+                        "/PDM/BlkCache/Shard%u/cbCachedMruOut", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsed.cbCached,
+                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_BYTES, "Number of bytes cached in FRU list",
+                        "/PDM/BlkCache/Shard%u/cbCachedFru", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsedOut.cbCached,
+                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_BYTES, "Number of bytes cached in FRU ghost list",
+                        "/PDM/BlkCache/Shard%u/cbCachedFruOut", cShardsInitialized);
+#ifdef VBOX_WITH_STATISTICS
+        STAMR3RegisterF(pVM, &pShard->StatHits,
+                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_COUNT, "Number of hits in the shard",
+                        "/PDM/BlkCache/Shard%u/Hits", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->StatMisses,
+                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_COUNT, "Number of misses in the shard",
+                        "/PDM/BlkCache/Shard%u/Misses", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->StatEvicted,
+                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_COUNT, "Number of entries evicted from the shard",
+                        "/PDM/BlkCache/Shard%u/Evicted", cShardsInitialized);
+        STAMR3RegisterF(pVM, &pShard->StatGhostHits,
+                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                        STAMUNIT_COUNT, "Number of hits in the ghost lists of the shard",
+                        "/PDM/BlkCache/Shard%u/GhostHits", cShardsInitialized);
+#endif
+        cShardsInitialized++;
+    }
+
     if (RT_SUCCESS(rc))
     {
         STAMR3Register(pVM, &pBlkCacheGlobal->cbMax,
@@ -1046,26 +1476,11 @@ int pdmR3BlkCacheInit(PVM pVM)
                        "/PDM/BlkCache/cbMax",
                        STAMUNIT_BYTES,
                        "Maximum cache size");
-        STAMR3Register(pVM, &pBlkCacheGlobal->cbCached,
+        STAMR3Register(pVM, (void *)&pBlkCacheGlobal->cbCached,
                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
                        "/PDM/BlkCache/cbCached",
                        STAMUNIT_BYTES,
                        "Currently used cache");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedIn.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruIn",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in MRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedOut.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruOut",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruFrequentlyUsed.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedFru",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU ghost list");
 
 #ifdef VBOX_WITH_STATISTICS
         STAMR3Register(pVM, &pBlkCacheGlobal->cHits,
@@ -1104,6 +1519,26 @@ int pdmR3BlkCacheInit(PVM pVM)
                        STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
                        "/PDM/BlkCache/CacheBuffersReused",
                        STAMUNIT_COUNT, "Number of times a buffer could be reused");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatReadAheadBytes,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/ReadAheadBytes",
+                       STAMUNIT_BYTES, "Number of bytes read ahead");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatReadAheadHits,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/ReadAheadHits",
+                       STAMUNIT_COUNT, "Number of read ahead entries accessed afterwards");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatReadAheadFailed,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/ReadAheadFailed",
+                       STAMUNIT_COUNT, "Number of read ahead transfers which failed");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatCommitCoalesced,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/CommitCoalesced",
+                       STAMUNIT_COUNT, "Number of coalesced writes issued during a commit");
+        STAMR3Register(pVM, &pBlkCacheGlobal->StatCommitCoalescedEntries,
+                       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                       "/PDM/BlkCache/CommitCoalescedEntries",
+                       STAMUNIT_COUNT, "Number of entries written by coalesced writes");
 #endif
 
         /* Initialize the critical section */
@@ -1130,8 +1565,13 @@ int pdmR3BlkCacheInit(PVM pVM)
             if (RT_SUCCESS(rc))
             {
                 LogRel(("BlkCache: Cache successfully initialised. Cache size is %u bytes\n", pBlkCacheGlobal->cbMax));
+                LogRel(("BlkCache: Cache uses %u shard(s) with the %s replacement policy\n", pBlkCacheGlobal->cShards,
+                        pBlkCacheGlobal->enmPolicy == PDMBLKCACHEPOLICY_ARC ? "ARC" : "2Q"));
                 LogRel(("BlkCache: Cache commit interval is %u ms\n", pBlkCacheGlobal->u32CommitTimeoutMs));
                 LogRel(("BlkCache: Cache commit threshold is %u bytes\n", pBlkCacheGlobal->cbCommitDirtyThreshold));
+                LogRel(("BlkCache: Cache coalesces up to %u bytes per commit write\n", pBlkCacheGlobal->cbCommitCoalesceMax));
+                LogRel(("BlkCache: Cache reads ahead %u bytes after %u matching requests\n",
+                        pBlkCacheGlobal->cbReadAheadDepth, pBlkCacheGlobal->cReadAheadTrigger));
                 pUVM->pdm.s.pBlkCacheGlobal = pBlkCacheGlobal;
                 return VINF_SUCCESS;
             }
@@ -1140,6 +1580,11 @@ int pdmR3BlkCacheInit(PVM pVM)
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
     }
 
+    while (cShardsInitialized > 0)
+        RTCritSectDelete(&pBlkCacheGlobal->paShards[--cShardsInitialized].CritSect);
+    if (pBlkCacheGlobal->paShards)
+        RTMemFree(pBlkCacheGlobal->paShards);
+
     if (pBlkCacheGlobal)
         RTMemFree(pBlkCacheGlobal);
 
@@ -1154,16 +1599,25 @@ void pdmR3BlkCacheTerm(PVM pVM)
     if (pBlkCacheGlobal)
     {
         /* Make sure no one else uses the cache now */
-        pdmBlkCacheLockEnter(pBlkCacheGlobal);
+        pdmBlkCacheLockEnterAll(pBlkCacheGlobal);
 
         /* Cleanup deleting all cache entries waiting for in progress entries to finish. */
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedIn);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedOut);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruFrequentlyUsed);
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->paShards[i];
 
-        pdmBlkCacheLockLeave(pBlkCacheGlobal);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedIn);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedOut);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsed);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsedOut);
+        }
+
+        pdmBlkCacheLockLeaveAll(pBlkCacheGlobal);
 
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+            RTCritSectDelete(&pBlkCacheGlobal->paShards[i].CritSect);
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
+        RTMemFree(pBlkCacheGlobal->paShards);
         RTMemFree(pBlkCacheGlobal);
         pVM->pUVM->pdm.s.pBlkCacheGlobal = NULL;
     }
@@ -1384,12 +1838,12 @@ static int pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *pvUser)
         /* Leave the locks to let the I/O thread make progress but reference the entry to prevent eviction. */
         pdmBlkCacheEntryRef(pEntry);
         RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
-        pdmBlkCacheLockLeave(pCache);
+        pdmBlkCacheLockLeaveAll(pCache);
 
         RTThreadSleep(250);
 
         /* Re-enter all locks */
-        pdmBlkCacheLockEnter(pCache);
+        pdmBlkCacheLockEnterAll(pCache);
         RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
         pdmBlkCacheEntryRelease(pEntry);
     }
@@ -1397,13 +1851,12 @@ static int pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *pvUser)
     AssertMsg(!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS),
                 ("Entry is dirty and/or still in progress fFlags=%#x\n", pEntry->fFlags));
 
-    bool fUpdateCache =    pEntry->pList == &pCache->LruFrequentlyUsed
-                        || pEntry->pList == &pCache->LruRecentlyUsedIn;
+    bool fUpdateCache = pdmBlkCacheEntryIsCached(pEntry);
 
     pdmBlkCacheEntryRemoveFromList(pEntry);
 
     if (fUpdateCache)
-        pdmBlkCacheSub(pCache, pEntry->cbData);
+        pdmBlkCacheSub(pEntry->pShard, pEntry->cbData);
 
     RTMemPageFree(pEntry->pbData, pEntry->cbData);
     RTMemFree(pEntry);
@@ -1430,7 +1883,7 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
         pdmBlkCacheCommit(pBlkCache);
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
-    pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheLockEnterAll(pCache);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
     RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
@@ -1440,7 +1893,7 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
     pCache->cRefs--;
     RTListNodeRemove(&pBlkCache->NodeCacheUser);
 
-    pdmBlkCacheLockLeave(pCache);
+    pdmBlkCacheLockLeaveAll(pCache);
 
     RTSemRWDestroy(pBlkCache->SemRWEntries);
 
@@ -1618,6 +2071,7 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryAlloc(PPDMBLKCACHE pBlkCache,
     pEntryNew->Core.Key      = off;
     pEntryNew->Core.KeyLast  = off + cbData - 1;
     pEntryNew->pBlkCache     = pBlkCache;
+    pEntryNew->pShard        = pdmBlkCacheShardGet(pBlkCache->pCache, pBlkCache, off);
     pEntryNew->fFlags        = 0;
     pEntryNew->cRefs         = 1; /* We are using it now. */
     pEntryNew->pList         = NULL;
@@ -1820,12 +2274,12 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
     *pcbData = pdmBlkCacheEntryBoundariesCalc(pBlkCache, off, (uint32_t)cb, &cbEntry);
     AssertReturn(cb <= UINT32_MAX, NULL);
 
-    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
-    pdmBlkCacheLockEnter(pCache);
+    PPDMBLKCACHESHARD pShard = pdmBlkCacheShardGet(pBlkCache->pCache, pBlkCache, off);
+    pdmBlkCacheShardLockEnter(pShard);
 
     PPDMBLKCACHEENTRY pEntryNew = NULL;
     uint8_t          *pbBuffer  = NULL;
-    bool fEnough = pdmBlkCacheReclaim(pCache, cbEntry, true, &pbBuffer);
+    bool fEnough = pdmBlkCacheReclaim(pShard, cbEntry, true, &pbBuffer);
     if (fEnough)
     {
         LogFlow(("Evicted enough bytes (%u requested). Creating new cache entry\n", cbEntry));
@@ -1833,9 +2287,10 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
         pEntryNew = pdmBlkCacheEntryAlloc(pBlkCache, off, cbEntry, pbBuffer);
         if (RT_LIKELY(pEntryNew))
         {
-            pdmBlkCacheEntryAddToList(&pCache->LruRecentlyUsedIn, pEntryNew);
-            pdmBlkCacheAdd(pCache, cbEntry);
-            pdmBlkCacheLockLeave(pCache);
+            Assert(pEntryNew->pShard == pShard);
+            pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntryNew);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
 
             pdmBlkCacheInsertEntry(pBlkCache, pEntryNew);
 
@@ -1844,10 +2299,10 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache,
                       ("Overflow in calculation off=%llu\n", off));
         }
         else
-            pdmBlkCacheLockLeave(pCache);
+            pdmBlkCacheShardLockLeave(pShard);
     }
     else
-        pdmBlkCacheLockLeave(pCache);
+        pdmBlkCacheShardLockLeave(pShard);
 
     return pEntryNew;
 }
@@ -1923,6 +2378,138 @@ static bool pdmBlkCacheReqUpdate(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEREQ pReq,
     return false;
 }
 
+/**
+ * Reads the given range into the cache skipping parts which are cached already.
+ *
+ * @returns nothing.
+ * @param   pBlkCache    The endpoint cache.
+ * @param   off          Start offset of the range.
+ * @param   cb           Size of the range.
+ */
+static void pdmBlkCacheReadAheadRange(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cb)
+{
+    /* Never read beyond the end of the medium. */
+    uint64_t cbMedium = ASMAtomicReadU64(&pBlkCache->cbMedium);
+    if (off >= cbMedium)
+        return;
+    cb = (size_t)RT_MIN(cb, cbMedium - off);
+
+    while (cb)
+    {
+        size_t cbThis = 0;
+        PPDMBLKCACHEENTRY pEntry = pdmBlkCacheGetCacheEntryByOffset(pBlkCache, off);
+
+        if (pEntry)
+        {
+            /* Cached already (or on a ghost list), skip it. */
+            cbThis = RT_MIN(pEntry->Core.KeyLast + 1 - off, cb);
+            pdmBlkCacheEntryRelease(pEntry);
+        }
+        else
+        {
+            pEntry = pdmBlkCacheEntryCreate(pBlkCache, off, RT_MIN(cb, PDMBLKCACHE_READ_AHEAD_ENTRY_MAX), &cbThis);
+            if (!pEntry)
+                break; /* Don't bother if there is no room, the guest will fetch the data itself. */
+
+            LogFlow(("Reading ahead %u bytes at off=%llu into entry %#p\n", pEntry->cbData, off, pEntry));
+            STAM_COUNTER_ADD(&pBlkCache->pCache->StatReadAheadBytes, pEntry->cbData);
+
+            pEntry->fFlags |= PDMBLKCACHE_ENTRY_READ_AHEAD;
+            pEntry->fReadAheadUnused = true;
+            pdmBlkCacheEntryReadFromMedium(pEntry);
+            pdmBlkCacheEntryRelease(pEntry); /* it is protected by the I/O in progress flag now. */
+        }
+
+        off += cbThis;
+        cb  -= cbThis;
+    }
+}
+
+/**
+ * Feeds a read request into the stream detector of the endpoint and reads
+ * ahead if a sequential or strided stream was detected.
+ *
+ * @returns nothing.
+ * @param   pBlkCache    The endpoint cache.
+ * @param   off          Start offset of the read request.
+ * @param   cbRead       Size of the read request.
+ */
+static void pdmBlkCacheReadAheadUpdate(PPDMBLKCACHE pBlkCache, uint64_t off, size_t cbRead)
+{
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    uint64_t offStart   = 0;
+    uint64_t offStride  = 0;
+    size_t   cbRange    = 0;
+    unsigned cRanges    = 0;
+
+    if (   !pCache->cbReadAheadDepth
+        || !cbRead
+        || !ASMAtomicReadU64(&pBlkCache->cbMedium)
+        || ASMAtomicReadBool(&pCache->fIoErrorVmSuspended))
+        return;
+
+    RTSpinlockAcquire(pBlkCache->LockList);
+
+    /* Only forward streams with a constant stride and request size are detected. */
+    if (   off > pBlkCache->ReadAhead.offLast
+        && off - pBlkCache->ReadAhead.offLast == pBlkCache->ReadAhead.offStride
+        && cbRead == pBlkCache->ReadAhead.cbLast)
+        pBlkCache->ReadAhead.cMatches++;
+    else
+    {
+        pBlkCache->ReadAhead.offStride       = off - pBlkCache->ReadAhead.offLast;
+        pBlkCache->ReadAhead.cMatches        = 0;
+        pBlkCache->ReadAhead.offReadAheadEnd = 0;
+    }
+    pBlkCache->ReadAhead.offLast = off;
+    pBlkCache->ReadAhead.cbLast  = cbRead;
+
+    if (pBlkCache->ReadAhead.cMatches >= pCache->cReadAheadTrigger)
+    {
+        offStride = pBlkCache->ReadAhead.offStride;
+
+        if (offStride <= cbRead)
+        {
+            /* Sequential, read the following range in one go. */
+            uint64_t offEnd = off + cbRead + pCache->cbReadAheadDepth;
+
+            offStart = RT_MAX(off + cbRead, pBlkCache->ReadAhead.offReadAheadEnd);
+            if (offStart < offEnd)
+            {
+                cbRange = (size_t)(offEnd - offStart);
+                cRanges = 1;
+                pBlkCache->ReadAhead.offReadAheadEnd = offEnd;
+            }
+        }
+        else
+        {
+            /* Strided, read the next blocks of the stream which are not read already. */
+            unsigned cBlocksMax = (unsigned)RT_MAX(pCache->cbReadAheadDepth / cbRead, 1);
+            unsigned cBlocks    = cBlocksMax;
+
+            offStart = off + offStride;
+            while (   cBlocks
+                   && offStart < pBlkCache->ReadAhead.offReadAheadEnd)
+            {
+                offStart += offStride;
+                cBlocks--;
+            }
+
+            if (cBlocks)
+            {
+                cbRange = cbRead;
+                cRanges = cBlocks;
+                pBlkCache->ReadAhead.offReadAheadEnd = off + cBlocksMax * offStride + cbRead;
+            }
+        }
+    }
+
+    RTSpinlockRelease(pBlkCache->LockList);
+
+    for (unsigned i = 0; i < cRanges; i++)
+        pdmBlkCacheReadAheadRange(pBlkCache, offStart + i * offStride, cbRange);
+}
+
 VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                                  PCRTSGBUF pcSgBuf, size_t cbRead, void *pvUser)
 {
@@ -1948,6 +2535,9 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
     /* Increment data transfer counter to keep the request valid while we access it. */
     ASMAtomicIncU32(&pReq->cXfersPending);
 
+    uint64_t const offReq = off;
+    size_t const   cbReq  = cbRead;
+
     while (cbRead)
     {
         size_t cbToRead;
@@ -1990,10 +2580,17 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 
             STAM_COUNTER_ADD(&pCache->StatRead, cbToRead);
 
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (pdmBlkCacheEntryIsCached(pEntry))
             {
+                STAM_COUNTER_INC(&pShard->StatHits);
+#ifdef VBOX_WITH_STATISTICS
+                if (ASMAtomicXchgBool(&pEntry->fReadAheadUnused, false))
+                    STAM_COUNTER_INC(&pCache->StatReadAheadHits);
+#endif
+
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
                                                               PDMBLKCACHE_ENTRY_IO_IN_PROGRESS,
                                                               PDMBLKCACHE_ENTRY_IS_DIRTY))
@@ -2004,6 +2601,13 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                                                false /* fWrite */);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
                 }
+                else if (RT_UNLIKELY(ASMAtomicReadU32(&pEntry->fFlags) & PDMBLKCACHE_ENTRY_INVALID))
+                {
+                    /* The read-ahead for this entry failed, go to the medium directly. */
+                    pdmBlkCacheRequestPassthrough(pBlkCache, pReq,
+                                                  &SgBuf, off, cbToRead,
+                                                  PDMBLKCACHEXFERDIR_READ);
+                }
                 else
                 {
                     /* Read as much as we can from the entry. */
@@ -2011,12 +2615,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                 }
 
                 /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                pdmBlkCacheEntryHit(pShard, pEntry);
                 /* Release the entry */
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2026,16 +2625,17 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 
                 LogFlow(("Fetching data for ghost entry %#p from file\n", pEntry));
 
-                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheShardLockEnter(pShard);
+                pdmBlkCacheArcAdapt(pShard, pEntry->pList, pEntry->cbData);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pShard, pEntry->cbData, true, &pbBuffer);
 
                 /* Move the entry to Am and fetch it to the cache. */
                 if (fEnough)
                 {
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
@@ -2058,7 +2658,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
 
@@ -2084,6 +2684,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_COUNTER_INC(&pCache->cMisses);
                 else
                     STAM_COUNTER_INC(&pCache->cPartialHits);
+                STAM_COUNTER_INC(&pEntryNew->pShard->StatMisses);
 
                 pdmBlkCacheEntryWaitersAdd(pEntryNew, pReq,
                                            &SgBuf,
@@ -2131,6 +2732,9 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
         off += cbToRead;
     }
 
+    /* Issue the read-ahead after the request so the guest data is fetched first. */
+    pdmBlkCacheReadAheadUpdate(pBlkCache, offReq, cbReq);
+
     if (!pdmBlkCacheReqUpdate(pBlkCache, pReq, rc, false))
         rc = VINF_AIO_TASK_PENDING;
 
@@ -2190,10 +2794,13 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
 
             STAM_COUNTER_ADD(&pCache->StatWritten, cbToWrite);
 
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (pdmBlkCacheEntryIsCached(pEntry))
             {
+                STAM_COUNTER_INC(&pShard->StatHits);
+
                 /* Check if the entry is dirty. */
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
                                                               PDMBLKCACHE_ENTRY_IS_DIRTY,
@@ -2229,6 +2836,13 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                         STAM_COUNTER_INC(&pBlkCache->StatWriteDeferred);
                         RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
                     }
+                    else if (RT_UNLIKELY(ASMAtomicReadU32(&pEntry->fFlags) & PDMBLKCACHE_ENTRY_INVALID))
+                    {
+                        /* The entry doesn't hold valid data which could be written back. */
+                        pdmBlkCacheRequestPassthrough(pBlkCache, pReq,
+                                                      &SgBuf, off, cbToWrite,
+                                                      PDMBLKCACHEXFERDIR_WRITE);
+                    }
                     else /* I/O in progress flag not set */
                     {
                         /* Write as much as we can into the entry and update the file. */
@@ -2241,12 +2855,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                 } /* Dirty bit not set */
 
                 /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
-                {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
-                }
+                pdmBlkCacheEntryHit(pShard, pEntry);
 
                 pdmBlkCacheEntryRelease(pEntry);
             }
@@ -2254,16 +2863,17 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
             {
                 uint8_t *pbBuffer = NULL;
 
-                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheShardLockEnter(pShard);
+                pdmBlkCacheArcAdapt(pShard, pEntry->pList, pEntry->cbData);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pShard, pEntry->cbData, true, &pbBuffer);
 
                 if (fEnough)
                 {
                     /* Move the entry to Am and fetch it to the cache. */
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
@@ -2288,7 +2898,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
                     pdmBlkCacheRequestPassthrough(pBlkCache, pReq,
@@ -2314,6 +2924,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off,
                 uint64_t offDiff = off - pEntryNew->Core.Key;
 
                 STAM_COUNTER_INC(&pCache->cHits);
+                STAM_COUNTER_INC(&pEntryNew->pShard->StatMisses);
 
                 /*
                  * Check if it is possible to just write the data without waiting
@@ -2439,9 +3050,10 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
 
                 cbThisDiscard = RT_MIN(pEntry->cbData - offDiff, cbLeft);
 
+                PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
                 /* Ghost lists contain no data. */
-                if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                    || (pEntry->pList == &pCache->LruFrequentlyUsed))
+                if (pdmBlkCacheEntryIsCached(pEntry))
                 {
                     /* Check if the entry is dirty. */
                     if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
@@ -2451,14 +3063,14 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         /* If it is dirty but not yet in progress remove it. */
                         if (!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS))
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
 
                             STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
                             RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2497,7 +3109,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         }
                         else /* I/O in progress flag not set */
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
 
                             RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2506,7 +3118,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                             RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2514,7 +3126,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                 }
                 else /* Entry is on the ghost list just remove cache entry. */
                 {
-                    pdmBlkCacheLockEnter(pCache);
+                    pdmBlkCacheShardLockEnter(pShard);
                     pdmBlkCacheEntryRemoveFromList(pEntry);
 
                     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2523,7 +3135,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pShard);
 
                     RTMemFree(pEntry);
                 }
@@ -2565,10 +3177,50 @@ static PPDMBLKCACHEWAITER pdmBlkCacheWaiterComplete(PPDMBLKCACHE pBlkCache,
     return pNext;
 }
 
-static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEIOXFER hIoXfer, int rcIoXfer)
+/**
+ * Drops an entry whose read-ahead failed from the cache if nobody else references it.
+ *
+ * @returns nothing.
+ * @param   pBlkCache    The endpoint cache the entry belongs to.
+ * @param   pEntry       The entry to drop, the caller's reference is released.
+ */
+static void pdmBlkCacheEntryDropInvalid(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY pEntry)
+{
+    PPDMBLKCACHESHARD pShard = pEntry->pShard;
+
+    pdmBlkCacheShardLockEnter(pShard);
+    RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
+
+    /* Entries still referenced are evicted later, users will see the invalid flag. */
+    if (   ASMAtomicReadU32(&pEntry->cRefs) == 1
+        && (pEntry->fFlags & ~PDMBLKCACHE_ENTRY_READ_AHEAD) == PDMBLKCACHE_ENTRY_INVALID
+        && pdmBlkCacheEntryIsCached(pEntry))
+    {
+        pdmBlkCacheEntryRemoveFromList(pEntry);
+        pdmBlkCacheSub(pShard, pEntry->cbData);
+
+        STAM_PROFILE_ADV_START(&pBlkCache->pCache->StatTreeRemove, Cache);
+        RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
+        STAM_PROFILE_ADV_STOP(&pBlkCache->pCache->StatTreeRemove, Cache);
+
+        RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+        pdmBlkCacheShardLockLeave(pShard);
+
+        RTMemPageFree(pEntry->pbData, pEntry->cbData);
+        RTMemFree(pEntry);
+        return;
+    }
+
+    pdmBlkCacheEntryRelease(pEntry);
+    RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheShardLockLeave(pShard);
+}
+
+static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEENTRY pEntry,
+                                           PDMBLKCACHEXFERDIR enmXferDir, int rcIoXfer)
 {
-    PPDMBLKCACHEENTRY  pEntry    = hIoXfer->pEntry;
     PPDMBLKCACHEGLOBAL pCache    = pBlkCache->pCache;
+    bool               fInvalid  = false;
 
     /* Reference the entry now as we are clearing the I/O in progress flag
      * which protected the entry till now. */
@@ -2587,7 +3239,7 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
     pEntry->pWaitingTail = NULL;
     pEntry->pWaitingHead = NULL;
 
-    if (hIoXfer->enmXferDir == PDMBLKCACHEXFERDIR_WRITE)
+    if (enmXferDir == PDMBLKCACHEXFERDIR_WRITE)
     {
         /*
          * An error here is difficult to handle as the original request completed already.
@@ -2627,10 +3279,24 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
     }
     else
     {
-        AssertMsg(hIoXfer->enmXferDir == PDMBLKCACHEXFERDIR_READ, ("Invalid transfer type\n"));
+        AssertMsg(enmXferDir == PDMBLKCACHEXFERDIR_READ, ("Invalid transfer type\n"));
         AssertMsg(!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY),
                   ("Invalid flags set\n"));
 
+        /*
+         * A failed read-ahead is not an error for anyone, it might just have crossed the end
+         * of the medium. The entry is marked invalid and the waiters are passed through below.
+         */
+        if (   RT_FAILURE(rcIoXfer)
+            && (pEntry->fFlags & PDMBLKCACHE_ENTRY_READ_AHEAD))
+        {
+            LogFlow(("Read-ahead for entry %#p failed with %Rrc\n", pEntry, rcIoXfer));
+            STAM_COUNTER_INC(&pCache->StatReadAheadFailed);
+            pEntry->fFlags |= PDMBLKCACHE_ENTRY_INVALID;
+            fInvalid = true;
+            pCurr    = NULL;
+        }
+
         while (pCurr)
         {
             if (pCurr->fWrite)
@@ -2652,11 +3318,28 @@ static void pdmBlkCacheIoXferCompleteEntry(PPDMBLKCACHE pBlkCache, PPDMBLKCACHEI
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
     /* Dereference so that it isn't protected anymore except we issued anyother write for it. */
-    pdmBlkCacheEntryRelease(pEntry);
+    if (!fInvalid)
+        pdmBlkCacheEntryRelease(pEntry);
 
     if (fCommit)
         pdmBlkCacheCommitDirtyEntries(pCache);
 
+    if (fInvalid)
+    {
+        /* Pass the waiters through to the medium, the transfer holds a reference to the request. */
+        while (pComplete)
+        {
+            pdmBlkCacheRequestPassthrough(pBlkCache, pComplete->pReq, &pComplete->SgBuf,
+                                          pEntry->Core.Key + pComplete->offCacheEntry, pComplete->cbTransfer,
+                                            pComplete->fWrite
+                                          ? PDMBLKCACHEXFERDIR_WRITE
+                                          : PDMBLKCACHEXFERDIR_READ);
+            pComplete = pdmBlkCacheWaiterComplete(pBlkCache, pComplete, VINF_SUCCESS);
+        }
+
+        pdmBlkCacheEntryDropInvalid(pBlkCache, pEntry);
+    }
+
     /* Complete waiters now. */
     while (pComplete)
         pComplete = pdmBlkCacheWaiterComplete(pBlkCache, pComplete, rcIoXfer);
@@ -2667,7 +3350,17 @@ VMMR3DECL(void) PDMR3BlkCacheIoXferComplete(PPDMBLKCACHE pBlkCache, PPDMBLKCACHE
     LogFlowFunc(("pBlkCache=%#p hIoXfer=%#p rcIoXfer=%Rrc\n", pBlkCache, hIoXfer, rcIoXfer));
 
     if (hIoXfer->fIoCache)
-        pdmBlkCacheIoXferCompleteEntry(pBlkCache, hIoXfer, rcIoXfer);
+    {
+        if (hIoXfer->cEntries)
+        {
+            /* Coalesced write, complete every entry on its own. */
+            for (uint32_t i = 0; i < hIoXfer->cEntries; i++)
+                pdmBlkCacheIoXferCompleteEntry(pBlkCache, hIoXfer->papEntries[i], hIoXfer->enmXferDir, rcIoXfer);
+            RTMemFree(hIoXfer->papEntries);
+        }
+        else
+            pdmBlkCacheIoXferCompleteEntry(pBlkCache, hIoXfer->pEntry, hIoXfer->enmXferDir, rcIoXfer);
+    }
     else
         pdmBlkCacheReqUpdate(pBlkCache, hIoXfer->pReq, rcIoXfer, true);
     RTMemFree(hIoXfer);
@@ -2725,6 +3418,12 @@ VMMR3DECL(int) PDMR3BlkCacheSuspend(PPDMBLKCACHE pBlkCache)
     return rc;
 }
 
+VMMR3DECL(void) PDMR3BlkCacheSetMediumSize(PPDMBLKCACHE pBlkCache, uint64_t cbMedium)
+{
+    AssertPtrReturnVoid(pBlkCache);
+    ASMAtomicWriteU64(&pBlkCache->cbMedium, cbMedium);
+}
+
 VMMR3DECL(int) PDMR3BlkCacheResume(PPDMBLKCACHE pBlkCache)
 {
     LogFlowFunc(("pBlkCache=%#p\n", pBlkCache));
@@ -2750,12 +3449,12 @@ VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache)
         pdmBlkCacheCommit(pBlkCache);
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
-    pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheLockEnterAll(pCache);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
     RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-    pdmBlkCacheLockLeave(pCache);
+    pdmBlkCacheLockLeaveAll(pCache);
     return rc;
 }
 
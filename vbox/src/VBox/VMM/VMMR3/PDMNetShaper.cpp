@@ -36,6 +36,7 @@
 #include <iprt/thread.h>
 #include <iprt/mem.h>
 #include <iprt/critsect.h>
+#include <iprt/semaphore.h>
 #include <iprt/tcp.h>
 #include <iprt/path.h>
 #include <iprt/string.h>
@@ -59,6 +60,8 @@ typedef struct PDMNETSHAPER
     RTCRITSECT               Lock;
     /** Pending TX thread. */
     PPDMTHREAD               pTxThread;
+    /** Event semaphore the TX thread sleeps on between refills. */
+    RTSEMEVENT               hEvtTxWakeUp;
     /** Pointer to the first bandwidth group. */
     PPDMNSBWGROUP            pBwGroupsHead;
 } PDMNETSHAPER;
@@ -134,18 +137,31 @@ static void pdmNsBwGroupUnlink(PPDMNSBWGROUP pBwGroup)
 #endif
 
 
+/* Every bucket must be able to hold the largest frame a filter may ask for. */
+AssertCompile(PDM_NETSHAPER_MIN_BUCKET_SIZE >= VBOX_MAX_GSO_SIZE);
+
 static void pdmNsBwGroupSetLimit(PPDMNSBWGROUP pBwGroup, uint64_t cbPerSecMax)
 {
     pBwGroup->cbPerSecMax = cbPerSecMax;
-    pBwGroup->cbBucket    = RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, cbPerSecMax * PDM_NETSHAPER_MAX_LATENCY / 1000);
+    if (pBwGroup->cbBurst)
+    {
+        /* A bucket smaller than the largest transfer (a GSO frame) could never
+           fill up far enough and would stall the group and everything below it. */
+        Assert(pBwGroup->cbBurst >= PDM_NETSHAPER_MIN_BUCKET_SIZE);
+        pBwGroup->cbBucket = RT_MAX(pBwGroup->cbBurst, PDM_NETSHAPER_MIN_BUCKET_SIZE);
+    }
+    else
+        pBwGroup->cbBucket = (uint32_t)RT_MIN(RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, cbPerSecMax * PDM_NETSHAPER_MAX_LATENCY / 1000),
+                                              UINT32_MAX / 2);
     LogFlow(("pdmNsBwGroupSetLimit: New rate limit is %llu bytes per second, adjusted bucket size to %u bytes\n",
              pBwGroup->cbPerSecMax, pBwGroup->cbBucket));
 }
 
 
-static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uint64_t cbPerSecMax)
+static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uint64_t cbPerSecMax, uint32_t cbBurst)
 {
-    LogFlow(("pdmNsBwGroupCreate: pShaper=%#p pszBwGroup=%#p{%s} cbPerSecMax=%llu\n", pShaper, pszBwGroup, pszBwGroup, cbPerSecMax));
+    LogFlow(("pdmNsBwGroupCreate: pShaper=%#p pszBwGroup=%#p{%s} cbPerSecMax=%llu cbBurst=%u\n",
+             pShaper, pszBwGroup, pszBwGroup, cbPerSecMax, cbBurst));
 
     AssertPtrReturn(pShaper, VERR_INVALID_POINTER);
     AssertPtrReturn(pszBwGroup, VERR_INVALID_POINTER);
@@ -166,13 +182,24 @@ static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uin
                 if (pBwGroup->pszNameR3)
                 {
                     pBwGroup->pShaperR3             = pShaper;
+                    pBwGroup->pParentR3             = NULL;
+                    pBwGroup->pParentR0             = NIL_RTR0PTR;
                     pBwGroup->cRefs                 = 0;
+                    pBwGroup->cbBurst               = cbBurst;
 
                     pdmNsBwGroupSetLimit(pBwGroup, cbPerSecMax);
 
                     pBwGroup->cbTokensLast          = pBwGroup->cbBucket;
                     pBwGroup->tsUpdatedLast         = RTTimeSystemNanoTS();
 
+                    PVM pVM = pShaper->pVM;
+                    STAMR3RegisterF(pVM, &pBwGroup->StatThrottled, STAMTYPE_PROFILE, STAMVISIBILITY_USED, STAMUNIT_NS_PER_OCCURENCE,
+                                    "Time filters were choked before being woken up.", "/PDM/NetShaper/%s/Throttled", pszBwGroup);
+                    STAMR3RegisterF(pVM, &pBwGroup->StatDenied, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                                    "Number of denied allocations.", "/PDM/NetShaper/%s/Denied", pszBwGroup);
+                    STAMR3RegisterF(pVM, &pBwGroup->StatWakeUps, STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                                    "Number of filters woken up.", "/PDM/NetShaper/%s/WakeUps", pszBwGroup);
+
                     LogFlowFunc(("pszBwGroup={%s} cbBucket=%u\n",
                                  pszBwGroup, pBwGroup->cbBucket));
                     pdmNsBwGroupLink(pBwGroup);
@@ -193,9 +220,44 @@ static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uin
 }
 
 
+/**
+ * Makes a bandwidth group a child of another one.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND if the parent doesn't exist.
+ * @retval  VERR_INVALID_PARAMETER if this would create a loop or nest the
+ *          groups deeper than PDM_NETSHAPER_MAX_DEPTH.
+ * @param   pShaper         The shaper.
+ * @param   pszBwGroup      The name of the child group.
+ * @param   pszParent       The name of the parent group.
+ */
+static int pdmNsBwGroupSetParent(PPDMNETSHAPER pShaper, const char *pszBwGroup, const char *pszParent)
+{
+    PPDMNSBWGROUP pBwGroup = pdmNsBwGroupFindById(pShaper, pszBwGroup);
+    PPDMNSBWGROUP pParent  = pdmNsBwGroupFindById(pShaper, pszParent);
+    if (!pBwGroup || !pParent)
+        return VERR_NOT_FOUND;
+
+    /* The depth of the parent's chain plus our own must stay within the limit,
+       and we must not show up in it. */
+    unsigned cDepth = 1;
+    for (PPDMNSBWGROUP pCur = pParent; pCur; pCur = pCur->pParentR3)
+        if (pCur == pBwGroup || ++cDepth > PDM_NETSHAPER_MAX_DEPTH)
+            return VERR_INVALID_PARAMETER;
+
+    pBwGroup->pParentR3 = pParent;
+    pBwGroup->pParentR0 = MMHyperR3ToR0(pShaper->pVM, pParent);
+    return VINF_SUCCESS;
+}
+
+
 static void pdmNsBwGroupTerminate(PPDMNSBWGROUP pBwGroup)
 {
     Assert(pBwGroup->cRefs == 0);
+    PVM pVM = pBwGroup->pShaperR3->pVM;
+    STAMR3Deregister(pVM, &pBwGroup->StatThrottled);
+    STAMR3Deregister(pVM, &pBwGroup->StatDenied);
+    STAMR3Deregister(pVM, &pBwGroup->StatWakeUps);
     if (PDMCritSectIsInitialized(&pBwGroup->Lock))
         PDMR3CritSectDelete(&pBwGroup->Lock);
 }
@@ -214,7 +276,100 @@ DECLINLINE(void) pdmNsBwGroupUnref(PPDMNSBWGROUP pBwGroup)
 }
 
 
-static void pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup)
+/**
+ * Gets the number of bytes a group and its parents can still let thru in the
+ * current TX thread pass.
+ *
+ * @returns Number of bytes, UINT32_MAX if no group in the chain is limited.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   tsNow           The timestamp of the pass.
+ */
+static uint32_t pdmNsBwGroupGetBudget(PPDMNSBWGROUP pBwGroup, uint64_t tsNow)
+{
+    uint32_t cbBudget = UINT32_MAX;
+    for (PPDMNSBWGROUP pCur = pBwGroup; pCur; pCur = pCur->pParentR3)
+        if (pCur->cbPerSecMax)
+        {
+            uint32_t cbTokens = pdmNsBwGroupGetTokens(pCur, tsNow);
+            cbBudget = RT_MIN(cbBudget, cbTokens - RT_MIN(cbTokens, pCur->cbReserved));
+        }
+    return cbBudget;
+}
+
+
+/**
+ * Calculates how long it takes until a group and its parents have refilled
+ * enough to let a transfer thru.
+ *
+ * @returns Nanoseconds, 0 if the transfer can go ahead right away.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   tsNow           The timestamp of the pass.
+ * @param   cbTransfer      The size of the transfer.
+ */
+static uint64_t pdmNsBwGroupNsUntilAvail(PPDMNSBWGROUP pBwGroup, uint64_t tsNow, uint32_t cbTransfer)
+{
+    uint64_t cNsWait = 0;
+    for (PPDMNSBWGROUP pCur = pBwGroup; pCur; pCur = pCur->pParentR3)
+    {
+        uint64_t cbPerSecMax = pCur->cbPerSecMax;
+        if (cbPerSecMax)
+        {
+            uint32_t cbTokens = pdmNsBwGroupGetTokens(pCur, tsNow);
+            uint32_t cbAvail  = cbTokens - RT_MIN(cbTokens, pCur->cbReserved);
+            if (cbTransfer > cbAvail)
+                cNsWait = RT_MAX(cNsWait, (uint64_t)(cbTransfer - cbAvail) * RT_NS_1SEC / cbPerSecMax);
+        }
+    }
+    return cNsWait;
+}
+
+
+/**
+ * Wakes up a choked filter and reserves the bytes it asked for in its group
+ * and the parents, so the rest of the pass doesn't hand them out again.
+ *
+ * @param   pBwGroup        The group the filter is attached to.
+ * @param   pFilter         The filter.
+ * @param   cbWanted        The number of bytes the filter wants to transmit.
+ * @param   tsNow           The timestamp of the pass.
+ */
+static void pdmNsFilterWakeUp(PPDMNSBWGROUP pBwGroup, PPDMNSFILTER pFilter, uint32_t cbWanted, uint64_t tsNow)
+{
+    if (!ASMAtomicXchgBool(&pFilter->fChoked, false))
+        return;
+
+    pFilter->cbCredit -= RT_MIN(pFilter->cbCredit, cbWanted);
+    for (PPDMNSBWGROUP pCur = pBwGroup; pCur; pCur = pCur->pParentR3)
+        if (pCur->cbPerSecMax)
+            pCur->cbReserved += cbWanted;
+
+    uint64_t tsChoked = ASMAtomicReadU64(&pFilter->tsChoked);
+    STAM_REL_PROFILE_ADD_PERIOD(&pBwGroup->StatThrottled, tsNow > tsChoked ? tsNow - tsChoked : 0);
+    STAM_REL_COUNTER_INC(&pBwGroup->StatWakeUps);
+
+    if (pFilter->pIDrvNetR3)
+    {
+        LogFlowFunc(("Calling pfnXmitPending for pFilter=%#p cbWanted=%u\n", pFilter, cbWanted));
+        pFilter->pIDrvNetR3->pfnXmitPending(pFilter->pIDrvNetR3);
+    }
+}
+
+
+/**
+ * Wakes up the choked filters of a group which can transmit now.
+ *
+ * The bytes available to the group in this pass are split among the choked
+ * filters according to their weights and accumulated as credit.  A filter is
+ * only woken up once its credit covers the transfer it was denied and the
+ * group and its parents have the tokens for it.  The starting point rotates
+ * between passes so equally weighted filters take turns.
+ *
+ * @returns Nanoseconds until the TX thread should look at the group again,
+ *          UINT64_MAX if none of its filters is choked.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   tsNow           The timestamp of the pass.
+ */
+static uint64_t pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup, uint64_t tsNow)
 {
     /*
      * We don't need to hold the bandwidth group lock to iterate over the list
@@ -224,27 +379,75 @@ static void pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup)
     AssertPtr(pBwGroup);
     AssertPtr(pBwGroup->pShaperR3);
     Assert(RTCritSectIsOwner(&pBwGroup->pShaperR3->Lock));
-    //LOCK_NETSHAPER(pShaper);
 
-    /* Check if the group is disabled. */
-    if (pBwGroup->cbPerSecMax == 0)
-        return;
-
-    PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3;
-    while (pFilter)
-    {
-        bool fChoked = ASMAtomicXchgBool(&pFilter->fChoked, false);
-        Log3((LOG_FN_FMT ": pFilter=%#p fChoked=%RTbool\n", __PRETTY_FUNCTION__, pFilter, fChoked));
-        if (fChoked && pFilter->pIDrvNetR3)
+    uint32_t cChoked      = 0;
+    uint64_t uWeightTotal = 0;
+    for (PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3; pFilter; pFilter = pFilter->pNextR3)
+        if (ASMAtomicReadBool(&pFilter->fChoked))
         {
-            LogFlowFunc(("Calling pfnXmitPending for pFilter=%#p\n", pFilter));
-            pFilter->pIDrvNetR3->pfnXmitPending(pFilter->pIDrvNetR3);
+            cChoked++;
+            uWeightTotal += RT_MAX(pFilter->uWeight, 1);
         }
+    if (!cChoked)
+        return UINT64_MAX;
+
+    uint32_t const cbBudget = pdmNsBwGroupGetBudget(pBwGroup, tsNow);
+    uint32_t const iStart   = pBwGroup->iRoundRobin++ % cChoked;
+    uint64_t       cNsNext  = UINT64_MAX;
+    bool           fWokeUp  = false;
+    PPDMNSFILTER   pBest    = NULL;
+    Log3((LOG_FN_FMT ": pBwGroup=%#p{%s} cChoked=%u cbBudget=%u\n", __PRETTY_FUNCTION__,
+          pBwGroup, pBwGroup->pszNameR3, cChoked, cbBudget));
+
+    for (unsigned iLap = 0; iLap < 2; iLap++)
+    {
+        uint32_t iChoked = 0;
+        for (PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3; pFilter; pFilter = pFilter->pNextR3)
+        {
+            if (!ASMAtomicReadBool(&pFilter->fChoked))
+                continue;
+            bool fThisLap = iLap == 0 ? iChoked >= iStart : iChoked < iStart;
+            iChoked++;
+            if (!fThisLap)
+                continue;
+
+            uint32_t cbWanted = ASMAtomicReadU32(&pFilter->cbWanted);
+            if (cbBudget == UINT32_MAX)
+            {
+                /* Nothing above us is limited. */
+                pdmNsFilterWakeUp(pBwGroup, pFilter, cbWanted, tsNow);
+                fWokeUp = true;
+                continue;
+            }
+
+            uint64_t cbShare = (uint64_t)cbBudget * RT_MAX(pFilter->uWeight, 1) / uWeightTotal;
+            pFilter->cbCredit = (uint32_t)RT_MIN(pFilter->cbCredit + cbShare, RT_MAX(cbBudget, cbWanted));
 
-        pFilter = pFilter->pNextR3;
+            uint64_t cNsWait = pdmNsBwGroupNsUntilAvail(pBwGroup, tsNow, cbWanted);
+            if (!cNsWait && pFilter->cbCredit >= cbWanted)
+            {
+                pdmNsFilterWakeUp(pBwGroup, pFilter, cbWanted, tsNow);
+                fWokeUp = true;
+                continue;
+            }
+
+            if (   !cNsWait
+                && (   !pBest
+                    || (uint64_t)pFilter->cbCredit * RT_MAX(pBest->uWeight, 1)
+                       > (uint64_t)pBest->cbCredit * RT_MAX(pFilter->uWeight, 1)))
+                pBest = pFilter;
+            cNsNext = RT_MIN(cNsNext, RT_MAX(cNsWait, RT_NS_1MS));
+        }
     }
 
-    //UNLOCK_NETSHAPER(pShaper);
+    /*
+     * Don't let the bandwidth go to waste if the tokens would cover somebody
+     * but nobody has enough credit yet: wake up the one closest to it.
+     */
+    if (!fWokeUp && pBest)
+        pdmNsFilterWakeUp(pBwGroup, pBest, ASMAtomicReadU32(&pBest->cbWanted), tsNow);
+
+    return cNsNext;
 }
 
 
@@ -415,17 +618,28 @@ static DECLCALLBACK(int) pdmR3NsTxThread(PVM pVM, PPDMTHREAD pThread)
     LogFlow(("pdmR3NsTxThread: pShaper=%p\n", pShaper));
     while (pThread->enmState == PDMTHREADSTATE_RUNNING)
     {
-        RTThreadSleep(PDM_NETSHAPER_MAX_LATENCY);
-
-        /* Go over all bandwidth groups/filters calling pfnXmitPending */
+        /*
+         * Go over all bandwidth groups waking up the filters which can
+         * transmit, and find out when the next one will be able to.
+         */
+        uint64_t cNsNext = UINT64_MAX;
         LOCK_NETSHAPER(pShaper);
-        PPDMNSBWGROUP pBwGroup = pShaper->pBwGroupsHead;
-        while (pBwGroup)
-        {
-            pdmNsBwGroupXmitPending(pBwGroup);
-            pBwGroup = pBwGroup->pNextR3;
-        }
+        uint64_t tsNow = RTTimeSystemNanoTS();
+        for (PPDMNSBWGROUP pBwGroup = pShaper->pBwGroupsHead; pBwGroup; pBwGroup = pBwGroup->pNextR3)
+            pBwGroup->cbReserved = 0;
+        for (PPDMNSBWGROUP pBwGroup = pShaper->pBwGroupsHead; pBwGroup; pBwGroup = pBwGroup->pNextR3)
+            cNsNext = RT_MIN(cNsNext, pdmNsBwGroupXmitPending(pBwGroup, tsNow));
         UNLOCK_NETSHAPER(pShaper);
+
+        /*
+         * Sleep until the earliest refill that lets a choked filter go.  Filters
+         * getting choked meanwhile are picked up after PDM_NETSHAPER_MAX_LATENCY
+         * at the latest.
+         */
+        RTMSINTERVAL cMsWait = PDM_NETSHAPER_MAX_LATENCY;
+        if (cNsNext < (uint64_t)PDM_NETSHAPER_MAX_LATENCY * RT_NS_1MS)
+            cMsWait = (RTMSINTERVAL)RT_MAX((cNsNext + RT_NS_1MS - 1) / RT_NS_1MS, 1);
+        RTSemEventWait(pShaper->hEvtTxWakeUp, cMsWait);
     }
     return VINF_SUCCESS;
 }
@@ -438,8 +652,7 @@ static DECLCALLBACK(int) pdmR3NsTxWakeUp(PVM pVM, PPDMTHREAD pThread)
 {
     PPDMNETSHAPER pShaper = (PPDMNETSHAPER)pThread->pvUser;
     LogFlow(("pdmR3NsTxWakeUp: pShaper=%p\n", pShaper));
-    /* Nothing to do */
-    return VINF_SUCCESS;
+    return RTSemEventSignal(pShaper->hEvtTxWakeUp);
 }
 
 
@@ -469,6 +682,7 @@ int pdmR3NetShaperTerm(PVM pVM)
         MMHyperFree(pVM, pFree);
     }
 
+    RTSemEventDestroy(pShaper->hEvtTxWakeUp);
     RTCritSectDelete(&pShaper->Lock);
     return VINF_SUCCESS;
 }
@@ -477,6 +691,15 @@ int pdmR3NetShaperTerm(PVM pVM)
 /**
  * Initialize the network shaper.
  *
+ * The bandwidth groups are configured under PDM/NetworkShaper/BwGroups/<name>/:
+ *  - Max:      The rate limit in bytes per second, 0 for unlimited.
+ *  - Burst:    Optional bucket size in bytes.  Defaults to what the rate lets
+ *              thru in PDM_NETSHAPER_MAX_LATENCY ms.  Either way it is at
+ *              least PDM_NETSHAPER_MIN_BUCKET_SIZE so that a full GSO frame
+ *              (VBOX_MAX_GSO_SIZE) always fits, smaller values are raised.
+ *  - Parent:   Optional name of the group this group is nested in.  Traffic
+ *              counts against the limits of the group and all its parents.
+ *
  * @returns VBox status code
  * @param   pVM Pointer to the VM.
  */
@@ -504,6 +727,7 @@ int pdmR3NetShaperInit(PVM pVM)
                 for (PCFGMNODE pCur = CFGMR3GetFirstChild(pCfgBwGrp); pCur; pCur = CFGMR3GetNextChild(pCur))
                 {
                     uint64_t cbMax;
+                    uint32_t cbBurst;
                     size_t cbName = CFGMR3GetNameLen(pCur) + 1;
                     char *pszBwGrpId = (char *)RTMemAllocZ(cbName);
 
@@ -519,15 +743,50 @@ int pdmR3NetShaperInit(PVM pVM)
                     if (RT_SUCCESS(rc))
                         rc = CFGMR3QueryU64(pCur, "Max", &cbMax);
                     if (RT_SUCCESS(rc))
-                        rc = pdmNsBwGroupCreate(pShaper, pszBwGrpId, cbMax);
+                        rc = CFGMR3QueryU32Def(pCur, "Burst", &cbBurst, 0);
+                    if (   RT_SUCCESS(rc)
+                        && cbBurst
+                        && cbBurst < PDM_NETSHAPER_MIN_BUCKET_SIZE)
+                    {
+                        LogRel(("NetShaper: Burst of bandwidth group '%s' raised from %u to %u bytes\n",
+                                pszBwGrpId, cbBurst, PDM_NETSHAPER_MIN_BUCKET_SIZE));
+                        cbBurst = PDM_NETSHAPER_MIN_BUCKET_SIZE;
+                    }
+                    if (RT_SUCCESS(rc))
+                        rc = pdmNsBwGroupCreate(pShaper, pszBwGrpId, cbMax, cbBurst);
 
                     RTMemFree(pszBwGrpId);
 
                     if (RT_FAILURE(rc))
                         break;
                 }
+
+                /* Hook up the nested groups now that all of them exist. */
+                for (PCFGMNODE pCur = CFGMR3GetFirstChild(pCfgBwGrp); pCur && RT_SUCCESS(rc); pCur = CFGMR3GetNextChild(pCur))
+                {
+                    char *pszParent = NULL;
+                    rc = CFGMR3QueryStringAlloc(pCur, "Parent", &pszParent);
+                    if (rc == VERR_CFGM_VALUE_NOT_FOUND)
+                    {
+                        rc = VINF_SUCCESS;
+                        continue;
+                    }
+                    if (RT_FAILURE(rc))
+                        break;
+
+                    char szBwGrpId[128];
+                    rc = CFGMR3GetName(pCur, szBwGrpId, sizeof(szBwGrpId));
+                    if (RT_SUCCESS(rc))
+                        rc = pdmNsBwGroupSetParent(pShaper, szBwGrpId, pszParent);
+                    if (RT_FAILURE(rc))
+                        LogRel(("NetShaper: Failed to make bandwidth group '%s' a child of '%s': %Rrc\n",
+                                szBwGrpId, pszParent, rc));
+                    MMR3HeapFree(pszParent);
+                }
             }
 
+            if (RT_SUCCESS(rc))
+                rc = RTSemEventCreate(&pShaper->hEvtTxWakeUp);
             if (RT_SUCCESS(rc))
             {
                 rc = PDMR3ThreadCreate(pVM, &pShaper->pTxThread, pShaper, pdmR3NsTxThread, pdmR3NsTxWakeUp,
@@ -537,6 +796,7 @@ int pdmR3NetShaperInit(PVM pVM)
                     pUVM->pdm.s.pNetShaper = pShaper;
                     return VINF_SUCCESS;
                 }
+                RTSemEventDestroy(pShaper->hEvtTxWakeUp);
             }
 
             RTCritSectDelete(&pShaper->Lock);
@@ -621,6 +621,7 @@
 #include <VBox/sup.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/em.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/stam.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
@@ -1706,6 +1707,11 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG(pVM, &pPGM->StatLargePageRecheck,               STAMTYPE_COUNTER, "/PGM/LargePage/Recheck",             STAMUNIT_OCCURENCES, "The number of times we've rechecked a disabled large page.");
 
     STAM_REL_REG(pVM, &pPGM->StatShModCheck,                     STAMTYPE_PROFILE, "/PGM/ShMod/Check",                   STAMUNIT_TICKS_PER_CALL, "Profiles the shared module checking.");
+    STAM_REL_REG(pVM, &pPGM->Dedup.StatScanned,                  STAMTYPE_COUNTER, "/PGM/Dedup/Scanned",                 STAMUNIT_PAGES,      "The number of pages hashed by the dedup scanner.");
+    STAM_REL_REG(pVM, &pPGM->Dedup.StatShared,                   STAMTYPE_COUNTER, "/PGM/Dedup/Shared",                  STAMUNIT_PAGES,      "The number of pages the dedup scanner converted to shared pages.");
+    STAM_REL_REG(pVM, &pPGM->Dedup.StatMerged,                   STAMTYPE_COUNTER, "/PGM/Dedup/Merged",                  STAMUNIT_PAGES,      "The number of pages the dedup scanner replaced by identical shared pages.");
+    STAM_REL_REG(pVM, &pPGM->Dedup.StatPasses,                   STAMTYPE_COUNTER, "/PGM/Dedup/Passes",                  STAMUNIT_OCCURENCES, "The number of complete passes over guest RAM.");
+    STAM_REL_REG(pVM, &pPGM->Dedup.StatScan,                     STAMTYPE_PROFILE, "/PGM/Dedup/Scan",                    STAMUNIT_TICKS_PER_CALL, "Profiles the dedup scans.");
 
     /* Live save */
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.fActive,              STAMTYPE_U8,      "/PGM/LiveSave/fActive",              STAMUNIT_COUNT,     "Active or not.");
@@ -1714,6 +1720,7 @@ static int pgmR3InitStats(PVM pVM)
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDirtyPagesShort,     STAMTYPE_U32,     "/PGM/LiveSave/cDirtyPagesShort",     STAMUNIT_COUNT,     "Short term dirty page average.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cPagesPerSecond,      STAMTYPE_U32,     "/PGM/LiveSave/cPagesPerSecond",      STAMUNIT_COUNT,     "Pages per second.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cSavedPages,          STAMTYPE_U64,     "/PGM/LiveSave/cSavedPages",          STAMUNIT_COUNT,     "The total number of saved pages.");
+    STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cDupPages,            STAMTYPE_U32,     "/PGM/LiveSave/cDupPages",            STAMUNIT_COUNT,     "The number of RAM pages saved as references to identical pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cReadyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cReadPages",       STAMUNIT_COUNT,     "RAM: Ready pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cDirtyPages,      STAMTYPE_U32,     "/PGM/LiveSave/Ram/cDirtyPages",      STAMUNIT_COUNT,     "RAM: Dirty pages.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.Ram.cZeroPages,       STAMTYPE_U32,     "/PGM/LiveSave/Ram/cZeroPages",       STAMUNIT_COUNT,     "RAM: Ready zero pages.");
@@ -2224,6 +2231,14 @@ VMMR3DECL(int) PGMR3InitFinalize(PVM pVM)
     if (pVM->pgm.s.fRamPreAlloc)
         rc = pgmR3PhysRamPreAllocate(pVM);
 
+#ifdef VBOX_WITH_PAGE_SHARING
+    /*
+     * Set up the content based page sharing scanner.
+     */
+    if (RT_SUCCESS(rc))
+        rc = pgmR3DedupScanInit(pVM);
+#endif
+
     LogRel(("PGMR3InitFinalize: 4 MB PSE mask %RGp\n", pVM->pgm.s.GCPhys4MBPSEMask));
     return rc;
 }
@@ -2600,6 +2615,7 @@ VMMR3_INT_DECL(void) PGMR3MemSetup(PVM pVM, bool fAtReset)
     {
         pgmLock(pVM);
 
+        pgmR3PostCopyReset(pVM);
         int rc = pgmR3PhysRamZeroAll(pVM);
         AssertReleaseRC(rc);
 
@@ -2646,6 +2662,7 @@ VMMR3DECL(int) PGMR3Term(PVM pVM)
     pgmR3PhysRamTerm(pVM);
     pgmR3PhysRomTerm(pVM);
     pgmUnlock(pVM);
+    pgmR3PostCopyTerm(pVM);
 
     PGMDeregisterStringFormatTypes();
     return PDMR3CritSectDelete(&pVM->pgm.s.CritSectX);
@@ -3374,6 +3391,7 @@ VMMR3DECL(int) PGMR3ChangeMode(PVM pVM, PVMCPU pVCpu, PGMMODE enmGuestMode)
 
     Log(("PGMR3ChangeMode: Guest mode: %s -> %s\n", PGMGetModeName(pVCpu->pgm.s.enmGuestMode), PGMGetModeName(enmGuestMode)));
     STAM_REL_COUNTER_INC(&pVCpu->pgm.s.cGuestModeChanges);
+    IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
 
     /*
      * Calc the shadow mode and switcher.
@@ -24,6 +24,7 @@
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/stam.h>
+#include <VBox/vmm/iem.h>
 #ifdef VBOX_WITH_REM
 # include <VBox/vmm/rem.h>
 #endif
@@ -1193,6 +1194,7 @@ static DECLCALLBACK(VBOXSTRICTRC) pgmR3PhysWriteProtectRAMRendezvous(PVM pVM, PV
     }
     pgmR3PoolWriteProtectPages(pVM);
     PGM_INVL_ALL_VCPU_TLBS(pVM);
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
     for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
         CPUMSetChangedFlags(&pVM->aCpus[idCpu], CPUM_CHANGED_GLOBAL_TLB_FLUSH);
 
@@ -1849,7 +1851,7 @@ void pgmR3PhysAssertSharedPageChecksums(PVM pVM)
                 PPGMPAGE pPage = &pRam->aPages[iPage];
                 if (PGM_PAGE_IS_SHARED(pPage))
                 {
-                    uint32_t u32Checksum = pPage->s.u2Unused0 | ((uint32_t)pPage->s.u2Unused1 << 8);
+                    uint32_t u32Checksum = ((uint32_t)pPage->s.u1Unused0 << 1) | ((uint32_t)pPage->s.u2Unused1 << 8);
                     if (!u32Checksum)
                     {
                         RTGCPHYS    GCPhysPage  = pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
@@ -1859,9 +1861,9 @@ void pgmR3PhysAssertSharedPageChecksums(PVM pVM)
                         {
                             uint32_t u32Checksum2 = RTCrc32(pvPage, PAGE_SIZE);
 # if 0
-                            AssertMsg((u32Checksum2 & UINT32_C(0x00000303)) == u32Checksum, ("GCPhysPage=%RGp\n", GCPhysPage));
+                            AssertMsg((u32Checksum2 & UINT32_C(0x00000302)) == u32Checksum, ("GCPhysPage=%RGp\n", GCPhysPage));
 # else
-                            if ((u32Checksum2 & UINT32_C(0x00000303)) == u32Checksum)
+                            if ((u32Checksum2 & UINT32_C(0x00000302)) == u32Checksum)
                                 LogFlow(("shpg %#x @ %RGp %#x [OK]\n", PGM_PAGE_GET_PAGEID(pPage), GCPhysPage, u32Checksum2));
                             else
                                 AssertMsgFailed(("shpg %#x @ %RGp %#x\n", PGM_PAGE_GET_PAGEID(pPage), GCPhysPage, u32Checksum2));
@@ -3817,6 +3819,7 @@ VMMDECL(void) PGMR3PhysSetA20(PVMCPU pVCpu, bool fEnable)
         pgmR3RefreshShadowModeAfterA20Change(pVCpu);
         HMFlushTLB(pVCpu);
 #endif
+        IEMTlbInvalidateAll(pVCpu, true /*fGlobal*/);
         STAM_REL_COUNTER_INC(&pVCpu->pgm.s.cA20Changes);
     }
 }
@@ -4025,6 +4028,8 @@ static DECLCALLBACK(VBOXSTRICTRC) pgmR3PhysUnmapChunkRendezvous(PVM pVM, PVMCPU
                 /* Flush REM translation blocks. */
                 REMFlushTBs(pVM);
 #endif
+                /* Flush the ring-3 mappings cached by IEM. */
+                IEMTlbInvalidateAllPhysicalAllCpus(pVM);
             }
         }
     }
@@ -0,0 +1,978 @@
+/* $Id$ */
+/** @file
+ * PGM - Page Manager and Monitor, Post-copy teleportation.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_pgm_post_copy  PGM Post-copy Teleportation
+ *
+ * When teleporting a VM whose guest keeps dirtying memory faster than the
+ * link can carry it, the live passes never converge and the final pass ends
+ * up sending a large part of RAM while the VM is suspended.  In post-copy
+ * mode the final pass only sends the address of each dirty page
+ * (PGM_STATE_REC_RAM_POSTCOPY) and the target resumes the VM right away.
+ *
+ * On the target the deferred pages are marked not present (PGMPAGE bit 6)
+ * and covered by PGMPHYSHANDLERTYPE_PHYSICAL_ALL handlers, which forces every
+ * guest access into ring-3.  The first time such a page is mapped or made
+ * writable, pgmR3PostCopyFetchPage asks the source for it through the
+ * callback registered by Main and waits for PGMR3PostCopyTrgSupplyPage to
+ * deliver the content.  Meanwhile the source pushes the remaining deferred
+ * pages in the background.  Once a page has arrived its handler is turned
+ * off for that page, and when the last page is in, all the handlers are
+ * deregistered.
+ *
+ * The fetch holds the PGM lock while waiting for the network, so pages
+ * supplied by other threads are staged in a small buffer and installed by the
+ * fetching thread.  Since neither the raw-mode context nor the shadow paging
+ * code can fetch pages, post-copy requires nested paging.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#define LOG_GROUP LOG_GROUP_PGM_PHYS
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/hm.h>
+#include <VBox/vmm/iem.h>
+#include <VBox/vmm/mm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/vmm/uvm.h>
+#include "PGMInternal.h"
+#include <VBox/vmm/vm.h>
+#include <VBox/param.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/asm.h>
+#include <iprt/assert.h>
+#include <iprt/critsect.h>
+#include <iprt/mem.h>
+#include <iprt/semaphore.h>
+#include <iprt/string.h>
+
+#include "PGMInline.h"
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+/** The number of pages that can be staged while the PGM lock is busy. */
+#define PGM_POST_COPY_STAGED_PAGES      16
+/** How long to wait for a page or for staging space per round (ms). */
+#define PGM_POST_COPY_WAIT_MS           10
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A page supplied while the PGM lock was owned by someone else.
+ */
+typedef struct PGMPOSTCOPYSTAGED
+{
+    /** The guest physical address of the page. */
+    RTGCPHYS                GCPhys;
+    /** The page content. */
+    uint8_t                 abPage[PAGE_SIZE];
+} PGMPOSTCOPYSTAGED;
+
+/**
+ * Post-copy teleportation state, both ends.
+ */
+typedef struct PGMPOSTCOPY
+{
+    /** @name Source side, protected by the PGM lock.
+     * @{ */
+    /** Set when the final pass should defer dirty pages. */
+    bool                    fSrcEnabled;
+    /** The number of deferred pages. */
+    uint32_t                cSrcPages;
+    /** The number of entries allocated for paSrcPages and pbmSrcSent. */
+    uint32_t                cSrcPagesAlloc;
+    /** Where PGMR3PostCopySrcNextPage continues searching. */
+    uint32_t                iSrcNext;
+    /** The deferred pages in ascending order. */
+    PRTGCPHYS               paSrcPages;
+    /** Bitmap of the deferred pages that have been sent. */
+    uint32_t               *pbmSrcSent;
+    /** @} */
+
+    /** @name Target side.
+     * @{ */
+    /** The fetch callback, NULL if not registered. */
+    PFNPGMR3POSTCOPYFETCH   pfnFetch;
+    /** The fetch callback user argument. */
+    void                   *pvFetchUser;
+    /** The number of pages that are still not present (PGM lock). */
+    uint32_t volatile       cTrgPending;
+    /** The abort status, VINF_SUCCESS while things are going fine. */
+    int32_t volatile        rcTrgAbort;
+    /** Set once the runtime error has been raised. */
+    bool volatile           fTrgErrorRaised;
+    /** The number of handlers in paTrgHandlers. */
+    uint32_t                cTrgHandlers;
+    /** The start addresses of the handlers we registered (PGM lock). */
+    PRTGCPHYS               paTrgHandlers;
+    /** Signalled when a page has been staged or installed. */
+    RTSEMEVENT              hEvtArrived;
+    /** Signalled when the staging buffer has been drained. */
+    RTSEMEVENT              hEvtSpace;
+    /** Protects cStaged and aStaged. */
+    RTCRITSECT              StagingCritSect;
+    /** The number of staged pages. */
+    uint32_t volatile       cStaged;
+    /** The staged pages. */
+    PGMPOSTCOPYSTAGED       aStaged[PGM_POST_COPY_STAGED_PAGES];
+    /** @} */
+
+    /** @name Statistics.
+     * @{ */
+    STAMCOUNTER             StatSrcSent;
+    STAMCOUNTER             StatTrgDeferred;
+    STAMCOUNTER             StatTrgSupplied;
+    STAMCOUNTER             StatTrgStaged;
+    STAMPROFILE             StatTrgFetch;
+    /** @} */
+} PGMPOSTCOPY;
+/** Pointer to the post-copy state. */
+typedef PGMPOSTCOPY *PPGMPOSTCOPY;
+
+
+/*******************************************************************************
+*   Internal Functions                                                         *
+*******************************************************************************/
+static void pgmR3PostCopyTrgDrain(PVM pVM, PPGMPOSTCOPY pPostCopy);
+
+
+/**
+ * Gets the post-copy state, creating it on first use.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ * @param   ppPostCopy      Where to return the state.
+ */
+static int pgmR3PostCopyGetOrCreate(PVM pVM, PPGMPOSTCOPY *ppPostCopy)
+{
+    pgmLock(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+    {
+        pPostCopy = (PPGMPOSTCOPY)MMR3HeapAllocZ(pVM, MM_TAG_PGM, sizeof(*pPostCopy));
+        if (!pPostCopy)
+        {
+            pgmUnlock(pVM);
+            return VERR_NO_MEMORY;
+        }
+        pPostCopy->hEvtArrived = NIL_RTSEMEVENT;
+        pPostCopy->hEvtSpace   = NIL_RTSEMEVENT;
+        int rc = RTCritSectInit(&pPostCopy->StagingCritSect);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pPostCopy->hEvtArrived);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pPostCopy->hEvtSpace);
+        if (RT_FAILURE(rc))
+        {
+            RTSemEventDestroy(pPostCopy->hEvtArrived);
+            if (RTCritSectIsInitialized(&pPostCopy->StagingCritSect))
+                RTCritSectDelete(&pPostCopy->StagingCritSect);
+            MMR3HeapFree(pPostCopy);
+            pgmUnlock(pVM);
+            return rc;
+        }
+
+        STAM_REL_REG(pVM, &pPostCopy->StatSrcSent,     STAMTYPE_COUNTER, "/PGM/PostCopy/Src/Sent",     STAMUNIT_PAGES,          "Deferred pages sent to the target.");
+        STAM_REL_REG(pVM, &pPostCopy->StatTrgDeferred, STAMTYPE_COUNTER, "/PGM/PostCopy/Trg/Deferred", STAMUNIT_PAGES,          "Pages left on the source by the saved state.");
+        STAM_REL_REG(pVM, &pPostCopy->StatTrgSupplied, STAMTYPE_COUNTER, "/PGM/PostCopy/Trg/Supplied", STAMUNIT_PAGES,          "Deferred pages installed.");
+        STAM_REL_REG(pVM, &pPostCopy->StatTrgStaged,   STAMTYPE_COUNTER, "/PGM/PostCopy/Trg/Staged",   STAMUNIT_PAGES,          "Pages staged because the PGM lock was busy.");
+        STAM_REL_REG(pVM, &pPostCopy->StatTrgFetch,    STAMTYPE_PROFILE, "/PGM/PostCopy/Trg/Fetch",    STAMUNIT_TICKS_PER_CALL, "Profiling of on-demand page fetches.");
+
+        pVM->pgm.s.pPostCopyR3 = pPostCopy;
+    }
+    pgmUnlock(pVM);
+
+    *ppPostCopy = pPostCopy;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Frees the post-copy resources, called by PGMR3Term.
+ *
+ * The state structure itself lives on the VM heap because the statistics
+ * point into it.
+ *
+ * @param   pVM             Pointer to the VM.
+ */
+void pgmR3PostCopyTerm(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+        return;
+
+    RTMemFree(pPostCopy->paSrcPages);
+    pPostCopy->paSrcPages = NULL;
+    RTMemFree(pPostCopy->pbmSrcSent);
+    pPostCopy->pbmSrcSent = NULL;
+    RTMemFree(pPostCopy->paTrgHandlers);
+    pPostCopy->paTrgHandlers = NULL;
+
+    RTSemEventDestroy(pPostCopy->hEvtArrived);
+    pPostCopy->hEvtArrived = NIL_RTSEMEVENT;
+    RTSemEventDestroy(pPostCopy->hEvtSpace);
+    pPostCopy->hEvtSpace = NIL_RTSEMEVENT;
+    RTCritSectDelete(&pPostCopy->StagingCritSect);
+}
+
+
+/**
+ * Forgets about all pages still on the source, used at VM reset.
+ *
+ * The memory is about to be zeroed, so there is no point in fetching it.  The
+ * handlers stay until PGMR3PostCopyTrgComplete and pages arriving later are
+ * dropped.
+ *
+ * @param   pVM             Pointer to the VM.
+ */
+void pgmR3PostCopyReset(PVM pVM)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy || !pPostCopy->cTrgPending)
+        return;
+
+    LogRel(("PGM: Post-copy: VM reset with %u pages still on the source\n", pPostCopy->cTrgPending));
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam; pRam = pRam->pNextR3)
+    {
+        uint32_t const cPages = pRam->cb >> PAGE_SHIFT;
+        for (uint32_t iPage = 0; iPage < cPages; iPage++)
+            PGM_PAGE_CLEAR_NOT_PRESENT(&pRam->aPages[iPage]);
+    }
+    ASMAtomicWriteU32(&pPostCopy->cTrgPending, 0);
+    RTSemEventSignal(pPostCopy->hEvtArrived);
+}
+
+
+/*
+ *
+ * Source side.
+ *
+ */
+
+/**
+ * Enables or disables post-copy for the next live save.
+ *
+ * When enabled, the final pass of a live save leaves the dirty RAM pages out
+ * of the stream and records them instead.  The caller must then transfer
+ * them using PGMR3PostCopySrcNextPage and PGMR3PostCopySrcGetPage, and
+ * finally call PGMR3PostCopySrcDone.
+ *
+ * @returns VBox status code.
+ * @param   pUVM            The user mode VM handle.
+ * @param   fEnable         Whether to enable or disable it.
+ */
+VMMR3DECL(int) PGMR3PostCopySrcEnable(PUVM pUVM, bool fEnable)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+
+    PPGMPOSTCOPY pPostCopy;
+    int rc = pgmR3PostCopyGetOrCreate(pVM, &pPostCopy);
+    if (RT_SUCCESS(rc))
+    {
+        pgmLock(pVM);
+        pPostCopy->fSrcEnabled = fEnable;
+        pPostCopy->cSrcPages   = 0;
+        pPostCopy->iSrcNext    = 0;
+        pgmUnlock(pVM);
+        LogRel(("PGM: Post-copy source mode %s\n", fEnable ? "enabled" : "disabled"));
+    }
+    return rc;
+}
+
+
+/**
+ * Checks whether the final pass should defer dirty pages.
+ *
+ * @returns true if it should, false if not.
+ * @param   pVM             Pointer to the VM.
+ */
+bool pgmR3PostCopySrcIsEnabled(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    return pPostCopy
+        && pPostCopy->fSrcEnabled;
+}
+
+
+/**
+ * Records a page the final pass has left out of the stream.
+ *
+ * Pages must be recorded in ascending order.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ * @param   GCPhys          The guest physical address of the page.
+ */
+int pgmR3PostCopySrcDeferPage(PVM pVM, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy && pPostCopy->fSrcEnabled, VERR_WRONG_ORDER);
+    Assert(   !pPostCopy->cSrcPages
+           || pPostCopy->paSrcPages[pPostCopy->cSrcPages - 1] < GCPhys);
+
+    if (pPostCopy->cSrcPages >= pPostCopy->cSrcPagesAlloc)
+    {
+        uint32_t const cNew = pPostCopy->cSrcPagesAlloc ? pPostCopy->cSrcPagesAlloc * 2 : _64K;
+        void *pvNew = RTMemRealloc(pPostCopy->paSrcPages, cNew * sizeof(RTGCPHYS));
+        if (!pvNew)
+            return VERR_NO_MEMORY;
+        pPostCopy->paSrcPages = (PRTGCPHYS)pvNew;
+
+        pvNew = RTMemRealloc(pPostCopy->pbmSrcSent, cNew / 8);
+        if (!pvNew)
+            return VERR_NO_MEMORY;
+        pPostCopy->pbmSrcSent = (uint32_t *)pvNew;
+        pPostCopy->cSrcPagesAlloc = cNew;
+    }
+
+    uint32_t const iPage = pPostCopy->cSrcPages++;
+    pPostCopy->paSrcPages[iPage] = GCPhys;
+    ASMBitClear(pPostCopy->pbmSrcSent, iPage);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Reads a deferred page so it can be sent to the target.
+ *
+ * This serves both the requests from the target and the background push.
+ *
+ * @returns VBox status code.
+ * @param   pUVM            The user mode VM handle.
+ * @param   GCPhys          The guest physical address of the page.
+ * @param   pvPage          Where to return the page content, PAGE_SIZE bytes.
+ * @thread  Any, the VM must not be running.
+ */
+VMMR3DECL(int) PGMR3PostCopySrcGetPage(PUVM pUVM, RTGCPHYS GCPhys, void *pvPage)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertReturn(!(GCPhys & PAGE_OFFSET_MASK), VERR_INVALID_PARAMETER);
+    AssertPtrReturn(pvPage, VERR_INVALID_POINTER);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy, VERR_WRONG_ORDER);
+
+    pgmLock(pVM);
+
+    /* Only deferred pages may be asked for. */
+    uint32_t iStart = 0;
+    uint32_t iEnd   = pPostCopy->cSrcPages;
+    while (iStart < iEnd)
+    {
+        uint32_t const i = iStart + (iEnd - iStart) / 2;
+        if (pPostCopy->paSrcPages[i] < GCPhys)
+            iStart = i + 1;
+        else
+            iEnd = i;
+    }
+    int rc;
+    if (   iStart < pPostCopy->cSrcPages
+        && pPostCopy->paSrcPages[iStart] == GCPhys)
+    {
+        PPGMPAGE pPage;
+        rc = pgmPhysGetPageEx(pVM, GCPhys, &pPage);
+        if (RT_SUCCESS(rc))
+        {
+            void const *pvSrc;
+            rc = pgmPhysPageMapReadOnly(pVM, pPage, GCPhys, &pvSrc);
+            if (RT_SUCCESS(rc))
+            {
+                memcpy(pvPage, pvSrc, PAGE_SIZE);
+                if (!ASMBitTestAndSet(pPostCopy->pbmSrcSent, iStart))
+                    STAM_REL_COUNTER_INC(&pPostCopy->StatSrcSent);
+            }
+        }
+    }
+    else
+    {
+        LogRel(("PGM: Post-copy: %RGp was not deferred\n", GCPhys));
+        rc = VERR_NOT_FOUND;
+    }
+
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
+/**
+ * Gets the next deferred page that hasn't been sent yet.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_FOUND when all the deferred pages have been sent.
+ * @param   pUVM            The user mode VM handle.
+ * @param   pGCPhys         Where to return the guest physical address.
+ */
+VMMR3DECL(int) PGMR3PostCopySrcNextPage(PUVM pUVM, PRTGCPHYS pGCPhys)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pGCPhys, VERR_INVALID_POINTER);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy, VERR_WRONG_ORDER);
+
+    pgmLock(pVM);
+    uint32_t i = pPostCopy->iSrcNext;
+    while (   i < pPostCopy->cSrcPages
+           && ASMBitTest(pPostCopy->pbmSrcSent, i))
+        i++;
+    pPostCopy->iSrcNext = i;
+
+    int rc;
+    if (i < pPostCopy->cSrcPages)
+    {
+        *pGCPhys = pPostCopy->paSrcPages[i];
+        rc = VINF_SUCCESS;
+    }
+    else
+        rc = VERR_NOT_FOUND;
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
+/**
+ * Ends post-copy on the source, whether it succeeded or not.
+ *
+ * @param   pUVM            The user mode VM handle.
+ */
+VMMR3DECL(void) PGMR3PostCopySrcDone(PUVM pUVM)
+{
+    AssertPtrReturnVoid(pUVM);
+    PVM pVM = pUVM->pVM;
+    AssertPtrReturnVoid(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy)
+        return;
+
+    pgmLock(pVM);
+    if (pPostCopy->cSrcPages)
+        LogRel(("PGM: Post-copy: %u pages were deferred, %RU64 of them sent\n",
+                pPostCopy->cSrcPages, pPostCopy->StatSrcSent.c));
+    pPostCopy->fSrcEnabled    = false;
+    pPostCopy->cSrcPages      = 0;
+    pPostCopy->cSrcPagesAlloc = 0;
+    pPostCopy->iSrcNext       = 0;
+    RTMemFree(pPostCopy->paSrcPages);
+    pPostCopy->paSrcPages     = NULL;
+    RTMemFree(pPostCopy->pbmSrcSent);
+    pPostCopy->pbmSrcSent     = NULL;
+    pgmUnlock(pVM);
+}
+
+
+/*
+ *
+ * Target side.
+ *
+ */
+
+/**
+ * Registers the post-copy fetch callback, allowing the saved state to defer
+ * pages.
+ *
+ * Must be called before the state is loaded.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if nested paging isn't active.
+ * @param   pUVM            The user mode VM handle.
+ * @param   pfnFetch        The fetch callback.
+ * @param   pvUser          User argument for the callback.
+ */
+VMMR3DECL(int) PGMR3PostCopyTrgRegister(PUVM pUVM, PFNPGMR3POSTCOPYFETCH pfnFetch, void *pvUser)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertPtrReturn(pfnFetch, VERR_INVALID_POINTER);
+
+    /*
+     * Only nested paging keeps every access to a deferred page in contexts
+     * that know how to deal with it.
+     */
+    if (   !HMIsEnabled(pVM)
+        || !HMIsNestedPagingActive(pVM))
+    {
+        LogRel(("PGM: Post-copy requires nested paging\n"));
+        return VERR_NOT_SUPPORTED;
+    }
+
+    PPGMPOSTCOPY pPostCopy;
+    int rc = pgmR3PostCopyGetOrCreate(pVM, &pPostCopy);
+    if (RT_SUCCESS(rc))
+    {
+        pgmLock(pVM);
+        AssertStmt(!pPostCopy->cTrgPending, rc = VERR_WRONG_ORDER);
+        if (RT_SUCCESS(rc))
+        {
+            pPostCopy->pfnFetch        = pfnFetch;
+            pPostCopy->pvFetchUser     = pvUser;
+            pPostCopy->rcTrgAbort      = VINF_SUCCESS;
+            pPostCopy->fTrgErrorRaised = false;
+        }
+        pgmUnlock(pVM);
+    }
+    return rc;
+}
+
+
+/**
+ * Marks a page as still being on the source, called while loading the state.
+ *
+ * The backing is allocated right away because the page may be installed by a
+ * thread which cannot allocate pages.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ * @param   pPage           The page.
+ * @param   GCPhys          The guest physical address of the page.
+ */
+int pgmR3PostCopyTrgDeferPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy || !pPostCopy->pfnFetch)
+        return VERR_PGM_POST_COPY_NOT_REGISTERED;
+    AssertLogRelMsgReturn(   PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM
+                          && !PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(pPage),
+                          ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage),
+                          VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+    if (PGM_PAGE_IS_NOT_PRESENT(pPage))
+        return VINF_SUCCESS;
+
+    if (PGM_PAGE_IS_BALLOONED(pPage))
+        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ZERO);
+    int rc = pgmPhysPageMakeWritable(pVM, pPage, GCPhys);
+    AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+
+    PGM_PAGE_SET_NOT_PRESENT(pPage);
+    pPostCopy->cTrgPending++;
+    STAM_REL_COUNTER_INC(&pPostCopy->StatTrgDeferred);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Physical access handler for the ranges containing deferred pages.
+ *
+ * The page has been fetched when the access mapped it, so let PGM do the
+ * access.
+ */
+static DECLCALLBACK(int) pgmR3PostCopyHandler(PVM pVM, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                                              PGMACCESSTYPE enmAccessType, void *pvUser)
+{
+    NOREF(pVM); NOREF(GCPhys); NOREF(pvPhys); NOREF(pvBuf); NOREF(cbBuf); NOREF(enmAccessType); NOREF(pvUser);
+    return VINF_PGM_HANDLER_DO_DEFAULT;
+}
+
+
+/**
+ * Covers the deferred pages with access handlers once the state is loaded.
+ *
+ * Each run of unhandled RAM pages containing deferred pages gets one handler
+ * so that the number of handlers stays small.  The present pages within a
+ * run are turned off right away.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ * @thread  EMT
+ */
+int pgmR3PostCopyTrgLoadDone(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy || !pPostCopy->cTrgPending)
+        return VINF_SUCCESS;
+
+    pgmLock(pVM);
+    int rc = VINF_SUCCESS;
+    for (PPGMRAMRANGE pRam = pVM->pgm.s.pRamRangesXR3; pRam && RT_SUCCESS(rc); pRam = pRam->pNextR3)
+    {
+        if (PGM_RAM_RANGE_IS_AD_HOC(pRam))
+            continue;
+
+        uint32_t const cPages = pRam->cb >> PAGE_SHIFT;
+        uint32_t       iPage  = 0;
+        while (iPage < cPages && RT_SUCCESS(rc))
+        {
+            /* Find the next run. */
+            PPGMPAGE pPage = &pRam->aPages[iPage];
+            if (   PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM
+                || PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(pPage))
+            {
+                iPage++;
+                continue;
+            }
+            uint32_t const iFirst = iPage;
+            bool           fDeferred = false;
+            while (   iPage < cPages
+                   && PGM_PAGE_GET_TYPE(&pRam->aPages[iPage]) == PGMPAGETYPE_RAM
+                   && !PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(&pRam->aPages[iPage]))
+                fDeferred |= !!PGM_PAGE_IS_NOT_PRESENT(&pRam->aPages[iPage++]);
+            if (!fDeferred)
+                continue;
+
+            /* Cover it. */
+            if (!(pPostCopy->cTrgHandlers % 16))
+            {
+                void *pvNew = RTMemRealloc(pPostCopy->paTrgHandlers, (pPostCopy->cTrgHandlers + 16) * sizeof(RTGCPHYS));
+                if (!pvNew)
+                {
+                    rc = VERR_NO_MEMORY;
+                    break;
+                }
+                pPostCopy->paTrgHandlers = (PRTGCPHYS)pvNew;
+            }
+            RTGCPHYS const GCPhysFirst = pRam->GCPhys + ((RTGCPHYS)iFirst << PAGE_SHIFT);
+            RTGCPHYS const GCPhysLast  = pRam->GCPhys + ((RTGCPHYS)iPage  << PAGE_SHIFT) - 1;
+            rc = PGMR3HandlerPhysicalRegister(pVM, PGMPHYSHANDLERTYPE_PHYSICAL_ALL, GCPhysFirst, GCPhysLast,
+                                              pgmR3PostCopyHandler, NULL,
+                                              NULL, NULL, NIL_RTR0PTR,
+                                              NULL, NULL, NIL_RTRCPTR, "Post-copy");
+            AssertLogRelMsgRCBreak(rc, ("%RGp-%RGp rc=%Rrc\n", GCPhysFirst, GCPhysLast, rc));
+            pPostCopy->paTrgHandlers[pPostCopy->cTrgHandlers++] = GCPhysFirst;
+
+            for (uint32_t i = iFirst; i < iPage && RT_SUCCESS(rc); i++)
+                if (!PGM_PAGE_IS_NOT_PRESENT(&pRam->aPages[i]))
+                    rc = PGMHandlerPhysicalPageTempOff(pVM, GCPhysFirst, pRam->GCPhys + ((RTGCPHYS)i << PAGE_SHIFT));
+        }
+    }
+
+    pgmPhysInvalidatePageMapTLB(pVM);
+    LogRel(("PGM: Post-copy: %u pages on the source, %u handlers, rc=%Rrc\n",
+            pPostCopy->cTrgPending, pPostCopy->cTrgHandlers, rc));
+    pgmUnlock(pVM);
+
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+    return rc;
+}
+
+
+/**
+ * Installs a page supplied by the source.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ * @param   pPostCopy       The post-copy state.
+ * @param   GCPhys          The guest physical address of the page.
+ * @param   pvPage          The page content.
+ */
+static int pgmR3PostCopyTrgInstall(PVM pVM, PPGMPOSTCOPY pPostCopy, RTGCPHYS GCPhys, void const *pvPage)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    PPGMPAGE pPage;
+    int rc = pgmPhysGetPageEx(pVM, GCPhys, &pPage);
+    AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp rc=%Rrc\n", GCPhys, rc), rc);
+    if (!PGM_PAGE_IS_NOT_PRESENT(pPage))
+        return VINF_SUCCESS; /* Pushed and requested, or the VM was reset. */
+
+    /* The backing was allocated when the page was deferred, so this won't
+       need to allocate anything. */
+    PGM_PAGE_CLEAR_NOT_PRESENT(pPage);
+    void *pvDst;
+    rc = pgmPhysPageMakeWritableAndMap(pVM, pPage, GCPhys, &pvDst);
+    if (RT_FAILURE(rc))
+    {
+        PGM_PAGE_SET_NOT_PRESENT(pPage);
+        AssertLogRelMsgFailedReturn(("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+    }
+    memcpy(pvDst, pvPage, PAGE_SIZE);
+
+    if (PGM_PAGE_GET_HNDL_PHYS_STATE(pPage) == PGM_PAGE_HNDL_PHYS_STATE_ALL)
+    {
+        PPGMPHYSHANDLER pCur = pgmHandlerPhysicalLookup(pVM, GCPhys);
+        if (pCur && pCur->pfnHandlerR3 == pgmR3PostCopyHandler)
+        {
+            PGM_PAGE_SET_HNDL_PHYS_STATE(pPage, PGM_PAGE_HNDL_PHYS_STATE_DISABLED);
+            pCur->cTmpOffPages++;
+        }
+    }
+    IEMTlbInvalidatePhysRangeAllCpus(pVM, GCPhys, GCPhys | PAGE_OFFSET_MASK);
+
+    Assert(pPostCopy->cTrgPending > 0);
+    ASMAtomicDecU32(&pPostCopy->cTrgPending);
+    STAM_REL_COUNTER_INC(&pPostCopy->StatTrgSupplied);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Records the first failure and wakes up everyone waiting.
+ *
+ * @returns true if this was the first failure, false if not.
+ * @param   pPostCopy       The post-copy state.
+ * @param   rc              The failure status.
+ */
+static bool pgmR3PostCopyTrgSetAbort(PPGMPOSTCOPY pPostCopy, int rc)
+{
+    bool fFirst = ASMAtomicCmpXchgS32(&pPostCopy->rcTrgAbort, rc, VINF_SUCCESS);
+    if (fFirst)
+        LogRel(("PGM: Post-copy failed with %Rrc, %u pages still on the source\n",
+                rc, ASMAtomicReadU32(&pPostCopy->cTrgPending)));
+    RTSemEventSignal(pPostCopy->hEvtArrived);
+    RTSemEventSignal(pPostCopy->hEvtSpace);
+    return fFirst;
+}
+
+
+/**
+ * Installs the staged pages.
+ *
+ * @param   pVM             Pointer to the VM.
+ * @param   pPostCopy       The post-copy state.
+ */
+static void pgmR3PostCopyTrgDrain(PVM pVM, PPGMPOSTCOPY pPostCopy)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    if (!ASMAtomicReadU32(&pPostCopy->cStaged))
+        return;
+
+    RTCritSectEnter(&pPostCopy->StagingCritSect);
+    uint32_t const cStaged = pPostCopy->cStaged;
+    for (uint32_t i = 0; i < cStaged; i++)
+    {
+        int rc = pgmR3PostCopyTrgInstall(pVM, pPostCopy, pPostCopy->aStaged[i].GCPhys, pPostCopy->aStaged[i].abPage);
+        if (RT_FAILURE(rc))
+            pgmR3PostCopyTrgSetAbort(pPostCopy, rc);
+    }
+    ASMAtomicWriteU32(&pPostCopy->cStaged, 0);
+    RTCritSectLeave(&pPostCopy->StagingCritSect);
+
+    RTSemEventSignal(pPostCopy->hEvtSpace);
+}
+
+
+/**
+ * Fetches a page from the post-copy source, called when a deferred page is
+ * about to be mapped or made writable.
+ *
+ * The PGM lock is held across the whole fetch so that the page and its
+ * tracking structure stay put.  Pages other threads receive meanwhile are
+ * staged and installed here.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_PGM_POST_COPY_PAGE_UNAVAILABLE if the transfer has failed.
+ * @param   pVM             Pointer to the VM.
+ * @param   pPage           The page.
+ * @param   GCPhys          The guest physical address (any offset).
+ */
+int pgmR3PostCopyFetchPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy && pPostCopy->pfnFetch, VERR_PGM_POST_COPY_NOT_REGISTERED);
+    GCPhys &= ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    Log(("pgmR3PostCopyFetchPage: %RGp\n", GCPhys));
+
+    STAM_REL_PROFILE_START(&pPostCopy->StatTrgFetch, a);
+    int  rc     = VINF_SUCCESS;
+    bool fFirst = true;
+    for (;;)
+    {
+        pgmR3PostCopyTrgDrain(pVM, pPostCopy);
+        if (!PGM_PAGE_IS_NOT_PRESENT(pPage))
+            break;
+        if (RT_FAILURE(ASMAtomicReadS32(&pPostCopy->rcTrgAbort)))
+        {
+            rc = VERR_PGM_POST_COPY_PAGE_UNAVAILABLE;
+            break;
+        }
+
+        rc = pPostCopy->pfnFetch(pVM->pUVM, GCPhys, fFirst, pPostCopy->pvFetchUser);
+        if (RT_FAILURE(rc))
+        {
+            pgmR3PostCopyTrgSetAbort(pPostCopy, rc);
+            rc = VERR_PGM_POST_COPY_PAGE_UNAVAILABLE;
+            break;
+        }
+        fFirst = false;
+
+        if (PGM_PAGE_IS_NOT_PRESENT(pPage))
+            RTSemEventWait(pPostCopy->hEvtArrived, PGM_POST_COPY_WAIT_MS);
+    }
+    STAM_REL_PROFILE_STOP(&pPostCopy->StatTrgFetch, a);
+    return rc;
+}
+
+
+/**
+ * Supplies the content of a deferred page.
+ *
+ * Pages which are not (or no longer) deferred are ignored.
+ *
+ * @returns VBox status code.
+ * @param   pUVM            The user mode VM handle.
+ * @param   GCPhys          The guest physical address of the page.
+ * @param   pvPage          The page content, PAGE_SIZE bytes.
+ * @thread  Any
+ */
+VMMR3DECL(int) PGMR3PostCopyTrgSupplyPage(PUVM pUVM, RTGCPHYS GCPhys, const void *pvPage)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    AssertReturn(!(GCPhys & PAGE_OFFSET_MASK), VERR_INVALID_PARAMETER);
+    AssertPtrReturn(pvPage, VERR_INVALID_POINTER);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy && pPostCopy->pfnFetch, VERR_WRONG_ORDER);
+
+    for (;;)
+    {
+        /*
+         * Install it directly if we can get the lock.  This is also the path
+         * taken when the fetching thread pumps the transport itself.
+         */
+        if (PDMCritSectTryEnter(&pVM->pgm.s.CritSectX) == VINF_SUCCESS)
+        {
+            pgmR3PostCopyTrgDrain(pVM, pPostCopy);
+            int rc = pgmR3PostCopyTrgInstall(pVM, pPostCopy, GCPhys, pvPage);
+            pgmUnlock(pVM);
+            return rc;
+        }
+
+        /*
+         * Otherwise stage it for the lock owner, who is probably waiting for
+         * this very page.
+         */
+        RTCritSectEnter(&pPostCopy->StagingCritSect);
+        uint32_t const i = pPostCopy->cStaged;
+        if (i < RT_ELEMENTS(pPostCopy->aStaged))
+        {
+            pPostCopy->aStaged[i].GCPhys = GCPhys;
+            memcpy(pPostCopy->aStaged[i].abPage, pvPage, PAGE_SIZE);
+            ASMAtomicWriteU32(&pPostCopy->cStaged, i + 1);
+            RTCritSectLeave(&pPostCopy->StagingCritSect);
+            STAM_REL_COUNTER_INC(&pPostCopy->StatTrgStaged);
+            RTSemEventSignal(pPostCopy->hEvtArrived);
+            return VINF_SUCCESS;
+        }
+        RTCritSectLeave(&pPostCopy->StagingCritSect);
+
+        int rc = ASMAtomicReadS32(&pPostCopy->rcTrgAbort);
+        if (RT_FAILURE(rc))
+            return rc;
+        RTSemEventWait(pPostCopy->hEvtSpace, PGM_POST_COPY_WAIT_MS);
+    }
+}
+
+
+/**
+ * EMT worker for PGMR3PostCopyTrgComplete.
+ *
+ * @returns VBox status code.
+ * @param   pVM             Pointer to the VM.
+ */
+static DECLCALLBACK(int) pgmR3PostCopyTrgCompleteWorker(PVM pVM)
+{
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+
+    pgmLock(pVM);
+    pgmR3PostCopyTrgDrain(pVM, pPostCopy);
+
+    int rc = ASMAtomicReadS32(&pPostCopy->rcTrgAbort);
+    if (RT_SUCCESS(rc) && pPostCopy->cTrgPending)
+    {
+        LogRel(("PGM: Post-copy: the source is done, but %u pages are missing\n", pPostCopy->cTrgPending));
+        rc = VERR_PGM_POST_COPY_PAGE_UNAVAILABLE;
+    }
+    if (RT_SUCCESS(rc))
+    {
+        for (uint32_t i = 0; i < pPostCopy->cTrgHandlers; i++)
+        {
+            int rc2 = PGMHandlerPhysicalDeregister(pVM, pPostCopy->paTrgHandlers[i]);
+            AssertLogRelRC(rc2);
+        }
+        pPostCopy->cTrgHandlers = 0;
+        pPostCopy->pfnFetch     = NULL;
+        pPostCopy->pvFetchUser  = NULL;
+        LogRel(("PGM: Post-copy completed, %RU64 pages supplied, %RU64 fetched on demand\n",
+                pPostCopy->StatTrgSupplied.c, pPostCopy->StatTrgFetch.cPeriods));
+    }
+    pgmUnlock(pVM);
+
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+    return rc;
+}
+
+
+/**
+ * Completes post-copy on the target after the source has sent all pages.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_PGM_POST_COPY_PAGE_UNAVAILABLE if pages are still missing,
+ *          in which case the caller should call PGMR3PostCopyTrgAbort.
+ * @param   pUVM            The user mode VM handle.
+ */
+VMMR3DECL(int) PGMR3PostCopyTrgComplete(PUVM pUVM)
+{
+    UVM_ASSERT_VALID_EXT_RETURN(pUVM, VERR_INVALID_VM_HANDLE);
+    PVM pVM = pUVM->pVM;
+    VM_ASSERT_VALID_EXT_RETURN(pVM, VERR_INVALID_VM_HANDLE);
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    AssertReturn(pPostCopy && pPostCopy->pfnFetch, VERR_WRONG_ORDER);
+
+    /* Deregistering handlers notifies REM and flushes shadow page tables,
+       so do it on an EMT. */
+    return VMR3ReqCallWaitU(pUVM, VMCPUID_ANY, (PFNRT)pgmR3PostCopyTrgCompleteWorker, 1, pVM);
+}
+
+
+/**
+ * Aborts post-copy on the target after the transport failed.
+ *
+ * If pages are still missing, the VM cannot continue and a fatal runtime
+ * error is raised.
+ *
+ * @param   pUVM            The user mode VM handle.
+ * @param   rc              The failure status.
+ */
+VMMR3DECL(void) PGMR3PostCopyTrgAbort(PUVM pUVM, int rc)
+{
+    AssertPtrReturnVoid(pUVM);
+    PVM pVM = pUVM->pVM;
+    AssertPtrReturnVoid(pVM);
+    AssertReturnVoid(RT_FAILURE(rc));
+    PPGMPOSTCOPY pPostCopy = pVM->pgm.s.pPostCopyR3;
+    if (!pPostCopy || !pPostCopy->pfnFetch)
+        return;
+
+    pgmR3PostCopyTrgSetAbort(pPostCopy, rc);
+
+    /* Wait for fetches calling pfnFetch to return, the caller may free the
+       user argument once we're done. */
+    pgmLock(pVM);
+    pgmUnlock(pVM);
+
+    if (   ASMAtomicReadU32(&pPostCopy->cTrgPending)
+        && !ASMAtomicXchgBool(&pPostCopy->fTrgErrorRaised, true))
+        VMSetRuntimeError(pVM, VMSETRTERR_FLAGS_FATAL | (VM_IS_EMT(pVM) ? 0 : VMSETRTERR_FLAGS_NO_WAIT),
+                          "TeleporterPostCopyFailed",
+                          N_("The connection to the teleportation source was lost before all of the guest memory had been transferred (%Rrc). The VM cannot continue"),
+                          rc);
+}
+
@@ -22,6 +22,8 @@
 #define LOG_GROUP LOG_GROUP_PGM
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/stam.h>
+#include <VBox/vmm/cpum.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/vmm/pdmdrv.h>
 #include <VBox/vmm/pdmdev.h>
@@ -46,7 +48,9 @@
 *   Defined Constants And Macros                                               *
 *******************************************************************************/
 /** Saved state data unit version.  */
-#define PGM_SAVED_STATE_VERSION                 14
+#define PGM_SAVED_STATE_VERSION                 15
+/** Saved state data unit version before the duplicate page records. */
+#define PGM_SAVED_STATE_VERSION_PRE_DUP         14
 /** Saved state data unit version before the PAE PDPE registers. */
 #define PGM_SAVED_STATE_VERSION_PRE_PAE         13
 /** Saved state data unit version after this includes ballooned page flags in
@@ -87,8 +91,14 @@
 #define PGM_STATE_REC_ROM_PROT          UINT8_C(0x07)
 /** Ballooned page. No data. */
 #define PGM_STATE_REC_RAM_BALLOONED     UINT8_C(0x08)
+/** Duplicate page. The payload is the address (RTGCPHYS) of a RAM page which
+ *  was saved earlier in the stream and has identical content. */
+#define PGM_STATE_REC_RAM_DUP           UINT8_C(0x09)
+/** Deferred page, fetched from the post-copy source after the hand-over.
+ *  No data. */
+#define PGM_STATE_REC_RAM_POSTCOPY      UINT8_C(0x0a)
 /** The last record type. */
-#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BALLOONED
+#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_POSTCOPY
 /** End marker. */
 #define PGM_STATE_REC_END               UINT8_C(0xff)
 /** Flag indicating that the data is preceded by the page address.
@@ -103,6 +113,14 @@
 /** The CRC-32 for a zero half page. */
 #define PGM_STATE_CRC32_ZERO_HALF_PAGE  UINT32_C(0xf1e8ba9e)
 
+/** @name Duplicate page index sizing.
+ * @{ */
+/** The min number of entries in the index. */
+#define PGM_LS_DUP_IDX_MIN_ENTRIES      _4K
+/** The max number of entries in the index (16 MB of entries). */
+#define PGM_LS_DUP_IDX_MAX_ENTRIES      _1M
+/** @} */
+
 
 /*******************************************************************************
 *   Structures and Typedefs                                                    *
@@ -127,6 +145,38 @@ typedef struct
     PGMMODE                         enmGuestMode;
 } PGMOLD;
 
+/**
+ * Duplicate page index entry.
+ */
+typedef struct PGMLIVESAVEDUPENTRY
+{
+    /** The content hash of the page when it was saved. */
+    uint64_t                        uHash;
+    /** The address of the saved page, NIL_RTGCPHYS if the entry is free. */
+    RTGCPHYS                        GCPhys;
+} PGMLIVESAVEDUPENTRY;
+/** Pointer to a duplicate page index entry. */
+typedef PGMLIVESAVEDUPENTRY *PPGMLIVESAVEDUPENTRY;
+
+/**
+ * Content hash index of the RAM pages saved during a live save.
+ *
+ * This is a direct mapped table indexed by the low hash bits.  Colliding pages
+ * simply replace each other, we only lose the odd opportunity to save a
+ * reference instead of the page content.
+ */
+typedef struct PGMLIVESAVEDUPIDX
+{
+    /** The index mask (number of entries - 1). */
+    uint32_t                        fMask;
+    /** Padding. */
+    uint32_t                        u32Padding;
+    /** The entries. */
+    PGMLIVESAVEDUPENTRY             aEntries[1];
+} PGMLIVESAVEDUPIDX;
+/** Pointer to a content hash index. */
+typedef PGMLIVESAVEDUPIDX *PPGMLIVESAVEDUPIDX;
+
 
 /*******************************************************************************
 *   Global Variables                                                           *
@@ -1037,6 +1087,114 @@ static void pgmR3DoneMmio2Pages(PVM pVM)
 }
 
 
+/**
+ * Calculates the content hash of a RAM page for the duplicate page index.
+ *
+ * @returns 64-bit hash value.
+ * @param   pvPage              The page content.
+ */
+static uint64_t pgmR3LiveSaveDupHashPage(void const *pvPage)
+{
+    uint64_t const *pu64  = (uint64_t const *)pvPage;
+    uint64_t        uHash = UINT64_C(0xcbf29ce484222325);
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i++)
+    {
+        uHash ^= pu64[i];
+        uHash *= UINT64_C(0x100000001b3);
+        uHash ^= uHash >> 32;
+    }
+    return uHash;
+}
+
+
+/**
+ * Checks that the guest still has the content of a RAM page which was saved
+ * earlier, i.e. that it hasn't been modified since.
+ *
+ * The page must not have been dirtied since it was saved and, outside the
+ * final pass, it must still be write monitored (or shared) so that any write
+ * after saving it would have been noticed.
+ *
+ * @returns true if unchanged, false if not or if we cannot tell.
+ * @param   pVM                 Pointer to the VM.
+ * @param   GCPhys              The address of the page.
+ * @param   uPass               The pass number.
+ */
+static bool pgmR3LiveSaveDupIsUnchanged(PVM pVM, RTGCPHYS GCPhys, uint32_t uPass)
+{
+    PPGMRAMRANGE pRam = pgmPhysGetRange(pVM, GCPhys);
+    if (   !pRam
+        || !pRam->paLSPages
+        || PGM_RAM_RANGE_IS_AD_HOC(pRam))
+        return false;
+
+    uint32_t const      iPage   = (uint32_t)((GCPhys - pRam->GCPhys) >> PAGE_SHIFT);
+    PPGMLIVESAVERAMPAGE pLSPage = &pRam->paLSPages[iPage];
+    PPGMPAGE            pPage   = &pRam->aPages[iPage];
+    if (   pLSPage->fDirty
+        || pLSPage->fIgnore
+        || pLSPage->fZero
+        || PGM_PAGE_GET_TYPE(pPage) != PGMPAGETYPE_RAM)
+        return false;
+
+    /* The VM is suspended during the final pass. */
+    if (uPass == SSM_PASS_FINAL)
+        return true;
+
+    return (   PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_WRITE_MONITORED
+            || PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_SHARED)
+        && PGM_PAGE_GET_WRITE_LOCKS(pPage) == 0;
+}
+
+
+/**
+ * Looks up a RAM page in the duplicate page index and enters it if no saved
+ * page with identical content is found.
+ *
+ * The caller owns the PGM lock.
+ *
+ * @returns The address of a saved page with identical content, NIL_RTGCPHYS
+ *          if none.
+ * @param   pVM                 Pointer to the VM.
+ * @param   pDupIdx             The duplicate page index.
+ * @param   pvPage              The content of the page about to be saved.
+ * @param   GCPhys              The address of the page about to be saved.
+ * @param   uPass               The pass number.
+ */
+static RTGCPHYS pgmR3LiveSaveDupLookup(PVM pVM, PPGMLIVESAVEDUPIDX pDupIdx, void const *pvPage, RTGCPHYS GCPhys, uint32_t uPass)
+{
+    uint64_t const       uHash  = pgmR3LiveSaveDupHashPage(pvPage);
+    PPGMLIVESAVEDUPENTRY pEntry = &pDupIdx->aEntries[uHash & pDupIdx->fMask];
+
+    if (   pEntry->GCPhys != NIL_RTGCPHYS
+        && pEntry->uHash  == uHash
+        && pEntry->GCPhys != GCPhys
+        && pgmR3LiveSaveDupIsUnchanged(pVM, pEntry->GCPhys, uPass))
+    {
+        /* Verify the content, the hash only gives us a candidate. */
+        PPGMPAGE pSrcPage;
+        int rc = pgmPhysGetPageEx(pVM, pEntry->GCPhys, &pSrcPage);
+        if (RT_SUCCESS(rc))
+        {
+            PGMPAGEMAPLOCK  PgMpLck;
+            void const     *pvSrcPage;
+            rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pSrcPage, pEntry->GCPhys, &pvSrcPage, &PgMpLck);
+            if (RT_SUCCESS(rc))
+            {
+                bool fSame = !memcmp(pvSrcPage, pvPage, PAGE_SIZE);
+                pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                if (fSame)
+                    return pEntry->GCPhys;
+            }
+        }
+    }
+
+    pEntry->uHash  = uHash;
+    pEntry->GCPhys = GCPhys;
+    return NIL_RTGCPHYS;
+}
+
+
 /**
  * Prepares the RAM pages for a live save.
  *
@@ -1169,6 +1327,34 @@ static int pgmR3PrepRamPages(PVM pVM)
             }
         }
     } while (pCur);
+    uint32_t const cRamPages = pVM->pgm.s.LiveSave.Ram.cDirtyPages;
+    pgmUnlock(pVM);
+
+    /*
+     * Allocate the duplicate page index.  This is an optimization, so we
+     * carry on without it if there isn't enough memory.
+     */
+    uint32_t cEntries = PGM_LS_DUP_IDX_MIN_ENTRIES;
+    while (cEntries < cRamPages && cEntries < PGM_LS_DUP_IDX_MAX_ENTRIES)
+        cEntries <<= 1;
+    PPGMLIVESAVEDUPIDX pDupIdx = (PPGMLIVESAVEDUPIDX)MMR3HeapAlloc(pVM, MM_TAG_PGM,
+                                                                   RT_OFFSETOF(PGMLIVESAVEDUPIDX, aEntries[cEntries]));
+    if (pDupIdx)
+    {
+        pDupIdx->fMask      = cEntries - 1;
+        pDupIdx->u32Padding = 0;
+        for (uint32_t i = 0; i < cEntries; i++)
+        {
+            pDupIdx->aEntries[i].uHash  = 0;
+            pDupIdx->aEntries[i].GCPhys = NIL_RTGCPHYS;
+        }
+    }
+    else
+        LogRel(("PGM: Not enough memory for the duplicate page index (%u entries)\n", cEntries));
+
+    pgmLock(pVM);
+    pVM->pgm.s.LiveSave.cDupPages = 0;
+    pVM->pgm.s.LiveSave.pDupIdxR3 = pDupIdx;
     pgmUnlock(pVM);
 
     return VINF_SUCCESS;
@@ -1388,6 +1574,8 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
 
                                 pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
                                                         pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
+                                /* The EMTs are running, so IEM must drop its writable mappings right away. */
+                                IEMTlbInvalidateAllPhysicalAllCpus(pVM);
                                 paLSPages[iPage].fWriteMonitored        = 1;
                                 paLSPages[iPage].fWriteMonitoredJustNow = 1;
                                 paLSPages[iPage].fDirty                 = 1;
@@ -1514,6 +1702,25 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
 }
 
 
+/**
+ * Checks if a page is the root of the guest paging structures of any VCPU.
+ *
+ * The target needs these right after the hand-over, so they're never
+ * deferred.
+ *
+ * @returns true if it is, false if not.
+ * @param   pVM                 Pointer to the VM.
+ * @param   GCPhys              The guest physical address of the page.
+ */
+static bool pgmR3SaveIsGstPagingRoot(PVM pVM, RTGCPHYS GCPhys)
+{
+    for (VMCPUID i = 0; i < pVM->cCpus; i++)
+        if ((CPUMGetGuestCR3(&pVM->aCpus[i]) & X86_CR3_AMD64_PAGE_MASK) == GCPhys)
+            return true;
+    return false;
+}
+
+
 /**
  * Save quiescent RAM pages.
  *
@@ -1525,8 +1732,6 @@ static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
  */
 static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t uPass)
 {
-    NOREF(fLiveSave);
-
     /*
      * The RAM.
      */
@@ -1534,6 +1739,12 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
     RTGCPHYS GCPhysCur = 0;
     PPGMRAMRANGE pCur;
     bool fFTMDeltaSaveActive = FTMIsDeltaLoadSaveActive(pVM);
+    /* In post-copy mode the final pass leaves the dirty pages on the source. */
+    bool const fPostCopy = uPass == SSM_PASS_FINAL
+                        && fLiveSave
+                        && !fFTMDeltaSaveActive
+                        && pgmR3PostCopySrcIsEnabled(pVM);
+    PPGMLIVESAVEDUPIDX pDupIdx = !fFTMDeltaSaveActive && !fPostCopy ? pVM->pgm.s.LiveSave.pDupIdxR3 : NULL;
 
     pgmLock(pVM);
     do
@@ -1610,8 +1821,32 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                     bool        fZero  = PGM_PAGE_IS_ZERO(pCurPage);
                     bool        fBallooned = PGM_PAGE_IS_BALLOONED(pCurPage);
                     bool        fSkipped = false;
+                    bool        fDup = false;
+
+                    if (   fPostCopy
+                        && !fZero
+                        && !fBallooned
+                        && paLSPages
+                        && !paLSPages[iPage].fIgnore
+                        && !PGM_PAGE_HAS_ANY_PHYSICAL_HANDLERS(pCurPage)
+                        && !pgmR3SaveIsGstPagingRoot(pVM, GCPhys))
+                    {
+                        /*
+                         * Dirty page left for the post-copy phase, only the address.
+                         */
+                        rc = pgmR3PostCopySrcDeferPage(pVM, GCPhys);
+                        pgmUnlock(pVM);
+                        AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys), rc);
 
-                    if (!fZero && !fBallooned)
+                        if (GCPhys == GCPhysLast + PAGE_SIZE)
+                            rc = SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_POSTCOPY);
+                        else
+                        {
+                            SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_POSTCOPY | PGM_STATE_REC_FLAG_ADDR);
+                            rc = SSMR3PutGCPhys(pSSM, GCPhys);
+                        }
+                    }
+                    else if (!fZero && !fBallooned)
                     {
                         /*
                          * Copy the page and then save it outside the lock (since any
@@ -1620,6 +1855,7 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         uint8_t         abPage[PAGE_SIZE];
                         PGMPAGEMAPLOCK  PgMpLck;
                         void const     *pvPage;
+                        RTGCPHYS        GCPhysDup = NIL_RTGCPHYS;
                         rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pCurPage, GCPhys, &pvPage, &PgMpLck);
                         if (RT_SUCCESS(rc))
                         {
@@ -1629,6 +1865,12 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 pgmR3StateVerifyCrc32ForPage(abPage, pCur, paLSPages, iPage, "save#3");
 #endif
                             pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+
+                            /* Look for a saved page with the same content. */
+                            if (   pDupIdx
+                                && paLSPages
+                                && !ASMMemIsZeroPage(abPage))
+                                GCPhysDup = pgmR3LiveSaveDupLookup(pVM, pDupIdx, abPage, GCPhys, uPass);
                         }
                         pgmUnlock(pVM);
                         AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys), rc);
@@ -1656,6 +1898,18 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 else
                                     fSkipped = true;
                             }
+                            else if (GCPhysDup != NIL_RTGCPHYS)
+                            {
+                                if (GCPhys == GCPhysLast + PAGE_SIZE)
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP);
+                                else
+                                {
+                                    SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP | PGM_STATE_REC_FLAG_ADDR);
+                                    SSMR3PutGCPhys(pSSM, GCPhys);
+                                }
+                                rc = SSMR3PutGCPhys(pSSM, GCPhysDup);
+                                fDup = true;
+                            }
                             else
                             {
                                 if (GCPhys == GCPhysLast + PAGE_SIZE)
@@ -1711,6 +1965,8 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         pVM->pgm.s.LiveSave.Ram.cReadyPages++;
                         if (fZero)
                             pVM->pgm.s.LiveSave.Ram.cZeroPages++;
+                        if (fDup)
+                            pVM->pgm.s.LiveSave.cDupPages++;
                         pVM->pgm.s.LiveSave.Ram.cDirtyPages--;
                         pVM->pgm.s.LiveSave.cSavedPages++;
                     }
@@ -1795,10 +2051,14 @@ static void pgmR3DoneRamPages(PVM pVM)
     else
         pVM->pgm.s.cMonitoredPages -= cMonitoredPages;
 
+    PPGMLIVESAVEDUPIDX pDupIdx = pVM->pgm.s.LiveSave.pDupIdxR3;
+    pVM->pgm.s.LiveSave.pDupIdxR3 = NULL;
+
     pgmUnlock(pVM);
 
     MMR3HeapFree(pvToFree);
     pvToFree = NULL;
+    MMR3HeapFree(pDupIdx);
 }
 
 
@@ -1891,6 +2151,7 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
                              + pVM->pgm.s.LiveSave.Ram.cDirtyPages
                              + cWrittenToPages;
     uint32_t i = pVM->pgm.s.LiveSave.iDirtyPagesHistory;
+    uint32_t const cDirtyPrev = pVM->pgm.s.LiveSave.acDirtyPagesHistory[(i + cHistoryEntries - 1) % cHistoryEntries];
     pVM->pgm.s.LiveSave.acDirtyPagesHistory[i] = cDirtyNow;
     pVM->pgm.s.LiveSave.iDirtyPagesHistory = (i + 1) % cHistoryEntries;
 
@@ -1920,6 +2181,18 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
                                           / ((long double)cNsElapsed / 1000000000.0) );
     pVM->pgm.s.LiveSave.cPagesPerSecond = cPagesPerSecond;
 
+    /*
+     * In post-copy mode the dirty pages aren't sent while the VM is suspended,
+     * so there is no point in more passes once the dirty set stops shrinking.
+     */
+    if (   pgmR3PostCopySrcIsEnabled(pVM)
+        && (   uPass >= 4
+            || (uPass >= 1 && cDirtyNow >= cDirtyPrev)))
+    {
+        Log(("pgmR3LiveVote: VINF_SUCCESS - post-copy pass=%d cDirtyNow=%u cDirtyPrev=%u\n", uPass, cDirtyNow, cDirtyPrev));
+        return VINF_SUCCESS;
+    }
+
     /*
      * Try make a decision.
      */
@@ -2637,6 +2910,8 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             case PGM_STATE_REC_RAM_ZERO:
             case PGM_STATE_REC_RAM_RAW:
             case PGM_STATE_REC_RAM_BALLOONED:
+            case PGM_STATE_REC_RAM_DUP:
+            case PGM_STATE_REC_RAM_POSTCOPY:
             {
                 /*
                  * Get the address and resolve it into a page descriptor.
@@ -2742,6 +3017,50 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                         break;
                     }
 
+                    case PGM_STATE_REC_RAM_DUP:
+                    {
+                        RTGCPHYS GCPhysSrc;
+                        rc = SSMR3GetGCPhys(pSSM, &GCPhysSrc);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        AssertLogRelMsgReturn(   !(GCPhysSrc & PAGE_OFFSET_MASK)
+                                              && GCPhysSrc != GCPhys,
+                                              ("GCPhys=%RGp GCPhysSrc=%RGp\n", GCPhys, GCPhysSrc), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        PPGMPAGE pSrcPage;
+                        rc = pgmPhysGetPageEx(pVM, GCPhysSrc, &pSrcPage);
+                        AssertLogRelMsgRCReturn(rc, ("rc=%Rrc %RGp\n", rc, GCPhysSrc), rc);
+
+                        /* Map the destination first as making it writable may
+                           involve allocating a page. */
+                        PGMPAGEMAPLOCK PgMpLck;
+                        void          *pvDstPage;
+                        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+
+                        PGMPAGEMAPLOCK PgMpLckSrc;
+                        void const    *pvSrcPage;
+                        rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pSrcPage, GCPhysSrc, &pvSrcPage, &PgMpLckSrc);
+                        if (RT_SUCCESS(rc))
+                        {
+                            memcpy(pvDstPage, pvSrcPage, PAGE_SIZE);
+                            pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLckSrc);
+                        }
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhysSrc=%RGp %R[pgmpage] rc=%Rrc\n", GCPhysSrc, pSrcPage, rc), rc);
+                        break;
+                    }
+
+                    case PGM_STATE_REC_RAM_POSTCOPY:
+                    {
+                        rc = pgmR3PostCopyTrgDeferPage(pVM, pPage, GCPhys);
+                        if (rc == VERR_PGM_POST_COPY_NOT_REGISTERED)
+                            return SSMR3SetLoadError(pSSM, rc, RT_SRC_POS,
+                                                     N_("The saved state leaves RAM pages on a post-copy teleportation source"));
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        break;
+                    }
+
                     default:
                         AssertMsgFailedReturn(("%#x\n", u8), VERR_PGM_SAVED_REC_TYPE);
                 }
@@ -3105,11 +3424,13 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
      */
     if (   (   uPass != SSM_PASS_FINAL
             && uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_DUP
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
             && uVersion != PGM_SAVED_STATE_VERSION_NO_RAM_CFG)
         || (   uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_DUP
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
@@ -3175,6 +3496,10 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
 
             pgmR3HandlerPhysicalUpdateAll(pVM);
 
+            /* Cover the pages left on the post-copy source, if any. */
+            rc = pgmR3PostCopyTrgLoadDone(pVM);
+            AssertLogRelRCReturn(rc, rc);
+
             /*
              * Change the paging mode and restore PGMCPU::GCPhysCR3.
              * (The latter requires the CPUM state to be restored already.)
@@ -21,7 +21,9 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_PGM_SHARED
 #include <VBox/vmm/pgm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/stam.h>
+#include <VBox/vmm/tm.h>
 #include <VBox/vmm/uvm.h>
 #include "PGMInternal.h"
 #include <VBox/vmm/vm.h>
@@ -264,6 +266,158 @@ VMMR3DECL(int) PGMR3SharedModuleCheckAll(PVM pVM)
 }
 
 
+/**
+ * Rendezvous callback that performs one dedup scan, see GMMR0DedupScanReq.
+ *
+ * @returns VBox strict status code.
+ * @param   pVM                 Pointer to the VM.
+ * @param   pVCpu               Pointer to the VMCPU of the calling EMT.
+ * @param   pvUser              Pointer to the scan request.
+ */
+static DECLCALLBACK(VBOXSTRICTRC) pgmR3DedupScanRendezvous(PVM pVM, PVMCPU pVCpu, void *pvUser)
+{
+    PGMMDEDUPSCANREQ pReq = (PGMMDEDUPSCANREQ)pvUser;
+    NOREF(pVCpu);
+
+    /* Don't interfere with the dirty page tracking of a live save. */
+    if (pVM->pgm.s.LiveSave.fActive)
+        return VINF_SUCCESS;
+
+    /* Flush all pending handy page operations before changing any shared page assignments. */
+    int rc = PGMR3PhysAllocateHandyPages(pVM);
+    AssertRC(rc);
+
+    /*
+     * Lock it here as we can't deal with busy locks in this ring-0 path.
+     */
+    pgmLock(pVM);
+    pgmR3PhysAssertSharedPageChecksums(pVM);
+    pReq->GCPhysNext = pVM->pgm.s.Dedup.GCPhysNext;
+    pReq->cMaxPages  = pVM->pgm.s.Dedup.cPagesPerScan;
+    rc = GMMR3DedupScan(pVM, pReq);
+    if (RT_SUCCESS(rc))
+        pVM->pgm.s.Dedup.GCPhysNext = pReq->GCPhysNext;
+    pgmR3PhysAssertSharedPageChecksums(pVM);
+    pgmUnlock(pVM);
+
+    LogFlow(("pgmR3DedupScanRendezvous: rc=%Rrc scanned=%u shared=%u merged=%u next=%RGp\n",
+             rc, pReq->cScanned, pReq->cShared, pReq->cMerged, pReq->GCPhysNext));
+    return rc;
+}
+
+
+/**
+ * Dedup scan helper (called on the way out).
+ *
+ * @param   pVM         Pointer to the VM.
+ */
+static DECLCALLBACK(void) pgmR3DedupScanHelper(PVM pVM)
+{
+    GMMDEDUPSCANREQ Req;
+    RT_ZERO(Req);
+
+    /* We must stall other VCPUs as we'd otherwise have to send IPI flush commands for every single change we make. */
+    STAM_REL_PROFILE_START(&pVM->pgm.s.Dedup.StatScan, a);
+    int rc = VMMR3EmtRendezvous(pVM, VMMEMTRENDEZVOUS_FLAGS_TYPE_ONCE, pgmR3DedupScanRendezvous, &Req);
+    STAM_REL_PROFILE_STOP(&pVM->pgm.s.Dedup.StatScan, a);
+
+    if (RT_SUCCESS(rc))
+    {
+        STAM_REL_COUNTER_ADD(&pVM->pgm.s.Dedup.StatScanned, Req.cScanned);
+        STAM_REL_COUNTER_ADD(&pVM->pgm.s.Dedup.StatShared, Req.cShared);
+        STAM_REL_COUNTER_ADD(&pVM->pgm.s.Dedup.StatMerged, Req.cMerged);
+        if (Req.fWrapped)
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.Dedup.StatPasses);
+    }
+    else if (   rc == VERR_NOT_IMPLEMENTED
+             || rc == VERR_NO_MEMORY)
+    {
+        LogRel(("PGM: Disabling the dedup scanner: %Rrc\n", rc));
+        TMTimerStop(pVM->pgm.s.Dedup.pTimerR3);
+    }
+    else
+        AssertLogRelRC(rc);
+
+    ASMAtomicWriteBool(&pVM->pgm.s.Dedup.fPending, false);
+}
+
+
+/**
+ * Timer callback that kicks off the next dedup scan.
+ *
+ * @param   pVM             Pointer to the VM.
+ * @param   pTimer          The timer handle.
+ * @param   pvUser          Unused.
+ */
+static DECLCALLBACK(void) pgmR3DedupScanTimer(PVM pVM, PTMTIMER pTimer, void *pvUser)
+{
+    NOREF(pvUser);
+
+    /* Only while running, the EMTs are busy with other stuff otherwise. Skip
+       this round if the previous scan hasn't been serviced yet. */
+    if (   VMR3GetState(pVM) == VMSTATE_RUNNING
+        && !ASMAtomicXchgBool(&pVM->pgm.s.Dedup.fPending, true))
+    {
+        int rc = VMR3ReqCallNoWait(pVM, VMCPUID_ANY_QUEUE, (PFNRT)pgmR3DedupScanHelper, 1, pVM);
+        if (RT_FAILURE(rc))
+            ASMAtomicWriteBool(&pVM->pgm.s.Dedup.fPending, false);
+    }
+
+    TMTimerSetMillies(pTimer, pVM->pgm.s.Dedup.cMsInterval);
+}
+
+
+/**
+ * Initializes the content based page sharing scanner.
+ *
+ * This complements the guest assisted shared module scheme by looking for
+ * identical pages in guest RAM on its own, at a rate of PagesPerScan pages
+ * every Interval milliseconds.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 Pointer to the VM.
+ */
+int pgmR3DedupScanInit(PVM pVM)
+{
+    PCFGMNODE pCfgDedup = CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM/DedupScan");
+
+    /** @cfgm{/PGM/DedupScan/Enabled, bool, false}
+     * Whether to scan guest RAM for pages with identical content and share
+     * them.  This requires page sharing to be enabled in GMM. */
+    bool fEnabled;
+    int rc = CFGMR3QueryBoolDef(pCfgDedup, "Enabled", &fEnabled, false);
+    AssertLogRelRCReturn(rc, rc);
+
+    /** @cfgm{/PGM/DedupScan/PagesPerScan, uint32_t, 256, 1, 1M}
+     * The max number of guest pages to look at in each scan.  Larger values
+     * means longer stalls of the EMTs. */
+    rc = CFGMR3QueryU32Def(pCfgDedup, "PagesPerScan", &pVM->pgm.s.Dedup.cPagesPerScan, 256);
+    AssertLogRelRCReturn(rc, rc);
+    if (pVM->pgm.s.Dedup.cPagesPerScan < 1 || pVM->pgm.s.Dedup.cPagesPerScan > _1M)
+        return VMSetError(pVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                          "Configuration error: /PGM/DedupScan/PagesPerScan=%u is out of range (1..1M)",
+                          pVM->pgm.s.Dedup.cPagesPerScan);
+
+    /** @cfgm{/PGM/DedupScan/Interval, uint32_t, 50, 1, 60000}
+     * The number of milliseconds between scans. */
+    rc = CFGMR3QueryU32Def(pCfgDedup, "Interval", &pVM->pgm.s.Dedup.cMsInterval, 50);
+    AssertLogRelRCReturn(rc, rc);
+    if (pVM->pgm.s.Dedup.cMsInterval < 1 || pVM->pgm.s.Dedup.cMsInterval > 60000)
+        return VMSetError(pVM, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                          "Configuration error: /PGM/DedupScan/Interval=%u is out of range (1..60000)",
+                          pVM->pgm.s.Dedup.cMsInterval);
+
+    if (!fEnabled)
+        return VINF_SUCCESS;
+
+    LogRel(("PGM: Dedup scanner enabled, %u pages every %u ms\n", pVM->pgm.s.Dedup.cPagesPerScan, pVM->pgm.s.Dedup.cMsInterval));
+    rc = TMR3TimerCreateInternal(pVM, TMCLOCK_REAL, pgmR3DedupScanTimer, NULL, "PGM Dedup Scanner", &pVM->pgm.s.Dedup.pTimerR3);
+    AssertRCReturn(rc, rc);
+
+    return TMTimerSetMillies(pVM->pgm.s.Dedup.pTimerR3, pVM->pgm.s.Dedup.cMsInterval);
+}
+
+
 # ifdef DEBUG
 /**
  * Query the state of a page in a shared module
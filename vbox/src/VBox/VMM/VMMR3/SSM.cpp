@@ -112,7 +112,10 @@
  *       - type 5: Named data - length prefixed name followed by the data. This
  *                 type is not implemented yet as we're missing the API part, so
  *                 the type assignment is tentative.
- *       - types 6 thru 15 are current undefined.
+ *       - type 6: Raw data compressed in large blocks by worker threads. The
+ *                 data is prefixed by a 8-bit codec field and a 32-bit field
+ *                 containing the length of the uncompressed data.
+ *       - types 7 thru 15 are current undefined.
  *   - bit 4: Important (set), can be skipped (clear).
  *   - bit 5: Undefined flag, must be zero.
  *   - bit 6: Undefined flag, must be zero.
@@ -128,6 +131,22 @@
  * needed updating after the data was written.)
  *
  *
+ * @section sec_ssm_zip             Multi-threaded Compression
+ *
+ * By default the unit data is compressed page by page with LZF on the thread
+ * executing the unit callbacks.  When /SSM/Compression is set to "lzf-mt" or
+ * "zlib" in CFGM, the unit data is instead collected into 64KB blocks that are
+ * compressed by a pool of worker threads (SSMZIPPOOL) and written as type 6
+ * records.  The saving thread retires the blocks in submission order, so the
+ * records end up in the stream in the same order as the data was put, and the
+ * stream layer, the directory and the checksumming are not affected.  Such
+ * streams have the SSMFILEHDR_FLAGS_STREAM_ZIP header flag set so older
+ * versions refuse to load them.
+ *
+ * The load side reads type 6 records ahead up to the end of the unit and
+ * decompresses them in parallel using the same kind of worker pool.
+ *
+ *
  * @section sec_ssm_future          Future Changes
  *
  * There are plans to extend SSM to make it easier to be both backwards and
@@ -145,6 +164,7 @@
 *******************************************************************************/
 #define LOG_GROUP LOG_GROUP_SSM
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/pdmcritsect.h>
@@ -161,6 +181,7 @@
 #include <iprt/crc.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/param.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
@@ -192,6 +213,8 @@
 #define SSMFILEHDR_FLAGS_STREAM_CRC32           RT_BIT_32(0)
 /** Indicates that the file was produced by a live save. */
 #define SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE       RT_BIT_32(1)
+/** The data units may contain SSM_REC_TYPE_RAW_ZIP records. */
+#define SSMFILEHDR_FLAGS_STREAM_ZIP             RT_BIT_32(2)
 /** @} */
 
 /** The directory magic. */
@@ -227,10 +250,15 @@
 /** Named data items.
  * A length prefix zero terminated string (i.e. max 255) followed by the data.  */
 #define SSM_REC_TYPE_NAMED                      5
+/** Raw data compressed by a worker thread.
+ * The record header is followed by a 8-bit field containing the codec
+ * (SSM_ZIP_CODEC_XXX) and a 32-bit little endian field containing the size of
+ * the uncompressed data.  The compressed data is after it. */
+#define SSM_REC_TYPE_RAW_ZIP                    6
 /** Macro for validating the record type.
  * This can be used with the flags+type byte, no need to mask out the type first. */
 #define SSM_REC_TYPE_IS_VALID(u8Type)           (   ((u8Type) & SSM_REC_TYPE_MASK) >  SSM_REC_TYPE_INVALID \
-                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_NAMED )
+                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_RAW_ZIP )
 /** @} */
 
 /** The flag mask. */
@@ -285,6 +313,21 @@
 #define SSM_ZIP_BLOCK_SIZE                      _4K
 AssertCompile(SSM_ZIP_BLOCK_SIZE / _1K * _1K == SSM_ZIP_BLOCK_SIZE);
 
+/** The size of the blocks compressed by the worker threads. */
+#define SSM_ZIP_MT_BLOCK_SIZE                   _64K
+/** The max number of compression worker threads. */
+#define SSM_ZIP_MT_MAX_THREADS                  16
+/** The size of the SSM_REC_TYPE_RAW_ZIP record prefix (codec + size). */
+#define SSM_ZIP_MT_REC_PREFIX_SIZE              5
+
+/** @name SSM_REC_TYPE_RAW_ZIP codecs.
+ * @{ */
+/** LZF (fast). */
+#define SSM_ZIP_CODEC_LZF                       UINT8_C(1)
+/** zlib deflate (better ratio). */
+#define SSM_ZIP_CODEC_ZLIB                      UINT8_C(2)
+/** @} */
+
 
 /**
  * Asserts that the handle is writable and returns with VERR_SSM_INVALID_STATE
@@ -447,6 +490,97 @@ typedef struct SSMSTRM
 typedef SSMSTRM *PSSMSTRM;
 
 
+/** SSMZIPSLOT::enmState values. */
+typedef enum SSMZIPSLOTSTATE
+{
+    /** The slot is unused or being filled by the owner of the pool. */
+    SSMZIPSLOTSTATE_FREE = 0,
+    /** The slot is waiting for a worker thread. */
+    SSMZIPSLOTSTATE_QUEUED,
+    /** A worker thread is (de)compressing the slot. */
+    SSMZIPSLOTSTATE_BUSY,
+    /** The slot has been processed and is waiting for the owner. */
+    SSMZIPSLOTSTATE_DONE
+} SSMZIPSLOTSTATE;
+
+/**
+ * A block processed by the compression worker threads.
+ */
+typedef struct SSMZIPSLOT
+{
+    /** The slot state (SSMZIPSLOTSTATE). */
+    uint32_t volatile       enmState;
+    /** The codec (SSM_ZIP_CODEC_XXX). */
+    uint8_t                 uCodec;
+    /** The number of input bytes. */
+    uint32_t                cbIn;
+    /** The number of output bytes.  When compressing this is zero if the block
+     * didn't compress.  When decompressing this is set to the expected size
+     * before the block is queued. */
+    uint32_t                cbOut;
+    /** The status of the decompression. */
+    int32_t                 rc;
+    /** The input data. */
+    uint8_t                 abIn[SSM_ZIP_MT_BLOCK_SIZE];
+    /** The output data. */
+    uint8_t                 abOut[SSM_ZIP_MT_BLOCK_SIZE];
+} SSMZIPSLOT;
+/** Pointer to a compression slot. */
+typedef SSMZIPSLOT *PSSMZIPSLOT;
+
+/**
+ * Compression worker pool.
+ *
+ * The slots form a ring.  The owner of the pool (the saving or loading thread)
+ * queues blocks at iHead + cQueued and retires them in order from iHead, so the
+ * order of the data is retained no matter which worker finishes first.
+ */
+typedef struct SSMZIPPOOL
+{
+    /** Compress (set) or decompress (clear). */
+    bool                    fCompress;
+    /** Set when the worker threads should terminate. */
+    bool volatile           fTerminate;
+    /** The codec to compress with (SSM_ZIP_CODEC_XXX). */
+    uint8_t                 uCodec;
+    /** The compression level. */
+    RTZIPLEVEL              enmLevel;
+    /** Signalled when a slot has been queued. */
+    RTSEMEVENT              hEvtWork;
+    /** Signalled when a slot has been processed. */
+    RTSEMEVENT              hEvtDone;
+    /** The number of slots. */
+    uint32_t                cSlots;
+    /** The oldest queued slot. */
+    uint32_t volatile       iHead;
+    /** The number of queued slots not yet retired. */
+    uint32_t                cQueued;
+    /** The slots (cSlots, page allocated). */
+    PSSMZIPSLOT             paSlots;
+
+    /** @name Load only.
+     * @{ */
+    /** The slot currently being consumed, NULL if none. */
+    PSSMZIPSLOT             pCur;
+    /** Whether the read ahead stopped at a record which is not compressed. */
+    bool                    fStashed;
+    /** The stashed record: type and flags. */
+    uint8_t                 u8StashTypeAndFlags;
+    /** The stashed record: end of data indicator. */
+    bool                    fStashEndOfData;
+    /** The stashed record: unread bytes in the record. */
+    uint32_t                cbStashRecLeft;
+    /** @} */
+
+    /** The number of worker threads. */
+    uint32_t                cThreads;
+    /** The worker thread handles. */
+    RTTHREAD                ahThreads[SSM_ZIP_MT_MAX_THREADS];
+} SSMZIPPOOL;
+/** Pointer to a compression worker pool. */
+typedef SSMZIPPOOL *PSSMZIPPOOL;
+
+
 /**
  * Handle structure.
  */
@@ -473,6 +607,8 @@ typedef struct SSMHANDLE
     uint64_t                offUnitUser;
     /** Indicates that this is a live save or restore operation. */
     bool                    fLiveSave;
+    /** The compression worker pool, NULL if not used. */
+    PSSMZIPPOOL             pZipPool;
 
     /** Pointer to the progress callback function. */
     PFNVMPROGRESS           pfnProgress;
@@ -2971,6 +3107,262 @@ static void ssmR3StrmStartIoThread(PSSMSTRM pStrm)
 
 #endif /* !SSM_STANDALONE */
 
+/**
+ * Converts a SSM_ZIP_CODEC_XXX value to an IPRT compression type.
+ *
+ * @returns The compression type, RTZIPTYPE_INVALID if unknown.
+ * @param   uCodec      The codec.
+ */
+static RTZIPTYPE ssmR3ZipCodecToType(uint8_t uCodec)
+{
+    switch (uCodec)
+    {
+        case SSM_ZIP_CODEC_LZF:     return RTZIPTYPE_LZF;
+        case SSM_ZIP_CODEC_ZLIB:    return RTZIPTYPE_ZLIB;
+        default:                    return RTZIPTYPE_INVALID;
+    }
+}
+
+
+/**
+ * Compresses or decompresses one slot on a worker thread.
+ *
+ * @param   pPool       The worker pool.
+ * @param   pSlot       The slot.
+ */
+static void ssmR3ZipProcessSlot(PSSMZIPPOOL pPool, PSSMZIPSLOT pSlot)
+{
+    RTZIPTYPE enmType = ssmR3ZipCodecToType(pSlot->uCodec);
+    if (pPool->fCompress)
+    {
+        /* Only keep the result if it saves at least 1/16th, like for LZF. */
+        size_t cbOut = pSlot->cbIn - pSlot->cbIn / 16;
+        int rc = RTZipBlockCompress(enmType, pPool->enmLevel, 0 /*fFlags*/,
+                                    &pSlot->abIn[0], pSlot->cbIn,
+                                    &pSlot->abOut[0], cbOut, &cbOut);
+        pSlot->cbOut = RT_SUCCESS(rc) ? (uint32_t)cbOut : 0;
+        pSlot->rc    = VINF_SUCCESS;
+    }
+    else
+    {
+        size_t cbOut = 0;
+        int rc = RTZipBlockDecompress(enmType, 0 /*fFlags*/,
+                                      &pSlot->abIn[0], pSlot->cbIn, NULL /*pcbSrcActual*/,
+                                      &pSlot->abOut[0], pSlot->cbOut, &cbOut);
+        if (RT_SUCCESS(rc) && cbOut != pSlot->cbOut)
+            rc = VERR_SSM_INTEGRITY_DECOMPRESSION;
+        pSlot->rc = rc;
+    }
+}
+
+
+/**
+ * Compression worker thread.
+ *
+ * @returns VINF_SUCCESS.
+ * @param   hSelf       The thread handle.
+ * @param   pvPool      The worker pool.
+ */
+static DECLCALLBACK(int) ssmR3ZipThread(RTTHREAD hSelf, void *pvPool)
+{
+    PSSMZIPPOOL pPool = (PSSMZIPPOOL)pvPool;
+    NOREF(hSelf);
+
+    while (!ASMAtomicReadBool(&pPool->fTerminate))
+    {
+        /*
+         * Grab the oldest queued slot.
+         */
+        PSSMZIPSLOT pSlot  = NULL;
+        uint32_t    iSlot  = ASMAtomicReadU32(&pPool->iHead);
+        for (uint32_t i = 0; i < pPool->cSlots; i++, iSlot = (iSlot + 1) % pPool->cSlots)
+            if (ASMAtomicCmpXchgU32(&pPool->paSlots[iSlot].enmState, SSMZIPSLOTSTATE_BUSY, SSMZIPSLOTSTATE_QUEUED))
+            {
+                pSlot = &pPool->paSlots[iSlot];
+                break;
+            }
+        if (!pSlot)
+        {
+            RTSemEventWait(pPool->hEvtWork, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        /* Let another worker look for more work while we're busy. */
+        RTSemEventSignal(pPool->hEvtWork);
+
+        ssmR3ZipProcessSlot(pPool, pSlot);
+        ASMAtomicWriteU32(&pSlot->enmState, SSMZIPSLOTSTATE_DONE);
+        RTSemEventSignal(pPool->hEvtDone);
+    }
+
+    /* Pass the termination request on to the next worker. */
+    RTSemEventSignal(pPool->hEvtWork);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Destroys a worker pool.
+ *
+ * Blocks until the worker threads have terminated.
+ *
+ * @param   pPool       The worker pool, NULL is fine.
+ */
+static void ssmR3ZipPoolDestroy(PSSMZIPPOOL pPool)
+{
+    if (!pPool)
+        return;
+
+    ASMAtomicWriteBool(&pPool->fTerminate, true);
+    if (pPool->hEvtWork != NIL_RTSEMEVENT)
+        RTSemEventSignal(pPool->hEvtWork);
+    for (uint32_t i = 0; i < pPool->cThreads; i++)
+    {
+        int rc = RTThreadWait(pPool->ahThreads[i], RT_INDEFINITE_WAIT, NULL);
+        AssertRC(rc);
+    }
+
+    RTSemEventDestroy(pPool->hEvtWork);
+    RTSemEventDestroy(pPool->hEvtDone);
+    if (pPool->paSlots)
+        RTMemPageFree(pPool->paSlots, pPool->cSlots * sizeof(SSMZIPSLOT));
+    RTMemFree(pPool);
+}
+
+
+/**
+ * Creates a worker pool.
+ *
+ * @returns VBox status code.
+ * @param   fCompress   Whether to compress or decompress.
+ * @param   uCodec      The codec to compress with (SSM_ZIP_CODEC_XXX).
+ *                      Ignored when decompressing.
+ * @param   enmLevel    The compression level.  Ignored when decompressing.
+ * @param   cThreads    The number of worker threads.
+ * @param   ppPool      Where to return the pool.
+ */
+static int ssmR3ZipPoolCreate(bool fCompress, uint8_t uCodec, RTZIPLEVEL enmLevel, uint32_t cThreads, PSSMZIPPOOL *ppPool)
+{
+    cThreads = RT_MAX(RT_MIN(cThreads, SSM_ZIP_MT_MAX_THREADS), 1);
+
+    PSSMZIPPOOL pPool = (PSSMZIPPOOL)RTMemAllocZ(sizeof(*pPool));
+    if (!pPool)
+        return VERR_NO_MEMORY;
+    pPool->fCompress  = fCompress;
+    pPool->fTerminate = false;
+    pPool->uCodec     = uCodec;
+    pPool->enmLevel   = enmLevel;
+    pPool->hEvtWork   = NIL_RTSEMEVENT;
+    pPool->hEvtDone   = NIL_RTSEMEVENT;
+    pPool->cSlots     = cThreads * 2;
+    pPool->iHead      = 0;
+    pPool->cQueued    = 0;
+    pPool->pCur       = NULL;
+    pPool->fStashed   = false;
+    pPool->cThreads   = 0;
+
+    int rc = VERR_NO_MEMORY;
+    pPool->paSlots = (PSSMZIPSLOT)RTMemPageAllocZ(pPool->cSlots * sizeof(SSMZIPSLOT));
+    if (pPool->paSlots)
+        rc = RTSemEventCreate(&pPool->hEvtWork);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPool->hEvtDone);
+    while (   RT_SUCCESS(rc)
+           && pPool->cThreads < cThreads)
+    {
+        rc = RTThreadCreateF(&pPool->ahThreads[pPool->cThreads], ssmR3ZipThread, pPool, 0, RTTHREADTYPE_DEFAULT,
+                             RTTHREADFLAGS_WAITABLE, "SSM-Zip%u", pPool->cThreads);
+        if (RT_SUCCESS(rc))
+            pPool->cThreads++;
+        else if (pPool->cThreads > 0)
+        {
+            LogRel(("SSM: WARNING: Could only create %u of %u compression threads (rc=%Rrc).\n", pPool->cThreads, cThreads, rc));
+            rc = VINF_SUCCESS;
+            break;
+        }
+    }
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Failed to create the compression worker pool: %Rrc\n", rc));
+        ssmR3ZipPoolDestroy(pPool);
+        return rc;
+    }
+
+    *ppPool = pPool;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Queues the slot at the end of the ring for processing.
+ *
+ * @param   pPool       The worker pool.
+ * @param   pSlot       The slot, must be the one at iHead + cQueued.
+ */
+static void ssmR3ZipPoolQueue(PSSMZIPPOOL pPool, PSSMZIPSLOT pSlot)
+{
+    Assert(pSlot == &pPool->paSlots[(pPool->iHead + pPool->cQueued) % pPool->cSlots]);
+    Assert(pPool->cQueued < pPool->cSlots);
+    pPool->cQueued++;
+    ASMAtomicWriteU32(&pSlot->enmState, SSMZIPSLOTSTATE_QUEUED);
+    RTSemEventSignal(pPool->hEvtWork);
+}
+
+
+/**
+ * Waits for the oldest queued slot to be processed and takes it off the ring.
+ *
+ * The slot must be set to SSMZIPSLOTSTATE_FREE again once the caller is done
+ * with it.
+ *
+ * @returns The slot.
+ * @param   pPool       The worker pool.
+ */
+static PSSMZIPSLOT ssmR3ZipPoolRetire(PSSMZIPPOOL pPool)
+{
+    Assert(pPool->cQueued > 0);
+    PSSMZIPSLOT pSlot = &pPool->paSlots[pPool->iHead];
+    while (ASMAtomicReadU32(&pSlot->enmState) != SSMZIPSLOTSTATE_DONE)
+        RTSemEventWait(pPool->hEvtDone, RT_INDEFINITE_WAIT);
+
+    ASMAtomicWriteU32(&pPool->iHead, (pPool->iHead + 1) % pPool->cSlots);
+    pPool->cQueued--;
+    return pSlot;
+}
+
+
+/**
+ * Discards all read ahead and decompressed blocks.
+ *
+ * @param   pPool           The worker pool, NULL is fine.
+ */
+static void ssmR3ZipPoolReset(PSSMZIPPOOL pPool)
+{
+    if (!pPool)
+        return;
+    if (pPool->pCur)
+    {
+        ASMAtomicWriteU32(&pPool->pCur->enmState, SSMZIPSLOTSTATE_FREE);
+        pPool->pCur = NULL;
+    }
+    while (pPool->cQueued > 0)
+        ASMAtomicWriteU32(&ssmR3ZipPoolRetire(pPool)->enmState, SSMZIPSLOTSTATE_FREE);
+    pPool->fStashed = false;
+}
+
+
+/**
+ * Gets the default number of compression worker threads.
+ *
+ * @returns Thread count.
+ */
+static uint32_t ssmR3ZipDefaultThreads(void)
+{
+    RTCPUID cCpus = RTMpGetOnlineCount();
+    return RT_MAX(RT_MIN(cCpus, SSM_ZIP_MT_MAX_THREADS / 2), 1);
+}
+
+
 /**
  * Works the progress calculation for non-live saves and restores.
  *
@@ -3215,6 +3607,129 @@ static int ssmR3DataWriteRecHdr(PSSMHANDLE pSSM, size_t cb, uint8_t u8TypeAndFla
 }
 
 
+/**
+ * Writes a block processed by the compression workers to the stream.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pSlot           The retired slot.
+ */
+static int ssmR3DataWriteZipSlot(PSSMHANDLE pSSM, PSSMZIPSLOT pSlot)
+{
+    int rc;
+    if (pSlot->cbOut)
+    {
+        uint8_t abPrefix[SSM_ZIP_MT_REC_PREFIX_SIZE];
+        abPrefix[0] = pSlot->uCodec;
+        abPrefix[1] = RT_BYTE1(pSlot->cbIn);
+        abPrefix[2] = RT_BYTE2(pSlot->cbIn);
+        abPrefix[3] = RT_BYTE3(pSlot->cbIn);
+        abPrefix[4] = RT_BYTE4(pSlot->cbIn);
+        rc = ssmR3DataWriteRecHdr(pSSM, sizeof(abPrefix) + pSlot->cbOut,
+                                  SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZIP);
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataWriteRaw(pSSM, &abPrefix[0], sizeof(abPrefix));
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataWriteRaw(pSSM, &pSlot->abOut[0], pSlot->cbOut);
+    }
+    else
+    {
+        /* Didn't compress, store it. */
+        rc = ssmR3DataWriteRecHdr(pSSM, pSlot->cbIn, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataWriteRaw(pSSM, &pSlot->abIn[0], pSlot->cbIn);
+    }
+
+    pSlot->cbIn = 0;
+    ASMAtomicWriteU32(&pSlot->enmState, SSMZIPSLOTSTATE_FREE);
+    return rc;
+}
+
+
+/**
+ * Adds data to the block currently being filled for the compression workers,
+ * queuing full blocks and writing out finished ones in order.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ * @param   pvBuf           The bits to write.
+ * @param   cbBuf           The number of bytes to write.
+ */
+static int ssmR3DataWriteZip(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
+{
+    PSSMZIPPOOL pPool = pSSM->pZipPool;
+    while (cbBuf > 0)
+    {
+        /* Make sure the slot after the queued ones is free. */
+        if (pPool->cQueued == pPool->cSlots)
+        {
+            int rc = ssmR3DataWriteZipSlot(pSSM, ssmR3ZipPoolRetire(pPool));
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+
+        PSSMZIPSLOT pSlot  = &pPool->paSlots[(pPool->iHead + pPool->cQueued) % pPool->cSlots];
+        uint32_t    cbCopy = (uint32_t)RT_MIN(cbBuf, sizeof(pSlot->abIn) - pSlot->cbIn);
+        memcpy(&pSlot->abIn[pSlot->cbIn], pvBuf, cbCopy);
+        pSlot->cbIn += cbCopy;
+        cbBuf       -= cbCopy;
+        pvBuf        = (uint8_t const *)pvBuf + cbCopy;
+
+        if (pSlot->cbIn == sizeof(pSlot->abIn))
+        {
+            pSlot->uCodec = pPool->uCodec;
+            ssmR3ZipPoolQueue(pPool, pSlot);
+
+            /* Write out what's done without blocking. */
+            while (   pPool->cQueued > 0
+                   && ASMAtomicReadU32(&pPool->paSlots[pPool->iHead].enmState) == SSMZIPSLOTSTATE_DONE)
+            {
+                int rc = ssmR3DataWriteZipSlot(pSSM, ssmR3ZipPoolRetire(pPool));
+                if (RT_FAILURE(rc))
+                    return rc;
+            }
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Queues the partially filled block and writes out all the blocks queued for
+ * the compression workers.
+ *
+ * This must be done before the termination record is written.
+ *
+ * @returns VBox status code. Sets pSSM->rc on failure.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataWriteZipFlush(PSSMHANDLE pSSM)
+{
+    PSSMZIPPOOL pPool = pSSM->pZipPool;
+    if (!pPool)
+        return VINF_SUCCESS;
+
+    if (pPool->cQueued < pPool->cSlots)
+    {
+        PSSMZIPSLOT pSlot = &pPool->paSlots[(pPool->iHead + pPool->cQueued) % pPool->cSlots];
+        if (pSlot->cbIn)
+        {
+            pSlot->uCodec = pPool->uCodec;
+            ssmR3ZipPoolQueue(pPool, pSlot);
+        }
+    }
+
+    int rc = VINF_SUCCESS;
+    while (pPool->cQueued > 0)
+    {
+        int rc2 = ssmR3DataWriteZipSlot(pSSM, ssmR3ZipPoolRetire(pPool));
+        if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+            rc = rc2;
+    }
+    return rc;
+}
+
+
 /**
  * Worker that flushes the buffered data.
  *
@@ -3236,9 +3751,15 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
      * (No need for fancy optimizations here any longer since the stream is
      * fully buffered.)
      */
-    int rc = ssmR3DataWriteRecHdr(pSSM, cb, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
-    if (RT_SUCCESS(rc))
-        rc = ssmR3DataWriteRaw(pSSM, pSSM->u.Write.abDataBuffer, cb);
+    int rc;
+    if (!pSSM->pZipPool)
+    {
+        rc = ssmR3DataWriteRecHdr(pSSM, cb, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataWriteRaw(pSSM, pSSM->u.Write.abDataBuffer, cb);
+    }
+    else
+        rc = ssmR3DataWriteZip(pSSM, pSSM->u.Write.abDataBuffer, cb);
     ssmR3ProgressByByte(pSSM, cb);
     return rc;
 }
@@ -3259,6 +3780,16 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
     {
         pSSM->offUnitUser += cbBuf;
 
+        /*
+         * Leave it to the compression workers if we've got any.
+         */
+        if (pSSM->pZipPool)
+        {
+            rc = ssmR3DataWriteZip(pSSM, pvBuf, cbBuf);
+            ssmR3ProgressByByte(pSSM, cbBuf);
+            return rc;
+        }
+
         /*
          * Split it up into compression blocks.
          */
@@ -4206,6 +4737,8 @@ static int ssmR3LiveControlEmit(PSSMHANDLE pSSM, long double lrdPct, uint32_t uP
         ssmR3DataWrite(pSSM, &u16PartsPerTenThousand, sizeof(u16PartsPerTenThousand));
 
         rc = ssmR3DataFlushBuffer(pSSM); /* will return SSMHANDLE::rc if it is set */
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataWriteZipFlush(pSSM);
         if (RT_SUCCESS(rc))
         {
             /*
@@ -4383,6 +4916,9 @@ static int ssmR3SaveDoClose(PVM pVM, PSSMHANDLE pSSM)
             ssmR3SaveDoDoneRun(pVM, pSSM);
     }
 
+    ssmR3ZipPoolDestroy(pSSM->pZipPool);
+    pSSM->pZipPool = NULL;
+
     /*
      * Trash the handle before freeing it.
      */
@@ -4674,7 +5210,11 @@ static int ssmR3SaveDoExecRun(PVM pVM, PSSMHANDLE pSSM)
         if (RT_FAILURE(rc) && RT_SUCCESS_NP(pSSM->rc))
             pSSM->rc = rc;
         else
+        {
             rc = ssmR3DataFlushBuffer(pSSM); /* will return SSMHANDLE::rc if it is set */
+            if (RT_SUCCESS(rc))
+                rc = ssmR3DataWriteZipFlush(pSSM);
+        }
         if (RT_FAILURE(rc))
         {
             LogRel(("SSM: Execute save failed with rc=%Rrc for data unit '%s'/#%u.\n", rc, pUnit->szName, pUnit->u32Instance));
@@ -4878,6 +5418,8 @@ static int ssmR3WriteHeaderAndClearPerUnitData(PVM pVM, PSSMHANDLE pSSM)
     FileHdr.fFlags       = SSMFILEHDR_FLAGS_STREAM_CRC32;
     if (pSSM->fLiveSave)
         FileHdr.fFlags  |= SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE;
+    if (pSSM->pZipPool)
+        FileHdr.fFlags  |= SSMFILEHDR_FLAGS_STREAM_ZIP;
     FileHdr.cbMaxDecompr = RT_SIZEOFMEMB(SSMHANDLE, u.Read.abDataBuffer);
     FileHdr.u32CRC       = 0;
     FileHdr.u32CRC       = RTCrc32(&FileHdr, sizeof(FileHdr));
@@ -4898,6 +5440,71 @@ static int ssmR3WriteHeaderAndClearPerUnitData(PVM pVM, PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Creates the compression worker pool for a save operation according to the
+ * /SSM configuration.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 Pointer to the VM.
+ * @param   ppPool              Where to return the pool.  Set to NULL if the
+ *                              unit data should be compressed the
+ *                              traditional way.
+ */
+static int ssmR3SaveCreateZipPool(PVM pVM, PSSMZIPPOOL *ppPool)
+{
+    *ppPool = NULL;
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pVM), "SSM");
+
+    /** @cfgm{SSM/Compression, string, "lzf"}
+     * How to compress the unit data.  "lzf" compresses pages on the saving
+     * thread, "lzf-mt" and "zlib" use worker threads and larger blocks.  */
+    char szCodec[16];
+    int rc = CFGMR3QueryStringDef(pCfg, "Compression", szCodec, sizeof(szCodec), "lzf");
+    AssertLogRelRCReturn(rc, rc);
+    uint8_t uCodec;
+    if (!RTStrICmp(szCodec, "lzf"))
+        return VINF_SUCCESS;
+    if (!RTStrICmp(szCodec, "lzf-mt"))
+        uCodec = SSM_ZIP_CODEC_LZF;
+    else if (!RTStrICmp(szCodec, "zlib"))
+        uCodec = SSM_ZIP_CODEC_ZLIB;
+    else
+    {
+        LogRel(("SSM: Unknown compression '%s'\n", szCodec));
+        return VERR_INVALID_PARAMETER;
+    }
+
+    /** @cfgm{SSM/CompressionLevel, string, "fast"}
+     * The zlib compression level: "fast", "default" or "max". */
+    char szLevel[16];
+    rc = CFGMR3QueryStringDef(pCfg, "CompressionLevel", szLevel, sizeof(szLevel), "fast");
+    AssertLogRelRCReturn(rc, rc);
+    RTZIPLEVEL enmLevel;
+    if (!RTStrICmp(szLevel, "fast"))
+        enmLevel = RTZIPLEVEL_FAST;
+    else if (!RTStrICmp(szLevel, "default"))
+        enmLevel = RTZIPLEVEL_DEFAULT;
+    else if (!RTStrICmp(szLevel, "max"))
+        enmLevel = RTZIPLEVEL_MAX;
+    else
+    {
+        LogRel(("SSM: Unknown compression level '%s'\n", szLevel));
+        return VERR_INVALID_PARAMETER;
+    }
+
+    /** @cfgm{SSM/CompressionThreads, uint32_t, online CPUs up to 8, 1, 16}
+     * The number of compression worker threads. */
+    uint32_t cThreads;
+    rc = CFGMR3QueryU32Def(pCfg, "CompressionThreads", &cThreads, ssmR3ZipDefaultThreads());
+    AssertLogRelRCReturn(rc, rc);
+
+    rc = ssmR3ZipPoolCreate(true /*fCompress*/, uCodec, enmLevel, cThreads, ppPool);
+    if (RT_SUCCESS(rc))
+        LogRel(("SSM: Compressing with %s (%s) using %u threads\n", szCodec, szLevel, (*ppPool)->cThreads));
+    return rc;
+}
+
+
 /**
  * Creates a new saved state file.
  *
@@ -4943,10 +5550,20 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
     pSSM->uPercentDone              = 0;
     pSSM->uReportedLivePercent      = 0;
     pSSM->pszFilename               = pszFilename;
+    pSSM->pZipPool                  = NULL;
     pSSM->u.Write.offDataBuffer     = 0;
     pSSM->u.Write.cMsMaxDowntime    = UINT32_MAX;
 
-    int rc;
+    /*
+     * Start the compression workers if configured.
+     */
+    int rc = ssmR3SaveCreateZipPool(pVM, &pSSM->pZipPool);
+    if (RT_FAILURE(rc))
+    {
+        RTMemFree(pSSM);
+        return rc;
+    }
+
     if (pStreamOps)
         rc = ssmR3StrmInit(&pSSM->Strm, pStreamOps, pvStreamOpsUser, true /*fWrite*/, true /*fChecksummed*/, 8 /*cBuffers*/);
     else
@@ -4954,6 +5571,7 @@ static int ssmR3SaveDoCreateFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS
     if (RT_FAILURE(rc))
     {
         LogRel(("SSM: Failed to create save state file '%s', rc=%Rrc.\n",  pszFilename, rc));
+        ssmR3ZipPoolDestroy(pSSM->pZipPool);
         RTMemFree(pSSM);
         return rc;
     }
@@ -5250,6 +5868,8 @@ static int ssmR3LiveDoExecRun(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
             if (rc == VINF_SSM_DONT_CALL_AGAIN)
                 pUnit->fDoneLive = true;
             rc = ssmR3DataFlushBuffer(pSSM); /* will return SSMHANDLE::rc if it is set */
+            if (RT_SUCCESS(rc))
+                rc = ssmR3DataWriteZipFlush(pSSM);
         }
         if (RT_FAILURE(rc))
         {
@@ -5554,6 +6174,7 @@ VMMR3_INT_DECL(int) SSMR3LiveSave(PVM pVM, uint32_t cMsMaxDowntime,
     }
     /* bail out. */
     int rc2 = ssmR3StrmClose(&pSSM->Strm, pSSM->rc == VERR_SSM_CANCELLED);
+    ssmR3ZipPoolDestroy(pSSM->pZipPool);
     RTMemFree(pSSM);
     rc2 = RTFileDelete(pszFilename);
     AssertRC(rc2);
@@ -5688,6 +6309,8 @@ static void ssmR3DataReadBeginV2(PSSMHANDLE pSSM)
     Assert(!pSSM->u.Read.cbDataBuffer || pSSM->u.Read.cbDataBuffer == pSSM->u.Read.offDataBuffer);
     Assert(!pSSM->u.Read.cbRecLeft);
 
+    ssmR3ZipPoolReset(pSSM->pZipPool);
+
     pSSM->offUnit     = 0;
     pSSM->offUnitUser = 0;
     pSSM->u.Read.cbRecLeft      = 0;
@@ -5849,6 +6472,23 @@ static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
 }
 
 
+/**
+ * Copies data out of the current decompressed SSM_REC_TYPE_RAW_ZIP block.
+ *
+ * @param   pSSM            The saved state handle.
+ * @param   pvDst           Where to put the data.
+ * @param   cbToRead        How much to copy, must not exceed the remainder
+ *                          of the record.
+ */
+DECLINLINE(void) ssmR3DataReadV2Zip(PSSMHANDLE pSSM, void *pvDst, uint32_t cbToRead)
+{
+    PSSMZIPSLOT pSlot = pSSM->pZipPool->pCur;
+    Assert(cbToRead <= pSSM->u.Read.cbRecLeft);
+    memcpy(pvDst, &pSlot->abOut[pSlot->cbOut - pSSM->u.Read.cbRecLeft], cbToRead);
+    pSSM->u.Read.cbRecLeft -= cbToRead;
+}
+
+
 /**
  * Reads and checks the raw zero "header".
  *
@@ -5877,7 +6517,7 @@ DECLINLINE(int) ssmR3DataReadV2RawZeroHdr(PSSMHANDLE pSSM, uint32_t *pcbZero)
 
 
 /**
- * Worker for reading the record header.
+ * Worker for reading the record header from the stream.
  *
  * It sets pSSM->u.Read.cbRecLeft, pSSM->u.Read.u8TypeAndFlags and
  * pSSM->u.Read.fEndOfData.  When a termination record is encounter, it will be
@@ -5887,7 +6527,7 @@ DECLINLINE(int) ssmR3DataReadV2RawZeroHdr(PSSMHANDLE pSSM, uint32_t *pcbZero)
  * @returns VBox status code. Does not set pSSM->rc.
  * @param   pSSM            The saved state handle.
  */
-static int ssmR3DataReadRecHdrV2(PSSMHANDLE pSSM)
+static int ssmR3DataReadRecHdrV2Strm(PSSMHANDLE pSSM)
 {
     AssertLogRelReturn(!pSSM->u.Read.fEndOfData, VERR_SSM_LOADED_TOO_MUCH);
 
@@ -6045,6 +6685,184 @@ static int ssmR3DataReadRecHdrV2(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Reads the payload of the current SSM_REC_TYPE_RAW_ZIP record into the next
+ * free slot and queues it for decompression.
+ *
+ * @returns VBox status code. Does not set pSSM->rc.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataReadZipQueueRec(PSSMHANDLE pSSM)
+{
+    PSSMZIPPOOL pPool = pSSM->pZipPool;
+    PSSMZIPSLOT pSlot = &pPool->paSlots[(pPool->iHead + pPool->cQueued) % pPool->cSlots];
+    Assert(ASMAtomicReadU32(&pSlot->enmState) == SSMZIPSLOTSTATE_FREE);
+
+    uint32_t cbRec = pSSM->u.Read.cbRecLeft;
+    AssertLogRelMsgReturn(   cbRec > SSM_ZIP_MT_REC_PREFIX_SIZE
+                          && cbRec - SSM_ZIP_MT_REC_PREFIX_SIZE <= sizeof(pSlot->abIn),
+                          ("%#x\n", cbRec), VERR_SSM_INTEGRITY_DECOMPRESSION);
+
+    uint8_t abPrefix[SSM_ZIP_MT_REC_PREFIX_SIZE];
+    int rc = ssmR3DataReadV2Raw(pSSM, &abPrefix[0], sizeof(abPrefix));
+    if (RT_FAILURE(rc))
+        return rc;
+    uint32_t cbDecompr = RT_MAKE_U32_FROM_U8(abPrefix[1], abPrefix[2], abPrefix[3], abPrefix[4]);
+    AssertLogRelMsgReturn(ssmR3ZipCodecToType(abPrefix[0]) != RTZIPTYPE_INVALID,
+                          ("codec=%#x\n", abPrefix[0]), VERR_SSM_INTEGRITY_DECOMPRESSION);
+    AssertLogRelMsgReturn(cbDecompr > 0 && cbDecompr <= sizeof(pSlot->abOut),
+                          ("%#x\n", cbDecompr), VERR_SSM_INTEGRITY_DECOMPRESSION);
+
+    pSlot->uCodec = abPrefix[0];
+    pSlot->cbIn   = cbRec - SSM_ZIP_MT_REC_PREFIX_SIZE;
+    pSlot->cbOut  = cbDecompr;
+    pSlot->rc     = VINF_SUCCESS;
+    rc = ssmR3DataReadV2Raw(pSSM, &pSlot->abIn[0], pSlot->cbIn);
+    if (RT_FAILURE(rc))
+        return rc;
+    pSSM->u.Read.cbRecLeft = 0;
+
+    ssmR3ZipPoolQueue(pPool, pSlot);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Reads compressed records ahead until all slots are in use or a record of
+ * another type is encountered, which is then stashed away.
+ *
+ * @returns VBox status code. Does not set pSSM->rc.
+ * @param   pSSM            The saved state handle.
+ * @param   fHaveHdr        Whether the current record header is an unread
+ *                          SSM_REC_TYPE_RAW_ZIP record.
+ */
+static int ssmR3DataReadZipAhead(PSSMHANDLE pSSM, bool fHaveHdr)
+{
+    PSSMZIPPOOL pPool = pSSM->pZipPool;
+    while (   pPool->cQueued < pPool->cSlots
+           && !pPool->fStashed)
+    {
+        if (!fHaveHdr)
+        {
+            int rc = ssmR3DataReadRecHdrV2Strm(pSSM);
+            if (RT_FAILURE(rc))
+                return rc;
+            if (   pSSM->u.Read.fEndOfData
+                || (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) != SSM_REC_TYPE_RAW_ZIP)
+            {
+                pPool->fStashed            = true;
+                pPool->u8StashTypeAndFlags = pSSM->u.Read.u8TypeAndFlags;
+                pPool->cbStashRecLeft      = pSSM->u.Read.cbRecLeft;
+                pPool->fStashEndOfData     = pSSM->u.Read.fEndOfData;
+                pSSM->u.Read.fEndOfData    = false;
+                pSSM->u.Read.cbRecLeft     = 0;
+                break;
+            }
+        }
+        fHaveHdr = false;
+
+        int rc = ssmR3DataReadZipQueueRec(pSSM);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Makes the next decompressed block or the stashed record the current record.
+ *
+ * @returns VBox status code. Does not set pSSM->rc.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataReadZipNextRec(PSSMHANDLE pSSM)
+{
+    PSSMZIPPOOL pPool = pSSM->pZipPool;
+
+    /* Done with the current block. */
+    if (pPool->pCur)
+    {
+        ASMAtomicWriteU32(&pPool->pCur->enmState, SSMZIPSLOTSTATE_FREE);
+        pPool->pCur = NULL;
+    }
+
+    if (!pPool->cQueued)
+    {
+        Assert(pPool->fStashed);
+        pPool->fStashed             = false;
+        pSSM->u.Read.u8TypeAndFlags = pPool->u8StashTypeAndFlags;
+        pSSM->u.Read.cbRecLeft      = pPool->cbStashRecLeft;
+        pSSM->u.Read.fEndOfData     = pPool->fStashEndOfData;
+        return VINF_SUCCESS;
+    }
+
+    /* Keep the workers busy. */
+    int rc = ssmR3DataReadZipAhead(pSSM, false /*fHaveHdr*/);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PSSMZIPSLOT pSlot = ssmR3ZipPoolRetire(pPool);
+    pPool->pCur = pSlot;
+    if (RT_FAILURE(pSlot->rc))
+    {
+        LogRel(("SSM: Failed to decompress block: cbCompr=%#x cbDecompr=%#x rc=%Rrc\n", pSlot->cbIn, pSlot->cbOut, pSlot->rc));
+        return VERR_SSM_INTEGRITY_DECOMPRESSION;
+    }
+
+    pSSM->u.Read.u8TypeAndFlags = SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZIP;
+    pSSM->u.Read.cbRecLeft      = pSlot->cbOut;
+    Log3(("ssmR3DataReadZipNextRec: %08llx|%08llx/%08x: ZIP\n", ssmR3StrmTell(&pSSM->Strm), pSSM->offUnit, pSlot->cbOut));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Worker for reading the record header.
+ *
+ * Takes care of the compressed records that have been read ahead, see
+ * ssmR3DataReadRecHdrV2Strm for the rest.
+ *
+ * @returns VBox status code. Does not set pSSM->rc.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataReadRecHdrV2(PSSMHANDLE pSSM)
+{
+    PSSMZIPPOOL pPool = pSSM->pZipPool;
+    if (   pPool
+        && (pPool->cQueued || pPool->fStashed))
+        return ssmR3DataReadZipNextRec(pSSM);
+
+    int rc = ssmR3DataReadRecHdrV2Strm(pSSM);
+    if (   RT_SUCCESS(rc)
+        && !pSSM->u.Read.fEndOfData
+        && (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_ZIP)
+    {
+        /*
+         * Compressed records come in batches, so read ahead and let the
+         * workers decompress them in parallel.
+         */
+        if (!pPool)
+        {
+            rc = ssmR3ZipPoolCreate(false /*fCompress*/, 0 /*uCodec*/, RTZIPLEVEL_DEFAULT, ssmR3ZipDefaultThreads(),
+                                    &pSSM->pZipPool);
+            if (RT_FAILURE(rc))
+                return rc;
+            pPool = pSSM->pZipPool;
+        }
+        else if (pPool->pCur)
+        {
+            ASMAtomicWriteU32(&pPool->pCur->enmState, SSMZIPSLOTSTATE_FREE);
+            pPool->pCur = NULL;
+        }
+
+        rc = ssmR3DataReadZipAhead(pSSM, true /*fHaveHdr*/);
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataReadZipNextRec(pSSM);
+    }
+    return rc;
+}
+
+
 /**
  * Buffer miss, do an unbuffered read.
  *
@@ -6131,6 +6949,13 @@ static int ssmR3DataReadUnbufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
                 break;
             }
 
+            case SSM_REC_TYPE_RAW_ZIP:
+            {
+                cbToRead = (uint32_t)RT_MIN(cbBuf, pSSM->u.Read.cbRecLeft);
+                ssmR3DataReadV2Zip(pSSM, pvBuf, cbToRead);
+                break;
+            }
+
             case SSM_REC_TYPE_RAW_ZERO:
             {
                 int rc = ssmR3DataReadV2RawZeroHdr(pSSM, &cbToRead);
@@ -6241,6 +7066,14 @@ static int ssmR3DataReadBufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
                 break;
             }
 
+            case SSM_REC_TYPE_RAW_ZIP:
+            {
+                cbToRead = RT_MIN(sizeof(pSSM->u.Read.abDataBuffer), pSSM->u.Read.cbRecLeft);
+                ssmR3DataReadV2Zip(pSSM, &pSSM->u.Read.abDataBuffer[0], cbToRead);
+                pSSM->u.Read.cbDataBuffer = cbToRead;
+                break;
+            }
+
             case SSM_REC_TYPE_RAW_ZERO:
             {
                 int rc = ssmR3DataReadV2RawZeroHdr(pSSM, &cbToRead);
@@ -7255,6 +8088,10 @@ VMMR3DECL(int) SSMR3SkipToEndOfUnit(PSSMHANDLE pSSM)
         {
             do
             {
+                /* decompressed records have already been read from the stream */
+                if ((pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) == SSM_REC_TYPE_RAW_ZIP)
+                    pSSM->u.Read.cbRecLeft = 0;
+
                 /* read the rest of the current record */
                 while (pSSM->u.Read.cbRecLeft)
                 {
@@ -7544,7 +8381,7 @@ static int ssmR3HeaderAndValidate(PSSMHANDLE pSSM, bool fChecksumIt, bool fCheck
                 LogRel(("SSM: Reserved header field isn't zero: %02x\n", uHdr.v2_0.u8Reserved));
                 return VERR_SSM_INTEGRITY;
             }
-            if (uHdr.v2_0.fFlags & ~(SSMFILEHDR_FLAGS_STREAM_CRC32 | SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE))
+            if (uHdr.v2_0.fFlags & ~(SSMFILEHDR_FLAGS_STREAM_CRC32 | SSMFILEHDR_FLAGS_STREAM_LIVE_SAVE | SSMFILEHDR_FLAGS_STREAM_ZIP))
             {
                 LogRel(("SSM: Unknown header flags: %08x\n", uHdr.v2_0.fFlags));
                 return VERR_SSM_INTEGRITY;
@@ -7772,6 +8609,7 @@ static int ssmR3OpenFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS pStreamO
     pSSM->uPercentDone          = 2;
     pSSM->uReportedLivePercent  = 0;
     pSSM->pszFilename           = pszFilename;
+    pSSM->pZipPool              = NULL;
 
     pSSM->u.Read.pZipDecompV1   = NULL;
     pSSM->u.Read.uFmtVerMajor   = UINT32_MAX;
@@ -8520,6 +9358,8 @@ VMMR3DECL(int) SSMR3Load(PVM pVM, const char *pszFilename, PCSSMSTRMOPS pStreamO
 
         ssmR3SetCancellable(pVM, &Handle, false);
         ssmR3StrmClose(&Handle.Strm, Handle.rc == VERR_SSM_CANCELLED);
+        ssmR3ZipPoolDestroy(Handle.pZipPool);
+        Handle.pZipPool = NULL;
         rc = Handle.rc;
     }
 
@@ -8749,6 +9589,8 @@ VMMR3DECL(int) SSMR3Close(PSSMHANDLE pSSM)
         RTZipDecompDestroy(pSSM->u.Read.pZipDecompV1);
         pSSM->u.Read.pZipDecompV1 = NULL;
     }
+    ssmR3ZipPoolDestroy(pSSM->pZipPool);
+    pSSM->pZipPool = NULL;
     RTMemFree(pSSM);
     return rc;
 }
@@ -170,6 +170,7 @@ static uint64_t             tmR3CalibrateTSC(PVM pVM);
 static DECLCALLBACK(int)    tmR3Save(PVM pVM, PSSMHANDLE pSSM);
 static DECLCALLBACK(int)    tmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass);
 static DECLCALLBACK(void)   tmR3TimerCallback(PRTTIMER pTimer, void *pvUser, uint64_t iTick);
+static int                  tmR3TimerQueueGrowHeap(PVM pVM, PTMTIMERQUEUE pQueue);
 static void                 tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue);
 static void                 tmR3TimerQueueRunVirtualSync(PVM pVM);
 static DECLCALLBACK(int)    tmR3SetWarpDrive(PUVM pUVM, uint32_t u32Percent);
@@ -686,6 +687,8 @@ VMM_INT_DECL(int) TMR3Init(PVM pVM)
     STAM_REG(pVM, &pVM->tm.s.StatVirtualResume,                       STAMTYPE_COUNTER, "/TM/VirtualResume",                   STAMUNIT_OCCURENCES, "The number of times TMR3TimerResume was called.");
 
     STAM_REG(pVM, &pVM->tm.s.StatTimerCallbackSetFF,                  STAMTYPE_COUNTER, "/TM/CallbackSetFF",                   STAMUNIT_OCCURENCES, "The number of times the timer callback set FF.");
+    STAM_REL_REG(pVM, &pVM->tm.s.StatTimerCallback,                  STAMTYPE_COUNTER, "/TM/Callback",                        STAMUNIT_OCCURENCES, "The number of times the host timer (TM/TimerMillies) fired.");
+    STAM_REL_REG(pVM, &pVM->tm.s.StatHostTimerStopped,               STAMTYPE_COUNTER, "/TM/HostTimerStopped",                STAMUNIT_OCCURENCES, "The number of times the host timer was stopped because all EMTs were blocking in a tickless halt.");
 
     STAM_REG(pVM, &pVM->tm.s.StatTSCCatchupLE010,                     STAMTYPE_COUNTER, "/TM/TSC/Intercept/CatchupLE010",      STAMUNIT_OCCURENCES, "In catch-up mode, 10% or lower.");
     STAM_REG(pVM, &pVM->tm.s.StatTSCCatchupLE025,                     STAMTYPE_COUNTER, "/TM/TSC/Intercept/CatchupLE025",      STAMUNIT_OCCURENCES, "In catch-up mode, 25%-11%.");
@@ -1290,6 +1293,47 @@ static DECLCALLBACK(int) tmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, u
 }
 
 
+/**
+ * Doubles the size of the active timer heap of a queue.
+ *
+ * The heap must always have room for every timer created on the clock so
+ * that linking a timer never has to allocate, which isn't possible in R0 and
+ * RC.
+ *
+ * @returns VBox status code.
+ * @param   pVM         Pointer to the VM.
+ * @param   pQueue      The timer queue.
+ *
+ * @remarks Called while owning the timer lock and, for the virtual sync
+ *          queue, the virtual sync lock.
+ */
+static int tmR3TimerQueueGrowHeap(PVM pVM, PTMTIMERQUEUE pQueue)
+{
+    TM_ASSERT_TIMER_LOCK_OWNERSHIP(pVM);
+    Assert(pQueue->enmClock != TMCLOCK_VIRTUAL_SYNC || PDMCritSectIsOwner(&pVM->tm.s.VirtualSyncLock));
+
+    uint32_t const cEntriesOld = pQueue->cHeapEntries;
+    uint32_t const cEntriesNew = cEntriesOld ? cEntriesOld * 2 : 32;
+    AssertReturn(cEntriesNew > cEntriesOld, VERR_OUT_OF_RANGE);
+
+    PTMTIMERHEAPENTRY paNew;
+    int rc = MMHyperAlloc(pVM, cEntriesNew * sizeof(paNew[0]), 0, MM_TAG_TM, (void **)&paNew);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PTMTIMERHEAPENTRY paOld = cEntriesOld ? TMTIMER_GET_HEAP(pQueue) : NULL;
+    if (pQueue->cActive)
+        memcpy(paNew, paOld, pQueue->cActive * sizeof(paNew[0]));
+    pQueue->offHeap      = (int32_t)((intptr_t)paNew - (intptr_t)pQueue);
+    pQueue->cHeapEntries = cEntriesNew;
+    if (paOld)
+        MMHyperFree(pVM, paOld);
+
+    Log(("TM: Grew the heap of queue %d from %u to %u entries\n", pQueue->enmClock, cEntriesOld, cEntriesNew));
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Internal TMR3TimerCreate worker.
  *
@@ -1303,6 +1347,26 @@ static int tmr3TimerCreate(PVM pVM, TMCLOCK enmClock, const char *pszDesc, PPTMT
 {
     VM_ASSERT_EMT(pVM);
 
+    /*
+     * Reserve room in the active timer heap of the queue.
+     */
+    PTMTIMERQUEUE pQueue = &pVM->tm.s.paTimerQueuesR3[enmClock];
+    int rc = VINF_SUCCESS;
+    TM_LOCK_TIMERS(pVM);
+    if (pQueue->cTimers >= pQueue->cHeapEntries)
+    {
+        if (enmClock == TMCLOCK_VIRTUAL_SYNC)
+            PDMCritSectEnter(&pVM->tm.s.VirtualSyncLock, VERR_IGNORED);
+        rc = tmR3TimerQueueGrowHeap(pVM, pQueue);
+        if (enmClock == TMCLOCK_VIRTUAL_SYNC)
+            PDMCritSectLeave(&pVM->tm.s.VirtualSyncLock);
+    }
+    if (RT_SUCCESS(rc))
+        pQueue->cTimers++;
+    TM_UNLOCK_TIMERS(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Allocate the timer.
      */
@@ -1316,9 +1380,14 @@ static int tmr3TimerCreate(PVM pVM, TMCLOCK enmClock, const char *pszDesc, PPTMT
 
     if (!pTimer)
     {
-        int rc = MMHyperAlloc(pVM, sizeof(*pTimer), 0, MM_TAG_TM, (void **)&pTimer);
+        rc = MMHyperAlloc(pVM, sizeof(*pTimer), 0, MM_TAG_TM, (void **)&pTimer);
         if (RT_FAILURE(rc))
+        {
+            TM_LOCK_TIMERS(pVM);
+            pQueue->cTimers--;
+            TM_UNLOCK_TIMERS(pVM);
             return rc;
+        }
         Log3(("TM: Allocated new timer %p\n", pTimer));
     }
 
@@ -1332,8 +1401,7 @@ static int tmr3TimerCreate(PVM pVM, TMCLOCK enmClock, const char *pszDesc, PPTMT
     pTimer->pVMRC           = pVM->pVMRC;
     pTimer->enmState        = TMTIMERSTATE_STOPPED;
     pTimer->offScheduleNext = 0;
-    pTimer->offNext         = 0;
-    pTimer->offPrev         = 0;
+    pTimer->idxHeap         = TMTIMER_HEAP_IDX_NIL;
     pTimer->pvUser          = NULL;
     pTimer->pCritSect       = NULL;
     pTimer->pszDesc         = pszDesc;
@@ -1643,24 +1711,10 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
     }
 
     /*
-     * Unlink from the active list.
+     * Unlink from the active heap.
      */
-    if (fActive)
-    {
-        const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-        const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
-        if (pPrev)
-            TMTIMER_SET_NEXT(pPrev, pNext);
-        else
-        {
-            TMTIMER_SET_HEAD(pQueue, pNext);
-            pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-        }
-        if (pNext)
-            TMTIMER_SET_PREV(pNext, pPrev);
-        pTimer->offNext = 0;
-        pTimer->offPrev = 0;
-    }
+    if (fActive && pTimer->idxHeap != TMTIMER_HEAP_IDX_NIL)
+        tmTimerQueueHeapRemove(pQueue, pTimer);
 
     /*
      * Unlink from the schedule list by running it.
@@ -1677,7 +1731,9 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
     /*
      * Read to move the timer from the created list and onto the free list.
      */
-    Assert(!pTimer->offNext); Assert(!pTimer->offPrev); Assert(!pTimer->offScheduleNext);
+    Assert(pTimer->idxHeap == TMTIMER_HEAP_IDX_NIL); Assert(!pTimer->offScheduleNext);
+    Assert(pQueue->cTimers > 0);
+    pQueue->cTimers--;
 
     /* unlink from created list */
     if (pTimer->pBigPrev)
@@ -1888,6 +1944,7 @@ static DECLCALLBACK(void) tmR3TimerCallback(PRTTIMER pTimer, void *pvUser, uint6
     PVM     pVM      = (PVM)pvUser;
     PVMCPU  pVCpuDst = &pVM->aCpus[pVM->tm.s.idTimerCpu];
     NOREF(pTimer);
+    STAM_REL_COUNTER_INC(&pVM->tm.s.StatTimerCallback);
 
     AssertCompile(TMCLOCK_MAX == 4);
 #ifdef DEBUG_Sander /* very annoying, keep it private. */
@@ -1972,7 +2029,7 @@ VMMR3DECL(void) TMR3TimerQueuesDo(PVM pVM)
     STAM_PROFILE_ADV_STOP(&pVM->tm.s.aStatDoQueues[TMCLOCK_VIRTUAL], s2);
 
     /* TMCLOCK_TSC */
-    Assert(!pVM->tm.s.paTimerQueuesR3[TMCLOCK_TSC].offActive); /* not used */
+    Assert(!pVM->tm.s.paTimerQueuesR3[TMCLOCK_TSC].cActive); /* not used */
 
     /* TMCLOCK_REAL */
     STAM_PROFILE_ADV_START(&pVM->tm.s.aStatDoQueues[TMCLOCK_REAL], s3);
@@ -2022,15 +2079,24 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
      *      However, we only allow EMT to handle EXPIRED_PENDING
      *      timers, thus enabling the timer handler function to
      *      arm the timer again.
+     *
+     * N.B. The heap head is re-read for every timer as the callbacks
+     *      may link timers and create new ones (growing the heap).  The
+     *      number of timers fired is limited to the number active on
+     *      entry so a timer re-arming itself in the past cannot keep
+     *      us here forever.
      */
-    PTMTIMER pNext = TMTIMER_GET_HEAD(pQueue);
-    if (!pNext)
+    if (!pQueue->cActive)
         return;
-    const uint64_t u64Now = tmClock(pVM, pQueue->enmClock);
-    while (pNext && pNext->u64Expire <= u64Now)
+    const uint64_t  u64Now         = tmClock(pVM, pQueue->enmClock);
+    uint32_t        cLeft          = pQueue->cActive;
+    PTMTIMER        pTimerBlocked  = NULL;
+    while (pQueue->cActive && cLeft > 0)
     {
-        PTMTIMER        pTimer    = pNext;
-        pNext = TMTIMER_GET_NEXT(pTimer);
+        PTMTIMERHEAPENTRY pHead = TMTIMER_GET_HEAP(pQueue);
+        if (pHead->u64Expire > u64Now)
+            break;
+        PTMTIMER        pTimer    = TMTIMER_HEAP_GET_TIMER(pQueue, pHead);
         PPDMCRITSECT    pCritSect = pTimer->pCritSect;
         if (pCritSect)
             PDMCritSectEnter(pCritSect, VERR_IGNORED);
@@ -2038,23 +2104,14 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
               pTimer, tmTimerState(pTimer->enmState), pTimer->enmClock, pTimer->enmType, pTimer->u64Expire, u64Now, pTimer->pszDesc));
         bool fRc;
         TM_TRY_SET_STATE(pTimer, TMTIMERSTATE_EXPIRED_GET_UNLINK, TMTIMERSTATE_ACTIVE, fRc);
+        bool const fBlocked = !fRc;
         if (fRc)
         {
             Assert(!pTimer->offScheduleNext); /* this can trigger falsely */
+            cLeft--;
 
             /* unlink */
-            const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-            if (pPrev)
-                TMTIMER_SET_NEXT(pPrev, pNext);
-            else
-            {
-                TMTIMER_SET_HEAD(pQueue, pNext);
-                pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-            }
-            if (pNext)
-                TMTIMER_SET_PREV(pNext, pPrev);
-            pTimer->offNext = 0;
-            pTimer->offPrev = 0;
+            tmTimerQueueHeapRemove(pQueue, pTimer);
 
             /* fire */
             TM_SET_STATE(pTimer, TMTIMERSTATE_EXPIRED_DELIVER);
@@ -2076,6 +2133,19 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
         }
         if (pCritSect)
             PDMCritSectLeave(pCritSect);
+
+        /*
+         * The head timer is being modified by another thread and cannot be
+         * skipped like in a list.  Schedule the queue once to get it out of
+         * the way; if it's still in flux, leave the rest for the next run.
+         */
+        if (fBlocked)
+        {
+            if (!pQueue->offSchedule || pTimer == pTimerBlocked)
+                break;
+            pTimerBlocked = pTimer;
+            tmTimerQueueSchedule(pVM, pQueue);
+        }
     } /* run loop */
 }
 
@@ -2211,11 +2281,11 @@ static void tmR3TimerQueueRunVirtualSync(PVM pVM)
 #ifdef VBOX_STRICT
     uint64_t u64Prev = u64Now; NOREF(u64Prev);
 #endif
-    while (pNext && pNext->u64Expire <= u64Max)
+    uint32_t cLeft = pQueue->cActive; /* see tmR3TimerQueueRun */
+    for (; cLeft > 0 && (pNext = TMTIMER_GET_HEAD(pQueue)) != NULL && pNext->u64Expire <= u64Max; cLeft--)
     {
         /* Advance */
         PTMTIMER pTimer = pNext;
-        pNext = TMTIMER_GET_NEXT(pTimer);
 
         /* Take the associated lock. */
         PPDMCRITSECT pCritSect = pTimer->pCritSect;
@@ -2455,6 +2525,169 @@ VMMR3_INT_DECL(void) TMR3VirtualSyncFF(PVM pVM, PVMCPU pVCpu)
 }
 
 
+/**
+ * Gets the GIP timestamp of the next timer event for a halting EMT, taking all
+ * the clocks into account.
+ *
+ * This differs from TMTimerPollGIP in that TMCLOCK_REAL timers are considered
+ * as well, so the EMT doing timer work doesn't have to depend on the host
+ * timer (TM/TimerMillies) to be woken up for them, and that EMTs not dedicated
+ * to timer work aren't given an arbitrary deadline.  Those will be woken up by
+ * whoever needs their attention.
+ *
+ * @returns The GIP timestamp of the next event.
+ *          0 if the next event has already expired (VMCPU_FF_TIMER is set).
+ *          UINT64_MAX if there is nothing armed which the caller must attend to.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @param   pVCpu       Pointer to the shared VMCPU structure of the caller.
+ * @param   pu64Delta   Where to store the delta (ns). UINT64_MAX if nothing
+ *                      is armed.
+ *
+ * @thread  EMT(pVCpu)
+ */
+VMMR3_INT_DECL(uint64_t) TMR3TimerPollGIPAllClocks(PVM pVM, PVMCPU pVCpu, uint64_t *pu64Delta)
+{
+    VMCPU_ASSERT_EMT(pVCpu);
+    if (pVCpu->idCpu != pVM->tm.s.idTimerCpu)
+    {
+        *pu64Delta = UINT64_MAX;
+        return UINT64_MAX;
+    }
+
+    /*
+     * TMCLOCK_VIRTUAL and TMCLOCK_VIRTUAL_SYNC.
+     */
+    uint64_t u64Delta;
+    uint64_t u64GipTime = TMTimerPollGIP(pVM, pVCpu, &u64Delta);
+    if (!u64GipTime)
+    {
+        *pu64Delta = 0;
+        return 0;
+    }
+
+    /*
+     * TMCLOCK_REAL - the clock is RTTimeMilliTS, i.e. GIP time in milliseconds.
+     */
+    uint64_t const u64ExpireReal = ASMAtomicReadU64(&pVM->tm.s.paTimerQueuesR3[TMCLOCK_REAL].u64Expire);
+    if (u64ExpireReal != INT64_MAX)
+    {
+        uint64_t const u64NowGip      = RTTimeNanoTS();
+        uint64_t const u64GipTimeReal = u64ExpireReal * RT_NS_1MS;
+        if (u64GipTimeReal <= u64NowGip)
+        {
+            if (    !VMCPU_FF_ISSET(pVCpu, VMCPU_FF_TIMER)
+                &&  !ASMAtomicReadBool(&pVM->tm.s.fRunningQueues))
+            {
+                Log5(("TM(%u): FF: 0 -> 1\n", __LINE__));
+                VMCPU_FF_SET(pVCpu, VMCPU_FF_TIMER);
+#ifdef VBOX_WITH_REM
+                REMR3NotifyTimerPending(pVM, pVCpu);
+#endif
+            }
+            *pu64Delta = 0;
+            return 0;
+        }
+        if (u64GipTimeReal < u64GipTime)
+        {
+            u64GipTime = u64GipTimeReal;
+            u64Delta   = u64GipTimeReal - u64NowGip;
+        }
+    }
+
+    *pu64Delta = u64Delta;
+    return u64GipTime;
+}
+
+
+/**
+ * Stops the host timer (TM/TimerMillies).
+ *
+ * @param   pVM         Pointer to the VM.
+ * @remarks Caller owns the timer lock.
+ */
+static void tmR3HostTimerStop(PVM pVM)
+{
+    TM_ASSERT_TIMER_LOCK_OWNERSHIP(pVM);
+    Assert(!pVM->tm.s.fHostTimerStopped);
+#ifdef RT_OS_WINDOWS
+    /* The ring-3 windows timers can't be stopped and started, recreate it. */
+    int rc = RTTimerDestroy(pVM->tm.s.pTimer);
+    pVM->tm.s.pTimer = NULL;
+#else
+    int rc = RTTimerStop(pVM->tm.s.pTimer);
+#endif
+    AssertLogRelRC(rc);
+    pVM->tm.s.fHostTimerStopped = true;
+    STAM_REL_COUNTER_INC(&pVM->tm.s.StatHostTimerStopped);
+}
+
+
+/**
+ * Starts the host timer (TM/TimerMillies) again after tmR3HostTimerStop.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @remarks Caller owns the timer lock.
+ */
+static void tmR3HostTimerStart(PVM pVM)
+{
+    TM_ASSERT_TIMER_LOCK_OWNERSHIP(pVM);
+    Assert(pVM->tm.s.fHostTimerStopped);
+#ifdef RT_OS_WINDOWS
+    int rc = RTTimerCreate(&pVM->tm.s.pTimer, pVM->tm.s.u32TimerMillies, tmR3TimerCallback, pVM);
+#else
+    int rc = RTTimerStart(pVM->tm.s.pTimer, pVM->tm.s.u32TimerMillies * UINT64_C(1000000));
+#endif
+    AssertLogRelRC(rc);
+    pVM->tm.s.fHostTimerStopped = false;
+}
+
+
+/**
+ * Notifies TM that an EMT is about to block in a tickless halt, i.e. until the
+ * deadline returned by TMR3TimerPollGIPAllClocks.
+ *
+ * When all the EMTs are doing that, the host timer (TM/TimerMillies) is
+ * stopped.  The dedicated timer EMT works out its wake up time from all the
+ * clocks itself, and since no EMT is executing, timers can only be changed by
+ * other threads, which kick the timer EMT (tmScheduleNotify).  The timer is
+ * started again by TMR3HaltTicklessLeave when the first EMT returns.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @thread  EMT
+ */
+VMMR3_INT_DECL(void) TMR3HaltTicklessEnter(PVM pVM)
+{
+    VM_ASSERT_EMT(pVM);
+    TM_LOCK_TIMERS(pVM);
+    Assert(pVM->tm.s.cHaltedTickless < pVM->cCpus);
+    if (   ++pVM->tm.s.cHaltedTickless == pVM->cCpus
+        && !pVM->tm.s.fHostTimerStopped
+        && pVM->tm.s.pTimer)
+        tmR3HostTimerStop(pVM);
+    TM_UNLOCK_TIMERS(pVM);
+}
+
+
+/**
+ * Notifies TM that an EMT returned from blocking in a tickless halt.
+ *
+ * @param   pVM         Pointer to the VM.
+ * @thread  EMT
+ * @see     TMR3HaltTicklessEnter
+ */
+VMMR3_INT_DECL(void) TMR3HaltTicklessLeave(PVM pVM)
+{
+    VM_ASSERT_EMT(pVM);
+    TM_LOCK_TIMERS(pVM);
+    Assert(pVM->tm.s.cHaltedTickless > 0);
+    pVM->tm.s.cHaltedTickless--;
+    if (pVM->tm.s.fHostTimerStopped)
+        tmR3HostTimerStart(pVM);
+    TM_UNLOCK_TIMERS(pVM);
+}
+
+
 /** @name Saved state values
  * @{ */
 #define TMTIMERSTATE_SAVED_PENDING_STOP         4
@@ -3026,11 +3259,10 @@ static DECLCALLBACK(void) tmR3TimerInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char
     NOREF(pszArgs);
     pHlp->pfnPrintf(pHlp,
                     "Timers (pVM=%p)\n"
-                    "%.*s %.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
+                    "%.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
                     pVM,
                     sizeof(RTR3PTR) * 2,        "pTimerR3        ",
-                    sizeof(int32_t) * 2,        "offNext         ",
-                    sizeof(int32_t) * 2,        "offPrev         ",
+                    sizeof(int32_t) * 2,        "idxHeap         ",
                     sizeof(int32_t) * 2,        "offSched        ",
                                                 "Time",
                                                 "Expire",
@@ -3040,10 +3272,9 @@ static DECLCALLBACK(void) tmR3TimerInfo(PVM pVM, PCDBGFINFOHLP pHlp, const char
     for (PTMTIMERR3 pTimer = pVM->tm.s.pCreated; pTimer; pTimer = pTimer->pBigNext)
     {
         pHlp->pfnPrintf(pHlp,
-                        "%p %08RX32 %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
+                        "%p %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
                         pTimer,
-                        pTimer->offNext,
-                        pTimer->offPrev,
+                        pTimer->idxHeap,
                         pTimer->offScheduleNext,
                         tmR3Get5CharClockName(pTimer->enmClock),
                         TMTimerGet(pTimer),
@@ -3068,11 +3299,10 @@ static DECLCALLBACK(void) tmR3TimerInfoActive(PVM pVM, PCDBGFINFOHLP pHlp, const
     NOREF(pszArgs);
     pHlp->pfnPrintf(pHlp,
                     "Active Timers (pVM=%p)\n"
-                    "%.*s %.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
+                    "%.*s %.*s %.*s Clock %18s %18s %6s %-25s Description\n",
                     pVM,
                     sizeof(RTR3PTR) * 2,        "pTimerR3        ",
-                    sizeof(int32_t) * 2,        "offNext         ",
-                    sizeof(int32_t) * 2,        "offPrev         ",
+                    sizeof(int32_t) * 2,        "idxHeap         ",
                     sizeof(int32_t) * 2,        "offSched        ",
                                                 "Time",
                                                 "Expire",
@@ -3080,16 +3310,16 @@ static DECLCALLBACK(void) tmR3TimerInfoActive(PVM pVM, PCDBGFINFOHLP pHlp, const
                                                 "State");
     for (unsigned iQueue = 0; iQueue < TMCLOCK_MAX; iQueue++)
     {
+        /* Listed in heap order, i.e. only the first one is guaranteed to be the next to expire. */
         TM_LOCK_TIMERS(pVM);
-        for (PTMTIMERR3 pTimer = TMTIMER_GET_HEAD(&pVM->tm.s.paTimerQueuesR3[iQueue]);
-             pTimer;
-             pTimer = TMTIMER_GET_NEXT(pTimer))
+        PTMTIMERQUEUE pQueue = &pVM->tm.s.paTimerQueuesR3[iQueue];
+        for (uint32_t idx = 0; idx < pQueue->cActive; idx++)
         {
+            PTMTIMERR3 pTimer = TMTIMER_HEAP_GET_TIMER(pQueue, &TMTIMER_GET_HEAP(pQueue)[idx]);
             pHlp->pfnPrintf(pHlp,
-                            "%p %08RX32 %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
+                            "%p %08RX32 %08RX32 %s %18RU64 %18RU64 %6RU32 %-25s %s\n",
                             pTimer,
-                            pTimer->offNext,
-                            pTimer->offPrev,
+                            pTimer->idxHeap,
                             pTimer->offScheduleNext,
                             tmR3Get5CharClockName(pTimer->enmClock),
                             TMTimerGet(pTimer),
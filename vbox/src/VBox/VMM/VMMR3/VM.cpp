@@ -913,6 +913,9 @@ static int vmR3InitRing3(PVM pVM, PUVM pUVM)
         AssertRC(rc);
     }
 
+    STAM_REL_REG(pVM, &pUVM->vm.s.StatHaltWakeUps,     STAMTYPE_COUNTER, "/VM/Halt/WakeUps",        STAMUNIT_OCCURENCES,    "Number of times an EMT returned from blocking in the halted state.");
+    STAM_REL_REG(pVM, (void *)&pUVM->vm.s.cHaltWakeUpsPerSec, STAMTYPE_U32, "/VM/Halt/WakeUpsPerSec", STAMUNIT_HZ,         "Halted state wake ups per second, all EMTs. (updated once per second)");
+
     STAM_REG(pVM, &pUVM->vm.s.StatReqAllocNew,   STAMTYPE_COUNTER,     "/VM/Req/AllocNew",       STAMUNIT_OCCURENCES,        "Number of VMR3ReqAlloc returning a new packet.");
     STAM_REG(pVM, &pUVM->vm.s.StatReqAllocRaces, STAMTYPE_COUNTER,     "/VM/Req/AllocRaces",     STAMUNIT_OCCURENCES,        "Number of VMR3ReqAlloc causing races.");
     STAM_REG(pVM, &pUVM->vm.s.StatReqAllocRecycled, STAMTYPE_COUNTER,  "/VM/Req/AllocRecycled",  STAMUNIT_OCCURENCES,        "Number of VMR3ReqAlloc returning a recycled packet.");
@@ -2751,6 +2754,7 @@ static DECLCALLBACK(VBOXSTRICTRC) vmR3Reset(PVM pVM, PVMCPU pVCpu, void *pvUser)
         CPUMR3Reset(pVM);
         TMR3Reset(pVM);
         EMR3Reset(pVM);
+        IEMR3Reset(pVM);
         HMR3Reset(pVM);                 /* This must come *after* PATM, CSAM, CPUM, SELM and TRPM. */
 
 #ifdef LOG_ENABLED
@@ -286,6 +286,7 @@ static const char *vmR3GetHaltMethodName(VMHALTMETHOD enmMethod)
         case VMHALTMETHOD_1:            return "method1";
         //case VMHALTMETHOD_2:            return "method2";
         case VMHALTMETHOD_GLOBAL_1:     return "global1";
+        case VMHALTMETHOD_TICKLESS:     return "tickless";
         default:                        return "unknown";
     }
 }
@@ -618,6 +619,31 @@ static DECLCALLBACK(int) vmR3HaltMethod1Halt(PUVMCPU pUVCpu, const uint32_t fMas
 }
 
 
+/**
+ * Accounts for an EMT returning from blocking in GVMM.
+ *
+ * Updates the per VM wake up counter and, once per second, the number of wake
+ * ups per second.
+ *
+ * @param   pUVM            Pointer to the user mode VM structure.
+ * @param   u64Now          The current RTTimeNanoTS() value.
+ */
+static void vmR3HaltAccountWakeUp(PUVM pUVM, uint64_t u64Now)
+{
+    STAM_REL_COUNTER_INC(&pUVM->vm.s.StatHaltWakeUps);
+    uint32_t const cWakeUps = ASMAtomicIncU32(&pUVM->vm.s.cHaltWakeUps);
+
+    uint64_t const u64StartTS = ASMAtomicReadU64(&pUVM->vm.s.u64HaltWakeUpsStartTS);
+    uint64_t const cNsPeriod  = u64Now - u64StartTS;
+    if (   (int64_t)cNsPeriod >= (int64_t)RT_NS_1SEC /* another EMT may have started a new period after we read u64Now */
+        && ASMAtomicCmpXchgU64(&pUVM->vm.s.u64HaltWakeUpsStartTS, u64Now, u64StartTS))
+    {
+        ASMAtomicSubU32(&pUVM->vm.s.cHaltWakeUps, cWakeUps);
+        ASMAtomicWriteU32(&pUVM->vm.s.cHaltWakeUpsPerSec, (uint32_t)((uint64_t)cWakeUps * RT_NS_1SEC / cNsPeriod));
+    }
+}
+
+
 /**
  * Initialize the global 1 halt method.
  *
@@ -733,6 +759,7 @@ static DECLCALLBACK(int) vmR3HaltGlobal1Halt(PUVMCPU pUVCpu, const uint32_t fMas
                 else
                     STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockOnTime,    cNsElapsedSchedHalt);
             }
+            vmR3HaltAccountWakeUp(pUVM, u64EndSchedHalt);
         }
         /*
          * When spinning call upon the GVMM and do some wakups once
@@ -833,6 +860,188 @@ static DECLCALLBACK(void) vmR3HaltGlobal1NotifyCpuFF(PUVMCPU pUVCpu, uint32_t fF
 }
 
 
+/**
+ * Initialize the tickless halt method.
+ *
+ * @return VBox status code.
+ * @param   pUVM            Pointer to the user mode VM structure.
+ */
+static DECLCALLBACK(int) vmR3HaltTicklessInit(PUVM pUVM)
+{
+    /*
+     * The defaults.
+     */
+    uint32_t cNsResolution = SUPSemEventMultiGetResolution(pUVM->vm.s.pSession);
+    if (cNsResolution > 5*RT_NS_100US)
+        pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg = 50000;
+    else if (cNsResolution > RT_NS_100US)
+        pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg = cNsResolution / 4;
+    else
+        pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg = 2000;
+    pUVM->vm.s.Halt.Tickless.cNsSlackCfg    = RT_MAX(cNsResolution, 500000);
+    pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg = RT_NS_1SEC;
+
+    /*
+     * Query overrides.
+     */
+    PCFGMNODE pCfg = CFGMR3GetChild(CFGMR3GetRoot(pUVM->pVM), "/VMM/HaltedTickless");
+    if (pCfg)
+    {
+        /** @cfgm{/VMM/HaltedTickless/SpinBlockThreshold, uint32_t, ns, 0, UINT32_MAX, depends}
+         * Don't block when the next deadline is closer than this, spin instead. */
+        int rc = CFGMR3QueryU32Def(pCfg, "SpinBlockThreshold", &pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg,
+                                   pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg);
+        AssertLogRelRCReturn(rc, rc);
+
+        /** @cfgm{/VMM/HaltedTickless/Slack, uint32_t, ns, 0, 100000000, max(500000, resolution)}
+         * The wake up deadlines are rounded up to a multiple of this (GIP time) so
+         * that timers of all clocks, EMTs and VMs which expire within the same
+         * slack period share one host wake up. 0 disables the rounding. */
+        rc = CFGMR3QueryU32Def(pCfg, "Slack", &pUVM->vm.s.Halt.Tickless.cNsSlackCfg,
+                               pUVM->vm.s.Halt.Tickless.cNsSlackCfg);
+        AssertLogRelRCReturn(rc, rc);
+        if (pUVM->vm.s.Halt.Tickless.cNsSlackCfg > 100 * RT_NS_1MS)
+            return VMSetError(pUVM->pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                              N_("Configuration error: /VMM/HaltedTickless/Slack is out of range (%u ns, max 100 ms)"),
+                              pUVM->vm.s.Halt.Tickless.cNsSlackCfg);
+
+        /** @cfgm{/VMM/HaltedTickless/MaxSleep, uint32_t, ns, 1000000, 1000000000, 1000000000}
+         * How long to block at the most when no timer is armed.  GVMM caps the
+         * blocking to one second anyway. */
+        rc = CFGMR3QueryU32Def(pCfg, "MaxSleep", &pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg,
+                               pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg);
+        AssertLogRelRCReturn(rc, rc);
+        if (   pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg < RT_NS_1MS
+            || pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg > RT_NS_1SEC)
+            return VMSetError(pUVM->pVM, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                              N_("Configuration error: /VMM/HaltedTickless/MaxSleep is out of range (%u ns, 1 ms..1 s)"),
+                              pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg);
+    }
+    LogRel(("HaltedTickless config: cNsSpinBlockThresholdCfg=%u cNsSlackCfg=%u cNsMaxSleepCfg=%u\n",
+            pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg, pUVM->vm.s.Halt.Tickless.cNsSlackCfg,
+            pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg));
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * The tickless halt method - Block in GVMM (ring-0) until the next timer
+ * deadline of any clock, rounded up to the configured slack.
+ *
+ * The rounding is done on the absolute GIP time, which is the same for all
+ * EMTs of all VMs on the host, so deadlines falling into the same slack period
+ * result in a single wake up regardless of which queue, EMT or VM they belong
+ * to.  GVMM will then wake up the other EMTs sharing the deadline when the
+ * first one returns (see gvmmR0SchedDoWakeUps).
+ *
+ * While all EMTs are blocking, TM stops its periodic host timer so that only
+ * the deadlines wake us up (TMR3HaltTicklessEnter).
+ */
+static DECLCALLBACK(int) vmR3HaltTicklessHalt(PUVMCPU pUVCpu, const uint32_t fMask, uint64_t u64Now)
+{
+    PUVM    pUVM  = pUVCpu->pUVM;
+    PVMCPU  pVCpu = pUVCpu->pVCpu;
+    PVM     pVM   = pUVCpu->pVM;
+    Assert(VMMGetCpu(pVM) == pVCpu);
+    NOREF(u64Now);
+
+    uint32_t const cNsSpinBlockThreshold = pUVM->vm.s.Halt.Tickless.cNsSpinBlockThresholdCfg;
+    uint32_t const cNsSlack              = pUVM->vm.s.Halt.Tickless.cNsSlackCfg;
+    uint32_t const cNsMaxSleep           = pUVM->vm.s.Halt.Tickless.cNsMaxSleepCfg;
+
+    /*
+     * Halt loop.
+     */
+    int  rc       = VINF_SUCCESS;
+    bool fBlocked = false;
+    ASMAtomicWriteBool(&pUVCpu->vm.s.fWait, true);
+    unsigned cLoops = 0;
+    for (;; cLoops++)
+    {
+        /*
+         * Work the timers and check if we can exit.
+         */
+        uint64_t const u64StartTimers   = RTTimeNanoTS();
+        TMR3TimerQueuesDo(pVM);
+        uint64_t const cNsElapsedTimers = RTTimeNanoTS() - u64StartTimers;
+        STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltTimers, cNsElapsedTimers);
+        if (    VM_FF_ISPENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+            ||  VMCPU_FF_ISPENDING(pVCpu, fMask))
+            break;
+
+        /*
+         * Get the next deadline and calculate when to wake up.
+         */
+        uint64_t u64Delta;
+        uint64_t u64GipTime = TMR3TimerPollGIPAllClocks(pVM, pVCpu, &u64Delta);
+        if (    VM_FF_ISPENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+            ||  VMCPU_FF_ISPENDING(pVCpu, fMask))
+            break;
+
+        if (u64Delta >= cNsSpinBlockThreshold)
+        {
+            uint64_t const u64NowGip = RTTimeNanoTS();
+            if (u64Delta > cNsMaxSleep)
+                u64GipTime = u64NowGip + cNsMaxSleep;
+            if (cNsSlack)
+                u64GipTime = ((u64GipTime + cNsSlack - 1) / cNsSlack) * cNsSlack;
+
+            VMMR3YieldStop(pVM);
+            if (!fBlocked)
+            {
+                /* Lets TM stop the host timer once all EMTs are blocking. */
+                TMR3HaltTicklessEnter(pVM);
+                fBlocked = true;
+            }
+            if (    VM_FF_ISPENDING(pVM, VM_FF_EXTERNAL_HALTED_MASK)
+                ||  VMCPU_FF_ISPENDING(pVCpu, fMask))
+                break;
+
+            uint64_t const u64StartSchedHalt   = RTTimeNanoTS();
+            rc = SUPR3CallVMMR0Ex(pVM->pVMR0, pVCpu->idCpu, VMMR0_DO_GVMM_SCHED_HALT, u64GipTime, NULL);
+            uint64_t const u64EndSchedHalt     = RTTimeNanoTS();
+            uint64_t const cNsElapsedSchedHalt = u64EndSchedHalt - u64StartSchedHalt;
+            STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlock, cNsElapsedSchedHalt);
+
+            if (rc == VERR_INTERRUPTED)
+                rc = VINF_SUCCESS;
+            else if (RT_FAILURE(rc))
+            {
+                rc = vmR3FatalWaitError(pUVCpu, "VMMR0_DO_GVMM_SCHED_HALT->%Rrc\n", rc);
+                break;
+            }
+            else
+            {
+                int64_t const cNsOverslept = u64EndSchedHalt - u64GipTime;
+                if (cNsOverslept > 50000)
+                    STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockOverslept, cNsOverslept);
+                else if (cNsOverslept < -50000)
+                    STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockInsomnia,  cNsElapsedSchedHalt);
+                else
+                    STAM_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltBlockOnTime,    cNsElapsedSchedHalt);
+            }
+            vmR3HaltAccountWakeUp(pUVM, u64EndSchedHalt);
+        }
+        /*
+         * When spinning call upon the GVMM and do some wakups once
+         * in a while, it's not like we're actually busy or anything.
+         */
+        else if (!(cLoops & 0x1fff))
+        {
+            uint64_t const u64StartSchedYield   = RTTimeNanoTS();
+            rc = SUPR3CallVMMR0Ex(pVM->pVMR0, pVCpu->idCpu, VMMR0_DO_GVMM_SCHED_POLL, false /* don't yield */, NULL);
+            uint64_t const cNsElapsedSchedYield = RTTimeNanoTS() - u64StartSchedYield;
+            STAM_REL_PROFILE_ADD_PERIOD(&pUVCpu->vm.s.StatHaltYield, cNsElapsedSchedYield);
+        }
+    }
+
+    if (fBlocked)
+        TMR3HaltTicklessLeave(pVM);
+    ASMAtomicUoWriteBool(&pUVCpu->vm.s.fWait, false);
+    return rc;
+}
+
+
 /**
  * Bootstrap VMR3Wait() worker.
  *
@@ -990,6 +1199,7 @@ static const struct VMHALTMETHODDESC
     { VMHALTMETHOD_OLD,       NULL,                NULL,   vmR3HaltOldDoHalt,   vmR3DefaultWait,     vmR3DefaultNotifyCpuFF,     NULL },
     { VMHALTMETHOD_1,         vmR3HaltMethod1Init, NULL,   vmR3HaltMethod1Halt, vmR3DefaultWait,     vmR3DefaultNotifyCpuFF,     NULL },
     { VMHALTMETHOD_GLOBAL_1,  vmR3HaltGlobal1Init, NULL,   vmR3HaltGlobal1Halt, vmR3HaltGlobal1Wait, vmR3HaltGlobal1NotifyCpuFF, NULL },
+    { VMHALTMETHOD_TICKLESS,  vmR3HaltTicklessInit, NULL,  vmR3HaltTicklessHalt, vmR3HaltGlobal1Wait, vmR3HaltGlobal1NotifyCpuFF, NULL },
 };
 
 
@@ -21,6 +21,7 @@
 #include <VBox/vmm/stam.h>
 #include <VBox/vmm/cpum.h>
 #include <VBox/param.h>
+#include <iprt/critsect.h>
 
 
 RT_C_DECLS_BEGIN
@@ -128,6 +129,190 @@ typedef IEMFPURESULTTWO *PIEMFPURESULTTWO;
 typedef IEMFPURESULTTWO const *PCIEMFPURESULTTWO;
 
 
+/**
+ * IEM TLB entry.
+ *
+ * Caches the outcome of a guest page table walk and, in ring-3, the host
+ * mapping of the guest physical page it resolved to.
+ */
+typedef struct IEMTLBENTRY
+{
+    /** The TLB entry tag.
+     * Bits 35:0 is the page number of the address (bits 47:12), the bits above
+     * that hold the revision (IEMTLB::uTlbRevision or
+     * IEMTLB::uTlbRevisionGlobal) the entry was loaded under. */
+    uint64_t                uTag;
+    /** The IEMTLBE_F_XXX flags ORed with the physical revision
+     * (IEMTLBE_F_PHYS_REV) pbMappingR3 was established under. */
+    uint64_t                fFlagsAndPhysRev;
+    /** The guest physical address of the page. */
+    RTGCPHYS                GCPhys;
+    /** The ring-3 mapping of the page.  Only valid if the physical revision
+     * matches IEMCPU::uTlbPhysRev and IEMTLBE_F_NO_MAPPINGR3 is clear. */
+    R3PTRTYPE(uint8_t *)    pbMappingR3;
+#if HC_ARCH_BITS == 32
+    uint32_t                u32Padding; /**< Alignment padding. */
+#endif
+} IEMTLBENTRY;
+AssertCompileSize(IEMTLBENTRY, 32);
+/** Pointer to an IEM TLB entry. */
+typedef IEMTLBENTRY *PIEMTLBENTRY;
+
+/** @name IEMTLBE_F_XXX - TLB entry flags (IEMTLBENTRY::fFlagsAndPhysRev).
+ * @{ */
+/** Page tables: Not writable. */
+#define IEMTLBE_F_PT_NO_WRITE           RT_BIT_64(0)
+/** Page tables: Not accessible from user mode. */
+#define IEMTLBE_F_PT_NO_USER            RT_BIT_64(1)
+/** Page tables: Not executable (NX set, honoured only with EFER.NXE). */
+#define IEMTLBE_F_PT_NO_EXEC            RT_BIT_64(2)
+/** Page tables: Global page (G set while CR4.PGE was set). */
+#define IEMTLBE_F_PT_GLOBAL             RT_BIT_64(3)
+/** Physical page: pbMappingR3 is only good for reading. */
+#define IEMTLBE_F_PG_NO_WRITE           RT_BIT_64(4)
+/** Physical page: No ring-3 mapping, accesses must go thru PGM. */
+#define IEMTLBE_F_NO_MAPPINGR3          RT_BIT_64(5)
+/** The physical revision mask. */
+#define IEMTLBE_F_PHYS_REV              UINT64_C(0xffffffffffffff00)
+/** @} */
+
+/** The number of entries in each TLB (power of two). */
+#define IEMTLB_ENTRY_COUNT              64
+/** The TLB revision increment; the revision lives above the 36-bit page
+ * number in IEMTLBENTRY::uTag. */
+#define IEMTLB_REVISION_INCR            RT_BIT_64(36)
+/** The physical revision increment. */
+#define IEMTLB_PHYS_REV_INCR            RT_BIT_64(8)
+/** Calculates the revision-less tag of a guest virtual address. */
+#define IEMTLB_CALC_TAG_NO_REV(a_GCPtr) ( ((uint64_t)(a_GCPtr) << 16) >> (16 + X86_PAGE_4K_SHIFT) )
+/** Converts a revision-less tag to a TLB entry index. */
+#define IEMTLB_TAG_TO_INDEX(a_uTag)     ( (uintptr_t)(a_uTag) & (IEMTLB_ENTRY_COUNT - 1) )
+
+/**
+ * Direct mapped IEM TLB.
+ *
+ * Entries are invalidated wholesale by bumping the revision, INVLPG and
+ * accesses refused with a \#PF are the only things that touch individual
+ * entries.  Global pages are loaded under uTlbRevisionGlobal and survive CR3
+ * loads.
+ */
+typedef struct IEMTLB
+{
+    /** The TLB revision for non-global pages. */
+    uint64_t                uTlbRevision;
+    /** The TLB revision for global pages.  This is always one of the values
+     * uTlbRevision has had, never a greater one. */
+    uint64_t                uTlbRevisionGlobal;
+    /** Number of lookups satisfied by the TLB. */
+    uint32_t                cTlbHits;
+    /** Number of lookups that required a page table walk. */
+    uint32_t                cTlbMisses;
+    /** The TLB entries. */
+    IEMTLBENTRY             aEntries[IEMTLB_ENTRY_COUNT];
+} IEMTLB;
+AssertCompileSizeAlignment(IEMTLB, 8);
+/** Pointer to an IEM TLB. */
+typedef IEMTLB *PIEMTLB;
+
+
+/** The max number of instructions in a cached block. */
+#define IEMBLOCK_MAX_INSTRS             32
+/** The max number of opcode bytes in a cached block. */
+#define IEMBLOCK_MAX_OPCODES            128
+/** The number of blocks in the per-VCPU block cache (power of two). */
+#define IEMBLOCK_CACHE_SIZE             256
+/** Converts a guest physical address to a block cache index. */
+#define IEMBLOCK_CACHE_IDX(a_GCPhys)    ( ((uintptr_t)(a_GCPhys) ^ ((uintptr_t)(a_GCPhys) >> 8)) & (IEMBLOCK_CACHE_SIZE - 1) )
+
+/**
+ * A cached block of instructions, see IEMExecLots.
+ *
+ * The IEM decoder and the instruction implementations are one and the same,
+ * so there is no decoded form to cache.  Instead we remember the instruction
+ * boundaries and opcode bytes of a straight run of instructions within a page,
+ * which lets us skip the CS:rIP translation, access checks and opcode fetching
+ * when replaying it.
+ */
+typedef struct IEMBLOCK
+{
+    /** The guest physical address of the first instruction.  NIL_RTGCPHYS if
+     * the entry is unused. */
+    RTGCPHYS                GCPhys;
+    /** The write generation of the code page (IEMCODEPAGE::uGeneration) when
+     * the block was recorded. */
+    uint32_t                uCodePageGen;
+    /** The CPU mode the block was recorded in (IEMMODE). */
+    uint8_t                 enmCpuMode;
+    /** The number of instructions. */
+    uint8_t                 cInstrs;
+    /** The number of opcode bytes. */
+    uint8_t                 cbOpcodes;
+    /** Explicit alignment padding. */
+    uint8_t                 bAlignment;
+    /** The instruction lengths. */
+    uint8_t                 acbInstrs[IEMBLOCK_MAX_INSTRS];
+    /** The opcode bytes. */
+    uint8_t                 abOpcodes[IEMBLOCK_MAX_OPCODES];
+} IEMBLOCK;
+/** Pointer to a cached block. */
+typedef IEMBLOCK *PIEMBLOCK;
+
+
+/** The number of code pages that can be write monitored at one time (power of
+ * two). */
+#define IEMCODEPAGE_COUNT               256
+/** Converts a guest physical address to a code page index. */
+#define IEMCODEPAGE_IDX(a_GCPhys)       ( (uintptr_t)((a_GCPhys) >> PAGE_SHIFT) & (IEMCODEPAGE_COUNT - 1) )
+/** The number of writes invalidating a page that make it uncacheable. */
+#define IEMCODEPAGE_MAX_WRITES          8
+/** The number of requests to monitor an uncacheable page that are refused
+ * before giving it another chance. */
+#define IEMCODEPAGE_UNCACHEABLE_PERIOD  4096
+
+/**
+ * A write monitored code page.
+ */
+typedef struct IEMCODEPAGE
+{
+    /** The guest physical address of the page, NIL_RTGCPHYS if the slot isn't
+     * monitoring anything. */
+    RTGCPHYS                GCPhys;
+    /** The page the write statistics below apply to.  Unlike GCPhys this
+     * survives the monitoring being stopped by a write. */
+    RTGCPHYS                GCPhysWrites;
+    /** The write generation.  Incremented when the page is written to or the
+     * monitoring ends, which invalidates all blocks recorded from it. */
+    uint32_t volatile       uGeneration;
+    /** Number of times writes invalidated GCPhysWrites while monitored. */
+    uint16_t                cWrites;
+    /** Number of monitoring requests for GCPhysWrites left to refuse.  Set to
+     * IEMCODEPAGE_UNCACHEABLE_PERIOD when cWrites reaches
+     * IEMCODEPAGE_MAX_WRITES, so that pages mixing code and data don't keep
+     * us busy registering and deregistering handlers. */
+    uint16_t                cUncacheable;
+} IEMCODEPAGE;
+/** Pointer to a write monitored code page. */
+typedef IEMCODEPAGE *PIEMCODEPAGE;
+
+/**
+ * The code pages the block caches of all the VCPUs have recorded blocks from.
+ *
+ * The pages are monitored using physical write access handlers, the first
+ * write stops the monitoring again.  Pages written to over and over are not
+ * monitored for a while (IEMCODEPAGE::cUncacheable).  Direct mapped, a new
+ * page simply evicts whatever was monitored in its slot.
+ */
+typedef struct IEMCODEPAGES
+{
+    /** Serializes handler registration and deregistration. */
+    RTCRITSECT              CritSect;
+    /** The monitored pages. */
+    IEMCODEPAGE             aPages[IEMCODEPAGE_COUNT];
+} IEMCODEPAGES;
+/** Pointer to the write monitored code pages. */
+typedef IEMCODEPAGES *PIEMCODEPAGES;
+
+
 #ifdef IEM_VERIFICATION_MODE_FULL
 
 /**
@@ -279,8 +464,6 @@ typedef struct IEMCPU
     RTSEL                   uOldCs;
     /** The RIP of the instruction being interpreted. */
     uint64_t                uOldRip;
-    /** The physical address corresponding to abOpcodes[0]. */
-    RTGCPHYS                GCPhysOpcodes;
 #endif
     /** @}  */
 
@@ -376,6 +559,43 @@ typedef struct IEMCPU
         uint8_t             ab[512];
     } aBounceBuffers[3];
 
+    /** @name Guest virtual address translation caches.
+     * @{ */
+    /** The physical revision for the ring-3 mappings in the TLBs.  Other EMTs
+     * bump this when physical pages change, see
+     * IEMTlbInvalidateAllPhysicalAllCpus. */
+    uint64_t volatile       uTlbPhysRev;
+    /** Incremented by IEMTlbInvalidatePhysRangeAllCpus before it drops the
+     * mappings of a page range from the TLBs, so that a mapping being set up
+     * concurrently isn't kept. */
+    uint64_t volatile       cTlbPhysRangeInvls;
+    /** The instruction fetch TLB. */
+    IEMTLB                  CodeTlb;
+    /** The data TLB (data, stack and system table accesses). */
+    IEMTLB                  DataTlb;
+    /** @} */
+
+    /** @name Decoded block cache (IEMExecLots, ring-3 only).
+     * @{ */
+    /** The physical address corresponding to abOpcodes[0]. */
+    RTGCPHYS                GCPhysOpcodes;
+    /** The block cache (IEMBLOCK_CACHE_SIZE entries), NULL if disabled. */
+    R3PTRTYPE(PIEMBLOCK)    paBlocksR3;
+    /** The write monitored code pages, shared by all VCPUs. */
+    R3PTRTYPE(PIEMCODEPAGES) pCodePagesR3;
+    /** Number of blocks found in the cache. */
+    uint32_t                cBlockHits;
+    /** Number of blocks that had to be recorded. */
+    uint32_t                cBlockMisses;
+    /** Number of blocks found in the cache but invalidated by a write. */
+    uint32_t                cBlockStale;
+    /** Number of blocks not recorded because of frequent writes to the page. */
+    uint32_t                cBlockUncacheable;
+    /** Number of instructions executed from cached opcode bytes. */
+    uint32_t                cBlockInstrsReplayed;
+    uint32_t                u32Alignment5; /**< Alignment padding. */
+    /** @} */
+
 #ifdef IEM_VERIFICATION_MODE_FULL
     /** The event verification records for what IEM did (LIFO). */
     R3PTRTYPE(PIEMVERIFYEVTREC)     pIemEvtRecHead;
@@ -421,6 +641,9 @@ typedef IEMCPU *PIEMCPU;
 #define IEM_ACCESS_PARTIAL_WRITE        UINT32_C(0x00000100)
 /** Used in aMemMappings to indicate that the entry is bounce buffered. */
 #define IEM_ACCESS_BOUNCE_BUFFERED      UINT32_C(0x00000200)
+/** Used in aMemMappings to indicate that the entry is a ring-3 mapping taken
+ * from the TLB and has no PGM mapping lock to release. */
+#define IEM_ACCESS_NOT_LOCKED           UINT32_C(0x00000400)
 /** Read+write data alias. */
 #define IEM_ACCESS_DATA_RW              (IEM_ACCESS_TYPE_READ  | IEM_ACCESS_TYPE_WRITE | IEM_ACCESS_WHAT_DATA)
 /** Write data alias. */
@@ -1346,6 +1569,10 @@ typedef IEMOPSHIFTDBLSIZES const *PCIEMOPSHIFTDBLSIZES;
 
 /** @}  */
 
+#ifdef IN_RING3
+int                 iemR3CodePageMonitor(PVM pVM, PIEMCODEPAGES pCodePages, RTGCPHYS GCPhysPage, uint32_t *puGeneration);
+#endif
+
 
 /** @} */
 
@@ -43,6 +43,8 @@ typedef struct PDMBLKLRULIST *PPDMBLKLRULIST;
 typedef struct PDMBLKCACHEGLOBAL *PPDMBLKCACHEGLOBAL;
 /** Pointer to a cache entry waiter structure. */
 typedef struct PDMBLKCACHEWAITER *PPDMBLKCACHEWAITER;
+/** Pointer to a cache shard. */
+typedef struct PDMBLKCACHESHARD *PPDMBLKCACHESHARD;
 
 /**
  * A cache entry
@@ -59,6 +61,8 @@ typedef struct PDMBLKCACHEENTRY
     PPDMBLKLRULIST                  pList;
     /** Cache the entry belongs to. */
     PPDMBLKCACHE                    pBlkCache;
+    /** The shard managing the LRU state of the entry. */
+    PPDMBLKCACHESHARD               pShard;
     /** Flags for this entry. Combinations of PDMACFILECACHE_* #defines */
     volatile uint32_t               fFlags;
     /** Reference counter. Prevents eviction of the entry if > 0. */
@@ -73,6 +77,8 @@ typedef struct PDMBLKCACHEENTRY
     PPDMBLKCACHEWAITER              pWaitingTail;
     /** Node for dirty but not yet committed entries list per endpoint. */
     RTLISTNODE                      NodeNotCommitted;
+    /** Flag whether the entry was read ahead and not accessed yet. */
+    volatile bool                   fReadAheadUnused;
 } PDMBLKCACHEENTRY, *PPDMBLKCACHEENTRY;
 /** I/O is still in progress for this entry. This entry is not evictable. */
 #define PDMBLKCACHE_ENTRY_IO_IN_PROGRESS RT_BIT(0)
@@ -80,6 +86,10 @@ typedef struct PDMBLKCACHEENTRY
 #define PDMBLKCACHE_ENTRY_LOCKED         RT_BIT(1)
 /** Entry is dirty */
 #define PDMBLKCACHE_ENTRY_IS_DIRTY       RT_BIT(2)
+/** Entry was created by the read-ahead engine. */
+#define PDMBLKCACHE_ENTRY_READ_AHEAD     RT_BIT(3)
+/** Entry doesn't contain valid data because the read-ahead failed. */
+#define PDMBLKCACHE_ENTRY_INVALID        RT_BIT(4)
 /** Entry is not evictable. */
 #define PDMBLKCACHE_NOT_EVICTABLE  (PDMBLKCACHE_ENTRY_LOCKED | PDMBLKCACHE_ENTRY_IO_IN_PROGRESS | PDMBLKCACHE_ENTRY_IS_DIRTY)
 
@@ -97,32 +107,103 @@ typedef struct PDMBLKLRULIST
 } PDMBLKLRULIST;
 
 /**
- * Global cache data.
+ * Replacement policy used by the cache shards.
  */
-typedef struct PDMBLKCACHEGLOBAL
+typedef enum PDMBLKCACHEPOLICY
 {
-    /** Pointer to the owning VM instance. */
-    PVM                 pVM;
-    /** Maximum size of the cache in bytes. */
+    /** Invalid policy. */
+    PDMBLKCACHEPOLICY_INVALID = 0,
+    /** 2Q with a fixed split between the recently and frequently used lists. */
+    PDMBLKCACHEPOLICY_2Q,
+    /** ARC, adapting the target size of the recently used list on ghost hits. */
+    PDMBLKCACHEPOLICY_ARC,
+    /** 32bit hack. */
+    PDMBLKCACHEPOLICY_32BIT_HACK = 0x7fffffff
+} PDMBLKCACHEPOLICY;
+
+/** Maximum number of cache shards. */
+#define PDMBLKCACHE_SHARDS_MAX               64
+/** Shift to get the granule of an offset which is used to select a shard. */
+#define PDMBLKCACHE_SHARD_GRANULE_SHIFT      16
+/** Maximum size of a single cache entry created by the read-ahead engine. */
+#define PDMBLKCACHE_READ_AHEAD_ENTRY_MAX     _64K
+
+/**
+ * Cache shard.
+ *
+ * Each shard manages the LRU state for a subset of the cache entries which is
+ * selected by hashing the endpoint and the offset of the entry.
+ * The shard lock protects the lists and the accounting only, the entries
+ * are still referenced from the AVL tree of the owning endpoint.
+ */
+typedef struct PDMBLKCACHESHARD
+{
+    /** Critical section protecting the shard. */
+    RTCRITSECT          CritSect;
+    /** Pointer to the global cache data. */
+    PPDMBLKCACHEGLOBAL  pCache;
+    /** Maximum size of the shard in bytes. */
     uint32_t            cbMax;
-    /** Current size of the cache in bytes. */
+    /** Current size of the shard in bytes. */
     uint32_t            cbCached;
-    /** Critical section protecting the cache. */
-    RTCRITSECT          CritSect;
-    /** Maximum number of bytes cached. */
+    /** Maximum number of bytes in the recently used list.
+     * This is the adaptive target size when the ARC policy is used. */
     uint32_t            cbRecentlyUsedInMax;
-    /** Maximum number of bytes in the paged out list .*/
+    /** Maximum number of bytes in the recently used ghost list. */
     uint32_t            cbRecentlyUsedOutMax;
+    /** Maximum number of bytes in the frequently used ghost list (ARC only). */
+    uint32_t            cbFrequentlyUsedOutMax;
+    /** Index of the shard. */
+    uint32_t            idxShard;
     /** Recently used cache entries list */
     PDMBLKLRULIST       LruRecentlyUsedIn;
     /** Scorecard cache entry list. */
     PDMBLKLRULIST       LruRecentlyUsedOut;
     /** List of frequently used cache entries */
     PDMBLKLRULIST       LruFrequentlyUsed;
+    /** Ghost list of entries evicted from the frequently used list (ARC only). */
+    PDMBLKLRULIST       LruFrequentlyUsedOut;
+#ifdef VBOX_WITH_STATISTICS
+    /** Hit counter. */
+    STAMCOUNTER         StatHits;
+    /** Miss counter. */
+    STAMCOUNTER         StatMisses;
+    /** Number of entries evicted from the shard. */
+    STAMCOUNTER         StatEvicted;
+    /** Number of hits in one of the ghost lists. */
+    STAMCOUNTER         StatGhostHits;
+#endif
+} PDMBLKCACHESHARD;
+
+/**
+ * Global cache data.
+ */
+typedef struct PDMBLKCACHEGLOBAL
+{
+    /** Pointer to the owning VM instance. */
+    PVM                 pVM;
+    /** Maximum size of the cache in bytes. */
+    uint32_t            cbMax;
+    /** Current size of the cache in bytes, sum of all shards. */
+    volatile uint32_t   cbCached;
+    /** Critical section protecting the list of users and serializing commits. */
+    RTCRITSECT          CritSect;
+    /** The replacement policy. */
+    PDMBLKCACHEPOLICY   enmPolicy;
+    /** Number of shards, power of two. */
+    uint32_t            cShards;
+    /** Pointer to the array of shards. */
+    PPDMBLKCACHESHARD   paShards;
     /** Commit timeout in milli seconds */
     uint32_t            u32CommitTimeoutMs;
     /** Number of dirty bytes needed to start a commit of the data to the disk. */
     uint32_t            cbCommitDirtyThreshold;
+    /** Maximum number of bytes of adjacent dirty entries coalesced into one write. */
+    uint32_t            cbCommitCoalesceMax;
+    /** Number of bytes to read ahead once a stream was detected, 0 to disable. */
+    uint32_t            cbReadAheadDepth;
+    /** Number of consecutive requests matching a pattern before read-ahead starts. */
+    uint32_t            cReadAheadTrigger;
     /** Current number of dirty bytes in the cache. */
     volatile uint32_t   cbDirty;
     /** Flag whether the VM was suspended becaus of an I/O error. */
@@ -154,6 +235,16 @@ typedef struct PDMBLKCACHEGLOBAL
     STAMPROFILEADV      StatTreeRemove;
     /** Number of times a buffer could be reused. */
     STAMCOUNTER         StatBuffersReused;
+    /** Number of bytes read ahead. */
+    STAMCOUNTER         StatReadAheadBytes;
+    /** Number of read ahead entries which were accessed afterwards. */
+    STAMCOUNTER         StatReadAheadHits;
+    /** Number of read ahead transfers which failed. */
+    STAMCOUNTER         StatReadAheadFailed;
+    /** Number of coalesced writes issued during a commit. */
+    STAMCOUNTER         StatCommitCoalesced;
+    /** Number of entries written as part of a coalesced write. */
+    STAMCOUNTER         StatCommitCoalescedEntries;
 #endif
 } PDMBLKCACHEGLOBAL;
 #ifdef VBOX_WITH_STATISTICS
@@ -188,7 +279,7 @@ typedef struct PDMBLKCACHE
     RTSEMRW                       SemRWEntries;
     /** Pointer to the gobal cache data */
     PPDMBLKCACHEGLOBAL            pCache;
-    /** Lock protecting the dirty entries list. */
+    /** Lock protecting the dirty entries list and the read-ahead state. */
     RTSPINLOCK                    LockList;
     /** List of dirty but not committed entries for this endpoint. */
     RTLISTANCHOR                  ListDirtyNotCommitted;
@@ -196,6 +287,23 @@ typedef struct PDMBLKCACHE
     RTLISTNODE                    NodeCacheUser;
     /** Block cache type. */
     PDMBLKCACHETYPE               enmType;
+    /** Size of the medium in bytes, reading ahead is confined to it.
+     * 0 if unknown, which disables reading ahead. */
+    volatile uint64_t             cbMedium;
+    /** Read-ahead stream detector. */
+    struct
+    {
+        /** Start offset of the last read request. */
+        uint64_t                  offLast;
+        /** Size of the last read request. */
+        size_t                    cbLast;
+        /** Distance between the start offsets of the last two requests. */
+        uint64_t                  offStride;
+        /** Number of consecutive requests matching the stride. */
+        uint32_t                  cMatches;
+        /** End of the range which was read ahead already. */
+        uint64_t                  offReadAheadEnd;
+    } ReadAhead;
     /** Type specific data. */
     union
     {
@@ -302,6 +410,13 @@ typedef struct PDMBLKCACHEIOXFER
     RTSGSEG               SgSeg;
     /** S/G buffer. */
     RTSGBUF               SgBuf;
+    /** Number of entries in papEntries if several adjacent entries are written
+     * with a single transfer, 0 otherwise. */
+    uint32_t              cEntries;
+    /** Array of entries the transfer updates, sorted by offset. */
+    PPDMBLKCACHEENTRY    *papEntries;
+    /** Segment array, one segment per entry in papEntries. */
+    PRTSGSEG              paSegs;
 } PDMBLKCACHEIOXFER;
 
 /**
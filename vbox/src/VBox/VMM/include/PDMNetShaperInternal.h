@@ -15,6 +15,9 @@
  * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
  */
 
+/** The maximum nesting depth of bandwidth groups. */
+#define PDM_NETSHAPER_MAX_DEPTH     8
+
 /**
  * Bandwidth group instance data
  */
@@ -24,6 +27,10 @@ typedef struct PDMNSBWGROUP
     R3PTRTYPE(struct PDMNSBWGROUP *)            pNextR3;
     /** Pointer to the shared UVM structure. */
     R3PTRTYPE(struct PDMNETSHAPER *)            pShaperR3;
+    /** Pointer to the parent group, NULL for a top level group (ring-3). */
+    R3PTRTYPE(struct PDMNSBWGROUP *)            pParentR3;
+    /** Pointer to the parent group, NIL for a top level group (ring-0). */
+    R0PTRTYPE(struct PDMNSBWGROUP *)            pParentR0;
     /** Critical section protecting all members below. */
     PDMCRITSECT                                 Lock;
     /** Pointer to the first filter attached to this group. */
@@ -38,10 +45,50 @@ typedef struct PDMNSBWGROUP
     volatile uint32_t                           cbTokensLast;
     /** Timestamp of the last update */
     volatile uint64_t                           tsUpdatedLast;
+    /** Configured burst size in bytes, 0 to derive it from the rate. */
+    uint32_t                                    cbBurst;
     /** Reference counter - How many filters are associated with this group. */
     volatile uint32_t                           cRefs;
+    /** Tokens promised to filters woken up during the current TX thread pass
+     * (ring-3, protected by the shaper lock). */
+    uint32_t                                    cbReserved;
+    /** Round robin start position among the choked filters (ring-3, protected
+     * by the shaper lock). */
+    uint32_t                                    iRoundRobin;
+    /** Time filters spent choked before they were woken up. */
+    STAMPROFILE                                 StatThrottled;
+    /** Number of allocations denied by this group or one of its parents. */
+    STAMCOUNTER                                 StatDenied;
+    /** Number of filters woken up. */
+    STAMCOUNTER                                 StatWakeUps;
 } PDMNSBWGROUP;
 /** Pointer to a bandwidth group. */
 typedef PDMNSBWGROUP *PPDMNSBWGROUP;
 
 
+/**
+ * Calculates the number of tokens in the bucket of a bandwidth group.
+ *
+ * @returns Number of bytes the group can let thru at @a tsNow, UINT32_MAX if
+ *          the group is unlimited.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   tsNow           The current RTTimeSystemNanoTS timestamp.
+ */
+DECLINLINE(uint32_t) pdmNsBwGroupGetTokens(PPDMNSBWGROUP pBwGroup, uint64_t tsNow)
+{
+    uint64_t cbPerSecMax = pBwGroup->cbPerSecMax;
+    if (!cbPerSecMax)
+        return UINT32_MAX;
+
+    uint64_t tsUpdatedLast = pBwGroup->tsUpdatedLast;
+    uint64_t cbTokens      = pBwGroup->cbTokensLast;
+    if (tsNow > tsUpdatedLast)
+    {
+        /* Split the interval to avoid overflows after long idle periods. */
+        uint64_t cNsElapsed = tsNow - tsUpdatedLast;
+        cbTokens += cNsElapsed / (1000 * 1000 * 1000) * cbPerSecMax
+                  + cNsElapsed % (1000 * 1000 * 1000) * cbPerSecMax / (1000 * 1000 * 1000);
+    }
+    return (uint32_t)RT_MIN(cbTokens, pBwGroup->cbBucket);
+}
+
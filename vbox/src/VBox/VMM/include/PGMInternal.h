@@ -714,8 +714,11 @@ typedef union PGMPAGE
         /** 5     - Flag indicating that a write monitored page was written to
          *  when set. */
         uint64_t    fWrittenToY         : 1;
-        /** 7:6   - Unused. */
-        uint64_t    u2Unused0           : 2;
+        /** 6     - Flag indicating that the page content is still on the
+         *  post-copy source and must be fetched before use. */
+        uint64_t    fNotPresentY        : 1;
+        /** 7     - Unused. */
+        uint64_t    u1Unused0           : 1;
         /** 9:8   - The physical handler state (PGM_PAGE_HNDL_VIRT_STATE_*). */
         uint64_t    u2HandlerVirtStateY : 2;
         /** 11:10 - Unused. */
@@ -1037,6 +1040,26 @@ typedef PPGMPAGE *PPPGMPAGE;
  */
 #define PGM_PAGE_IS_FT_DIRTY(a_pPage)           ( (a_pPage)->s.fFTDirtyY )
 
+/**
+ * Marks the page as not present, i.e. its content is still on the post-copy
+ * source.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_SET_NOT_PRESENT(a_pPage)       do { (a_pPage)->s.fNotPresentY = 1; } while (0)
+
+/**
+ * Clears the not present indicator.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_CLEAR_NOT_PRESENT(a_pPage)     do { (a_pPage)->s.fNotPresentY = 0; } while (0)
+
+/**
+ * Checks if the page content is still on the post-copy source.
+ * @returns true/false.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_IS_NOT_PRESENT(a_pPage)        ( (a_pPage)->s.fNotPresentY )
+
 
 /** @name PT usage values (PGMPAGE::u2PDEType).
  *
@@ -3336,7 +3359,10 @@ typedef struct PGM
         uint64_t                    uSaveStartNS;
         /** Pages per second (for statistics). */
         uint32_t                    cPagesPerSecond;
-        uint32_t                    cAlignment;
+        /** The number of RAM pages saved as references to identical pages. */
+        uint32_t                    cDupPages;
+        /** The content hash index used for finding identical RAM pages. */
+        R3PTRTYPE(struct PGMLIVESAVEDUPIDX *) pDupIdxR3;
     } LiveSave;
 
     /** @name   Error injection.
@@ -3377,6 +3403,33 @@ typedef struct PGM
     STAMPROFILE                     StatShModCheck;         /**< Profiles shared module checks. */
     /** @} */
 
+    /** Content based page sharing (dedup scanner) state.
+     * @{ */
+    struct
+    {
+        /** Where the next scan should continue. */
+        RTGCPHYS                    GCPhysNext;
+        /** The max number of pages to look at per scan. */
+        uint32_t                    cPagesPerScan;
+        /** The scan interval in milliseconds. */
+        uint32_t                    cMsInterval;
+        /** Set while a scan is queued or in progress. */
+        bool volatile               fPending;
+        /** Alignment padding. */
+        bool                        afAlignment[3];
+        /** The scan timer (TMCLOCK_REAL). NULL if the scanner is disabled. */
+        PTMTIMERR3                  pTimerR3;
+        STAMCOUNTER                 StatScanned;            /**< The number of pages hashed. */
+        STAMCOUNTER                 StatShared;             /**< The number of pages converted to shared ones. */
+        STAMCOUNTER                 StatMerged;             /**< The number of pages replaced by an identical shared page. */
+        STAMCOUNTER                 StatPasses;             /**< The number of complete passes over guest RAM. */
+        STAMPROFILE                 StatScan;               /**< Profiles the scans. */
+    } Dedup;
+    /** @} */
+
+    /** Post-copy teleportation state (PGMPostCopy.cpp), NULL if not in use. */
+    R3PTRTYPE(struct PGMPOSTCOPY *) pPostCopyR3;
+
 #ifdef VBOX_WITH_STATISTICS
     /** @name Statistics on the heap.
      * @{ */
@@ -3935,6 +3988,16 @@ void            pgmHandlerVirtualDumpPhysPages(PVM pVM);
 #endif
 DECLCALLBACK(void) pgmR3InfoHandlers(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
 int             pgmR3InitSavedState(PVM pVM, uint64_t cbRam);
+#ifdef VBOX_WITH_PAGE_SHARING
+int             pgmR3DedupScanInit(PVM pVM);
+#endif
+int             pgmR3PostCopyFetchPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
+bool            pgmR3PostCopySrcIsEnabled(PVM pVM);
+int             pgmR3PostCopySrcDeferPage(PVM pVM, RTGCPHYS GCPhys);
+int             pgmR3PostCopyTrgDeferPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
+int             pgmR3PostCopyTrgLoadDone(PVM pVM);
+void            pgmR3PostCopyReset(PVM pVM);
+void            pgmR3PostCopyTerm(PVM pVM);
 
 int             pgmPhysAllocPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysAllocLargePage(PVM pVM, RTGCPHYS GCPhys);
@@ -19,6 +19,100 @@
 #define ___TMInline_h
 
 
+/**
+ * Moves a heap entry up towards the root until the heap order is restored.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   paHeap      The heap array of the queue.
+ * @param   idx         The index of the entry to move.
+ * @param   Entry       The entry (not stored yet).
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueHeapSiftUp(PTMTIMERQUEUE pQueue, PTMTIMERHEAPENTRY paHeap, uint32_t idx,
+                                               TMTIMERHEAPENTRY Entry)
+{
+    while (idx > 0)
+    {
+        uint32_t const idxParent = (idx - 1) / 2;
+        if (paHeap[idxParent].u64Expire <= Entry.u64Expire)
+            break;
+        paHeap[idx] = paHeap[idxParent];
+        TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx])->idxHeap = idx;
+        idx = idxParent;
+    }
+    paHeap[idx] = Entry;
+    TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx])->idxHeap = idx;
+}
+
+
+/**
+ * Moves a heap entry down towards the leaves until the heap order is restored.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   paHeap      The heap array of the queue.
+ * @param   idx         The index of the entry to move.
+ * @param   Entry       The entry (not stored yet).
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueHeapSiftDown(PTMTIMERQUEUE pQueue, PTMTIMERHEAPENTRY paHeap, uint32_t idx,
+                                                 TMTIMERHEAPENTRY Entry)
+{
+    uint32_t const cActive = pQueue->cActive;
+    for (;;)
+    {
+        uint32_t idxChild = idx * 2 + 1;
+        if (idxChild >= cActive)
+            break;
+        if (   idxChild + 1 < cActive
+            && paHeap[idxChild + 1].u64Expire < paHeap[idxChild].u64Expire)
+            idxChild++;
+        if (Entry.u64Expire <= paHeap[idxChild].u64Expire)
+            break;
+        paHeap[idx] = paHeap[idxChild];
+        TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx])->idxHeap = idx;
+        idx = idxChild;
+    }
+    paHeap[idx] = Entry;
+    TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx])->idxHeap = idx;
+}
+
+
+/**
+ * Removes a timer from the active timer heap, no state checks.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The timer to remove.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueHeapRemove(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+    uint32_t const          idx    = pTimer->idxHeap;
+    PTMTIMERHEAPENTRY const paHeap = TMTIMER_GET_HEAP(pQueue);
+    Assert(idx < pQueue->cActive);
+    Assert(TMTIMER_HEAP_GET_TIMER(pQueue, &paHeap[idx]) == pTimer);
+
+    uint32_t const idxLast = --pQueue->cActive;
+    if (idx != idxLast)
+    {
+        TMTIMERHEAPENTRY const Last = paHeap[idxLast];
+        if (idx > 0 && Last.u64Expire < paHeap[(idx - 1) / 2].u64Expire)
+            tmTimerQueueHeapSiftUp(pQueue, paHeap, idx, Last);
+        else
+            tmTimerQueueHeapSiftDown(pQueue, paHeap, idx, Last);
+    }
+    pTimer->idxHeap = TMTIMER_HEAP_IDX_NIL;
+
+    if (idx == 0)
+    {
+        ASMAtomicWriteU64(&pQueue->u64Expire, pQueue->cActive ? paHeap[0].u64Expire : INT64_MAX);
+        DBGFTRACE_U64_TAG(pTimer->CTX_SUFF(pVM), pQueue->u64Expire, "tmTimerQueueUnlinkActive");
+    }
+}
+
+
 /**
  * Used to unlink a timer from the active list.
  *
@@ -35,21 +129,7 @@ DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER
            ? enmState == TMTIMERSTATE_ACTIVE
            : enmState == TMTIMERSTATE_PENDING_SCHEDULE || enmState == TMTIMERSTATE_PENDING_STOP_SCHEDULE);
 #endif
-
-    const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-    const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
-    if (pPrev)
-        TMTIMER_SET_NEXT(pPrev, pNext);
-    else
-    {
-        TMTIMER_SET_HEAD(pQueue, pNext);
-        pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-        DBGFTRACE_U64_TAG(pTimer->CTX_SUFF(pVM), pQueue->u64Expire, "tmTimerQueueUnlinkActive");
-    }
-    if (pNext)
-        TMTIMER_SET_PREV(pNext, pPrev);
-    pTimer->offNext = 0;
-    pTimer->offPrev = 0;
+    tmTimerQueueHeapRemove(pQueue, pTimer);
 }
 
 #endif
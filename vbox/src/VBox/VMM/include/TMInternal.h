@@ -174,10 +174,11 @@ typedef struct TMTIMER
     /** Timer relative offset to the next timer in the schedule list. */
     int32_t volatile        offScheduleNext;
 
-    /** Timer relative offset to the next timer in the chain. */
-    int32_t                 offNext;
-    /** Timer relative offset to the previous timer in the chain. */
-    int32_t                 offPrev;
+    /** Index of the timer in the active timer heap of its queue,
+     * TMTIMER_HEAP_IDX_NIL when not linked. */
+    uint32_t                idxHeap;
+    /** Explicit alignment padding. */
+    uint32_t                u32Padding;
 
     /** Pointer to the VM the timer belongs to - R3 Ptr. */
     PVMR3                   pVMR3;
@@ -235,14 +236,30 @@ AssertCompileMemberSize(TMTIMER, enmState, sizeof(uint32_t));
     } while (0)
 #endif
 
-/** Get the previous timer. */
-#define TMTIMER_GET_PREV(pTimer) ((PTMTIMER)((pTimer)->offPrev ? (intptr_t)(pTimer) + (pTimer)->offPrev : 0))
-/** Get the next timer. */
-#define TMTIMER_GET_NEXT(pTimer) ((PTMTIMER)((pTimer)->offNext ? (intptr_t)(pTimer) + (pTimer)->offNext : 0))
-/** Set the previous timer link. */
-#define TMTIMER_SET_PREV(pTimer, pPrev) ((pTimer)->offPrev = (pPrev) ? (intptr_t)(pPrev) - (intptr_t)(pTimer) : 0)
-/** Set the next timer link. */
-#define TMTIMER_SET_NEXT(pTimer, pNext) ((pTimer)->offNext = (pNext) ? (intptr_t)(pNext) - (intptr_t)(pTimer) : 0)
+/** TMTIMER::idxHeap value for timers which aren't in the active timer heap. */
+#define TMTIMER_HEAP_IDX_NIL    UINT32_MAX
+
+
+/**
+ * Active timer heap entry.
+ *
+ * The expire time is copied into the entry when the timer is linked so that
+ * the heap can be maintained without touching the timers, and so that other
+ * threads updating TMTIMER::u64Expire of a timer pending rescheduling cannot
+ * upset the heap order.
+ */
+typedef struct TMTIMERHEAPENTRY
+{
+    /** The expire time the timer was linked with. */
+    uint64_t                u64Expire;
+    /** The timer, offset relative to the queue structure. */
+    int32_t                 offTimer;
+    /** Explicit alignment padding. */
+    uint32_t                u32Padding;
+} TMTIMERHEAPENTRY;
+AssertCompileSize(TMTIMERHEAPENTRY, 16);
+/** Pointer to an active timer heap entry. */
+typedef TMTIMERHEAPENTRY *PTMTIMERHEAPENTRY;
 
 
 /**
@@ -256,14 +273,17 @@ typedef struct TMTIMERQUEUE
      * Updated by EMT when scheduling the queue or modifying the head timer.
      * Assigned UINT64_MAX when there is no head timer. */
     uint64_t                u64Expire;
-    /** Doubly linked list of active timers.
+    /** The active timers, a binary min-heap array of TMTIMERHEAPENTRY keyed on
+     * the expire time (cHeapEntries entries, cActive used).
      *
-     * When no scheduling is pending, this list is will be ordered by expire time (ascending).
-     * Access is serialized by only letting the emulation thread (EMT) do changes.
+     * The heap entry at index 0 is the head timer.  Access is serialized by
+     * only letting the emulation thread (EMT) do changes.  The array is
+     * allocated on the hyper heap and grown by ring-3 when creating timers,
+     * so that linking never needs to allocate.
      *
      * The offset is relative to the queue structure.
      */
-    int32_t                 offActive;
+    int32_t                 offHeap;
     /** List of timers pending scheduling of some kind.
      *
      * Timer stats allowed in the list are TMTIMERSTATE_PENDING_STOPPING,
@@ -275,17 +295,24 @@ typedef struct TMTIMERQUEUE
     int32_t volatile        offSchedule;
     /** The clock for this queue. */
     TMCLOCK                 enmClock;
-    /** Pad the structure up to 32 bytes. */
-    uint32_t                au32Padding[3];
+    /** The number of active timers in the heap. */
+    uint32_t                cActive;
+    /** The number of entries allocated for the heap. */
+    uint32_t                cHeapEntries;
+    /** The number of timers created for this clock (ring-3 only, sizes the heap). */
+    uint32_t                cTimers;
 } TMTIMERQUEUE;
+AssertCompileSize(TMTIMERQUEUE, 32);
 
 /** Pointer to a timer queue. */
 typedef TMTIMERQUEUE *PTMTIMERQUEUE;
 
-/** Get the head of the active timer list. */
-#define TMTIMER_GET_HEAD(pQueue)        ((PTMTIMER)((pQueue)->offActive ? (intptr_t)(pQueue) + (pQueue)->offActive : 0))
-/** Set the head of the active timer list. */
-#define TMTIMER_SET_HEAD(pQueue, pHead) ((pQueue)->offActive = pHead ? (intptr_t)pHead - (intptr_t)(pQueue) : 0)
+/** Get the active timer heap array of a queue. */
+#define TMTIMER_GET_HEAP(pQueue)        ((PTMTIMERHEAPENTRY)((intptr_t)(pQueue) + (pQueue)->offHeap))
+/** Get the timer of a heap entry. */
+#define TMTIMER_HEAP_GET_TIMER(pQueue, pEntry) ((PTMTIMER)((intptr_t)(pQueue) + (pEntry)->offTimer))
+/** Get the head of the active timer heap, NULL if empty. */
+#define TMTIMER_GET_HEAD(pQueue)        ((pQueue)->cActive ? TMTIMER_HEAP_GET_TIMER(pQueue, TMTIMER_GET_HEAP(pQueue)) : (PTMTIMER)NULL)
 
 
 /**
@@ -501,8 +528,16 @@ typedef struct TM
     bool volatile               fRunningQueues;
     /** Indicates that the virtual sync queue is being run. */
     bool volatile               fRunningVirtualSyncQueue;
+    /** Set while pTimer is stopped because all the EMTs are blocking in a
+     * tickless halt.  Protected by TimerCritSect. */
+    bool                        fHostTimerStopped;
+    /** Alignment */
+    bool                        afAlignment3[1];
+    /** The number of EMTs blocking in a tickless halt (TMR3HaltTicklessEnter).
+     * Protected by TimerCritSect. */
+    uint32_t                    cHaltedTickless;
     /** Alignment */
-    bool                        afAlignment3[2];
+    uint32_t                    u32Alignment3;
 
     /** Lock serializing access to the timer lists. */
     PDMCRITSECT                 TimerCritSect;
@@ -626,6 +661,10 @@ typedef struct TM
     STAMPROFILE                 StatVirtualSyncFF;
     /** The timer callback. */
     STAMCOUNTER                 StatTimerCallbackSetFF;
+    /** Host timer (pTimer) ticks. */
+    STAMCOUNTER                 StatTimerCallback;
+    /** Times pTimer was stopped for a tickless halt. */
+    STAMCOUNTER                 StatHostTimerStopped;
 
     /** Calls to TMCpuTickSet. */
     STAMCOUNTER                 StatTSCSet;
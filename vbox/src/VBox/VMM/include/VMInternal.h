@@ -141,6 +141,8 @@ typedef enum
     VMHALTMETHOD_1,
     /** The first go at a more global approach. */
     VMHALTMETHOD_GLOBAL_1,
+    /** GVMM blocking until the next timer deadline, with coalesced wakeups. */
+    VMHALTMETHOD_TICKLESS,
     /** The end of valid methods. (not inclusive of course) */
     VMHALTMETHOD_END,
     /** The usual 32-bit max value. */
@@ -255,6 +257,16 @@ typedef struct VMINTUSERPERVM
     VMHALTMETHOD                    enmHaltMethod;
     /** The index into g_aHaltMethods of the current halt method. */
     uint32_t volatile               iHaltMethod;
+    /** The number of times an EMT was woken up from blocking in the current
+     * period (all EMTs). */
+    uint32_t volatile               cHaltWakeUps;
+    /** The number of wake ups per second in the last period. (updated once per
+     * second) */
+    uint32_t volatile               cHaltWakeUpsPerSec;
+    /** When we started counting wake ups in cHaltWakeUps (RTTimeNanoTS). */
+    uint64_t volatile               u64HaltWakeUpsStartTS;
+    /** Total number of times an EMT was woken up from blocking. */
+    STAMCOUNTER                     StatHaltWakeUps;
     /** @} */
 
     /** @todo Do NOT add new members here or reuse the current, we need to store the config for
@@ -293,6 +305,21 @@ typedef struct VMINTUSERPERVM
             /** The threshold between spinning and blocking. */
             uint32_t                cNsSpinBlockThresholdCfg;
         }                           Global1;
+
+       /**
+        * Like Global1, but sleeps until the next timer deadline of any clock and
+        * rounds it up to a slack boundary so that deadlines close to one
+        * another (and those of other EMTs and VMs) share a single wake up.
+        */
+        struct
+        {
+            /** The threshold between spinning and blocking. */
+            uint32_t                cNsSpinBlockThresholdCfg;
+            /** The deadline rounding granularity (ns), 0 if disabled. */
+            uint32_t                cNsSlackCfg;
+            /** The max time to block when no timer is armed. */
+            uint32_t                cNsMaxSleepCfg;
+        }                           Tickless;
     }                               Halt;
 
     /** Pointer to the DBGC instance data. */
@@ -0,0 +1,327 @@
+/* $Id$ */
+/** @file
+ * IEM Testcase - Emulated instruction throughput.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/cpum.h>
+#include <VBox/vmm/pgm.h>
+#include <VBox/vmm/iem.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/assert.h>
+#include <iprt/getopt.h>
+#include <iprt/initterm.h>
+#include <iprt/message.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+#include <iprt/x86.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+#define TESTCASE    "tstIEMBench"
+
+/** The guest page directory (32-bit, no PSE). */
+#define TST_GCPHYS_PD       UINT32_C(0x00001000)
+/** The guest page table identity mapping the first 4MB. */
+#define TST_GCPHYS_PT       UINT32_C(0x00002000)
+/** Where the test loop lives. */
+#define TST_GCPTR_CODE      UINT32_C(0x00100000)
+/** The start of the data window the loop is walking. */
+#define TST_GCPTR_DATA      UINT32_C(0x00200000)
+/** The stride the loop advances ESI by, a page and a cache line. */
+#define TST_DATA_STRIDE     UINT32_C(0x00001040)
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The number of instructions to emulate. */
+static uint64_t g_cInstructions = _1M;
+/** The number of data pages the loop walks, power of two. */
+static uint32_t g_cDataPages    = 16;
+/** Whether to use IEMExecLots instead of IEMExecOne. */
+static bool     g_fExecLots     = false;
+
+
+/**
+ * @callback_method_impl{FNSTAMR3ENUM, Gets the sample pointer.}
+ */
+static DECLCALLBACK(int) tstIEMBenchStatEnum(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                             STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    NOREF(pszName); NOREF(enmUnit); NOREF(enmVisiblity); NOREF(pszDesc);
+    if (enmType != STAMTYPE_U32)
+        return VERR_INVALID_PARAMETER;
+    *(uint32_t volatile **)pvUser = (uint32_t volatile *)pvSample;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Sets up flat 32-bit paged protected mode and a loop that walks the data
+ * window, then emulates it with IEMExecOne or IEMExecLots.
+ *
+ * Runs on EMT(0).
+ *
+ * @returns VINF_SUCCESS, test failure is reported via RTTEST.
+ * @param   pVM         Pointer to the VM.
+ * @param   hTest       The test handle.
+ */
+static DECLCALLBACK(int) tstIEMBenchWorker(PVM pVM, RTTEST hTest)
+{
+    PVMCPU   pVCpu = VMMGetCpu(pVM);
+    uint32_t const cbWindow = g_cDataPages * PAGE_SIZE;
+
+    /*
+     * The page tables: one PDE pointing to a PT identity mapping 0..4MB.
+     */
+    X86PDE Pde;
+    Pde.u = TST_GCPHYS_PT | X86_PDE_P | X86_PDE_RW | X86_PDE_US;
+    int rc = PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_PD, &Pde, sizeof(Pde));
+    RTTEST_CHECK_RC_OK_RET(hTest, rc, rc);
+    for (uint32_t iPte = 0; iPte < X86_PG_ENTRIES; iPte++)
+    {
+        X86PTE Pte;
+        Pte.u = (iPte << X86_PAGE_4K_SHIFT) | X86_PTE_P | X86_PTE_RW | X86_PTE_US;
+        rc = PGMPhysSimpleWriteGCPhys(pVM, TST_GCPHYS_PT + iPte * sizeof(Pte), &Pte, sizeof(Pte));
+        RTTEST_CHECK_RC_OK_RET(hTest, rc, rc);
+    }
+
+    /*
+     * The loop:
+     *          mov     esi, TST_GCPTR_DATA
+     *      .next:
+     *          mov     eax, [esi]
+     *          add     [esi + 4], eax
+     *          add     esi, TST_DATA_STRIDE
+     *          and     esi, cbWindow - 1
+     *          or      esi, TST_GCPTR_DATA
+     *          jmp     .next
+     */
+    uint8_t abCode[] =
+    {
+        0xbe, 0, 0, 0, 0,
+        0x8b, 0x06,
+        0x01, 0x46, 0x04,
+        0x81, 0xc6, 0, 0, 0, 0,
+        0x81, 0xe6, 0, 0, 0, 0,
+        0x81, 0xce, 0, 0, 0, 0,
+        0xeb, 0xe7
+    };
+    *(uint32_t *)&abCode[1]  = TST_GCPTR_DATA;
+    *(uint32_t *)&abCode[12] = TST_DATA_STRIDE;
+    *(uint32_t *)&abCode[18] = cbWindow - 1;
+    *(uint32_t *)&abCode[24] = TST_GCPTR_DATA;
+    rc = PGMPhysSimpleWriteGCPhys(pVM, TST_GCPTR_CODE, abCode, sizeof(abCode));
+    RTTEST_CHECK_RC_OK_RET(hTest, rc, rc);
+
+    /*
+     * Flat ring-0 segments and paging on.
+     */
+    PCPUMCTX pCtx = CPUMQueryGuestCtxPtr(pVCpu);
+    pCtx->cs.Sel        = pCtx->cs.ValidSel = 0x08;
+    pCtx->cs.fFlags     = CPUMSELREG_FLAGS_VALID;
+    pCtx->cs.u64Base    = 0;
+    pCtx->cs.u32Limit   = UINT32_MAX;
+    pCtx->cs.Attr.u     = 0xc09b;
+    PCPUMSELREG apDataSRegs[] = { &pCtx->ds, &pCtx->es, &pCtx->ss, &pCtx->fs, &pCtx->gs };
+    for (unsigned i = 0; i < RT_ELEMENTS(apDataSRegs); i++)
+    {
+        apDataSRegs[i]->Sel      = apDataSRegs[i]->ValidSel = 0x10;
+        apDataSRegs[i]->fFlags   = CPUMSELREG_FLAGS_VALID;
+        apDataSRegs[i]->u64Base  = 0;
+        apDataSRegs[i]->u32Limit = UINT32_MAX;
+        apDataSRegs[i]->Attr.u   = 0xc093;
+    }
+    pCtx->rip      = TST_GCPTR_CODE;
+    pCtx->rsp      = TST_GCPTR_CODE;
+    pCtx->eflags.u = X86_EFL_1;
+
+    CPUMSetGuestCR4(pVCpu, 0);
+    CPUMSetGuestCR3(pVCpu, TST_GCPHYS_PD);
+    CPUMSetGuestCR0(pVCpu, X86_CR0_PE | X86_CR0_PG | X86_CR0_ET);
+    rc = PGMChangeMode(pVCpu, CPUMGetGuestCR0(pVCpu), CPUMGetGuestCR4(pVCpu), CPUMGetGuestEFER(pVCpu));
+    RTTEST_CHECK_RC_OK_RET(hTest, rc, rc);
+    rc = PGMFlushTLB(pVCpu, TST_GCPHYS_PD, true /*fGlobal*/);
+    RTTEST_CHECK_MSG_RET(hTest, RT_SUCCESS(rc), (hTest, "PGMFlushTLB -> %Rrc\n", rc), rc);
+
+    /*
+     * Run it.
+     */
+    uint64_t const nsStart = RTTimeNanoTS();
+    uint64_t       iInstr;
+    if (!g_fExecLots)
+    {
+        for (iInstr = 0; iInstr < g_cInstructions; iInstr++)
+        {
+            VBOXSTRICTRC rcStrict = IEMExecOne(pVCpu);
+            if (rcStrict != VINF_SUCCESS)
+            {
+                RTTestFailed(hTest, "IEMExecOne -> %Rrc at cs:eip=%04x:%08x after %RU64 instructions\n",
+                             VBOXSTRICTRC_VAL(rcStrict), pCtx->cs.Sel, pCtx->eip, iInstr);
+                break;
+            }
+        }
+    }
+    else
+    {
+        /* IEMExecLots decides how much to do, so count using the IEM statistics. */
+        uint32_t volatile *pcInstructions = NULL;
+        rc = STAMR3Enum(VMR3GetUVM(pVM), "/IEM/CPU0/cInstructions", tstIEMBenchStatEnum, &pcInstructions);
+        RTTEST_CHECK_MSG_RET(hTest, RT_SUCCESS(rc) && pcInstructions, (hTest, "STAMR3Enum -> %Rrc\n", rc), VERR_NOT_FOUND);
+        uint32_t const cInstructionsStart = *pcInstructions;
+        for (iInstr = 0; iInstr < g_cInstructions; iInstr = (uint32_t)(*pcInstructions - cInstructionsStart))
+        {
+            VBOXSTRICTRC rcStrict = IEMExecLots(pVCpu);
+            if (rcStrict != VINF_SUCCESS)
+            {
+                RTTestFailed(hTest, "IEMExecLots -> %Rrc at cs:eip=%04x:%08x after %RU64 instructions\n",
+                             VBOXSTRICTRC_VAL(rcStrict), pCtx->cs.Sel, pCtx->eip, iInstr);
+                break;
+            }
+        }
+    }
+    uint64_t const cNsElapsed = RT_MAX(RTTimeNanoTS() - nsStart, 1);
+
+    RTTestValue(hTest, "Emulation", iInstr * RT_NS_1SEC / cNsElapsed, RTTESTUNIT_INSTRS_PER_SEC);
+    RTTestValue(hTest, "Per instruction", cNsElapsed / RT_MAX(iInstr, 1), RTTESTUNIT_NS_PER_CALL);
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int)
+tstIEMBenchConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    NOREF(pUVM); NOREF(pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = CFGMR3InsertInteger(CFGMR3GetRoot(pVM), "HMEnabled", false);
+        RTTESTI_CHECK_MSG_RET(RT_SUCCESS(rc),
+                              ("CFGMR3InsertInteger(pRoot,\"HMEnabled\",) -> %Rrc\n", rc), rc);
+    }
+    return rc;
+}
+
+
+int main(int argc, char **argv)
+{
+    /*
+     * Init runtime and the test environment.
+     */
+    int rc = RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    if (RT_FAILURE(rc))
+        return RTMsgInitFailure(rc);
+    RTTEST hTest;
+    rc = RTTestCreate(TESTCASE, &hTest);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": RTTestCreate failed: %Rrc\n", rc);
+        return 1;
+    }
+
+    /*
+     * Parse arguments.
+     */
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--instructions",  'i', RTGETOPT_REQ_UINT64 },
+        { "--pages",         'p', RTGETOPT_REQ_UINT32 },
+        { "--lots",          'l', RTGETOPT_REQ_NOTHING },
+    };
+
+    int ch;
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0);
+    while ((ch = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (ch)
+        {
+            case 'i':
+                g_cInstructions = ValueUnion.u64;
+                break;
+
+            case 'p':
+                if (   !ValueUnion.u32
+                    || !RT_IS_POWER_OF_TWO(ValueUnion.u32)
+                    || ValueUnion.u32 > _2M / PAGE_SIZE)
+                {
+                    RTPrintf(TESTCASE ": --pages must be a power of two between 1 and %u\n", _2M / PAGE_SIZE);
+                    return 1;
+                }
+                g_cDataPages = ValueUnion.u32;
+                break;
+
+            case 'l':
+                g_fExecLots = true;
+                break;
+
+            case 'h':
+                RTPrintf("usage: " TESTCASE " [--instructions|-i count] [--pages|-p count] [--lots|-l]\n");
+                return 1;
+
+            case 'V':
+                RTPrintf("$Revision$\n");
+                return 0;
+
+            default:
+                return RTGetOptPrintError(ch, &ValueUnion);
+        }
+    }
+
+    /*
+     * Create the test VM and run the benchmark on EMT(0).
+     */
+    RTTestSub(hTest, g_fExecLots ? "IEMExecLots" : "IEMExecOne");
+    PVM pVM;
+    PUVM pUVM;
+    rc = VMR3Create(1 /*cCpus*/, NULL, NULL, NULL, tstIEMBenchConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstIEMBenchWorker, 2, pVM, hTest);
+        if (RT_FAILURE(rc))
+            RTTestFailed(hTest, "tstIEMBenchWorker failed: rc=%Rrc\n", rc);
+
+        STAMR3Dump(pUVM, "/IEM/*");
+
+        /*
+         * Cleanup.
+         */
+        rc = VMR3PowerOff(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc);
+        rc = VMR3Destroy(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(hTest, "VMR3Destroy failed: rc=%Rrc\n", rc);
+        VMR3ReleaseUVM(pUVM);
+    }
+    else
+        RTTestFailed(hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -0,0 +1,336 @@
+/* $Id$ */
+/** @file
+ * TM Testcase - Timer queue stress and benchmark.
+ */
+
+/*
+ * Copyright (C) 2013 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*******************************************************************************
+*   Header Files                                                               *
+*******************************************************************************/
+#include <VBox/vmm/vm.h>
+#include <VBox/vmm/vmm.h>
+#include <VBox/vmm/tm.h>
+#include <VBox/vmm/stam.h>
+#include <VBox/vmm/cfgm.h>
+#include <VBox/err.h>
+#include <VBox/log.h>
+#include <iprt/assert.h>
+#include <iprt/getopt.h>
+#include <iprt/initterm.h>
+#include <iprt/mem.h>
+#include <iprt/message.h>
+#include <iprt/rand.h>
+#include <iprt/stream.h>
+#include <iprt/string.h>
+#include <iprt/test.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
+
+
+/*******************************************************************************
+*   Defined Constants And Macros                                               *
+*******************************************************************************/
+#define TESTCASE    "tstTMBench"
+
+
+/*******************************************************************************
+*   Structures and Typedefs                                                    *
+*******************************************************************************/
+/**
+ * A test timer.
+ */
+typedef struct TSTTMTIMER
+{
+    /** The timer handle. */
+    PTMTIMERR3      pTimer;
+    /** The expire time it was last armed with. */
+    uint64_t        u64Expire;
+    /** Set when the callback was invoked. */
+    bool            fFired;
+} TSTTMTIMER;
+/** Pointer to a test timer. */
+typedef TSTTMTIMER *PTSTTMTIMER;
+
+
+/*******************************************************************************
+*   Global Variables                                                           *
+*******************************************************************************/
+/** The number of timers to create. */
+static uint32_t     g_cTimers       = 4096;
+/** The number of re-arm rounds. */
+static uint32_t     g_cRounds       = 16;
+/** The number of callbacks invoked. */
+static uint32_t     g_cFired        = 0;
+/** The expire time of the last timer fired, for checking the order. */
+static uint64_t     g_u64LastFired  = 0;
+/** The number of timers fired out of order. */
+static uint32_t     g_cOutOfOrder   = 0;
+
+
+/**
+ * @callback_method_impl{FNTMTIMERINT}
+ */
+static DECLCALLBACK(void) tstTMBenchTimerCallback(PVM pVM, PTMTIMER pTimer, void *pvUser)
+{
+    PTSTTMTIMER pTstTimer = (PTSTTMTIMER)pvUser;
+    NOREF(pVM);
+    Assert(pTstTimer->pTimer == pTimer); NOREF(pTimer);
+
+    if (pTstTimer->u64Expire < g_u64LastFired)
+        g_cOutOfOrder++;
+    g_u64LastFired = pTstTimer->u64Expire;
+    pTstTimer->fFired = true;
+    g_cFired++;
+}
+
+
+/**
+ * Reports the average cost of an operation.
+ */
+static void tstTMBenchReport(RTTEST hTest, const char *pszName, uint64_t nsStart, uint64_t cOps)
+{
+    uint64_t const cNsElapsed = RTTimeNanoTS() - nsStart;
+    RTTestValue(hTest, pszName, cNsElapsed / RT_MAX(cOps, 1), RTTESTUNIT_NS_PER_CALL);
+}
+
+
+/**
+ * Creates lots of timers on the virtual clock and arms, re-arms, stops and
+ * expires them.
+ *
+ * Runs on EMT(0), which is the dedicated timer EMT as there is only one CPU.
+ *
+ * @returns VINF_SUCCESS, test failure is reported via RTTEST.
+ * @param   pVM         Pointer to the VM.
+ * @param   hTest       The test handle.
+ */
+static DECLCALLBACK(int) tstTMBenchWorker(PVM pVM, RTTEST hTest)
+{
+    PVMCPU pVCpu = VMMGetCpu(pVM);
+    PTSTTMTIMER paTimers = (PTSTTMTIMER)RTMemAllocZ(sizeof(paTimers[0]) * g_cTimers);
+    RTTEST_CHECK_RET(hTest, paTimers, VERR_NO_MEMORY);
+
+    /*
+     * Create the timers.
+     */
+    uint64_t nsStart = RTTimeNanoTS();
+    int      rc      = VINF_SUCCESS;
+    uint32_t cTimers;
+    for (cTimers = 0; cTimers < g_cTimers; cTimers++)
+    {
+        rc = TMR3TimerCreateInternal(pVM, TMCLOCK_VIRTUAL, tstTMBenchTimerCallback, &paTimers[cTimers], "tstTMBench",
+                                     &paTimers[cTimers].pTimer);
+        if (RT_FAILURE(rc))
+        {
+            RTTestFailed(hTest, "TMR3TimerCreateInternal failed on timer #%u: %Rrc\n", cTimers, rc);
+            break;
+        }
+    }
+    tstTMBenchReport(hTest, "Create", nsStart, cTimers);
+
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t const cTicksPerSec = TMTimerGetFreq(paTimers[0].pTimer);
+
+        /*
+         * Arm them at random points in the far future, so none expires.
+         */
+        uint64_t u64Now = TMTimerGet(paTimers[0].pTimer);
+        nsStart = RTTimeNanoTS();
+        for (uint32_t i = 0; i < cTimers; i++)
+        {
+            paTimers[i].u64Expire = u64Now + 3600 * cTicksPerSec + RTRandU64Ex(0, cTicksPerSec);
+            TMTimerSet(paTimers[i].pTimer, paTimers[i].u64Expire);
+        }
+        tstTMBenchReport(hTest, "Arm", nsStart, cTimers);
+
+        /*
+         * Re-arm the active timers, which goes thru the reschedule path.
+         */
+        nsStart = RTTimeNanoTS();
+        for (uint32_t iRound = 0; iRound < g_cRounds; iRound++)
+            for (uint32_t i = 0; i < cTimers; i++)
+            {
+                paTimers[i].u64Expire = u64Now + 3600 * cTicksPerSec + RTRandU64Ex(0, cTicksPerSec);
+                TMTimerSet(paTimers[i].pTimer, paTimers[i].u64Expire);
+            }
+        tstTMBenchReport(hTest, "Re-arm", nsStart, (uint64_t)cTimers * g_cRounds);
+
+        /*
+         * Stop them all.
+         */
+        nsStart = RTTimeNanoTS();
+        for (uint32_t i = 0; i < cTimers; i++)
+            TMTimerStop(paTimers[i].pTimer);
+        tstTMBenchReport(hTest, "Stop", nsStart, cTimers);
+        for (uint32_t i = 0; i < cTimers; i++)
+            RTTEST_CHECK(hTest, !TMTimerIsActive(paTimers[i].pTimer));
+
+        /*
+         * Let the virtual clock run and expire all the timers within 10ms,
+         * checking that they are delivered in expire order.
+         */
+        rc = TMR3NotifyResume(pVM, pVCpu);
+        RTTEST_CHECK_RC_OK(hTest, rc);
+        if (RT_SUCCESS(rc))
+        {
+            u64Now = TMTimerGet(paTimers[0].pTimer);
+            for (uint32_t i = 0; i < cTimers; i++)
+            {
+                paTimers[i].u64Expire = u64Now + RTRandU64Ex(0, cTicksPerSec / 100);
+                TMTimerSet(paTimers[i].pTimer, paTimers[i].u64Expire);
+            }
+
+            uint64_t       cRuns        = 0;
+            uint64_t       cNsInQueues  = 0;
+            uint64_t const nsDeadline   = RTTimeNanoTS() + RT_NS_1SEC * 10;
+            while (   g_cFired < cTimers
+                   && RTTimeNanoTS() < nsDeadline)
+            {
+                nsStart = RTTimeNanoTS();
+                TMR3TimerQueuesDo(pVM);
+                cNsInQueues += RTTimeNanoTS() - nsStart;
+                cRuns++;
+                RTThreadYield();
+            }
+            RTTestValue(hTest, "Expire", cNsInQueues / RT_MAX(g_cFired, 1), RTTESTUNIT_NS_PER_CALL);
+            RTTestValue(hTest, "Queue runs", cRuns, RTTESTUNIT_OCCURRENCES);
+
+            RTTEST_CHECK_MSG(hTest, g_cFired == cTimers, (hTest, "Only %u of %u timers fired\n", g_cFired, cTimers));
+            RTTEST_CHECK_MSG(hTest, g_cOutOfOrder == 0, (hTest, "%u timers fired out of order\n", g_cOutOfOrder));
+            for (uint32_t i = 0; i < cTimers; i++)
+                RTTEST_CHECK(hTest, paTimers[i].fFired);
+
+            rc = TMR3NotifySuspend(pVM, pVCpu);
+            RTTEST_CHECK_RC_OK(hTest, rc);
+        }
+    }
+
+    /*
+     * Cleanup.
+     */
+    for (uint32_t i = 0; i < cTimers; i++)
+    {
+        rc = TMR3TimerDestroy(paTimers[i].pTimer);
+        RTTEST_CHECK_RC_OK(hTest, rc);
+    }
+    RTMemFree(paTimers);
+    return VINF_SUCCESS;
+}
+
+
+static DECLCALLBACK(int)
+tstTMBenchConfigConstructor(PUVM pUVM, PVM pVM, void *pvUser)
+{
+    NOREF(pUVM); NOREF(pvUser);
+    int rc = CFGMR3ConstructDefaultTree(pVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = CFGMR3InsertInteger(CFGMR3GetRoot(pVM), "HMEnabled", false);
+        RTTESTI_CHECK_MSG_RET(RT_SUCCESS(rc),
+                              ("CFGMR3InsertInteger(pRoot,\"HMEnabled\",) -> %Rrc\n", rc), rc);
+    }
+    return rc;
+}
+
+
+int main(int argc, char **argv)
+{
+    /*
+     * Init runtime and the test environment.
+     */
+    int rc = RTR3InitExe(argc, &argv, RTR3INIT_FLAGS_SUPLIB);
+    if (RT_FAILURE(rc))
+        return RTMsgInitFailure(rc);
+    RTTEST hTest;
+    rc = RTTestCreate(TESTCASE, &hTest);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf(TESTCASE ": RTTestCreate failed: %Rrc\n", rc);
+        return 1;
+    }
+
+    /*
+     * Parse arguments.
+     */
+    static const RTGETOPTDEF s_aOptions[] =
+    {
+        { "--timers",        't', RTGETOPT_REQ_UINT32 },
+        { "--rounds",        'r', RTGETOPT_REQ_UINT32 },
+    };
+
+    int ch;
+    RTGETOPTUNION ValueUnion;
+    RTGETOPTSTATE GetState;
+    RTGetOptInit(&GetState, argc, argv, s_aOptions, RT_ELEMENTS(s_aOptions), 1, 0);
+    while ((ch = RTGetOpt(&GetState, &ValueUnion)))
+    {
+        switch (ch)
+        {
+            case 't':
+                if (!ValueUnion.u32 || ValueUnion.u32 > _1M)
+                {
+                    RTPrintf(TESTCASE ": --timers must be between 1 and %u\n", _1M);
+                    return 1;
+                }
+                g_cTimers = ValueUnion.u32;
+                break;
+
+            case 'r':
+                g_cRounds = ValueUnion.u32;
+                break;
+
+            case 'h':
+                RTPrintf("usage: " TESTCASE " [--timers|-t count] [--rounds|-r count]\n");
+                return 1;
+
+            case 'V':
+                RTPrintf("$Revision$\n");
+                return 0;
+
+            default:
+                return RTGetOptPrintError(ch, &ValueUnion);
+        }
+    }
+
+    /*
+     * Create the test VM and run the benchmark on EMT(0).
+     */
+    RTTestSubF(hTest, "%u timers", g_cTimers);
+    PVM pVM;
+    PUVM pUVM;
+    rc = VMR3Create(1 /*cCpus*/, NULL, NULL, NULL, tstTMBenchConfigConstructor, NULL, &pVM, &pUVM);
+    if (RT_SUCCESS(rc))
+    {
+        rc = VMR3ReqCallWaitU(pUVM, 0 /*idDstCpu*/, (PFNRT)tstTMBenchWorker, 2, pVM, hTest);
+        if (RT_FAILURE(rc))
+            RTTestFailed(hTest, "tstTMBenchWorker failed: rc=%Rrc\n", rc);
+
+        /*
+         * Cleanup.
+         */
+        rc = VMR3PowerOff(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(hTest, "VMR3PowerOff failed: rc=%Rrc\n", rc);
+        rc = VMR3Destroy(pUVM);
+        if (RT_FAILURE(rc))
+            RTTestFailed(hTest, "VMR3Destroy failed: rc=%Rrc\n", rc);
+        VMR3ReleaseUVM(pUVM);
+    }
+    else
+        RTTestFailed(hTest, "VMR3Create failed: rc=%Rrc\n", rc);
+
+    return RTTestSummaryAndDestroy(hTest);
+}
@@ -270,6 +270,16 @@
     GEN_CHECK_OFF(IEMCPU, aBounceBuffers[1]);
     GEN_CHECK_OFF(IEMCPU, aMemBbMappings);
     GEN_CHECK_OFF(IEMCPU, aMemBbMappings[1]);
+    GEN_CHECK_OFF(IEMCPU, uTlbPhysRev);
+    GEN_CHECK_OFF(IEMCPU, cTlbPhysRangeInvls);
+    GEN_CHECK_OFF(IEMCPU, CodeTlb);
+    GEN_CHECK_OFF(IEMCPU, CodeTlb.aEntries[1]);
+    GEN_CHECK_OFF(IEMCPU, DataTlb);
+    GEN_CHECK_OFF(IEMCPU, DataTlb.aEntries[1]);
+    GEN_CHECK_OFF(IEMCPU, GCPhysOpcodes);
+    GEN_CHECK_OFF(IEMCPU, paBlocksR3);
+    GEN_CHECK_OFF(IEMCPU, pCodePagesR3);
+    GEN_CHECK_OFF(IEMCPU, cBlockHits);
 
     GEN_CHECK_SIZE(IOM);
     GEN_CHECK_OFF(IOM, pTreesRC);
@@ -1093,8 +1103,7 @@
     GEN_CHECK_OFF_DOT(TMTIMER, u.External.pfnTimer);
     GEN_CHECK_OFF(TMTIMER, enmState);
     GEN_CHECK_OFF(TMTIMER, offScheduleNext);
-    GEN_CHECK_OFF(TMTIMER, offNext);
-    GEN_CHECK_OFF(TMTIMER, offPrev);
+    GEN_CHECK_OFF(TMTIMER, idxHeap);
     GEN_CHECK_OFF(TMTIMER, pVMR0);
     GEN_CHECK_OFF(TMTIMER, pVMR3);
     GEN_CHECK_OFF(TMTIMER, pVMRC);
@@ -1105,9 +1114,12 @@
     GEN_CHECK_OFF(TMTIMER, pBigPrev);
     GEN_CHECK_OFF(TMTIMER, pszDesc);
     GEN_CHECK_SIZE(TMTIMERQUEUE);
-    GEN_CHECK_OFF(TMTIMERQUEUE, offActive);
+    GEN_CHECK_OFF(TMTIMERQUEUE, offHeap);
     GEN_CHECK_OFF(TMTIMERQUEUE, offSchedule);
     GEN_CHECK_OFF(TMTIMERQUEUE, enmClock);
+    GEN_CHECK_OFF(TMTIMERQUEUE, cActive);
+    GEN_CHECK_OFF(TMTIMERQUEUE, cHeapEntries);
+    GEN_CHECK_OFF(TMTIMERQUEUE, cTimers);
 
     GEN_CHECK_SIZE(TRPM); // has .mac
     GEN_CHECK_SIZE(TRPMCPU); // has .mac